@@ -0,0 +1,791 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Replayable traffic capture.
+ *
+ * Unlike traffic dumps, which are meant to be analyzed by external tools
+ * and lose the identity of the nodes, captures record each Gnutella message
+ * with a timestamp, the ID of the node it was received from or sent to,
+ * its direction and the peer mode of the node.  This is enough to later
+ * push the received traffic back through the stack, as if it came from
+ * the same set of nodes.
+ *
+ * A capture file starts with a header:
+ *
+ *     magic       4 bytes     "GCAP"
+ *     version     2 bytes     CAPTURE_VERSION
+ *     hlen        2 bytes     length of the file header
+ *     start       8 bytes     capture start time, in us since the Epoch
+ *
+ * followed by records made of a fixed-size header and the message:
+ *
+ *     length      4 bytes     length of the message
+ *     direction   1 byte      enum capture_dir
+ *     flags       1 byte      enum capture_flags
+ *     peermode    1 byte      node_peer_t of the remote node
+ *     net         1 byte      4 for IPv4, 6 for IPv6, 0 if unknown
+ *     stamp       8 bytes     capture time, in us since the Epoch
+ *     node ID     8 bytes     remote node ID, 0 for UDP transmissions
+ *     address     16 bytes    remote address
+ *     port        2 bytes     remote port
+ *     reserved    2 bytes     zero
+ *
+ * All values are stored in big-endian order.
+ *
+ * Replaying is done offline, to make sure nothing is relayed to actual
+ * nodes: each captured node becomes a replay node and the received messages
+ * are parsed as fast as possible, measuring the time spent processing each
+ * message kind.  This provides a reproducible benchmark for the hot paths
+ * of the Gnutella stack.
+ *
+ * Replayed messages are processed exactly like live ones, hence they update
+ * the host caches, the routing tables, the GUESS and dynamic query state,
+ * the search results, etc., all of which are later persisted.  Sandboxing
+ * all these subsystems would alter the very code paths we want to measure,
+ * so instead replaying is refused unless we are running from a throwaway
+ * configuration directory, set through $GTK_GNUTELLA_DIR, whose content is
+ * to be discarded after the replay session.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "capture.h"
+
+#include "gmsg.h"
+#include "nodes.h"
+
+#include "if/gnet_property_priv.h"
+#include "if/core/settings.h"
+
+#include "lib/atoms.h"
+#include "lib/endian.h"
+#include "lib/file.h"
+#include "lib/halloc.h"
+#include "lib/htable.h"
+#include "lib/nid.h"
+#include "lib/stringify.h"
+#include "lib/tm.h"
+#include "lib/tmalloc.h"
+#include "lib/walloc.h"
+#include "lib/xmalloc.h"
+#include "lib/zalloc.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+#define CAPTURE_MAGIC		"GCAP"
+#define CAPTURE_VERSION		1
+#define CAPTURE_HDR_LEN		16			/**< File header length */
+#define CAPTURE_REC_LEN		44			/**< Record header length */
+#define CAPTURE_MAX_LEN		(1024 * 1024)	/**< Max message length */
+
+/**
+ * Capture context.
+ */
+static struct {
+	FILE *f;					/**< Capture file, NULL if not capturing */
+	const char *path;			/**< Path of capture file (atom) */
+	uint64 count;				/**< Records written */
+	bool replaying;				/**< Replay in progress */
+} capture;
+
+enum capture_reader_magic { CAPTURE_READER_MAGIC = 0x1e5fd2a0 };
+
+/**
+ * Capture reader.
+ */
+struct capture_reader {
+	enum capture_reader_magic magic;
+	FILE *f;					/**< Capture file being read */
+	char *buf;					/**< Message buffer (halloc'ed) */
+	size_t size;				/**< Size of message buffer */
+};
+
+static inline void
+capture_reader_check(const struct capture_reader * const cr)
+{
+	g_assert(cr != NULL);
+	g_assert(CAPTURE_READER_MAGIC == cr->magic);
+}
+
+/**
+ * @return current time, in microseconds since the Epoch.
+ */
+static uint64
+capture_now(void)
+{
+	tm_t now;
+
+	tm_now_exact(&now);
+	return tm2us(&now);
+}
+
+/**
+ * Is a capture in progress?
+ */
+bool
+capture_is_active(void)
+{
+	return capture.f != NULL;
+}
+
+/**
+ * @return path of the current capture file, NULL if not capturing.
+ */
+const char *
+capture_path(void)
+{
+	return capture.path;
+}
+
+/**
+ * @return amount of records written in the current capture.
+ */
+uint64
+capture_count(void)
+{
+	return capture.count;
+}
+
+/**
+ * Start capturing traffic into specified file, which is truncated.
+ *
+ * @return TRUE if OK, FALSE on error with errno set.
+ */
+bool
+capture_start(const char *path)
+{
+	char hdr[CAPTURE_HDR_LEN];
+	FILE *f;
+
+	g_assert(path != NULL);
+
+	if (capture.f != NULL || capture.replaying) {
+		errno = EBUSY;
+		return FALSE;
+	}
+
+	f = file_fopen(path, "wb");
+	if (NULL == f)
+		return FALSE;
+
+	memcpy(&hdr[0], CAPTURE_MAGIC, 4);
+	poke_be16(&hdr[4], CAPTURE_VERSION);
+	poke_be16(&hdr[6], CAPTURE_HDR_LEN);
+	poke_be64(&hdr[8], capture_now());
+
+	if (1 != fwrite(hdr, sizeof hdr, 1, f)) {
+		int saved_errno = errno;
+		fclose(f);
+		errno = saved_errno;
+		return FALSE;
+	}
+
+	capture.f = f;
+	capture.path = atom_str_get(path);
+	capture.count = 0;
+
+	if (GNET_PROPERTY(node_debug))
+		g_info("%s(): capturing traffic into %s", G_STRFUNC, path);
+
+	return TRUE;
+}
+
+/**
+ * Stop capturing traffic.
+ */
+void
+capture_stop(void)
+{
+	if (NULL == capture.f)
+		return;
+
+	if (0 != fclose(capture.f))
+		g_warning("%s(): error closing %s: %m", G_STRFUNC, capture.path);
+
+	if (GNET_PROPERTY(node_debug)) {
+		g_info("%s(): captured %s message%s into %s", G_STRFUNC,
+			uint64_to_string(capture.count), plural(capture.count),
+			capture.path);
+	}
+
+	capture.f = NULL;
+	atom_str_free_null(&capture.path);
+}
+
+/**
+ * Write capture record.
+ *
+ * @param dir		direction of the message
+ * @param flags		record flags
+ * @param peermode	peer mode of the remote node
+ * @param nid		ID of the remote node, 0 if none
+ * @param addr		address of the remote node
+ * @param port		port of the remote node
+ * @param header	the Gnutella header
+ * @param data		the message payload
+ * @param len		length of payload
+ */
+static void
+capture_write(enum capture_dir dir, uint8 flags, uint8 peermode, uint64 nid,
+	const host_addr_t addr, uint16 port,
+	const void *header, const void *data, size_t len)
+{
+	char rec[CAPTURE_REC_LEN];
+
+	ZERO(&rec);
+
+	poke_be32(&rec[0], GTA_HEADER_SIZE + len);
+	rec[4] = dir;
+	rec[5] = flags;
+	rec[6] = peermode;
+	poke_be64(&rec[8], capture_now());
+	poke_be64(&rec[16], nid);
+
+	switch (host_addr_net(addr)) {
+	case NET_TYPE_IPV4:
+		rec[7] = 4;
+		poke_be32(&rec[24], host_addr_ipv4(addr));
+		break;
+	case NET_TYPE_IPV6:
+		rec[7] = 6;
+		memcpy(&rec[24], host_addr_ipv6(&addr), 16);
+		break;
+	case NET_TYPE_LOCAL:
+	case NET_TYPE_NONE:
+		break;
+	}
+
+	poke_be16(&rec[40], port);
+
+	if (
+		1 != fwrite(rec, sizeof rec, 1, capture.f) ||
+		1 != fwrite(header, GTA_HEADER_SIZE, 1, capture.f) ||
+		(len != 0 && 1 != fwrite(data, len, 1, capture.f))
+	) {
+		g_warning("error writing to %s: %m -- stopping capture",
+			capture.path);
+		capture_stop();
+		return;
+	}
+
+	capture.count++;
+}
+
+/**
+ * Capture message received from node.
+ */
+void
+capture_rx_packet(const gnutella_node_t *n)
+{
+	if G_LIKELY(NULL == capture.f)
+		return;
+
+	node_check(n);
+
+	capture_write(CAPTURE_RX, NODE_IS_UDP(n) ? CAPTURE_F_UDP : 0,
+		n->peermode, nid_value(NODE_ID(n)), n->addr, n->port,
+		n->header, n->data, n->size);
+}
+
+/**
+ * Capture message block sent via TCP.
+ * If ``from'' is NULL, message was emitted locally.
+ */
+void
+capture_tx_tcp_packet(const gnutella_node_t *from, const gnutella_node_t *to,
+	const pmsg_t *mb)
+{
+	const char *start;
+	uint8 flags = 0;
+
+	if G_LIKELY(NULL == capture.f)
+		return;
+
+	node_check(to);
+	g_assert(pmsg_size(mb) >= GTA_HEADER_SIZE);
+
+	start = pmsg_read_base(mb);
+
+	if (from != NULL)
+		flags |= CAPTURE_F_RELAYED;
+	if (pmsg_prio(mb) != PMSG_P_DATA)
+		flags |= CAPTURE_F_CTRL;
+
+	capture_write(CAPTURE_TX, flags, to->peermode, nid_value(NODE_ID(to)),
+		to->addr, to->port, start, &start[GTA_HEADER_SIZE],
+		pmsg_size(mb) - GTA_HEADER_SIZE);
+}
+
+/**
+ * Capture locally-emitted message block sent via UDP.
+ */
+void
+capture_tx_udp_packet(const gnet_host_t *to, const pmsg_t *mb)
+{
+	const char *start;
+
+	if G_LIKELY(NULL == capture.f)
+		return;
+
+	start = pmsg_read_base(mb);
+
+	/*
+	 * This is only for Gnutella packets, leave DHT messages out.
+	 */
+
+	if (
+		pmsg_size(mb) < GTA_HEADER_SIZE ||
+		GTA_MSG_DHT == gnutella_header_get_function(start)
+	)
+		return;
+
+	capture_write(CAPTURE_TX, CAPTURE_F_UDP, NODE_P_UDP, 0,
+		gnet_host_get_addr(to), gnet_host_get_port(to),
+		start, &start[GTA_HEADER_SIZE], pmsg_size(mb) - GTA_HEADER_SIZE);
+}
+
+/**
+ * Open capture file for reading.
+ *
+ * @return reader, NULL on error with errno set.
+ */
+capture_reader_t *
+capture_reader_open(const char *path)
+{
+	capture_reader_t *cr;
+	char hdr[CAPTURE_HDR_LEN];
+	FILE *f;
+	uint16 hlen;
+
+	f = file_fopen(path, "rb");
+	if (NULL == f)
+		return NULL;
+
+	if (1 != fread(hdr, sizeof hdr, 1, f))
+		goto bad;
+
+	hlen = peek_be16(&hdr[6]);
+
+	if (
+		0 != memcmp(hdr, CAPTURE_MAGIC, 4) ||
+		CAPTURE_VERSION != peek_be16(&hdr[4]) ||
+		hlen < CAPTURE_HDR_LEN
+	)
+		goto bad;
+
+	/*
+	 * Skip any header extension.
+	 */
+
+	if (hlen != CAPTURE_HDR_LEN && 0 != fseek(f, hlen, SEEK_SET))
+		goto bad;
+
+	WALLOC0(cr);
+	cr->magic = CAPTURE_READER_MAGIC;
+	cr->f = f;
+
+	return cr;
+
+bad:
+	fclose(f);
+	errno = EINVAL;
+	return NULL;
+}
+
+/**
+ * Read next record from capture.
+ *
+ * @param cr		the capture reader
+ * @param rec		filled with the record read
+ *
+ * @return TRUE if a record was read, FALSE on EOF or if the capture is
+ * truncated or corrupted.
+ */
+bool
+capture_reader_next(capture_reader_t *cr, struct capture_record *rec)
+{
+	char hdr[CAPTURE_REC_LEN];
+	uint32 len;
+
+	capture_reader_check(cr);
+	g_assert(rec != NULL);
+
+	if (1 != fread(hdr, sizeof hdr, 1, cr->f))
+		return FALSE;
+
+	len = peek_be32(&hdr[0]);
+
+	if (len < GTA_HEADER_SIZE || len > CAPTURE_MAX_LEN)
+		return FALSE;
+
+	if (len > cr->size) {
+		cr->size = len;
+		cr->buf = hrealloc(cr->buf, cr->size);
+	}
+
+	if (1 != fread(cr->buf, len, 1, cr->f))
+		return FALSE;
+
+	rec->dir = hdr[4];
+	rec->flags = hdr[5];
+	rec->peermode = hdr[6];
+	rec->stamp = peek_be64(&hdr[8]);
+	rec->node_id = peek_be64(&hdr[16]);
+
+	switch (hdr[7]) {
+	case 4:
+		rec->addr = host_addr_peek_ipv4(&hdr[24]);
+		break;
+	case 6:
+		rec->addr = host_addr_peek_ipv6(&hdr[24]);
+		break;
+	default:
+		rec->addr = zero_host_addr;
+		break;
+	}
+
+	rec->port = peek_be16(&hdr[40]);
+	rec->data = cr->buf;
+	rec->len = len;
+
+	return TRUE;
+}
+
+/**
+ * Close capture reader and nullify its pointer.
+ */
+void
+capture_reader_close_null(capture_reader_t **cr_ptr)
+{
+	capture_reader_t *cr = *cr_ptr;
+
+	if (cr != NULL) {
+		capture_reader_check(cr);
+		fclose(cr->f);
+		HFREE_NULL(cr->buf);
+		cr->magic = 0;
+		WFREE(cr);
+		*cr_ptr = NULL;
+	}
+}
+
+/**
+ * @return name of replay stage.
+ */
+const char *
+capture_stage_name(enum capture_stage stage)
+{
+	switch (stage) {
+	case CAPTURE_ST_PING:	return "ping";
+	case CAPTURE_ST_PONG:	return "pong";
+	case CAPTURE_ST_PUSH:	return "push";
+	case CAPTURE_ST_QUERY:	return "query";
+	case CAPTURE_ST_HITS:	return "hits";
+	case CAPTURE_ST_VENDOR:	return "vendor";
+	case CAPTURE_ST_OTHER:	return "other";
+	case CAPTURE_ST_COUNT:	break;
+	}
+
+	return "unknown";
+}
+
+/**
+ * @return the replay stage processing the message.
+ */
+static enum capture_stage
+capture_stage_of(const void *header)
+{
+	switch (gnutella_header_get_function(header)) {
+	case GTA_MSG_INIT:				return CAPTURE_ST_PING;
+	case GTA_MSG_INIT_RESPONSE:		return CAPTURE_ST_PONG;
+	case GTA_MSG_PUSH_REQUEST:		return CAPTURE_ST_PUSH;
+	case GTA_MSG_SEARCH:			return CAPTURE_ST_QUERY;
+	case GTA_MSG_SEARCH_RESULTS:	return CAPTURE_ST_HITS;
+	case GTA_MSG_VENDOR:
+	case GTA_MSG_STANDARD:			return CAPTURE_ST_VENDOR;
+	default:						break;
+	}
+
+	return CAPTURE_ST_OTHER;
+}
+
+/**
+ * Record processing time in histogram.
+ */
+static void
+capture_hist_add(struct capture_hist *h, uint64 ns)
+{
+	uint i = 0;
+
+	h->count++;
+	h->total_ns += ns;
+	h->max_ns = MAX(h->max_ns, ns);
+
+	while (i < CAPTURE_HIST_BUCKETS - 1 && ns >= ((uint64) 2 << i))
+		i++;
+
+	h->bucket[i]++;
+}
+
+/**
+ * Compute approximate percentile of the processing times.
+ *
+ * @param h		the histogram
+ * @param p		the percentile, between 0.0 and 1.0
+ *
+ * @return upper bound of the bucket holding the percentile, in nanoseconds.
+ */
+uint64
+capture_hist_percentile(const struct capture_hist *h, double p)
+{
+	uint64 target, seen = 0;
+	uint i;
+
+	if (0 == h->count)
+		return 0;
+
+	target = p * h->count;
+	target = MAX(target, 1);
+
+	for (i = 0; i < CAPTURE_HIST_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if (seen >= target)
+			return MIN((uint64) 2 << i, h->max_ns);
+	}
+
+	return h->max_ns;
+}
+
+/**
+ * @return total allocations made through thread magazines.
+ */
+static uint64
+capture_tmalloc_allocations(void)
+{
+	pslist_t *sl, *list = tmalloc_info_list();
+	uint64 total = 0;
+
+	PSLIST_FOREACH(list, sl) {
+		const tmalloc_info_t *tmi = sl->data;
+
+		tmalloc_info_check(tmi);
+		total += tmi->allocations;
+	}
+
+	tmalloc_info_list_free_null(&list);
+	return total;
+}
+
+/**
+ * A simulated node in a replay.
+ */
+struct capture_node {
+	uint64 id;					/**< Captured node ID, the key */
+	gnutella_node_t *n;			/**< The replay node */
+};
+
+/**
+ * Get replay node for record, creating it if needed.
+ *
+ * @return the replay node, NULL if the record cannot be replayed.
+ */
+static gnutella_node_t *
+capture_replay_node(htable_t *nodes, const struct capture_record *rec,
+	struct capture_replay *report)
+{
+	struct capture_node *cn;
+
+	switch (rec->peermode) {
+	case NODE_P_LEAF:
+	case NODE_P_ULTRA:
+	case NODE_P_NORMAL:
+	case NODE_P_UDP:
+		break;
+	default:
+		return NULL;
+	}
+
+	cn = htable_lookup(nodes, &rec->node_id);
+
+	/*
+	 * The stack may have decided to remove the node whilst processing a
+	 * previous message: create a fresh one, as a reconnection would.
+	 */
+
+	if (cn != NULL && !NODE_IS_CONNECTED(cn->n)) {
+		node_replay_free(cn->n);
+		cn->n = NULL;
+	}
+
+	if (NULL == cn) {
+		WALLOC(cn);
+		cn->id = rec->node_id;
+		cn->n = NULL;
+		htable_insert(nodes, &cn->id, cn);
+	}
+
+	if (NULL == cn->n) {
+		cn->n = node_replay_create(rec->peermode, rec->addr, rec->port);
+		report->nodes++;
+	}
+
+	return cn->n;
+}
+
+/**
+ * Hash table iterator to free replay nodes.
+ */
+static bool
+capture_replay_node_free(const void *unused_key, void *value, void *unused_data)
+{
+	struct capture_node *cn = value;
+
+	(void) unused_key;
+	(void) unused_data;
+
+	if (cn->n != NULL)
+		node_replay_free(cn->n);
+	WFREE(cn);
+
+	return TRUE;
+}
+
+/**
+ * Replay captured traffic through the Gnutella stack.
+ *
+ * Received messages are pushed through the stack as fast as possible,
+ * each captured node being simulated by a replay node.  Transmitted
+ * messages are skipped.
+ *
+ * Replaying must be done offline, so that nothing is relayed to real nodes,
+ * and from a configuration directory that is not the default one, since
+ * the replayed traffic pollutes the state we persist.
+ *
+ * @param path		the capture file
+ * @param report	filled with replay statistics
+ *
+ * @return TRUE if OK, FALSE on error with errno set: EBUSY if capturing,
+ * already replaying or online, EPERM if using the default configuration.
+ */
+bool
+capture_replay(const char *path, struct capture_replay *report)
+{
+	capture_reader_t *cr;
+	struct capture_record rec;
+	htable_t *nodes;
+	uint64 zallocs, tallocs, xallocs;
+	tm_nano_t start, end;
+
+	g_assert(path != NULL);
+	g_assert(report != NULL);
+
+	if (capture.f != NULL || capture.replaying || GNET_PROPERTY(online_mode)) {
+		errno = EBUSY;
+		return FALSE;
+	}
+
+	if (settings_config_dir_is_default()) {
+		errno = EPERM;
+		return FALSE;
+	}
+
+	cr = capture_reader_open(path);
+	if (NULL == cr)
+		return FALSE;
+
+	ZERO(report);
+	capture.replaying = TRUE;
+	nodes = htable_create_any(uint64_mem_hash, NULL, uint64_mem_eq);
+
+	zallocs = zalloc_allocations();
+	tallocs = capture_tmalloc_allocations();
+	xallocs = xmalloc_allocations();
+	tm_precise_time(&start);
+
+	while (capture_reader_next(cr, &rec)) {
+		gnutella_node_t *n;
+		tm_nano_t t0, t1, elapsed;
+		enum capture_stage stage;
+
+		report->records++;
+
+		if (rec.dir != CAPTURE_RX) {
+			report->skipped++;
+			continue;
+		}
+
+		n = capture_replay_node(nodes, &rec, report);
+
+		if (NULL == n) {
+			report->skipped++;
+			continue;
+		}
+
+		stage = capture_stage_of(rec.data);
+
+		tm_precise_time(&t0);
+		node_replay_parse(n, deconstify_pointer(rec.data), rec.len);
+		tm_precise_time(&t1);
+
+		tm_precise_elapsed(&elapsed, &t1, &t0);
+		capture_hist_add(&report->stage[stage], tmn2ns(&elapsed));
+		report->replayed++;
+	}
+
+	tm_precise_time(&end);
+	report->elapsed = tm_precise_elapsed_f(&end, &start);
+	report->zallocs = zalloc_allocations() - zallocs;
+	report->tallocs = capture_tmalloc_allocations() - tallocs;
+	report->xallocs = xmalloc_allocations() - xallocs;
+
+	htable_foreach_remove(nodes, capture_replay_node_free, NULL);
+	htable_free_null(&nodes);
+	capture_reader_close_null(&cr);
+	capture.replaying = FALSE;
+
+	if (GNET_PROPERTY(node_debug)) {
+		g_info("%s(): replayed %s message%s from %s in %g secs",
+			G_STRFUNC, uint64_to_string(report->replayed),
+			plural(report->replayed), path, report->elapsed);
+	}
+
+	return TRUE;
+}
+
+/**
+ * Shutdown capture layer.
+ */
+void
+capture_close(void)
+{
+	capture_stop();
+}
+
+/* vi: set ts=4 sw=4 cindent: */
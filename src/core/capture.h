@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Replayable traffic capture.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _core_capture_h_
+#define _core_capture_h_
+
+#include "common.h"
+
+#include "lib/gnet_host.h"
+#include "lib/host_addr.h"
+#include "lib/pmsg.h"
+
+struct gnutella_node;
+
+#define CAPTURE_HIST_BUCKETS	32	/**< Log2 buckets, in nanoseconds */
+
+/**
+ * Direction of captured messages.
+ */
+enum capture_dir {
+	CAPTURE_RX = 0,				/**< Received message */
+	CAPTURE_TX = 1				/**< Transmitted message */
+};
+
+/**
+ * Captured record flags.
+ */
+enum capture_flags {
+	CAPTURE_F_UDP		= (1 << 0),	/**< Message sent or received via UDP */
+	CAPTURE_F_RELAYED	= (1 << 1),	/**< TX message relayed from another node */
+	CAPTURE_F_CTRL		= (1 << 2)	/**< TX message sent with control priority */
+};
+
+/**
+ * A captured message, as returned by the capture reader.
+ *
+ * The data pointer refers to the reader's internal buffer and remains
+ * valid only until the next record is read.
+ */
+struct capture_record {
+	uint64 stamp;				/**< Time of capture, in us since the Epoch */
+	uint64 node_id;				/**< Node ID, 0 for UDP transmissions */
+	host_addr_t addr;			/**< Remote node address */
+	uint16 port;				/**< Remote node port */
+	uint8 dir;					/**< Direction (enum capture_dir) */
+	uint8 flags;				/**< Flags (enum capture_flags) */
+	uint8 peermode;				/**< Remote node peer mode (node_peer_t) */
+	const void *data;			/**< Message, starting with Gnutella header */
+	size_t len;					/**< Length of message */
+};
+
+/**
+ * Replay stages, one per Gnutella message family.
+ */
+enum capture_stage {
+	CAPTURE_ST_PING = 0,
+	CAPTURE_ST_PONG,
+	CAPTURE_ST_PUSH,
+	CAPTURE_ST_QUERY,
+	CAPTURE_ST_HITS,
+	CAPTURE_ST_VENDOR,
+	CAPTURE_ST_OTHER,
+
+	CAPTURE_ST_COUNT
+};
+
+/**
+ * Latency histogram for a replay stage.
+ */
+struct capture_hist {
+	uint64 count;				/**< Messages processed */
+	uint64 total_ns;			/**< Total processing time */
+	uint64 max_ns;				/**< Maximum processing time */
+	uint64 bucket[CAPTURE_HIST_BUCKETS];	/**< Slot i counts [2^i, 2^(i+1)) */
+};
+
+/**
+ * Replay report.
+ */
+struct capture_replay {
+	uint64 records;				/**< Records read from the capture */
+	uint64 replayed;			/**< RX messages pushed through the stack */
+	uint64 skipped;				/**< TX and unusable records */
+	uint64 zallocs;				/**< zalloc() allocations during replay */
+	uint64 tallocs;				/**< Thread magazine allocations */
+	uint64 xallocs;				/**< xmalloc() allocations during replay */
+	uint nodes;					/**< Replay nodes simulated */
+	double elapsed;				/**< Wall-clock time spent replaying, secs */
+	struct capture_hist stage[CAPTURE_ST_COUNT];
+};
+
+typedef struct capture_reader capture_reader_t;
+
+/*
+ * Public interface.
+ */
+
+bool capture_start(const char *path);
+void capture_stop(void);
+bool capture_is_active(void);
+const char *capture_path(void);
+uint64 capture_count(void);
+
+void capture_rx_packet(const struct gnutella_node *n);
+void capture_tx_tcp_packet(const struct gnutella_node *from,
+	const struct gnutella_node *to, const pmsg_t *mb);
+void capture_tx_udp_packet(const gnet_host_t *to, const pmsg_t *mb);
+
+capture_reader_t *capture_reader_open(const char *path);
+bool capture_reader_next(capture_reader_t *cr, struct capture_record *rec);
+void capture_reader_close_null(capture_reader_t **cr_ptr);
+
+bool capture_replay(const char *path, struct capture_replay *report);
+const char *capture_stage_name(enum capture_stage stage);
+uint64 capture_hist_percentile(const struct capture_hist *h, double p);
+
+void capture_close(void);
+
+#endif /* _core_capture_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
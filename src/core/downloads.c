@@ -93,6 +93,7 @@
 #include "lib/atoms.h"
 #include "lib/base32.h"
 #include "lib/concat.h"
+#include "lib/cq.h"
 #include "lib/dbus_util.h"
 #include "lib/dualhash.h"
 #include "lib/endian.h"
@@ -153,6 +154,8 @@
 #define DOWNLOAD_MAX_PROXIES	8		/**< Keep that many recent proxies */
 #define DOWNLOAD_MAX_UDP_PUSH	4		/**< Contact at most 4 hosts */
 #define DOWNLOAD_CONNECT_DELAY	12		/**< Seconds between connections */
+#define DOWNLOAD_SCHED_FALLBACK	5		/**< Secs between unsolicited pickups */
+#define DOWNLOAD_SCHED_MAXWAIT	3600	/**< Max secs between scheduler runs */
 #define DOWNLOAD_PIPELINE_MSECS	10000	/**< Less than 10 secs away */
 #define DOWNLOAD_FS_SPACE		16384	/**< Min filesystem free space */
 #define DOWNLOAD_PUSH_FREQ		30		/**< Each 30 secs, we allow sending... */
@@ -416,20 +419,25 @@ server_host_info(const struct dl_server *server)
  * This `dl_key' is inserted in the `dl_by_host' hash table were we find a
  * `dl_server' structure describing all the downloads for the given host.
  *
- * All `dl_server' structures are also inserted in the `dl_by_time' struct,
- * where hosts are sorted based on their retry time.
+ * All `dl_server' structures holding waiting downloads are also inserted in
+ * the `dl_by_time' tree, where hosts are sorted based on their retry time.
+ * This is the priority queue used by the download scheduler.
  */
 
 static hikset_t *dl_by_host;
 
-#define DHASH_SIZE	(1UL << 10)	/**< Hash list size, must be a power of 2 */
-#define DHASH_MASK 	(DHASH_SIZE - 1)
-#define DL_HASH(x)	((x) & DHASH_MASK)
+static erbtree_t dl_by_time;		/**< Servers with waiting downloads */
+static uint dl_by_time_change;		/**< Counts changes to the tree */
 
-static struct {
-	plist_t *servers[DHASH_SIZE];	/**< Lists of servers, by retry time */
-	int change[DHASH_SIZE];			/**< Counts changes to the list */
-} dl_by_time;
+/*
+ * The download scheduler runs from a callout queue event, armed to fire
+ * when the next server becomes eligible for a retry, or as soon as possible
+ * when a download slot is released.
+ */
+
+static cevent_t *dl_sched_ev;		/**< Next scheduler run */
+static time_t dl_sched_when;		/**< When dl_sched_ev will fire */
+static time_t dl_sched_last;		/**< Last scheduler run */
 
 /**
  * To handle download meshes, where we only know the IP/port of the host and
@@ -1134,15 +1142,17 @@ dl_retry_cmp(const void *p, const void *q)
 }
 
 /**
- * Compare two `dl_server' structures based on the `retry_after' field.
- * The smaller that time, the smaller the structure is.
+ * Compare servers in the `dl_by_time' tree: by retry time, then by address
+ * to make each node unique.
  */
 static int
-dl_server_retry_cmp(const void *p, const void *q)
+dl_server_sched_cmp(const void *p, const void *q)
 {
 	const struct dl_server *a = p, *b = q;
+	int c;
 
-	return CMP(a->retry_after, b->retry_after);
+	c = CMP(a->retry_after, b->retry_after);
+	return 0 != c ? c : ptr_cmp(a, b);
 }
 
 /**
@@ -1311,6 +1321,8 @@ download_init(void)
 {
 	dl_by_host = hikset_create_any(
 		offsetof(struct dl_server, key), dl_key_hash, dl_key_eq);
+	erbtree_init(&dl_by_time, dl_server_sched_cmp,
+		offsetof(struct dl_server, by_time));
 	dl_by_addr = htable_create_any(dl_addr_hash, NULL, dl_addr_eq);
 	dl_by_guid = htable_create(HASH_KEY_FIXED, GUID_RAW_SIZE);
 	dl_by_id = hikset_create(
@@ -1754,33 +1766,125 @@ buffers_strip_trailing(struct download *d, size_t amount)
 
 /* ----------------------------------------- */
 
+static void download_sched_fire(cqueue_t *cq, void *unused_obj);
+
 /**
- * Insert server by retry time into the `dl_by_time' structure.
+ * Make sure the download scheduler will run at `when' at the latest.
  */
 static void
-dl_by_time_insert(struct dl_server *server)
+download_sched_arm(time_t when)
 {
-	uint idx = DL_HASH(server->retry_after);
+	time_t now = tm_time();
+	time_delta_t delay;
+
+	if (download_shutdown)
+		return;
+
+	if (delta_time(when, now) < 0)
+		when = now;
 
+	if (dl_sched_ev != NULL && delta_time(dl_sched_when, when) <= 0)
+		return;			/* Already scheduled to run soon enough */
+
+	delay = delta_time(when, now);
+	delay = MIN(delay, DOWNLOAD_SCHED_MAXWAIT);
+	dl_sched_when = time_advance(now, delay);
+
+	if (NULL == dl_sched_ev)
+		dl_sched_ev = cq_main_insert(delay * 1000, download_sched_fire, NULL);
+	else
+		cq_resched(dl_sched_ev, delay * 1000);
+}
+
+/**
+ * Signal that a download slot was released, or that some waiting download
+ * may have become schedulable: run the scheduler as soon as possible.
+ */
+static void
+download_sched_wakeup(void)
+{
+	gnet_stats_inc_general(GNR_DL_SCHEDULER_SLOT_WAKEUPS);
+	download_sched_arm(tm_time());
+}
+
+/**
+ * Insert server by retry time into the `dl_by_time' tree, provided it
+ * has waiting downloads.
+ */
+static void
+dl_by_time_insert(struct dl_server *server)
+{
 	g_assert(dl_server_valid(server));
 
-	dl_by_time.change[idx]++;
-	dl_by_time.servers[idx] = plist_insert_sorted(dl_by_time.servers[idx],
-		server, dl_server_retry_cmp);
+	if (server->scheduled || 0 == server_list_length(server, DL_LIST_WAITING))
+		return;
+
+	dl_by_time_change++;
+	erbtree_insert(&dl_by_time, &server->by_time);
+	server->scheduled = TRUE;
+
+	download_sched_arm(server->retry_after);
 }
 
 /**
- * Remove server from the `dl_by_time' structure.
+ * Remove server from the `dl_by_time' tree.
  */
 static void
 dl_by_time_remove(struct dl_server *server)
 {
-	uint idx = DL_HASH(server->retry_after);
-
 	g_assert(dl_server_valid(server));
 
-	dl_by_time.change[idx]++;
-	dl_by_time.servers[idx] = plist_remove(dl_by_time.servers[idx], server);
+	if (!server->scheduled)
+		return;
+
+	dl_by_time_change++;
+	erbtree_remove(&dl_by_time, &server->by_time);
+	server->scheduled = FALSE;
+}
+
+/**
+ * Update the scheduling status of the server after a change to its list
+ * of waiting downloads.
+ */
+static void
+dl_by_time_update(struct dl_server *server, enum dl_list idx)
+{
+	if (DL_LIST_WAITING != idx)
+		return;
+
+	if (0 == server_list_length(server, DL_LIST_WAITING))
+		dl_by_time_remove(server);
+	else
+		dl_by_time_insert(server);
+}
+
+/**
+ * Find the first server in the `dl_by_time' tree that comes after the
+ * position held by (retry, server), which need not be in the tree anymore.
+ *
+ * @return the tree node of the next server, NULL if none.
+ */
+static rbnode_t *
+dl_by_time_after(time_t retry, const struct dl_server *server)
+{
+	rbnode_t *rn = dl_by_time.root, *found = NULL;
+
+	while (rn != NULL) {
+		const struct dl_server *s = erbtree_data(&dl_by_time, rn);
+		int c = CMP(s->retry_after, retry);
+
+		if (0 == c)
+			c = ptr_cmp(s, server);
+
+		if (c > 0) {
+			found = rn;
+			rn = rn->left;
+		} else {
+			rn = rn->right;
+		}
+	}
+
+	return found;
 }
 
 /**
@@ -3257,6 +3361,10 @@ server_list_insert_download_sorted(struct dl_server *server, enum dl_list idx,
 
 	server_sha1_count_inc(server, d);
 	list_insert_sorted(server_list_by_index(server, idx), d, dl_retry_cmp);
+	dl_by_time_update(server, idx);
+
+	if (DL_LIST_WAITING == idx)
+		download_sched_arm(MAX(server->retry_after, d->retry_after));
 }
 
 static void
@@ -3268,6 +3376,7 @@ server_list_append_download(struct dl_server *server, enum dl_list idx,
 
 	server_sha1_count_inc(server, d);
 	list_append(server_list_by_index(server, idx), d);
+	dl_by_time_update(server, idx);
 }
 
 static void
@@ -3279,6 +3388,7 @@ server_list_prepend_download(struct dl_server *server, enum dl_list idx,
 
 	server_sha1_count_inc(server, d);
 	list_prepend(server_list_by_index(server, idx), d);
+	dl_by_time_update(server, idx);
 }
 
 static struct download *
@@ -3305,6 +3415,7 @@ server_list_remove_download(struct dl_server *server, enum dl_list idx,
 	if (0 == server_list_length(server, idx)) {
 		list_free(&server->list[idx]);
 	}
+	dl_by_time_update(server, idx);
 }
 
 /**
@@ -3829,6 +3940,8 @@ download_move_to_list(struct download *d, enum dl_list idx)
 	 */
 
 	if (old_idx == DL_LIST_RUNNING) {
+		download_sched_wakeup();		/* Slot released */
+
 		if (DOWNLOAD_IS_ACTIVE(d))
 			dl_active--;
 		else {
@@ -4131,6 +4244,9 @@ download_remove_from_server(struct download *d, bool reclaim)
 	g_assert(server_list_length(server, idx) > 0);
 	server_list_remove_download(server, idx, d);
 
+	if (DL_LIST_RUNNING == idx)
+		download_sched_wakeup();		/* Slot released */
+
 	if (reclaim)
 		download_reclaim_server(d, FALSE);
 }
@@ -5068,6 +5184,9 @@ download_thaw_queue(void)
 {
 	g_return_if_fail(GNET_PROPERTY(download_queue_frozen) > 0);
 	gnet_prop_decr_guint32(PROP_DOWNLOAD_QUEUE_FROZEN);
+
+	if (!download_queue_is_frozen())
+		download_sched_wakeup();
 }
 
 /**
@@ -6560,6 +6679,32 @@ download_pick_another(const struct download *d)
 	return other;
 }
 
+/**
+ * Record the scheduling latency of download `d', about to be started by the
+ * scheduler: the time elapsed since both the server and the download became
+ * eligible for a retry.
+ */
+static void
+download_sched_latency(const struct download *d, const tm_t *now)
+{
+	const struct dl_server *server = d->server;
+	time_t eligible;
+	time_delta_t connect;
+	long latency;
+
+	eligible = MAX(server->retry_after, d->retry_after);
+	connect = delta_time(eligible, server->last_connect);
+	if (connect < DOWNLOAD_CONNECT_DELAY)
+		eligible = time_advance(server->last_connect, DOWNLOAD_CONNECT_DELAY);
+
+	latency = (now->tv_sec - eligible) * 1000L + now->tv_usec / 1000;
+	latency = MAX(latency, 0);
+
+	gnet_stats_inc_general(GNR_DL_SCHEDULER_STARTS);
+	gnet_stats_count_general(GNR_DL_SCHEDULER_LATENCY_TOTAL, (int) latency);
+	gnet_stats_max_general(GNR_DL_SCHEDULER_LATENCY_MAX, latency);
+}
+
 /**
  * Pick up new downloads from the queue as needed.
  */
@@ -6567,181 +6712,205 @@ static void
 download_pickup_queued(void)
 {
 	time_t now = tm_time();
-	uint i;
+	rbnode_t *rn, *next;
+	tm_t start;
+
+	dl_sched_last = now;
+	tm_now_exact(&start);
+	gnet_stats_inc_general(GNR_DL_SCHEDULER_PASSES);
 
 	/*
-	 * To select downloads, we iterate over the sorted `dl_by_time' list and
-	 * look for something we could schedule.
+	 * To select downloads, we iterate over the sorted `dl_by_time' tree and
+	 * look for something we could schedule.  Only servers with waiting
+	 * downloads are present in the tree.
 	 *
 	 * Note that we jump from one host to the other, even if we have multiple
 	 * things to schedule on the same host: It's better to spread load among
 	 * all hosts first.
 	 */
 
-	for (i = 0; i < DHASH_SIZE; i++) {
-		plist_t *l;
-		int last_change;
+	for (rn = erbtree_first(&dl_by_time); rn != NULL; rn = next) {
+		struct dl_server *server = erbtree_data(&dl_by_time, rn);
+		list_iter_t *iter;
+		struct download *d;
+		uint n, last_change;
+		bool only_special = FALSE;
+
+		g_assert(dl_server_valid(server));
+		g_assert(server->scheduled);
+
+		next = erbtree_next(rn);
 
 		if (download_queue_is_frozen())
 			break;
 
 		if (count_running_downloads() >= GNET_PROPERTY(max_downloads))
-			break;
+			break;		/* Will be woken up when a slot is released */
 
 		if (!bws_can_connect(SOCK_TYPE_DOWNLOAD))
 			break;
 
-	retry:
-		l = dl_by_time.servers[i];
-		last_change = dl_by_time.change[i];
+		/*
+		 * Tree is sorted, so as soon as we go beyond the current time,
+		 * we can stop: the scheduler was armed for that server.
+		 */
 
-		for (/* NOTHING */; NULL != l; l = plist_next(l)) {
-			struct dl_server *server = l->data;
-			list_iter_t *iter;
-			struct download *d;
-			uint n;
-			bool only_special = FALSE;
+		if (delta_time(now, server->retry_after) < 0) {
+			download_sched_arm(server->retry_after);
+			break;
+		}
 
-			g_assert(dl_server_valid(server));
+		gnet_stats_inc_general(GNR_DL_SCHEDULER_SERVERS_VISITED);
 
-			if (count_running_downloads() >= GNET_PROPERTY(max_downloads))
-				break;
+		if (
+			count_running_on_server(server)
+				>= GNET_PROPERTY(max_host_downloads)
+		) {
+			download_list_send_head_ping(server->list[DL_LIST_WAITING]);
 
 			/*
-			 * List is sorted, so as soon as we go beyond the current time,
-			 * we can stop.
+			 * Normally, special downloads are served by remote servents
+			 * regardless of the amount of upload slots or per host
+			 * restrictions (since these downloads are small, usually).
+			 *
+			 * Hence, allow such special downloads to be scheduled even
+			 * if we reached the configured local maximum.
 			 */
 
-			if (delta_time(now, server->retry_after) < 0)
-				break;
+			only_special = TRUE;
+		}
 
-			if (server_list_length(server, DL_LIST_WAITING) == 0)
-				continue;
+		/*
+		 * Avoid hammering servers.  In case we have multiple files queued
+		 * on that server, we must not issue all the requests in a short
+		 * period of time as this can be frowned upon.
+		 */
 
-			if (
-				count_running_on_server(server)
-					>= GNET_PROPERTY(max_host_downloads)
-			) {
-				download_list_send_head_ping(server->list[DL_LIST_WAITING]);
+		if (delta_time(now, server->last_connect) < DOWNLOAD_CONNECT_DELAY) {
+			download_sched_arm(
+				time_advance(server->last_connect, DOWNLOAD_CONNECT_DELAY));
+			continue;
+		}
 
-				/*
-				 * Normally, special downloads are served by remote servents
-				 * regardless of the amount of upload slots or per host
-				 * restrictions (since these downloads are small, usually).
-				 *
-				 * Hence, allow such special downloads to be scheduled even
-				 * if we reached the configured local maximum.
-				 */
+		/*
+		 * OK, select a download within the waiting list, but do not
+		 * remove it yet.  This will be done by download_start().
+		 */
 
-				only_special = TRUE;
-			}
+		g_assert(server->list[DL_LIST_WAITING]);	/* Since scheduled */
 
-			/*
-			 * Avoid hammering servers.  In case we have multiple files queued
-			 * on that server, we must not issue all the requests in a short
-			 * period of time as this can be frowned upon.
-			 */
+		n = 0;
+		d = NULL;
+		iter = list_iter_before_head(server->list[DL_LIST_WAITING]);
+		while (list_iter_has_next(iter)) {
+			struct download *cur;
 
-			if (delta_time(now, server->last_connect) < DOWNLOAD_CONNECT_DELAY)
-				continue;
+			cur = list_iter_next(iter);
+			download_check(cur);
 
-			/*
-			 * OK, select a download within the waiting list, but do not
-			 * remove it yet.  This will be done by download_start().
-			 */
+			if (cur->flags & (DL_F_SUSPENDED | DL_F_PAUSED))
+				continue;
 
-			g_assert(server->list[DL_LIST_WAITING]);	/* Since count != 0 */
+			if (only_special && !download_is_special(cur))
+				continue;
 
-			n = 0;
-			d = NULL;
-			iter = list_iter_before_head(server->list[DL_LIST_WAITING]);
-			while (list_iter_has_next(iter)) {
-				struct download *cur;
+			if (download_has_enough_active_sources(cur)) {
+				download_send_head_ping(cur);
+				continue;
+			}
 
-				cur = list_iter_next(iter);
-				download_check(cur);
+			if (
+				delta_time(now, cur->last_update) <=
+					(time_delta_t) cur->timeout_delay
+			) {
+				download_send_head_ping(cur);
+				continue;
+			}
 
-				if (cur->flags & (DL_F_SUSPENDED | DL_F_PAUSED))
-					continue;
+			/* Note that we skip over paused and suspended downloads */
+			if (delta_time(now, cur->retry_after) < 0) {
+				download_sched_arm(cur->retry_after);
+				break;	/* List is sorted */
+			}
 
-				if (only_special && !download_is_special(cur))
-					continue;
+			if (d) {
+				if ((NULL != d->thex) == (NULL != cur->thex)) {
+					/*
+					 * Pick the download with the most progress. Otherwise
+					 * we easily end up with dozens of partials from the
+					 * the server.
+					 */
 
-				if (download_has_enough_active_sources(cur)) {
-					download_send_head_ping(cur);
-					continue;
+					if (
+						download_total_progress(d)
+							>= download_total_progress(cur)
+					) {
+						download_send_head_ping(cur);
+						continue;
+					}
 				}
 
-				if (
-					delta_time(now, cur->last_update) <=
-						(time_delta_t) cur->timeout_delay
-				) {
+				/* Give priority to THEX downloads */
+				if (d->thex && NULL == cur->thex) {
 					download_send_head_ping(cur);
 					continue;
 				}
+			}
 
-				/* Note that we skip over paused and suspended downloads */
-				if (delta_time(now, cur->retry_after) < 0)
-					break;	/* List is sorted */
+			if (d)
+				download_send_head_ping(d);
 
-				if (d) {
-					if ((NULL != d->thex) == (NULL != cur->thex)) {
-						/*
-						 * Pick the download with the most progress. Otherwise
-						 * we easily end up with dozens of partials from the
-						 * the server.
-						 */
+			d = cur;
 
-						if (
-							download_total_progress(d)
-								>= download_total_progress(cur)
-						) {
-							download_send_head_ping(cur);
-							continue;
-						}
-					}
+			/*
+			 * If there are a lot of downloads queued at a single server we
+			 * might spend a lot of time scanning the queue of a download
+			 * to pick. Thus limit the amount of items we're going to take
+			 * into account.
+			 */
 
-					/* Give priority to THEX downloads */
-					if (d->thex && NULL == cur->thex) {
-						download_send_head_ping(cur);
-						continue;
-					}
-				}
+			if (n++ > 100)
+				break;
+		}
+		list_iter_free(&iter);
 
-				if (d)
-					download_send_head_ping(d);
+		if (NULL == d)
+			continue;
 
-				d = cur;
+		/*
+		 * It's possible that download_start() ended-up changing the
+		 * dl_by_time tree we're iterating over.  That's why all changes
+		 * to that tree update the dl_by_time_change variable, which we
+		 * snapshot before starting.  We then resume right after the
+		 * position held by the server, which may no longer be in the tree.
+		 *		--RAM, 24/08/2002.
+		 */
 
-				/*
-				 * If there are a lot of downloads queued at a single server we
-				 * might spend a lot of time scanning the queue of a download
-				 * to pick. Thus limit the amount of items we're going to take
-				 * into account.
-				 */
+		{
+			time_t retry = server->retry_after;
 
-				if (n++ > 100)
-					break;
-			}
-			list_iter_free(&iter);
+			last_change = dl_by_time_change;
+			download_sched_latency(d, &start);
+			download_start(d, FALSE);
 
-			if (d) {
-				download_start(d, FALSE);
-			}
+			if (last_change != dl_by_time_change)
+				next = dl_by_time_after(retry, server);
+		}
+	}
+}
 
+/**
+ * Callout queue event to run the download scheduler.
+ */
+static void
+download_sched_fire(cqueue_t *cq, void *unused_obj)
+{
+	(void) unused_obj;
 
-			/*
-			 * It's possible that download_start() ended-up changing the
-			 * dl_by_time list we're iterating over.  That's why all changes
-			 * to that list update the dl_by_time_change variable, which we
-			 * snapshot upon entry into the loop.
-			 *		--RAM, 24/08/2002.
-			 */
+	cq_zero(cq, &dl_sched_ev);
 
-			if (last_change != dl_by_time.change[i])
-				goto retry;
-		}
-	}
+	if (GNET_PROPERTY(is_inet_connected))
+		download_pickup_queued();
 }
 
 /**
@@ -9247,11 +9416,11 @@ download_flush(struct download *d, bool *trimmed, bool may_stop)
 
 		iov = buffers_to_iovec(d, &n);
 		ret = file_object_pwritev(d->out_file, iov, n, d->pos);
-		HFREE_NULL(iov);
 
 		b->mode = DL_BUF_READING;
 
 		if ((ssize_t) -1 == ret || 0 == ret) {
+			HFREE_NULL(iov);
 			if (0 == written) {
 				written = ret;
 			}
@@ -9262,6 +9431,8 @@ download_flush(struct download *d, bool *trimmed, bool may_stop)
 			g_assert(size <= b->held);
 
 			file_info_update(d, d->pos, d->pos + size, DL_CHUNK_DONE);
+			file_info_hash_data(d->file_info, d->pos, iov, n, size);
+			HFREE_NULL(iov);
 			gnet_prop_set_guint64_val(PROP_DL_BYTE_COUNT,
 				GNET_PROPERTY(dl_byte_count) + size);
 
@@ -10093,6 +10264,9 @@ download_handle_thex_uri_header(struct download *d, header_t *header)
 		file_info_got_tth(d->file_info, &tth);
 	}
 
+	if (d->file_info->tth != NULL)
+		file_info_tigertree_load(d->file_info);
+
 	if (
 		d->file_info->tth &&
 		!(DL_F_FETCH_TTH & d->flags) &&
@@ -15272,6 +15446,7 @@ download_move_start(struct download *d)
 	g_assert(d->status == GTA_DL_MOVE_WAIT);
 
 	d->file_info->copied = 0;
+	d->file_info->copy_elapsed = 0;
 	download_set_status(d, GTA_DL_MOVING);
 }
 
@@ -15279,12 +15454,13 @@ download_move_start(struct download *d)
  * Called to register the current moving progress.
  */
 void
-download_move_progress(struct download *d, filesize_t copied)
+download_move_progress(struct download *d, filesize_t copied, uint elapsed)
 {
 	download_check(d);
 	g_assert(d->status == GTA_DL_MOVING);
 
 	d->file_info->copied = copied;
+	d->file_info->copy_elapsed = elapsed;
 	file_info_changed(d->file_info);
 }
 
@@ -15553,6 +15729,7 @@ download_verify_sha1(struct download *d)
 {
 	bool inserted;
 	fileinfo_t *fi;
+	filesize_t hashed;
 
 	download_check(d);
 	fi = d->file_info;
@@ -15595,13 +15772,43 @@ download_verify_sha1(struct download *d)
 	queue_suspend_downloads_with_file(fi, TRUE);
 	d->flags &= ~DL_F_CLONED;		/* Has to be persisted until SHA-1 is OK */
 
-	inserted = verify_sha1_enqueue(TRUE, download_pathname(d),
-					download_filesize(d), download_verify_sha1_callback, d);
+	/*
+	 * If data was hashed incrementally whilst downloading, only the part
+	 * that could not be hashed in order needs to be read back: when the
+	 * whole file was hashed, the verification thread will just finalize
+	 * the digest.
+	 */
+
+	hashed = file_info_hashed(fi);
+
+	if (hashed != 0) {
+		filesize_t tail = download_filesize(d) - hashed;
+
+		if (0 == tail)
+			gnet_stats_inc_general(GNR_SHA1_INCREMENTAL_VERIFICATIONS);
+		gnet_stats_set_general(GNR_SHA1_INCREMENTAL_TAIL_BYTES,
+			gnet_stats_get_general(GNR_SHA1_INCREMENTAL_TAIL_BYTES) + tail);
+
+		if (GNET_PROPERTY(verify_debug) > 1) {
+			g_debug("resuming SHA-1 of %s at offset %s (%s bytes left)",
+				download_pathname(d), filesize_to_string(hashed),
+				filesize_to_string2(tail));
+		}
+
+		inserted = verify_sha1_enqueue_resume(TRUE, download_pathname(d),
+						hashed, download_filesize(d),
+						file_info_hash_context(fi),
+						download_verify_sha1_callback, d);
+	} else {
+		inserted = verify_sha1_enqueue(TRUE, download_pathname(d),
+						download_filesize(d), download_verify_sha1_callback, d);
+	}
 
 	g_assert(inserted); /* There cannot be duplicates */
 
+	file_info_hash_discard(fi);
 	fi->flags |= FI_F_VERIFYING;
-	fi->vrfy_hashed = 0;
+	fi->vrfy_hashed = hashed;
 	fi->tth_check = FALSE;
 }
 
@@ -15741,6 +15948,7 @@ download_verify_tigertree_done(struct download *d,
 
 	fi = d->file_info;
 	file_info_check(fi);
+	file_info_tigertree_load(fi);
 	fi->flags &= ~FI_F_VERIFYING;
 	fi->vrfy_elapsed = elapsed;
 	fi->vrfy_hashed = fi->size;
@@ -16052,7 +16260,7 @@ download_close(void)
 
 	download_store();			/* Save latest copy */
 	download_freeze_queue();
-	file_info_store();			/* Must do BEFORE we remove downloads */
+	file_info_store_all();		/* Must do BEFORE we remove downloads */
 
 	/*
 	 * This flag is set because certain operations must be avoided from now on
@@ -16060,6 +16268,7 @@ download_close(void)
 	 * downloads, nothing what we do from here on is meant to persist.
 	 */
 	download_shutdown = TRUE;
+	cq_cancel(&dl_sched_ev);
 
 	download_clear_stopped(TRUE, TRUE, TRUE, TRUE, TRUE);
 	download_remove_all();
@@ -16375,6 +16584,7 @@ download_thex_done(struct download *d)
 	if (NULL == fi->tth) {
 		file_info_got_tth(fi, tth);
 	}
+	file_info_tigertree_load(fi);
 	if (fi->tigertree.num_leaves >= num_leaves) {
 		g_message("discarding tigertree data from %s: already known.",
 			download_host_info(d));
@@ -17260,9 +17470,18 @@ download_timer(time_t now)
 		}
 	}
 
-	/* Dequeuing */
-	if (GNET_PROPERTY(is_inet_connected))
+	/*
+	 * Dequeuing is normally driven by the scheduler event, but conditions
+	 * such as bandwidth availability or connectivity changes are not
+	 * signalled, so we still run an unsolicited pickup every now and then.
+	 */
+
+	if (
+		GNET_PROPERTY(is_inet_connected) &&
+		delta_time(now, dl_sched_last) >= DOWNLOAD_SCHED_FALLBACK
+	) {
 		download_pickup_queued();
+	}
 }
 
 /**
@@ -92,7 +92,8 @@ void download_found_server(const struct guid *,
 void download_attach_socket(struct download *d, struct gnutella_socket *s);
 
 void download_move_start(struct download *d);
-void download_move_progress(struct download *d, filesize_t copied);
+void download_move_progress(struct download *d,
+	filesize_t copied, uint elapsed);
 void download_move_done(struct download *d, const char *pathname,
 		uint elapsed);
 void download_move_error(struct download *d);
@@ -102,6 +102,12 @@
 #define DQ_MQ_EPSILON		2048   /**< Queues identical at +/- 2K */
 #define DQ_FUZZY_FACTOR		0.80   /**< Corrector for theoretical horizon */
 
+#define DQ_YIELD_DECAY		0.98   /**< Yield statistics decay per query */
+#define DQ_YIELD_REACH		1000.0 /**< Min decayed reach for valid yield */
+#define DQ_MIN_EXPECTED		1.0	   /**< Stop below that remaining yield */
+#define DQ_POPULAR_MIN		0.25   /**< Min popularity correction */
+#define DQ_POPULAR_MAX		4.0	   /**< Max popularity correction */
+
 #define DQ_TTL_PROBE		(1 << 8)	/**< Flags probed requests */
 #define DQ_TTL_MASK			(DQ_TTL_PROBE - 1)
 
@@ -131,8 +137,49 @@ struct next_up {
 	query_hashvec_t *qhv;	/**< Query hash vector for the query */
 	int can_route;			/**< -1 = unknown, otherwise TRUE / FALSE */
 	int queue_pending;		/**< -1 = unknown, otherwise cached queue size */
+	double yield;			/**< Predicted yield, -1 if unknown */
+};
+
+/**
+ * Query classes for which we keep separate yield statistics.
+ *
+ * A query by URN does not behave at all like a keyword query, and queries
+ * bearing several keywords are more selective than single-word ones.
+ */
+enum dq_class {
+	DQ_CLASS_URN = 0,		/**< Query by URN */
+	DQ_CLASS_WORD,			/**< Single keyword */
+	DQ_CLASS_WORDS,			/**< Several keywords */
+
+	DQ_CLASS_COUNT
 };
 
+typedef enum {
+	DQ_YIELD_MAGIC = 0x2c1d95e7
+} dq_yield_magic_t;
+
+/**
+ * Hit yield statistics for an ultrapeer we send dynamic queries to.
+ *
+ * For each query class, we record the amount of hits we got back from the
+ * node and the theoretical horizon we reached through it.  Both are
+ * exponentially decayed each time we send a new query of that class to the
+ * node, so that the ratio tracks the recent behaviour of the node.
+ */
+struct dq_yield {
+	dq_yield_magic_t magic;
+	struct nid *node_id;			/**< The ultrapeer (ref-counted) */
+	double hits[DQ_CLASS_COUNT];	/**< Decayed amount of hits */
+	double reach[DQ_CLASS_COUNT];	/**< Decayed horizon reached */
+};
+
+static inline void
+dq_yield_check(const struct dq_yield * const dy)
+{
+	g_assert(dy != NULL);
+	g_assert(DQ_YIELD_MAGIC == dy->magic);
+}
+
 typedef enum {
 	DQUERY_MAGIC = 0x53608af3
 } dquery_magic_t;
@@ -153,6 +200,8 @@ typedef struct dquery {
 	const struct guid *lmuid;/**< For proxied query: the original leaf MUID */
 	uint16 query_flags;		/**< Flags from the marked query speed field */
 	uint8 ttl;				/**< Initial query TTL */
+	uint8 qclass;			/**< Query class (enum dq_class) */
+	double expected;		/**< Yield predicted for queries sent so far */
 	uint32 horizon;			/**< Theoretical horizon reached thus far */
 	uint32 up_sent;			/**< # of UPs to which we really sent our query */
 	uint32 last_status;		/**< How many UP queried last time we got status */
@@ -219,6 +268,25 @@ static htable_t *by_muid;
  */
 static hikset_t *by_leaf_muid;
 
+/**
+ * This table records hit yield statistics for the ultrapeers to which we
+ * send dynamic queries, indexed by node ID.  Values are dq_yield structures.
+ */
+static htable_t *dq_yields;
+
+/**
+ * Decayed hits and reach per query class, aggregated over all the
+ * ultrapeers: used as a prior for nodes without enough history.
+ *
+ * The class hits include the claimed OOB hits, which are delivered directly
+ * by the servents and therefore cannot be credited to the ultrapeer that
+ * relayed the query.  The part of the hits that could be credited to some
+ * ultrapeer is kept separately, to scale the per-node rates accordingly.
+ */
+static double dq_class_hits[DQ_CLASS_COUNT];
+static double dq_class_credited[DQ_CLASS_COUNT];
+static double dq_class_reach[DQ_CLASS_COUNT];
+
 /**
  * Information about query messages sent.
  *
@@ -313,6 +381,189 @@ dq_get_horizon(int degree, int ttl)
 	return hosts[i][j] * pow(DQ_FUZZY_FACTOR, j);
 }
 
+/**
+ * @return the class of the query, given its query hash vector.
+ */
+static enum dq_class
+dq_class_of(const query_hashvec_t *qhv)
+{
+	if (qhvec_has_urn(qhv))
+		return DQ_CLASS_URN;
+
+	return qhvec_count(qhv) > 1 ? DQ_CLASS_WORDS : DQ_CLASS_WORD;
+}
+
+/**
+ * Get yield statistics for node, creating them if needed.
+ */
+static struct dq_yield *
+dq_yield_get(const struct nid *node_id)
+{
+	struct dq_yield *dy;
+
+	dy = htable_lookup(dq_yields, node_id);
+
+	if (NULL == dy) {
+		WALLOC0(dy);
+		dy->magic = DQ_YIELD_MAGIC;
+		dy->node_id = nid_ref(node_id);
+		htable_insert(dq_yields, dy->node_id, dy);
+	}
+
+	dq_yield_check(dy);
+	return dy;
+}
+
+/**
+ * Free yield statistics.
+ */
+static void
+dq_yield_free(struct dq_yield *dy)
+{
+	dq_yield_check(dy);
+
+	nid_unref(dy->node_id);
+	dy->magic = 0;
+	WFREE(dy);
+}
+
+/**
+ * Record that a query was sent to a node, reaching the given horizon.
+ *
+ * @param dq		the dynamic query
+ * @param node_id	the node to which the query was sent
+ * @param horizon	the theoretical horizon reached through the node
+ */
+static void
+dq_yield_sent(const dquery_t *dq, const struct nid *node_id, uint32 horizon)
+{
+	struct dq_yield *dy;
+	enum dq_class c = dq->qclass;
+
+	dy = dq_yield_get(node_id);
+
+	dy->hits[c] *= DQ_YIELD_DECAY;
+	dy->reach[c] = dy->reach[c] * DQ_YIELD_DECAY + horizon;
+
+	dq_class_hits[c] *= DQ_YIELD_DECAY;
+	dq_class_credited[c] *= DQ_YIELD_DECAY;
+	dq_class_reach[c] = dq_class_reach[c] * DQ_YIELD_DECAY + horizon;
+}
+
+/**
+ * Do we see all the hits for the query?
+ *
+ * When a leaf gets its hits out-of-band without us proxying the query, the
+ * hits do not come through us and cannot be used to measure the yield.
+ */
+static inline bool
+dq_yield_measurable(const dquery_t *dq)
+{
+	return 0 != (dq->flags & (DQ_F_LOCAL | DQ_F_ROUTING_HITS));
+}
+
+/**
+ * Account for hits received for a query.
+ *
+ * @param dq		the dynamic query
+ * @param node_id	the node that sent us the hits, NULL if unknown
+ * @param count		amount of hits
+ */
+static void
+dq_yield_hits(const dquery_t *dq, const struct nid *node_id, int count)
+{
+	struct dq_yield *dy;
+	enum dq_class c = dq->qclass;
+
+	if (!dq_yield_measurable(dq))
+		return;
+
+	dq_class_hits[c] += count;
+
+	/*
+	 * Credit the UP that sent us the results, if we queried it.  OOB hits
+	 * come from the servents that produced them.
+	 */
+
+	if (NULL == node_id || !htable_contains(dq->queried, node_id))
+		return;
+
+	dy = htable_lookup(dq_yields, node_id);
+	if (NULL == dy)
+		return;		/* Query not sent yet, hits came via another path */
+
+	dq_yield_check(dy);
+
+	dy->hits[c] += count;
+	dq_class_credited[c] += count;
+}
+
+/**
+ * Compute the expected amount of hits per host reached through a node,
+ * falling back to the global statistics for the query class when we do
+ * not have enough history for the node.
+ *
+ * @return the yield rate, -1.0 if unknown.
+ */
+static double
+dq_yield_rate(const dquery_t *dq, const struct nid *node_id)
+{
+	const struct dq_yield *dy;
+	enum dq_class c = dq->qclass;
+
+	dy = htable_lookup(dq_yields, node_id);
+
+	/*
+	 * The hits credited to the node do not include the OOB hits that the
+	 * query it relayed produced, so we scale its rate by the ratio between
+	 * all the hits and the credited ones for the class, to measure the rate
+	 * the same way as for the class.
+	 */
+
+	if (
+		dy != NULL && dy->reach[c] >= DQ_YIELD_REACH &&
+		dq_class_credited[c] > 0.0
+	) {
+		return dy->hits[c] / dy->reach[c] *
+			dq_class_hits[c] / dq_class_credited[c];
+	}
+
+	if (dq_class_reach[c] >= DQ_YIELD_REACH)
+		return dq_class_hits[c] / dq_class_reach[c];
+
+	return -1.0;
+}
+
+/**
+ * Popularity correction for the query: how many more (or less) hits than
+ * predicted we got so far.  A query for popular content will yield more
+ * than the average query of its class.
+ */
+static double
+dq_yield_popularity(const dquery_t *dq)
+{
+	double p = (dq->results + 1.0) / (dq->expected + 1.0);
+
+	return CLAMP(p, DQ_POPULAR_MIN, DQ_POPULAR_MAX);
+}
+
+/**
+ * Predict the amount of hits we are going to get by sending the query to
+ * the node with the specified TTL.
+ *
+ * @return the expected amount of hits, -1.0 if we cannot predict anything.
+ */
+static double
+dq_yield_predict(const dquery_t *dq, const gnutella_node_t *n, unsigned ttl)
+{
+	double rate = dq_yield_rate(dq, NODE_ID(n));
+
+	if (rate < 0.0)
+		return -1.0;
+
+	return rate * dq_get_horizon(n->degree, ttl) * dq_yield_popularity(dq);
+}
+
 /**
  * Compute amount of results "kept" for the query, if we have this
  * information available.
@@ -542,13 +793,28 @@ dq_pmsg_free(pmsg_t *mb, void *arg)
 			cq_resched(dq->results_ev, 1);
 
 	} else {
+		uint32 horizon = dq_get_horizon(pmi->degree, pmi->ttl);
+		double rate;
+
 		/*
 		 * The message was sent.  Adjust the total horizon reached thus far.
+		 *
+		 * Also account for the yield we expect from it (before updating
+		 * the statistics of the node) so that we can later compare the
+		 * results we get with our predictions.
 		 */
 
-		dq->horizon += dq_get_horizon(pmi->degree, pmi->ttl);
+		dq->horizon += horizon;
 		dq->up_sent++;
 
+		if (dq_yield_measurable(dq)) {
+			rate = dq_yield_rate(dq, pmi->node_id);
+			if (rate >= 0.0)
+				dq->expected += rate * horizon;
+
+			dq_yield_sent(dq, pmi->node_id, horizon);
+		}
+
 		if (dq->flags & DQ_F_LOCAL)
 			search_query_sent(dq->sh);
 
@@ -829,6 +1095,9 @@ dq_fill_next_up(dquery_t *dq, struct next_up *nv, int ncount)
 			nup->can_route = old_nup->can_route;
 		} else
 			nup->can_route = -1;	/* We don't know yet */
+
+		nup->queue_pending = -1;
+		nup->yield = dq_yield_predict(dq, n, MIN(n->max_ttl, dq->ttl));
 	}
 
 	/*
@@ -1284,7 +1553,8 @@ node_mq_cmp(const void *np1, const void *np2)
 
 /**
  * qsort() callback for sorting nodes by increasing queue size, with a
- * preference towards nodes that have a QRP match.
+ * preference towards nodes that have a QRP match, and then towards the
+ * nodes from which we predict the highest yield.
  */
 static int
 node_mq_qrp_cmp(const void *np1, const void *np2)
@@ -1325,6 +1595,8 @@ node_mq_qrp_cmp(const void *np1, const void *np2)
 
 		if (!nu1->can_route == !nu2->can_route) {
 			/* Both can equally route or not route */
+			if (nu1->yield != nu2->yield)
+				return nu1->yield > nu2->yield ? -1 : +1;
 			return CMP(qs1, qs2);
 		}
 
@@ -1385,6 +1657,52 @@ dq_send_query(dquery_t *dq, gnutella_node_t *n, int ttl, bool probe)
 		gmsg_mb_routeto_one(node_by_id(dq->node_id), n, mb);
 }
 
+/**
+ * Check whether the yield we can expect from querying the remaining UPs is
+ * too low to be worth the bandwidth.
+ *
+ * We only decide after the initial probe, and only when we can make a
+ * prediction for every candidate and later see all the hits the query
+ * produces, to be able to compare them with the predictions.
+ *
+ * @param dq		the dynamic query
+ * @param nv		the candidate UPs
+ * @param found		amount of candidates in `nv'
+ * @param expected	where the total expected yield is written back
+ *
+ * @return TRUE if the query should be stopped.
+ */
+static bool
+dq_yield_exhausted(dquery_t *dq, const struct next_up *nv, int found,
+	double *expected)
+{
+	double sum = 0.0;
+	int i;
+
+	dquery_check(dq);
+
+	if (dq->up_sent < DQ_PROBE_UP || !dq_yield_measurable(dq))
+		return FALSE;
+
+	for (i = 0; i < found; i++) {
+		gnutella_node_t *node = node_by_id(nv[i].node_id);
+		double yield;
+
+		yield = dq_yield_predict(dq, node, dq_select_ttl(dq, node, found));
+
+		if (yield < 0.0)
+			return FALSE;
+
+		sum += yield;
+
+		if (sum >= DQ_MIN_EXPECTED)
+			return FALSE;
+	}
+
+	*expected = sum;
+	return TRUE;
+}
+
 /**
  * Iterate over the UPs which have not seen our query yet, select one and
  * send it the query.
@@ -1500,6 +1818,26 @@ dq_send_next(dquery_t *dq)
 	if (found == 0)
 		goto terminate;	/* Terminate query: no more UP to send it to */
 
+	/*
+	 * Stop if the remaining UPs are not expected to bring back anything
+	 * meaningful, according to the yield they had for similar queries.
+	 */
+
+	{
+		double expected;
+
+		if (dq_yield_exhausted(dq, nv, found, &expected)) {
+			if (GNET_PROPERTY(dq_debug) > 1)
+				g_debug("DQ[%s] terminating "
+					"(UPs=%u, horizon=%u, results=%u, "
+					"%d UP%s left expected to yield %.2f)",
+					nid_to_string(&dq->qid), dq->up_sent, dq->horizon,
+					results, found, plural(found), expected);
+			gnet_stats_inc_general(GNR_DYN_QUERIES_LOW_YIELD);
+			goto terminate;
+		}
+	}
+
 	/*
 	 * Sort the array by increasing queue size, so that the nodes with
 	 * the less pending data are listed first, with a preference to nodes
@@ -1713,6 +2051,7 @@ dq_common_init(dquery_t *dq)
 	dq->enqueued = hset_create_any(nid_hash, nid_hash2, nid_equal);
 	dq->result_timeout = DQ_QUERY_TIMEOUT;
 	dq->start = tm_time();
+	dq->qclass = dq_class_of(dq->qhv);
 
 	/*
 	 * Make sure the dynamic query structure is cleaned up in at most
@@ -2207,7 +2546,8 @@ ignore:
 
 /**
  * Tells us a node ID has been removed.
- * Get rid of all the queries registered for that node.
+ * Get rid of all the queries registered for that node, and of the yield
+ * statistics we kept for it.
  */
 void
 dq_node_removed(const struct nid *node_id)
@@ -2215,6 +2555,11 @@ dq_node_removed(const struct nid *node_id)
 	void *value;
 	pslist_t *sl;
 
+	if (htable_lookup_extended(dq_yields, node_id, NULL, &value)) {
+		htable_remove(dq_yields, node_id);
+		dq_yield_free(value);
+	}
+
 	if (!htable_lookup_extended(by_node_id, node_id, NULL, &value))
 		return;		/* No dynamic query for this node */
 
@@ -2245,6 +2590,7 @@ dq_node_removed(const struct nid *node_id)
  *
  * @param muid is the dynamic query's MUID, i.e. the MUID used to send out
  * the query on the network (important for OOB-proxied queries).
+ * @param node_id is the node from which we got the results, NULL if unknown
  * @param count is the amount of results we received or got notified about
  * @param oob if TRUE indicates that we just got notified about OOB results
  * awaiting, but which have not been claimed yet.  If FALSE, the results
@@ -2255,7 +2601,8 @@ dq_node_removed(const struct nid *node_id)
  * should not forward the results anyway.
  */
 static bool
-dq_count_results(const struct guid *muid, int count, uint16 status, bool oob)
+dq_count_results(const struct guid *muid, const struct nid *node_id,
+	int count, uint16 status, bool oob)
 {
 	dquery_t *dq;
 
@@ -2318,6 +2665,7 @@ dq_count_results(const struct guid *muid, int count, uint16 status, bool oob)
 	else {
 		dq->results += count;
 		dq->new_results += count;
+		dq_yield_hits(dq, node_id, count);
 	}
 
 	if (GNET_PROPERTY(dq_debug) > 19) {
@@ -2352,6 +2700,7 @@ dq_count_results(const struct guid *muid, int count, uint16 status, bool oob)
  * count.
  *
  * @param muid		the query's MUID
+ * @param node_id	the node from which we got the results
  * @param count		how many results we parsed
  * @param status	result set `status' flags gathered during parsing
  *
@@ -2360,9 +2709,10 @@ dq_count_results(const struct guid *muid, int count, uint16 status, bool oob)
  * whether we should forward the results.
  */
 bool
-dq_got_results(const struct guid *muid, uint count, uint32 status)
+dq_got_results(const struct guid *muid, const struct nid *node_id,
+	uint count, uint32 status)
 {
-	return dq_count_results(muid, count, status, FALSE);
+	return dq_count_results(muid, node_id, count, status, FALSE);
 }
 
 /**
@@ -2375,7 +2725,7 @@ dq_got_results(const struct guid *muid, uint count, uint32 status)
 bool
 dq_oob_results_ind(const struct guid *muid, int count)
 {
-	return dq_count_results(muid, count, 0, TRUE);
+	return dq_count_results(muid, NULL, count, 0, TRUE);
 }
 
 /**
@@ -2624,6 +2974,7 @@ dq_init(void)
 	by_muid = htable_create(HASH_KEY_FIXED, GUID_RAW_SIZE);
 	by_leaf_muid = hikset_create(
 		offsetof(struct dquery, lmuid), HASH_KEY_FIXED, GUID_RAW_SIZE);
+	dq_yields = htable_create_any(nid_hash, nid_hash2, nid_equal);
 	fill_hosts();
 }
 
@@ -2700,6 +3051,18 @@ free_leaf_muid(void *value, void *unused_udata)
 		guid_hex_str(dq->lmuid));
 }
 
+/**
+ * Hashtable iteration callback to free the yield statistics.
+ */
+static void
+free_yield(const void *unused_key, void *value, void *unused_udata)
+{
+	(void) unused_key;
+	(void) unused_udata;
+
+	dq_yield_free(value);
+}
+
 /**
  * Cleanup data structures used by dynamic querying.
  */
@@ -2717,6 +3080,9 @@ dq_close(void)
 
 	hikset_foreach(by_leaf_muid, free_leaf_muid, NULL);
 	hikset_free_null(&by_leaf_muid);
+
+	htable_foreach(dq_yields, free_yield, NULL);
+	htable_free_null(&dq_yields);
 }
 
 /* vi: set ts=4 sw=4 cindent: */
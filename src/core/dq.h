@@ -57,7 +57,8 @@ void dq_close(void);
 void dq_launch_net(struct gnutella_node *n,
 	struct query_hashvec *qhv, const search_request_info_t *sri);
 void dq_node_removed(const struct nid *node_id);
-bool dq_got_results(const struct guid *muid, uint count, uint32 status);
+bool dq_got_results(const struct guid *muid, const struct nid *node_id,
+	uint count, uint32 status);
 bool dq_oob_results_ind(const struct guid *muid, int count);
 void dq_oob_results_got(const struct guid *muid, uint count);
 void dq_got_query_status(const struct guid *muid, const struct nid *node_id,
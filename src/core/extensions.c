@@ -39,6 +39,7 @@
 #include "extensions.h"
 #include "ggep.h"
 
+#include "lib/arena.h"
 #include "lib/ascii.h"
 #include "lib/atoms.h"
 #include "lib/halloc.h"
@@ -104,6 +105,7 @@ typedef struct extdesc {
 	uint16 ext_phys_paylen;		/**< Extension payload length */
 	uint16 ext_paylen;			/**< "virtual" payload length */
 	uint16 ext_rpaylen;			/**< Length of buffer for "virtual" payload */
+	uint8 ext_flags;			/**< Allocation flags */
 
 	union {
 		struct {
@@ -115,6 +117,12 @@ typedef struct extdesc {
 
 } extdesc_t;
 
+/*
+ * Extension descriptor allocation flags.
+ */
+#define EXT_D_ARENA		(1U << 0)	/**< Descriptor allocated from arena */
+#define EXT_D_PAYARENA	(1U << 1)	/**< "Virtual" payload in arena */
+
 #define ext_phys_headlen(d)	((d)->ext_phys_len - (d)->ext_phys_paylen)
 #define ext_phys_base(d)	((d)->ext_phys_payload - ext_phys_headlen(d))
 
@@ -126,6 +134,38 @@ typedef struct extdesc {
 #define ext_ggep_deflate	ext_u.extu_ggep.extu_deflate
 #define ext_ggep_id			ext_u.extu_ggep.extu_id
 
+/**
+ * Allocate a new extension descriptor.
+ *
+ * When parsing happens within an arena transaction (i.e. whilst processing
+ * an incoming message), the descriptor is taken from the thread arena and
+ * will be reclaimed at the end of the transaction.
+ */
+static inline extdesc_t *
+ext_desc_alloc(void)
+{
+	extdesc_t *d = arena_tx_alloc(sizeof *d);
+
+	if (d != NULL) {
+		d->ext_flags = EXT_D_ARENA;
+	} else {
+		WALLOC(d);
+		d->ext_flags = 0;
+	}
+
+	return d;
+}
+
+/**
+ * Free extension descriptor, unless it was allocated from the arena.
+ */
+static inline void
+ext_desc_free(extdesc_t *d)
+{
+	if (0 == (d->ext_flags & EXT_D_ARENA))
+		WFREE(d);
+}
+
 /**
  * Flags for ext_parse_buffer.
  */
@@ -566,7 +606,7 @@ ext_ggep_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 		 * OK, at this point we have validated the GGEP header.
 		 */
 
-		WALLOC(d);
+		d = ext_desc_alloc();
 
 		d->ext_phys_payload = p;
 		d->ext_phys_paylen = data_length;
@@ -628,7 +668,7 @@ abort:
 
 	while (count--) {
 		exv--;
-		wfree(exv->opaque, sizeof(extdesc_t));
+		ext_desc_free(exv->opaque);
 		exv->opaque = NULL;
 	}
 
@@ -655,7 +695,7 @@ ext_urn_bad_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 	 * Encapsulate as one big opaque chunk.
 	 */
 
-	WALLOC(d);
+	d = ext_desc_alloc();
 
 	d->ext_phys_payload = lastp;
 	d->ext_phys_len = d->ext_phys_paylen = p - lastp;
@@ -782,7 +822,7 @@ ext_huge_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 found:
 	g_assert(payload_start);
 
-	WALLOC(d);
+	d = ext_desc_alloc();
 
 	d->ext_phys_payload = payload_start;
 	d->ext_phys_paylen = data_length;
@@ -831,7 +871,7 @@ ext_xml_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 	 * We don't analyze the XML, encapsulate as one big opaque chunk.
 	 */
 
-	WALLOC(d);
+	d = ext_desc_alloc();
 
 	d->ext_phys_payload = lastp;
 	d->ext_phys_len = d->ext_phys_paylen = p - lastp;
@@ -911,7 +951,7 @@ ext_unknown_parse(const char **retp, int len, extvec_t *exv,
 	 * Encapsulate as one big opaque chunk.
 	 */
 
-	WALLOC(d);
+	d = ext_desc_alloc();
 
 	d->ext_phys_payload = lastp;
 	d->ext_phys_len = d->ext_phys_paylen = p - lastp;
@@ -970,7 +1010,7 @@ ext_none_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 	 * Encapsulate as one big opaque chunk.
 	 */
 
-	WALLOC(d);
+	d = ext_desc_alloc();
 
 	d->ext_phys_payload = lastp;
 	d->ext_phys_len = d->ext_phys_paylen = p - lastp;
@@ -1044,7 +1084,7 @@ ext_merge_adjacent(extvec_t *exv, extvec_t *next)
 	g_assert(
 		nd->ext_payload == NULL || nd->ext_payload == nd->ext_phys_payload);
 
-	WFREE(nd);
+	ext_desc_free(nd);
 	next->opaque = NULL;
 }
 
@@ -1769,8 +1809,11 @@ ext_ggep_decode(const extvec_t *e)
 	 */
 
 	if (d->ext_ggep_cobs) {
-		uncobs = walloc(plen);		/* At worse slightly oversized */
-		uncobs_len = plen;
+		uncobs = arena_tx_alloc(plen);	/* At worse slightly oversized */
+		if (NULL == uncobs) {
+			uncobs = walloc(plen);
+			uncobs_len = plen;
+		}
 
 		if (!cobs_decode_into(pbase, plen, uncobs, plen, &result)) {
 			if (GNET_PROPERTY(ggep_debug))
@@ -1785,6 +1828,8 @@ ext_ggep_decode(const extvec_t *e)
 			d->ext_payload = uncobs;
 			d->ext_paylen = result;
 			d->ext_rpaylen = plen;		/* Signals it was walloc()'ed */
+			if (0 == uncobs_len)
+				d->ext_flags |= EXT_D_PAYARENA;
 
 			return;
 		} else {
@@ -1816,7 +1861,7 @@ ext_ggep_decode(const extvec_t *e)
 
 	/* FALL THROUGH */
 out:
-	if (uncobs != NULL)
+	if (uncobs_len != 0)
 		wfree(uncobs, uncobs_len);
 
 	/*
@@ -2220,7 +2265,9 @@ ext_reset(extvec_t *exv, int exvcnt)
 
 		if (d->ext_payload != NULL && d->ext_payload != d->ext_phys_payload) {
 			void *p = deconstify_pointer(d->ext_payload);
-			if (d->ext_rpaylen == 0) {
+			if (d->ext_flags & EXT_D_PAYARENA) {
+				/* Will be reclaimed with the arena */
+			} else if (d->ext_rpaylen == 0) {
 				HFREE_NULL(p);
 			} else {
 				wfree(p, d->ext_rpaylen);
@@ -2229,7 +2276,7 @@ ext_reset(extvec_t *exv, int exvcnt)
 			d->ext_payload = NULL;
 		}
 
-		WFREE(d);
+		ext_desc_free(d);
 		e->opaque = NULL;
 	}
 }
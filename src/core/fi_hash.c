@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Incremental in-order hashing of downloaded data.
+ *
+ * A hasher is attached to a fileinfo and is fed with the data as it is
+ * flushed to disk, as long as that data extends the contiguous prefix
+ * already hashed.  It maintains the running SHA-1 of that prefix, so that
+ * when the file completes only the part that was not received in order
+ * (if any) needs to be read back from disk.
+ *
+ * When the tigertree leaves of the file are known, each TTH slice is also
+ * hashed as it is fed and compared to the expected leaf, which lets us
+ * spot corrupted data as soon as the slice is complete instead of waiting
+ * for the whole file to be verified.  Upon a mismatch, the hasher rewinds
+ * to the start of the bad slice.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "fi_hash.h"
+
+#include "if/core/fileinfo.h"
+
+#include "lib/atoms.h"
+#include "lib/halloc.h"
+#include "lib/tigertree.h"
+#include "lib/walloc.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+enum fi_hash_magic { FI_HASH_MAGIC = 0x49f1c5e2 };
+
+/**
+ * An incremental hasher.
+ */
+struct fi_hash {
+	enum fi_hash_magic magic;
+	filesize_t offset;			/**< Amount of bytes hashed (in-order prefix) */
+	SHA1_context sha1;			/**< SHA-1 of [0, offset[ */
+	SHA1_context slice_sha1;	/**< SHA-1 state at start of current slice */
+	TTH_CONTEXT *tth;			/**< TTH of current slice (lazily allocated) */
+	filesize_t slice_start;		/**< Start of current slice */
+	filesize_t slice_end;		/**< End of current slice (excluded) */
+	filesize_t slice_size;		/**< Slice size when slice was started */
+	unsigned slicing:1;			/**< Whether current slice is being checked */
+};
+
+static inline void
+fi_hash_check(const struct fi_hash * const fh)
+{
+	g_assert(fh != NULL);
+	g_assert(FI_HASH_MAGIC == fh->magic);
+}
+
+/**
+ * Reset hasher to the beginning of the file.
+ */
+void
+fi_hash_reset(fi_hash_t *fh)
+{
+	fi_hash_check(fh);
+
+	fh->offset = 0;
+	fh->slicing = FALSE;
+	SHA1_reset(&fh->sha1);
+}
+
+/**
+ * Allocate a new hasher, starting at the beginning of the file.
+ */
+fi_hash_t *
+fi_hash_make(void)
+{
+	fi_hash_t *fh;
+
+	WALLOC0(fh);
+	fh->magic = FI_HASH_MAGIC;
+	SHA1_reset(&fh->sha1);
+
+	return fh;
+}
+
+/**
+ * Free hasher and nullify its pointer.
+ */
+void
+fi_hash_free_null(fi_hash_t **fh_ptr)
+{
+	fi_hash_t *fh = *fh_ptr;
+
+	if (fh != NULL) {
+		fi_hash_check(fh);
+		HFREE_NULL(fh->tth);
+		fh->magic = 0;
+		WFREE(fh);
+		*fh_ptr = NULL;
+	}
+}
+
+/**
+ * @return amount of bytes hashed so far, i.e. the offset of the next byte
+ * the hasher expects.
+ */
+filesize_t
+fi_hash_offset(const fi_hash_t *fh)
+{
+	fi_hash_check(fh);
+
+	return fh->offset;
+}
+
+/**
+ * @return the running SHA-1 context, covering the hashed prefix.
+ */
+const SHA1_context *
+fi_hash_sha1_context(const fi_hash_t *fh)
+{
+	fi_hash_check(fh);
+
+	return &fh->sha1;
+}
+
+/**
+ * Compute the SHA-1 of the hashed prefix, leaving the context intact.
+ */
+void
+fi_hash_sha1_digest(const fi_hash_t *fh, struct sha1 *digest)
+{
+	int ret;
+
+	fi_hash_check(fh);
+
+	ret = SHA1_intermediate(&fh->sha1, digest);
+	g_assert(SHA_SUCCESS == ret);
+}
+
+/**
+ * Start hashing a new TTH slice, if leaves are known and we are at
+ * a slice boundary.
+ */
+static void
+fi_hash_slice_start(fi_hash_t *fh, const fileinfo_t *fi)
+{
+	filesize_t size = fi->tigertree.slice_size;
+
+	if (0 == fi->tigertree.num_leaves || 0 == size)
+		return;
+
+	if (0 != fh->offset % size)
+		return;			/* Leaves known in the middle of a slice */
+
+	if (NULL == fh->tth)
+		fh->tth = halloc(tt_size());
+
+	fh->slice_start = fh->offset;
+	fh->slice_end = fh->offset + MIN(size, fi->size - fh->offset);
+	fh->slice_size = size;
+	fh->slice_sha1 = fh->sha1;		/* Struct copy, to rewind if bad */
+	fh->slicing = TRUE;
+
+	tt_init(fh->tth, fh->slice_end - fh->slice_start);
+}
+
+/**
+ * Check the TTH of the slice that was just completed.
+ *
+ * @return TRUE if slice is good or could not be checked.
+ */
+static bool
+fi_hash_slice_end(fi_hash_t *fh, const fileinfo_t *fi)
+{
+	struct tth leaf;
+	size_t idx;
+
+	fh->slicing = FALSE;
+
+	/*
+	 * If we got more leaves since the slice was started, the slice size
+	 * changed and we cannot compare with the known leaves.
+	 */
+
+	if (fh->slice_size != fi->tigertree.slice_size)
+		return TRUE;
+
+	idx = fh->slice_start / fh->slice_size;
+	if (idx >= fi->tigertree.num_leaves)
+		return TRUE;
+
+	tt_digest(fh->tth, &leaf);
+
+	return tth_eq(&leaf, &fi->tigertree.leaves[idx]);
+}
+
+/**
+ * Feed hasher with data starting at the current hashing offset.
+ *
+ * When a bad TTH slice is detected, the hasher is rewound to the start of
+ * that slice, and the remaining data is not consumed.
+ *
+ * @param fh		the hasher
+ * @param fi		the fileinfo to which data belongs
+ * @param data		start of data, at offset fi_hash_offset()
+ * @param len		length of data
+ * @param bad_from	where start of bad slice is written, if any
+ * @param bad_to	where end of bad slice (excluded) is written, if any
+ *
+ * @return TRUE if OK, FALSE if a bad slice was detected.
+ */
+bool
+fi_hash_feed(fi_hash_t *fh, const fileinfo_t *fi,
+	const void *data, size_t len, filesize_t *bad_from, filesize_t *bad_to)
+{
+	const char *p = data;
+
+	fi_hash_check(fh);
+	file_info_check(fi);
+	g_assert(bad_from != NULL);
+	g_assert(bad_to != NULL);
+
+	while (len != 0) {
+		size_t n = len;
+		int ret;
+
+		if (!fh->slicing)
+			fi_hash_slice_start(fh, fi);
+
+		if (fh->slicing)
+			n = MIN(n, fh->slice_end - fh->offset);
+
+		ret = SHA1_input(&fh->sha1, p, n);
+		g_assert(SHA_SUCCESS == ret);
+
+		if (fh->slicing)
+			tt_update(fh->tth, p, n);
+
+		fh->offset += n;
+		p += n;
+		len -= n;
+
+		if (fh->slicing && fh->offset == fh->slice_end) {
+			if (!fi_hash_slice_end(fh, fi)) {
+				*bad_from = fh->slice_start;
+				*bad_to = fh->slice_end;
+				fh->sha1 = fh->slice_sha1;		/* Struct copy */
+				fh->offset = fh->slice_start;
+				return FALSE;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
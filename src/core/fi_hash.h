@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Incremental in-order hashing of downloaded data.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _core_fi_hash_h_
+#define _core_fi_hash_h_
+
+#include "common.h"
+
+#include "lib/sha1.h"
+
+struct dl_file_info;
+struct fi_hash;
+typedef struct fi_hash fi_hash_t;
+
+/*
+ * Public interface.
+ */
+
+fi_hash_t *fi_hash_make(void);
+void fi_hash_free_null(fi_hash_t **fh_ptr);
+void fi_hash_reset(fi_hash_t *fh);
+
+filesize_t fi_hash_offset(const fi_hash_t *fh);
+const SHA1_context *fi_hash_sha1_context(const fi_hash_t *fh);
+void fi_hash_sha1_digest(const fi_hash_t *fh, struct sha1 *digest);
+
+bool fi_hash_feed(fi_hash_t *fh, const struct dl_file_info *fi,
+	const void *data, size_t len, filesize_t *bad_from, filesize_t *bad_to);
+
+#endif /* _core_fi_hash_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,527 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Binary journal of fileinfo chunk changes.
+ *
+ * The fileinfo database lists all the known entries along with their chunk
+ * list.  Rewriting it each time a download makes progress is expensive when
+ * there are thousands of partial files, so between two full rewrites (the
+ * checkpoints, written as a compact binary snapshot by the fileinfo layer)
+ * we simply append small fixed-size records to a journal, describing the
+ * ranges that changed status.
+ *
+ * Each record is made of:
+ *
+ *     type      1 byte   (FI_JOURNAL_DONE or FI_JOURNAL_EMPTY)
+ *     reserved  3 bytes  (zero)
+ *     GUID      16 bytes (fileinfo GUID)
+ *     from      8 bytes  (big-endian, first byte of range)
+ *     to        8 bytes  (big-endian, first byte beyond range)
+ *     CRC32     4 bytes  (big-endian, computed over the previous 36 bytes)
+ *
+ * and the file starts with an 8-byte magic and a 4-byte version number.
+ *
+ * Consecutive DONE ranges for the same file are coalesced in memory before
+ * being written, since downloads generally progress linearly.  EMPTY records
+ * are written immediately: losing them would let an older DONE record
+ * resurrect data that is no longer valid.
+ *
+ * At startup, once the snapshot has been loaded, the journal is
+ * replayed in order.  A torn record at the end (crash during a write) simply
+ * stops the replay.  Once a checkpoint has been written, the journal is
+ * truncated back to its header.
+ *
+ * When a record cannot be fully written, the journal is truncated back to
+ * the last complete record and no further record is appended until the next
+ * checkpoint, which the fileinfo layer must write as soon as possible: the
+ * journal no longer describes all the changes made since the last checkpoint,
+ * and replaying only some of them could resurrect ranges that were reset.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "fi_journal.h"
+
+#include "if/core/guid.h"
+#include "if/gnet_property_priv.h"
+
+#include "lib/atoms.h"
+#include "lib/crc.h"
+#include "lib/endian.h"
+#include "lib/fd.h"
+#include "lib/file.h"
+#include "lib/halloc.h"
+#include "lib/hstrfn.h"
+#include "lib/stringify.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+#define FI_JOURNAL_VERSION	1
+#define FI_JOURNAL_HDRLEN	12			/**< Magic + version */
+#define FI_JOURNAL_RECLEN	40			/**< Size of a record */
+#define FI_JOURNAL_PENDING	16			/**< Max coalesced pending records */
+
+static const char fi_journal_magic[] = "GTKGFIJ\n";
+
+/**
+ * A pending record, being coalesced.
+ */
+struct fi_journal_pending {
+	struct guid guid;		/**< Fileinfo GUID */
+	filesize_t from;		/**< First byte of range */
+	filesize_t to;			/**< First byte beyond range */
+	bool used;				/**< Whether slot is used */
+};
+
+static struct fi_journal_pending fij_pending[FI_JOURNAL_PENDING];
+static unsigned fij_evict;		/**< Next pending slot to evict */
+static size_t fij_count;		/**< Records in the journal */
+static int fij_fd = -1;			/**< Journal file descriptor */
+static char *fij_path;			/**< Journal path, once opened */
+static bool fij_lost;			/**< Records lost since last checkpoint */
+
+/**
+ * Serialize record into the supplied buffer, which must be at least
+ * FI_JOURNAL_RECLEN bytes long.
+ */
+static void
+fi_journal_serialize(char *buf, const struct guid *guid,
+	fi_journal_type_t type, filesize_t from, filesize_t to)
+{
+	buf[0] = type;
+	buf[1] = buf[2] = buf[3] = 0;
+	memcpy(&buf[4], guid, GUID_RAW_SIZE);
+	poke_be64(&buf[20], from);
+	poke_be64(&buf[28], to);
+	poke_be32(&buf[36], crc32_update(0, buf, 36));
+}
+
+/**
+ * @return offset of the end of the last complete record in the journal.
+ */
+static inline off_t
+fi_journal_offset(void)
+{
+	return FI_JOURNAL_HDRLEN + (off_t) fij_count * FI_JOURNAL_RECLEN;
+}
+
+/**
+ * Write serialized records to the journal.
+ *
+ * On failure, the journal is truncated back to its last complete record,
+ * so that a replay does not stop at a torn record and silently ignore the
+ * records we could append afterwards, and we stop journaling until the next
+ * checkpoint.  Should the truncation fail as well, the journal is closed
+ * and will be re-created by the checkpoint.
+ */
+static void
+fi_journal_write(const char *buf, size_t len)
+{
+	ssize_t r;
+	off_t offset;
+
+	g_assert(0 == len % FI_JOURNAL_RECLEN);
+
+	if (0 == len)
+		return;
+
+	if (-1 == fij_fd || fij_lost) {
+		if (fij_path != NULL)
+			fij_lost = TRUE;		/* Change not journaled, need checkpoint */
+		return;
+	}
+
+	r = write(fij_fd, buf, len);
+
+	if G_LIKELY((size_t) r == len) {
+		fij_count += len / FI_JOURNAL_RECLEN;
+		return;
+	}
+
+	if ((ssize_t) -1 == r) {
+		g_warning("%s(): cannot write fileinfo journal: %m", G_STRFUNC);
+	} else {
+		g_warning("%s(): partial write to fileinfo journal (%zd/%zu bytes)",
+			G_STRFUNC, r, len);
+	}
+
+	fij_lost = TRUE;
+	offset = fi_journal_offset();
+
+	if (
+		-1 == ftruncate(fij_fd, offset) ||
+		offset != lseek(fij_fd, offset, SEEK_SET) ||
+		-1 == fd_fsync(fij_fd)
+	) {
+		g_warning("%s(): cannot truncate fileinfo journal, closing it: %m",
+			G_STRFUNC);
+		fd_forget_and_close(&fij_fd);
+	}
+}
+
+/**
+ * Flush pending record in slot.
+ */
+static void
+fi_journal_flush_slot(struct fi_journal_pending *p)
+{
+	char buf[FI_JOURNAL_RECLEN];
+
+	if (!p->used)
+		return;
+
+	fi_journal_serialize(buf, &p->guid, FI_JOURNAL_DONE, p->from, p->to);
+	fi_journal_write(buf, sizeof buf);
+	p->used = FALSE;
+}
+
+/**
+ * Flush all the pending records to the journal.
+ */
+void
+fi_journal_flush(void)
+{
+	char buf[FI_JOURNAL_PENDING * FI_JOURNAL_RECLEN];
+	size_t i, n = 0;
+
+	for (i = 0; i < N_ITEMS(fij_pending); i++) {
+		struct fi_journal_pending *p = &fij_pending[i];
+
+		if (!p->used)
+			continue;
+
+		fi_journal_serialize(&buf[n], &p->guid, FI_JOURNAL_DONE,
+			p->from, p->to);
+		n += FI_JOURNAL_RECLEN;
+		p->used = FALSE;
+	}
+
+	fi_journal_write(buf, n);
+}
+
+/**
+ * Find pending slot for given GUID.
+ *
+ * @return the slot, NULL if none.
+ */
+static struct fi_journal_pending *
+fi_journal_pending_lookup(const struct guid *guid)
+{
+	size_t i;
+
+	for (i = 0; i < N_ITEMS(fij_pending); i++) {
+		struct fi_journal_pending *p = &fij_pending[i];
+
+		if (p->used && guid_eq(&p->guid, guid))
+			return p;
+	}
+
+	return NULL;
+}
+
+/**
+ * Record status change of range [from, to[ for the fileinfo bearing
+ * the specified GUID.
+ */
+void
+fi_journal_append(const struct guid *guid,
+	fi_journal_type_t type, filesize_t from, filesize_t to)
+{
+	struct fi_journal_pending *p;
+	size_t i;
+
+	g_assert(guid != NULL);
+	g_assert(from < to);
+
+	if (-1 == fij_fd) {
+		if (fij_path != NULL)
+			fij_lost = TRUE;		/* Journal closed, need checkpoint */
+		return;
+	}
+
+	p = fi_journal_pending_lookup(guid);
+
+	if (FI_JOURNAL_EMPTY == type) {
+		char buf[FI_JOURNAL_RECLEN];
+
+		/* Order matters: the pending DONE range must come first */
+
+		if (p != NULL)
+			fi_journal_flush_slot(p);
+
+		fi_journal_serialize(buf, guid, type, from, to);
+		fi_journal_write(buf, sizeof buf);
+		return;
+	}
+
+	g_assert(FI_JOURNAL_DONE == type);
+
+	/*
+	 * Coalesce with the pending range when contiguous.
+	 */
+
+	if (p != NULL) {
+		if (p->to == from) {
+			p->to = to;
+			return;
+		} else if (p->from == to) {
+			p->from = from;
+			return;
+		}
+		fi_journal_flush_slot(p);
+	} else {
+		for (i = 0; i < N_ITEMS(fij_pending); i++) {
+			if (!fij_pending[i].used) {
+				p = &fij_pending[i];
+				break;
+			}
+		}
+
+		if (NULL == p) {
+			p = &fij_pending[fij_evict++ % N_ITEMS(fij_pending)];
+			fi_journal_flush_slot(p);
+		}
+	}
+
+	g_assert(!p->used);
+
+	p->guid = *guid;
+	p->from = from;
+	p->to = to;
+	p->used = TRUE;
+}
+
+/**
+ * Write a fresh header to the journal, discarding all its records.
+ *
+ * @return TRUE if OK.
+ */
+static bool
+fi_journal_reset(void)
+{
+	char hdr[FI_JOURNAL_HDRLEN];
+
+	g_assert(fij_fd != -1);
+
+	memcpy(hdr, fi_journal_magic, 8);
+	poke_be32(&hdr[8], FI_JOURNAL_VERSION);
+
+	if (
+		-1 == ftruncate(fij_fd, 0) ||
+		(off_t) -1 == lseek(fij_fd, 0, SEEK_SET) ||
+		sizeof hdr != write(fij_fd, hdr, sizeof hdr) ||
+		-1 == fd_fsync(fij_fd)
+	) {
+		g_warning("%s(): cannot reset fileinfo journal: %m", G_STRFUNC);
+		return FALSE;
+	}
+
+	fij_count = 0;
+	fij_lost = FALSE;
+	return TRUE;
+}
+
+/**
+ * Replay the journal held in `path', invoking the callback on each record.
+ *
+ * @return the amount of records replayed.
+ */
+size_t
+fi_journal_replay(const char *path, fi_journal_cb_t cb)
+{
+	char buf[FI_JOURNAL_RECLEN];
+	size_t n = 0;
+	ssize_t r;
+	int fd;
+
+	g_assert(path != NULL);
+	g_assert(cb != NULL);
+
+	fd = file_open_missing(path, O_RDONLY);
+	if (-1 == fd)
+		return 0;
+
+	r = read(fd, buf, FI_JOURNAL_HDRLEN);
+
+	if (
+		FI_JOURNAL_HDRLEN != r ||
+		0 != memcmp(buf, fi_journal_magic, 8) ||
+		FI_JOURNAL_VERSION != peek_be32(&buf[8])
+	) {
+		if (r != 0)
+			g_warning("%s(): ignoring invalid fileinfo journal %s",
+				G_STRFUNC, path);
+		goto done;
+	}
+
+	while (FI_JOURNAL_RECLEN == (r = read(fd, buf, sizeof buf))) {
+		struct guid guid;
+		uint8 type = buf[0];
+
+		if (peek_be32(&buf[36]) != crc32_update(0, buf, 36)) {
+			g_warning("%s(): corrupted record #%zu in %s, stopping replay",
+				G_STRFUNC, n + 1, path);
+			goto done;
+		}
+
+		if (FI_JOURNAL_DONE != type && FI_JOURNAL_EMPTY != type) {
+			g_warning("%s(): unknown record type %u in %s, stopping replay",
+				G_STRFUNC, type, path);
+			goto done;
+		}
+
+		memcpy(&guid, &buf[4], GUID_RAW_SIZE);
+		(*cb)(&guid, type, peek_be64(&buf[20]), peek_be64(&buf[28]));
+		n++;
+	}
+
+	if (r != 0) {
+		g_warning("%s(): ignoring truncated trailing record in %s",
+			G_STRFUNC, path);
+	}
+
+done:
+	fd_forget_and_close(&fd);
+
+	if (GNET_PROPERTY(fileinfo_debug)) {
+		g_debug("%s(): replayed %zu record%s from %s",
+			G_STRFUNC, n, plural(n), path);
+	}
+
+	return n;
+}
+
+/**
+ * Open the journal for appending.
+ *
+ * This must be called after the journal was replayed, since any existing
+ * record is discarded: the caller is expected to write a checkpoint right
+ * after having replayed the journal anyway.
+ */
+void
+fi_journal_open(const char *path)
+{
+	g_assert(path != NULL);
+
+	if (fij_fd != -1)
+		return;
+
+	if (NULL == fij_path)
+		fij_path = h_strdup(path);
+
+	fij_fd = file_create(path, O_WRONLY, S_IRUSR | S_IWUSR);
+	if (-1 == fij_fd)
+		return;
+
+	if (!fi_journal_reset())
+		fd_forget_and_close(&fij_fd);
+}
+
+/**
+ * Discard all the journal records, now that a checkpoint was written.
+ */
+void
+fi_journal_checkpoint(void)
+{
+	size_t i;
+
+	/*
+	 * Pending records were captured by the checkpoint.
+	 */
+
+	for (i = 0; i < N_ITEMS(fij_pending); i++)
+		fij_pending[i].used = FALSE;
+
+	/*
+	 * If the journal had to be closed, we cannot leave the older records
+	 * it holds: they would be replayed over the new checkpoint.
+	 */
+
+	if (-1 == fij_fd) {
+		if (NULL == fij_path)
+			return;
+		fi_journal_open(fij_path);
+		if (-1 == fij_fd) {
+			if (-1 == unlink(fij_path) && ENOENT != errno) {
+				g_warning("%s(): cannot remove stale journal %s: %m",
+					G_STRFUNC, fij_path);
+			}
+			fij_lost = FALSE;
+		}
+		return;
+	}
+
+	if (!fi_journal_reset())
+		fd_forget_and_close(&fij_fd);
+}
+
+/**
+ * Did we lose journal records since the last checkpoint?
+ *
+ * When this returns TRUE, a checkpoint must be written quickly since the
+ * journal no longer reflects the changes made to the fileinfo chunks.
+ */
+bool
+fi_journal_lost(void)
+{
+	return fij_lost;
+}
+
+/**
+ * @return amount of records in the journal, including pending ones.
+ */
+size_t
+fi_journal_count(void)
+{
+	size_t i, n = fij_count;
+
+	for (i = 0; i < N_ITEMS(fij_pending); i++) {
+		if (fij_pending[i].used)
+			n++;
+	}
+
+	return n;
+}
+
+/**
+ * Close the journal, flushing pending records.
+ */
+void
+fi_journal_close(void)
+{
+	fi_journal_flush();
+
+	if (fij_fd != -1)
+		fd_forget_and_close(&fij_fd);
+
+	HFREE_NULL(fij_path);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
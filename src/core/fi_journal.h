@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Binary journal of fileinfo chunk changes.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _core_fi_journal_h_
+#define _core_fi_journal_h_
+
+#include "common.h"
+
+struct guid;
+
+/**
+ * Journal record types.
+ */
+typedef enum fi_journal_type {
+	FI_JOURNAL_DONE = 1,		/**< Range was downloaded */
+	FI_JOURNAL_EMPTY = 2		/**< Range is to be downloaded again */
+} fi_journal_type_t;
+
+/**
+ * Callback invoked on each journal record during replay.
+ */
+typedef void (*fi_journal_cb_t)(const struct guid *guid,
+	fi_journal_type_t type, filesize_t from, filesize_t to);
+
+/*
+ * Public interface.
+ */
+
+size_t fi_journal_replay(const char *path, fi_journal_cb_t cb);
+void fi_journal_open(const char *path);
+void fi_journal_append(const struct guid *guid,
+	fi_journal_type_t type, filesize_t from, filesize_t to);
+void fi_journal_flush(void);
+void fi_journal_checkpoint(void);
+bool fi_journal_lost(void);
+size_t fi_journal_count(void);
+void fi_journal_close(void);
+
+#endif /* _core_fi_journal_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
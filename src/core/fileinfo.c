@@ -47,8 +47,11 @@
 #include "bsched.h"
 #include "dmesh.h"
 #include "downloads.h"
+#include "fi_hash.h"
+#include "fi_journal.h"
 #include "gdht.h"
 #include "gmsg.h"
+#include "gnet_stats.h"
 #include "guid.h"
 #include "hosts.h"
 #include "huge.h"
@@ -69,11 +72,14 @@
 #include "lib/ascii.h"
 #include "lib/atoms.h"
 #include "lib/base32.h"
+#include "lib/bstr.h"
 #include "lib/concat.h"
 #include "lib/crash.h"
+#include "lib/crc.h"
 #include "lib/eclist.h"
 #include "lib/endian.h"
 #include "lib/entropy.h"
+#include "lib/erbtree.h"
 #include "lib/fd.h"
 #include "lib/file.h"
 #include "lib/file_object.h"
@@ -89,6 +95,7 @@
 #include "lib/mempcpy.h"
 #include "lib/parse.h"
 #include "lib/path.h"
+#include "lib/pmsg.h"
 #include "lib/pslist.h"
 #include "lib/random.h"
 #include "lib/rbtree.h"
@@ -100,6 +107,7 @@
 #include "lib/unsigned.h"
 #include "lib/url.h"
 #include "lib/utf8.h"
+#include "lib/vsort.h"
 #include "lib/walloc.h"
 #include "lib/xmalloc.h"
 
@@ -118,6 +126,11 @@
 #define FI_DHT_QUEUED_DELAY	150			/**< Penalty per queued source */
 #define FI_DHT_RECV_DELAY	600			/**< Penalty per active source */
 #define FI_DHT_RECV_THRESH	5			/**< No query if that many active */
+#define FI_JOURNAL_MAX		10000		/**< Checkpoint beyond that many records */
+#define FI_JOURNAL_PERIOD	1800		/**< Checkpoint period if journal used */
+#define FI_JOURNAL_RETRY	10			/**< Checkpoint retry if records lost */
+#define FI_HASH_CATCHUP		(4 * 1024 * 1024)	/**< Bytes re-read per second */
+#define FI_HASH_BUFSIZE		(128 * 1024)		/**< Catch-up read buffer */
 
 /*
  * Aligning requested blocks is just a convenience, to make it easier later
@@ -143,6 +156,7 @@ struct dl_file_chunk {
 	filesize_t to;					/**< Range offset end (byte EXCLUDED) */
 	const download_t *download;		/**< Download which "reserved" range */
 	slink_t lk;						/**< Embedded one-way link */
+	rbnode_t node;					/**< Embedded node in fi->chunkidx */
 };
 
 static inline void
@@ -209,7 +223,12 @@ static hikset_t *fi_by_guid;
 
 static const char file_info_file[] = "fileinfo";
 static const char file_info_what[] = "fileinfo database";
+static const char file_info_journal[] = "fileinfo.journal";
+static const char file_info_snapshot[] = "fileinfo.snapshot";
+static const char file_info_snapshot_what[] = "fileinfo snapshot";
 static bool fileinfo_dirty = FALSE;
+static time_t fileinfo_checkpoint;	/**< Last time fileinfo DB was written */
+static char *fi_hash_buf;			/**< Incremental hashing read buffer */
 static bool can_swarm = FALSE;		/**< Set by file_info_retrieve() */
 static bool can_publish_partial_sha1;
 
@@ -238,6 +257,25 @@ enum dl_file_info_field {
 #define FI_STORE_DELAY		60	/**< Max delay (secs) for flushing fileinfo */
 #define FI_TRAILER_INT		6	/**< Amount of uint32 in the trailer */
 
+#define FI_SNAPSHOT_VERSION	1
+#define FI_SNAPSHOT_HDRLEN	12	/**< Magic + version */
+#define FI_SNAPSHOT_MAXLEN	(1U << 30)	/**< Sanity limit on snapshot size */
+
+static const char fi_snapshot_magic[] = "GTKGFIS\n";
+
+/*
+ * Flags of fileinfo snapshot records.
+ */
+enum {
+	FI_SNAP_CHA1		= 1 << 6,	/**< Computed SHA1 follows */
+	FI_SNAP_TTH			= 1 << 5,	/**< Server TTH follows */
+	FI_SNAP_SHA1		= 1 << 4,	/**< Server SHA1 follows */
+	FI_SNAP_SWARMING	= 1 << 3,	/**< Use swarming */
+	FI_SNAP_SIZE_KNOWN	= 1 << 2,	/**< File size known */
+	FI_SNAP_SEEDING		= 1 << 1,	/**< File being seeded */
+	FI_SNAP_PAUSED		= 1 << 0	/**< Paused by user */
+};
+
 /**
  * The swarming trailer is built within a memory buffer first, to avoid having
  * to issue mutliple write() system calls.	We can't use stdio's buffering
@@ -521,6 +559,8 @@ static void fi_free(fileinfo_t *fi);
 static void fi_update_seen_on_network(gnet_src_t srcid);
 static const char *file_info_new_outname(const char *dir, const char *name);
 static bool looks_like_urn(const char *filename);
+static bool fi_update_range(fileinfo_t *fi, filesize_t from, filesize_t to,
+	enum dl_chunk_status status, const struct download *newval);
 
 static idtable_t *fi_handle_map;
 static idtable_t *src_handle_map;
@@ -645,6 +685,188 @@ dl_file_chunk_free(struct dl_file_chunk **fc_ptr)
 	}
 }
 
+/**
+ * Compares two file chunks by their starting offset.
+ *
+ * Chunks in the chunklist never overlap, hence their starting offset is
+ * enough to order them, and it remains a valid key when the boundary
+ * between two adjacent chunks is moved.
+ */
+static int
+fi_chunk_from_cmp(const void *a, const void *b)
+{
+	const struct dl_file_chunk *ca = a, *cb = b;
+
+	return CMP(ca->from, cb->from);
+}
+
+/**
+ * Invalidate the chunk index, which will be rebuilt on next lookup.
+ */
+static void
+fi_chunk_index_invalidate(fileinfo_t *fi)
+{
+	erbtree_clear(&fi->chunkidx);
+	fi->chunkidx_ok = FALSE;
+}
+
+/**
+ * Index new chunk, which has just been linked into the chunklist.
+ */
+static void
+fi_chunk_index_insert(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	if (!fi->chunkidx_ok)
+		return;
+
+	/*
+	 * A duplicate offset means the chunklist is being filled with
+	 * inconsistent data (e.g. a corrupted trailer): stop indexing, it
+	 * will be rebuilt when needed, once the list has been validated.
+	 */
+
+	if G_UNLIKELY(NULL != erbtree_insert(&fi->chunkidx, &fc->node))
+		fi_chunk_index_invalidate(fi);
+}
+
+/**
+ * Make sure the chunk index is in sync with the chunklist.
+ *
+ * @return TRUE if the index can be used, FALSE if chunklist is inconsistent.
+ */
+static bool
+fi_chunk_index_sync(fileinfo_t *fi)
+{
+	struct dl_file_chunk *fc;
+
+	if G_LIKELY(fi->chunkidx_ok)
+		return TRUE;
+
+	erbtree_clear(&fi->chunkidx);
+
+	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+		dl_file_chunk_check(fc);
+
+		if (NULL != erbtree_insert(&fi->chunkidx, &fc->node)) {
+			erbtree_clear(&fi->chunkidx);
+			return FALSE;
+		}
+	}
+
+	fi->chunkidx_ok = TRUE;
+	return TRUE;
+}
+
+/**
+ * Append chunk at the tail of the chunklist.
+ */
+static void
+fi_chunk_append(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	eslist_append(&fi->chunklist, fc);
+	fi_chunk_index_insert(fi, fc);
+}
+
+/**
+ * Insert new chunk `nfc' right after `fc' in the chunklist.
+ */
+static void
+fi_chunk_insert_after(fileinfo_t *fi,
+	struct dl_file_chunk *fc, struct dl_file_chunk *nfc)
+{
+	eslist_insert_after(&fi->chunklist, fc, nfc);
+	fi_chunk_index_insert(fi, nfc);
+}
+
+/**
+ * Remove the chunk following `fc' in the chunklist.
+ *
+ * @return the removed chunk, which is not freed.
+ */
+static struct dl_file_chunk *
+fi_chunk_remove_after(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	struct dl_file_chunk *removed;
+
+	removed = eslist_remove_after(&fi->chunklist, fc);
+
+	if (fi->chunkidx_ok)
+		erbtree_remove(&fi->chunkidx, &removed->node);
+
+	return removed;
+}
+
+/**
+ * Find the chunk holding the byte at the specified offset.
+ *
+ * This is an O(log n) lookup in the chunk index, falling back to a linear
+ * scan of the chunklist when the index cannot be built.
+ *
+ * @return the chunk containing `offset', NULL if offset lies beyond the
+ * last chunk.
+ */
+static struct dl_file_chunk *
+fi_chunk_find(fileinfo_t *fi, filesize_t offset)
+{
+	struct dl_file_chunk *fc, *found = NULL;
+	const rbnode_t *rn;
+
+	if G_UNLIKELY(!fi_chunk_index_sync(fi)) {
+		ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+			if (fc->from <= offset && offset < fc->to)
+				return fc;
+		}
+		return NULL;
+	}
+
+	/*
+	 * Look for the chunk with the largest starting offset not greater
+	 * than `offset'.
+	 */
+
+	rn = fi->chunkidx.root;
+
+	while (rn != NULL) {
+		fc = erbtree_key(rn, struct dl_file_chunk, node);
+
+		if (fc->from <= offset) {
+			found = fc;
+			rn = rn->right;
+		} else {
+			rn = rn->left;
+		}
+	}
+
+	if (found != NULL && offset < found->to)
+		return found;
+
+	return NULL;
+}
+
+/**
+ * @return the chunk preceding `fc' in the chunklist, NULL if first.
+ */
+static struct dl_file_chunk *
+fi_chunk_prev(fileinfo_t *fi, const struct dl_file_chunk *fc)
+{
+	struct dl_file_chunk *pfc, *prev = NULL;
+	rbnode_t *rn;
+
+	if G_LIKELY(fi_chunk_index_sync(fi)) {
+		rn = erbtree_prev(&fc->node);
+		return NULL == rn ? NULL :
+			erbtree_key(rn, struct dl_file_chunk, node);
+	}
+
+	ESLIST_FOREACH_DATA(&fi->chunklist, pfc) {
+		if (pfc == fc)
+			return prev;
+		prev = pfc;
+	}
+
+	return NULL;
+}
+
 static struct dl_avail_chunk *
 dl_avail_chunk_alloc(void)
 {
@@ -747,6 +969,13 @@ file_info_fd_store_binary(fileinfo_t *fi, const file_object_t *fo)
 	g_assert(fo);
 	g_return_if_fail(0 == ((FI_F_TRANSIENT | FI_F_STRIPPED) & fi->flags));
 
+	/*
+	 * The tigertree is only kept in the trailer, hence we must read it
+	 * before rewriting the trailer or it would be lost.
+	 */
+
+	file_info_tigertree_load(fi);
+
 	TBUF_INIT_WRITE();
 	WRITE_UINT32(FILE_INFO_VERSION, &checksum);
 
@@ -833,7 +1062,14 @@ file_info_fd_store_binary(fileinfo_t *fi, const file_object_t *fo)
 	}
 
 	fi->dirty = FALSE;
-	fileinfo_dirty = TRUE;
+
+	/*
+	 * Chunk changes are journaled for swarming files, there is no need
+	 * to rewrite the whole fileinfo database for them.
+	 */
+
+	if (!fi->use_swarming)
+		fileinfo_dirty = TRUE;
 
 	entropy_harvest_time();
 }
@@ -922,6 +1158,8 @@ file_info_recomputed_tth_internal(
 	g_return_if_fail(fi->sha1 != NULL);
 	g_return_if_fail(NULL == fi->tigertree.leaves);
 
+	fi->flags &= ~FI_F_TT_PENDING;		/* Superseded by the TTH cache */
+
 	if (fi->tth != NULL && !tth_eq(fi->tth, tth)) {
 		g_warning("%s(): inconsistent TTH for \"%s\": "
 			"was known as %s, but got new TTH %s",
@@ -977,6 +1215,8 @@ fi_tigertree_free(fileinfo_t *fi)
 {
 	file_info_check(fi);
 
+	fi->flags &= ~FI_F_TT_PENDING;
+
 	if (fi->tigertree.leaves != NULL) {
 		g_assert(fi->tigertree.num_leaves != 0);
 		WFREE_ARRAY(fi->tigertree.leaves, fi->tigertree.num_leaves);
@@ -992,6 +1232,9 @@ file_info_got_tigertree(fileinfo_t *fi,
 
 	g_return_if_fail(leaves);
 	g_return_if_fail(size_is_positive(num_leaves));
+
+	file_info_tigertree_load(fi);
+
 	g_return_if_fail(fi->tigertree.num_leaves < num_leaves);
 	g_return_if_fail(fi->file_size_known);
 
@@ -1008,6 +1251,51 @@ file_info_got_tigertree(fileinfo_t *fi,
 	}
 }
 
+/**
+ * Load the tigertree from the file trailer, if not done yet.
+ *
+ * Entries loaded from the fileinfo snapshot do not have their trailer read
+ * at startup.  The tigertree leaves, which are only saved in the trailer,
+ * are therefore read the first time they are needed.
+ */
+void
+file_info_tigertree_load(fileinfo_t *fi)
+{
+	fileinfo_t *dfi;
+
+	file_info_check(fi);
+
+	if G_LIKELY(0 == (FI_F_TT_PENDING & fi->flags))
+		return;
+
+	fi->flags &= ~FI_F_TT_PENDING;
+
+	if ((FI_F_TRANSIENT | FI_F_SEEDING | FI_F_STRIPPED) & fi->flags)
+		return;
+
+	dfi = file_info_retrieve_binary(fi->pathname);
+
+	if (NULL == dfi)
+		return;
+
+	if (
+		dfi->tigertree.leaves != NULL &&
+		dfi->size == fi->size && fi->file_size_known &&
+		dfi->tigertree.num_leaves > fi->tigertree.num_leaves
+	) {
+		file_info_got_tigertree(fi,
+			dfi->tigertree.leaves, dfi->tigertree.num_leaves, FALSE);
+
+		if (GNET_PROPERTY(fileinfo_debug) > 1) {
+			g_debug("FILEINFO: loaded %zu tigertree lea%s for \"%s\"",
+				fi->tigertree.num_leaves,
+				plural_f(fi->tigertree.num_leaves), fi->pathname);
+		}
+	}
+
+	fi_free(dfi);
+}
+
 /**
  * Record that the fileinfo trailer has been stripped.
  */
@@ -1103,7 +1391,9 @@ file_info_chunklist_free(fileinfo_t *fi)
 {
 	file_info_check(fi);
 
+	erbtree_clear(&fi->chunkidx);
 	eslist_wfree(&fi->chunklist, sizeof(struct dl_file_chunk));
+	fi->chunkidx_ok = TRUE;		/* Both empty */
 }
 
 /**
@@ -1135,6 +1425,7 @@ fi_downloading_free(fileinfo_t *fi)
 
 	http_rangeset_free_null(&fi->seen_on_network);
 	fi_tigertree_free(fi);
+	fi_hash_free_null(&fi->hasher);
 }
 
 /**
@@ -1276,7 +1567,7 @@ fi_extend_chunklist(fileinfo_t *fi, filesize_t size)
 	fc->from = fi->size;
 	fc->to = size;
 	fc->status = DL_CHUNK_EMPTY;
-	eslist_append(&fi->chunklist, fc);
+	fi_chunk_append(fi, fc);
 
 	/*
 	 * Don't remove/re-insert `fi' from hash tables: when this routine is
@@ -1880,6 +2171,9 @@ file_info_allocate(void)
 	WALLOC0(fi);
 	fi->magic = FI_MAGIC;
 	eslist_init(&fi->chunklist, offsetof(struct dl_file_chunk, lk));
+	erbtree_init(&fi->chunkidx, fi_chunk_from_cmp,
+		offsetof(struct dl_file_chunk, node));
+	fi->chunkidx_ok = TRUE;
 	eslist_init(&fi->available, offsetof(struct dl_avail_chunk, lk));
 
 	return fi;
@@ -2141,7 +2435,7 @@ G_STMT_START {				\
 				if (DL_CHUNK_BUSY == fc->status)
 					fc->status = DL_CHUNK_EMPTY;
 
-				eslist_append(&fi->chunklist, fc);
+				fi_chunk_append(fi, fc);
 			}
 			break;
 		default:
@@ -2227,16 +2521,11 @@ eof:
 }
 
 /**
- * Stores a file info record to the config_dir/fileinfo file, and
- * appends it to the output file in question if needed.
+ * Should fileinfo be persisted in the fileinfo database?
  */
-static void
-file_info_store_one(FILE *f, fileinfo_t *fi)
+static bool
+file_info_is_persistent(const fileinfo_t *fi)
 {
-	slink_t *cl;
-	pslist_t *sl;
-	char *path;
-
 	file_info_check(fi);
 
 	/*
@@ -2247,16 +2536,10 @@ file_info_store_one(FILE *f, fileinfo_t *fi)
 	 */
 
 	if (FI_F_SEEDING == ((FI_F_SEEDING | FI_F_NOSHARE) & fi->flags))
-		goto persist;		/* Skip trailer writes, of course */
+		return TRUE;
 
 	if (fi->flags & (FI_F_TRANSIENT | FI_F_SEEDING | FI_F_STRIPPED))
-		return;
-
-	if (fi->use_swarming && fi->dirty) {
-		file_info_store_binary(fi, FALSE);
-	}
-
-persist:
+		return FALSE;
 
 	/*
 	 * Keep entries for incomplete or not even started downloads so that the
@@ -2266,11 +2549,26 @@ persist:
 	if (0 == fi->refcount && fi->done == fi->size) {
 		filestat_t st;
 
-		if (-1 == stat(fi->pathname, &st)) {
-			return; 	/* Skip: not referenced, and file no longer exists */
-		}
+		if (-1 == stat(fi->pathname, &st))
+			return FALSE;	/* Not referenced, and file no longer exists */
 	}
 
+	return TRUE;
+}
+
+/**
+ * Stores a file info record to the config_dir/fileinfo file.
+ */
+static void
+file_info_store_one(FILE *f, fileinfo_t *fi)
+{
+	slink_t *cl;
+	pslist_t *sl;
+	char *path;
+
+	if (!file_info_is_persistent(fi))
+		return;
+
 	path = filepath_directory(fi->pathname);
 	fprintf(f,
 		"# refcount %u\n"
@@ -2363,10 +2661,10 @@ file_info_store_list(void *value, void *user_data)
 
 /**
  * Stores the list of output files and their metainfo to the
- * configdir/fileinfo database.
+ * configdir/fileinfo text database.
  */
-void
-file_info_store(void)
+static void
+file_info_store_text(void)
 {
 	FILE *f;
 	file_path_t fp;
@@ -2408,63 +2706,310 @@ file_info_store(void)
 	hikset_foreach(fi_by_outname, file_info_store_list, f);
 
 	file_config_close(f, &fp);
-	fileinfo_dirty = FALSE;
 }
 
 /**
- * Store global file information cache if dirty.
+ * Serialize fileinfo into a snapshot record.
+ *
+ * The record is made of a 32-bit length, the serialized fields and the
+ * CRC32 of these fields, lengths and CRC being big-endian.
+ *
+ * @return the serialized record, to be freed with pmsg_free().
  */
-void
-file_info_store_if_dirty(void)
+static pmsg_t *
+fi_snapshot_serialize(const fileinfo_t *fi)
 {
-	if (fileinfo_dirty)
-		file_info_store();
-}
+	const pslist_t *sl;
+	const slink_t *cl;
+	size_t len, count;
+	uint8 flags = 0;
+	pmsg_t *mb;
 
-/*
- * Notify interested parties that file info is being removed and free
- * its handle.  Used mainly during final cleanup.
- */
-static void
-fi_dispose(fileinfo_t *fi)
-{
-	file_info_check(fi);
+	/*
+	 * Compute an upper bound of the serialized size, strings being
+	 * prefixed by their length which takes at most 10 bytes.
+	 */
 
-	file_info_drop_handle(fi, "Shutting down");
+	count = eslist_count(&fi->chunklist);
+	len = 4 + 10 + strlen(fi->pathname) + GUID_RAW_SIZE + 4 + 1 +
+		SHA1_RAW_SIZE + TTH_RAW_SIZE + SHA1_RAW_SIZE + 8 + 4 * 4 +
+		4 + 4 + count * 9 + 4;
+
+	PSLIST_FOREACH(fi->alias, sl) {
+		len += 10 + strlen(sl->data);
+	}
+
+	if (FI_F_PAUSED & fi->flags)
+		flags |= FI_SNAP_PAUSED;
+	if (FI_F_SEEDING == ((FI_F_SEEDING | FI_F_NOSHARE) & fi->flags))
+		flags |= FI_SNAP_SEEDING;
+	if (fi->file_size_known)
+		flags |= FI_SNAP_SIZE_KNOWN;
+	if (fi->use_swarming)
+		flags |= FI_SNAP_SWARMING;
+	if (fi->sha1 != NULL)
+		flags |= FI_SNAP_SHA1;
+	if (fi->tth != NULL)
+		flags |= FI_SNAP_TTH;
+	if (fi->cha1 != NULL)
+		flags |= FI_SNAP_CHA1;
+
+	mb = pmsg_new(PMSG_P_DATA, NULL, len);
+
+	pmsg_write_be32(mb, 0);			/* Length, filled below */
+	pmsg_write_string(mb, fi->pathname, (size_t) -1);
+	pmsg_write(mb, fi->guid, GUID_RAW_SIZE);
+	pmsg_write_be32(mb, fi->generation);
+	pmsg_write_u8(mb, flags);
+
+	if (fi->sha1 != NULL)
+		pmsg_write(mb, fi->sha1, SHA1_RAW_SIZE);
+	if (fi->tth != NULL)
+		pmsg_write(mb, fi->tth, TTH_RAW_SIZE);
+	if (fi->cha1 != NULL)
+		pmsg_write(mb, fi->cha1, SHA1_RAW_SIZE);
+
+	pmsg_write_be64(mb, fi->size);
+	pmsg_write_time(mb, fi->stamp);
+	pmsg_write_time(mb, fi->created);
+	pmsg_write_time(mb, fi->ntime);
+	pmsg_write_time(mb, fi->modified);
+
+	pmsg_write_be32(mb, pslist_length(fi->alias));
+	PSLIST_FOREACH(fi->alias, sl) {
+		pmsg_write_string(mb, sl->data, (size_t) -1);
+	}
 
 	/*
-	 * Note that normally all fileinfo structures should have been collected
-	 * during the freeing of downloads, so if we come here with a non-zero
-	 * refcount, something is wrong with our memory management.
-	 *
-	 * (refcount of zero is possible if we have a fileinfo entry but no
-	 * download attached to that fileinfo)
+	 * Chunks are contiguous, hence we only need to emit their end.
 	 */
 
-	if (fi->refcount)
-		g_warning("%s(): refcount = %u for \"%s\"",
-			G_STRFUNC, fi->refcount, fi->pathname);
+	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	fi->hashed = FALSE;
-	fi_free(fi);
+	pmsg_write_be32(mb, count);
+	ESLIST_FOREACH(&fi->chunklist, cl) {
+		const struct dl_file_chunk *fc = eslist_data(&fi->chunklist, cl);
+
+		dl_file_chunk_check(fc);
+		pmsg_write_be64(mb, fc->to);
+		pmsg_write_u8(mb, fc->status);
+	}
+
+	len = pmsg_size(mb);
+	poke_be32(pmsg_start(mb), len - 4);
+	pmsg_write_be32(mb, crc32_update(0, pmsg_start(mb) + 4, len - 4));
+
+	return mb;
 }
 
 /**
- * Callback for hash table iterator. Used by file_info_close().
+ * Context for file_info_store_snapshot_one().
+ */
+struct fi_snapshot_ctx {
+	FILE *f;				/**< Snapshot being written */
+	size_t count;			/**< Records written */
+	bool error;				/**< Whether a write error occurred */
+};
+
+/**
+ * Hash table iterator callback, writing a snapshot record for fileinfo.
  */
 static void
-file_info_free_sha1_kv(void *val, void *unused_x)
+file_info_store_snapshot_one(void *value, void *data)
 {
-	const fileinfo_t *fi = val;
+	fileinfo_t *fi = value;
+	struct fi_snapshot_ctx *ctx = data;
+	pmsg_t *mb;
 
-	(void) unused_x;
-	file_info_check(fi);
+	if (ctx->error || !file_info_is_persistent(fi))
+		return;
 
-	/* fi structure in value not freed, shared with other hash tables */
+	mb = fi_snapshot_serialize(fi);
+
+	if (1 != fwrite(pmsg_start(mb), pmsg_size(mb), 1, ctx->f))
+		ctx->error = TRUE;
+	else
+		ctx->count++;
+
+	pmsg_free(mb);
 }
 
 /**
- * Callback for hash table iterator. Used by file_info_close().
+ * Write the fileinfo snapshot, the compact binary form of the database
+ * onto which the journal is replayed at startup.
+ *
+ * The file starts with an 8-byte magic and a 32-bit version, then holds
+ * one record per entry and ends with a null length followed by the
+ * amount of records, to detect truncation.
+ *
+ * @return TRUE if the snapshot was written.
+ */
+static bool
+file_info_store_snapshot(void)
+{
+	struct fi_snapshot_ctx ctx;
+	char buf[FI_SNAPSHOT_HDRLEN];
+	file_path_t fp;
+
+	file_path_set(&fp, settings_config_dir(), file_info_snapshot);
+
+	ZERO(&ctx);
+	ctx.f = file_config_open_write(file_info_snapshot_what, &fp);
+
+	if (NULL == ctx.f)
+		return FALSE;
+
+	memcpy(buf, fi_snapshot_magic, 8);
+	poke_be32(&buf[8], FI_SNAPSHOT_VERSION);
+
+	if (1 != fwrite(buf, FI_SNAPSHOT_HDRLEN, 1, ctx.f))
+		ctx.error = TRUE;
+
+	hikset_foreach(fi_by_outname, file_info_store_snapshot_one, &ctx);
+
+	poke_be32(&buf[0], 0);
+	poke_be32(&buf[4], ctx.count);
+
+	if (!ctx.error && 1 != fwrite(buf, 8, 1, ctx.f))
+		ctx.error = TRUE;
+
+	/*
+	 * Do not replace the previous snapshot with a partial one.
+	 */
+
+	if (ctx.error) {
+		g_warning("%s(): cannot write %s: %m", G_STRFUNC, file_info_snapshot);
+		fclose(ctx.f);
+		return FALSE;
+	}
+
+	if (!file_config_close(ctx.f, &fp))
+		return FALSE;
+
+	if (GNET_PROPERTY(fileinfo_debug)) {
+		g_debug("%s(): wrote %zu entr%s to %s", G_STRFUNC,
+			ctx.count, plural_y(ctx.count), file_info_snapshot);
+	}
+
+	return TRUE;
+}
+
+/**
+ * Write a checkpoint of the fileinfo database.
+ *
+ * The checkpoint is the binary snapshot: all the chunk changes recorded
+ * in the journal so far become useless once it is written.
+ */
+void
+file_info_store(void)
+{
+	if (!file_info_store_snapshot())
+		return;
+
+	fileinfo_dirty = FALSE;
+	fileinfo_checkpoint = tm_time();
+	fi_journal_checkpoint();
+}
+
+/**
+ * Hash table iterator callback, flushing the pending trailer update.
+ */
+static void
+file_info_store_trailer(void *value, void *unused_data)
+{
+	fileinfo_t *fi = value;
+
+	(void) unused_data;
+	file_info_check(fi);
+
+	if (fi->flags & (FI_F_TRANSIENT | FI_F_SEEDING | FI_F_STRIPPED))
+		return;
+
+	if (fi->use_swarming && fi->dirty)
+		file_info_store_binary(fi, FALSE);
+}
+
+/**
+ * Store the fileinfo database in its text form as well, along with the
+ * pending trailer updates.
+ *
+ * This is only done at shutdown.  Periodic checkpoints only write the
+ * snapshot and the text database is only read back when it is more recent
+ * than the snapshot, i.e. when it was edited or written by a version that
+ * does not know about the snapshot.
+ */
+void
+file_info_store_all(void)
+{
+	hikset_foreach(fi_by_outname, file_info_store_trailer, NULL);
+	file_info_store_text();
+	file_info_store();		/* Must come last, to be more recent */
+}
+
+/**
+ * Store global file information cache if dirty.
+ *
+ * Chunk changes are only journaled, so we also write a checkpoint when
+ * the journal grows too large or has not been folded back for a while.
+ */
+void
+file_info_store_if_dirty(void)
+{
+	size_t count = fi_journal_count();
+
+	if (
+		fileinfo_dirty ||
+		count >= FI_JOURNAL_MAX ||
+		(0 != count &&
+			delta_time(tm_time(), fileinfo_checkpoint) >= FI_JOURNAL_PERIOD)
+	)
+		file_info_store();
+}
+
+/*
+ * Notify interested parties that file info is being removed and free
+ * its handle.  Used mainly during final cleanup.
+ */
+static void
+fi_dispose(fileinfo_t *fi)
+{
+	file_info_check(fi);
+
+	file_info_drop_handle(fi, "Shutting down");
+
+	/*
+	 * Note that normally all fileinfo structures should have been collected
+	 * during the freeing of downloads, so if we come here with a non-zero
+	 * refcount, something is wrong with our memory management.
+	 *
+	 * (refcount of zero is possible if we have a fileinfo entry but no
+	 * download attached to that fileinfo)
+	 */
+
+	if (fi->refcount)
+		g_warning("%s(): refcount = %u for \"%s\"",
+			G_STRFUNC, fi->refcount, fi->pathname);
+
+	fi->hashed = FALSE;
+	fi_free(fi);
+}
+
+/**
+ * Callback for hash table iterator. Used by file_info_close().
+ */
+static void
+file_info_free_sha1_kv(void *val, void *unused_x)
+{
+	const fileinfo_t *fi = val;
+
+	(void) unused_x;
+	file_info_check(fi);
+
+	/* fi structure in value not freed, shared with other hash tables */
+}
+
+/**
+ * Callback for hash table iterator. Used by file_info_close().
  */
 static void
 file_info_free_namesize_kv(const void *key, void *val, void *unused_x)
@@ -2585,6 +3130,9 @@ file_info_close(void)
 {
 	unsigned i;
 
+	fi_journal_close();
+	HFREE_NULL(fi_hash_buf);
+
 	/*
 	 * Freeing callbacks expect that the freeing of the `fi_by_outname'
 	 * table will free the referenced `fi' (since that table MUST contain
@@ -3103,48 +3651,487 @@ fi_reset_chunks(fileinfo_t *fi)
 	if (fi->file_size_known) {
 		struct dl_file_chunk *fc;
 
-		file_info_chunklist_free(fi);
-		fc = dl_file_chunk_alloc();
-		fc->from = 0;
-		fc->to = fi->size;
-		fc->status = DL_CHUNK_EMPTY;
-		eslist_append(&fi->chunklist, fc);
+		file_info_chunklist_free(fi);
+		fc = dl_file_chunk_alloc();
+		fc->from = 0;
+		fc->to = fi->size;
+		fc->status = DL_CHUNK_EMPTY;
+		fi_chunk_append(fi, fc);
+	}
+
+	fi->generation = 0;		/* Restarting from scratch... */
+	fi->done = 0;
+	atom_sha1_free_null(&fi->cha1);
+}
+
+/**
+ * Copy CHUNK info from binary trailer `trailer' into `fi'.
+ */
+static void
+fi_copy_chunks(fileinfo_t *fi, fileinfo_t *trailer)
+{
+	const struct dl_file_chunk *fc;
+
+	file_info_check(fi);
+	file_info_check(trailer);
+	g_assert(0 == eslist_count(&fi->chunklist));
+	g_assert(file_info_check_chunklist(trailer, TRUE));
+
+	fi->generation = trailer->generation;
+	if (trailer->cha1)
+		fi->cha1 = atom_sha1_get(trailer->cha1);
+
+	ESLIST_FOREACH_DATA(&trailer->chunklist, fc) {
+		dl_file_chunk_check(fc);
+		g_assert(fc->from <= fc->to);
+
+		fi_chunk_append(fi, WCOPY(fc));
+	}
+
+	file_info_merge_adjacent(fi); /* Recalculates also fi->done */
+}
+
+/**
+ * Journal replay callback, applying the recorded chunk change.
+ */
+static void
+file_info_journal_apply(const struct guid *guid,
+	fi_journal_type_t type, filesize_t from, filesize_t to)
+{
+	fileinfo_t *fi;
+
+	fi = hikset_lookup(fi_by_guid, guid);
+
+	if (NULL == fi)
+		return;			/* Entry was removed since then */
+
+	file_info_check(fi);
+
+	if (0 == eslist_count(&fi->chunklist) || to > fi->size) {
+		if (GNET_PROPERTY(fileinfo_debug)) {
+			g_debug("%s(): ignoring journaled range %s-%s for \"%s\"",
+				G_STRFUNC, filesize_to_string(from), filesize_to_string2(to),
+				fi->pathname);
+		}
+		return;
+	}
+
+	fi_update_range(fi, from, to,
+		FI_JOURNAL_DONE == type ? DL_CHUNK_DONE : DL_CHUNK_EMPTY, NULL);
+	file_info_merge_adjacent(fi);		/* Also updates fi->done */
+}
+
+/**
+ * Replay the fileinfo journal over the loaded database, then start
+ * journaling chunk changes.
+ */
+static void
+file_info_journal_start(void)
+{
+	char *path;
+	size_t n;
+
+	path = make_pathname(settings_config_dir(), file_info_journal);
+	n = fi_journal_replay(path, file_info_journal_apply);
+
+	/*
+	 * Opening the journal discards its records, hence we need to
+	 * write a checkpoint first if we replayed any.
+	 */
+
+	if (n != 0) {
+		g_message("replayed %zu fileinfo change%s", n, plural(n));
+		file_info_store();
+	}
+
+	fi_journal_open(path);
+	HFREE_NULL(path);
+}
+
+/**
+ * Insert fileinfo loaded from the database into the hash tables and
+ * record its aliases.
+ */
+static void
+file_info_retrieve_insert(fileinfo_t *fi)
+{
+	file_info_hash_insert(fi);
+
+	if (can_publish_partial_sha1 && fi->sha1 != NULL) {
+		publisher_add(fi->sha1);
+	}
+
+	/*
+	 * We could not add the aliases immediately because the file
+	 * is formatted with ALIA coming before SIZE.  To let fi_alias()
+	 * detect conflicting entries, we need to have a valid fi->size.
+	 * And since the `fi' is hashed, we can detect duplicates in
+	 * the `aliases' list itself as an added bonus.
+	 */
+
+	if (fi->alias) {
+		pslist_t *aliases, *sl;
+
+		/* For efficiency each alias has been prepended to
+		 * the list. To preserve the order between sessions,
+		 * the original list order is restored here. */
+		aliases = pslist_reverse(fi->alias);
+		fi->alias = NULL;
+		PSLIST_FOREACH(aliases, sl) {
+			const char *s = sl->data;
+			fi_alias(fi, s, TRUE);
+			atom_str_free_null(&s);
+		}
+		pslist_free_null(&aliases);
+	}
+}
+
+/**
+ * Deserialize fileinfo from the fields of a snapshot record.
+ *
+ * @return new fileinfo, NULL if the record was invalid.
+ */
+static fileinfo_t *
+fi_snapshot_deserialize(const char *data, size_t len)
+{
+	bstr_t *bs;
+	fileinfo_t *fi;
+	char *str;
+	char buf[TTH_RAW_SIZE];
+	uint8 flags;
+	uint32 i, count;
+	uint64 to;
+	filesize_t from = 0;
+
+	STATIC_ASSERT(TTH_RAW_SIZE >= SHA1_RAW_SIZE);
+	STATIC_ASSERT(TTH_RAW_SIZE >= GUID_RAW_SIZE);
+
+	bs = bstr_open(data, len, BSTR_F_ERROR);
+	fi = file_info_allocate();
+
+	if (!bstr_read_string(bs, NULL, &str))
+		goto failed;
+
+	fi->pathname = atom_str_get(str);
+	HFREE_NULL(str);
+
+	if (!is_absolute_path(fi->pathname))
+		goto failed;
+
+	if (!bstr_read(bs, buf, GUID_RAW_SIZE))
+		goto failed;
+
+	fi->guid = atom_guid_get((struct guid *) buf);
+
+	if (!bstr_read_be32(bs, &fi->generation) || !bstr_read_u8(bs, &flags))
+		goto failed;
+
+	if (FI_SNAP_PAUSED & flags)
+		fi->flags |= FI_F_PAUSED;
+	if (FI_SNAP_SEEDING & flags)
+		fi->flags |= FI_F_SEEDING | FI_F_STRIPPED;
+	fi->file_size_known = booleanize(FI_SNAP_SIZE_KNOWN & flags);
+	fi->use_swarming = booleanize(FI_SNAP_SWARMING & flags);
+
+	if (FI_SNAP_SHA1 & flags) {
+		if (!bstr_read(bs, buf, SHA1_RAW_SIZE))
+			goto failed;
+		fi->sha1 = atom_sha1_get((struct sha1 *) buf);
+	}
+
+	if (FI_SNAP_TTH & flags) {
+		if (!bstr_read(bs, buf, TTH_RAW_SIZE))
+			goto failed;
+		fi->tth = atom_tth_get((struct tth *) buf);
+	}
+
+	if (FI_SNAP_CHA1 & flags) {
+		if (!bstr_read(bs, buf, SHA1_RAW_SIZE))
+			goto failed;
+		fi->cha1 = atom_sha1_get((struct sha1 *) buf);
+	}
+
+	if (
+		!bstr_read_be64(bs, &fi->size) ||
+		!bstr_read_time(bs, &fi->stamp) ||
+		!bstr_read_time(bs, &fi->created) ||
+		!bstr_read_time(bs, &fi->ntime) ||
+		!bstr_read_time(bs, &fi->modified) ||
+		!bstr_read_be32(bs, &count)
+	)
+		goto failed;
+
+	if (fi->size >= ((uint64) 1UL << 63))
+		goto failed;
+
+	/*
+	 * Aliases are prepended, as when parsing the text database, for
+	 * file_info_retrieve_insert() to restore their order.
+	 */
+
+	for (i = 0; i < count; i++) {
+		if (!bstr_read_string(bs, NULL, &str))
+			goto failed;
+		fi->alias = pslist_prepend_const(fi->alias, atom_str_get(str));
+		HFREE_NULL(str);
+	}
+
+	if (!bstr_read_be32(bs, &count))
+		goto failed;
+
+	for (i = 0; i < count; i++) {
+		struct dl_file_chunk *fc;
+		uint8 status;
+
+		if (!bstr_read_be64(bs, &to) || !bstr_read_u8(bs, &status))
+			goto failed;
+
+		if (to <= from || to > fi->size || status > DL_CHUNK_DONE)
+			goto failed;
+
+		fc = dl_file_chunk_alloc();
+		fc->from = from;
+		fc->to = to;
+		fc->status = DL_CHUNK_BUSY == status ? DL_CHUNK_EMPTY : status;
+		fi_chunk_append(fi, fc);
+		from = to;
+	}
+
+	if (0 != count && from != fi->size)
+		goto failed;
+
+	if (!bstr_ended(bs))
+		goto failed;
+
+	bstr_free(&bs);
+	return fi;
+
+failed:
+	g_warning("%s(): ignoring invalid snapshot record for \"%s\": %s",
+		G_STRFUNC, NULL_STRING(fi->pathname),
+		bstr_has_error(bs) ? bstr_error(bs) : "inconsistent data");
+	bstr_free(&bs);
+	fi_free(fi);
+	return NULL;
+}
+
+/**
+ * Validate fileinfo loaded from the snapshot and insert it.
+ *
+ * Contrary to entries loaded from the text database, the file trailer is
+ * not read: the snapshot and the journal are the reference, and the
+ * tigertree that is only saved in the trailer is loaded when needed.
+ *
+ * @return TRUE if entry was kept, FALSE if it must be freed.
+ */
+static bool
+file_info_snapshot_insert(fileinfo_t *fi)
+{
+	fileinfo_t *dfi;
+
+	if (hikset_contains(fi_by_outname, fi->pathname)) {
+		g_warning("discarding DUPLICATE fileinfo entry for \"%s\"",
+			filepath_basename(fi->pathname));
+		return FALSE;
+	}
+
+	if (0 == fi->size)
+		fi->file_size_known = FALSE;
+
+	fi_upgrade_older_version(fi);
+
+	/*
+	 * Seeded entries are only kept when we are recovering from a crash.
+	 */
+
+	if (FI_F_SEEDING & fi->flags) {
+		if (!crash_was_restarted()) {
+			if (GNET_PROPERTY(share_debug))
+				g_info("SHARE discarding seeded file %s", fi->pathname);
+			return FALSE;
+		}
+
+		if (NULL == fi->sha1 || !file_exists(fi->pathname)) {
+			g_warning("%s(): missing previously seeded file %s",
+				G_STRFUNC, fi->pathname);
+			return FALSE;
+		}
+
+		if (fi->tth != NULL)
+			file_info_recomputed_tth_internal(fi, fi->tth, FALSE);
+
+		goto ready;
+	}
+
+	if (0 == eslist_count(&fi->chunklist) && fi->file_size_known) {
+		g_warning("no chunk info for \"%s\"", fi->pathname);
+		fi_reset_chunks(fi);
+	}
+
+	file_info_merge_adjacent(fi);		/* Computes fi->done */
+
+	/*
+	 * A stat() is all it takes to spot files that were removed, whereas
+	 * loading the text database needs to read their trailer.
+	 */
+
+	if (fi->done > 0 && !is_regular(fi->pathname)) {
+		g_warning("discarding cached metainfo for \"%s\": "
+			"file had %s bytes downloaded but is now gone!",
+			fi->pathname, filesize_to_string(fi->done));
+		return FALSE;
+	}
+
+	dfi = file_info_lookup_dup(fi);
+
+	if (NULL != dfi) {
+		g_warning("found DUPLICATE entry for \"%s\" "
+			"(%s bytes) with \"%s\" (%s bytes)",
+			fi->pathname, filesize_to_string(fi->size),
+			dfi->pathname, filesize_to_string2(dfi->size));
+		return FALSE;
+	}
+
+	fi->flags |= FI_F_TT_PENDING;
+
+ready:
+	file_info_retrieve_insert(fi);
+	return TRUE;
+}
+
+/**
+ * Check the framing of the snapshot held in `data'.
+ *
+ * @return TRUE if all the records are present and intact.
+ */
+static bool
+fi_snapshot_check(const char *data, size_t len, const char *path)
+{
+	const char *p = data + FI_SNAPSHOT_HDRLEN, *end = data + len;
+	size_t n = 0;
+
+	if (
+		len < FI_SNAPSHOT_HDRLEN ||
+		0 != memcmp(data, fi_snapshot_magic, 8) ||
+		FI_SNAPSHOT_VERSION != peek_be32(&data[8])
+	) {
+		g_warning("%s(): ignoring invalid %s", G_STRFUNC, path);
+		return FALSE;
+	}
+
+	while (ptr_diff(end, p) >= 8) {
+		size_t rlen = peek_be32(p);
+
+		if (0 == rlen) {
+			if (peek_be32(&p[4]) == n && p + 8 == end)
+				return TRUE;
+			break;
+		}
+
+		if (rlen > ptr_diff(end, p) - 8)
+			break;
+
+		if (peek_be32(&p[4 + rlen]) != crc32_update(0, &p[4], rlen)) {
+			g_warning("%s(): corrupted record #%zu in %s",
+				G_STRFUNC, n + 1, path);
+			return FALSE;
+		}
+
+		p += 4 + rlen + 4;
+		n++;
+	}
+
+	g_warning("%s(): truncated %s after %zu record%s",
+		G_STRFUNC, path, n, plural(n));
+
+	return FALSE;
+}
+
+/**
+ * Load the fileinfo database from the binary snapshot.
+ *
+ * The snapshot is checked as a whole before anything is loaded, so that we
+ * can fall back to the text database should it be unusable.
+ *
+ * @return TRUE if the snapshot was loaded.
+ */
+static bool G_COLD
+file_info_retrieve_snapshot(const char *path)
+{
+	filestat_t sb;
+	char *data;
+	const char *p;
+	size_t len, n = 0, count = 0;
+	ssize_t r;
+	int fd;
+	bool ok = FALSE;
+
+	fd = file_open_missing(path, O_RDONLY);
+	if (-1 == fd)
+		return FALSE;
+
+	if (-1 == fstat(fd, &sb)) {
+		g_warning("%s(): cannot stat %s: %m", G_STRFUNC, path);
+		fd_forget_and_close(&fd);
+		return FALSE;
+	}
+
+	if (sb.st_size < FI_SNAPSHOT_HDRLEN || sb.st_size > FI_SNAPSHOT_MAXLEN) {
+		g_warning("%s(): ignoring %s: unexpected size of %s bytes",
+			G_STRFUNC, path, filesize_to_string(sb.st_size));
+		fd_forget_and_close(&fd);
+		return FALSE;
+	}
+
+	len = sb.st_size;
+	data = halloc(len);
+	r = read(fd, data, len);
+	fd_forget_and_close(&fd);
+
+	if (-1 == r) {
+		g_warning("%s(): cannot read %s: %m", G_STRFUNC, path);
+		goto done;
+	} else if (r != (ssize_t) len) {
+		g_warning("%s(): short read on %s (%zd/%zu bytes)",
+			G_STRFUNC, path, r, len);
+		goto done;
 	}
 
-	fi->generation = 0;		/* Restarting from scratch... */
-	fi->done = 0;
-	atom_sha1_free_null(&fi->cha1);
-}
+	if (!fi_snapshot_check(data, len, path))
+		goto done;
 
-/**
- * Copy CHUNK info from binary trailer `trailer' into `fi'.
- */
-static void
-fi_copy_chunks(fileinfo_t *fi, fileinfo_t *trailer)
-{
-	const struct dl_file_chunk *fc;
+	for (p = data + FI_SNAPSHOT_HDRLEN; 0 != peek_be32(p); /* empty */) {
+		size_t rlen = peek_be32(p);
+		fileinfo_t *fi;
 
-	file_info_check(fi);
-	file_info_check(trailer);
-	g_assert(0 == eslist_count(&fi->chunklist));
-	g_assert(file_info_check_chunklist(trailer, TRUE));
+		fi = fi_snapshot_deserialize(&p[4], rlen);
+		p += 4 + rlen + 4;
+		n++;
 
-	fi->generation = trailer->generation;
-	if (trailer->cha1)
-		fi->cha1 = atom_sha1_get(trailer->cha1);
+		if (NULL == fi)
+			continue;
 
-	ESLIST_FOREACH_DATA(&trailer->chunklist, fc) {
-		dl_file_chunk_check(fc);
-		g_assert(fc->from <= fc->to);
+		if (file_info_snapshot_insert(fi))
+			count++;
+		else
+			fi_free(fi);
+	}
+
+	ok = TRUE;
 
-		eslist_append(&fi->chunklist, WCOPY(fc));
+	if (GNET_PROPERTY(fileinfo_debug)) {
+		g_debug("%s(): loaded %zu/%zu entr%s from %s",
+			G_STRFUNC, count, n, plural_y(n), path);
 	}
 
-	file_info_merge_adjacent(fi); /* Recalculates also fi->done */
+done:
+	HFREE_NULL(data);
+	return ok;
 }
 
 /**
- * Loads the fileinfo database from disk, and saves a copy in fileinfo.orig.
+ * Loads the fileinfo database from disk, from the snapshot if possible,
+ * otherwise from the text database of which a copy is saved in fileinfo.orig.
  */
 void G_COLD
 file_info_retrieve(void)
@@ -3173,10 +4160,38 @@ file_info_retrieve(void)
 
 	can_swarm = TRUE;			/* Allows file_info_try_to_swarm_with() */
 
+	/*
+	 * The text database is only written at shutdown, before the snapshot,
+	 * so when it is more recent it was edited or written by a version that
+	 * does not know about the snapshot, and it must be used instead.
+	 */
+
+	{
+		filestat_t snap, text;
+		char *snapshot, *textdb;
+		bool loaded = FALSE;
+
+		snapshot = make_pathname(settings_config_dir(), file_info_snapshot);
+		textdb = make_pathname(settings_config_dir(), file_info_file);
+
+		if (
+			0 == stat(snapshot, &snap) &&
+			(-1 == stat(textdb, &text) ||
+				delta_time(text.st_mtime, snap.st_mtime) <= 0)
+		)
+			loaded = file_info_retrieve_snapshot(snapshot);
+
+		HFREE_NULL(snapshot);
+		HFREE_NULL(textdb);
+
+		if (loaded)
+			goto journal;
+	}
+
 	file_path_set(&fp, settings_config_dir(), file_info_file);
 	f = file_config_open_read(file_info_what, &fp, 1);
 	if (!f)
-		return;
+		goto journal;
 
 	while (fgets(line, sizeof line, f)) {
 		int error;
@@ -3447,7 +4462,11 @@ file_info_retrieve(void)
 					}
 				}
 			} else if (dfi->generation > fi->generation) {
-				g_warning("found more recent metainfo in \"%s\"", fi->pathname);
+				/* Normal since chunk changes are journaled */
+				if (GNET_PROPERTY(fileinfo_debug)) {
+					g_debug("found more recent metainfo in \"%s\"",
+						fi->pathname);
+				}
 				fi_free(fi);
 				fi = dfi;
 			} else if (dfi->generation < fi->generation) {
@@ -3490,35 +4509,7 @@ file_info_retrieve(void)
 
 		ready:
 
-			file_info_hash_insert(fi);
-
-			if (can_publish_partial_sha1 && fi->sha1 != NULL) {
-				publisher_add(fi->sha1);
-			}
-
-			/*
-			 * We could not add the aliases immediately because the file
-			 * is formatted with ALIA coming before SIZE.  To let fi_alias()
-			 * detect conflicting entries, we need to have a valid fi->size.
-			 * And since the `fi' is hashed, we can detect duplicates in
-			 * the `aliases' list itself as an added bonus.
-			 */
-
-			if (fi->alias) {
-				pslist_t *aliases, *sl;
-
-				/* For efficiency each alias has been prepended to
-				 * the list. To preserve the order between sessions,
-				 * the original list order is restored here. */
-				aliases = pslist_reverse(fi->alias);
-				fi->alias = NULL;
-				PSLIST_FOREACH(aliases, sl) {
-					const char *s = sl->data;
-					fi_alias(fi, s, TRUE);
-					atom_str_free_null(&s);
-				}
-				pslist_free_null(&aliases);
-			}
+			file_info_retrieve_insert(fi);
 
 			empty = FALSE;
 			fi = NULL;
@@ -3736,7 +4727,7 @@ file_info_retrieve(void)
 							filesize_to_string(fi->size));
 						damaged = TRUE;
 					} else {
-						eslist_append(&fi->chunklist, fc);
+						fi_chunk_append(fi, fc);
 					}
 				}
 			}
@@ -3768,6 +4759,9 @@ file_info_retrieve(void)
 	atom_str_free_null(&path);
 
 	fclose(f);
+
+journal:
+	file_info_journal_start();
 }
 
 static bool
@@ -3881,7 +4875,7 @@ file_info_create(const char *file, const char *path, filesize_t size,
 		fi->size = fc->to = st.st_size;
 		fc->status = DL_CHUNK_DONE;
 		fi->modified = st.st_mtime;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 		fi->dirty = TRUE;
 	}
 
@@ -4351,7 +5345,7 @@ file_info_merge_adjacent(fileinfo_t *fi)
 			void *removed;
 
 			fc1->to = fc2->to;
-			removed = eslist_remove_after(&fi->chunklist, fc1);
+			removed = fi_chunk_remove_after(fi, fc1);
 			g_assert(removed == fc2);
 			dl_file_chunk_free(&fc2);
 			fc2 = fc1;					/* new current chunk */
@@ -4386,6 +5380,7 @@ file_info_size_unknown(fileinfo_t *fi)
 		fileinfo_dirty = TRUE;
 	}
 
+	fi_hash_free_null(&fi->hasher);		/* Only done with known sizes */
 	fi->file_size_known = FALSE;
 	fi_event_trigger(fi, EV_FI_INFO_CHANGED);
 
@@ -4422,7 +5417,7 @@ file_info_size_known(struct download *d, filesize_t size)
 			fc->to = fi->done;			/* Byte at that offset is excluded */
 			fc->status = DL_CHUNK_DONE;
 
-			eslist_append(&fi->chunklist, fc);
+			fi_chunk_append(fi, fc);
 		} else {
 			fc->to = fi->done;
 
@@ -4433,7 +5428,7 @@ file_info_size_known(struct download *d, filesize_t size)
 			while (NULL != eslist_next(&fc->lk)) {
 				struct dl_file_chunk *fcn;
 
-				fcn = eslist_remove_after(&fi->chunklist, fc);
+				fcn = fi_chunk_remove_after(fi, fc);
 				dl_file_chunk_free(&fcn);
 			}
 		}
@@ -4452,7 +5447,7 @@ file_info_size_known(struct download *d, filesize_t size)
 		fc->to = size;				/* Byte at that offset is excluded */
 		fc->status = DL_CHUNK_BUSY;
 		fc->download = d;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 	}
 
 	fi->file_size_known = TRUE;
@@ -4471,67 +5466,37 @@ file_info_size_known(struct download *d, filesize_t size)
 }
 
 /**
- * Marks a chunk of the file with given status.
- * The bytes range from `from' (included) to `to' (excluded).
+ * Marks range [from, to[ of the file with given status, linking the range
+ * to `newval' (NULL when marking it as EMPTY).
  *
- * When not marking the chunk as EMPTY, the range is linked to
- * the supplied download `d' so we know who "owns" it currently.
+ * @return TRUE if part of the range was DONE and is no longer.
  */
-void
-file_info_update(const struct download *d, filesize_t from, filesize_t to,
-		enum dl_chunk_status status)
+static bool
+fi_update_range(fileinfo_t *fi, filesize_t from, filesize_t to,
+	enum dl_chunk_status status, const struct download *newval)
 {
 	struct dl_file_chunk *fc, *nfc, *prevfc;
 	slink_t *sl;
-	fileinfo_t *fi;
-	bool found = FALSE;
-	int n, againcount = 0;
+	bool found = FALSE, regressed = FALSE;
+	int againcount = 0;
 	bool need_merging;
-	const struct download *newval;
 
-	download_check(d);
-	fi = d->file_info;
 	file_info_check(fi);
-	g_assert(fi->refcount > 0);
 	g_assert(from < to);
+	g_assert(file_info_check_chunklist(fi, TRUE));
 
 	switch (status) {
 	case DL_CHUNK_DONE:
 		need_merging = FALSE;
-		newval = d;
 		goto status_ok;
 	case DL_CHUNK_BUSY:
-		need_merging = TRUE;
-		newval = d;
-		g_assert(fi->lifecount > 0);
-		goto status_ok;
 	case DL_CHUNK_EMPTY:
 		need_merging = TRUE;
-		newval = NULL;
 		goto status_ok;
 	}
 	g_assert_not_reached();
 
 status_ok:
-
-	/*
-	 * If file size is not known yet, the chunk list could be empty.
-	 * Simply update the downloaded amount if the chunk is marked as done.
-	 */
-
-	if (!fi->file_size_known && 0 == eslist_count(&fi->chunklist)) {
-		g_assert(!fi->use_swarming);
-
-		if (status == DL_CHUNK_DONE) {
-			g_assert(from == fi->done);		/* Downloading continuously */
-			fi->done += to - from;
-		}
-
-		goto done;
-	}
-
-	g_assert(file_info_check_chunklist(fi, TRUE));
-
 	fi->stamp = tm_time();
 
 	if (DL_CHUNK_DONE == status) {
@@ -4545,8 +5510,8 @@ again:
 	if (++againcount > 10) {
 		g_error("%s(%s, %s, %d) is looping for \"%s\"! Man battle stations!",
 			G_STRFUNC, filesize_to_string(from), filesize_to_string2(to),
-			status, d->file_name);
-		return;
+			status, fi->pathname);
+		return regressed;
 	}
 
 	/*
@@ -4556,12 +5521,18 @@ again:
 	 * because we may be writing data to an already "done" chunk, when a
 	 * previous chunk bumps into a done one.
 	 *		--RAM, 04/11/2002
+	 *
+	 * The chunk index lets us start right at the chunk holding `from'
+	 * instead of walking the whole list.
 	 */
 
+	fc = fi_chunk_find(fi, from);
+	prevfc = NULL == fc ? NULL : fi_chunk_prev(fi, fc);
+
 	for (
-		n = 0, prevfc = NULL, sl = eslist_first(&fi->chunklist);
+		sl = NULL == fc ? NULL : &fc->lk;
 		sl != NULL;
-		n++, prevfc = fc, sl = eslist_next(sl)
+		prevfc = fc, sl = eslist_next(sl)
 	) {
 		fc = eslist_data(&fi->chunklist, sl);
 
@@ -4570,6 +5541,9 @@ again:
 		if (fc->to <= from) continue;
 		if (fc->from >= to) break;
 
+		if (DL_CHUNK_DONE == fc->status && DL_CHUNK_DONE != status)
+			regressed = TRUE;
+
 		if (fc->from == from && fc->to == to) {
 
 			if (prevfc && prevfc->status == status)
@@ -4627,7 +5601,7 @@ again:
 				fc->to = to;
 				fc->status = status;
 				fc->download = newval;
-				eslist_insert_after(&fi->chunklist, fc, nfc);
+				fi_chunk_insert_after(fi, fc, nfc);
 				g_assert(file_info_check_chunklist(fi, TRUE));
 			}
 
@@ -4652,7 +5626,7 @@ again:
 				nfc->to = fc->to;
 				nfc->status = fc->status;
 				nfc->download = fc->download;
-				eslist_insert_after(&fi->chunklist, fc, nfc);
+				fi_chunk_insert_after(fi, fc, nfc);
 
 				if (DL_CHUNK_BUSY == nfc->status) {
 					/*
@@ -4671,7 +5645,7 @@ again:
 			nfc->to = to;
 			nfc->status = status;
 			nfc->download = newval;
-			eslist_insert_after(&fi->chunklist, fc, nfc);
+			fi_chunk_insert_after(fi, fc, nfc);
 
 			fc->to = from;
 
@@ -4694,51 +5668,338 @@ again:
 			nfc->to = fc->to;
 			nfc->status = status;
 			nfc->download = newval;
-			eslist_insert_after(&fi->chunklist, fc, nfc);
+			fi_chunk_insert_after(fi, fc, nfc);
+
+			tmp = fc->to;
+			fc->to = from;
+			from = tmp;
+			g_assert(file_info_check_chunklist(fi, TRUE));
+			goto again;
+		}
+	}
+
+	if (!found) {
+		/* Should never happen. */
+		g_critical("%s(): didn't find matching chunk for <%s-%s> (%u) "
+			"for \"%s\" (%s%s bytes)",
+			G_STRFUNC, filesize_to_string(from), filesize_to_string2(to),
+			status, fi->pathname,
+			fi->file_size_known ? "" : "unknown size, currently ",
+			filesize_to_string3(fi->size));
+
+		ESLIST_FOREACH(&fi->chunklist, sl) {
+			fc = eslist_data(&fi->chunklist, sl);
+			g_warning("... %s %s %u", filesize_to_string(fc->from),
+				filesize_to_string2(fc->to), fc->status);
+		}
+	}
+
+	if (need_merging)
+		file_info_merge_adjacent(fi);		/* Also updates fi->done */
+
+	g_assert(file_info_check_chunklist(fi, TRUE));
+
+	return regressed;
+}
+
+/**
+ * Marks a chunk of the file with given status.
+ * The bytes range from `from' (included) to `to' (excluded).
+ *
+ * When not marking the chunk as EMPTY, the range is linked to
+ * the supplied download `d' so we know who "owns" it currently.
+ */
+void
+file_info_update(const struct download *d, filesize_t from, filesize_t to,
+		enum dl_chunk_status status)
+{
+	fileinfo_t *fi;
+	bool regressed;
+
+	download_check(d);
+	fi = d->file_info;
+	file_info_check(fi);
+	g_assert(fi->refcount > 0);
+	g_assert(from < to);
+	g_assert(DL_CHUNK_BUSY != status || fi->lifecount > 0);
+
+	/*
+	 * If file size is not known yet, the chunk list could be empty.
+	 * Simply update the downloaded amount if the chunk is marked as done.
+	 */
+
+	if (!fi->file_size_known && 0 == eslist_count(&fi->chunklist)) {
+		g_assert(!fi->use_swarming);
+
+		if (status == DL_CHUNK_DONE) {
+			g_assert(from == fi->done);		/* Downloading continuously */
+			fi->done += to - from;
+		}
+
+		goto done;
+	}
+
+	regressed = fi_update_range(fi, from, to, status,
+		DL_CHUNK_EMPTY == status ? NULL : d);
+
+	if (fi->flags & FI_F_TRANSIENT)
+		goto done;
+
+	/*
+	 * Journal the changes that need to persist: completed data and
+	 * completed data we have to download again.  Reservations are
+	 * transient and are not recorded.
+	 */
+
+	if (DL_CHUNK_DONE == status)
+		fi_journal_append(fi->guid, FI_JOURNAL_DONE, from, to);
+	else if (regressed)
+		fi_journal_append(fi->guid, FI_JOURNAL_EMPTY, from, to);
+
+	/*
+	 * If hashed data is no longer there, the incremental hasher has to
+	 * restart from scratch.
+	 */
+
+	if (regressed && fi->hasher != NULL && from < fi_hash_offset(fi->hasher))
+		fi_hash_reset(fi->hasher);
+
+	/*
+	 * When status is DL_CHUNK_DONE, we're coming from an "active" download,
+	 * i.e. we are writing to it, therefore we can reuse its file descriptor.
+	 */
+
+	if (fi->dirty) {
+		file_info_store_binary(d->file_info, FALSE);
+	}
+
+done:
+	file_info_changed(fi);
+}
+
+/**
+ * Can incremental hashing be performed for the file?
+ */
+static bool
+fi_hash_wanted(const fileinfo_t *fi)
+{
+	return fi->file_size_known &&
+		0 == (fi->flags & (FI_F_TRANSIENT | FI_F_SEEDING | FI_F_VERIFYING)) &&
+		!FILE_INFO_FINISHED(fi);
+}
+
+/**
+ * Called when the incremental hasher found a corrupted TTH slice.
+ *
+ * The slice is marked as empty so that it gets downloaded again.
+ */
+static void
+fi_hash_bad_slice(fileinfo_t *fi, filesize_t from, filesize_t to)
+{
+	g_warning("TTH slice %s-%s of \"%s\" is corrupted, will fetch it again",
+		filesize_to_string(from), filesize_to_string2(to - 1),
+		file_info_readable_filename(fi));
+
+	gnet_stats_inc_general(GNR_TTH_INCREMENTAL_BAD_SLICES);
+
+	fi_update_range(fi, from, to, DL_CHUNK_EMPTY, NULL);
+	fi_journal_append(fi->guid, FI_JOURNAL_EMPTY, from, to);
+	fi->dirty = TRUE;
+	file_info_changed(fi);
+}
+
+/**
+ * Feed the incremental hasher with data that was just written to disk.
+ *
+ * Only the part of the data extending the contiguous hashed prefix is
+ * used, data written out-of-order will be read back from disk later.
+ *
+ * @param fi		the fileinfo
+ * @param offset	file offset where data was written
+ * @param iov		the I/O vector holding the data
+ * @param iovcnt	amount of entries in the I/O vector
+ * @param len		amount of bytes written from the I/O vector
+ */
+void
+file_info_hash_data(fileinfo_t *fi, filesize_t offset,
+	const iovec_t *iov, int iovcnt, size_t len)
+{
+	filesize_t pos, skip;
+	int i;
+
+	file_info_check(fi);
+
+	if (!fi_hash_wanted(fi))
+		return;
+
+	if (NULL == fi->hasher) {
+		file_info_tigertree_load(fi);	/* To check TTH slices */
+		fi->hasher = fi_hash_make();
+	}
+
+	pos = fi_hash_offset(fi->hasher);
+
+	if (pos < offset || pos >= offset + len)
+		return;				/* Not extending the hashed prefix */
+
+	skip = pos - offset;
+	len -= skip;
+
+	for (i = 0; i < iovcnt && len != 0; i++) {
+		const char *base = iovec_base(&iov[i]);
+		size_t n = iovec_len(&iov[i]);
+		filesize_t from, to;
+
+		if (skip >= n) {
+			skip -= n;
+			continue;
+		}
+
+		base += skip;
+		n -= skip;
+		n = MIN(n, len);
+		skip = 0;
+		len -= n;
+
+		if (!fi_hash_feed(fi->hasher, fi, base, n, &from, &to)) {
+			fi_hash_bad_slice(fi, from, to);
+			break;
+		}
+	}
+}
+
+/**
+ * Catch up with data already on disk, following the hashed prefix.
+ *
+ * @param fi		the fileinfo
+ * @param budget	amount of bytes we can read
+ *
+ * @return amount of bytes read.
+ */
+static size_t
+fi_hash_catchup(fileinfo_t *fi, size_t budget)
+{
+	file_object_t *fo = NULL;
+	size_t used = 0;
+
+	while (used < budget) {
+		const struct dl_file_chunk *fc;
+		filesize_t pos = fi_hash_offset(fi->hasher), from, to;
+		size_t n;
+		ssize_t r;
+
+		if (pos >= fi->size)
+			break;
+
+		fc = fi_chunk_find(fi, pos);
+		if (NULL == fc || DL_CHUNK_DONE != fc->status)
+			break;
+
+		if (NULL == fo) {
+			fo = file_object_open(fi->pathname, O_RDONLY);
+			if (NULL == fo)
+				break;
+		}
+
+		if (NULL == fi_hash_buf)
+			fi_hash_buf = halloc(FI_HASH_BUFSIZE);
+
+		n = MIN(fc->to - pos, FI_HASH_BUFSIZE);
+		n = MIN(n, budget - used);
+		r = file_object_pread(fo, fi_hash_buf, n, pos);
 
-			tmp = fc->to;
-			fc->to = from;
-			from = tmp;
-			g_assert(file_info_check_chunklist(fi, TRUE));
-			goto again;
+		if (r <= 0) {
+			if (GNET_PROPERTY(fileinfo_debug)) {
+				g_debug("%s(): cannot read \"%s\" at %s: %m", G_STRFUNC,
+					fi->pathname, filesize_to_string(pos));
+			}
+			break;
 		}
-	}
 
-	if (!found) {
-		/* Should never happen. */
-		g_critical("%s(): didn't find matching chunk for <%s-%s> (%u) "
-			"for \"%s\" (%s%s bytes)",
-			G_STRFUNC, filesize_to_string(from), filesize_to_string2(to),
-			status, fi->pathname,
-			fi->file_size_known ? "" : "unknown size, currently ",
-			filesize_to_string3(fi->size));
+		used += r;
 
-		ESLIST_FOREACH(&fi->chunklist, sl) {
-			fc = eslist_data(&fi->chunklist, sl);
-			g_warning("... %s %s %u", filesize_to_string(fc->from),
-				filesize_to_string2(fc->to), fc->status);
+		if (!fi_hash_feed(fi->hasher, fi, fi_hash_buf, r, &from, &to)) {
+			fi_hash_bad_slice(fi, from, to);
+			break;
 		}
 	}
 
-	if (need_merging)
-		file_info_merge_adjacent(fi);		/* Also updates fi->done */
+	file_object_release(&fo);
+	return used;
+}
 
-	g_assert(file_info_check_chunklist(fi, TRUE));
+/**
+ * Hash table iterator to let incremental hashers catch up with data
+ * already flushed to disk.
+ */
+static void
+fi_hash_catchup_helper(void *value, void *data)
+{
+	fileinfo_t *fi = value;
+	size_t *budget = data;
 
-	/*
-	 * When status is DL_CHUNK_DONE, we're coming from an "active" download,
-	 * i.e. we are writing to it, therefore we can reuse its file descriptor.
-	 */
+	file_info_check(fi);
 
-	if (fi->flags & FI_F_TRANSIENT)
-		goto done;
+	if (NULL == fi->hasher || 0 == *budget)
+		return;
 
-	if (fi->dirty) {
-		file_info_store_binary(d->file_info, FALSE);
+	if (!fi_hash_wanted(fi)) {
+		fi_hash_free_null(&fi->hasher);
+		return;
 	}
 
-done:
-	file_info_changed(fi);
+	*budget -= fi_hash_catchup(fi, *budget);
+}
+
+/**
+ * @return amount of bytes hashed incrementally for the file.
+ */
+filesize_t
+file_info_hashed(const fileinfo_t *fi)
+{
+	file_info_check(fi);
+
+	return NULL == fi->hasher ? 0 : fi_hash_offset(fi->hasher);
+}
+
+/**
+ * @return SHA-1 context covering the incrementally hashed prefix, NULL if
+ * the file is not being hashed.
+ */
+const SHA1_context *
+file_info_hash_context(const fileinfo_t *fi)
+{
+	file_info_check(fi);
+
+	return NULL == fi->hasher ? NULL : fi_hash_sha1_context(fi->hasher);
+}
+
+/**
+ * Fetch the SHA-1 of the file if it was entirely hashed incrementally.
+ *
+ * @return TRUE if digest was filled.
+ */
+bool
+file_info_hash_sha1(const fileinfo_t *fi, struct sha1 *digest)
+{
+	file_info_check(fi);
+
+	if (NULL == fi->hasher || fi_hash_offset(fi->hasher) != fi->size)
+		return FALSE;
+
+	fi_hash_sha1_digest(fi->hasher, digest);
+	return TRUE;
+}
+
+/**
+ * Discard incremental hashing state, once the file is being verified.
+ */
+void
+file_info_hash_discard(fileinfo_t *fi)
+{
+	file_info_check(fi);
+
+	fi_hash_free_null(&fi->hasher);
 }
 
 /**
@@ -4834,6 +6095,12 @@ restart:
 
 	file_info_merge_adjacent(fi);
 	fileinfo_dirty = TRUE;
+
+	if (0 == (fi->flags & FI_F_TRANSIENT) && fi->size != 0)
+		fi_journal_append(fi->guid, FI_JOURNAL_EMPTY, 0, fi->size);
+
+	if (fi->hasher != NULL)
+		fi_hash_reset(fi->hasher);
 }
 
 /**
@@ -4849,11 +6116,11 @@ file_info_chunk_status(fileinfo_t *fi, filesize_t from, filesize_t to)
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
-		dl_file_chunk_check(fc);
+	fc = fi_chunk_find(fi, from);
 
-		if (from >= fc->from && to <= fc->to)
-			return fc->status;
+	if (fc != NULL && to <= fc->to) {
+		dl_file_chunk_check(fc);
+		return fc->status;
 	}
 
 	/*
@@ -4881,38 +6148,34 @@ file_info_new_chunk_owner(const struct download *d,
 {
 	fileinfo_t *fi;
 	const struct download *old = NULL;
-	const slink_t *sl;
+	struct dl_file_chunk *fc;
+	const slink_t *sl = NULL;
 
 	download_check(d);
 	fi = d->file_info;
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH(&fi->chunklist, sl) {
-		struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
-
-		dl_file_chunk_check(fc);
+	/*
+	 * We're looking for the first busy chunk intersecting with [from, to],
+	 * which happens when one of the segment bounds lies within the chunk.
+	 * The chunk holding `from' comes first in the list, if busy.
+	 */
 
-		/*
-		 * We're looking for the first busy chunk intersecting with [from, to],
-		 * which happens when one of the segment bounds lies within the chunk.
-		 */
+	fc = fi_chunk_find(fi, from);
 
-		if (DL_CHUNK_BUSY != fc->status)
-			continue;
+	if (NULL == fc || DL_CHUNK_BUSY != fc->status)
+		fc = fi_chunk_find(fi, to);
 
-		if (
-			(from >= fc->from && from < fc->to) ||
-			(to >= fc->from && to < fc->to)
-		) {
-			g_assert(fc->download != NULL);
-			download_check(fc->download);
-			g_assert(fc->download != d);
+	if (fc != NULL && DL_CHUNK_BUSY == fc->status) {
+		dl_file_chunk_check(fc);
+		g_assert(fc->download != NULL);
+		download_check(fc->download);
+		g_assert(fc->download != d);
 
-			old = fc->download;
-			fc->download = d;
-			break;
-		}
+		old = fc->download;
+		fc->download = d;
+		sl = &fc->lk;
 	}
 
 	if (old != NULL) {
@@ -4941,10 +6204,11 @@ file_info_pos_status(fileinfo_t *fi, filesize_t pos)
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+	fc = fi_chunk_find(fi, pos);
+
+	if (fc != NULL) {
 		dl_file_chunk_check(fc);
-		if (pos >= fc->from && pos < fc->to)
-			return fc->status;
+		return fc->status;
 	}
 
 	if (pos > fi->size) {
@@ -5020,20 +6284,31 @@ fi_busy_count(fileinfo_t *fi, const struct download *d)
 }
 
 /**
- * Compares two offered ranges so that two ranges are equal when they overlap.
+ * Find the first empty chunk overlapping with range [from, to[.
+ *
+ * @return the first missing chunk in the range, NULL if none.
  */
-static int
-fi_chunk_overlap_cmp(const void *a, const void *b)
+static struct dl_file_chunk *
+fi_chunk_find_missing(fileinfo_t *fi, filesize_t from, filesize_t to)
 {
-	const struct dl_file_chunk *ca = a, *cb = b;
+	struct dl_file_chunk *fc;
+	const slink_t *sl;
 
-	if (ca->to <= cb->from)			/* `to' is NOT part of the chunk range */
-		return -1;
+	fc = fi_chunk_find(fi, from);
+
+	for (sl = NULL == fc ? NULL : &fc->lk; sl != NULL; sl = eslist_next(sl)) {
+		fc = eslist_data(&fi->chunklist, sl);
+
+		dl_file_chunk_check(fc);
+
+		if (fc->from >= to)
+			break;
 
-	if (cb->to <= ca->from)
-		return +1;
+		if (DL_CHUNK_EMPTY == fc->status)
+			return fc;
+	}
 
-	return 0;		/* Overlapping chunks are equal */
+	return NULL;
 }
 
 /**
@@ -5055,7 +6330,6 @@ fi_chunk_overlap_cmp(const void *a, const void *b)
 static const struct dl_file_chunk *
 fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 {
-	rbtree_t *missing;
 	http_rangeset_t *offered;
 	const struct dl_file_chunk *fc;
 	const struct dl_file_chunk *first, *candidate = NULL;
@@ -5093,24 +6367,15 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 	}
 
 	/*
-	 * The `missing' red-black tree contains the file chunks that are still
-	 * empty and need to be downloaded.
+	 * The missing chunks, which are still empty and need to be downloaded,
+	 * are located through the chunk index.
 	 *
 	 * The `offered' set contains the HTTP ranges offered by the source,
 	 * if any given.  If NULL, it means the source covers the whole file.
 	 */
 
-	missing = rbtree_create(fi_chunk_overlap_cmp);
 	offered = NULL == d ? NULL : d->ranges;
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
-		dl_file_chunk_check(fc);
-
-		if (DL_CHUNK_EMPTY == fc->status) {
-			rbtree_insert(missing, fc);
-		}
-	}
-
 	/*
 	 * Find the first missing chunk that is also offered, starting with the
 	 * rarest available chunk: the fi->available list is sorted by increasing
@@ -5119,7 +6384,6 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 
 	ESLIST_FOREACH_DATA(&fi->available, fa) {
 		struct dl_file_chunk *dfc;
-		struct dl_file_chunk crange;
 
 		dl_avail_chunk_check(fa);
 
@@ -5137,10 +6401,7 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 		)
 			continue;		/* Range not offered */
 
-		crange.from = fa->from;
-		crange.to = fa->to;
-
-		dfc = rbtree_lookup(missing, &crange);
+		dfc = fi_chunk_find_missing(fi, fa->from, fa->to);
 
 		if (dfc != NULL) {
 			/* Rare range overlaps with missing range */
@@ -5252,7 +6513,7 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 			nfc->status = dfc->status;
 			dfc->to = start;
 
-			eslist_insert_after(&fi->chunklist, dfc, nfc);
+			fi_chunk_insert_after(fi, dfc, nfc);
 			candidate = nfc;
 
 			if (
@@ -5274,8 +6535,6 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 	if (NULL == candidate)
 		candidate = first;
 
-	rbtree_free_null(&missing);
-
 done:
 	if (GNET_PROPERTY(fileinfo_debug) || GNET_PROPERTY(download_debug)) {
 		g_debug("%s(): returning [%s, %s] (%u) for \"%s\"",
@@ -5301,14 +6560,13 @@ static const struct dl_file_chunk *
 fi_pick_chunk(fileinfo_t *fi)
 {
 	filesize_t offset = 0;
+	struct dl_file_chunk *fc;
 	slink_t *sl;
 
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
 	if (GNET_PROPERTY(pfsp_first_chunk) > 0) {
-		const struct dl_file_chunk *fc;
-
 		/*
 		 * Check whether first chunk is at least "pfsp_first_chunk" bytes
 		 * long.  If not, return that first chunk.
@@ -5325,7 +6583,6 @@ fi_pick_chunk(fileinfo_t *fi)
 	}
 
 	if (GNET_PROPERTY(pfsp_last_chunk) > 0) {
-		const struct dl_file_chunk *fc;
 		filesize_t last_chunk_offset;
 
 		/*
@@ -5338,7 +6595,11 @@ fi_pick_chunk(fileinfo_t *fi)
 			? fi->size - GNET_PROPERTY(pfsp_last_chunk)
 			: 0;
 
-		ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+		fc = fi_chunk_find(fi, last_chunk_offset);
+		sl = NULL == fc ? NULL : &fc->lk;
+
+		for (/* empty */; sl != NULL; sl = eslist_next(sl)) {
+			fc = eslist_data(&fi->chunklist, sl);
 			dl_file_chunk_check(fc);
 
 			if (DL_CHUNK_DONE == fc->status)
@@ -5365,37 +6626,23 @@ fi_pick_chunk(fileinfo_t *fi)
 	}
 
 	/*
-	 * Pick the first chunk whose start is after the offset.
+	 * Pick the first chunk whose start is after the offset, starting with
+	 * the chunk holding that offset.
 	 */
 
-	ESLIST_FOREACH(&fi->chunklist, sl) {
-		const struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
+	fc = fi_chunk_find(fi, offset);
 
+	if (fc != NULL) {
 		dl_file_chunk_check(fc);
 
-		if (fc->from >= offset)
+		if (fc->from == offset)
 			return fc;
 
 		/*
-		 * If offset lies within a free chunk, it will get split below.
-		 * So exit without selecting anything yet.
+		 * If the offset lies within a big free chunk, be smarter and
+		 * break-up that chunk into two at the selected offset.
 		 */
 
-		if (DL_CHUNK_EMPTY == fc->status && fc->to - 1 > offset)
-			break;
-	}
-
-	/*
-	 * If we have not picked anything, it means we have encountered a big chunk
-	 * and the selected offset lies within that chunk.
-	 * Be smarter and break-up any free chunk into two at the selected offset.
-	 */
-
-	ESLIST_FOREACH(&fi->chunklist, sl) {
-		struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
-
-		dl_file_chunk_check(fc);
-
 		if (DL_CHUNK_EMPTY == fc->status && fc->to - 1 > offset) {
 			struct dl_file_chunk *nfc;
 
@@ -5413,9 +6660,13 @@ fi_pick_chunk(fileinfo_t *fi)
 			nfc->status = DL_CHUNK_EMPTY;
 			fc->to = nfc->from;
 
-			eslist_insert_after(&fi->chunklist, fc, nfc);
+			fi_chunk_insert_after(fi, fc, nfc);
 			return nfc;
 		}
+
+		sl = eslist_next(&fc->lk);
+		if (sl != NULL)
+			return eslist_data(&fi->chunklist, sl);
 	}
 
 	g_assert(file_info_check_chunklist(fi, TRUE));
@@ -6901,7 +8152,27 @@ fi_notify_helper(void *value, void *unused_udata)
 void
 file_info_timer(void)
 {
+	size_t budget = FI_HASH_CATCHUP;
+
 	hikset_foreach(fi_by_outname, fi_notify_helper, NULL);
+	hikset_foreach(fi_by_outname, fi_hash_catchup_helper, &budget);
+	fi_journal_flush();
+
+	/*
+	 * If journaling failed, write a checkpoint right away since the journal
+	 * no longer covers all the chunk changes.  Retries are throttled to
+	 * avoid rewriting the whole database every second when the disk is full.
+	 */
+
+	if G_UNLIKELY(fi_journal_lost()) {
+		static time_t last_try;
+		time_t now = tm_time();
+
+		if (delta_time(now, last_try) >= FI_JOURNAL_RETRY) {
+			last_try = now;
+			file_info_store();
+		}
+	}
 }
 
 /**
@@ -7500,24 +8771,6 @@ fi_avail_cmp(const void *a, const void *b)
 	return CMP(ca->from, cb->from);
 }
 
-/**
- * Compares two available ranges so that two ranges are equal when they
- * overlap.
- */
-static int
-fi_overlap_cmp(const void *a, const void *b)
-{
-	const struct dl_avail_chunk *ca = a, *cb = b;
-
-	if (ca->to <= cb->from)
-		return -1;
-
-	if (cb->to <= ca->from)
-		return +1;
-
-	return 0;		/* Overlapping ranges are equal */
-}
-
 /**
  * Compares two available ranges on the amount of sources that provide them.
  */
@@ -7557,151 +8810,107 @@ fi_count_source(rbtree_t *rbt, filesize_t from, filesize_t to)
 }
 
 /**
- * Spread offered chunk `ac' to the list of available chunks held in the
- * red-black tree, updating the amount of sources offering each range of
- * the file.
+ * A boundary of an offered chunk, used to sweep over the file.
+ */
+struct fi_avail_edge {
+	filesize_t offset;		/**< Position in the file */
+	ssize_t delta;			/**< Sources gained (> 0) or lost (< 0) there */
+};
+
+/**
+ * Compares two chunk boundaries by file offset.
+ */
+static int
+fi_avail_edge_cmp(const void *a, const void *b)
+{
+	const struct fi_avail_edge *ea = a, *eb = b;
+
+	return CMP(ea->offset, eb->offset);
+}
+
+/**
+ * Sweep over the boundaries of all the offered chunks to compute the list
+ * of available chunks, with the amount of sources providing each of them.
  *
- * This is an important step in our computation of the rarest chunks offered
- * on the network.
+ * Each offered chunk contributes two boundaries, and once they are sorted
+ * by offset, the amount of sources covering any point of the file is the
+ * running sum of the deltas seen so far.  This runs in O(n log n) over the
+ * n offered chunks, regardless of how they overlap.
  *
- * @param arbt		red-black tree listing available chunks with source count
- * @param ac		the offered chunk we're adding to the existing set
+ * Available chunks are appended to fi->available in file order.  Adjacent
+ * chunks with the same source count are coalesced.
+ *
+ * @param fi		the fileinfo whose available list we're building
+ * @param rbt		red-black tree listing offered chunks with source count
  */
 static void
-fi_update_available_forward(rbtree_t *arbt, const struct dl_avail_chunk *ac)
+fi_update_available_sweep(fileinfo_t *fi, rbtree_t *rbt)
 {
-	filesize_t from;					/* Starting point of added chunk */
-
-	dl_avail_chunk_check(ac);
+	struct fi_avail_edge *edges;
+	struct dl_avail_chunk *last = NULL;
+	rbtree_iter_t *iter;
+	const void *item;
+	size_t i, n;
+	ssize_t sources = 0;
 
-	from = ac->from;
+	g_assert(0 == eslist_count(&fi->available));
 
-	do {
-		struct dl_avail_chunk key;
-		struct dl_avail_chunk *avc;		/* Available chunk */
-		rbnode_t *node;					/* Tree node for faster iteration */
+	n = 2 * rbtree_count(rbt);
+	if (0 == n)
+		return;
 
-		key.from = from;
-		key.to = ac->to;
+	XMALLOC_ARRAY(edges, n);
 
-		avc = rbtree_lookup_node(arbt, &key, &node);
+	i = 0;
+	iter = rbtree_iter_new(rbt);
 
-		if (NULL == avc) {
-			struct dl_avail_chunk *anew;
+	while (rbtree_iter_next(iter, &item)) {
+		const struct dl_avail_chunk *ac = item;		/* Chunk offered */
 
-			/* Chunk overlaps with nothing -> new entry and we're done */
+		dl_avail_chunk_check(ac);
+		g_assert(ac->from < ac->to);
 
-			anew = dl_avail_chunk_new(from, ac->to, ac->sources);
-			rbtree_insert(arbt, anew);
-			break;
-		}
+		edges[i].offset = ac->from;
+		edges[i++].delta = ac->sources;
+		edges[i].offset = ac->to;
+		edges[i++].delta = -(ssize_t) ac->sources;
+	}
 
-		/*
-		 * Chunk `avc' overlaps with `ac'.
-		 * There are six main configurations possible, with case #0 being
-		 * handled flexibly (i.e. it can start / end on the same boundaries):
-		 *
-		 *   #0:         [=avc=]
-		 *              [---ac--]
-		 *
-		 *   #1:           [====avc====]
-		 *              [---ac--]
-		 *
-		 *   #2:       [====avc====]
-		 *             [---ac--]
-		 *
-		 *   #3:     [====avc====]
-		 *             [---ac--]
-		 *
-		 *   #4:   [====avc====]
-		 *             [---ac--]
-		 *
-		 *   #5: [====avc====]
-		 *             [---ac--]
-		 *
-		 * We want to find the first available chunk which overlaps with `ac'.
-		 */
+	rbtree_iter_release(&iter);
+	g_assert(i == n);
 
-		 for (;;) {
-			struct dl_avail_chunk *prev;
-			rbnode_t *pnode = node;
+	vsort(edges, n, sizeof edges[0], fi_avail_edge_cmp);
 
-			prev = rbtree_prev_node(arbt, &pnode);
-			if (NULL == prev)
-				break;		/* No other available chunk before `avc' */
+	for (i = 0; i < n; /* empty */) {
+		filesize_t from = edges[i].offset, to;
 
-			if (prev->to <= from)
-				break;		/* No overlap with `ac' */
+		/* Apply all the deltas at that offset */
 
-			avc = prev;
-			node = pnode;
-		}
+		do {
+			sources += edges[i].delta;
+		} while (++i < n && edges[i].offset == from);
 
-		/*
-		 * Handle cases #0 and #1 by creating a new available chunk at
-		 * the beginning, then handling the overlapping part.
-		 */
+		if (0 == sources || i >= n)
+			continue;		/* Gap not offered by any source, or end */
 
-		if (from < avc->from) {
-			struct dl_avail_chunk *anew;
+		to = edges[i].offset;
 
-			g_assert(avc->from < ac->to);	/* Overlaps with `ac' */
+		g_assert(sources > 0);
 
-			anew = dl_avail_chunk_new(from, avc->from, ac->sources);
-			rbtree_insert(arbt, anew);
-			from = avc->from;
+		if (
+			last != NULL && last->to == from &&
+			last->sources == (size_t) sources
+		) {
+			last->to = to;
+		} else {
+			last = dl_avail_chunk_new(from, to, sources);
+			eslist_append(&fi->available, last);
 		}
+	}
 
-		/*
-		 * Handle cases #2, #3, #4 and #5 by splitting the existing available
-		 * chunk up to the start of the offered chunk `ac', and anything
-		 * following the end of `ac'.
-		 */
-
-		if (avc->from <= from) {
-			struct dl_avail_chunk *anew;
-			filesize_t to = MIN(avc->to, ac->to);	/* Upper intersection */
-			filesize_t avc_to = avc->to;
-			size_t sources = avc->sources;
-
-			g_assert(avc->to > from);			/* Overlaps with `ac' */
-
-			if (avc->from == from) {
-				/* Case #2, or case #0 with matching start */
-				avc->sources += ac->sources;	/* For the common part */
-
-				if (avc->to > ac->to)			/* `avc' longer than `ac' */
-					avc->to = ac->to;			/* Extra part added below */
-			} else {
-				/* Not case #2 */
-				avc->to = from;					/* Truncates `avc' */
-
-				/*
-				 * Insert the common part with added source counts.
-				 */
-
-				anew = dl_avail_chunk_new(from, to, ac->sources + avc->sources);
-				rbtree_insert(arbt, anew);
-
-				avc = rbtree_next_node(arbt, &node);
-				g_soft_assert(avc == anew);		/* The chunk we just inserted */
-			}
-
-			/* Handle rightmost part of cases #2 and #3 */
-
-			if (avc_to > to) {
-				anew = dl_avail_chunk_new(to, avc_to, sources);
-				rbtree_insert(arbt, anew);
-
-				avc = rbtree_next_node(arbt, &node);
-				g_soft_assert(avc == anew);
-
-				break;		/* We've consumed the whole `ac' */
-			}
+	g_assert(0 == sources);		/* All chunks were closed */
 
-			from = to;
-		}
-	} while (from < ac->to);
+	XFREE_NULL(edges);
 }
 
 /**
@@ -7711,7 +8920,7 @@ static void
 fi_update_rarest_chunks(fileinfo_t *fi)
 {
 	pslist_t *sl;
-	rbtree_t *rbt, *arbt;
+	rbtree_t *rbt;
 	rbtree_iter_t *iter;
 	size_t sources;
 	const void *item;
@@ -7797,71 +9006,34 @@ fi_update_rarest_chunks(fileinfo_t *fi)
 	}
 
 	/*
-	 * All the unique chunks are in the red-black tree, we can iterate in order
-	 * (so our visiting order will be A, D, E, B, etc..) and create the list
-	 * of chunks representing the available regions and the amount of times they
+	 * All the unique chunks are in the red-black tree.  We now sweep over
+	 * their boundaries, in file order, to create the list of chunks
+	 * representing the available regions and the amount of times they
 	 * are offered (list of chunks a, b, c, d etc...).
 	 *
-	 * In our example, starting with "A" we get:
-	 *
-	 *     [--A-]
-	 *     [====]
-	 *        1
-	 *
-	 * because chunk "A" is present once. Then we process "D" so the list now
-	 * becomes:
-	 *
-	 *     [----------------D------------------]
-	 *     [====][=============================]
-	 *        3                  2
-	 *
-	 * because "A" and "D" overlap so the "A" part is available twice but the
-	 * count associated to "D" was 2 (chunks "D" and "G" are equal).  Then we
-	 * process "E" and we further split the second chunk in our list:
-	 *
-	 *           [------E------]
-	 *     [====][=============][==============]
-	 *        3         3                2
+	 * In our example, the sweep sees +3 at the start of the file (A, D and
+	 * G begin there), then -1 / +1 (end of A, start of E), +1 (start of B),
+	 * -1 (end of B), -1 (end of E), +1 (start of C), +1 (start of F),
+	 * -1 (end of C), and finally -3 at the end of the file.
 	 *
-	 * Encountering "B"
-	 *
-	 *              [---B--]
-	 *     [====][=][======][==][==============]
-	 *       3    3    4     3          2
-	 *
-	 * we further split the chunk, counting one more occurrence for the region
-	 * covered by "B".
-	 *
-	 * This list is also held in a red-black tree during construction, to
-	 * optimize lookups, but here we have only non-overlapping chunks
-	 * so we use a different comparison function.  The red-black tree will
-	 * be linearized into an embedded list at the end.
+	 * The running sum of the deltas gives the amount of sources covering
+	 * the region that starts at each boundary: 3, 3, 4, 3, 2, 3, 4, 3.
+	 * Adjacent regions ending up with the same count are coalesced, so
+	 * regions "a" and "b" above become a single available chunk.
 	 */
 
 	file_info_available_free(fi);		/* Discard previous computation */
-
-	arbt = rbtree_create(fi_overlap_cmp);
-	iter = rbtree_iter_new(rbt);
-
-	while (rbtree_iter_next(iter, &item)) {
-		const struct dl_avail_chunk *ac = item;		/* Chunk offered */
-
-		fi_update_available_forward(arbt, ac);
-	}
-
-	rbtree_iter_release(&iter);
+	fi_update_available_sweep(fi, rbt);
 
 	if (GNET_PROPERTY(fileinfo_debug) > 5) {
 		filesize_t available = 0;
-
-		iter = rbtree_iter_new(arbt);
+		const struct dl_avail_chunk *avc;
 
 		g_debug("- identified %zu available range%s over file:",
-			rbtree_count(arbt), plural(rbtree_count(arbt)));
-
-		while (rbtree_iter_next(iter, &item)) {
-			const struct dl_avail_chunk *avc = item;
+			eslist_count(&fi->available),
+			plural(eslist_count(&fi->available)));
 
+		ESLIST_FOREACH_DATA(&fi->available, avc) {
 			dl_avail_chunk_check(avc);
 
 			g_debug("   [%s, %s] %zu source%s",
@@ -7878,30 +9050,16 @@ fi_update_rarest_chunks(fileinfo_t *fi)
 		g_debug("=> %s out of %s bytes available (%.2f%%)",
 			filesize_to_string(available), filesize_to_string2(fi->size),
 			100.0 * available / fi->size);
-
-		rbtree_iter_release(&iter);
 	}
 
 	/*
-	 * In the end, we can dispose of the red-black trees and need only to keep
+	 * In the end, we can dispose of the red-black tree and need only to keep
 	 * the list of chunks available along with their availability count.
 	 */
 
 	rbtree_discard(rbt, dl_avail_chunk_free);
 	rbtree_free_null(&rbt);
 
-	iter = rbtree_iter_new(arbt);
-
-	while (rbtree_iter_next(iter, &item)) {
-		struct dl_avail_chunk *avc = deconstify_pointer(item);
-
-		dl_avail_chunk_check(avc);
-		eslist_append(&fi->available, avc);
-	}
-
-	rbtree_iter_release(&iter);
-	rbtree_free_null(&arbt);	/* Its items are now listed in fi->available */
-
 	/*
 	 * Sort the list so that the rarest chunks come first.
 	 *
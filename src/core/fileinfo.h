@@ -38,6 +38,9 @@
 #include "share.h"						/* For shared_file_t */
 #include "if/core/fileinfo.h"
 
+#include "lib/iovec.h"
+#include "lib/sha1.h"
+
 /*
  * Shared core constants
  */
@@ -56,6 +59,7 @@ void file_info_scandir(const char *dir);
 int file_info_has_trailer(const char *path);
 void file_info_retrieve(void);
 void file_info_store(void);
+void file_info_store_all(void);
 void file_info_store_binary(fileinfo_t *fi, bool force);
 void file_info_store_if_dirty(void);
 void file_info_set_discard(fileinfo_t *fi, bool state);
@@ -79,12 +83,19 @@ void file_info_got_tth(fileinfo_t *fi, const struct tth *tth);
 void file_info_recomputed_tth(fileinfo_t *fi, const struct tth *tth);
 void file_info_got_tigertree(fileinfo_t *fi,
 		const struct tth *leaves, size_t num_leaves, bool mark_dirty);
+void file_info_tigertree_load(fileinfo_t *fi);
 void file_info_size_known(struct download *d, filesize_t size);
 void file_info_size_unknown(fileinfo_t *fi);
 void file_info_update(const struct download *d, filesize_t from, filesize_t to,
 	enum dl_chunk_status status);
 void file_info_new_chunk_owner(const struct download *d,
 	filesize_t from, filesize_t to);
+void file_info_hash_data(fileinfo_t *fi, filesize_t offset,
+	const iovec_t *iov, int iovcnt, size_t len);
+filesize_t file_info_hashed(const fileinfo_t *fi);
+const SHA1_context *file_info_hash_context(const fileinfo_t *fi);
+bool file_info_hash_sha1(const fileinfo_t *fi, struct sha1 *digest);
+void file_info_hash_discard(fileinfo_t *fi);
 enum dl_chunk_status file_info_pos_status(fileinfo_t *fi,
 	filesize_t pos /*, filesize_t *start, filesize_t *end */);
 void file_info_close(void);
@@ -44,8 +44,11 @@
 #include "if/dht/kademlia.h"
 #include "if/gnet_property_priv.h"
 
+#include "lib/atomic.h"
 #include "lib/entropy.h"
 #include "lib/event.h"
+#include "lib/omalloc.h"
+#include "lib/pow2.h"
 #include "lib/random.h"
 #include "lib/sha1.h"
 #include "lib/spinlock.h"
@@ -75,6 +78,113 @@ static spinlock_t gnet_stats_slk = SPINLOCK_INIT;
 #define GNET_STATS_LOCK		spinlock_hidden(&gnet_stats_slk)
 #define GNET_STATS_UNLOCK	spinunlock_hidden(&gnet_stats_slk)
 
+/*
+ * Per-thread statistics.
+ *
+ * The general counters being updatable from any thread, taking the global
+ * lock on each update would make them a contention point as more work is
+ * moved to threads.  Instead, each thread accumulates its own deltas into
+ * a private block, which is never written to by other threads, and these
+ * deltas are only aggregated with the base values held in gnet_stats.general[]
+ * when someone needs to read the counters.
+ *
+ * Blocks are indexed by thread small ID and never freed: they are reused
+ * by the next thread getting the same small ID, which simply continues to
+ * accumulate deltas there.  They are padded on both ends to avoid false
+ * sharing of cache lines between threads.
+ *
+ * The per-message latency histograms are also kept per-thread, and allocated
+ * only for the message types the thread actually records.
+ */
+
+#define GNET_STATS_CACHE_LINE	64	/**< Assumed cache line size, in bytes */
+
+struct gnet_stats_thread {
+	uint8 lead[GNET_STATS_CACHE_LINE];		/**< Padding */
+	int64 general[GNR_TYPE_COUNT];			/**< Deltas to general counters */
+	struct gnet_stats_latency *latency[MSG_TOTAL];	/**< Lazily allocated */
+	uint8 trail[GNET_STATS_CACHE_LINE];		/**< Padding */
+};
+
+static struct gnet_stats_thread *gnet_stats_threads[THREAD_MAX];
+
+/**
+ * @return the statistics block of the current thread, allocating it
+ * on first usage.
+ */
+static struct gnet_stats_thread *
+gnet_stats_thread(void)
+{
+	uint stid = thread_small_id();
+	struct gnet_stats_thread *gst;
+
+	g_assert(stid < N_ITEMS(gnet_stats_threads));
+
+	gst = gnet_stats_threads[stid];
+
+	if G_UNLIKELY(NULL == gst) {
+		OMALLOC0(gst);
+		atomic_mb();		/* Zeroed block visible before it is published */
+		gnet_stats_threads[stid] = gst;
+	}
+
+	return gst;
+}
+
+/**
+ * @return sum of the deltas accumulated by all threads for general counter.
+ */
+static int64
+gnet_stats_general_deltas(size_t i)
+{
+	int64 sum = 0;
+	uint t;
+
+	for (t = 0; t < N_ITEMS(gnet_stats_threads); t++) {
+		const struct gnet_stats_thread *gst = gnet_stats_threads[t];
+
+		if (gst != NULL)
+			sum += gst->general[i];
+	}
+
+	return sum;
+}
+
+/**
+ * Fill ``general'' with the current value of all the general counters.
+ *
+ * @attention
+ * Must be called with the global stats lock held.
+ */
+static void
+gnet_stats_general_snapshot(uint64 general[GNR_TYPE_COUNT])
+{
+	uint t;
+
+	for (t = 0; t < GNR_TYPE_COUNT; t++)
+		general[t] = gnet_stats.general[t];
+
+	for (t = 0; t < N_ITEMS(gnet_stats_threads); t++) {
+		const struct gnet_stats_thread *gst = gnet_stats_threads[t];
+		uint i;
+
+		if (NULL == gst)
+			continue;
+
+		for (i = 0; i < GNR_TYPE_COUNT; i++)
+			general[i] += gst->general[i];
+	}
+}
+
+/**
+ * Add delta to the general counter, in the current thread's block.
+ */
+static inline void
+gnet_stats_general_add(size_t i, int64 delta)
+{
+	gnet_stats_thread()->general[i] += delta;
+}
+
 /***
  *** Public functions
  ***/
@@ -219,8 +329,14 @@ gnet_stats_udp_digest(sha1_t *digest)
 void
 gnet_stats_general_digest(sha1_t *digest)
 {
+	static uint64 general[GNR_TYPE_COUNT];
+
 	gnet_stats_inc_general(GNR_STATS_DIGEST);
-	SHA1_COMPUTE(gnet_stats.general, digest);
+
+	GNET_STATS_LOCK;
+	gnet_stats_general_snapshot(general);
+	SHA1_COMPUTE(general, digest);
+	GNET_STATS_UNLOCK;
 }
 
 /**
@@ -618,7 +734,7 @@ gnet_stats_count_expired(const gnutella_node_t *n)
         (reason == MSG_DROP_ROUTE_LOST) ||				\
         (reason == MSG_DROP_NO_ROUTE)					\
     )													\
-        gnet_stats.general[GNR_ROUTING_ERRORS]++;		\
+        gnet_stats_general_add(GNR_ROUTING_ERRORS, 1);	\
 														\
     gnet_stats.drop_reason[reason][MSG_TOTAL]++;		\
     gnet_stats.drop_reason[reason][t]++;				\
@@ -727,9 +843,7 @@ gnet_stats_count_general(gnr_stats_t type, int delta)
 
 	g_assert(i < GNR_TYPE_COUNT);
 
-	GNET_STATS_LOCK;
-    gnet_stats.general[i] += delta;
-	GNET_STATS_UNLOCK;
+	gnet_stats_general_add(i, delta);
 }
 
 /**
@@ -742,9 +856,7 @@ gnet_stats_inc_general(gnr_stats_t type)
 
 	g_assert(i < GNR_TYPE_COUNT);
 
-	GNET_STATS_LOCK;
-    gnet_stats.general[i]++;
-	GNET_STATS_UNLOCK;
+	gnet_stats_general_add(i, 1);
 }
 
 /**
@@ -757,9 +869,7 @@ gnet_stats_dec_general(gnr_stats_t type)
 
 	g_assert(i < GNR_TYPE_COUNT);
 
-	GNET_STATS_LOCK;
-    gnet_stats.general[i]--;
-	GNET_STATS_UNLOCK;
+	gnet_stats_general_add(i, -1);
 }
 
 /**
@@ -769,17 +879,22 @@ void
 gnet_stats_max_general(gnr_stats_t type, uint64 value)
 {
 	size_t i = type;
+	uint64 current;
 
 	g_assert(i < GNR_TYPE_COUNT);
 
 	GNET_STATS_LOCK;
-	if (value > gnet_stats.general[i])
-		gnet_stats.general[i] = value;
+	current = gnet_stats.general[i] + gnet_stats_general_deltas(i);
+	if (value > current)
+		gnet_stats.general[i] += value - current;
 	GNET_STATS_UNLOCK;
 }
 
 /**
  * Set the general stats counter to the given value.
+ *
+ * The base value is adjusted so that adding the deltas accumulated by
+ * all the threads yields the requested value.
  */
 void
 gnet_stats_set_general(gnr_stats_t type, uint64 value)
@@ -789,7 +904,7 @@ gnet_stats_set_general(gnr_stats_t type, uint64 value)
 	g_assert(i < GNR_TYPE_COUNT);
 
 	GNET_STATS_LOCK;
-    gnet_stats.general[i] = value;
+	gnet_stats.general[i] = value - gnet_stats_general_deltas(i);
 	GNET_STATS_UNLOCK;
 }
 
@@ -805,7 +920,7 @@ gnet_stats_get_general(gnr_stats_t type)
 	g_assert(i < GNR_TYPE_COUNT);
 
 	GNET_STATS_LOCK;
-	value = gnet_stats.general[i];
+	value = gnet_stats.general[i] + gnet_stats_general_deltas(i);
 	GNET_STATS_UNLOCK;
 
 	return value;
@@ -926,6 +1041,151 @@ gnet_stats_g2_count_flowc(const gnutella_node_t *n,
 	gnet_stats_flowc_internal(t, f, ttl, hops, len);
 }
 
+/**
+ * Compute latency histogram bucket index for given value.
+ *
+ * Values below GNET_STATS_LAT_SUB are counted exactly, then each power
+ * of two is split into GNET_STATS_LAT_SUB linear sub-buckets, which keeps
+ * the relative error below 1 / GNET_STATS_LAT_SUB over the whole range.
+ */
+static inline uint
+gnet_stats_latency_bucket(uint64 ns)
+{
+	int e;
+	uint i;
+
+	STATIC_ASSERT(IS_POWER_OF_2(GNET_STATS_LAT_SUB));
+
+	if (ns < GNET_STATS_LAT_SUB)
+		return ns;
+
+	e = highest_bit_set64(ns) - GNET_STATS_LAT_SHIFT;
+	i = GNET_STATS_LAT_SUB * (e + 1) + ((ns >> e) & (GNET_STATS_LAT_SUB - 1));
+
+	return MIN(i, GNET_STATS_LAT_BUCKETS - 1);
+}
+
+/**
+ * @return the lowest value falling in the latency histogram bucket.
+ */
+static uint64
+gnet_stats_latency_bucket_value(uint i)
+{
+	uint e;
+
+	g_assert(i < GNET_STATS_LAT_BUCKETS);
+
+	if (i < GNET_STATS_LAT_SUB)
+		return i;
+
+	e = i / GNET_STATS_LAT_SUB - 1;
+
+	return (uint64) (GNET_STATS_LAT_SUB + i % GNET_STATS_LAT_SUB) << e;
+}
+
+/**
+ * Record the time taken to process a received Gnutella message.
+ *
+ * This is recorded in the calling thread's histograms, without locking.
+ *
+ * @param function		the Gnutella message function
+ * @param ns			processing time, in nanoseconds
+ */
+void
+gnet_stats_count_latency(uint8 function, uint64 ns)
+{
+	struct gnet_stats_thread *gst = gnet_stats_thread();
+	struct gnet_stats_latency *h;
+	uint t = stats_lut[function];
+
+	g_assert(t < MSG_TOTAL);
+
+	h = gst->latency[t];
+
+	if G_UNLIKELY(NULL == h) {
+		OMALLOC0(h);
+		atomic_mb();		/* Zeroed histogram visible before it is published */
+		gst->latency[t] = h;
+	}
+
+	h->count++;
+	h->total_ns += ns;
+	h->bucket[gnet_stats_latency_bucket(ns)]++;
+	if G_UNLIKELY(ns > h->max_ns)
+		h->max_ns = ns;
+}
+
+/**
+ * Get a snapshot of the processing latency histogram for a message type,
+ * aggregated over all the threads.
+ *
+ * Threads keep updating their histograms whilst we read them, so the
+ * snapshot is only consistent to within a few messages.
+ *
+ * @param t		the message type
+ * @param h		where the aggregated histogram is written
+ */
+void
+gnet_stats_latency_get(msg_type_t t, struct gnet_stats_latency *h)
+{
+	uint i;
+
+	g_assert(h != NULL);
+	g_assert(UNSIGNED(t) < MSG_TOTAL);
+
+	ZERO(h);
+
+	for (i = 0; i < N_ITEMS(gnet_stats_threads); i++) {
+		const struct gnet_stats_thread *gst = gnet_stats_threads[i];
+		const struct gnet_stats_latency *th;
+		uint j;
+
+		if (NULL == gst || NULL == (th = gst->latency[t]))
+			continue;
+
+		h->count += th->count;
+		h->total_ns += th->total_ns;
+		h->max_ns = MAX(h->max_ns, th->max_ns);
+
+		for (j = 0; j < N_ITEMS(h->bucket); j++)
+			h->bucket[j] += th->bucket[j];
+	}
+}
+
+/**
+ * Compute percentile from a latency histogram.
+ *
+ * @param h		the latency histogram
+ * @param p		the percentile, as a fraction between 0.0 and 1.0
+ *
+ * @return the estimated latency at that percentile, in nanoseconds.
+ */
+uint64
+gnet_stats_latency_percentile(const struct gnet_stats_latency *h, double p)
+{
+	uint64 target, seen = 0;
+	uint i;
+
+	g_assert(h != NULL);
+	g_assert(p >= 0.0 && p <= 1.0);
+
+	if (0 == h->count)
+		return 0;
+
+	target = p * h->count;
+	target = MAX(target, 1);
+
+	for (i = 0; i < N_ITEMS(h->bucket); i++) {
+		seen += h->bucket[i];
+		if (seen >= target) {
+			uint64 v = gnet_stats_latency_bucket_value(i);
+			return MIN(v, h->max_ns);
+		}
+	}
+
+	return h->max_ns;
+}
+
 /***
  *** Public functions (gnet.h)
  ***/
@@ -937,6 +1197,7 @@ gnet_stats_get(gnet_stats_t *s)
 
 	GNET_STATS_LOCK;
     *s = gnet_stats;
+	gnet_stats_general_snapshot(s->general);
 	GNET_STATS_UNLOCK;
 }
 
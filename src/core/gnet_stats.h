@@ -30,6 +30,23 @@
 #include "if/core/net_stats.h"
 #include "if/dht/kademlia.h"
 
+/*
+ * Message processing latency histograms, HDR-style: each power of two
+ * is split into GNET_STATS_LAT_SUB linear sub-buckets, covering 0 to 4 secs
+ * with a relative error below 1/16.  Larger values land in the last bucket.
+ */
+
+#define GNET_STATS_LAT_SHIFT	4		/**< log2(GNET_STATS_LAT_SUB) */
+#define GNET_STATS_LAT_SUB		(1U << GNET_STATS_LAT_SHIFT)
+#define GNET_STATS_LAT_BUCKETS	(GNET_STATS_LAT_SUB * (33 - GNET_STATS_LAT_SHIFT))
+
+struct gnet_stats_latency {
+	uint64 count;							/**< Messages processed */
+	uint64 total_ns;						/**< Total processing time */
+	uint64 max_ns;							/**< Largest processing time */
+	uint64 bucket[GNET_STATS_LAT_BUCKETS];
+};
+
 void gnet_stats_init(void);
 
 void gnet_stats_count_received_header(gnutella_node_t *n);
@@ -53,6 +70,11 @@ void gnet_stats_set_general(gnr_stats_t type, uint64 value);
 uint64 gnet_stats_get_general(gnr_stats_t type);
 void gnet_stats_count_flowc(const void *, bool head_only);
 
+void gnet_stats_count_latency(uint8 function, uint64 ns);
+void gnet_stats_latency_get(msg_type_t t, struct gnet_stats_latency *h);
+uint64 gnet_stats_latency_percentile(
+	const struct gnet_stats_latency *h, double p);
+
 void gnet_stats_g2_count_flowc(const gnutella_node_t *n,
 	const void *base, size_t len);
 void gnet_stats_g2_count_queued(const gnutella_node_t *n,
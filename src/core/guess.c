@@ -139,6 +139,8 @@
 #include "lib/timestamp.h"		/* For timestamp_to_string() */
 #include "lib/tm.h"
 #include "lib/tokenizer.h"
+#include "lib/unsigned.h"		/* For uint32_saturate_add() */
+#include "lib/vmm.h"
 #include "lib/walloc.h"
 #include "lib/wq.h"
 #include "lib/xmalloc.h"
@@ -146,6 +148,12 @@
 #include "lib/override.h"		/* Must be the last header included */
 
 #define GUESS_QK_DB_CACHE_SIZE	1024	/**< Cached amount of query keys */
+#define GUESS_QKC_SETS			1024	/**< Sets in query key cache */
+#define GUESS_QKC_WAYS			2		/**< Entries per set */
+#define GUESS_QKC_SLOTS			(GUESS_QKC_SETS * GUESS_QKC_WAYS)
+#define GUESS_QKC_MASK			(GUESS_QKC_SETS - 1)
+#define GUESS_QK_SWEEP_PERIOD	1000	/**< in ms, between sweep steps */
+#define GUESS_QK_SWEEP_BATCH	256		/**< Entries examined per step */
 #define GUESS_QK_MAP_CACHE_SIZE	64		/**< # of SDBM pages to cache */
 #define GUESS_QK_LIFE			86000	/**< Cached token lifetime (secs) */
 #define GUESS_QK_PRUNE_PERIOD	(GUESS_QK_LIFE / 3 * 1000)	/**< in ms */
@@ -175,6 +183,11 @@
 #define GUESS_G2_CACHE_SIZE		45		/**< Random cache of G2 hosts */
 #define GUESS_ALIVE_CACHE_SIZE	1024	/**< Hosts with recent activity */
 #define GUESS_DBLOAD_PERIOD		(GUESS_DBLOAD_DELAY * 1000)	/**< in ms */
+#define GUESS_SCORE_MAX			4096	/**< Max amount of scored hosts */
+#define GUESS_SCORE_WINDOW		16		/**< Acks before halving history */
+#define GUESS_SCORE_RTT			1000	/**< Default RTT (ms) if unmeasured */
+#define GUESS_PICK_SCAN			64		/**< Eligible hosts compared on pick */
+#define GUESS_QK_WINDOW			8		/**< Max prefetched keys per query */
 
 /**
  * Query stops after that many hits
@@ -213,6 +226,8 @@ struct guess {
 	uint32 recv_results;		/**< Amount of results received */
 	unsigned hops;				/**< Amount of iteration hops */
 	int rpc_pending;			/**< Amount of RPC pending */
+	int qk_prefetch;			/**< Amount of query keys being prefetched */
+	const gnet_host_t *last_acked;	/**< Last host acknowledging (atom) */
 	unsigned bw_out_query;		/**< Spent outgoing querying bandwidth */
 	unsigned bw_out_qk;			/**< Estimated outgoing query key bandwidth */
 };
@@ -263,6 +278,7 @@ struct guess_rpc {
 	cevent_t *timeout;				/**< Callout queue timeout event */
 	struct guess_pmsg_info *pmi;	/**< Meta information about message sent */
 	const g2_tree_t *t;				/**< Parsed G2 tree (for G2 RPCs only) */
+	tm_t start;						/**< RPC issue time */
 	unsigned hops;					/**< Hop count at RPC issue time */
 };
 
@@ -347,6 +363,34 @@ struct qkdata {
 	void *query_key;		/**< Binary data -- walloc()-ed */
 };
 
+/**
+ * In-memory cache of recently accessed qkdata, in front of the database.
+ *
+ * This is a set-associative cache indexed by host, with GUESS_QKC_WAYS
+ * entries per set and LRU replacement within the set.  Modified entries are
+ * written back to the database when evicted and during periodic syncs.
+ *
+ * We also cache the fact that a host is not present in the database, since
+ * we get to process many hosts that we never contacted yet.
+ */
+enum guess_qkslot_state {
+	QKS_EMPTY = 0,			/**< Unused slot */
+	QKS_ABSENT,				/**< Host not present in database */
+	QKS_PRESENT				/**< Host data held in slot */
+};
+
+struct guess_qkslot {
+	struct qkdata qk;		/**< Cached value, query key owned by slot */
+	gnet_host_t host;		/**< Host to which entry belongs */
+	uint8 state;			/**< Slot state (enum guess_qkslot_state) */
+	uint8 dirty;			/**< Whether value needs to be written back */
+	uint8 recent;			/**< Most recently used slot within set */
+} G_ALIGNED(64);
+
+static struct guess_qkslot *guess_qkc;	/**< The cache (GUESS_QKC_SLOTS) */
+static uint64 guess_qkc_hits;			/**< Cache hits, for debugging */
+static uint64 guess_qkc_misses;			/**< Cache misses, for debugging */
+
 /**
  * Host flags.
  */
@@ -409,13 +453,39 @@ guess_qk_rpc_check(const struct guess_qk_rpc * const ctx)
 	g_assert(GUESS_QK_RPC_MAGIC == ctx->magic);
 }
 
+enum guess_score_magic { GUESS_SCORE_MAGIC = 0x3a1e57c9 };
+
+/**
+ * Observed behaviour of a GUESS host, used to rank hosts in query pools.
+ *
+ * The acknowledgment and hit counters are halved once we have seen enough
+ * acknowledgments, so that the hit yield tracks recent behaviour.
+ */
+struct guess_score {
+	enum guess_score_magic magic;
+	gnet_host_t host;			/**< The scored host */
+	uint32 acks;				/**< Query acknowledgments (decayed) */
+	uint32 hits;				/**< Hits credited to host (decayed) */
+	uint32 timeouts;			/**< Timeouts since last acknowledgment */
+	uint32 rtt;					/**< Smoothed RTT, in ms (0 if unknown) */
+};
+
+static inline void
+guess_score_check(const struct guess_score * const gs)
+{
+	g_assert(gs != NULL);
+	g_assert(GUESS_SCORE_MAGIC == gs->magic);
+}
+
 static hevset_t *gqueries;				/**< Running GUESS queries */
 static hikset_t *gmuid;					/**< MUIDs of active queries */
 static htable_t *pending;				/**< Pending pong acknowledges */
 static hash_list_t *link_cache;			/**< GUESS "link cache" */
 static hash_list_t *load_pending;		/**< Queries waiting for DBMW loading */
 static hash_list_t *alive_cache;		/**< Cache of zero-timeout hosts */
+static hash_list_t *guess_scores;		/**< LRU cache of host scores */
 static cperiodic_t *guess_qk_prune_ev;	/**< Query keys pruning event */
+static cperiodic_t *guess_qk_sweep_ev;	/**< Incremental pruning sweep */
 static cperiodic_t *guess_check_ev;		/**< Link cache monitoring */
 static cperiodic_t *guess_sync_ev;		/**< Periodic DBMW syncs */
 static cperiodic_t *guess_bw_ev;		/**< Periodic b/w checking */
@@ -430,6 +500,16 @@ static uint64 guess_target_bw;			/**< Outgoing b/w target for period */
 static int guess_alpha = GUESS_ALPHA;	/**< Concurrency query parameter */
 static time_t guess_qk_threshtime;		/**< Stamp threshold for query keys */
 
+/**
+ * Incremental sweep through the query key database, for pruning.
+ */
+static struct guess_qk_sweep {
+	pslist_t *keys;				/**< Remaining keys to check */
+	size_t pruned;				/**< Amount of entries pruned */
+	uint64 v2_hosts;			/**< GUESS 0.2 hosts seen during sweep */
+	uint64 g2_hosts;			/**< G2 hosts seen during sweep */
+} guess_qk_sweep;
+
 static void guess_discovery_enable(void);
 static void guess_iterate(guess_t *gq);
 static bool guess_send(guess_t *gq, const gnet_host_t *host);
@@ -652,16 +732,166 @@ guess_id_create(void)
 }
 
 /**
- * Get qkdata from database, returning NULL if not found.
+ * Compute the set in the query key cache where host can be held.
+ */
+static inline struct guess_qkslot *
+guess_qkc_set(const gnet_host_t *h)
+{
+	return &guess_qkc[GUESS_QKC_WAYS * (gnet_host_hash(h) & GUESS_QKC_MASK)];
+}
+
+/**
+ * Mark slot as the most recently used in its set.
+ */
+static inline void
+guess_qkc_touch(struct guess_qkslot *set, unsigned i)
+{
+	unsigned j;
+
+	for (j = 0; j < GUESS_QKC_WAYS; j++)
+		set[j].recent = booleanize(i == j);
+}
+
+/**
+ * Lookup host in the query key cache.
+ *
+ * @param h		the host to look for
+ * @param touch	whether to mark the entry as the most recently used one
+ *
+ * @return the slot holding the host, NULL if not cached.
+ */
+static struct guess_qkslot *
+guess_qkc_lookup(const gnet_host_t *h, bool touch)
+{
+	struct guess_qkslot *set = guess_qkc_set(h);
+	unsigned i;
+
+	for (i = 0; i < GUESS_QKC_WAYS; i++) {
+		struct guess_qkslot *s = &set[i];
+
+		if (QKS_EMPTY != s->state && gnet_host_equal(&s->host, h)) {
+			if (touch)
+				guess_qkc_touch(set, i);
+			return s;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Write back modified slot to the database.
+ */
+static void
+guess_qkc_flush_slot(struct guess_qkslot *s)
+{
+	struct qkdata qk;
+
+	if (!s->dirty)
+		return;
+
+	g_assert(QKS_PRESENT == s->state);
+
+	/*
+	 * The DBMW layer takes ownership of the query key we give it.
+	 */
+
+	qk = s->qk;		/* Struct copy */
+	qk.query_key = 0 == qk.length ? NULL : wcopy(qk.query_key, qk.length);
+	dbmw_write(db_qkdata, &s->host, &qk, sizeof qk);
+
+	s->dirty = FALSE;
+}
+
+/**
+ * Discard the value held in slot, which must have been flushed already.
+ */
+static void
+guess_qkc_clear_slot(struct guess_qkslot *s)
+{
+	if (QKS_PRESENT == s->state)
+		WFREE_NULL(s->qk.query_key, s->qk.length);
+
+	s->state = QKS_EMPTY;
+	s->dirty = FALSE;
+}
+
+/**
+ * Allocate a slot for host, evicting the least recently used entry in the
+ * set if needed.
+ *
+ * @return the allocated slot, marked as the most recently used, with the
+ * host recorded but no value attached.
+ */
+static struct guess_qkslot *
+guess_qkc_allocate(const gnet_host_t *h)
+{
+	struct guess_qkslot *set = guess_qkc_set(h), *s = NULL;
+	unsigned i;
+
+	for (i = 0; i < GUESS_QKC_WAYS; i++) {
+		if (QKS_EMPTY == set[i].state) {
+			s = &set[i];
+			break;
+		}
+		if (!set[i].recent)
+			s = &set[i];
+	}
+
+	g_assert(s != NULL);
+
+	guess_qkc_flush_slot(s);
+	guess_qkc_clear_slot(s);
+
+	gnet_host_copy(&s->host, h);
+	guess_qkc_touch(set, s - set);
+
+	return s;
+}
+
+/**
+ * Write back all the modified query key cache entries.
+ */
+static void
+guess_qkc_flush(void)
+{
+	size_t i;
+
+	if G_UNLIKELY(NULL == guess_qkc)
+		return;
+
+	for (i = 0; i < GUESS_QKC_SLOTS; i++)
+		guess_qkc_flush_slot(&guess_qkc[i]);
+}
+
+/**
+ * Write back all the modified entries and discard the query key cache.
+ */
+static void
+guess_qkc_close(void)
+{
+	size_t i;
+
+	if G_UNLIKELY(NULL == guess_qkc)
+		return;
+
+	for (i = 0; i < GUESS_QKC_SLOTS; i++) {
+		guess_qkc_flush_slot(&guess_qkc[i]);
+		guess_qkc_clear_slot(&guess_qkc[i]);
+	}
+
+	vmm_free(guess_qkc, GUESS_QKC_SLOTS * sizeof guess_qkc[0]);
+	guess_qkc = NULL;
+}
+
+/**
+ * Read qkdata from the database, without going through the cache.
  */
 static struct qkdata *
-get_qkdata(const gnet_host_t *host)
+get_qkdata_db(const gnet_host_t *host)
 {
 	struct qkdata *qk;
 
-	if G_UNLIKELY(NULL == db_qkdata)
-		return NULL;
-
 	qk = dbmw_read(db_qkdata, host, NULL);
 
 	if (NULL == qk) {
@@ -675,14 +905,150 @@ get_qkdata(const gnet_host_t *host)
 	return qk;
 }
 
+/**
+ * Get qkdata, returning NULL if not found.
+ *
+ * The returned value can be modified and written back with put_qkdata().
+ * It remains valid until the next access to another host's data.
+ */
+static struct qkdata *
+get_qkdata(const gnet_host_t *host)
+{
+	struct guess_qkslot *s;
+	struct qkdata *qk;
+
+	if G_UNLIKELY(NULL == db_qkdata)
+		return NULL;
+
+	s = guess_qkc_lookup(host, TRUE);
+
+	if (s != NULL) {
+		guess_qkc_hits++;
+		return QKS_PRESENT == s->state ? &s->qk : NULL;
+	}
+
+	guess_qkc_misses++;
+
+	/*
+	 * Allocate the slot before reading from the database since a possible
+	 * write-back of the evicted entry would invalidate the value read.
+	 */
+
+	s = guess_qkc_allocate(host);
+	qk = get_qkdata_db(host);
+
+	if (qk != NULL) {
+		s->qk = *qk;		/* Struct copy */
+		s->qk.query_key =
+			0 == qk->length ? NULL : wcopy(qk->query_key, qk->length);
+		s->state = QKS_PRESENT;
+		return &s->qk;
+	}
+
+	/*
+	 * Remember that the host is not in the database, unless we got an I/O
+	 * error, to avoid hitting the disk each time we process unknown hosts.
+	 */
+
+	if (dbmw_has_ioerr(db_qkdata))
+		s->state = QKS_EMPTY;
+	else
+		s->state = QKS_ABSENT;
+
+	return NULL;
+}
+
+/**
+ * Get qkdata without altering the contents of the cache, for bulk traversals.
+ *
+ * The returned value must not be modified.
+ */
+static const struct qkdata *
+peek_qkdata(const gnet_host_t *host)
+{
+	const struct guess_qkslot *s;
+
+	if G_UNLIKELY(NULL == db_qkdata)
+		return NULL;
+
+	s = guess_qkc_lookup(host, FALSE);
+
+	if (s != NULL)
+		return QKS_PRESENT == s->state ? &s->qk : NULL;
+
+	return get_qkdata_db(host);
+}
+
+/**
+ * Record new qkdata for host.
+ *
+ * Data are written back to the database when evicted from the cache or
+ * during periodic syncs.
+ *
+ * The query key referenced by the new value becomes owned by the cache,
+ * and any previous query key held for the host is freed.
+ */
+static void
+put_qkdata(const gnet_host_t *host, struct qkdata *qk)
+{
+	struct guess_qkslot *s;
+
+	if G_UNLIKELY(NULL == db_qkdata)
+		return;
+
+	s = guess_qkc_lookup(host, TRUE);
+
+	if (NULL == s)
+		s = guess_qkc_allocate(host);
+
+	if (qk != &s->qk) {
+		if (QKS_PRESENT == s->state && s->qk.query_key != qk->query_key)
+			WFREE_NULL(s->qk.query_key, s->qk.length);
+		s->qk = *qk;		/* Struct copy */
+	}
+
+	s->state = QKS_PRESENT;
+	s->dirty = TRUE;
+}
+
 /**
  * Delete known-to-be existing query keys for specified host from database.
+ *
+ * @param host		the host whose entry we are deleting
+ * @param qk		the entry being deleted, to update host counters
  */
 static void
-delete_qkdata(const gnet_host_t *host)
+delete_qkdata(const gnet_host_t *host, const struct qkdata *qk)
 {
+	struct guess_qkslot *s;
+
+	/*
+	 * Keep the amount of GUESS 0.2 and G2 hosts accurate, counting hosts
+	 * the same way guess_qk_sweep_end() does.
+	 */
+
+	if (qk->flags & GUESS_F_G2) {
+		if (guess_g2_hosts != 0) {
+			guess_g2_hosts--;
+			gnet_stats_dec_general(GNR_GUESS_CACHED_G2_HOSTS_HELD);
+		}
+	} else if (qk->flags & GUESS_F_PONG_IPP) {
+		if (guess_02_hosts != 0) {
+			guess_02_hosts--;
+			gnet_stats_dec_general(GNR_GUESS_CACHED_02_HOSTS_HELD);
+		}
+	}
+
 	guess_cache_remove(&guess_02_cache, host);		/* In case it is there */
 	guess_cache_remove(&guess_g2_cache, host);		/* In case it is there */
+
+	s = guess_qkc_lookup(host, FALSE);
+
+	if (s != NULL) {
+		guess_qkc_clear_slot(s);
+		s->state = QKS_ABSENT;
+	}
+
 	dbmw_delete(db_qkdata, host);
 	gnet_stats_dec_general(GNR_GUESS_CACHED_QUERY_KEYS_HELD);
 
@@ -1068,6 +1434,7 @@ guess_rpc_register(const gnet_host_t *host, const guid_t *muid, bool g2,
 	grp->gid = gid;
 	grp->cb = cb;
 	grp->timeout = cq_main_insert(GUESS_RPC_LIFETIME, guess_rpc_timeout, grp);
+	tm_now_exact(&grp->start);
 
 	k = guess_rpc_key_alloc(muid, host);
 	htable_insert(pending, k, grp);
@@ -1139,7 +1506,7 @@ guess_host_set_flags(const gnet_host_t *h, uint32 flags)
 	if (qk != NULL) {
 		if ((qk->flags & flags) != flags) {
 			qk->flags |= flags;
-			dbmw_write(db_qkdata, h, qk, sizeof *qk);
+			put_qkdata(h, qk);
 		}
 	}
 }
@@ -1157,7 +1524,7 @@ guess_host_clear_flags(const gnet_host_t *h, uint32 flags)
 	if (qk != NULL) {
 		if (qk->flags & flags) {
 			qk->flags &= ~flags;
-			dbmw_write(db_qkdata, h, qk, sizeof *qk);
+			put_qkdata(h, qk);
 		}
 	}
 }
@@ -1177,7 +1544,7 @@ guess_host_set_v2(const gnet_host_t *h)
 			qk->flags |= GUESS_F_PONG_IPP;
 			guess_02_hosts++;
 			gnet_stats_inc_general(GNR_GUESS_CACHED_02_HOSTS_HELD);
-			dbmw_write(db_qkdata, h, qk, sizeof *qk);
+			put_qkdata(h, qk);
 			guess_cache_add(&guess_02_cache, h);
 		}
 	}
@@ -1198,7 +1565,7 @@ guess_host_clear_v2(const gnet_host_t *h)
 			qk->flags &= ~GUESS_F_PONG_IPP;
 			guess_02_hosts--;
 			gnet_stats_dec_general(GNR_GUESS_CACHED_02_HOSTS_HELD);
-			dbmw_write(db_qkdata, h, qk, sizeof *qk);
+			put_qkdata(h, qk);
 			guess_cache_remove(&guess_02_cache, h);
 		}
 	}
@@ -1232,6 +1599,211 @@ guess_alive_update(const gnet_host_t *h)
 	}
 }
 
+/**
+ * Hash a host score (by host).
+ */
+static uint
+guess_score_hash(const void *key)
+{
+	const struct guess_score *gs = key;
+
+	return gnet_host_hash(&gs->host);
+}
+
+/**
+ * Compare two host scores (by host).
+ */
+static bool
+guess_score_eq(const void *a, const void *b)
+{
+	const struct guess_score *gsa = a, *gsb = b;
+
+	return gnet_host_equal(&gsa->host, &gsb->host);
+}
+
+/**
+ * Free host score.
+ */
+static void
+guess_score_free(void *data)
+{
+	struct guess_score *gs = data;
+
+	guess_score_check(gs);
+
+	gs->magic = 0;
+	WFREE(gs);
+}
+
+/**
+ * Lookup score of host.
+ *
+ * @return the score of the host, NULL if the host was never scored.
+ */
+static struct guess_score *
+guess_score_lookup(const gnet_host_t *h)
+{
+	struct guess_score key;
+	const void *orig;
+
+	if G_UNLIKELY(NULL == guess_scores)
+		return NULL;		/* GUESS layer shutdown already */
+
+	gnet_host_copy(&key.host, h);
+
+	if (hash_list_find(guess_scores, &key, &orig))
+		return deconstify_pointer(orig);
+
+	return NULL;
+}
+
+/**
+ * Get score of host, creating a blank one if the host was never scored.
+ *
+ * The score cache is maintained as a pure LRU cache of limited size: hosts
+ * we keep hearing about stay in the cache, the others are forgotten.
+ *
+ * @return the score of the host, NULL if the GUESS layer was shutdown.
+ */
+static struct guess_score *
+guess_score_get(const gnet_host_t *h)
+{
+	struct guess_score *gs;
+
+	if G_UNLIKELY(NULL == guess_scores)
+		return NULL;
+
+	gs = guess_score_lookup(h);
+
+	if (gs != NULL) {
+		guess_score_check(gs);
+		hash_list_moveto_head(guess_scores, gs);
+		return gs;
+	}
+
+	while (hash_list_length(guess_scores) >= GUESS_SCORE_MAX) {
+		struct guess_score *old = hash_list_remove_tail(guess_scores);
+		guess_score_free(old);
+	}
+
+	WALLOC0(gs);
+	gs->magic = GUESS_SCORE_MAGIC;
+	gnet_host_copy(&gs->host, h);
+	hash_list_prepend(guess_scores, gs);
+
+	gnet_stats_set_general(GNR_GUESS_SCORED_HOSTS_HELD,
+		hash_list_length(guess_scores));
+
+	return gs;
+}
+
+/**
+ * Record round-trip time measured for host.
+ *
+ * @param h			the host which replied
+ * @param start		time at which the request was sent
+ */
+static void
+guess_score_rtt(const gnet_host_t *h, const tm_t *start)
+{
+	struct guess_score *gs;
+	tm_t now;
+	long ms;
+
+	gs = guess_score_get(h);
+	if (NULL == gs)
+		return;
+
+	tm_now_exact(&now);
+	ms = tm_elapsed_ms(&now, start);
+	ms = MAX(ms, 1);
+
+	if (0 == gs->rtt)
+		gs->rtt = ms;
+	else
+		gs->rtt = (3 * (uint64) gs->rtt + ms) / 4;
+}
+
+/**
+ * Record query acknowledgment from host.
+ */
+static void
+guess_score_ack(const gnet_host_t *h)
+{
+	struct guess_score *gs;
+
+	gs = guess_score_get(h);
+	if (NULL == gs)
+		return;
+
+	gs->timeouts = 0;
+
+	if (++gs->acks > GUESS_SCORE_WINDOW) {
+		gs->acks /= 2;
+		gs->hits /= 2;
+	}
+}
+
+/**
+ * Credit hits to host.
+ */
+static void
+guess_score_hits(const gnet_host_t *h, uint32 hits)
+{
+	struct guess_score *gs;
+
+	gs = guess_score_get(h);
+	if (NULL == gs)
+		return;
+
+	gs->hits = uint32_saturate_add(gs->hits, hits);
+}
+
+/**
+ * Record timeout from host.
+ */
+static void
+guess_score_timeout(const gnet_host_t *h)
+{
+	struct guess_score *gs;
+
+	gs = guess_score_get(h);
+	if (NULL == gs)
+		return;
+
+	gs->timeouts++;
+}
+
+/**
+ * Compute the value of a host, for ranking purposes.
+ *
+ * The value is the observed hit yield per acknowledgment, penalized by the
+ * round-trip time and by the amount of recent timeouts.  Unknown hosts are
+ * valued below hosts which proved to be productive but above hosts which
+ * acknowledge our queries without ever generating hits.
+ *
+ * @return the value of the host, the larger the better.
+ */
+static uint32
+guess_score_value(const gnet_host_t *h)
+{
+	const struct guess_score *gs = guess_score_lookup(h);
+	uint64 v;
+	uint32 rtt;
+
+	if (NULL == gs)
+		return 128 * 1024 / (1024 + GUESS_SCORE_RTT);
+
+	guess_score_check(gs);
+
+	v = ((uint64) gs->hits * 256 + 128) / (gs->acks + 1);
+	rtt = 0 == gs->rtt ? GUESS_SCORE_RTT : gs->rtt;
+	v = v * 1024 / (1024 + rtt);
+	v /= 1 + gs->timeouts;
+
+	return MIN(v, MAX_INT_VAL(uint32));
+}
+
 /**
  * Update "last_seen" event for hosts from whom we get traffic and move
  * them to the head of the link cache if present.
@@ -1268,7 +1840,7 @@ guess_traffic_from(const gnet_host_t *h, uint32 flags)
 
 	qk->last_seen = tm_time();
 	qk->timeouts = 0;
-	dbmw_write(db_qkdata, h, qk, sizeof *qk);
+	put_qkdata(h, qk);
 }
 
 /**
@@ -1290,13 +1862,14 @@ guess_timeout_from(const gnet_host_t *h)
 
 	atom = hash_list_remove(alive_cache, h);
 	atom_host_free_null(&atom);
+	guess_score_timeout(h);
 
 	qk = get_qkdata(h);
 
 	if (qk != NULL) {
 		qk->last_timeout = tm_time();
 		qk->timeouts++;
-		dbmw_write(db_qkdata, h, qk, sizeof *qk);
+		put_qkdata(h, qk);
 	}
 }
 
@@ -1325,7 +1898,7 @@ guess_timeout_reset(const gnet_host_t *h, struct qkdata *qk)
 			g_debug("GUESS resetting timeouts for %s", gnet_host_to_string(h));
 		}
 		qk->timeouts = 0;
-		dbmw_write(db_qkdata, h, qk, sizeof *qk);
+		put_qkdata(h, qk);
 	}
 }
 
@@ -1353,10 +1926,10 @@ guess_record_g2(const gnet_host_t *h)
 		guess_g2_hosts++;
 		gnet_stats_inc_general(GNR_GUESS_CACHED_G2_HOSTS_HELD);
 
-		dbmw_write(db_qkdata, h, qk, sizeof *qk);
+		put_qkdata(h, qk);
 	} else if (!(qk->flags & GUESS_F_G2)) {
 		qk->flags |= GUESS_F_G2;
-		dbmw_write(db_qkdata, h, qk, sizeof *qk);
+		put_qkdata(h, qk);
 	}
 }
 
@@ -1833,7 +2406,7 @@ guess_remove_link_cache(const gnet_host_t *h)
 		double p = guess_entry_still_alive(qk);
 
 		if (p < GUESS_ALIVE_PROBA) {
-			delete_qkdata(h);
+			delete_qkdata(h, qk);
 		}
 	}
 
@@ -1886,15 +2459,15 @@ guess_record_qk(const gnet_host_t *h, const void *buf, size_t len, bool g2)
 	new_qk.length = MIN(len, MAX_INT_VAL(uint8));
 	new_qk.query_key = new_qk.length ? wcopy(buf, new_qk.length) : NULL;
 
-	if (!dbmw_exists(db_qkdata, h))
+	if (NULL == qk)
 		gnet_stats_inc_general(GNR_GUESS_CACHED_QUERY_KEYS_HELD);
 
 	/*
-	 * Writing a new value for the key will free up any dynamically allocated
-	 * data in the DBMW cache through free_qkdata().
+	 * Writing a new value for the key will free up any previous query key
+	 * held in the cache.
 	 */
 
-	dbmw_write(db_qkdata, h, &new_qk, sizeof new_qk);
+	put_qkdata(h, &new_qk);
 
 	if (GNET_PROPERTY(guess_client_debug) > 4) {
 		g_debug("GUESS got %u-byte query key from %s%s",
@@ -3171,23 +3744,19 @@ guess_request_hosts(host_addr_t addr, uint16 port)
 }
 
 /**
- * DBMW foreach iterator to remove old entries.
+ * Check whether entry is to be pruned, updating sweep statistics.
+ *
  * @return TRUE if entry must be deleted.
  */
 static bool
-qk_prune_old(void *key, void *value, size_t u_len, void *u_data)
+qk_prune_old(const gnet_host_t *h, const struct qkdata *qk)
 {
-	const gnet_host_t *h = key;
-	const struct qkdata *qk = value;
 	time_delta_t d;
 	bool expired, hostile, g2;
 	unsigned minor;
 	double p;
 	host_addr_t addr;
 
-	(void) u_len;
-	(void) u_data;
-
 	/*
 	 * The query cache is both a way to identify "stable" GUESS nodes as well
 	 * as a way to cache the necessary query key.
@@ -3224,10 +3793,10 @@ qk_prune_old(void *key, void *value, size_t u_len, void *u_data)
 			guess_cache_remove(g2 ? &guess_g2_cache : &guess_02_cache, h);
 		} else {
 			if (g2) {
-				guess_g2_hosts++;
+				guess_qk_sweep.g2_hosts++;
 				guess_cache_add(&guess_g2_cache, h);
 			} else {
-				guess_02_hosts++;
+				guess_qk_sweep.v2_hosts++;
 				guess_cache_add(&guess_02_cache, h);
 			}
 		}
@@ -3245,31 +3814,148 @@ qk_prune_old(void *key, void *value, size_t u_len, void *u_data)
 }
 
 /**
- * Prune the database, removing expired query keys.
+ * End of the sweep through the database, once all the entries were checked.
+ *
+ * @param sync		whether the whole sweep was performed synchronously
  */
 static void
-guess_qk_prune_old(void)
+guess_qk_sweep_end(bool sync)
 {
-	if (GNET_PROPERTY(guess_client_debug)) {
-		g_debug("GUESS QKCACHE pruning expired query keys (%zu)",
-			dbmw_count(db_qkdata));
-	}
+	size_t count = dbmw_count(db_qkdata);
+
+	g_assert(NULL == guess_qk_sweep.keys);
+
+	/*
+	 * The amount of GUESS 0.2 and G2 hosts is maintained as entries are
+	 * created, flagged and deleted.  The tallies of an incremental sweep
+	 * miss the changes made to entries it had already checked, hence we
+	 * only trust them when nothing could change during the sweep, which
+	 * is how the counters get initialized at startup.
+	 */
 
-	guess_02_hosts = 0;		/* Will be updated by qk_prune_old() */
-	guess_g2_hosts = 0;		/* Idem */
+	if (sync) {
+		guess_02_hosts = guess_qk_sweep.v2_hosts;
+		guess_g2_hosts = guess_qk_sweep.g2_hosts;
+	}
 
-	dbmw_foreach_remove(db_qkdata, qk_prune_old, NULL);
-	gnet_stats_set_general(GNR_GUESS_CACHED_QUERY_KEYS_HELD,
-		dbmw_count(db_qkdata));
+	gnet_stats_set_general(GNR_GUESS_CACHED_QUERY_KEYS_HELD, count);
 	gnet_stats_set_general(GNR_GUESS_CACHED_02_HOSTS_HELD, guess_02_hosts);
 	gnet_stats_set_general(GNR_GUESS_CACHED_G2_HOSTS_HELD, guess_g2_hosts);
 
 	if (GNET_PROPERTY(guess_client_debug)) {
-		g_debug("GUESS QKCACHE pruned expired query keys (%zu remaining)",
-			dbmw_count(db_qkdata));
+		g_debug("GUESS QKCACHE pruned %zu expired query key%s "
+			"(%zu remaining)",
+			guess_qk_sweep.pruned, plural(guess_qk_sweep.pruned), count);
+	}
+
+	/*
+	 * Only rebuild the database when we removed a significant fraction
+	 * of its entries, since this requires a full traversal.
+	 */
+
+	if (guess_qk_sweep.pruned != 0 && guess_qk_sweep.pruned >= count / 8)
+		dbstore_compact(db_qkdata);
+}
+
+/**
+ * Check the next entries in the sweep, removing expired ones.
+ *
+ * @param max		maximum amount of entries to check
+ * @param sync		whether the sweep is performed synchronously
+ *
+ * @return TRUE if there are remaining entries to check.
+ */
+static bool
+guess_qk_sweep_step(size_t max, bool sync)
+{
+	while (max-- != 0 && guess_qk_sweep.keys != NULL) {
+		gnet_host_t *h = pslist_shift(&guess_qk_sweep.keys);
+		const struct qkdata *qk;
+
+		/*
+		 * The key snapshot was taken at the beginning of the sweep, hence
+		 * the entry could have been removed since then.
+		 *
+		 * We do not want to pollute the query key cache with entries we
+		 * are merely traversing, hence the use of peek_qkdata().
+		 */
+
+		qk = peek_qkdata(h);
+
+		if (qk != NULL && qk_prune_old(h, qk)) {
+			delete_qkdata(h, qk);
+			guess_qk_sweep.pruned++;
+		}
+
+		wfree(h, gnet_host_length(h));
+	}
+
+	if (guess_qk_sweep.keys != NULL)
+		return TRUE;
+
+	guess_qk_sweep_end(sync);
+	return FALSE;
+}
+
+/**
+ * Callout queue periodic event to continue the sweep.
+ */
+static bool
+guess_qk_periodic_sweep(void *unused_obj)
+{
+	(void) unused_obj;
+
+	if (guess_qk_sweep_step(GUESS_QK_SWEEP_BATCH, FALSE))
+		return TRUE;		/* Keep calling */
+
+	guess_qk_sweep_ev = NULL;
+	return FALSE;			/* Sweep completed */
+}
+
+/**
+ * Prune the database, removing expired query keys.
+ *
+ * We take a snapshot of the keys and then check the entries incrementally,
+ * a batch at a time, to avoid stalling the process when the database is
+ * large.
+ *
+ * @param sync		if TRUE, check all the entries synchronously
+ */
+static void
+guess_qk_prune_old(bool sync)
+{
+	if (guess_qk_sweep.keys != NULL) {
+		if (GNET_PROPERTY(guess_client_debug)) {
+			g_debug("GUESS QKCACHE previous sweep still running (%zu left)",
+				pslist_length(guess_qk_sweep.keys));
+		}
+		return;
+	}
+
+	g_assert(NULL == guess_qk_sweep_ev);
+
+	/*
+	 * Flush the query key cache so that the database holds all the
+	 * known hosts before taking the key snapshot.
+	 */
+
+	guess_qkc_flush();
+
+	ZERO(&guess_qk_sweep);
+	guess_qk_sweep.keys = dbmw_all_keys(db_qkdata);
+
+	if (GNET_PROPERTY(guess_client_debug)) {
+		g_debug("GUESS QKCACHE pruning expired query keys (%zu)",
+			pslist_length(guess_qk_sweep.keys));
 	}
 
-	dbstore_compact(db_qkdata);
+	if (sync) {
+		while (guess_qk_sweep_step(GUESS_QK_SWEEP_BATCH, TRUE))
+			/* empty */;
+	} else if (guess_qk_sweep_step(GUESS_QK_SWEEP_BATCH, FALSE)) {
+		guess_qk_sweep_ev = cq_periodic_main_add(
+			GUESS_QK_SWEEP_PERIOD, guess_qk_periodic_sweep, NULL);
+	}
 }
 
 /**
@@ -3280,7 +3966,7 @@ guess_qk_periodic_prune(void *unused_obj)
 {
 	(void) unused_obj;
 
-	guess_qk_prune_old();
+	guess_qk_prune_old(FALSE);
 	return TRUE;		/* Keep calling */
 }
 
@@ -3395,6 +4081,7 @@ qk_link_cache(void *key, void *value, size_t len, void *u_data)
 static void
 guess_load_link_cache(void)
 {
+	guess_qkc_flush();
 	dbmw_foreach(db_qkdata, qk_link_cache, NULL);
 }
 
@@ -3475,6 +4162,13 @@ guess_periodic_sync(void *unused_obj)
 {
 	(void) unused_obj;
 
+	if (GNET_PROPERTY(guess_client_debug) > 1) {
+		g_debug("GUESS QKCACHE %s hit%s, %s miss%s",
+			uint64_to_string(guess_qkc_hits), plural(guess_qkc_hits),
+			uint64_to_string2(guess_qkc_misses), plural_es(guess_qkc_misses));
+	}
+
+	guess_qkc_flush();
 	dbstore_sync_flush(db_qkdata);
 	return TRUE;				/* Keep calling */
 }
@@ -3605,6 +4299,10 @@ guess_got_results(const guid_t *muid, uint32 hits)
 
 	guess_check(gq);
 	gq->recv_results += hits;
+
+	if (gq->last_acked != NULL)
+		guess_score_hits(gq->last_acked, hits);
+
 	guess_stats_fire(gq);
 }
 
@@ -3660,14 +4358,20 @@ guess_final_stats(const guess_t *gq)
 /**
  * Select host to query next.
  *
+ * Among the first GUESS_PICK_SCAN eligible hosts in the pool, we pick the
+ * one with the best score.  Hosts for which we do not hold a valid query
+ * key yet see their value halved: querying them requires an extra round-trip
+ * unless the key was prefetched.
+ *
  * @return host to query, NULL if none available.
  */
 static const gnet_host_t *
 guess_pick_next(guess_t *gq)
 {
 	hash_list_iter_t *iter;
-	const gnet_host_t *host;
-	bool found = FALSE;
+	const gnet_host_t *host, *best = NULL;
+	uint32 best_value = 0;
+	unsigned candidates = 0;
 
 	guess_check(gq);
 
@@ -3752,9 +4456,21 @@ guess_pick_next(guess_t *gq)
 			continue;
 		}
 
-		found = TRUE;
-		hash_list_iter_remove(iter);
-		break;
+		{
+			uint32 value = guess_score_value(host);
+
+			if (!guess_has_valid_qk(host))
+				value /= 2;
+
+			if (NULL == best || value > best_value) {
+				best = host;
+				best_value = value;
+			}
+		}
+
+		if (++candidates >= GUESS_PICK_SCAN)
+			break;
+		continue;
 
 	defer:
 		hash_list_iter_remove(iter);
@@ -3772,7 +4488,17 @@ guess_pick_next(guess_t *gq)
 
 	hash_list_iter_release(&iter);
 
-	return found ? host : NULL;
+	if (best != NULL) {
+		hash_list_remove(gq->pool, best);
+
+		if (GNET_PROPERTY(guess_client_debug) > 5) {
+			g_debug("GUESS QUERY[%s] picked %s (value %u) among %u host%s",
+				nid_to_string(&gq->gid), gnet_host_to_string(best),
+				best_value, candidates, plural(candidates));
+		}
+	}
+
+	return best;
 }
 
 /**
@@ -4041,6 +4767,7 @@ next:
 	 * query, shuffle the resulting pool after loading.
 	 */
 
+	guess_qkc_flush();
 	dbmw_foreach(db_qkdata, guess_pool_from_qkdata, &ctx);
 	gq->flags &= ~GQ_F_POOL_LOAD;
 	hash_list_shuffle(gq->pool);	/* Randomize order */
@@ -4345,6 +5072,7 @@ struct guess_qk_context {
 	enum guess_qk_magic magic;
 	struct nid gid;					/**< Running query ID */
 	const gnet_host_t *host;		/**< Host we're requesting the key from */
+	tm_t start;						/**< Time of the request */
 };
 
 static inline void
@@ -4473,6 +5201,7 @@ guess_got_query_key(enum udp_ping_ret type,
 		extracted = g2 ?
 			guess_extract_g2_qk(t, host) : guess_extract_qk(n, host);
 		if (extracted) {
+			guess_score_rtt(host, &ctx->start);
 			if (GNET_PROPERTY(guess_client_debug) > 2) {
 				g_debug("GUESS QUERY[%s] got query key from %s%s, querying",
 					nid_to_string(&gq->gid),
@@ -4514,7 +5243,7 @@ guess_got_query_key(enum udp_ping_ret type,
 					guess_alien_host(gq, host, TRUE);
 				}
 				if (qk != NULL)
-					delete_qkdata(host);
+					delete_qkdata(host, qk);
 				guess_remove_link_cache(host);
 				goto no_query_key;
 			}
@@ -4533,6 +5262,179 @@ no_query_key:
 	guess_iterate(gq);
 }
 
+enum guess_prefetch_magic { GUESS_PREFETCH_MAGIC = 0x5c0e27b1 };
+
+/**
+ * Context for query keys requested ahead of querying the host.
+ */
+struct guess_prefetch {
+	enum guess_prefetch_magic magic;
+	struct nid gid;					/**< Running query ID */
+	const gnet_host_t *host;		/**< Host we're requesting the key from */
+	tm_t start;						/**< Time of the request */
+	bool g2;						/**< Whether host is a G2 hub */
+	bool replied;					/**< Whether we got a reply already */
+};
+
+static inline void
+guess_prefetch_check(const struct guess_prefetch * const ctx)
+{
+	g_assert(ctx != NULL);
+	g_assert(GUESS_PREFETCH_MAGIC == ctx->magic);
+}
+
+/**
+ * Process query key reply from host whose key was prefetched.
+ *
+ * Processing of the reply is delegated to the routines handling background
+ * query key requests, which record the key in the cache.  We only account
+ * for the end of the prefetch in the query and let it iterate, since the
+ * host can now be queried directly.
+ *
+ * @param type		type of reply, if any
+ * @param n			gnutella node replying (NULL if no reply)
+ * @param t			parsed G2 message tree (NULL if no reply or for Gnutella)
+ * @param data		user-supplied callback data
+ */
+static void
+guess_qk_prefetched(enum udp_ping_ret type,
+	const gnutella_node_t *n, const g2_tree_t *t, void *data)
+{
+	struct guess_prefetch *ctx = data;
+	guess_t *gq;
+	bool last;
+
+	guess_prefetch_check(ctx);
+	g_assert(atom_is_host(ctx->host));
+
+	if (UDP_PING_REPLY == type && !ctx->replied) {
+		ctx->replied = TRUE;
+		if G_LIKELY(link_cache != NULL)
+			guess_score_rtt(ctx->host, &ctx->start);
+	}
+
+	/*
+	 * G2 hosts reply with a single /QKA, Gnutella hosts can send several
+	 * pongs before we get the final UDP_PING_EXPIRED notification.
+	 *
+	 * The delegated routine takes ownership of the host atom and frees it
+	 * upon the last notification.
+	 */
+
+	last = ctx->g2 || UDP_PING_EXPIRED == type || UDP_PING_TIMEDOUT == type;
+
+	if (ctx->g2) {
+		guess_qk_g2_reply(type, n, t, deconstify_pointer(ctx->host));
+	} else {
+		guess_qk_reply(type, n, t, deconstify_pointer(ctx->host));
+	}
+
+	if (!last)
+		return;
+
+	gq = guess_is_alive(ctx->gid);
+
+	if (gq != NULL) {
+		g_assert(gq->qk_prefetch > 0);
+
+		gq->qk_prefetch--;
+
+		if (
+			ctx->replied && NULL == gq->bwait &&
+			gq->rpc_pending < guess_alpha
+		)
+			guess_async_iterate_if_needed(gq);
+	}
+
+	ctx->magic = 0;
+	WFREE(ctx);
+}
+
+/**
+ * Request query keys for the hosts we are about to query, so that they can
+ * be directly queried when we pick them.
+ *
+ * At most GUESS_QK_WINDOW requests can be in flight for a query, and we only
+ * look at the first GUESS_PICK_SCAN hosts in the pool.
+ */
+static void
+guess_qk_prefetch(guess_t *gq)
+{
+	hash_list_iter_t *iter;
+	unsigned scanned = 0;
+	bool intro = settings_is_ultra();
+
+	guess_check(gq);
+
+	if (gq->flags & GQ_F_END_STARVING)
+		return;
+
+	iter = hash_list_iterator(gq->pool);
+
+	while (hash_list_iter_has_next(iter) && scanned++ < GUESS_PICK_SCAN) {
+		const gnet_host_t *host = hash_list_iter_next(iter);
+		const struct qkdata *qk;
+		struct guess_prefetch *ctx;
+		bool g2;
+
+		if (gq->qk_prefetch >= GUESS_QK_WINDOW)
+			break;
+
+		if (guess_out_bw >= guess_target_bw)
+			break;
+
+		if (
+			aging_lookup(guess_qk_reqs, host) ||
+			aging_lookup(guess_alien, host) ||
+			guess_should_skip(host) ||
+			!guess_can_recontact(host)
+		)
+			continue;
+
+		qk = get_qkdata(host);
+
+		if (
+			qk != NULL && qk->length != 0 &&
+			guess_key_still_valid(qk->last_update)
+		)
+			continue;
+
+		g2 = qk != NULL && (qk->flags & GUESS_F_G2);
+
+		if (!guess_enabled(g2))
+			continue;
+
+		WALLOC0(ctx);
+		ctx->magic = GUESS_PREFETCH_MAGIC;
+		ctx->gid = gq->gid;
+		ctx->host = atom_host_get(host);
+		ctx->g2 = g2;
+		tm_now_exact(&ctx->start);
+
+		if (
+			!guess_request_qk_full(gq, host, intro, g2,
+				guess_qk_prefetched, ctx)
+		) {
+			atom_host_free_null(&ctx->host);
+			ctx->magic = 0;
+			WFREE(ctx);
+			continue;
+		}
+
+		gq->qk_prefetch++;
+		gnet_stats_inc_general(GNR_GUESS_QUERY_KEYS_PREFETCHED);
+
+		if (GNET_PROPERTY(guess_client_debug) > 2) {
+			g_debug("GUESS QUERY[%s] prefetching query key from %s%s "
+				"(%d pending)",
+				nid_to_string(&gq->gid), g2 ? "G2 " : "",
+				gnet_host_to_string(host), gq->qk_prefetch);
+		}
+	}
+
+	hash_list_iter_release(&iter);
+}
+
 /**
  * Process acknowledgement pong or /QA received from host.
  *
@@ -4562,6 +5464,17 @@ guess_handle_ack(guess_t *gq,
 
 	gq->query_reached++;
 
+	/*
+	 * Hits are not tagged with the GUESS host that relayed our query, so
+	 * we credit the hits we get to the last acknowledging host.  This is
+	 * only an approximation, but it lets productive hosts stand out over
+	 * time.
+	 */
+
+	guess_score_ack(host);
+	atom_host_free_null(&gq->last_acked);
+	gq->last_acked = atom_host_get(host);
+
 	if (GUESS_WARMING_COUNT == gq->query_acks++) {
 		if (GNET_PROPERTY(guess_client_debug) > 1) {
 			g_debug("GUESS QUERY[%s] switching to loose parallelism",
@@ -4696,6 +5609,7 @@ guess_rpc_callback(struct guess_rpc *grp, const gnutella_node_t *n, guess_t *gq)
 	} else {
 		g_assert(NULL == grp->pmi);		/* Message sent if we get a reply */
 
+		guess_score_rtt(grp->host, &grp->start);
 		iterate = guess_handle_ack(gq, n, grp->host, grp->hops, grp->t);
 	}
 
@@ -4795,6 +5709,7 @@ guess_send(guess_t *gq, const gnet_host_t *host)
 		ctx->magic = GUESS_QK_MAGIC;
 		ctx->gid = gq->gid;
 		ctx->host = atom_host_get(host);
+		tm_now_exact(&ctx->start);
 
 		/*
 		 * Contacting the host to request a query key is also an opportunity
@@ -5219,6 +6134,15 @@ guess_iterate(guess_t *gq)
 	}
 
 	gq->flags &= ~GQ_F_SENDING;
+
+	/*
+	 * Keep query keys flowing in for the hosts we will query next, so that
+	 * we do not have to wait for the key before querying them.
+	 */
+
+	if (!(gq->flags & GQ_F_UDP_DROP))
+		guess_qk_prefetch(gq);
+
 	poolsize = hash_list_length(gq->pool);
 
 	if (unsent > UNSIGNED(alpha) || (unsent >= poolsize && 0 != poolsize)) {
@@ -5486,6 +6410,7 @@ guess_free(guess_t *gq)
 	hash_list_free(&gq->pool);
 	atom_str_free_null(&gq->query);
 	atom_guid_free_null(&gq->muid);
+	atom_host_free_null(&gq->last_acked);
 	wq_cancel(&gq->hostwait);
 	wq_cancel(&gq->bwait);
 	cq_cancel(&gq->delay_ev);
@@ -5871,11 +6796,13 @@ guess_init(void)
 
 	dbmw_set_map_cache(db_qkdata, GUESS_QK_MAP_CACHE_SIZE);
 
+	guess_qkc = vmm_alloc0(GUESS_QKC_SLOTS * sizeof guess_qkc[0]);
+
 	guess_cache_init(&guess_02_cache);
 	guess_cache_init(&guess_g2_cache);
 
 	if (!crash_was_restarted())
-		guess_qk_prune_old();
+		guess_qk_prune_old(TRUE);
 
 	guess_qk_prune_ev = cq_periodic_main_add(
 		GUESS_QK_PRUNE_PERIOD, guess_qk_periodic_prune, NULL);
@@ -5893,6 +6820,7 @@ guess_init(void)
 		offsetof(guess_t, muid), HASH_KEY_FIXED, GUID_RAW_SIZE);
 	link_cache = hash_list_new(gnet_host_hash, gnet_host_equal);
 	alive_cache = hash_list_new(gnet_host_hash, gnet_host_equal);
+	guess_scores = hash_list_new(guess_score_hash, guess_score_eq);
 	load_pending = hash_list_new(pointer_hash, NULL);
 	pending = htable_create_any(guess_rpc_key_hash, NULL, guess_rpc_key_eq);
 	guess_qk_reqs = aging_make(GUESS_QK_FREQ,
@@ -5945,6 +6873,11 @@ guess_close(void)
 	if (NULL == db_qkdata)
 		return;		/* GUESS layer never initialized */
 
+	cq_periodic_remove(&guess_qk_sweep_ev);
+	dbmw_free_all_keys(db_qkdata, guess_qk_sweep.keys);
+	guess_qk_sweep.keys = NULL;
+
+	guess_qkc_close();
 	dbstore_close(db_qkdata, settings_gnet_db_dir(), db_qkdata_base);
 	db_qkdata = NULL;
 	cq_periodic_remove(&guess_qk_prune_ev);
@@ -5967,6 +6900,7 @@ guess_close(void)
 	ripening_destroy(&guess_deferred);
 	hash_list_free_all(&link_cache, gnet_host_free_atom);
 	hash_list_free_all(&alive_cache, gnet_host_free_atom);
+	hash_list_free_all(&guess_scores, guess_score_free);
 	hash_list_free(&load_pending);
 }
 
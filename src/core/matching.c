@@ -38,10 +38,13 @@
 #include "lib/atoms.h"
 #include "lib/halloc.h"
 #include "lib/hset.h"
+#include "lib/htable.h"
 #include "lib/pattern.h"
+#include "lib/pow2.h"
 #include "lib/pslist.h"
 #include "lib/stringify.h"	/* For hex_escape() */
 #include "lib/utf8.h"
+#include "lib/vmm.h"
 #include "lib/walloc.h"
 #include "lib/wordvec.h"
 
@@ -105,6 +108,8 @@ struct st_set {
 	struct st_bin all_entries;
 	uchar index_map[MAX_INT_VAL(uchar)];
 	uchar fold_map[MAX_INT_VAL(uchar)];
+	uint64 *bloom;				/* Prefilter of word prefixes, NULL if none */
+	size_t bloom_blocks;		/* Amount of blocks in filter (power of 2) */
 };
 
 enum search_table_magic { SEARCH_TABLE_MAGIC = 0x0cf66242 };
@@ -231,6 +236,211 @@ st_setup_map(void)
 	done = TRUE;
 }
 
+/*
+ * Blocked Bloom filter of the word prefixes in a set.
+ *
+ * Each key is hashed to a single 64-byte block (one cache line) in which
+ * ST_BLOOM_K bits are set, so that a lookup touches only one cache line.
+ *
+ * The keys are the prefixes, from ST_BLOOM_MINLEN to ST_BLOOM_MAXLEN bytes,
+ * of the text starting at each word boundary and running up to the next
+ * space.  Since entry_match() only matches query words at the beginning of
+ * words in the text, and since query words cannot contain spaces, the
+ * leading bytes of any matching query word are necessarily one of the keys.
+ * A query with a word absent from the filter therefore cannot match.
+ */
+
+#define ST_BLOOM_MINLEN		2		/* Shortest prefix recorded */
+#define ST_BLOOM_MAXLEN		12		/* Longest prefix recorded */
+#define ST_BLOOM_K			5		/* Bits set per key */
+#define ST_BLOOM_KEY_BITS	8		/* Filter bits per key */
+#define ST_BLOOM_BLOCK		8		/* Block size, in 64-bit words */
+#define ST_BLOOM_MAX_BLOCKS	(1U << 18)	/* 16 MiB */
+
+#define ST_FNV_OFFSET		UINT64_CONST(0xcbf29ce484222325)
+#define ST_FNV_PRIME		UINT64_CONST(0x100000001b3)
+
+/**
+ * Free Bloom filter of the set.
+ */
+static void
+st_bloom_free(struct st_set *set)
+{
+	if (set->bloom != NULL) {
+		vmm_free(set->bloom,
+			set->bloom_blocks * ST_BLOOM_BLOCK * sizeof set->bloom[0]);
+		set->bloom = NULL;
+		set->bloom_blocks = 0;
+	}
+}
+
+/**
+ * Finalize the (FNV-1a) hash of a key.
+ */
+static inline uint64
+st_bloom_mix(uint64 h)
+{
+	h ^= h >> 33;
+	h *= UINT64_CONST(0xff51afd7ed558ccd);
+	h ^= h >> 33;
+	h *= UINT64_CONST(0xc4ceb9fe1a85ec53);
+	h ^= h >> 33;
+
+	return h;
+}
+
+/**
+ * Record key whose hash is given in the Bloom filter.
+ */
+static inline void
+st_bloom_set(struct st_set *set, uint64 h)
+{
+	uint64 *block;
+	uint i;
+
+	h = st_bloom_mix(h);
+	block = &set->bloom[(h & (set->bloom_blocks - 1)) * ST_BLOOM_BLOCK];
+	h >>= 18;		/* Skip bits used to select the block */
+
+	for (i = 0; i < ST_BLOOM_K; i++, h >>= 9) {
+		uint bit = h & 0x1ff;
+		block[bit >> 6] |= (uint64) 1 << (bit & 0x3f);
+	}
+}
+
+/**
+ * @return whether key whose hash is given may be present in the filter.
+ */
+static inline bool
+st_bloom_test(const struct st_set *set, uint64 h)
+{
+	const uint64 *block;
+	uint i;
+
+	h = st_bloom_mix(h);
+	block = &set->bloom[(h & (set->bloom_blocks - 1)) * ST_BLOOM_BLOCK];
+	h >>= 18;
+
+	for (i = 0; i < ST_BLOOM_K; i++, h >>= 9) {
+		uint bit = h & 0x1ff;
+		if (0 == (block[bit >> 6] & ((uint64) 1 << (bit & 0x3f))))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Record the word prefixes of string in the Bloom filter of the set.
+ *
+ * @param set		the set, NULL to only count the keys
+ * @param s			the string
+ *
+ * @return the amount of keys.
+ */
+static size_t
+st_bloom_add(struct st_set *set, const char *s)
+{
+	const char *p;
+	size_t n = 0;
+
+	for (p = s; *p != '\0'; p++) {
+		const char *q;
+		uint64 h = ST_FNV_OFFSET;
+		size_t len;
+
+		if (p != s && !is_ascii_space(p[-1]))
+			continue;		/* Not at the beginning of a word */
+
+		for (
+			q = p, len = 1;
+			*q != '\0' && *q != ' ' && len <= ST_BLOOM_MAXLEN;
+			q++, len++
+		) {
+			h = (h ^ (uchar) *q) * ST_FNV_PRIME;
+
+			if (len >= ST_BLOOM_MINLEN) {
+				if (set != NULL)
+					st_bloom_set(set, h);
+				n++;
+			}
+		}
+	}
+
+	return n;
+}
+
+/**
+ * Build the Bloom filter of the set, from all its entries.
+ */
+static void
+st_bloom_build(struct st_set *set)
+{
+	size_t i, keys = 0, blocks;
+
+	st_bloom_free(set);
+
+	for (i = 0; i < set->all_entries.nvals; i++)
+		keys += st_bloom_add(NULL, set->all_entries.vals[i]->string);
+
+	if (0 == keys)
+		return;
+
+	blocks = keys * ST_BLOOM_KEY_BITS / (ST_BLOOM_BLOCK * 64) + 1;
+	blocks = MIN(blocks, ST_BLOOM_MAX_BLOCKS);
+	blocks = next_pow2(blocks);
+
+	set->bloom_blocks = blocks;
+	set->bloom = vmm_alloc0(blocks * ST_BLOOM_BLOCK * sizeof set->bloom[0]);
+
+	for (i = 0; i < set->all_entries.nvals; i++)
+		st_bloom_add(set, set->all_entries.vals[i]->string);
+
+	if (GNET_PROPERTY(matching_debug)) {
+		g_debug("MATCH %s(): %zu key%s for %u entr%s in %zu block%s",
+			G_STRFUNC, keys, plural(keys),
+			set->all_entries.nvals, plural_y(set->all_entries.nvals),
+			blocks, plural(blocks));
+	}
+}
+
+/**
+ * Check the words of the query against the Bloom filter of the set.
+ *
+ * @param set		the set we are about to search
+ * @param search	the query string, in the form used by the set
+ *
+ * @return FALSE if the query cannot match anything in the set.
+ */
+static bool
+st_bloom_may_match(const struct st_set *set, const char *search)
+{
+	const char *p = search;
+
+	if (NULL == set->bloom)
+		return TRUE;
+
+	while (*p != '\0') {
+		uint64 h = ST_FNV_OFFSET;
+		size_t len = 0;
+
+		if (' ' == *p) {
+			p++;
+			continue;
+		}
+
+		for (/* empty */; *p != '\0' && *p != ' '; p++) {
+			if (len++ < ST_BLOOM_MAXLEN)
+				h = (h ^ (uchar) *p) * ST_FNV_PRIME;
+		}
+
+		if (len >= ST_BLOOM_MINLEN && !st_bloom_test(set, h))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
 /**
  * Initialize permanent entries in a table set.
  */
@@ -344,6 +554,8 @@ st_set_destroy(struct st_set *set)
 		}
 		bin_destroy(&set->all_entries);
 	}
+
+	st_bloom_free(set);
 }
 
 /**
@@ -505,6 +717,8 @@ st_insert_item(search_table_t *table,
 
 	g_assert(set != NULL);
 
+	st_bloom_free(set);		/* No longer accurate, rebuilt by st_compact() */
+
 	seen_keys = hset_create(HASH_KEY_SELF, 0);
 
 	WALLOC(entry);
@@ -552,6 +766,8 @@ st_set_compact(struct st_set *set)
 		if (set->bins[i])
 			bin_compact(set->bins[i]);
 	}
+
+	st_bloom_build(set);
 }
 
 /**
@@ -566,6 +782,209 @@ st_compact(search_table_t *table)
 	st_set_compact(&table->alias);
 }
 
+/**
+ * @return the table set.
+ */
+static struct st_set *
+st_get_set(const search_table_t *table, enum match_set which)
+{
+	const struct st_set *set = NULL;
+
+	search_table_check(table);
+
+	switch (which) {
+	case ST_SET_PLAIN: set = &table->plain; break;
+	case ST_SET_ALIAS: set = &table->alias; break;
+	}
+
+	g_assert(set != NULL);
+
+	return deconstify_pointer(set);
+}
+
+/**
+ * Compute a pointer-free image of a table set, suitable for persisting.
+ *
+ * The image is made of 32-bit words:
+ *
+ *     nentries
+ *     nbins
+ *     identifier of the file for each entry  (nentries words)
+ *     amount of entries in each bin          (nbins words)
+ *     index of the entries in each bin, bin after bin
+ *
+ * @param table		the search table
+ * @param which		the table set
+ * @param cb		computes the identifier of each shared file
+ * @param udata		additional callback argument
+ * @param count		where the amount of words in the image is written
+ *
+ * @return halloc()'ed image, NULL if a file cannot be identified.
+ */
+uint32 *
+st_image(const search_table_t *table, enum match_set which,
+	st_image_id_cb cb, void *udata, size_t *count)
+{
+	const struct st_set *set = st_get_set(table, which);
+	htable_t *index;
+	uint32 *image, *p;
+	size_t i, n;
+
+	g_assert(cb != NULL);
+	g_assert(count != NULL);
+
+	n = 2 + set->all_entries.nvals + set->nbins;
+
+	for (i = 0; i < set->nbins; i++) {
+		if (set->bins[i] != NULL)
+			n += set->bins[i]->nvals;
+	}
+
+	HALLOC_ARRAY(image, n);
+	index = htable_create(HASH_KEY_SELF, 0);
+	p = image;
+
+	*p++ = set->all_entries.nvals;
+	*p++ = set->nbins;
+
+	for (i = 0; i < set->all_entries.nvals; i++) {
+		const struct st_entry *e = set->all_entries.vals[i];
+		uint32 id = (*cb)(e->sf, udata);
+
+		if ((uint32) -1 == id) {
+			HFREE_NULL(image);
+			goto done;
+		}
+
+		*p++ = id;
+		htable_insert(index, e, uint_to_pointer(i));
+	}
+
+	for (i = 0; i < set->nbins; i++) {
+		const struct st_bin *bin = set->bins[i];
+		*p++ = NULL == bin ? 0 : bin->nvals;
+	}
+
+	for (i = 0; i < set->nbins; i++) {
+		const struct st_bin *bin = set->bins[i];
+		uint j;
+
+		if (NULL == bin)
+			continue;
+
+		for (j = 0; j < bin->nvals; j++) {
+			*p++ = pointer_to_uint(htable_lookup(index, bin->vals[j]));
+		}
+	}
+
+	g_assert(ptr_diff(p, image) == n * sizeof image[0]);
+	*count = n;
+
+done:
+	htable_free_null(&index);
+	return image;
+}
+
+/**
+ * Load table set from image computed by st_image().
+ *
+ * The table set must be empty, i.e. the table must have been freshly
+ * created.  The bins are allocated at their final size, so there is no
+ * need to compact the table afterwards.
+ *
+ * Upon failure, the table is left partially filled and must be freed.
+ *
+ * @param table		the search table
+ * @param which		the table set
+ * @param image		the image
+ * @param count		amount of words in the image
+ * @param cb		maps identifiers back to shared files
+ * @param udata		additional callback argument
+ *
+ * @return TRUE if OK, FALSE if the image is inconsistent.
+ */
+bool
+st_image_load(search_table_t *table, enum match_set which,
+	const uint32 *image, size_t count, st_image_file_cb cb, void *udata)
+{
+	struct st_set *set = st_get_set(table, which);
+	const uint32 *sizes, *vals, *end;
+	uint32 nentries;
+	size_t i;
+
+	g_assert(image != NULL);
+	g_assert(cb != NULL);
+	g_assert(0 == set->all_entries.nvals);
+
+	if (count < 2)
+		return FALSE;
+
+	nentries = image[0];
+
+	if (image[1] != set->nbins || count - 2 < (size_t) nentries + set->nbins)
+		return FALSE;
+
+	sizes = &image[2 + nentries];
+	vals = &sizes[set->nbins];
+	end = &image[count];
+
+	if (nentries > set->all_entries.nslots) {
+		set->all_entries.nslots = nentries;
+		HREALLOC_ARRAY(set->all_entries.vals, nentries);
+	}
+
+	for (i = 0; i < nentries; i++) {
+		const shared_file_t *sf;
+		const char *key = NULL;
+		struct st_entry *entry;
+
+		sf = (*cb)(image[2 + i], which, &key, udata);
+		if (NULL == sf || NULL == key)
+			return FALSE;
+
+		WALLOC(entry);
+		entry->string = atom_str_get(key);
+		entry->sf = shared_file_ref(sf);
+		entry->mask = mask_hash(entry->string);
+
+		set->all_entries.vals[set->all_entries.nvals++] = entry;
+	}
+
+	set->nentries = nentries;
+
+	for (i = 0; i < set->nbins; i++) {
+		struct st_bin *bin;
+		uint j, n = sizes[i];
+
+		if (0 == n)
+			continue;
+
+		if (UNSIGNED(end - vals) < n)
+			return FALSE;
+
+		WALLOC(bin);
+		bin->nslots = n;
+		bin->nvals = 0;
+		HALLOC_ARRAY(bin->vals, n);
+		set->bins[i] = bin;
+
+		for (j = 0; j < n; j++) {
+			uint32 v = *vals++;
+
+			if (v >= nentries)
+				return FALSE;
+
+			bin->vals[bin->nvals++] = set->all_entries.vals[v];
+		}
+	}
+
+	if (vals != end)
+		return FALSE;
+
+	st_bloom_build(set);
+	return TRUE;
+}
+
 /**
  * Apply pattern matching on text, matching at the *beginning* of words.
  * Patterns are lazily compiled as needed, using pattern_compile_fast().
@@ -598,6 +1017,27 @@ entry_match(const char *text, size_t tlen,
 	return TRUE;
 }
 
+/**
+ * Fill query hash vector for query routing, from canonized search string.
+ */
+void
+st_fill_qhv_canonic(const char *search, query_hashvec_t *qhv)
+{
+	word_vec_t *wovec;
+	uint wocnt;
+	uint i;
+
+	wocnt = word_vec_make(search, &wovec);
+
+	for (i = 0; i < wocnt; i++) {
+		if (wovec[i].len >= QRP_MIN_WORD_LENGTH)
+			qhvec_add(qhv, wovec[i].word, QUERY_H_WORD);
+	}
+
+	if (wocnt > 0)
+		word_vec_free(wovec, wocnt);
+}
+
 /**
  * Fill non-NULL query hash vector for query routing.
  *
@@ -610,26 +1050,15 @@ void
 st_fill_qhv(const char *search_term, query_hashvec_t *qhv)
 {
 	char *search;
-	word_vec_t *wovec;
-	uint wocnt;
-	uint i;
 
 	if (NULL == qhv)
 		return;
 
 	search = UNICODE_CANONIZE(search_term);
-	wocnt = word_vec_make(search, &wovec);
-
-	for (i = 0; i < wocnt; i++) {
-		if (wovec[i].len >= QRP_MIN_WORD_LENGTH)
-			qhvec_add(qhv, wovec[i].word, QUERY_H_WORD);
-	}
+	st_fill_qhv_canonic(search, qhv);
 
 	if (search != search_term)
 		HFREE_NULL(search);
-
-	if (wocnt > 0)
-		word_vec_free(wovec, wocnt);
 }
 
 /**
@@ -936,32 +1365,98 @@ finish:
 }
 
 /**
- * Do an actual search.
+ * Collect all the entries matching an already canonized query.
+ *
+ * @param table			table containing organized entries to search from
+ * @param search		the canonized query string
+ * @param sri			search meta-information, for applying query limits
+ * @param result		where the list of matching shared files is returned
+ * @param qhv			query hash vector built from query string, for routing
+ *
+ * @return number of hits we produced, the length of the returned list.
+ */
+uint G_HOT
+st_search_collect_canonic(
+	search_table_t *table,
+	const char *search,
+	const search_request_info_t *sri,
+	pslist_t **result,
+	query_hashvec_t *qhv)
+{
+	uint nres = 0;
+	char *alias;
+
+	g_assert(result != NULL);
+
+	*result = NULL;
+
+	/*
+	 * Run the original query, unmangled, unless the prefilter tells us
+	 * it cannot match anything.  We still need to compute the query hash
+	 * vector for routing.
+	 */
+
+	if (st_bloom_may_match(&table->plain, search)) {
+		nres = st_run_search(
+					SEARCH_NORMAL, &table->plain, search, sri, result, qhv);
+	} else {
+		gnet_stats_inc_general(GNR_LOCAL_QUERY_PREFILTERED);
+		if (qhv != NULL)
+			st_fill_qhv_canonic(search, qhv);
+	}
+
+	/*
+	 * Handle aliases if needed.
+	 *
+	 * If the alias set is empty, there is no need to attempt a search through
+	 * an aliased query.
+	 */
+
+	alias = 0 == table->alias.nentries ? NULL : alias_normalize(search, " ");
+
+	if (alias != NULL) {
+		uint ares = 0;
+
+		gnet_stats_inc_general(GNR_QUERY_ALIASED_WORDS);
+
+		if (st_bloom_may_match(&table->alias, alias)) {
+			ares = st_run_search(
+						SEARCH_ALIAS, &table->alias, alias, sri, result, NULL);
+		} else {
+			gnet_stats_inc_general(GNR_LOCAL_QUERY_PREFILTERED);
+		}
+
+		nres += ares;
+		HFREE_NULL(alias);
+
+		if (ares != 0)
+			gnet_stats_count_general(GNR_LOCAL_ALIASED_HITS, ares);
+	}
+
+	return nres;
+}
+
+/**
+ * Collect all the entries matching a query.
  *
  * @param table			table containing organized entries to search from
  * @param search_term	the query string
  * @param sri			search meta-information, for applying query limits
- * @param callback		routine to invoke for each match
- * @param ctx			user-supplied data to pass on to callback
- * @param max_res		maximum amount of results to return
+ * @param result		where the list of matching shared files is returned
  * @param qhv			query hash vector built from query string, for routing
  *
- * @return number of hits we produced
+ * @return number of hits we produced, the length of the returned list.
  */
-int G_HOT
-st_search(
+uint
+st_search_collect(
 	search_table_t *table,
 	const char *search_term,
 	const search_request_info_t *sri,
-	st_search_callback callback,
-	void *ctx,
-	uint max_res,
+	pslist_t **result,
 	query_hashvec_t *qhv)
 {
-	uint nres = 0;
-	uint i;
-	pslist_t *result = NULL;
-	char *search, *alias;
+	uint nres;
+	char *search;
 
 	/*
 	 * We use a canonic search string, which simplifies matching.
@@ -984,67 +1479,92 @@ st_search(
 			HFREE_NULL(safe_search_term);
 	}
 
+	nres = st_search_collect_canonic(table, search, sri, result, qhv);
 
-	/*
-	 * Run the original query, unmangled.
-	 */
-
-	nres = st_run_search(
-				SEARCH_NORMAL, &table->plain, search, sri, &result, qhv);
-
-	/*
-	 * Handle aliases if needed.
-	 *
-	 * If the alias set is empty, there is no need to attempt a search through
-	 * an aliased query.
-	 */
-
-	alias = 0 == table->alias.nentries ? NULL : alias_normalize(search, " ");
-
-	if (alias != NULL) {
-		uint ares;
+	if (search != search_term)
+		HFREE_NULL(search);
 
-		gnet_stats_inc_general(GNR_QUERY_ALIASED_WORDS);
+	return nres;
+}
 
-		ares = st_run_search(
-					SEARCH_ALIAS, &table->alias, alias, sri, &result, NULL);
-		nres += ares;
-		HFREE_NULL(alias);
+/**
+ * Deliver matches collected by st_search_collect().
+ *
+ * The results are randomly shuffled when there are more than we can
+ * deliver, and the first max_res items retained by the callback are kept.
+ *
+ * @param result		the list of matches, freed on return
+ * @param nres			the length of the list
+ * @param callback		routine to invoke for each match
+ * @param ctx			user-supplied data to pass on to callback
+ * @param max_res		maximum amount of results to return
+ */
+void
+st_search_deliver(pslist_t **result, uint nres,
+	st_search_callback callback, void *ctx, uint max_res)
+{
+	pslist_t *sl = *result;
+	uint i;
 
-		if (ares != 0)
-			gnet_stats_count_general(GNR_LOCAL_ALIASED_HITS, ares);
-	}
+	if (NULL == sl)
+		return;
 
 	/*
 	 * Randomly shuffle the results and pick the first max_res items.
 	 */
 
-	if (result != NULL) {
-		if (nres > max_res)
-			result = pslist_shuffle(result);
+	if (nres > max_res)
+		sl = pslist_shuffle(sl);
 
-		for (i = 0; i < max_res; /* empty */) {
-			const shared_file_t *sf = pslist_shift(&result);
-
-			if (NULL == sf)
-				break;
+	for (i = 0; i < max_res; /* empty */) {
+		const shared_file_t *sf = pslist_shift(&sl);
 
-			/*
-			 * Because search_apply_limits() was already ran by st_run_search(),
-			 * we are certain that the entries in the list pass the limits.
-			 * Therefore, there is no need to check them again, hence the
-			 * trailing "FALSE" in the call here.
-			 */
+		if (NULL == sf)
+			break;
 
-			if ((*callback)(ctx, sf, FALSE))
-				i++;						/* Entry retained */
-		}
+		/*
+		 * Because search_apply_limits() was already ran by st_run_search(),
+		 * we are certain that the entries in the list pass the limits.
+		 * Therefore, there is no need to check them again, hence the
+		 * trailing "FALSE" in the call here.
+		 */
 
-		pslist_free_null(&result);
+		if ((*callback)(ctx, sf, FALSE))
+			i++;						/* Entry retained */
 	}
 
-	if (search != search_term)
-		HFREE_NULL(search);
+	pslist_free(sl);
+	*result = NULL;
+}
+
+/**
+ * Do an actual search.
+ *
+ * @param table			table containing organized entries to search from
+ * @param search_term	the query string
+ * @param sri			search meta-information, for applying query limits
+ * @param callback		routine to invoke for each match
+ * @param ctx			user-supplied data to pass on to callback
+ * @param max_res		maximum amount of results to return
+ * @param qhv			query hash vector built from query string, for routing
+ *
+ * @return number of hits we produced
+ */
+int
+st_search(
+	search_table_t *table,
+	const char *search_term,
+	const search_request_info_t *sri,
+	st_search_callback callback,
+	void *ctx,
+	uint max_res,
+	query_hashvec_t *qhv)
+{
+	pslist_t *result;
+	uint nres;
+
+	nres = st_search_collect(table, search_term, sri, &result, qhv);
+	st_search_deliver(&result, nres, callback, ctx, max_res);
 
 	return nres;
 }
@@ -83,6 +83,31 @@ int st_count(const search_table_t *st, enum match_set which);
 bool st_insert_item(search_table_t *, enum match_set which, const char *key,
 	const struct shared_file *sf);
 
+/**
+ * Callback for st_image(): compute identifier of shared file.
+ *
+ * @return the identifier, (uint32) -1 if the file cannot be identified.
+ */
+typedef uint32 (*st_image_id_cb)(const struct shared_file *sf, void *udata);
+
+/**
+ * Callback for st_image_load(): map identifier back to the shared file.
+ *
+ * @param id		the identifier given by the st_image_id_cb callback
+ * @param which		the table set being loaded
+ * @param key		where the key under which file is inserted must be written
+ * @param udata		user-supplied argument
+ *
+ * @return the shared file, NULL if the identifier is invalid.
+ */
+typedef const struct shared_file *(*st_image_file_cb)(uint32 id,
+	enum match_set which, const char **key, void *udata);
+
+uint32 *st_image(const search_table_t *st, enum match_set which,
+	st_image_id_cb cb, void *udata, size_t *count);
+bool st_image_load(search_table_t *st, enum match_set which,
+	const uint32 *image, size_t count, st_image_file_cb cb, void *udata);
+
 /**
  * Callback for st_search().
  *
@@ -105,7 +130,27 @@ int st_search(
 	uint max_res,
 	struct query_hashvec *qhv);
 
+struct pslist;
+
+uint st_search_collect(
+	search_table_t *table,
+	const char *search,
+	const struct search_request_info *sri,
+	struct pslist **result,
+	struct query_hashvec *qhv);
+
+uint st_search_collect_canonic(
+	search_table_t *table,
+	const char *search,
+	const struct search_request_info *sri,
+	struct pslist **result,
+	struct query_hashvec *qhv);
+
+void st_search_deliver(struct pslist **result, uint nres,
+	st_search_callback callback, void *ctx, uint max_res);
+
 void st_fill_qhv(const char *search_term, struct query_hashvec *qhv);
+void st_fill_qhv_canonic(const char *search, struct query_hashvec *qhv);
 
 #endif	/* _core_matching_h_ */
 
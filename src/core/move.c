@@ -71,6 +71,15 @@ static bool move_work_available;
 
 enum moved_magic_t { MOVED_MAGIC = 0x0ac0b103 };
 
+/**
+ * How data are copied, from the most efficient to the least efficient way.
+ */
+enum move_method {
+	MOVE_CLONE = 0,			/**< Data blocks shared with source (reflink) */
+	MOVE_COPY_RANGE,		/**< Copy performed by the filesystem */
+	MOVE_PLAIN				/**< Copy via sendfile() or our buffer */
+};
+
 /**
  * Moving daemon context.
  */
@@ -87,8 +96,29 @@ struct moved {
 	time_delta_t elapsed;	/**< Elapsed time, set when move is completed */
 	int wd;					/**< File descriptor for write, -1 if none */
 	int error;				/**< Error code */
+	enum move_method method;	/**< How data are copied */
 };
 
+/**
+ * @return English description of the copying method.
+ */
+static const char *
+move_method_to_string(enum move_method m)
+{
+	switch (m) {
+	case MOVE_CLONE:		return "clone";
+	case MOVE_COPY_RANGE:	return "copy_file_range";
+	case MOVE_PLAIN:
+#ifdef HAS_SENDFILE
+		return "sendfile";
+#else
+		return "copy";
+#endif
+	}
+
+	return "unknown";
+}
+
 /**
  * Work queue entry.
  */
@@ -280,6 +310,28 @@ move_d_start(struct bgtask *h, void *ctx, void *item)
 	md->copied = 0;
 	md->last_notify = md->start;
 	md->error = 0;
+	md->method = MOVE_COPY_RANGE;
+
+	/*
+	 * Try to share the data blocks with the source first.  This is only
+	 * possible when both files lie on the same filesystem, which can still
+	 * be the case when rename() failed, for instance across bind mounts
+	 * or btrfs sub-volumes.
+	 *
+	 * The clone includes the fileinfo trailer, which we need to strip.
+	 */
+
+	if (
+		md->size != 0 &&
+		0 == compat_clone_file(md->wd, file_object_fd(md->rd))
+	) {
+		if (-1 == ftruncate(md->wd, md->size)) {
+			md->error = errno;
+			g_warning("can't truncate cloned \"%s\": %m", md->target);
+		}
+		md->copied = md->size;
+		md->method = MOVE_CLONE;
+	}
 
 	file_object_fadvise_sequential(md->rd);
 
@@ -399,9 +451,10 @@ error:
 	md->elapsed = MAX(1, md->elapsed);	/* time warp? clock not monotonic? */
 
 	if (GNET_PROPERTY(move_debug) > 0) {
-		g_debug("MOVE moved file \"%s\" at %s bytes/sec [error=%d]",
+		g_debug("MOVE moved file \"%s\" at %s bytes/sec via %s [error=%d]",
 			download_basename(md->d),
-			filesize_to_gstring(md->size / md->elapsed), md->error);
+			filesize_to_gstring(md->size / md->elapsed),
+			move_method_to_string(md->method), md->error);
 	}
 
 	/* FALL THROUGH */
@@ -427,7 +480,8 @@ move_progress(void *ctx)
 	g_assert(md->magic == MOVED_MAGIC);
 	g_assert(thread_is_main());
 
-	download_move_progress(md->d, md->copied);
+	download_move_progress(md->d, md->copied,
+		delta_time(tm_time(), md->start));
 
 	return NULL;
 }
@@ -453,18 +507,28 @@ move_d_step_copy(struct bgtask *h, void *u, int ticks)
 	if (md->size == 0)			/* Empty file */
 		return BGR_DONE;
 
+	if (md->error != 0)			/* Cloning failed */
+		return BGR_DONE;
+
+	if (MOVE_CLONE == md->method) {
+		teq_safe_rpc(THREAD_MAIN_ID, move_progress, md);
+		return BGR_DONE;
+	}
+
 again:		/* Avoids indenting all this code */
 
 	g_assert(md->size > md->copied);
 	remain = md->size - md->copied;
 
 	/*
-	 * When we use sendfile(), we have no use for the internal buffer,
-	 * hence there is no need to limit the amount of data to transfer.
+	 * When we use copy_file_range() or sendfile(), we have no use for the
+	 * internal buffer, hence there is no need to limit the amount of data
+	 * to transfer.
 	 */
 
 #ifndef HAS_SENDFILE
-	remain = MIN(remain, COPY_BUF_SIZE);
+	if (MOVE_PLAIN == md->method)
+		remain = MIN(remain, COPY_BUF_SIZE);
 #endif
 
 	/*
@@ -480,6 +544,50 @@ again:		/* Avoids indenting all this code */
 
 	g_assert(amount > 0);
 
+	/*
+	 * Calling file_object_fd() is safe here, see the comment below.
+	 */
+
+	if (MOVE_COPY_RANGE == md->method) {
+		off_t in_off = md->copied, out_off = md->copied;
+
+		r = compat_copy_file_range(file_object_fd(md->rd), &in_off,
+				md->wd, &out_off, amount);
+
+		/*
+		 * When the filesystems involved cannot perform the copy, fallback
+		 * to plain copying.  We can only do so before anything is written
+		 * since the other methods write at the current file position.
+		 */
+
+		if ((ssize_t) -1 == r && 0 == md->copied) {
+			switch (errno) {
+			case ENOSYS:
+			case EXDEV:
+			case EINVAL:
+			case EOPNOTSUPP:
+			case EBADF:
+				if (GNET_PROPERTY(move_debug)) {
+					g_debug("MOVE cannot use copy_file_range() for \"%s\": "
+						"%m", md->target);
+				}
+				md->method = MOVE_PLAIN;
+				goto again;
+			default:
+				break;
+			}
+		}
+
+		if (r <= 0) {
+			md->error = 0 == r ? EPIPE : errno;
+			g_warning("error while copying \"%s\" for moving \"%s\": %m",
+				file_object_pathname(md->rd), download_basename(md->d));
+			return BGR_DONE;
+		}
+
+		goto copied;		/* May have been a partial copy */
+	}
+
 #ifdef HAS_SENDFILE
 	{
 		off_t off = md->copied;
@@ -530,6 +638,7 @@ again:		/* Avoids indenting all this code */
 
 	g_assert((size_t) r == amount);
 
+copied:
 	md->copied += r;
 
 	/*
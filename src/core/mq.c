@@ -64,6 +64,34 @@ static bool make_room_header(
 	mqueue_t *q, const char *header, uint prio, int needed, int *offset);
 static void mq_swift_timer(cqueue_t *cq, void *obj);
 
+static mq_stats_t mq_tcp_stats;		/**< Over all the TCP queues */
+static mq_stats_t mq_udp_stats;		/**< Over all the UDP queues */
+
+/**
+ * @return global statistics for the transport used by the queue.
+ */
+static inline mq_stats_t *
+mq_stats(const mqueue_t *q)
+{
+	return (q->flags & MQ_UDP) ? &mq_udp_stats : &mq_tcp_stats;
+}
+
+/**
+ * Get global statistics over all the message queues.
+ *
+ * @param tcp		where statistics for TCP queues are written
+ * @param udp		where statistics for UDP queues are written
+ */
+void
+mq_stats_get(mq_stats_t *tcp, mq_stats_t *udp)
+{
+	g_assert(tcp != NULL);
+	g_assert(udp != NULL);
+
+	*tcp = mq_tcp_stats;
+	*udp = mq_udp_stats;
+}
+
 /**
  * @return queue's fullness status.
  */
@@ -372,6 +400,24 @@ mq_free(mqueue_t *q)
 
 	g_assert(n == q->count);
 
+	/*
+	 * Retire the queue from the global statistics.
+	 */
+
+	{
+		mq_stats_t *st = mq_stats(q);
+
+		g_assert(st->bytes >= UNSIGNED(q->size));
+		g_assert(st->messages >= UNSIGNED(q->count));
+
+		st->bytes -= q->size;
+		st->messages -= q->count;
+		if (q->flags & MQ_FLOWC)
+			st->flowc--;
+		if (q->flags & MQ_SWIFT)
+			st->swift--;
+	}
+
 	if (q->qlink)
 		qlink_free(q);
 
@@ -404,6 +450,8 @@ mq_rmlink_prev(mqueue_t *q, plist_t *l, int size)
 	q->size -= size;
 	g_assert(q->count > 0);
 	q->count--;
+	mq_stats(q)->bytes -= size;
+	mq_stats(q)->messages--;
 
 	pmsg_free(l->data);
 	l->data = NULL;
@@ -412,6 +460,19 @@ mq_rmlink_prev(mqueue_t *q, plist_t *l, int size)
 	return prev;
 }
 
+/**
+ * Account for bytes written out of the message at the tail of the queue,
+ * which is only partially sent and therefore remains queued.
+ */
+static void
+mq_shrink(mqueue_t *q, int size)
+{
+	g_assert(q->size >= size);
+
+	q->size -= size;
+	mq_stats(q)->bytes -= size;
+}
+
 /**
  * A "swift" checkpoint was reached.
  */
@@ -561,6 +622,7 @@ mq_enter_swift(cqueue_t *cq, void *obj)
 	g_assert((q->flags & (MQ_FLOWC|MQ_SWIFT)) == MQ_FLOWC);
 
 	q->flags |= MQ_SWIFT;
+	mq_stats(q)->swift++;
 
 	cq_zero(cq, &q->swift_ev);
 	node_tx_swift_changed(q->node);
@@ -585,6 +647,7 @@ mq_enter_flowc(mqueue_t *q)
 	g_assert(q->size >= q->hiwat);
 
 	q->flags |= MQ_FLOWC;			/* Above wartermark, raise */
+	mq_stats(q)->flowc++;
 	q->flowc_written = 0;
 	q->last_size = q->size;
 	q->swift_elapsed = node_flowc_swift_grace(q->node) * 1000;
@@ -611,6 +674,10 @@ mq_leave_flowc(mqueue_t *q)
 			(q->flags & MQ_SWIFT) ? "SWIFT" : "FLOWC",
 			node_addr(q->node), q->size);
 
+	mq_stats(q)->flowc--;
+	if (q->flags & MQ_SWIFT)
+		mq_stats(q)->swift--;
+
 	q->flags &= ~(MQ_FLOWC|MQ_SWIFT);	/* Under low watermark, clear */
 	if (q->qlink)
 		qlink_free(q);
@@ -1451,6 +1518,8 @@ mq_puthere(mqueue_t *q, pmsg_t *mb, int msize)
 
 	q->size += msize;
 	q->count++;
+	mq_stats(q)->bytes += msize;
+	mq_stats(q)->messages++;
 
 	/*
 	 * If `qlink' is not NULL, insert `new' within it.
@@ -1498,6 +1567,7 @@ static const struct mq_cops mq_cops = {
 	qlink_remove,			/**< qlink_remove */
 	mq_rmlink_prev,			/**< rmlink_prev */
 	mq_update_flowc,		/**< update_flowc */
+	mq_shrink,				/**< shrink */
 };
 
 /**
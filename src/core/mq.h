@@ -48,6 +48,19 @@
 
 typedef struct mqueue mqueue_t;
 
+/**
+ * Global message queue statistics, for a given transport.
+ *
+ * These are maintained as the queues change, so that they can be obtained
+ * without having to iterate over all the queues.
+ */
+typedef struct mq_stats {
+	size_t bytes;			/**< Bytes queued */
+	size_t messages;		/**< Messages queued */
+	size_t flowc;			/**< Queues in flow-control */
+	size_t swift;			/**< Queues in "swift" mode */
+} mq_stats_t;
+
 struct mq_ops;
 
 /**
@@ -122,6 +135,7 @@ struct mq_cops {
 	void (*qlink_remove)(mqueue_t *q, plist_t *l);
 	plist_t *(*rmlink_prev)(mqueue_t *q, plist_t *l, int size);
 	void (*update_flowc)(mqueue_t *q);
+	void (*shrink)(mqueue_t *q, int size);
 };
 
 enum mq_magic {
@@ -183,6 +197,7 @@ mq_check_consistency(const struct mqueue * const q)
  */
 
 enum {
+	MQ_UDP		= (1 << 5),	/**< Datagram queue */
 	MQ_CLEAR	= (1 << 4),	/**< Running mq_clear() */
 	MQ_WARNZONE	= (1 << 3),	/**< Between hiwat and lowat */
 	MQ_SWIFT	= (1 << 2),	/**< Swift mode, dropping more traffic */
@@ -239,6 +254,8 @@ void mq_fill_ops(struct mq_ops *ops);
 const struct mq_cops *mq_get_cops(void) G_CONST;
 const char *mq_info(const mqueue_t *q);
 
+void mq_stats_get(mq_stats_t *tcp, mq_stats_t *udp);
+
 #endif	/* _core_mq_h_ */
 
 /* vi: set ts=4 sw=4 cindent: */
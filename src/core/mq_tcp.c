@@ -42,6 +42,7 @@
 #include "tx.h"
 #include "gnet_stats.h"
 #include "dump.h"
+#include "capture.h"
 
 #include "lib/plist.h"
 #include "lib/pmsg.h"
@@ -239,7 +240,7 @@ again:
 			g_assert(r > 0 && r < pmsg_size(mb));
 			g_assert(r < q->size);
 			mb->m_rptr += r;
-			q->size -= r;
+			q->cops->shrink(q, r);
 			g_assert(l == q->qtail);	/* Partially written, is at tail */
 			saturated = TRUE;
 			break;
@@ -309,6 +310,7 @@ mq_tcp_putq(mqueue_t *q, pmsg_t *mb, const gnutella_node_t *from)
 	mq_check_consistency(q);
 
 	dump_tx_tcp_packet(from, q->node, mb);
+	capture_tx_tcp_packet(from, q->node, mb);
 
 again:
 	mq_check_consistency(q);
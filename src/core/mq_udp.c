@@ -44,6 +44,7 @@
 #include "hosts.h"
 #include "mq_udp.h"
 #include "dump.h"
+#include "capture.h"
 
 #include "lib/pmsg.h"
 #include "lib/walloc.h"
@@ -173,6 +174,7 @@ mq_udp_make(int maxsize,
 	q->lowat = maxsize >> 2;		/* 25% of max size */
 	q->hiwat = maxsize >> 1;		/* 50% of max size */
 	q->qwait = slist_new();
+	q->flags = MQ_UDP;
 	q->ops = &mq_udp_ops;
 	q->cops = mq_get_cops();
 	q->uops = uops;
@@ -284,6 +286,7 @@ mq_udp_putq(mqueue_t *q, pmsg_t *mb, const gnet_host_t *to)
 	mq_check_consistency(q);
 
 	dump_tx_udp_packet(to, mb);
+	capture_tx_udp_packet(to, mb);
 
 again:
 	mq_check_consistency(q);
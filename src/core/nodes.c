@@ -43,6 +43,7 @@
 #include "ban.h"
 #include "bh_upload.h"
 #include "bsched.h"
+#include "capture.h"
 #include "clock.h"
 #include "ctl.h"
 #include "dh.h"
@@ -102,6 +103,7 @@
 
 #include "lib/adns.h"
 #include "lib/aging.h"
+#include "lib/arena.h"
 #include "lib/ascii.h"
 #include "lib/atoms.h"
 #include "lib/concat.h"
@@ -2197,6 +2199,18 @@ node_remove_v(gnutella_node_t *n, const char *reason, va_list ap)
 {
 	node_check(n);
 	g_assert(n->status != GTA_NODE_REMOVING);
+
+	/*
+	 * Replay nodes are not connected to anything and are not accounted for:
+	 * just flag them as being removed, the replay logic will dispose of them.
+	 */
+
+	if G_UNLIKELY(NODE_IS_REPLAY(n)) {
+		n->status = GTA_NODE_REMOVING;
+		n->flags &= ~(NODE_F_WRITABLE|NODE_F_READABLE);
+		return;
+	}
+
 	g_assert(!NODE_USES_UDP(n));
 
 	if (reason && no_reason != reason) {
@@ -2344,10 +2358,8 @@ node_remove_v(gnutella_node_t *n, const char *reason, va_list ap)
 		hsep_connection_close(n, in_shutdown);
 
 	if (!in_shutdown) {
-		if (NODE_IS_LEAF(n)) {
-			/* Purge dynamic queries for that node */
-			dq_node_removed(NODE_ID(n));
-		}
+		/* Purge dynamic queries and yield statistics for that node */
+		dq_node_removed(NODE_ID(n));
 		node_fire_node_info_changed(n);
 		node_fire_node_flags_changed(n);
 	}
@@ -2989,6 +3001,11 @@ node_shutdown_v(gnutella_node_t *n, const char *reason, va_list args)
 {
 	node_check(n);
 
+	if G_UNLIKELY(NODE_IS_REPLAY(n)) {
+		node_remove_v(n, reason, args);
+		return;
+	}
+
 	if (n->status == GTA_NODE_SHUTDOWN) {
 		node_recursive_shutdown_v(n, "Shutdown", reason, args);
 		return;
@@ -9020,7 +9037,7 @@ node_patch_push_fw2fw(gnutella_node_t *n)
  * since we may invalidate that node during the processing.
  */
 static void
-node_parse(gnutella_node_t *n)
+node_parse_message(gnutella_node_t *n)
 {
 	bool drop = FALSE;
 	bool has_ggep = FALSE;
@@ -9036,6 +9053,7 @@ node_parse(gnutella_node_t *n)
 	dest.type = ROUTE_NONE;
 
 	dump_rx_packet(n);
+	capture_rx_packet(n);
 
 	/*
 	 * If we're expecting a handshaking ping, check whether we got one.
@@ -9593,6 +9611,37 @@ clean_dest:
 		pslist_free(dest.ur.u_nodes);
 }
 
+/**
+ * Process incoming message held in the node.
+ *
+ * All the short-lived data allocated from the thread arena whilst parsing
+ * and processing the message (e.g. extension descriptors) are reclaimed
+ * at once when we are done.
+ *
+ * The processing time is accounted in the latency histogram of the
+ * message type.
+ *
+ * @attention
+ * NB: callers of this routine must not use the node structure upon return,
+ * since we may invalidate that node during the processing.
+ */
+static void
+node_parse(gnutella_node_t *n)
+{
+	uint8 function = gnutella_header_get_function(&n->header);
+	tm_nano_t start, end, elapsed;
+
+	tm_precise_time(&start);
+
+	arena_begin();
+	node_parse_message(n);
+	arena_end();
+
+	tm_precise_time(&end);
+	tm_precise_elapsed(&elapsed, &end, &start);
+	gnet_stats_count_latency(function, tmn2ns(&elapsed));
+}
+
 static void
 node_drain_hello(void *data, int source, inputevt_cond_t cond)
 {
@@ -9641,6 +9690,9 @@ node_drain_hello(void *data, int source, inputevt_cond_t cond)
 bool
 node_udp_is_old(const gnutella_node_t *n)
 {
+	if G_UNLIKELY(NULL == n->socket)
+		return FALSE;		/* Replay node */
+
 	return socket_udp_is_old(n->socket);
 }
 
@@ -9828,6 +9880,116 @@ node_udp_process(gnutella_node_t *n, const struct gnutella_socket *s,
 	node_handle(n);
 }
 
+/**
+ * Create a node to replay captured traffic.
+ *
+ * Replay nodes are never writable: whatever the stack decides to send back
+ * to them is silently discarded.  They are not part of the connected node
+ * lists, hence nothing will be routed to them either, apart from replies
+ * to the messages they replayed.
+ *
+ * @param mode		the peer mode of the node whose traffic was captured
+ * @param addr		the address of the node whose traffic was captured
+ * @param port		the port of the node whose traffic was captured
+ *
+ * @return a new node, to be freed by node_replay_free().
+ */
+gnutella_node_t *
+node_replay_create(node_peer_t mode, const host_addr_t addr, uint16 port)
+{
+	gnutella_node_t *n;
+
+	n = node_pseudo_create(host_addr_net(addr), mode, _("Replay node"));
+	n->addr = n->gnet_addr = addr;
+	n->port = n->gnet_port = port;
+	n->country = gip_country(addr);
+	n->flags = NODE_F_ESTABLISHED | NODE_F_READABLE;
+	n->attrs = NODE_IS_UDP(n) ? NODE_A_UDP : 0;
+	n->attrs2 = NODE_A2_REPLAY;
+
+	return n;
+}
+
+/**
+ * Push captured message through the replay node.
+ *
+ * @param n		the replay node
+ * @param data	the message, starting with its Gnutella header
+ * @param len	the length of the message
+ */
+void
+node_replay_parse(gnutella_node_t *n, void *data, size_t len)
+{
+	const gnutella_header_t *head = data;
+
+	node_check(n);
+	g_assert(NODE_IS_REPLAY(n));
+	g_assert(NODE_IS_CONNECTED(n));
+	g_assert(len >= GTA_HEADER_SIZE);
+
+	memcpy(n->header, head, sizeof n->header);
+	n->size = MIN(gmsg_size(head), len - GTA_HEADER_SIZE);
+	n->data = ptr_add_offset(data, GTA_HEADER_SIZE);
+	n->msg_flags = 0;
+	n->last_rx = tm_time();
+
+	if (NODE_IS_UDP(n)) {
+		n->attrs = NODE_A_UDP;
+		node_handle(n);
+	} else {
+		n->received++;
+		node_parse(n);
+	}
+}
+
+/**
+ * Dispose of a replay node.
+ */
+void
+node_replay_free(gnutella_node_t *n)
+{
+	node_check(n);
+	g_assert(NODE_IS_REPLAY(n));
+
+	dq_node_removed(NODE_ID(n));
+
+	if (n->routing_data) {
+		routing_node_remove(n);
+		n->routing_data = NULL;
+	}
+	if (n->qrt_receive) {
+		qrt_receive_free(n->qrt_receive);
+		n->qrt_receive = NULL;
+	}
+	if (n->recv_query_table) {
+		qrt_unref(n->recv_query_table);
+		n->recv_query_table = NULL;
+	}
+	if (n->qrt_info) {
+		WFREE_NULL(n->qrt_info, sizeof(*n->qrt_info));
+	}
+	if (n->allocated) {
+		HFREE_NULL(n->data);
+		n->allocated = 0;
+	}
+
+	string_table_free(htable_ptr_cast_to_hash(&n->qseen));
+	string_table_free(hset_ptr_cast_to_hash(&n->qrelayed));
+	string_table_free(hset_ptr_cast_to_hash(&n->qrelayed_old));
+
+	hikset_remove(nodes_by_id, NODE_ID(n));
+	atom_str_free_null(&n->vendor);
+
+	if (n->alive_pings)
+		alive_free(n->alive_pings);
+
+	nid_unref(NODE_ID(n));
+	n->id = NULL;
+
+	n->magic = 0;
+	WFREE(n);
+}
+
 /**
  * Data indication callback for the semi-reliable UDP layer.
  *
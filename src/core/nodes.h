@@ -366,6 +366,7 @@ enum {
  * Second attributes.
  */
 enum {
+	NODE_A2_REPLAY		= 1 << 11,	/**< Node replays captured traffic */
 	NODE_A2_G2_HUB		= 1 << 10,	/**< Node is a G2 hub */
 	NODE_A2_SWITCH_TLS	= 1 << 9,	/**< Node will switch to TLS */
 	NODE_A2_UPGRADE_TLS	= 1 << 8,	/**< Node wants to upgrade to TLS */
@@ -509,6 +510,7 @@ enum {
  */
 
 #define NODE_CAN_SR_UDP(n)		((n)->attrs2 & NODE_A2_UDP_TRANCVR)
+#define NODE_IS_REPLAY(n)		((n)->attrs2 & NODE_A2_REPLAY)
 #define NODE_HAS_SR_UDP(n)		((n)->attrs2 & NODE_A2_HAS_SR_UDP)
 
 #define NODE_HAS_FAKE_NAME(n)	\
@@ -735,6 +737,11 @@ gnutella_node_t *node_browse_prepare(
 	gnet_host_t *host, const char *vendor, gnutella_header_t *header,
 	char *data, uint32 size);
 void node_browse_cleanup(gnutella_node_t *n);
+
+gnutella_node_t *node_replay_create(node_peer_t mode,
+	const host_addr_t addr, uint16 port);
+void node_replay_parse(gnutella_node_t *n, void *data, size_t len);
+void node_replay_free(gnutella_node_t *n);
 void node_kill_hostiles(void);
 void node_supports_tls(struct gnutella_node *);
 void node_supports_whats_new(struct gnutella_node *);
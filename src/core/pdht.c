@@ -62,7 +62,9 @@
 #include "lib/hikset.h"
 #include "lib/misc.h"
 #include "lib/nid.h"
+#include "lib/patricia.h"
 #include "lib/plist.h"
+#include "lib/pslist.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
 #include "lib/walloc.h"
@@ -83,6 +85,7 @@
 #define PDHT_PROX_DELAY		30		/**< Initial delay before publishing PROX */
 #define PDHT_MAX_PROXIES	8		/**< Send out 8 push-proxies at most */
 #define PDHT_PROX_RETRY		60		/**< Every minute if we have to */
+#define PDHT_ALOC_LOOKUPS	8		/**< Max concurrent ALOC roots lookups */
 
 /**
  * Hash table holding all the pending file publishes by SHA1.
@@ -94,6 +97,21 @@ static hikset_t *aloc_publishes;	/* SHA1 -> pdht_publish_t */
  */
 static hikset_t *nope_publishes;	/* GUID -> pdht_publish_t */
 
+/**
+ * ALOC publishes waiting for their STORE roots lookup to be launched.
+ *
+ * Rather than launching one lookup per key as soon as publishing is
+ * requested, we keep the pending keys sorted in a PATRICIA tree and only
+ * run a limited amount of lookups concurrently, always picking the next key
+ * closest to the last one launched.  When roots are found for a key, all the
+ * waiting keys lying in the same subspace can reuse that result set and are
+ * published immediately, without conducting their own lookup.
+ */
+static patricia_t *aloc_waiting;	/* KUID -> pdht_publish_t */
+static int aloc_lookups;			/* Running ALOC roots lookups */
+static kuid_t aloc_cursor;			/* Last KUID for which lookup launched */
+static cevent_t *aloc_launch_ev;	/* Scheduled lookup launching */
+
 typedef enum { PDHT_PUBLISH_MAGIC = 0x680182c5U } pdht_magic_t;
 
 typedef enum {
@@ -160,6 +178,8 @@ pdht_publish_check(const pdht_publish_t *pp)
 #define PDHT_F_BACKGROUND	(1U << 1)	/**< Background publishing */
 #define PDHT_F_DEAD			(1U << 2)	/**< Dead, to be freed ASAP */
 #define PDHT_F_LOOKUP_DONE	(1U << 3)	/**< Lookup phase completed */
+#define PDHT_F_WAITING		(1U << 4)	/**< Waiting in aloc_waiting */
+#define PDHT_F_LOOKUP		(1U << 5)	/**< Counted in aloc_lookups */
 
 /**
  * Context for PROX value publishing.
@@ -182,6 +202,10 @@ static struct {
 } pdht_proxy;
 
 static void pdht_bg_publish(cqueue_t *cq, void *obj);
+static void pdht_roots_found(const kuid_t *kuid,
+	const lookup_rs_t *rs, void *arg);
+static void pdht_roots_error(const kuid_t *kuid,
+	lookup_error_t error, void *arg);
 
 /**
  * English version of the publish type.
@@ -277,6 +301,12 @@ pdht_free_publish(pdht_publish_t *pp, bool do_remove)
 	case PDHT_T_ALOC:
 		if (do_remove)
 			hikset_remove(aloc_publishes, pp->u.aloc.sha1);
+		if (pp->flags & PDHT_F_WAITING) {
+			/* No lookup was launched yet, object can be freed now */
+			patricia_remove(aloc_waiting, pp->id);
+			pp->flags &= ~PDHT_F_WAITING;
+			pp->flags |= PDHT_F_LOOKUP_DONE;
+		}
 		atom_sha1_free_null(&pp->u.aloc.sha1);
 		shared_file_unref(&pp->u.aloc.sf);
 		break;
@@ -896,30 +926,18 @@ pdht_get_nope(const guid_t *guid, const kuid_t *key)
 }
 
 /**
- * Callback when lookup for STORE roots succeeded.
+ * Generate the DHT value and publish it to the STORE roots.
+ *
+ * @param pp		the publishing context, whose lookup phase is completed
+ * @param rs		the STORE roots to use
  */
 static void
-pdht_roots_found(const kuid_t *kuid, const lookup_rs_t *rs, void *arg)
+pdht_roots_publish(pdht_publish_t *pp, const lookup_rs_t *rs)
 {
-	pdht_publish_t *pp = arg;
 	dht_value_t *value = NULL;
 
 	pdht_publish_check(pp);
-	g_assert(pp->id == kuid);		/* They are atoms */
-
-	/*
-	 * Becase we cannot unqueue lookups once they have been sent to the ULQ
-	 * layer, we mark the lookup as completed and check whether the object
-	 * was not already marked as dead, the state where it simply waits for
-	 * the lookup to be completed.
-	 */
-
-	if (pp->flags & PDHT_F_DEAD) {
-		pdht_free_publish(pp, FALSE);	/* Already "removed" */
-		return;
-	}
-
-	pp->flags |= PDHT_F_LOOKUP_DONE;	/* Signals: can free up object now */
+	g_assert(pp->flags & PDHT_F_LOOKUP_DONE);
 
 	/*
 	 * Step #2: generate the DHT value
@@ -998,6 +1016,167 @@ pdht_roots_found(const kuid_t *kuid, const lookup_rs_t *rs, void *arg)
 	pp->pb = publish_value(value, rs, pdht_publish_done, pp);
 }
 
+/**
+ * Callout queue callback to launch pending ALOC roots lookups.
+ *
+ * The next key selected is always the waiting one closest to the last key
+ * for which we launched a lookup, so that keys are processed in KUID order
+ * and the roots cache gets primed by the previous lookups.
+ */
+static void
+pdht_aloc_launch(cqueue_t *cq, void *unused_obj)
+{
+	(void) unused_obj;
+
+	cq_zero(cq, &aloc_launch_ev);
+
+	while (
+		aloc_lookups < PDHT_ALOC_LOOKUPS &&
+		0 != patricia_count(aloc_waiting)
+	) {
+		pdht_publish_t *pp = patricia_closest(aloc_waiting, &aloc_cursor);
+
+		pdht_publish_check(pp);
+		g_assert(pp->flags & PDHT_F_WAITING);
+
+		patricia_remove(aloc_waiting, pp->id);
+		pp->flags &= ~PDHT_F_WAITING;
+		pp->flags |= PDHT_F_LOOKUP;
+		aloc_lookups++;
+		aloc_cursor = *pp->id;
+
+		ulq_find_store_roots(pp->id, FALSE,
+			pdht_roots_found, pdht_roots_error, pp);
+	}
+}
+
+/**
+ * Schedule launching of pending ALOC roots lookups, if not already done.
+ */
+static void
+pdht_aloc_launch_schedule(void)
+{
+	if (NULL == aloc_launch_ev)
+		aloc_launch_ev = cq_main_insert(1, pdht_aloc_launch, NULL);
+}
+
+/**
+ * Record completion of an ALOC roots lookup, freeing one lookup slot.
+ */
+static void
+pdht_aloc_lookup_done(pdht_publish_t *pp)
+{
+	pdht_publish_check(pp);
+	g_assert(pp->flags & PDHT_F_LOOKUP);
+	g_assert(aloc_lookups > 0);
+
+	pp->flags &= ~PDHT_F_LOOKUP;
+	aloc_lookups--;
+
+	if (0 != patricia_count(aloc_waiting))
+		pdht_aloc_launch_schedule();
+}
+
+/**
+ * Reuse the STORE roots found for `kuid' to publish all the waiting ALOC
+ * values whose key is covered by the same k-closest nodes, saving one node
+ * lookup for each of these keys.
+ *
+ * @param kuid		the key for which roots were looked up
+ * @param rs		the roots found for that key
+ */
+static void
+pdht_aloc_reuse_roots(const kuid_t *kuid, const lookup_rs_t *rs)
+{
+	patricia_iter_t *iter;
+	pslist_t *covered = NULL, *sl;
+
+	if (0 == patricia_count(aloc_waiting))
+		return;
+
+	/*
+	 * Waiting keys are visited by increasing distance to the looked-up key,
+	 * hence we can stop at the first one that is not covered by the roots.
+	 */
+
+	iter = patricia_metric_iterator_lazy(aloc_waiting, kuid, TRUE);
+
+	while (patricia_iter_has_next(iter)) {
+		pdht_publish_t *pp = patricia_iter_next_value(iter);
+
+		pdht_publish_check(pp);
+
+		if (!lookup_result_covers(rs, kuid, pp->id))
+			break;
+
+		covered = pslist_prepend(covered, pp);
+	}
+
+	patricia_iterator_release(&iter);
+
+	covered = pslist_reverse(covered);
+
+	PSLIST_FOREACH(covered, sl) {
+		pdht_publish_t *pp = sl->data;
+
+		pdht_publish_check(pp);
+		g_assert(pp->flags & PDHT_F_WAITING);
+
+		patricia_remove(aloc_waiting, pp->id);
+		pp->flags &= ~PDHT_F_WAITING;
+		pp->flags |= PDHT_F_LOOKUP_DONE;
+
+		gnet_stats_inc_general(GNR_DHT_STORE_ROOTS_REUSED);
+
+		if (GNET_PROPERTY(publisher_debug) > 2) {
+			g_debug("PDHT ALOC reusing roots of %s for %s",
+				kuid_to_hex_string(kuid), kuid_to_hex_string2(pp->id));
+		}
+
+		pdht_roots_publish(pp, rs);
+	}
+
+	pslist_free(covered);
+}
+
+/**
+ * Callback when lookup for STORE roots succeeded.
+ */
+static void
+pdht_roots_found(const kuid_t *kuid, const lookup_rs_t *rs, void *arg)
+{
+	pdht_publish_t *pp = arg;
+
+	pdht_publish_check(pp);
+	g_assert(pp->id == kuid);		/* They are atoms */
+
+	/*
+	 * Let the waiting ALOC publishes in the same subspace benefit from the
+	 * lookup, even if the object which triggered it is now dead.
+	 */
+
+	if (pp->flags & PDHT_F_LOOKUP) {
+		pdht_aloc_lookup_done(pp);
+		pdht_aloc_reuse_roots(kuid, rs);
+	}
+
+	/*
+	 * Becase we cannot unqueue lookups once they have been sent to the ULQ
+	 * layer, we mark the lookup as completed and check whether the object
+	 * was not already marked as dead, the state where it simply waits for
+	 * the lookup to be completed.
+	 */
+
+	if (pp->flags & PDHT_F_DEAD) {
+		pdht_free_publish(pp, FALSE);	/* Already "removed" */
+		return;
+	}
+
+	pp->flags |= PDHT_F_LOOKUP_DONE;	/* Signals: can free up object now */
+
+	pdht_roots_publish(pp, rs);
+}
+
 /**
  * Callback for errors during root node lookups.
  */
@@ -1010,6 +1189,9 @@ pdht_roots_error(const kuid_t *kuid, lookup_error_t error, void *arg)
 	pdht_publish_check(pp);
 	g_assert(pp->id == kuid);		/* They are atoms */
 
+	if (pp->flags & PDHT_F_LOOKUP)
+		pdht_aloc_lookup_done(pp);
+
 	/*
 	 * Becase we cannot unqueue lookups once they have been sent to the ULQ
 	 * layer, we mark the lookup as completed and check whether the object
@@ -1149,11 +1331,14 @@ pdht_publish_file(shared_file_t *sf, pdht_cb_t cb, void *arg)
 	 * #2 if file is still publishable, generate the DHT ALOC value
 	 * #3 issue the STORE on each of the k identified nodes.
 	 *
-	 * Here we launch step #1.
+	 * Here we prepare step #1: the key is put in the waiting set, from which
+	 * lookups are launched in KUID order, unless roots found for a nearby
+	 * key can be reused.
 	 */
 
-	ulq_find_store_roots(pp->id, FALSE,
-		pdht_roots_found, pdht_roots_error, pp);
+	patricia_insert(aloc_waiting, pp->id, pp);
+	pp->flags |= PDHT_F_WAITING;
+	pdht_aloc_launch_schedule();
 
 	return;
 
@@ -1802,6 +1987,7 @@ pdht_init(void)
 	nope_publishes = hikset_create(
 		offsetof(struct pdht_publish, u.nope.guid),
 		HASH_KEY_FIXED, GUID_RAW_SIZE);
+	aloc_waiting = patricia_create(KUID_RAW_BITSIZE);
 	ZERO(&pdht_proxy);
 	pdht_prox_install_republish(PDHT_PROX_DELAY);
 }
@@ -1830,8 +2016,12 @@ pdht_close(void)
 	}
 	cq_cancel(&pdht_proxy.publish_ev);
 
+	cq_cancel(&aloc_launch_ev);
+
 	hikset_foreach(aloc_publishes, free_publish_kv, NULL);
 	hikset_free_null(&aloc_publishes);
+	patricia_destroy(aloc_waiting);
+	aloc_waiting = NULL;
 
 	hikset_foreach(nope_publishes, free_publish_kv, NULL);
 	hikset_free_null(&nope_publishes);
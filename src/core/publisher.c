@@ -86,6 +86,7 @@
 
 #define PUBLISH_DB_CACHE_SIZE	128		/**< Amount of data to keep cached */
 #define PUBLISH_SYNC_PERIOD		60000	/**< Flush DB every minute */
+#define PUBLISH_STATS_PERIOD	60000	/**< Throughput stats every minute */
 #define PUBLISH_MIN_DECIMATION	0.95	/**< Minimum acceptable decimation */
 #define PUBLISH_MIN_PROBABILITY	0.99999	/**< 5 nines */
 
@@ -139,6 +140,16 @@ static hikset_t *publisher_sha1;	/** Known entries by SHA1 */
  */
 static cqueue_t *publish_cq;
 
+/**
+ * Publishing throughput monitoring, updated every PUBLISH_STATS_PERIOD.
+ */
+static struct {
+	uint64 published;			/**< Keys published at last period */
+	uint64 lookups;				/**< STORE roots lookups at last period */
+	uint64 reused;				/**< STORE roots reused at last period */
+	time_t last;				/**< Time of last period */
+} publisher_stats;
+
 /**
  * DBM wrapper to associate a SHA1 with publish timing information.
  */
@@ -519,6 +530,8 @@ publisher_done(void *arg, pdht_error_t code, const pdht_info_t *info)
 	 */
 
 	if (PDHT_E_OK == code && info->roots > 0) {
+		if (!pe->backgrounded)
+			gnet_stats_inc_general(GNR_DHT_PUBLISHER_KEYS_PUBLISHED);
 		pe->last_publish = tm_time();
 		if (pd != NULL) {
 			pd->expiration =
@@ -894,6 +907,58 @@ publisher_sync(void *unused_obj)
 	return TRUE;
 }
 
+/**
+ * Periodic computation of the publishing throughput.
+ *
+ * The throughput is the amount of keys published per minute.  We also
+ * report the amount of RPCs saved by reusing STORE roots for nearby keys,
+ * estimated from the average amount of messages a STORE roots lookup needs.
+ */
+static bool
+publisher_throughput(void *unused_obj)
+{
+	uint64 published, lookups, reused, msgs;
+	time_delta_t elapsed;
+	uint64 rate;
+
+	(void) unused_obj;
+
+	published = gnet_stats_get_general(GNR_DHT_PUBLISHER_KEYS_PUBLISHED);
+	lookups = gnet_stats_get_general(GNR_DHT_STORE_ROOTS_LOOKUPS);
+	reused = gnet_stats_get_general(GNR_DHT_STORE_ROOTS_REUSED);
+	elapsed = delta_time(tm_time(), publisher_stats.last);
+
+	if (elapsed <= 0)
+		return TRUE;
+
+	rate = (published - publisher_stats.published) * 60 / elapsed;
+	gnet_stats_set_general(GNR_DHT_PUBLISHER_KEYS_PER_MINUTE, rate);
+
+	if (GNET_PROPERTY(publisher_debug)) {
+		uint64 saved = 0;
+		unsigned nl = lookups - publisher_stats.lookups;
+		unsigned nr = reused - publisher_stats.reused;
+
+		msgs = gnet_stats_get_general(GNR_DHT_STORE_ROOTS_LOOKUP_MSGS);
+		if (lookups != 0)
+			saved = reused * msgs / lookups;
+
+		g_debug("PUBLISHER published %s key%s/min "
+			"(%u lookup%s, %u reused root set%s in last %s; "
+			"%s RPC%s saved overall)",
+			uint64_to_string(rate), plural(rate), nl, plural(nl),
+			nr, plural(nr), compact_time(elapsed),
+			uint64_to_string2(saved), plural(saved));
+	}
+
+	publisher_stats.published = published;
+	publisher_stats.lookups = lookups;
+	publisher_stats.reused = reused;
+	publisher_stats.last = tm_time();
+
+	return TRUE;		/* Keep calling */
+}
+
 /**
  * DBMW foreach iterator to remove expired DB keys.
  * @return TRUE if entry must be deleted.
@@ -962,6 +1027,9 @@ publisher_init(void)
 		sha1_hash, sha1_eq, GNET_PROPERTY(dht_storage_in_memory));
 
 	cq_periodic_add(publish_cq, PUBLISH_SYNC_PERIOD, publisher_sync, NULL);
+	cq_periodic_add(publish_cq, PUBLISH_STATS_PERIOD,
+		publisher_throughput, NULL);
+	publisher_stats.last = tm_time();
 
 	for (i = 0; i < N_ITEMS(inverse_decimation); i++) {
 		double n = i + 1.0;
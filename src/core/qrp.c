@@ -59,13 +59,14 @@
 
 #include "g2/node.h"
 
+#include "lib/atomic.h"
 #include "lib/atoms.h"
 #include "lib/bg.h"
 #include "lib/cq.h"
 #include "lib/endian.h"
+#include "lib/getcpucount.h"
 #include "lib/halloc.h"
 #include "lib/hashing.h"
-#include "lib/hset.h"
 #include "lib/hstrfn.h"
 #include "lib/htable.h"
 #include "lib/mutex.h"
@@ -76,9 +77,12 @@
 #include "lib/spinlock.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
+#include "lib/teq.h"
+#include "lib/thread.h"
 #include "lib/tm.h"
 #include "lib/unsigned.h"
 #include "lib/utf8.h"
+#include "lib/vsort.h"
 #include "lib/walloc.h"
 #include "lib/wordvec.h"
 #include "lib/zlib_util.h"
@@ -347,6 +351,12 @@ qrp_hashcode(const char *s)
 	for (j = 0; '\0' != (uc = (uchar) *s); j = (j + 8) & 24) {
 		uint retlen;
 
+		if (uc < 0x80) {
+			x ^= uc << j;		/* ASCII: no need to decode */
+			s++;
+			continue;
+		}
+
 		uc = utf8_decode_char_fast(s, &retlen);
 		if (!uc)
 			break;	/* Invalid encoding */
@@ -899,6 +909,54 @@ qrt_compress_free(void *u)
 	}
 }
 
+/**
+ * Install compressed routing patch if it's smaller than the original.
+ *
+ * @param rp		the routing patch
+ * @param zd		the deflater, having compressed the whole patch
+ */
+static void
+qrt_patch_deflated(struct routing_patch *rp, zlib_deflater_t *zd)
+{
+	g_assert(ROUTING_PATCH_MAGIC == rp->magic);
+
+	if (qrp_debugging(1)) {
+		g_debug(
+			"QRP %s %p: len=%d, compressed=%d (ratio %.2f%%)",
+			qrp_patch_to_string(rp), rp, rp->len,
+			zlib_deflater_outlen(zd),
+			100.0 * (rp->len - zlib_deflater_outlen(zd)) / rp->len);
+	}
+
+	if (zlib_deflater_outlen(zd) < rp->len) {
+		HFREE_NULL(rp->arena);
+		rp->len = zlib_deflater_outlen(zd);
+		rp->arena = hcopy(zlib_deflater_out(zd), rp->len);
+		rp->compressed = TRUE;
+	}
+}
+
+/**
+ * Compress routing patch inplace, synchronously.
+ */
+static void
+qrt_patch_compress_now(struct routing_patch *rp)
+{
+	zlib_deflater_t *zd;
+
+	g_assert(ROUTING_PATCH_MAGIC == rp->magic);
+
+	zd = zlib_deflater_make(rp->arena, rp->len, Z_BEST_COMPRESSION);
+
+	if (NULL == zd)
+		g_error("%s(): unable to initialize patch compression", G_STRFUNC);
+
+	if (0 == zlib_deflate_all(zd))
+		qrt_patch_deflated(rp, zd);
+
+	zlib_deflater_free(zd, TRUE);
+}
+
 /**
  * Perform incremental compression.
  */
@@ -927,28 +985,7 @@ qrt_step_compress(struct bgtask *h, void *u, int ticks)
 		goto done;
 		/* NOTREACHED */
 	case 0:						/* Finished */
-		/*
-		 * Install compressed routing patch if it's smaller than the original.
-		 */
-
-		if (qrp_debugging(1)) {
-			g_debug(
-				"QRP %s %p: len=%d, compressed=%d (ratio %.2f%%)",
-				qrp_patch_to_string(ctx->rp), ctx->rp, ctx->rp->len,
-				zlib_deflater_outlen(ctx->zd),
-				100.0 * (ctx->rp->len - zlib_deflater_outlen(ctx->zd)) /
-					ctx->rp->len);
-		}
-
-		if (zlib_deflater_outlen(ctx->zd) < ctx->rp->len) {
-			struct routing_patch *rp = ctx->rp;
-
-			g_assert(ROUTING_PATCH_MAGIC == rp->magic);
-			HFREE_NULL(rp->arena);
-			rp->len = zlib_deflater_outlen(ctx->zd);
-			rp->arena = hcopy(zlib_deflater_out(ctx->zd), rp->len);
-			rp->compressed = TRUE;
-		}
+		qrt_patch_deflated(ctx->rp, ctx->zd);
 		zlib_deflater_free(ctx->zd, TRUE);
 		ctx->zd = NULL;
 		goto done;
@@ -1775,92 +1812,245 @@ free_word(const void *key, void *value, void *unused_udata)
 	wfree(deconstify_pointer(key), pointer_to_size(value));
 }
 
-struct unique_substrings {		/* User data for unique_subtr() callback */
-	hset_t *unique;
-	pslist_t *head;
+/***
+ *** Parallel computation of the routing table.
+ ***
+ *** The substrings of the words are hashed and the table is filled by
+ *** several threads, each working on a part of the data.  Since the slot
+ *** of a substring only depends on its hash code, we only need to keep the
+ *** unique hash codes, not the substrings themselves.
+ ***/
+
+#define QRP_THREAD_MAX		8		/**< Max amount of computing threads */
+#define QRP_THREAD_ITEMS	4096	/**< Min amount of items per thread */
+#define QRP_THREAD_STACK	THREAD_STACK_MIN
+
+/**
+ * Work for computing the hash codes of the substrings of some words.
+ */
+struct qrp_substr_work {
+	const char **words;			/**< Words to process */
+	size_t count;				/**< Amount of words */
+	uint32 *hashes;				/**< Sorted unique hash codes (halloc()ed) */
+	size_t hcount;				/**< Amount of hash codes in `hashes' */
 };
 
-static inline void
-insert_substr(struct unique_substrings *u, const char *word, size_t size)
+/**
+ * Work for filling the routing table with some hash codes.
+ */
+struct qrp_fill_work {
+	const uint32 *hashes;		/**< Hash codes to insert */
+	size_t count;				/**< Amount of hash codes */
+	uint8 *arena;				/**< Compacted table (halloc()ed) */
+	int bits;					/**< Table size, in bits */
+};
+
+/**
+ * @return amount of threads to use to process `count' items.
+ */
+static uint
+qrp_thread_count(size_t count)
 {
-	if (!hset_contains(u->unique, word)) {
-		void *s;
+	size_t n = MAX(getcpucount(), 1);
 
-		s = wcopy(word, size);
-		hset_insert(u->unique, s);
-		u->head = pslist_prepend(u->head, s);
-	}
+	n = MIN(n, QRP_THREAD_MAX);
+	n = MIN(n, 1 + count / QRP_THREAD_ITEMS);
+
+	return n;
 }
 
 /**
- * Iteration callback on the hashtable containing keywords.
+ * Run processing routine on each of the `n' work items held in `args',
+ * each of `size' bytes, concurrently.
+ *
+ * The first item is processed by the calling thread, the other items by
+ * new threads, as long as we do not exceed the amount of CPUs.  Returns
+ * when all the items have been processed.
  */
 static void
-unique_substr(const void *key, void *value, void *udata)
+qrp_parallel_run(process_fn_t fn, void *args, size_t size, uint n)
 {
-	struct unique_substrings *u = udata;
-	const char *word = key;
-	char *s;
-	size_t len, size, i;
+	uint tid[QRP_THREAD_MAX];
+	char *p = args;
+	uint i, ncpus = getcpucount();
 
-	g_assert(size_is_positive(pointer_to_size(value)));
+	g_assert(n >= 1 && n <= QRP_THREAD_MAX);
+
+	for (i = 1; i < n; i++) {
+		tid[i] = THREAD_INVALID_ID;
+
+		if (i >= ncpus)
+			continue;
+
+		tid[i] = thread_create(fn, p + i * size, 0, QRP_THREAD_STACK);
+
+		if G_UNLIKELY(THREAD_INVALID_ID == tid[i])
+			g_warning("%s(): cannot create new thread: %m", G_STRFUNC);
+	}
+
+	(*fn)(p);		/* Our own share of the work */
+
+	for (i = 1; i < n; i++) {
+		if (THREAD_INVALID_ID == tid[i])
+			(*fn)(p + i * size);
+	}
+
+	for (i = 1; i < n; i++) {
+		if (THREAD_INVALID_ID == tid[i])
+			continue;
+
+		if (-1 == thread_join(tid[i], NULL)) {
+			g_critical("%s(): cannot join with %s: %m",
+				G_STRFUNC, thread_id_name(tid[i]));
+		}
+	}
+}
+
+static int
+qrp_hashcode_cmp(const void *a, const void *b)
+{
+	const uint32 *x = a, *y = b;
+
+	return CMP(*x, *y);
+}
+
+/**
+ * Compute the hash codes of all the substrings at least QRP_MIN_WORD_LENGTH
+ * long from the words, all anchored at the start, and keep the sorted
+ * unique values.
+ */
+static void *
+qrp_substr_worker(void *arg)
+{
+	struct qrp_substr_work *w = arg;
+	size_t i, j, n = 0, capacity, size = 0;
+	char *s = NULL;
+
+	capacity = w->count * (QRP_MAX_CUT_CHARS + 1) + 1;
+	HALLOC_ARRAY(w->hashes, capacity);
+
+	for (i = 0; i < w->count; i++) {
+		size_t len = strlen(w->words[i]);
+
+		if (len >= size) {
+			size = len + 1;
+			HREALLOC_ARRAY(s, size);
+		}
+
+		memcpy(s, w->words[i], len + 1);
+
+		for (j = 0; j <= QRP_MAX_CUT_CHARS; j++) {
+			g_assert(n < capacity);
+
+			w->hashes[n++] = qrp_hashcode(s);
+
+			while (len > QRP_MIN_WORD_LENGTH) {
+				uint retlen;
+
+				len--;
+				if (utf8_decode_char_fast(&s[len], &retlen)) {
+					s[len] = '\0';				/* Truncate word */
+					break;
+				}
+			}
+			if (len <= QRP_MIN_WORD_LENGTH)
+				break;
+		}
+	}
+
+	HFREE_NULL(s);
 
 	/*
-	 * Add all unique (i.e. not already seen) substrings from word, all
-	 * anchored at the start, whose length range from 3 to the word length.
+	 * Sort hash codes and strip duplicates.
 	 */
 
-	size = pointer_to_size(value);
-	s = wcopy(word, size);
-	len = size - 1;				/* Trailing NUL included in size */
+	vsort(w->hashes, n, sizeof w->hashes[0], qrp_hashcode_cmp);
 
-	for (i = 0; i <= QRP_MAX_CUT_CHARS; i++) {
+	for (i = j = 0; i < n; i++) {
+		if (0 == j || w->hashes[j - 1] != w->hashes[i])
+			w->hashes[j++] = w->hashes[i];
+	}
 
-		insert_substr(u, s, len + 1);
+	w->hcount = j;
 
-		while (len > QRP_MIN_WORD_LENGTH) {
-			uint retlen;
+	return NULL;
+}
 
-			len--;
-			if (utf8_decode_char_fast(&s[len], &retlen)) {
-				s[len] = '\0';				/* Truncate word */
-				break;
+/**
+ * Merge the sorted unique hash codes computed by the workers.
+ *
+ * @param w			the substring workers
+ * @param n			amount of workers
+ * @param count		where the amount of unique hash codes is written
+ *
+ * @return the sorted unique hash codes (halloc()ed).
+ */
+static uint32 *
+qrp_substr_merge(const struct qrp_substr_work *w, uint n, size_t *count)
+{
+	size_t pos[QRP_THREAD_MAX];
+	size_t total = 0, k = 0;
+	uint32 *hashes;
+	uint i;
+
+	for (i = 0; i < n; i++) {
+		pos[i] = 0;
+		total += w[i].hcount;
+	}
+
+	HALLOC_ARRAY(hashes, MAX(total, 1));
+
+	for (;;) {
+		uint32 min = 0;
+		bool found = FALSE;
+
+		for (i = 0; i < n; i++) {
+			if (pos[i] < w[i].hcount && (!found || w[i].hashes[pos[i]] < min)) {
+				min = w[i].hashes[pos[i]];
+				found = TRUE;
 			}
 		}
-		if (len <= QRP_MIN_WORD_LENGTH)
+
+		if (!found)
 			break;
+
+		hashes[k++] = min;
+
+		for (i = 0; i < n; i++) {
+			if (pos[i] < w[i].hcount && w[i].hashes[pos[i]] == min)
+				pos[i]++;
+		}
 	}
-	WFREE_NULL(s, size);
+
+	*count = k;
+	return hashes;
 }
 
 /**
- * Create a list of all unique substrings at least QRP_MIN_WORD_LENGTH long,
- * from words held in `ht' (keys are words, values are the word's length plus
- * the trailing NUL).
- *
- * @returns created list, and count in `retcount'.
+ * Fill private compacted table with the supplied hash codes.
  */
-static pslist_t *
-unique_substrings(htable_t *ht, int *retcount)
+static void *
+qrp_fill_worker(void *arg)
 {
-	struct unique_substrings u = { NULL, NULL };		/* Callback args */
+	struct qrp_fill_work *w = arg;
+	int shift = 32 - w->bits;
+	size_t i;
 
-	u.unique = hset_create(HASH_KEY_STRING, 0);
-	htable_foreach(ht, unique_substr, &u);
-	*retcount = hset_count(u.unique);
-	hset_free_null(&u.unique);		/* Created words ref'ed by u.head */
+	w->arena = halloc0((1U << w->bits) / 8);
+
+	for (i = 0; i < w->count; i++) {
+		uint idx = w->hashes[i] >> shift;
+		w->arena[idx >> 3] |= 0x80U >> (idx & 0x7);
+	}
 
-	return u.head;
+	return NULL;
 }
 
 /*
  * Co-routine context.
  */
 
-#define QRP_STEP_SUBSTRING	1	/**< Substring computation */
-#define QRP_STEP_COMPUTE	2	/**< Compute QRT */
-#define QRP_STEP_INSTALL	3	/**< Install new QRT */
-#define QRP_STEP_LAST		3	/**< Last step */
+#define QRP_DEFAULT_PATCHES	3	/**< Amount of default patches */
 
 enum qrp_magic {
 	QRP_MAGIC = 0x44b5975aU
@@ -1870,10 +2060,8 @@ struct qrp_context {
 	enum qrp_magic magic;
 	struct routing_table **rtp;	/**< Points to routing table variable to fill */
 	struct routing_patch **rpp;	/**< Points to routing patch variable to fill */
-	pslist_t *sl_substrings;	/**< List of all substrings */
-	htable_t *words;			/**< Words making up the files */
+	struct routing_patch *patch[QRP_DEFAULT_PATCHES];	/**< Precomputed */
 	bgtask_t *compress_bt;		/**< Task launched to compress patch */
-	int substrings;				/**< Amount of substrings */
 	char *table;				/**< Computed routing table */
 	int slots;					/**< Amount of slots in table */
 	struct routing_table *rt;	/**< The routing table object we computed */
@@ -1888,6 +2076,82 @@ struct qrp_context {
 
 static struct bgtask *qrp_comp;	/**< Background computation handle */
 static struct bgtask *qrp_merge;/**< Background merging handle */
+static struct qrp_compute *qrp_thread;	/**< Running table computation */
+
+enum qrp_compute_magic { QRP_COMPUTE_MAGIC = 0x2c1f83d6 };
+
+/**
+ * A routing table computation, carried out in a dedicated thread.
+ *
+ * Once the table and its default patches are ready, the computation is
+ * handed to the main thread which installs the new table.
+ */
+struct qrp_compute {
+	enum qrp_compute_magic magic;
+	htable_t *words;			/**< Words making up the files, NULL if none */
+	uint8 *arena;				/**< Compacted table */
+	char *table;				/**< Expanded table */
+	int slots;					/**< Amount of slots in table */
+	int filled;					/**< Amount of slots filled */
+	int hashed;					/**< Amount of keywords hashed */
+	int conflict_ratio;			/**< Percentage of hashing conflicts */
+	struct routing_patch *patch[QRP_DEFAULT_PATCHES];	/**< Default patches */
+	bool cancelled;				/**< Set when computation is cancelled */
+};
+
+static inline void
+qrp_compute_check(const struct qrp_compute * const c)
+{
+	g_assert(c != NULL);
+	g_assert(QRP_COMPUTE_MAGIC == c->magic);
+}
+
+/**
+ * Free routing table computation.
+ */
+static void
+qrp_compute_free(struct qrp_compute *c)
+{
+	uint i;
+
+	qrp_compute_check(c);
+
+	qrp_dispose_words(&c->words);
+	HFREE_NULL(c->arena);
+	HFREE_NULL(c->table);
+
+	for (i = 0; i < N_ITEMS(c->patch); i++) {
+		if (c->patch[i] != NULL)
+			qrt_patch_unref(c->patch[i]);
+	}
+
+	c->magic = 0;
+	WFREE(c);
+}
+
+/**
+ * Flag computation as cancelled.
+ *
+ * The computing thread will notice it and free the computation.
+ */
+static void
+qrp_compute_cancel(struct qrp_compute *c)
+{
+	qrp_compute_check(c);
+
+	atomic_bool_set(&c->cancelled, TRUE);
+}
+
+/**
+ * @return whether computation was cancelled.
+ */
+static bool
+qrp_compute_cancelled(const struct qrp_compute *c)
+{
+	qrp_compute_check(c);
+
+	return atomic_bool_get(&c->cancelled);
+}
 
 /**
  * Free the "seen words" hash table we're filling up in qrp_add_file()
@@ -1911,21 +2175,14 @@ static void
 qrp_context_free(void *p)
 {
 	struct qrp_context *ctx = p;
-	pslist_t *sl;
+	uint i;
 
 	g_assert(ctx->magic == QRP_MAGIC);
 
-	qrp_dispose_words(&ctx->words);
-
-	PSLIST_FOREACH(ctx->sl_substrings, sl) {
-		char *word = sl->data;
-		size_t size;
-
-		size = 1 + strlen(word);
-		g_assert(size_is_positive(size));
-		wfree(word, size);
+	for (i = 0; i < N_ITEMS(ctx->patch); i++) {
+		if (ctx->patch[i] != NULL)
+			qrt_patch_unref(ctx->patch[i]);
 	}
-	pslist_free_null(&ctx->sl_substrings);
 
 	HFREE_NULL(ctx->table);
 
@@ -1965,11 +2222,17 @@ static void
 qrp_cancel_computation(void)
 {
 	bgtask_t *bt;
+	struct qrp_compute *c;
 
 	qrt_compress_cancel_all();
 
 	QRP_TASK_LOCK;
 
+	if (NULL != (c = qrp_thread)) {
+		qrp_thread = NULL;
+		qrp_compute_cancel(c);
+	}
+
 	if (NULL != (bt = qrp_comp)) {
 		qrp_comp = NULL;
 		bg_task_cancel(bt);
@@ -1983,28 +2246,6 @@ qrp_cancel_computation(void)
 	QRP_TASK_UNLOCK;
 }
 
-/**
- * Compute all the substrings we need to insert.
- */
-static bgret_t
-qrp_step_substring(struct bgtask *unused_h, void *u, int unused_ticks)
-{
-	struct qrp_context *ctx = u;
-
-	(void) unused_h;
-	(void) unused_ticks;
-	g_assert(ctx->magic == QRP_MAGIC);
-	g_assert(ctx->words != NULL);
-
-	ctx->sl_substrings = unique_substrings(ctx->words, &ctx->substrings);
-	qrp_dispose_words(&ctx->words);
-
-	if (qrp_debugging(1))
-		g_debug("QRP unique subwords: %d", ctx->substrings);
-
-	return BGR_NEXT;		/* All done for this step */
-}
-
 /**
  * Compare possibly compacted table `rt' with expanded table arena `arena'
  * having `slots' slots.
@@ -2036,143 +2277,6 @@ qrt_eq(const struct routing_table *rt, const char *arena, int slots)
 	return TRUE;
 }
 
-/**
- * Compute QRP table, iteration step.
- */
-static bgret_t
-qrp_step_compute(struct bgtask *h, void *u, int unused_ticks)
-{
-	struct qrp_context *ctx = u;
-	char *table = NULL;
-	int slots;
-	int bits;
-	const pslist_t *sl;
-	int upper_thresh;
-	int hashed = 0;
-	int filled = 0;
-	int conflict_ratio;
-	bool full = FALSE;
-
-	(void) unused_ticks;
-	g_assert(ctx->magic == QRP_MAGIC);
-
-	/*
-	 * Build QR table: we try to achieve a minimum sparse ratio (empty
-	 * slots filled with INFINITY) whilst limiting the size of the table,
-	 * so we incrementally try and double the size until we reach the maximum.
-	 */
-
-	bits = MIN_TABLE_BITS + bg_task_seqno(h);
-	slots = 1 << bits;
-
-	upper_thresh = MIN_SPARSE_RATIO * slots;
-
-	table = halloc(slots);
-	memset(table, LOCAL_INFINITY, slots);
-
-	PSLIST_FOREACH(ctx->sl_substrings, sl) {
-		const char *word = sl->data;
-		uint idx = qrp_hash(word, bits);
-
-		hashed++;
-
-		if (table[idx] == LOCAL_INFINITY) {
-			table[idx] = 1;
-			filled++;
-			if (qrp_debugging(7))
-				g_debug("QRP added subword: \"%s\"", word);
-		}
-
-		/*
-		 * We won't be removing the slot we already filled, so if we
-		 * already filled more than our threshold ratio, there's no
-		 * need to continue: the table is full and we must double the
-		 * size -- unless we've reached our maximum size.
-		 */
-
-		if (bits < MAX_TABLE_BITS && 100*filled > upper_thresh) {
-			full = TRUE;
-			break;
-		}
-	}
-
-	conflict_ratio = ctx->substrings == 0 ? 0 :
-		(int) (100.0 * (ctx->substrings - filled) / ctx->substrings);
-
-	if (qrp_debugging(1))
-		g_debug("QRP [seqno=%d] size=%d, filled=%d, hashed=%d, "
-			"ratio=%d%%, conflicts=%d%%%s",
-			bg_task_seqno(h), slots, filled, hashed,
-			(int) (100.0 * filled / slots),
-			conflict_ratio, full ? " FULL" : "");
-
-	/*
-	 * Decide whether we can keep the table we've just built.
-	 */
-
-	if (
-		bits >= MAX_TABLE_BITS ||
-		(!full && conflict_ratio < MAX_CONFLICT_RATIO)
-	) {
-		if (qrp_debugging(1))
-			g_debug("QRP final table size: %d slots", slots);
-
-		gnet_prop_set_guint32_val(PROP_QRP_SLOTS, (uint32) slots);
-		gnet_prop_set_guint32_val(PROP_QRP_SLOTS_FILLED, (uint32) filled);
-		gnet_prop_set_guint32_val(PROP_QRP_HASHED_KEYWORDS, (uint32) hashed);
-		gnet_prop_set_guint32_val(PROP_QRP_FILL_RATIO,
-			(uint32) (100.0 * filled / slots));
-		gnet_prop_set_guint32_val(PROP_QRP_CONFLICT_RATIO,
-			(uint32) conflict_ratio);
-
-		/*
-		 * If we had already a table, compare it to the one we just built.
-		 * If they are identical, discard the new one.
-		 *
-		 * Can't do a direct memcmp() on the tables though, as the routing
-		 * table arena may be compressed and our table is not.
-		 */
-
-		if (routing_table != NULL) {
-			if (routing_table->cancelled) {
-				/*
-				 * Routing table was canceleld because the computation of the
-				 * global routing patch was cancelled when we began a new
-				 * computation.  Therefore, even if the new table is the same
-				 * as the old one, we need to keep the new one and continue
-				 * the process to propagate the table to our Gnutella peers
-				 * and recompute the default patch.
-				 *		--RAM, 2011-05-16
-				 */
-				if (qrp_debugging(1)) {
-					g_debug("QRP table at generation #%d was cancelled",
-						routing_table->generation);
-				}
-			} else if (qrt_eq(routing_table, table, slots)) {
-				if (qrp_debugging(1)) {
-					g_debug("QRP no change in table, keeping generation #%d",
-						routing_table->generation);
-				}
-				HFREE_NULL(table);
-				bg_task_exit(h, 0);	/* Abort processing */
-			}
-		}
-
-		/*
-		 * OK, we keep the table.
-		 */
-
-		ctx->table = table;
-		ctx->slots = slots;
-
-		return BGR_NEXT;		/* Done! */
-	}
-
-	HFREE_NULL(table);
-
-	return BGR_MORE;			/* More work required */
-}
-
 /**
  * Create the compacted routing table object.
  */
@@ -2219,45 +2323,88 @@ qrp_step_create_table(struct bgtask *unused_h, void *u, int unused_ticks)
 }
 
 /**
- * Compute the routing patches against an empty routing table (those that
- * need to be sent after a QRP RESET message).
+ * @return the variable holding the default routing patch #i, i.e. the
+ * i-th patch against an empty routing table we compute.
  */
-static bgret_t
-qrp_step_create_patches(bgtask_t *bt, void *u, int unused_ticks)
+static struct routing_patch **
+qrp_default_patch(int i)
 {
-	struct qrp_context *ctx = u;
-	struct routing_patch *rp = NULL;
-	struct routing_patch **rpp;
-
-	(void) unused_ticks;
-
-	/*
-	 * See if we have been woken up after successful compression (see below
-	 * in this step when we request sleeping).
-	 */
-
-	switch (ctx->npatch) {
+	switch (i) {
 	case 0:
-		rpp = NULL;
-		break;		/* First time in the step */
+		return &routing_revpatch1;
 	case 1:
-		rpp = &routing_revpatch1;
-		break;
+		return &routing_patch1;
 	case 2:
-		rpp = &routing_patch1;
-		break;
-	case 3:
-		rpp = &routing_patch4;
-		break;
-	default:
-		g_assert_not_reached();		/* Bug in code below */
+		return &routing_patch4;
 	}
 
+	g_assert_not_reached();
+}
+
+/**
+ * Install the default routing patch #i, taking over the reference of `rp'.
+ */
+static void
+qrp_install_default_patch(int i, struct routing_patch *rp)
+{
+	struct routing_patch **rpp = qrp_default_patch(i);
+
+	g_assert(ROUTING_PATCH_MAGIC == rp->magic);
+
+	qrt_patch_ref(rp);		/* Keep it referenced for callback below */
+
+	QRP_TASK_LOCK;
+
+	if (*rpp != NULL)
+		qrt_patch_unref(*rpp);
+	*rpp = rp;
+
+	QRP_TASK_UNLOCK;
+
+	qrt_patch_fire_ready(rp);
+	qrt_patch_unref(rp);	/* Remove extra reference taken above */
+}
+
+/**
+ * Compute the routing patches against an empty routing table (those that
+ * need to be sent after a QRP RESET message).
+ */
+static bgret_t
+qrp_step_create_patches(bgtask_t *bt, void *u, int unused_ticks)
+{
+	struct qrp_context *ctx = u;
+	struct routing_patch *rp = NULL;
+
+	(void) unused_ticks;
+
 	/*
-	 * Install the (possibly compressed) routing patch.
+	 * If the patches were computed along with the table, install them.
+	 * As an ultrapeer, we only need the G2 1-bit reversed patch (see below).
 	 */
 
-	if (rpp != NULL) {
+	if (ctx->patch[0] != NULL) {
+		uint i;
+
+		for (i = 0; i < N_ITEMS(ctx->patch); i++) {
+			rp = ctx->patch[i];
+			ctx->patch[i] = NULL;
+
+			if (0 == i || !settings_is_ultra())
+				qrp_install_default_patch(i, rp);
+			else
+				qrt_patch_unref(rp);
+		}
+
+		return BGR_NEXT;
+	}
+
+	/*
+	 * See if we have been woken up after successful compression (see below
+	 * in this step when we request sleeping), and install the (possibly
+	 * compressed) routing patch.
+	 */
+
+	if (ctx->npatch != 0) {
 		struct qrt_compress_context *comp_ctx = &ctx->compress_ctx;
 		struct routing_patch *crp;
 
@@ -2278,18 +2425,7 @@ qrp_step_create_patches(bgtask_t *bt, void *u, int unused_ticks)
 				G_STRFUNC, ctx->npatch, qrp_patch_to_string(crp));
 		}
 
-		qrt_patch_ref(crp);		/* Keep it referenced for callback below */
-
-		QRP_TASK_LOCK;
-
-		if (*rpp != NULL)
-			qrt_patch_unref(*rpp);
-		*rpp = crp;
-
-		QRP_TASK_UNLOCK;
-
-		qrt_patch_fire_ready(crp);
-		qrt_patch_unref(crp);	/* Remove extra reference taken above */
+		qrp_install_default_patch(ctx->npatch - 1, crp);
 	}
 
 	/*
@@ -2570,9 +2706,7 @@ qrp_step_install_ultra(struct bgtask *h, void *u, int ticks)
 	return BGR_DONE;
 }
 
-static bgstep_cb_t qrp_compute_steps[] = {
-	qrp_step_substring,
-	qrp_step_compute,
+static bgstep_cb_t qrp_install_steps[] = {
 	qrp_step_create_table,
 	qrp_step_create_patches,
 	qrp_step_install_leaf,
@@ -2616,40 +2750,323 @@ qrp_comp_done(bgtask_t *bt, void *p, bgstatus_t u_status, void *u_arg)
 }
 
 /**
- * This routine must be called once all the files have been added to finalize
- * the computation of the new QRP.
+ * Compute the routing table from the words making up the filenames, in
+ * the computing thread.
  *
- * If the routing table has changed, the node_qrt_changed() routine will
- * be called once we have finished its computation.
- *
- * @param words		the words making up the filenames (takes ownership of it)
+ * @return FALSE if computation was cancelled.
  */
-void
-qrp_finalize_computation(htable_t *words)
+static bool
+qrp_compute_table(struct qrp_compute *c)
+{
+	struct qrp_substr_work sw[QRP_THREAD_MAX];
+	struct qrp_fill_work fw[QRP_THREAD_MAX];
+	htable_iter_t *iter;
+	const char **words;
+	const void *key;
+	uint32 *hashes;
+	size_t nwords, substrings, i, chunk;
+	int bits, slots, filled;
+	uint n, t;
+
+	/*
+	 * Split the words among the threads, which compute the hash codes of
+	 * all their substrings.
+	 */
+
+	nwords = htable_count(c->words);
+	HALLOC_ARRAY(words, MAX(nwords, 1));
+
+	iter = htable_iter_new(c->words);
+	for (i = 0; htable_iter_next(iter, &key, NULL); i++)
+		words[i] = key;
+	htable_iter_release(&iter);
+
+	g_assert(i == nwords);
+
+	n = qrp_thread_count(nwords);
+	chunk = nwords / n;
+
+	for (t = 0; t < n; t++) {
+		ZERO(&sw[t]);
+		sw[t].words = &words[t * chunk];
+		sw[t].count = t == n - 1 ? nwords - t * chunk : chunk;
+	}
+
+	qrp_parallel_run(qrp_substr_worker, sw, sizeof sw[0], n);
+
+	hashes = qrp_substr_merge(sw, n, &substrings);
+
+	for (t = 0; t < n; t++)
+		HFREE_NULL(sw[t].hashes);
+	HFREE_NULL(words);
+	qrp_dispose_words(&c->words);
+
+	if (qrp_debugging(1))
+		g_debug("QRP unique subwords: %zu (%u thread%s)", substrings, n, plural(n));
+
+	/*
+	 * Build QR table: we try to achieve a minimum sparse ratio (empty
+	 * slots filled with INFINITY) whilst limiting the size of the table,
+	 * so we incrementally try and double the size until we reach the maximum.
+	 *
+	 * Since hash codes are sorted, so are the slots in which they fall and
+	 * we can count the amount of slots filled without building the table.
+	 */
+
+	for (bits = MIN_TABLE_BITS; /* empty */; bits++) {
+		int shift = 32 - bits;
+		bool full;
+
+		slots = 1 << bits;
+		filled = 0;
+
+		for (i = 0; i < substrings; i++) {
+			if (0 == i || (hashes[i] >> shift) != (hashes[i - 1] >> shift))
+				filled++;
+		}
+
+		full = bits < MAX_TABLE_BITS && 100*filled > MIN_SPARSE_RATIO * slots;
+
+		c->conflict_ratio = 0 == substrings ? 0 :
+			(int) (100.0 * (substrings - filled) / substrings);
+
+		if (qrp_debugging(1)) {
+			g_debug("QRP size=%d, filled=%d, hashed=%zu, "
+				"ratio=%d%%, conflicts=%d%%%s",
+				slots, filled, substrings, (int) (100.0 * filled / slots),
+				c->conflict_ratio, full ? " FULL" : "");
+		}
+
+		if (
+			bits >= MAX_TABLE_BITS ||
+			(!full && c->conflict_ratio < MAX_CONFLICT_RATIO)
+		)
+			break;
+
+		if (qrp_compute_cancelled(c)) {
+			HFREE_NULL(hashes);
+			return FALSE;
+		}
+	}
+
+	if (qrp_debugging(1))
+		g_debug("QRP final table size: %d slots", slots);
+
+	/*
+	 * Fill the table: each thread fills its own table with part of the
+	 * hash codes, and we merge them at the end.
+	 */
+
+	n = qrp_thread_count(substrings);
+	chunk = substrings / n;
+
+	for (t = 0; t < n; t++) {
+		ZERO(&fw[t]);
+		fw[t].hashes = &hashes[t * chunk];
+		fw[t].count = t == n - 1 ? substrings - t * chunk : chunk;
+		fw[t].bits = bits;
+	}
+
+	qrp_parallel_run(qrp_fill_worker, fw, sizeof fw[0], n);
+
+	for (t = 1; t < n; t++) {
+		for (i = 0; i < UNSIGNED(slots) / 8; i++)
+			fw[0].arena[i] |= fw[t].arena[i];
+		HFREE_NULL(fw[t].arena);
+	}
+
+	HFREE_NULL(hashes);
+
+	c->arena = fw[0].arena;
+	c->slots = slots;
+	c->filled = filled;
+	c->hashed = substrings;
+
+	return TRUE;
+}
+
+/**
+ * Expand the compacted table, as expected by qrt_create().
+ */
+static void
+qrp_compute_expand(struct qrp_compute *c)
+{
+	int i;
+
+	c->table = halloc(c->slots);
+	c->filled = 0;
+
+	for (i = 0; i < c->slots; i++) {
+		if (RT_SLOT_READ(c->arena, i)) {
+			c->table[i] = 1;
+			c->filled++;
+		} else {
+			c->table[i] = LOCAL_INFINITY;
+		}
+	}
+}
+
+/**
+ * Work for computing a default routing patch.
+ */
+struct qrp_patch_work {
+	struct routing_table *rt;	/**< The new routing table */
+	struct routing_patch *rp;	/**< Computed patch */
+	int which;					/**< Which default patch */
+};
+
+/**
+ * Compute and compress default routing patch.
+ */
+static void *
+qrp_patch_worker(void *arg)
+{
+	struct qrp_patch_work *w = arg;
+
+	switch (w->which) {
+	case 0:
+		w->rp = qrt_diff_1(NULL, w->rt, TRUE);
+		break;
+	case 1:
+		w->rp = qrt_diff_1(NULL, w->rt, FALSE);
+		break;
+	case 2:
+		w->rp = qrt_diff_4(NULL, w->rt);
+		break;
+	default:
+		g_assert_not_reached();
+	}
+
+	qrt_patch_compress_now(w->rp);
+
+	return NULL;
+}
+
+/**
+ * Compute the routing patches against an empty table concurrently.
+ */
+static void
+qrp_compute_patches(struct qrp_compute *c)
 {
+	struct qrp_patch_work pw[QRP_DEFAULT_PATCHES];
+	struct routing_table rt;
+	uint i;
+
+	/*
+	 * The patches only need the compacted arena of the table: the actual
+	 * routing table object will be created by the main thread.
+	 */
+
+	ZERO(&rt);
+	rt.magic = QRP_ROUTE_MAGIC;
+	rt.arena = c->arena;
+	rt.slots = c->slots;
+	rt.infinity = LOCAL_INFINITY;
+	rt.compacted = TRUE;
+
+	for (i = 0; i < N_ITEMS(pw); i++) {
+		pw[i].rt = &rt;
+		pw[i].rp = NULL;
+		pw[i].which = i;
+	}
+
+	qrp_parallel_run(qrp_patch_worker, pw, sizeof pw[0], N_ITEMS(pw));
+
+	for (i = 0; i < N_ITEMS(pw); i++)
+		c->patch[i] = pw[i].rp;
+}
+
+/**
+ * Install the computed routing table, in the main thread.
+ */
+static void
+qrp_computed(void *arg)
+{
+	struct qrp_compute *c = arg;
 	struct qrp_context *ctx;
+	bool current;
+	uint i;
 
-	g_assert(words != NULL);
+	qrp_compute_check(c);
+
+	QRP_TASK_LOCK;
+	current = c == qrp_thread;
+	if (current)
+		qrp_thread = NULL;
+	QRP_TASK_UNLOCK;
+
+	if (!current) {
+		if (qrp_debugging(1))
+			g_debug("QRP discarding cancelled table computation");
+		goto done;
+	}
+
+	gnet_prop_set_guint32_val(PROP_QRP_SLOTS, (uint32) c->slots);
+	gnet_prop_set_guint32_val(PROP_QRP_SLOTS_FILLED, (uint32) c->filled);
+	gnet_prop_set_guint32_val(PROP_QRP_FILL_RATIO,
+		(uint32) (100.0 * c->filled / c->slots));
+
+	if (c->hashed != 0) {
+		gnet_prop_set_guint32_val(PROP_QRP_HASHED_KEYWORDS,
+			(uint32) c->hashed);
+		gnet_prop_set_guint32_val(PROP_QRP_CONFLICT_RATIO,
+			(uint32) c->conflict_ratio);
+	}
 
 	/*
-	 * Because QRP computation is possibly a CPU-intensive operation, it
-	 * is dealt with as a coroutine that will be scheduled at regular
-	 * intervals.
+	 * If we had already a table, compare it to the one we just built.
+	 * If they are identical, discard the new one.
+	 *
+	 * Can't do a direct memcmp() on the tables though, as the routing
+	 * table arena may be compressed and our table is not.
+	 */
+
+	if (routing_table != NULL) {
+		if (routing_table->cancelled) {
+			/*
+			 * Routing table was canceleld because the computation of the
+			 * global routing patch was cancelled when we began a new
+			 * computation.  Therefore, even if the new table is the same
+			 * as the old one, we need to keep the new one and continue
+			 * the process to propagate the table to our Gnutella peers
+			 * and recompute the default patch.
+			 *		--RAM, 2011-05-16
+			 */
+			if (qrp_debugging(1)) {
+				g_debug("QRP table at generation #%d was cancelled",
+					routing_table->generation);
+			}
+		} else if (qrt_eq(routing_table, c->table, c->slots)) {
+			if (qrp_debugging(1)) {
+				g_debug("QRP no change in table, keeping generation #%d",
+					routing_table->generation);
+			}
+			goto done;
+		}
+	}
+
+	/*
+	 * OK, we keep the table.
 	 */
 
 	WALLOC0(ctx);
 	ctx->magic = QRP_MAGIC;
 	ctx->rtp = &local_table;	/* NOT routing_table, this is for local files */
-	ctx->words = words;			/* Will free it, caller must forget about it */
+	ctx->table = c->table;
+	ctx->slots = c->slots;
+	c->table = NULL;
 
-	gnet_prop_set_timestamp_val(PROP_QRP_TIMESTAMP, tm_time());
+	for (i = 0; i < N_ITEMS(c->patch); i++) {
+		ctx->patch[i] = c->patch[i];
+		c->patch[i] = NULL;
+	}
 
 	QRP_TASK_LOCK;
 
 	g_soft_assert(NULL == qrp_comp);
 
-	qrp_comp = bg_task_create_stopped(NULL, "QRP computation",
-		qrp_compute_steps, N_ITEMS(qrp_compute_steps),
+	qrp_comp = bg_task_create_stopped(NULL, "QRP install",
+		qrp_install_steps, N_ITEMS(qrp_install_steps),
 		ctx, qrp_comp_context_free,
 		qrp_comp_done, NULL);
 
@@ -2657,6 +3074,185 @@ qrp_finalize_computation(htable_t *words)
 		bg_task_run(qrp_comp);
 
 	QRP_TASK_UNLOCK;
+
+	/* FALL THROUGH */
+
+done:
+	qrp_compute_free(c);
+}
+
+/**
+ * Routing table computing thread.
+ */
+static void *
+qrp_compute_thread(void *arg)
+{
+	struct qrp_compute *c = arg;
+
+	qrp_compute_check(c);
+
+	thread_set_name("QRP");
+
+	if (c->words != NULL && !qrp_compute_table(c))
+		goto cancelled;
+
+	if (qrp_compute_cancelled(c))
+		goto cancelled;
+
+	qrp_compute_expand(c);
+	qrp_compute_patches(c);
+
+	if (qrp_compute_cancelled(c))
+		goto cancelled;
+
+	/*
+	 * Main thread will install the table, and free the computation.
+	 */
+
+	teq_safe_post(THREAD_MAIN_ID, qrp_computed, c);
+	return NULL;
+
+cancelled:
+	if (qrp_debugging(1))
+		g_debug("QRP table computation cancelled");
+
+	qrp_compute_free(c);
+	return NULL;
+}
+
+/**
+ * Launch table computation in a dedicated thread.
+ */
+static void
+qrp_compute_launch(struct qrp_compute *c)
+{
+	int r;
+
+	qrp_compute_check(c);
+
+	gnet_prop_set_timestamp_val(PROP_QRP_TIMESTAMP, tm_time());
+
+	QRP_TASK_LOCK;
+
+	g_soft_assert(NULL == qrp_thread);
+
+	qrp_thread = c;
+
+	QRP_TASK_UNLOCK;
+
+	r = thread_create(qrp_compute_thread, c,
+			THREAD_F_DETACH | THREAD_F_NO_CANCEL, QRP_THREAD_STACK);
+
+	if (-1 == r) {
+		g_warning("%s(): cannot create QRP thread, computing inline: %m",
+			G_STRFUNC);
+		qrp_compute_thread(c);
+	}
+}
+
+/**
+ * This routine must be called once all the files have been added to finalize
+ * the computation of the new QRP.
+ *
+ * If the routing table has changed, the node_qrt_changed() routine will
+ * be called once we have finished its computation.
+ *
+ * @param words		the words making up the filenames (takes ownership of it)
+ */
+void
+qrp_finalize_computation(htable_t *words)
+{
+	struct qrp_compute *c;
+
+	g_assert(words != NULL);
+
+	/*
+	 * Because QRP computation is a CPU-intensive operation, it is split
+	 * among several threads.  The main thread is only involved for the
+	 * installation of the new table.
+	 */
+
+	WALLOC0(c);
+	c->magic = QRP_COMPUTE_MAGIC;
+	c->words = words;			/* Will free it, caller must forget about it */
+
+	qrp_compute_launch(c);
+}
+
+/**
+ * Check whether a local routing table with that many slots can be given
+ * to qrp_finalize_precomputed().
+ *
+ * @return TRUE if the amount of slots is a valid table size.
+ */
+bool
+qrp_precomputed_slots_ok(size_t slots)
+{
+	return slots >= EMPTY_TABLE_SIZE && slots <= MAX_TABLE_SIZE &&
+		is_pow2(slots);
+}
+
+/**
+ * Install a local routing table that was computed earlier, typically during
+ * a previous session, instead of computing it from the words making up the
+ * filenames.
+ *
+ * The computation of the default patches and the merging with the tables
+ * of our leaves proceed as they would after a full computation.
+ *
+ * @param bits		bitmap of the table, as returned by qrp_local_table_bits()
+ * @param slots		amount of slots in the table
+ */
+void
+qrp_finalize_precomputed(const uint8 *bits, int slots)
+{
+	struct qrp_compute *c;
+
+	g_assert(bits != NULL);
+	g_return_unless(slots > 0 && qrp_precomputed_slots_ok(slots));
+
+	if (qrp_debugging(1))
+		g_debug("QRP installing precomputed table: %d slots", slots);
+
+	qrp_cancel_computation();
+
+	WALLOC0(c);
+	c->magic = QRP_COMPUTE_MAGIC;
+	c->arena = hcopy(bits, slots / 8);
+	c->slots = slots;
+
+	qrp_compute_launch(c);
+}
+
+/**
+ * Get a copy of the local routing table, the one computed from our shared
+ * files, so that it can be persisted.
+ *
+ * @param slots		where the amount of slots in the table is written
+ *
+ * @return halloc()'ed bitmap of (slots / 8) bytes where each bit set flags
+ * a present slot, NULL if the table is being computed.
+ */
+uint8 *
+qrp_local_table_bits(int *slots)
+{
+	uint8 *bits = NULL;
+
+	g_assert(slots != NULL);
+
+	QRP_TASK_LOCK;
+
+	if (
+		NULL == qrp_comp && NULL == qrp_thread &&
+		local_table != NULL && local_table->compacted
+	) {
+		*slots = local_table->slots;
+		bits = hcopy(local_table->arena, local_table->slots / 8);
+	}
+
+	QRP_TASK_UNLOCK;
+
+	return bits;
 }
 
 static void
@@ -81,6 +81,9 @@ void qrp_prepare_computation(void);
 void qrp_add_file(const struct shared_file *sf, struct htable *words);
 void qrp_finalize_computation(struct htable *words);
 void qrp_dispose_words(struct htable **h_ptr);
+void qrp_finalize_precomputed(const uint8 *bits, int slots);
+bool qrp_precomputed_slots_ok(size_t slots);
+uint8 *qrp_local_table_bits(int *slots);
 
 struct qrt_update *qrt_update_create(struct gnutella_node *n,
 						struct routing_table *);
@@ -5959,7 +5959,7 @@ search_results_process(gnutella_node_t *n, const g2_tree_t *t, int *results)
 		if (
 			t != NULL ||	/* Don't forward G2 hits, don't pass them to DQ */
 			!dq_got_results(gnutella_header_get_muid(&n->header),
-				rs->num_recs, rs->status)
+				NODE_ID(n), rs->num_recs, rs->status)
 		)
 			forward_it = FALSE;
 
@@ -96,6 +96,7 @@
 #include "lib/hstrfn.h"
 #include "lib/http_range.h"
 #include "lib/log.h"
+#include "lib/misc.h"			/* For is_same_file() */
 #include "lib/omalloc.h"
 #include "lib/palloc.h"
 #include "lib/parse.h"
@@ -321,6 +322,16 @@ settings_mkdir(const char *path, bool fatal)
 	}
 }
 
+/**
+ * @return the default configuration directory, to be freed with hfree().
+ */
+static char *
+settings_default_config_dir(void)
+{
+	return make_pathname(home_dir,
+		is_running_on_mingw() ? "gtk-gnutella" : ".gtk-gnutella");
+}
+
 /**
  * Initializes "config_dir", "home_dir", "crash_dir", etc...
  */
@@ -344,8 +355,7 @@ settings_early_init(void)
 				_("$GTK_GNUTELLA_DIR must point to an absolute path!"));
 		}
 	} else {
-		config_dir = make_pathname(home_dir,
-			is_running_on_mingw() ? "gtk-gnutella" : ".gtk-gnutella");
+		config_dir = settings_default_config_dir();
 	}
 	if (!is_directory(config_dir)) {
 		s_info(_("creating configuration directory \"%s\""), config_dir);
@@ -880,6 +890,26 @@ settings_config_dir(void)
 	return config_dir;
 }
 
+/**
+ * Are we running with the default configuration directory, i.e. the one
+ * holding the persistent state of the user, as opposed to a directory
+ * supplied through $GTK_GNUTELLA_DIR?
+ */
+bool
+settings_config_dir_is_default(void)
+{
+	char *dir;
+	int same;
+
+	g_assert(NULL != config_dir);
+
+	dir = settings_default_config_dir();
+	same = is_same_file(dir, config_dir);
+	HFREE_NULL(dir);
+
+	return TRUE == same;
+}
+
 /**
  * Gets the home dir.
  */
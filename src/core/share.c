@@ -36,6 +36,7 @@
 
 #include "common.h"
 
+#define SEARCH_SOURCES		/* For struct search_request_info */
 #include "share.h"
 
 #include "alias.h"
@@ -56,6 +57,7 @@
 #include "qrp.h"
 #include "search.h"
 #include "settings.h"
+#include "share_snap.h"
 #include "spam.h"
 #include "tth_cache.h"
 #include "upload_stats.h"
@@ -72,11 +74,13 @@
 #include "lib/bg.h"
 #include "lib/cq.h"
 #include "lib/crash.h"
+#include "lib/crc.h"
 #include "lib/endian.h"
 #include "lib/file.h"
 #include "lib/getcpucount.h"
 #include "lib/halloc.h"
 #include "lib/hashing.h"
+#include "lib/hashlist.h"
 #include "lib/hikset.h"
 #include "lib/hset.h"
 #include "lib/htable.h"
@@ -179,6 +183,21 @@ static cevent_t *share_qrp_rebuild_ev;
 
 static hset_t *partial_files;	/* Contains partial files, thread-safe */
 
+/**
+ * A directory traversed during a library scan, along with its modification
+ * time at that moment, used to validate the library snapshot.
+ */
+struct shared_dir {
+	const char *path;			/**< Directory path (atom) */
+	time_t mtime;				/**< Modification time, -1 if missing */
+};
+
+/*
+ * Whether the local QRP table was last computed from the shared library
+ * only, i.e. without partial files, in which case it can be persisted.
+ */
+static bool share_qrt_library_only;
+
 /*
  * These variables are recreated by each library scanning.
  *
@@ -199,6 +218,9 @@ static struct shared_library {
 	search_table_t *partial_table;
 	shared_file_t **file_table;			/* Sorted by mtime */
 	shared_file_t **sorted_file_table;	/* Sorted by name */
+	pslist_t *dirs;						/* Scanned dirs (struct shared_dir) */
+	time_t scanned;						/* When scan started */
+	uint generation;					/* Bumped when shared set changes */
 } shared_libfile;
 static spinlock_t shared_libfile_slk = SPINLOCK_INIT;
 
@@ -518,6 +540,7 @@ shared_file_deindex(shared_file_t *sf)
 	sf->file_index = 0;
 	sf->sort_index = 0;
 	sf->flags &= ~SHARE_F_INDEXED;
+	shared_libfile.generation++;		/* Invalidates cached query results */
 
 	SHARED_LIBFILE_UNLOCK;
 
@@ -734,6 +757,258 @@ done:
 	return sf;
 }
 
+/*
+ * Query result cache.
+ *
+ * Ultrapeers see the same popular queries over and over, coming from
+ * different leaves, and running them through the search table each time is
+ * wasteful since the results only change when the library does.  We keep
+ * the full list of matches for recent queries, keyed by the canonized query
+ * string and the limits that st_run_search() applies, in an LRU list.
+ *
+ * Entries expire after SHARE_QCACHE_TTL seconds and the total memory used
+ * is capped to SHARE_QCACHE_MAXMEM.  The whole cache is flushed as soon as
+ * the library generation changes, i.e. when the library is rebuilt or when
+ * a file is removed from the shared set.
+ *
+ * The cache is only accessed from the main thread.
+ */
+
+#define SHARE_QCACHE_TTL	120				/**< Lifetime of entries, secs */
+#define SHARE_QCACHE_MAXMEM	(2 * 1024 * 1024)	/**< Memory budget */
+
+enum share_qcache_magic { SHARE_QCACHE_MAGIC = 0x1c5e3b72 };
+
+/**
+ * A cached query result.
+ */
+struct share_qcache {
+	enum share_qcache_magic magic;
+	char *query;				/**< Canonized query string (halloc()-ed) */
+	uint32 media_types;			/**< Media type mask requested */
+	filesize_t minsize;			/**< Minimum file size */
+	filesize_t maxsize;			/**< Maximum file size */
+	time_t created;				/**< When results were computed */
+	shared_file_t **files;		/**< Matching files, referenced */
+	uint count;					/**< Amount of matching files */
+};
+
+static inline void
+share_qcache_check(const struct share_qcache * const qc)
+{
+	g_assert(qc != NULL);
+	g_assert(SHARE_QCACHE_MAGIC == qc->magic);
+}
+
+static hash_list_t *share_qcache;		/**< LRU list of cached results */
+static size_t share_qcache_memory;		/**< Memory used by cached results */
+static uint share_qcache_generation;	/**< Library generation of entries */
+
+static uint
+share_qcache_hash(const void *key)
+{
+	const struct share_qcache *qc = key;
+
+	return string_mix_hash(qc->query) ^ u32_hash(qc->media_types) ^
+		integer_hash(qc->minsize) ^ integer_hash2(qc->maxsize);
+}
+
+static bool
+share_qcache_eq(const void *a, const void *b)
+{
+	const struct share_qcache *qa = a, *qb = b;
+
+	return qa->media_types == qb->media_types &&
+		qa->minsize == qb->minsize && qa->maxsize == qb->maxsize &&
+		0 == strcmp(qa->query, qb->query);
+}
+
+/**
+ * @return memory used by a cached entry for query with ``count'' results.
+ */
+static size_t
+share_qcache_size(const char *query, uint count)
+{
+	return sizeof(struct share_qcache) + strlen(query) + 1 +
+		count * sizeof(shared_file_t *);
+}
+
+/**
+ * Remove entry from the cache and free it.
+ */
+static void
+share_qcache_remove(struct share_qcache *qc)
+{
+	uint i;
+
+	share_qcache_check(qc);
+
+	hash_list_remove(share_qcache, qc);
+	share_qcache_memory -= share_qcache_size(qc->query, qc->count);
+
+	for (i = 0; i < qc->count; i++)
+		shared_file_unref(&qc->files[i]);
+
+	HFREE_NULL(qc->files);
+	HFREE_NULL(qc->query);
+	qc->magic = 0;
+	WFREE(qc);
+}
+
+/**
+ * Discard all the cached query results.
+ */
+static void
+share_qcache_flush(void)
+{
+	struct share_qcache *qc;
+
+	if (NULL == share_qcache)
+		return;
+
+	while (NULL != (qc = hash_list_head(share_qcache)))
+		share_qcache_remove(qc);
+
+	g_assert(0 == share_qcache_memory);
+
+	gnet_stats_set_general(GNR_LOCAL_QUERY_CACHE_HELD, 0);
+}
+
+/**
+ * Record the results of a query in the cache.
+ *
+ * When the entry is created, the query string of the key is taken over and
+ * set to NULL in the key.
+ *
+ * @param key		the lookup key, with the query string and its limits
+ * @param result	list of matching shared files
+ * @param count		length of the result list
+ */
+static void
+share_qcache_insert(struct share_qcache *key,
+	const pslist_t *result, uint count)
+{
+	struct share_qcache *qc;
+	const pslist_t *sl;
+	size_t size;
+	uint i = 0;
+
+	/*
+	 * Queries matching too many files are not cached: they would evict
+	 * too many other entries.
+	 */
+
+	size = share_qcache_size(key->query, count);
+	if (size > SHARE_QCACHE_MAXMEM / 16)
+		return;
+
+	WALLOC(qc);
+	*qc = *key;		/* Struct copy */
+	qc->magic = SHARE_QCACHE_MAGIC;
+	qc->created = tm_time();
+	qc->count = count;
+	qc->files = NULL;
+
+	if (count != 0) {
+		HALLOC_ARRAY(qc->files, count);
+		PSLIST_FOREACH(result, sl) {
+			qc->files[i++] = shared_file_ref(sl->data);
+		}
+	}
+
+	g_assert(count == i);
+
+	key->query = NULL;		/* Now owned by the cached entry */
+
+	hash_list_append(share_qcache, qc);
+	share_qcache_memory += size;
+
+	while (share_qcache_memory > SHARE_QCACHE_MAXMEM) {
+		share_qcache_remove(hash_list_head(share_qcache));
+		gnet_stats_inc_general(GNR_LOCAL_QUERY_CACHE_EVICTIONS);
+	}
+
+	gnet_stats_set_general(GNR_LOCAL_QUERY_CACHE_HELD,
+		hash_list_length(share_qcache));
+}
+
+/**
+ * Search the library, going through the query result cache.
+ *
+ * @param st			the library search table
+ * @param generation	the library generation to which ``st'' belongs
+ * @param query			the query string to apply
+ * @param sri			meta-information about the query, for matching limits
+ * @param callback		routine to call on each hit
+ * @param user_data		opaque context passed to callback
+ * @param max_res		maximum number of results
+ * @param qhv			query hash vector, filled with query words if not NULL
+ *
+ * @return the amount of matches for the query.
+ */
+static int
+share_qcache_search(search_table_t *st, uint generation, const char *query,
+	const search_request_info_t *sri,
+	st_search_callback callback, void *user_data,
+	int max_res, query_hashvec_t *qhv)
+{
+	struct share_qcache key;
+	const void *orig;
+	pslist_t *result = NULL;
+	uint n;
+
+	if (generation != share_qcache_generation) {
+		share_qcache_flush();
+		share_qcache_generation = generation;
+	}
+
+	ZERO(&key);
+	key.query = UNICODE_CANONIZE(query);
+	key.media_types = sri->media_types;
+	if (sri->size_restrictions) {
+		key.minsize = sri->minsize;
+		key.maxsize = sri->maxsize;
+	} else {
+		key.maxsize = MAX_INT_VAL(filesize_t);
+	}
+
+	if (hash_list_find(share_qcache, &key, &orig)) {
+		struct share_qcache *qc = deconstify_pointer(orig);
+
+		share_qcache_check(qc);
+
+		if (delta_time(tm_time(), qc->created) <= SHARE_QCACHE_TTL) {
+			uint i;
+
+			gnet_stats_inc_general(GNR_LOCAL_QUERY_CACHE_HITS);
+			hash_list_moveto_tail(share_qcache, qc);
+
+			for (i = qc->count; i != 0; i--)
+				result = pslist_prepend_const(result, qc->files[i - 1]);
+
+			n = qc->count;
+
+			if (qhv != NULL)
+				st_fill_qhv_canonic(key.query, qhv);
+
+			goto deliver;
+		}
+
+		share_qcache_remove(qc);		/* Expired */
+	}
+
+	gnet_stats_inc_general(GNR_LOCAL_QUERY_CACHE_MISSES);
+
+	n = st_search_collect_canonic(st, key.query, sri, &result, qhv);
+	share_qcache_insert(&key, result, n);
+
+deliver:
+	st_search_deliver(&result, n, callback, user_data, max_res);
+	HFREE_NULL(key.query);
+
+	return n;
+}
+
 /**
  * Apply query string to the library.
  *
@@ -754,6 +1029,7 @@ shared_files_match(const char *query,
 	int n;
 	int remain;
 	search_table_t *gt, *pt;
+	uint generation;
 	bool partials = booleanize(flags & SHARE_FM_PARTIALS);
 	bool g2_query = booleanize(flags & SHARE_FM_G2);
 
@@ -765,14 +1041,16 @@ shared_files_match(const char *query,
 	SHARED_LIBFILE_LOCK;
 	gt = st_refcnt_inc(shared_libfile.search_table);
 	pt = partials ? st_refcnt_inc(shared_libfile.partial_table) : NULL;
+	generation = shared_libfile.generation;
 	SHARED_LIBFILE_UNLOCK;
 
 	/*
-	 * First search from the library.
+	 * First search from the library, whose results can be cached since
+	 * they only change when the library does.
 	 */
 
-	n = st_search(gt, query, sri, callback, user_data, max_res, qhv);
-
+	n = share_qcache_search(gt, generation, query, sri,
+			callback, user_data, max_res, qhv);
 
 	gnet_stats_count_general(g2_query ? GNR_LOCAL_G2_HITS : GNR_LOCAL_HITS, n);
 	remain = max_res - n;
@@ -1519,10 +1797,16 @@ struct recursive_scan {
 	shared_file_t **ftable;		/* cloned file_table, contains ref-counted sf */
 	search_table_t *search_tb;	/* the new search table */
 	search_table_t *partial_tb;	/* the new partial table */
+	pslist_t *dirs;				/* traversed dirs (struct shared_dir) */
+	share_snap_t *snap;			/* library snapshot being loaded */
+	const uint8 *qrt;			/* QRP table from snapshot, NULL if none */
+	int qrt_slots;				/* amount of slots in snapshot QRP table */
+	time_t scanned;				/* when library scan started */
 	uint64 files_scanned;		/* amount of files shared in the library */
 	uint64 bytes_scanned;		/* size of the library */
 	int idx;					/* iterating index */
 	int ticks;					/* ticks used */
+	int partials;				/* partial files added to QRP */
 	size_t ftable_capacity;		/* Amount of entries in ftable[] */
 };
 
@@ -1546,6 +1830,7 @@ recursive_scan_new(const pslist_t *base_dirs, time_t now)
 	WALLOC0(ctx);
 	ctx->magic = RECURSIVE_SCAN_MAGIC;
 	ctx->start_time = now;
+	ctx->scanned = now;
 	ctx->base_dirs = slist_new();
 	ctx->sub_dirs = slist_new();
 	ctx->shared_files = slist_new();
@@ -1559,6 +1844,51 @@ recursive_scan_new(const pslist_t *base_dirs, time_t now)
 	return ctx;
 }
 
+/**
+ * Allocate a new scanned directory.
+ */
+static struct shared_dir *
+shared_dir_make(const char *path, time_t mtime)
+{
+	struct shared_dir *sd;
+
+	WALLOC(sd);
+	sd->path = atom_str_get(path);
+	sd->mtime = mtime;
+
+	return sd;
+}
+
+/**
+ * Free scanned directory, as a pslist_free_full() callback.
+ */
+static void
+shared_dir_free(void *data)
+{
+	struct shared_dir *sd = data;
+
+	atom_str_free_null(&sd->path);
+	WFREE(sd);
+}
+
+/**
+ * Record directory traversed during the scan, along with its current
+ * modification time.
+ */
+static void
+recursive_scan_record_dir(struct recursive_scan *ctx, const char *dir)
+{
+	filestat_t sb;
+	time_t mtime;
+
+	if (-1 == stat(dir, &sb) || !S_ISDIR(sb.st_mode))
+		mtime = (time_t) -1;
+	else
+		mtime = sb.st_mtime;
+
+	ctx->dirs = pslist_prepend(ctx->dirs, shared_dir_make(dir, mtime));
+}
+
 static void
 recursive_scan_closedir(struct recursive_scan *ctx)
 {
@@ -1626,6 +1956,8 @@ recursive_scan_context_free(void *data)
 	slist_free_all(&ctx->partial_files, recursive_sf_unref);
 
 	htable_free_null(&ctx->basenames);
+	pslist_free_full_null(&ctx->dirs, shared_dir_free);
+	share_snap_close_null(&ctx->snap);
 	st_free(&ctx->search_tb);
 	st_free(&ctx->partial_tb);
 	atom_str_free_null(&ctx->base_dir);
@@ -1662,6 +1994,7 @@ share_free(void)
 	shared_file_slist_free_null(&shared_libfile.shared_files);
 	HFREE_NULL(shared_libfile.file_table);
 	HFREE_NULL(shared_libfile.sorted_file_table);
+	pslist_free_full_null(&shared_libfile.dirs, shared_dir_free);
 }
 
 /**
@@ -1732,6 +2065,8 @@ recursive_scan_opendir(struct recursive_scan *ctx, const char * const dir)
 	if (directory_is_unshareable(dir))
 		return;
 
+	recursive_scan_record_dir(ctx, dir);
+
 	/**
 	 * FIXME: On Windows FindFirstFile/FindNextFile/FindClose
 	 *		  must be used to get the Unicode filenames.
@@ -1901,6 +2236,8 @@ finish:
 /**
  * Callback invoked by the background task layer when a task is terminated.
  */
+static void share_lib_rescan(void);
+
 static void
 recursive_scan_done(struct bgtask *bt, void *data, bgstatus_t status, void *arg)
 {
@@ -1943,6 +2280,13 @@ recursive_scan_done(struct bgtask *bt, void *data, bgstatus_t status, void *arg)
 
 		spinunlock(&v->lock);
 	}
+
+	/*
+	 * If we could not load the library snapshot, fallback to a full scan.
+	 */
+
+	if (ctx->snap != NULL && BGS_ERROR == status)
+		share_lib_rescan();
 }
 
 /**
@@ -2302,6 +2646,199 @@ next:
 	return BGR_NEXT;
 }
 
+/**
+ * Create shared file from its snapshot record.
+ *
+ * @return the shared file, NULL if the record is corrupted.
+ */
+static shared_file_t *
+share_snapshot_file(const share_snap_t *snap, size_t i)
+{
+	const struct share_snap_file *f = share_snap_file(snap, i);
+	const char *path, *relative_path, *nfc, *canonic, *normal;
+	shared_file_t *sf;
+
+	path = share_snap_string(snap, f->path);
+	relative_path = share_snap_string(snap, f->relative_path);
+	nfc = share_snap_string(snap, f->name_nfc);
+	canonic = share_snap_string(snap, f->name_canonic);
+	normal = share_snap_string(snap, f->name_normal);
+
+	if (
+		NULL == path || !is_absolute_path(path) ||
+		NULL == nfc || '\0' == *nfc ||
+		NULL == canonic || '\0' == *canonic ||
+		0 == f->size || too_big_for_gnutella(f->size)
+	)
+		return NULL;
+
+	sf = shared_file_alloc();
+	sf->file_path = atom_str_get(path);
+	sf->relative_path = NULL == relative_path ? NULL :
+		atom_str_get(relative_path);
+	sf->file_size = f->size;
+	sf->mtime = f->mtime;
+	sf->ctime = f->ctime;
+	sf->name_nfc = atom_str_get(nfc);
+	sf->name_nfc_len = strlen(sf->name_nfc);
+	sf->name_canonic = atom_str_get(canonic);
+	sf->name_canonic_len = strlen(sf->name_canonic);
+
+	if (normal != NULL) {
+		sf->name_normal = atom_str_get(normal);
+		sf->name_normal_len = strlen(sf->name_normal);
+	}
+
+	sf->mime_type = mime_type_from_filename(sf->name_nfc);
+	sf->media_type = shared_file_media_type(sf->mime_type);
+	sf->sort_index = f->sort_index;
+
+	shared_file_name_check(sf);
+
+	return sf;
+}
+
+/**
+ * Load the shared files from the library snapshot, in place of the
+ * directory scanning and the building of the file tables.
+ */
+static bgret_t
+recursive_scan_step_snapshot_files(struct bgtask *bt, void *data, int ticks)
+{
+	struct recursive_scan *ctx = data;
+
+	recursive_scan_check(ctx);
+	g_assert(ctx->snap != NULL);
+
+	if (0 == ctx->idx) {
+		g_assert(NULL == ctx->files);
+
+		ctx->files_scanned = share_snap_file_count(ctx->snap);
+		ctx->bytes_scanned = 0;
+
+		if (0 == ctx->files_scanned)
+			goto done;
+
+		HALLOC0_ARRAY(ctx->files, ctx->files_scanned);
+		HALLOC0_ARRAY(ctx->sorted, ctx->files_scanned);
+	}
+
+	ctx->ticks = 0;
+
+	while (UNSIGNED(ctx->idx) < ctx->files_scanned) {
+		shared_file_t *sf;
+		int i = ctx->idx++;
+
+		sf = share_snapshot_file(ctx->snap, i);
+
+		if (
+			NULL == sf ||
+			0 == sf->sort_index || sf->sort_index > ctx->files_scanned ||
+			ctx->sorted[sf->sort_index - 1] != NULL
+		) {
+			g_warning("%s(): corrupted file #%d in library snapshot",
+				G_STRFUNC, i);
+			shared_file_free(&sf);
+			return BGR_ERROR;
+		}
+
+		/*
+		 * Files are recorded in the order of their file index, and we
+		 * do not set SHARE_F_INDEXED yet, as for a regular scan.
+		 */
+
+		sf->file_index = i + 1;
+		ctx->files[i] = sf;
+		ctx->sorted[sf->sort_index - 1] = sf;
+		ctx->shared = pslist_prepend(ctx->shared, shared_file_ref(sf));
+		ctx->bytes_scanned += sf->file_size;
+		upload_stats_enforce_local_filename(sf);
+
+		if (ctx->ticks++ >= ticks)
+			return BGR_MORE;
+
+		if (0 == (ctx->ticks & 0xf))
+			bg_task_cancel_test(ctx->task);
+	}
+
+done:
+	bg_task_ticks_used(bt, ctx->ticks);
+	ctx->idx = 0;				/* Prepares next step */
+	return BGR_NEXT;
+}
+
+/**
+ * st_image_load() callback to map file identifiers back to shared files.
+ */
+static const shared_file_t *
+share_snapshot_st_file(uint32 id, enum match_set which,
+	const char **key, void *data)
+{
+	struct recursive_scan *ctx = data;
+	const shared_file_t *sf;
+
+	recursive_scan_check(ctx);
+
+	if (id >= ctx->files_scanned)
+		return NULL;
+
+	sf = ctx->files[id];
+	*key = ST_SET_PLAIN == which ? sf->name_canonic : sf->name_normal;
+
+	return sf;
+}
+
+/**
+ * Load the search table from the library snapshot, along with the list of
+ * directories we need to monitor and the QRP table.
+ */
+static bgret_t
+recursive_scan_step_snapshot_tables(struct bgtask *bt, void *data, int ticks)
+{
+	struct recursive_scan *ctx = data;
+	static const enum match_set sets[] = { ST_SET_PLAIN, ST_SET_ALIAS };
+	size_t i;
+
+	recursive_scan_check(ctx);
+	g_assert(ctx->snap != NULL);
+	g_assert(NULL == ctx->search_tb);
+
+	(void) ticks;
+
+	ctx->search_tb = st_create();
+
+	for (i = 0; i < N_ITEMS(sets); i++) {
+		const uint32 *image;
+		size_t count;
+
+		image = share_snap_st(ctx->snap, sets[i], &count);
+
+		if (
+			!st_image_load(ctx->search_tb, sets[i], image, count,
+				share_snapshot_st_file, ctx)
+		) {
+			g_warning("%s(): corrupted search table in library snapshot",
+				G_STRFUNC);
+			return BGR_ERROR;
+		}
+	}
+
+	for (i = 0; i < share_snap_dir_count(ctx->snap); i++) {
+		const char *path;
+		time_t mtime;
+
+		path = share_snap_dir(ctx->snap, i, &mtime);
+		ctx->dirs = pslist_prepend(ctx->dirs, shared_dir_make(path, mtime));
+	}
+
+	ctx->scanned = share_snap_scanned(ctx->snap);
+	ctx->qrt = share_snap_qrt(ctx->snap, &ctx->qrt_slots);
+
+	bg_task_ticks_used(bt, ctx->files_scanned / 10);
+	ctx->idx = 0;				/* Prepares next step */
+	return BGR_NEXT;
+}
+
 static void *
 recursive_install_shared(void *unused)
 {
@@ -2404,6 +2941,9 @@ recursive_scan_step_install_shared(struct bgtask *bt, void *data, int ticks)
 	shared_libfile.sorted_file_table	= ctx->sorted;
 	shared_libfile.files_scanned		= ctx->files_scanned;
 	shared_libfile.bytes_scanned		= ctx->bytes_scanned;
+	shared_libfile.dirs					= ctx->dirs;
+	shared_libfile.scanned				= ctx->scanned;
+	shared_libfile.generation++;
 
 	/*
 	 * Reset these contextual variables, they are now held by the global ones.
@@ -2414,6 +2954,7 @@ recursive_scan_step_install_shared(struct bgtask *bt, void *data, int ticks)
 	ctx->shared = NULL;
 	ctx->files = NULL;
 	ctx->sorted = NULL;
+	ctx->dirs = NULL;
 
 	reinit_sha1_table();		/* Must happen whilst we hold the lock */
 
@@ -2718,8 +3259,20 @@ recursive_scan_step_prepare_qrp(struct bgtask *bt, void *data, int ticks)
 
 	teq_safe_rpc(THREAD_MAIN_ID, recursive_prepare_qrp, ctx);
 
+	/*
+	 * The QRP table from the library snapshot only covers the library files,
+	 * so we cannot use it when we have partial files to add.
+	 */
+
+	if (ctx->qrt != NULL && 0 != slist_length(ctx->partial_files)) {
+		if (GNET_PROPERTY(share_debug))
+			g_debug("SHARE ignoring QRP table from library snapshot");
+		ctx->qrt = NULL;
+	}
+
 	qrp_prepare_computation();
 	ctx->idx = 0;
+	ctx->partials = 0;
 
 	bg_task_ticks_used(bt, 0);
 	return BGR_NEXT;
@@ -2735,6 +3288,9 @@ recursive_scan_step_update_qrp_lib(struct bgtask *bt, void *data, int ticks)
 
 	ctx->ticks = 0;
 
+	if (ctx->qrt != NULL)
+		goto done;			/* Will use the QRP table from the snapshot */
+
 	/*
 	 * If we're coming from a rescan, then we have already loaded the ftable[]
 	 * copy in the context.
@@ -2774,6 +3330,7 @@ recursive_scan_step_update_qrp_lib(struct bgtask *bt, void *data, int ticks)
 		ctx->idx++;
 	}
 
+done:
 	bg_task_ticks_used(bt, ctx->ticks);
 	return BGR_NEXT;
 }
@@ -2804,6 +3361,7 @@ recursive_scan_step_update_qrp_partial(struct bgtask *bt, void *data, int ticks)
 
 		qrp_add_file(sf, ctx->words);
 		shared_file_unref(&sf);
+		ctx->partials++;
 
 		if (ctx->ticks++ >= ticks)
 			return BGR_MORE;
@@ -2830,8 +3388,14 @@ recursive_scan_finalize(void *arg)
 
 	gnet_prop_set_guint32_val(PROP_QRP_INDEXING_DURATION, elapsed);
 
-	qrp_finalize_computation(ctx->words);
-	ctx->words = NULL;		/* Gave pointer, QRP computation will free it */
+	if (ctx->qrt != NULL) {
+		qrp_finalize_precomputed(ctx->qrt, ctx->qrt_slots);
+	} else {
+		qrp_finalize_computation(ctx->words);
+		ctx->words = NULL;	/* Gave pointer, QRP computation will free it */
+	}
+
+	share_qrt_library_only = 0 == ctx->partials;
 
 	/*
 	 * The very first time we are scanning the library, make sure we
@@ -2967,6 +3531,222 @@ share_update_qrp_create_task(bgsched_t *bs)
 				recursive_scan_done, NULL);
 }
 
+/**
+ * Create a new background task for loading the library snapshot, which
+ * replaces the library rescan (+ QRP rebuilding) at startup.
+ *
+ * @param bs		the scheduler to which task should be inserted into
+ * @param snap		the library snapshot (taking ownership)
+ *
+ * @return a new background task.
+ */
+static struct bgtask *
+share_snapshot_create_task(bgsched_t *bs, share_snap_t *snap)
+{
+	static const bgstep_cb_t steps[] = {
+		recursive_scan_step_setup,
+		recursive_scan_step_snapshot_files,
+		recursive_scan_step_snapshot_tables,
+		recursive_scan_step_build_basenames,
+		recursive_scan_step_update_scan_timing,
+		recursive_scan_step_install_shared,
+		recursive_scan_step_request_sha1,
+		recursive_scan_step_tth_cache_cleanup,
+		recursive_scan_step_load_partials,
+		recursive_scan_step_build_partial_table,
+		recursive_scan_step_install_partials,
+		recursive_scan_step_prepare_qrp,
+		recursive_scan_step_update_qrp_lib,
+		recursive_scan_step_update_qrp_partial,
+		recursive_scan_step_finalize,
+	};
+	struct recursive_scan *ctx;
+
+	ctx = recursive_scan_new(NULL, tm_time());
+	ctx->snap = snap;
+
+	return ctx->task = bg_task_create(bs, "library snapshot",
+				steps, N_ITEMS(steps),
+				ctx, recursive_scan_context_free,
+				recursive_scan_done, NULL);
+}
+
+/**
+ * Compute fingerprint of the configuration parameters that determine which
+ * files are shared and how they are indexed.
+ *
+ * A library snapshot is only valid if it was created with the same
+ * parameters.
+ */
+static uint32
+share_snapshot_config(void)
+{
+	const pslist_t *sl;
+	uint32 crc = 0;
+	uint8 flags[3];
+
+	PSLIST_FOREACH(shared_dirs, sl) {
+		const char *dir = sl->data;
+		crc = crc32_update(crc, dir, strlen(dir) + 1);
+	}
+
+	crc = crc32_update(crc, GNET_PROPERTY(scan_extensions),
+		strlen(GNET_PROPERTY(scan_extensions)) + 1);
+
+	if (!is_null_or_empty(GNET_PROPERTY(save_file_path))) {
+		crc = crc32_update(crc, GNET_PROPERTY(save_file_path),
+			strlen(GNET_PROPERTY(save_file_path)) + 1);
+	}
+
+	if (!is_null_or_empty(GNET_PROPERTY(bad_file_path))) {
+		crc = crc32_update(crc, GNET_PROPERTY(bad_file_path),
+			strlen(GNET_PROPERTY(bad_file_path)) + 1);
+	}
+
+	flags[0] = booleanize(GNET_PROPERTY(scan_ignore_symlink_dirs));
+	flags[1] = booleanize(GNET_PROPERTY(scan_ignore_symlink_regfiles));
+	flags[2] = booleanize(GNET_PROPERTY(search_results_expose_relative_paths));
+
+	return crc32_update(crc, flags, sizeof flags);
+}
+
+/**
+ * st_image() callback to identify shared files by their file index.
+ */
+static uint32
+share_snapshot_st_id(const shared_file_t *sf, void *data)
+{
+	const uint64 *files = data;
+
+	shared_file_check(sf);
+
+	if (
+		!(SHARE_F_INDEXED & sf->flags) ||
+		0 == sf->file_index || sf->file_index > *files
+	)
+		return (uint32) -1;
+
+	return sf->file_index - 1;
+}
+
+/**
+ * Persist the current library, so that it can be reloaded at next startup
+ * without having to scan the shared directories again.
+ *
+ * This is only done when the library is stable: no scan is running and
+ * no file was de-indexed since the last scan.
+ */
+static void
+share_snapshot_save(void)
+{
+	struct share_thread_vars *v = &share_thread_vars;
+	share_snap_writer_t *w = NULL;
+	shared_file_t **files = NULL;
+	search_table_t *st = NULL;
+	const pslist_t *sl;
+	uint64 i = 0, n;
+	bool busy;
+	uint32 *image;
+	size_t count;
+	uint8 *bits;
+	int slots;
+
+	spinlock(&v->lock);
+	busy = v->task != NULL || v->qrp_rebuild;
+	spinunlock(&v->lock);
+
+	if (busy || atomic_bool_get(&share_rebuilding)) {
+		if (GNET_PROPERTY(share_debug))
+			g_debug("SHARE library being rebuilt, not saving snapshot");
+		return;
+	}
+
+	SHARED_LIBFILE_LOCK;
+
+	n = shared_libfile.files_scanned;
+
+	if (shared_libfile.file_table != NULL && n <= MAX_INT_VAL(uint32)) {
+		w = share_snap_writer_make(shared_libfile.scanned,
+				share_snapshot_config());
+
+		if (w != NULL) {
+			PSLIST_FOREACH(shared_libfile.dirs, sl) {
+				const struct shared_dir *sd = sl->data;
+				share_snap_writer_dir(w, sd->path, sd->mtime);
+			}
+		}
+
+		st = st_refcnt_inc(shared_libfile.search_table);
+		XMALLOC0_ARRAY(files, n);
+
+		for (i = 0; i < n; i++) {
+			shared_file_t *sf = shared_libfile.file_table[i];
+
+			if (NULL == sf || NULL == shared_libfile.sorted_file_table[i])
+				break;
+
+			files[i] = shared_file_ref(sf);
+		}
+	}
+
+	SHARED_LIBFILE_UNLOCK;
+
+	if (NULL == w)
+		goto done;
+
+	if (i != n) {
+		if (GNET_PROPERTY(share_debug))
+			g_debug("SHARE library changed since last scan, not saving snapshot");
+		goto done;
+	}
+
+	for (i = 0; i < n; i++) {
+		const shared_file_t *sf = files[i];
+		struct share_snap_info info;
+
+		info.size = sf->file_size;
+		info.mtime = sf->mtime;
+		info.ctime = sf->ctime;
+		info.path = sf->file_path;
+		info.relative_path = sf->relative_path;
+		info.name_nfc = sf->name_nfc;
+		info.name_canonic = sf->name_canonic;
+		info.name_normal = sf->name_normal;
+		info.sort_index = sf->sort_index;
+
+		share_snap_writer_file(w, &info);
+	}
+
+	image = st_image(st, ST_SET_PLAIN, share_snapshot_st_id, &n, &count);
+	if (NULL == image)
+		goto done;
+	share_snap_writer_st(w, ST_SET_PLAIN, image, count);
+
+	image = st_image(st, ST_SET_ALIAS, share_snapshot_st_id, &n, &count);
+	if (NULL == image)
+		goto done;
+	share_snap_writer_st(w, ST_SET_ALIAS, image, count);
+
+	if (
+		share_qrt_library_only &&
+		NULL != (bits = qrp_local_table_bits(&slots))
+	)
+		share_snap_writer_qrt(w, bits, slots);
+
+	share_snap_writer_close(&w);
+
+done:
+	share_snap_writer_discard(&w);
+
+	if (files != NULL) {
+		for (i = 0; i < n; i++)
+			shared_file_unref(&files[i]);
+		XFREE_NULL(files);
+	}
+
+	st_free(&st);
+}
+
 /*
  * The "share_thread_lib_xxx" routine is the implementation, within the
  * "library" thread, of the corresponding API invoked from the "main" thread.
@@ -2998,6 +3778,34 @@ share_thread_lib_rescan(void *unused_arg)
 	spinunlock(&v->lock);
 }
 
+/**
+ * Load the library snapshot, if valid, or start a library scan.
+ */
+static void
+share_thread_lib_load(void *unused_arg)
+{
+	struct share_thread_vars *v = &share_thread_vars;
+	share_snap_t *snap;
+
+	(void) unused_arg;
+
+	snap = share_snap_open(share_snapshot_config());
+
+	spinlock(&v->lock);
+
+	if (v->task != NULL) {
+		bg_task_cancel(v->task);
+		v->task = NULL;
+	}
+
+	v->qrp_rebuild = FALSE;		/* since loading takes care of it */
+	v->task = NULL == snap ?
+		share_rescan_create_task(v->sched) :
+		share_snapshot_create_task(v->sched, snap);
+
+	spinunlock(&v->lock);
+}
+
 /**
  * Request a QRP rebuild.
  */
@@ -3041,6 +3849,15 @@ share_lib_rescan(void)
 	teq_post_unique(share_thread_id, share_thread_lib_rescan, NULL);
 }
 
+/**
+ * Load the library snapshot, or start a library scan.
+ */
+static void
+share_lib_load(void)
+{
+	teq_post_unique(share_thread_id, share_thread_lib_load, NULL);
+}
+
 /**
  * Request a QRP rebuild.
  *
@@ -3214,7 +4031,19 @@ share_thread_create(void)
 void
 share_scan(void)
 {
-	share_lib_rescan();
+	static bool loaded;
+
+	/*
+	 * The first time, we try to reload the library from the snapshot
+	 * saved at the end of the previous session.
+	 */
+
+	if (!loaded) {
+		loaded = TRUE;
+		share_lib_load();
+	} else {
+		share_lib_rescan();
+	}
 }
 
 /**
@@ -3248,6 +4077,10 @@ share_special_close(void)
 void G_COLD
 share_close(void)
 {
+	share_snapshot_save();
+	share_qcache_flush();
+	hash_list_free(&share_qcache);
+
 	if (THREAD_MAIN_ID != share_thread_id)
 		thread_kill(share_thread_id, TSIG_TERM);
 
@@ -4175,6 +5008,7 @@ share_init(void)
 	 */
 
 	shared_libfile.search_table = st_create();
+	share_qcache = hash_list_new(share_qcache_hash, share_qcache_eq);
 
 	/*
 	 * Intialize partial file querying structures (so that queries can
@@ -0,0 +1,841 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Persisted snapshot of the shared library.
+ *
+ * Rebuilding the library at startup means scanning all the shared
+ * directories, normalizing all the filenames, then building the search
+ * table and the QRP table.  With hundreds of thousands of files, that takes
+ * a long time during which we cannot answer queries.
+ *
+ * The snapshot records the outcome of a scan: the shared files along with
+ * their normalized names, a pointer-free image of the search table sets,
+ * and the local QRP table.  It is only valid as long as none of the
+ * directories traversed during the scan was modified since, which we can
+ * check by comparing their modification times with the ones recorded.
+ *
+ * The file is written in native byte order and mapped in memory when read
+ * back, so that no parsing is needed: the records and the search table
+ * images are used in place.  Sections are 8-byte aligned.  The file layout
+ * is:
+ *
+ *     header
+ *     string pool (NUL-terminated strings, referred to by their offset)
+ *     directories (struct share_snap_dir)
+ *     files (struct share_snap_file), in file index order
+ *     plain search table set image (32-bit words)
+ *     alias search table set image (32-bit words)
+ *     QRP table bitmap (optional)
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "share_snap.h"
+#include "qrp.h"
+
+#include "if/core/settings.h"
+#include "if/gnet_property_priv.h"
+
+#include "lib/fd.h"
+#include "lib/file.h"
+#include "lib/halloc.h"
+#include "lib/misc.h"
+#include "lib/path.h"
+#include "lib/stringify.h"
+#include "lib/vmm.h"
+#include "lib/walloc.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+#define SHARE_SNAP_VERSION		1
+#define SHARE_SNAP_BYTEORDER	0x01020304U
+#define SHARE_SNAP_RACY			2		/**< Seconds, see share_snap_open() */
+
+static const char share_snap_file_name[] = "library.snapshot";
+static const char share_snap_what[] = "library snapshot";
+static const char share_snap_magic[] = "GTKGLIB\n";
+
+/**
+ * The snapshot header.
+ */
+struct share_snap_header {
+	char magic[8];			/**< share_snap_magic, without trailing NUL */
+	uint32 version;			/**< SHARE_SNAP_VERSION */
+	uint32 byteorder;		/**< SHARE_SNAP_BYTEORDER, in native order */
+	uint32 config;			/**< Fingerprint of the library configuration */
+	uint32 ndirs;			/**< Amount of directories */
+	uint32 nfiles;			/**< Amount of files */
+	uint32 qrt_slots;		/**< Amount of slots in QRP table, 0 if none */
+	int64 scanned;			/**< When library scan started */
+	uint64 size;			/**< Total file size */
+	uint64 strings_off;		/**< Offset of string pool */
+	uint64 strings_len;		/**< Length of string pool */
+	uint64 dirs_off;		/**< Offset of directories */
+	uint64 files_off;		/**< Offset of files */
+	uint64 st_off[2];		/**< Offset of search table set images */
+	uint64 st_len[2];		/**< Length of images, in 32-bit words */
+	uint64 qrt_off;			/**< Offset of QRP table bitmap */
+};
+
+/**
+ * A directory traversed during the scan.
+ */
+struct share_snap_dir {
+	int64 mtime;			/**< Modification time, -1 if missing */
+	uint32 path;			/**< Offset of path in string pool */
+	uint32 reserved;
+};
+
+enum share_snap_writer_magic { SHARE_SNAP_WRITER_MAGIC = 0x60d9c2f1 };
+
+/**
+ * The snapshot writer.
+ *
+ * Strings are written to the file as they are supplied, whilst the other
+ * sections are kept in memory until the writer is closed, since they must
+ * come after the string pool.
+ */
+struct share_snap_writer {
+	enum share_snap_writer_magic magic;
+	FILE *out;						/**< Snapshot being written */
+	file_path_t fp;					/**< Snapshot path */
+	struct share_snap_header hdr;	/**< Header being filled */
+	struct share_snap_dir *dirs;	/**< Directories */
+	size_t dirs_capacity;
+	struct share_snap_file *files;	/**< Files */
+	size_t files_capacity;
+	uint32 *st[2];					/**< Search table set images */
+	uint8 *qrt;						/**< QRP table bitmap */
+	bool error;						/**< Whether an error occurred */
+};
+
+static inline void
+share_snap_writer_check(const struct share_snap_writer * const w)
+{
+	g_assert(w != NULL);
+	g_assert(SHARE_SNAP_WRITER_MAGIC == w->magic);
+}
+
+enum share_snap_magic { SHARE_SNAP_MAGIC = 0x1f8a3b47 };
+
+/**
+ * A snapshot being read.
+ */
+struct share_snap {
+	enum share_snap_magic magic;
+	const struct share_snap_header *hdr;	/**< Start of snapshot data */
+	size_t size;							/**< Size of snapshot data */
+	bool mapped;							/**< Whether data is mapped */
+};
+
+static inline void
+share_snap_check(const struct share_snap * const s)
+{
+	g_assert(s != NULL);
+	g_assert(SHARE_SNAP_MAGIC == s->magic);
+}
+
+/**
+ * Write data to the snapshot, flagging errors.
+ */
+static void
+share_snap_writer_write(share_snap_writer_t *w, const void *data, size_t len)
+{
+	if (0 == len || w->error)
+		return;
+
+	if (1 != fwrite(data, len, 1, w->out))
+		w->error = TRUE;
+}
+
+/**
+ * Pad the snapshot to the next 8-byte boundary.
+ *
+ * @return the offset after padding.
+ */
+static uint64
+share_snap_writer_pad(share_snap_writer_t *w, uint64 offset)
+{
+	static const char zero[8];
+	size_t pad = (8 - (offset & 0x7)) & 0x7;
+
+	share_snap_writer_write(w, zero, pad);
+	return offset + pad;
+}
+
+/**
+ * Append string to the string pool.
+ *
+ * @return the string offset, SHARE_SNAP_NONE for NULL strings.
+ */
+static uint32
+share_snap_writer_string(share_snap_writer_t *w, const char *s)
+{
+	uint64 offset = w->hdr.strings_len;
+	size_t len;
+
+	if (NULL == s)
+		return SHARE_SNAP_NONE;
+
+	len = strlen(s) + 1;
+
+	if (offset + len >= SHARE_SNAP_NONE) {
+		w->error = TRUE;
+		return SHARE_SNAP_NONE;
+	}
+
+	share_snap_writer_write(w, s, len);
+	w->hdr.strings_len += len;
+
+	return offset;
+}
+
+/**
+ * Create a new snapshot writer.
+ *
+ * @param scanned		time at which the library scan started
+ * @param config		fingerprint of the library configuration
+ *
+ * @return the writer, NULL if the snapshot could not be created.
+ */
+share_snap_writer_t *
+share_snap_writer_make(time_t scanned, uint32 config)
+{
+	share_snap_writer_t *w;
+
+	WALLOC0(w);
+	w->magic = SHARE_SNAP_WRITER_MAGIC;
+	file_path_set(&w->fp, settings_config_dir(), share_snap_file_name);
+
+	w->out = file_config_open_write(share_snap_what, &w->fp);
+	if (NULL == w->out) {
+		w->magic = 0;
+		WFREE(w);
+		return NULL;
+	}
+
+	memcpy(w->hdr.magic, share_snap_magic, sizeof w->hdr.magic);
+	w->hdr.version = SHARE_SNAP_VERSION;
+	w->hdr.byteorder = SHARE_SNAP_BYTEORDER;
+	w->hdr.config = config;
+	w->hdr.scanned = scanned;
+	w->hdr.strings_off = sizeof w->hdr;
+
+	/* Header is rewritten when closing */
+	share_snap_writer_write(w, &w->hdr, sizeof w->hdr);
+
+	return w;
+}
+
+/**
+ * Record directory traversed during the scan, along with its modification
+ * time at that moment.
+ */
+void
+share_snap_writer_dir(share_snap_writer_t *w, const char *path, time_t mtime)
+{
+	struct share_snap_dir *d;
+
+	share_snap_writer_check(w);
+	g_assert(path != NULL);
+
+	if (w->hdr.ndirs == w->dirs_capacity) {
+		w->dirs_capacity = MAX(64, w->dirs_capacity * 2);
+		HREALLOC_ARRAY(w->dirs, w->dirs_capacity);
+	}
+
+	d = &w->dirs[w->hdr.ndirs++];
+	d->mtime = mtime;
+	d->path = share_snap_writer_string(w, path);
+	d->reserved = 0;
+}
+
+/**
+ * Record shared file.
+ *
+ * Files must be supplied in the order of their file index.
+ */
+void
+share_snap_writer_file(share_snap_writer_t *w,
+	const struct share_snap_info *info)
+{
+	struct share_snap_file *f;
+
+	share_snap_writer_check(w);
+	g_assert(info != NULL);
+
+	if (w->hdr.nfiles == w->files_capacity) {
+		w->files_capacity = MAX(1024, w->files_capacity * 2);
+		HREALLOC_ARRAY(w->files, w->files_capacity);
+	}
+
+	f = &w->files[w->hdr.nfiles++];
+	f->size = info->size;
+	f->mtime = info->mtime;
+	f->ctime = info->ctime;
+	f->path = share_snap_writer_string(w, info->path);
+	f->relative_path = share_snap_writer_string(w, info->relative_path);
+	f->name_nfc = share_snap_writer_string(w, info->name_nfc);
+	f->name_canonic = share_snap_writer_string(w, info->name_canonic);
+	f->sort_index = info->sort_index;
+
+	/*
+	 * Names are atoms: when no aliasing occurred, the normalized name is
+	 * the canonic one and there is no need to store it twice.
+	 */
+
+	f->name_normal = info->name_normal == info->name_canonic ?
+		f->name_canonic : share_snap_writer_string(w, info->name_normal);
+}
+
+/**
+ * Record search table set image, as computed by st_image().
+ *
+ * The writer takes ownership of the image.
+ */
+void
+share_snap_writer_st(share_snap_writer_t *w,
+	enum match_set which, uint32 *image, size_t count)
+{
+	share_snap_writer_check(w);
+	g_assert(UNSIGNED(which) < N_ITEMS(w->st));
+	g_assert(NULL == w->st[which]);
+
+	w->st[which] = image;
+	w->hdr.st_len[which] = count;
+}
+
+/**
+ * Record QRP table bitmap.
+ *
+ * The writer takes ownership of the bitmap.
+ */
+void
+share_snap_writer_qrt(share_snap_writer_t *w, uint8 *bits, int slots)
+{
+	share_snap_writer_check(w);
+	g_assert(NULL == w->qrt);
+	g_assert(slots > 0 && 0 == (slots & 0x7));
+
+	w->qrt = bits;
+	w->hdr.qrt_slots = slots;
+}
+
+/**
+ * Free writer.
+ */
+static void
+share_snap_writer_free(share_snap_writer_t *w)
+{
+	share_snap_writer_check(w);
+
+	HFREE_NULL(w->dirs);
+	HFREE_NULL(w->files);
+	HFREE_NULL(w->st[ST_SET_PLAIN]);
+	HFREE_NULL(w->st[ST_SET_ALIAS]);
+	HFREE_NULL(w->qrt);
+	w->magic = 0;
+	WFREE(w);
+}
+
+/**
+ * Discard snapshot being written.
+ */
+void
+share_snap_writer_discard(share_snap_writer_t **w_ptr)
+{
+	share_snap_writer_t *w = *w_ptr;
+
+	if (w != NULL) {
+		share_snap_writer_check(w);
+		fclose(w->out);
+		share_snap_writer_free(w);
+		*w_ptr = NULL;
+	}
+}
+
+/**
+ * Write all the sections and the final header, then install the snapshot.
+ *
+ * @return TRUE if the snapshot was successfully written.
+ */
+bool
+share_snap_writer_close(share_snap_writer_t **w_ptr)
+{
+	share_snap_writer_t *w = *w_ptr;
+	uint64 offset;
+	size_t i;
+	bool ok;
+
+	share_snap_writer_check(w);
+
+	if (NULL == w->st[ST_SET_PLAIN] || NULL == w->st[ST_SET_ALIAS])
+		w->error = TRUE;
+
+	offset = share_snap_writer_pad(w, w->hdr.strings_off + w->hdr.strings_len);
+
+	w->hdr.dirs_off = offset;
+	share_snap_writer_write(w, w->dirs, w->hdr.ndirs * sizeof w->dirs[0]);
+	offset += w->hdr.ndirs * sizeof w->dirs[0];
+
+	w->hdr.files_off = offset;
+	share_snap_writer_write(w, w->files, w->hdr.nfiles * sizeof w->files[0]);
+	offset += w->hdr.nfiles * sizeof w->files[0];
+
+	for (i = 0; i < N_ITEMS(w->st); i++) {
+		size_t len = w->hdr.st_len[i] * sizeof w->st[i][0];
+
+		w->hdr.st_off[i] = offset;
+		share_snap_writer_write(w, w->st[i], len);
+		offset = share_snap_writer_pad(w, offset + len);
+	}
+
+	if (w->qrt != NULL) {
+		w->hdr.qrt_off = offset;
+		share_snap_writer_write(w, w->qrt, w->hdr.qrt_slots / 8);
+		offset += w->hdr.qrt_slots / 8;
+	}
+
+	w->hdr.size = offset;
+
+	if (!w->error && 0 == fseek(w->out, 0, SEEK_SET))
+		share_snap_writer_write(w, &w->hdr, sizeof w->hdr);
+	else
+		w->error = TRUE;
+
+	if (w->error || ferror(w->out)) {
+		g_warning("%s(): cannot write %s: %m", G_STRFUNC, share_snap_what);
+		fclose(w->out);
+		ok = FALSE;
+	} else {
+		ok = file_config_close(w->out, &w->fp);
+	}
+
+	if (ok && GNET_PROPERTY(share_debug)) {
+		g_debug("SHARE wrote %s: %u director%s, %u file%s, %s QRP table "
+			"(%s)",
+			share_snap_what, w->hdr.ndirs, plural_y(w->hdr.ndirs),
+			w->hdr.nfiles, plural(w->hdr.nfiles),
+			NULL == w->qrt ? "without" : "with",
+			short_size(w->hdr.size, FALSE));
+	}
+
+	share_snap_writer_free(w);
+	*w_ptr = NULL;
+
+	return ok;
+}
+
+/**
+ * Check that section [off, off + len[ lies within the snapshot.
+ */
+static bool
+share_snap_section_ok(const share_snap_t *s, uint64 off, uint64 len)
+{
+	return 0 == (off & 0x7) && off <= s->size && len <= s->size - off;
+}
+
+/**
+ * Free snapshot data.
+ */
+static void
+share_snap_free_data(share_snap_t *s)
+{
+	void *p = deconstify_pointer(s->hdr);
+
+	if (NULL == p)
+		return;
+
+#ifdef HAS_MMAP
+	if (s->mapped) {
+		vmm_munmap(p, s->size);
+		s->hdr = NULL;
+		return;
+	}
+#endif	/* HAS_MMAP */
+
+	hfree(p);
+	s->hdr = NULL;
+}
+
+/**
+ * Load snapshot data from opened file.
+ *
+ * @return TRUE if OK.
+ */
+static bool
+share_snap_load(share_snap_t *s, int fd)
+{
+	filestat_t sb;
+	void *p;
+
+	if (-1 == fstat(fd, &sb)) {
+		g_warning("%s(): cannot stat %s: %m", G_STRFUNC, share_snap_what);
+		return FALSE;
+	}
+
+	if (
+		sb.st_size < (fileoffset_t) sizeof *s->hdr ||
+		(filesize_t) sb.st_size > (filesize_t) MAX_INT_VAL(size_t)
+	)
+		return FALSE;
+
+	s->size = sb.st_size;
+
+#ifdef HAS_MMAP
+	p = vmm_mmap(NULL, s->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p != MAP_FAILED) {
+		s->hdr = p;
+		s->mapped = TRUE;
+		return TRUE;
+	}
+#endif	/* HAS_MMAP */
+
+	p = halloc(s->size);
+	if (s->size != (size_t) read(fd, p, s->size)) {
+		g_warning("%s(): cannot read %s: %m", G_STRFUNC, share_snap_what);
+		hfree(p);
+		return FALSE;
+	}
+
+	s->hdr = p;
+	return TRUE;
+}
+
+/**
+ * Validate snapshot structure.
+ *
+ * @return NULL if OK, a reason why the snapshot is invalid otherwise.
+ */
+static const char *
+share_snap_validate(const share_snap_t *s, uint32 config)
+{
+	const struct share_snap_header *h = s->hdr;
+	const char *strings;
+	size_t i;
+
+	if (0 != memcmp(h->magic, share_snap_magic, sizeof h->magic))
+		return "bad magic";
+
+	if (h->version != SHARE_SNAP_VERSION)
+		return "unsupported version";
+
+	if (h->byteorder != SHARE_SNAP_BYTEORDER)
+		return "foreign byte order";
+
+	if (h->config != config)
+		return "library configuration changed";
+
+	if (h->size != s->size)
+		return "truncated file";
+
+	if (
+		!share_snap_section_ok(s, h->strings_off, h->strings_len) ||
+		!share_snap_section_ok(s, h->dirs_off,
+			(uint64) h->ndirs * sizeof(struct share_snap_dir)) ||
+		!share_snap_section_ok(s, h->files_off,
+			(uint64) h->nfiles * sizeof(struct share_snap_file))
+	)
+		return "corrupted section";
+
+	for (i = 0; i < N_ITEMS(h->st_off); i++) {
+		if (
+			h->st_len[i] > MAX_INT_VAL(size_t) / sizeof(uint32) ||
+			!share_snap_section_ok(s, h->st_off[i], h->st_len[i] * 4)
+		)
+			return "corrupted search table";
+	}
+
+	if (0 != h->qrt_slots) {
+		if (
+			!qrp_precomputed_slots_ok(h->qrt_slots) ||
+			!share_snap_section_ok(s, h->qrt_off, h->qrt_slots / 8)
+		)
+			return "corrupted QRP table";
+	}
+
+	/*
+	 * The string pool must end with a NUL byte so that any string we
+	 * return is properly terminated.
+	 */
+
+	strings = const_ptr_add_offset(h, h->strings_off);
+
+	if (0 != h->strings_len && '\0' != strings[h->strings_len - 1])
+		return "corrupted string pool";
+
+	return NULL;
+}
+
+/**
+ * Check whether all the directories traversed during the scan are unchanged.
+ *
+ * Directories whose modification time is too close to the start of the scan
+ * may have been modified after we read them without their modification
+ * time changing, so we cannot trust them.
+ *
+ * @return NULL if OK, a reason why the snapshot is stale otherwise.
+ */
+static const char *
+share_snap_validate_dirs(const share_snap_t *s)
+{
+	size_t i;
+
+	for (i = 0; i < share_snap_dir_count(s); i++) {
+		const char *path;
+		filestat_t sb;
+		time_t mtime, now;
+
+		path = share_snap_dir(s, i, &mtime);
+		if (NULL == path)
+			return "corrupted directory";
+
+		if (delta_time(mtime, share_snap_scanned(s)) > -SHARE_SNAP_RACY)
+			return "directory modified during scan";
+
+		if (-1 == stat(path, &sb) || !S_ISDIR(sb.st_mode))
+			now = (time_t) -1;
+		else
+			now = sb.st_mtime;
+
+		if (now != mtime) {
+			if (GNET_PROPERTY(share_debug) > 1)
+				g_debug("SHARE directory \"%s\" changed", path);
+			return "directory changed";
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Open the library snapshot, and check that it is still valid.
+ *
+ * @param config		fingerprint of the current library configuration
+ *
+ * @return the snapshot, NULL if there is none or if it is not valid.
+ */
+share_snap_t *
+share_snap_open(uint32 config)
+{
+	share_snap_t *s;
+	const char *reason;
+	char *path;
+	int fd;
+
+	path = make_pathname(settings_config_dir(), share_snap_file_name);
+	fd = file_open_missing(path, O_RDONLY);
+	HFREE_NULL(path);
+
+	if (-1 == fd)
+		return NULL;
+
+	WALLOC0(s);
+	s->magic = SHARE_SNAP_MAGIC;
+
+	if (!share_snap_load(s, fd)) {
+		reason = "cannot load";
+		goto invalid;
+	}
+
+	if (
+		NULL != (reason = share_snap_validate(s, config)) ||
+		NULL != (reason = share_snap_validate_dirs(s))
+	)
+		goto invalid;
+
+	fd_forget_and_close(&fd);
+
+	if (GNET_PROPERTY(share_debug)) {
+		g_debug("SHARE loaded %s: %zu director%s, %zu file%s, %s QRP table",
+			share_snap_what,
+			share_snap_dir_count(s), plural_y(share_snap_dir_count(s)),
+			share_snap_file_count(s), plural(share_snap_file_count(s)),
+			0 == s->hdr->qrt_slots ? "without" : "with");
+	}
+
+	return s;
+
+invalid:
+	if (GNET_PROPERTY(share_debug))
+		g_debug("SHARE ignoring %s: %s", share_snap_what, reason);
+
+	fd_forget_and_close(&fd);
+	share_snap_close_null(&s);
+	return NULL;
+}
+
+/**
+ * Close snapshot and nullify its pointer.
+ */
+void
+share_snap_close_null(share_snap_t **s_ptr)
+{
+	share_snap_t *s = *s_ptr;
+
+	if (s != NULL) {
+		share_snap_check(s);
+		share_snap_free_data(s);
+		s->magic = 0;
+		WFREE(s);
+		*s_ptr = NULL;
+	}
+}
+
+/**
+ * @return time at which the scan recorded in the snapshot started.
+ */
+time_t
+share_snap_scanned(const share_snap_t *s)
+{
+	share_snap_check(s);
+
+	return s->hdr->scanned;
+}
+
+/**
+ * @return amount of directories recorded in the snapshot.
+ */
+size_t
+share_snap_dir_count(const share_snap_t *s)
+{
+	share_snap_check(s);
+
+	return s->hdr->ndirs;
+}
+
+/**
+ * Get directory #i.
+ *
+ * @param s			the snapshot
+ * @param i			the directory index
+ * @param mtime		where the directory modification time is written
+ *
+ * @return the directory path, NULL if corrupted.
+ */
+const char *
+share_snap_dir(const share_snap_t *s, size_t i, time_t *mtime)
+{
+	const struct share_snap_dir *d;
+
+	share_snap_check(s);
+	g_assert(i < s->hdr->ndirs);
+	g_assert(mtime != NULL);
+
+	d = const_ptr_add_offset(s->hdr, s->hdr->dirs_off);
+	d += i;
+
+	*mtime = d->mtime;
+	return share_snap_string(s, d->path);
+}
+
+/**
+ * @return amount of files recorded in the snapshot.
+ */
+size_t
+share_snap_file_count(const share_snap_t *s)
+{
+	share_snap_check(s);
+
+	return s->hdr->nfiles;
+}
+
+/**
+ * @return file #i, the one whose file index is i + 1.
+ */
+const struct share_snap_file *
+share_snap_file(const share_snap_t *s, size_t i)
+{
+	const struct share_snap_file *f;
+
+	share_snap_check(s);
+	g_assert(i < s->hdr->nfiles);
+
+	f = const_ptr_add_offset(s->hdr, s->hdr->files_off);
+	return &f[i];
+}
+
+/**
+ * @return string at given offset in the string pool, NULL for
+ * SHARE_SNAP_NONE or invalid offsets.
+ */
+const char *
+share_snap_string(const share_snap_t *s, uint32 offset)
+{
+	share_snap_check(s);
+
+	if (offset >= s->hdr->strings_len)
+		return NULL;
+
+	return const_ptr_add_offset(s->hdr, s->hdr->strings_off + offset);
+}
+
+/**
+ * Get search table set image, to be given to st_image_load().
+ *
+ * @param s			the snapshot
+ * @param which		the table set
+ * @param count		where the amount of 32-bit words in the image is written
+ *
+ * @return the image.
+ */
+const uint32 *
+share_snap_st(const share_snap_t *s, enum match_set which, size_t *count)
+{
+	share_snap_check(s);
+	g_assert(UNSIGNED(which) < N_ITEMS(s->hdr->st_off));
+	g_assert(count != NULL);
+
+	*count = s->hdr->st_len[which];
+	return const_ptr_add_offset(s->hdr, s->hdr->st_off[which]);
+}
+
+/**
+ * Get QRP table bitmap.
+ *
+ * @param s			the snapshot
+ * @param slots		where the amount of slots in the table is written
+ *
+ * @return the bitmap, NULL if the snapshot holds no QRP table.
+ */
+const uint8 *
+share_snap_qrt(const share_snap_t *s, int *slots)
+{
+	share_snap_check(s);
+	g_assert(slots != NULL);
+
+	if (0 == s->hdr->qrt_slots)
+		return NULL;
+
+	*slots = s->hdr->qrt_slots;
+	return const_ptr_add_offset(s->hdr, s->hdr->qrt_off);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Persisted snapshot of the shared library.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _core_share_snap_h_
+#define _core_share_snap_h_
+
+#include "common.h"
+
+#include "matching.h"
+
+#define SHARE_SNAP_NONE		((uint32) -1)	/**< No string */
+
+/**
+ * A shared file, as recorded in the snapshot.
+ *
+ * Strings are given as offsets within the string pool.
+ */
+struct share_snap_file {
+	uint64 size;			/**< File size */
+	int64 mtime;			/**< Last modification time */
+	int64 ctime;			/**< Creation time */
+	uint32 path;			/**< Full path of the file */
+	uint32 relative_path;	/**< Relative path, or SHARE_SNAP_NONE */
+	uint32 name_nfc;		/**< NFC version of the filename */
+	uint32 name_canonic;	/**< Canonized version of the filename */
+	uint32 name_normal;		/**< Normalized aliases, or SHARE_SNAP_NONE */
+	uint32 sort_index;		/**< Index for sorted listings */
+};
+
+/**
+ * A shared file, as supplied to the snapshot writer.
+ */
+struct share_snap_info {
+	filesize_t size;
+	time_t mtime;
+	time_t ctime;
+	const char *path;
+	const char *relative_path;	/**< May be NULL */
+	const char *name_nfc;
+	const char *name_canonic;
+	const char *name_normal;	/**< May be NULL */
+	uint32 sort_index;
+};
+
+typedef struct share_snap share_snap_t;
+typedef struct share_snap_writer share_snap_writer_t;
+
+/*
+ * Public interface.
+ */
+
+share_snap_writer_t *share_snap_writer_make(time_t scanned, uint32 config);
+void share_snap_writer_dir(share_snap_writer_t *w,
+	const char *path, time_t mtime);
+void share_snap_writer_file(share_snap_writer_t *w,
+	const struct share_snap_info *info);
+void share_snap_writer_st(share_snap_writer_t *w,
+	enum match_set which, uint32 *image, size_t count);
+void share_snap_writer_qrt(share_snap_writer_t *w, uint8 *bits, int slots);
+bool share_snap_writer_close(share_snap_writer_t **w_ptr);
+void share_snap_writer_discard(share_snap_writer_t **w_ptr);
+
+share_snap_t *share_snap_open(uint32 config);
+void share_snap_close_null(share_snap_t **s_ptr);
+
+time_t share_snap_scanned(const share_snap_t *s);
+size_t share_snap_dir_count(const share_snap_t *s);
+const char *share_snap_dir(const share_snap_t *s, size_t i, time_t *mtime);
+size_t share_snap_file_count(const share_snap_t *s);
+const struct share_snap_file *share_snap_file(const share_snap_t *s, size_t i);
+const char *share_snap_string(const share_snap_t *s, uint32 offset);
+const uint32 *share_snap_st(const share_snap_t *s,
+	enum match_set which, size_t *count);
+const uint8 *share_snap_qrt(const share_snap_t *s, int *slots);
+
+#endif /* _core_share_snap_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -54,6 +54,7 @@
 #include "common.h"
 
 #include "verify.h"
+#include "gnet_stats.h"
 
 #include "if/gnet_property.h"
 #include "if/gnet_property_priv.h"
@@ -113,6 +114,7 @@ struct verify {
 
 	enum verify_status status;	/**< Used for callback multiplexing. */
 	uint8 shutdowned;			/**< Flag indicating context was shutdown */
+	uint8 resumed;				/**< Whether hashing resumed at `start' */
 
 	/* Fields copied from currently processed verify_file entry */
 	verify_callback	callback;	/**< User-specified callback function. */
@@ -157,6 +159,7 @@ struct verify_file {
 	const char *pathname;			/**< Absolute path of the file */
 	filesize_t offset;				/**< Offset to start at */
 	filesize_t amount;				/**< Amount of bytes to hash */
+	void *state;					/**< Hashing state to resume from */
 	verify_callback	callback;		/**< User-specified callback function */
 	void *user_data;				/**< Callback argument */
 };
@@ -195,6 +198,7 @@ verify_file_free(struct verify_file **ptr)
 	if (item) {
 		verify_file_check(item);
 		atom_str_free_null(&item->pathname);
+		HFREE_NULL(item->state);
 		item->magic = 0;
 		WFREE(item);
 	}
@@ -307,6 +311,9 @@ verify_status(const struct verify *ctx)
 /**
  * The callback function may call this to obtain the amount of bytes
  * that have been hashed of the current file so far.
+ *
+ * When hashing was resumed from a known state, the data prior to the
+ * starting offset is accounted for as well.
  */
 filesize_t
 verify_hashed(const struct verify *ctx)
@@ -314,7 +321,7 @@ verify_hashed(const struct verify *ctx)
 	verify_check(ctx);
 	g_assert(VERIFY_INVALID != ctx->status);
 
-	return ctx->offset - ctx->start;
+	return ctx->resumed ? ctx->offset : ctx->offset - ctx->start;
 }
 
 /**
@@ -720,6 +727,7 @@ verify_next_file(struct verify *ctx)
 {
 	struct verify_file *item;
 	bool skipped = FALSE;
+	void *state = NULL;
 
 	verify_check(ctx);
 	g_assert(NULL == ctx->file);
@@ -728,6 +736,9 @@ verify_next_file(struct verify *ctx)
 	if (item != NULL) {
 		verify_file_check(item);
 
+		state = item->state;		/* We take ownership */
+		item->state = NULL;
+		ctx->resumed = booleanize(state != NULL);
 		ctx->user_data = item->user_data;
 		ctx->callback = item->callback;
 		ctx->start = item->offset;
@@ -759,13 +770,21 @@ verify_next_file(struct verify *ctx)
 			g_debug("verifying %s digest for %s",
 				verify_hash_name(ctx), file_object_pathname(ctx->file));
 		}
-		verify_hash_init(ctx);
+		if (state != NULL) {
+			g_assert(ctx->hash.resume != NULL);
+			ctx->hash.resume(state);
+			HFREE_NULL(state);
+		} else {
+			verify_hash_init(ctx);
+		}
 		file_object_fadvise_sequential(ctx->file);
 		ctx->last_progress = ctx->started = tm_time_exact();
 	}
 	return;
 
 done:
+	HFREE_NULL(state);
+
 	if (skipped)
 		verify_shutdown(ctx);
 	else
@@ -829,6 +848,8 @@ verify_update(struct verify *ctx)
 			goto error;
 		}
 
+		gnet_stats_count_general(GNR_VERIFY_HASHED_BYTES, r);
+
 		/*
 		 * Don't inform about progress too frequently: if we're running in
 		 * a dedicated thread, the notification will issue a cross-thread RPC
@@ -1073,6 +1094,36 @@ bool
 verify_enqueue(struct verify *ctx, int high_priority,
 	const char *pathname, filesize_t offset, filesize_t amount,
 	verify_callback callback, void *user_data)
+{
+	return verify_enqueue_resume(ctx, high_priority, pathname, offset, amount,
+		NULL, 0, callback, user_data);
+}
+
+/**
+ * Enqueue file to be verified, resuming from a known hashing state.
+ *
+ * This is used when the data prior to `offset' has already been hashed:
+ * instead of being initialized, the hashing context is restored from the
+ * supplied state, whose format is specific to the hashing algorithm.
+ *
+ * @param ctx			the verification context
+ * @param high_priority	whether item should be treated quickly
+ * @param pathname		file to be verified
+ * @param offset		starting offset where verification should start
+ * @param amount		amount of data to verify in the file, starting at offset
+ * @param state			hashing state to resume from (copied), NULL if none
+ * @param state_len		length of the hashing state
+ * @param callback		callback routine to invoke in the calling thread
+ * @param user_data		context to pass to the calling routine
+ *
+ * @return TRUE if the item was enqueued, FALSE if an equivalent item was
+ * already enqueued.
+ */
+bool
+verify_enqueue_resume(struct verify *ctx, int high_priority,
+	const char *pathname, filesize_t offset, filesize_t amount,
+	const void *state, size_t state_len,
+	verify_callback callback, void *user_data)
 {
 	struct verify_file *item;
 	int inserted;
@@ -1081,6 +1132,7 @@ verify_enqueue(struct verify *ctx, int high_priority,
 	g_return_val_if_fail(pathname, FALSE);
 	g_return_val_if_fail(callback, FALSE);
 	g_return_val_if_fail(!ctx->shutdowned, FALSE);
+	g_return_val_if_fail(NULL == state || ctx->hash.resume != NULL, FALSE);
 
 	entropy_harvest_many(
 		PTRLEN(ctx), VARLEN(high_priority),
@@ -1088,6 +1140,8 @@ verify_enqueue(struct verify *ctx, int high_priority,
 		VARLEN(amount), NULL);
 
 	item = verify_file_new(pathname, offset, amount, callback, user_data);
+	if (state != NULL)
+		item->state = hcopy(state, state_len);
 
 	hash_list_lock(ctx->files_to_hash);
 
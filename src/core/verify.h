@@ -59,6 +59,7 @@ struct verify_hash {
 	void 			(*init)(filesize_t amount);
 	int  			(*update)(const void *data, size_t size);
 	int 			(*final)(void);
+	void			(*resume)(const void *state);	/**< Optional */
 };
 
 struct verify *verify_new(const struct verify_hash *);
@@ -67,6 +68,10 @@ void verify_free(struct verify **ptr);
 bool verify_enqueue(struct verify *, int high_priority,
 	const char *pathname, filesize_t offset, filesize_t filesize,
 	verify_callback callback, void *user_data);
+bool verify_enqueue_resume(struct verify *, int high_priority,
+	const char *pathname, filesize_t offset, filesize_t amount,
+	const void *state, size_t state_len,
+	verify_callback callback, void *user_data);
 
 enum verify_status verify_status(const struct verify *);
 filesize_t verify_hashed(const struct verify *);
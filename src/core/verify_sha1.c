@@ -83,11 +83,21 @@ verify_sha1_final(void)
 	return SHA_SUCCESS == ret ? 0 : -1;
 }
 
+static void
+verify_sha1_resume(const void *state)
+{
+	const SHA1_context *ctx = state;
+
+	SHA1_check(ctx);
+	verify_sha1.context = *ctx;		/* Struct copy */
+}
+
 static const struct verify_hash verify_hash_sha1 = {
 	verify_sha1_name,
 	verify_sha1_reset,
 	verify_sha1_update,
 	verify_sha1_final,
+	verify_sha1_resume,
 };
 
 int
@@ -99,6 +109,24 @@ verify_sha1_enqueue(int high_priority,
 		pathname, 0, filesize, callback, user_data);
 }
 
+/**
+ * Enqueue the SHA-1 verification of the tail of a file, the data before
+ * `offset' having already been hashed into the supplied context.
+ */
+int
+verify_sha1_enqueue_resume(int high_priority,
+	const char *pathname, filesize_t offset, filesize_t filesize,
+	const SHA1_context *context,
+	verify_callback callback, void *user_data)
+{
+	g_assert(offset <= filesize);
+	SHA1_check(context);
+
+	return verify_enqueue_resume(verify_sha1.verify, high_priority,
+		pathname, offset, filesize - offset, context, sizeof *context,
+		callback, user_data);
+}
+
 const struct sha1 *
 verify_sha1_digest(const struct verify *ctx)
 {
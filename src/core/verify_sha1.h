@@ -38,9 +38,15 @@
 
 #include "verify.h"
 
+#include "lib/sha1.h"
+
 int verify_sha1_enqueue(int high_priority,
 	const char *pathname, filesize_t filesize,
 	verify_callback callback, void *user_data);
+int verify_sha1_enqueue_resume(int high_priority,
+	const char *pathname, filesize_t offset, filesize_t filesize,
+	const SHA1_context *context,
+	verify_callback callback, void *user_data);
 
 const struct sha1 *verify_sha1_digest(const struct verify *);
 
@@ -95,6 +95,7 @@ static const struct verify_hash verify_hash_tth = {
 	verify_tth_reset,
 	verify_tth_update,
 	verify_tth_final,
+	NULL,				/* resume */
 };
 
 const struct tth *
@@ -967,8 +967,17 @@ keys_get_all(const kuid_t *id, dht_value_t **valvec, int valcnt)
 }
 
 /**
- * Fill supplied value vector with the DHT values we have under the key that
- * match the specifications: among those bearing the specified secondary keys
+ * Value fetching callback, invoked with the primary key, the DB key of the
+ * value and the DHT value type requested.
+ *
+ * @return the fetched value, NULL if not of the proper type (or expired).
+ */
+typedef void *(*keys_fetch_t)(const kuid_t *id,
+	uint64 dbkey, dht_value_type_t type);
+
+/**
+ * Fill supplied vector with the values we have under the key that match
+ * the specifications: among those bearing the specified secondary keys
  * (or all of them if no secondary keys are supplied), return only those with
  * the proper DHT value type.
  *
@@ -976,24 +985,24 @@ keys_get_all(const kuid_t *id, dht_value_t **valvec, int valcnt)
  * @param type				type of DHT value they want
  * @param secondary			optional secondary keys
  * @param secondary_count	amount of secondary keys supplied
- * @param valvec			value vector where results are stored
- * @param valcnt			size of value vector
+ * @param valvec			vector where fetched values are stored
+ * @param valcnt			size of vector
  * @param loadptr			where to write the average request load for key
  * @param cached			if non-NULL, filled with whether key was cached
+ * @param fetch				the routine fetching the value from its DB key
  *
- * @return amount of values filled into valvec.  The values are dynamically
- * created and must be freed by caller through dht_value_free().
+ * @return amount of values filled into valvec.
  */
-int
-keys_get(const kuid_t *id, dht_value_type_t type,
-	kuid_t **secondary, int secondary_count, dht_value_t **valvec, int valcnt,
-	float *loadptr, bool *cached)
+static int
+keys_fetch(const kuid_t *id, dht_value_type_t type,
+	kuid_t **secondary, int secondary_count, void **valvec, int valcnt,
+	float *loadptr, bool *cached, keys_fetch_t fetch)
 {
 	struct keyinfo *ki;
 	struct keydata *kd;
 	int i;
 	int vcnt = valcnt;
-	dht_value_t **vvec = valvec;
+	void **vvec = valvec;
 
 	g_assert(secondary_count == 0 || secondary != NULL);
 	g_assert(valvec);
@@ -1025,21 +1034,20 @@ keys_get(const kuid_t *id, dht_value_type_t type,
 
 	for (i = 0; i < secondary_count && vcnt > 0; i++) {
 		uint64 dbkey = lookup_secondary(kd, secondary[i]);
-		dht_value_t *v;
+		void *v;
 
 		if (0 == dbkey)
 			continue;
 
-		v = values_get(dbkey, type);
+		v = (*fetch)(id, dbkey, type);
 		if (v == NULL)
 			continue;
 
-		g_assert(kuid_eq(dht_value_key(v), id));
-
 		if (GNET_PROPERTY(dht_storage_debug) > 5)
-			g_debug("DHT FETCH key %s via secondary key %s has matching %s",
+			g_debug("DHT FETCH key %s via secondary key %s has matching "
+				"value DB-key %s",
 				kuid_to_hex_string(id), kuid_to_hex_string2(secondary[i]),
-				dht_value_to_string(v));
+				uint64_to_string(dbkey));
 
 		*vvec++ = v;
 		vcnt--;
@@ -1068,19 +1076,17 @@ keys_get(const kuid_t *id, dht_value_type_t type,
 
 	for (i = 0; i < kd->values && vcnt > 0; i++) {
 		uint64 dbkey = kd->dbkeys[i];
-		dht_value_t *v;
+		void *v;
 
 		g_assert(0 != dbkey);
 
-		v = values_get(dbkey, type);
+		v = (*fetch)(id, dbkey, type);
 		if (v == NULL)
 			continue;
 
-		g_assert(kuid_eq(dht_value_key(v), id));
-
 		if (GNET_PROPERTY(dht_storage_debug) > 5)
-			g_debug("DHT FETCH key %s has matching %s",
-				kuid_to_hex_string(id), dht_value_to_string(v));
+			g_debug("DHT FETCH key %s has matching value DB-key %s",
+				kuid_to_hex_string(id), uint64_to_string(dbkey));
 
 		*vvec++ = v;
 		vcnt--;
@@ -1107,6 +1113,76 @@ done:
 	return vvec - valvec;		/* Amount of entries filled */
 }
 
+/**
+ * Fetch DHT value, building it from the databases.
+ */
+static void *
+keys_fetch_value(const kuid_t *id, uint64 dbkey, dht_value_type_t type)
+{
+	dht_value_t *v;
+
+	v = values_get(dbkey, type);
+	if (v != NULL)
+		g_assert(kuid_eq(dht_value_key(v), id));
+
+	return v;
+}
+
+/**
+ * Fetch serialized DHT value from the value store.
+ */
+static void *
+keys_fetch_serialized(const kuid_t *id, uint64 dbkey, dht_value_type_t type)
+{
+	(void) id;
+
+	return values_get_serialized(dbkey, type);
+}
+
+/**
+ * Fill supplied value vector with the DHT values we have under the key that
+ * match the specifications: among those bearing the specified secondary keys
+ * (or all of them if no secondary keys are supplied), return only those with
+ * the proper DHT value type.
+ *
+ * @param id				the primary key of the value
+ * @param type				type of DHT value they want
+ * @param secondary			optional secondary keys
+ * @param secondary_count	amount of secondary keys supplied
+ * @param valvec			value vector where results are stored
+ * @param valcnt			size of value vector
+ * @param loadptr			where to write the average request load for key
+ * @param cached			if non-NULL, filled with whether key was cached
+ *
+ * @return amount of values filled into valvec.  The values are dynamically
+ * created and must be freed by caller through dht_value_free().
+ */
+int
+keys_get(const kuid_t *id, dht_value_type_t type,
+	kuid_t **secondary, int secondary_count, dht_value_t **valvec, int valcnt,
+	float *loadptr, bool *cached)
+{
+	return keys_fetch(id, type, secondary, secondary_count,
+		(void **) valvec, valcnt, loadptr, cached, keys_fetch_value);
+}
+
+/**
+ * Same as keys_get() but fill the supplied vector with the serialized
+ * values held in the value store, which can be directly copied into a
+ * message without building the DHT values.
+ *
+ * @return amount of values filled into recvec.  The records belong to the
+ * value store and are only valid until the store is modified.
+ */
+int
+keys_get_serialized(const kuid_t *id, dht_value_type_t type,
+	kuid_t **secondary, int secondary_count, vstore_rec_t **recvec, int reccnt,
+	float *loadptr, bool *cached)
+{
+	return keys_fetch(id, type, secondary, secondary_count,
+		(void **) recvec, reccnt, loadptr, cached, keys_fetch_serialized);
+}
+
 /**
  * Serialization routine for keydata.
  */
@@ -58,6 +58,9 @@ int keys_get_all(const kuid_t *id, dht_value_t **valvec, int valcnt);
 int keys_get(const kuid_t *id, dht_value_type_t type,
 	kuid_t **secondary, int secondary_count, dht_value_t **valvec, int valcnt,
 	float *loadptr, bool *cached);
+int keys_get_serialized(const kuid_t *id, dht_value_type_t type,
+	kuid_t **secondary, int secondary_count, vstore_rec_t **recvec, int reccnt,
+	float *loadptr, bool *cached);
 bool keys_within_kball(const kuid_t *id);
 bool keys_is_foreign(const kuid_t *id);
 bool keys_is_nearby(const kuid_t *id);
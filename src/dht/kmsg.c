@@ -563,7 +563,7 @@ k_send_find_node_response(
  *
  * @param n			where to send the response to
  * @param kn		the node who sent the request
- * @param vvec		base of DHT value vector
+ * @param vvec		base of serialized DHT value vector
  * @param vlen		amount of entries filled in vector
  * @param load		the EMA of the # of requests / minute for the key
  * @param cached	whether key was cached in our node (outside our k-ball)
@@ -573,7 +573,7 @@ static void
 k_send_find_value_response(
 	gnutella_node_t *n,
 	const knode_t *unused_kn,
-	dht_value_t **vvec, size_t vlen, float load, bool cached,
+	vstore_rec_t **vvec, size_t vlen, float load, bool cached,
 	const guid_t *muid)
 {
 	pmsg_t *mb;
@@ -637,12 +637,12 @@ k_send_find_value_response(
 	 * know how large the values are).
 	 */
 
-	vsort(vvec, vlen, sizeof vvec[0], dht_value_cmp);
+	vsort(vvec, vlen, sizeof vvec[0], vstore_rec_cmp);
 
 	for (i = 0; i < vlen; i++) {
 		size_t secondary_size = (vlen - i) * KUID_RAW_SIZE + 1;
-		dht_value_t *v = vvec[i];
-		size_t value_size = DHT_VALUE_HEADER_SIZE + dht_value_length(v);
+		const vstore_rec_t *vr = vvec[i];
+		size_t value_size = vstore_rec_size(vr);
 
 		g_assert((size_t) pmsg_available(mb) >= secondary_size);
 
@@ -654,15 +654,18 @@ k_send_find_value_response(
 			break;
 		}
 
-		/* That's the specs and the 61 above depends on the following... */
-		g_assert(host_addr_is_ipv4(dht_value_creator(v)->addr));
+		/*
+		 * Values are held in serialized form: this is the only copy made,
+		 * straight into the message.
+		 */
 
-		dht_value_serialize(mb, v);
+		vstore_rec_serialize(mb, vr);
 		values++;
 
 		if (GNET_PROPERTY(dht_debug) > 4)
-			g_warning("DHT packed value %d/%zu: %s", values, vlen,
-				dht_value_to_string(v));
+			g_warning("DHT packed %zu-byte \"%s\" value %d/%zu",
+				value_size, dht_value_type_to_string(vstore_rec_type(vr)),
+				values, vlen);
 	}
 
 	/*
@@ -683,13 +686,14 @@ k_send_find_value_response(
 
 		pmsg_write_u8(mb, remain);
 		for (/* empty */; i < vlen; i++) {
-			dht_value_t *v = vvec[i];
-			pmsg_write(mb, dht_value_creator(v)->id, KUID_RAW_SIZE);
+			const vstore_rec_t *vr = vvec[i];
+			pmsg_write(mb, vstore_rec_creator(vr), KUID_RAW_SIZE);
 			secondaries++;
 
 			if (GNET_PROPERTY(dht_debug) > 4)
 				g_warning("DHT packed secondary key %d/%zu for %s",
-					secondaries, remain, dht_value_to_string(v));
+					secondaries, remain,
+					kuid_to_hex_string(vstore_rec_creator(vr)));
 		}
 	} else {
 		/*
@@ -1519,7 +1523,7 @@ k_handle_find_value(knode_t *kn, gnutella_node_t *n,
 	const char *reason;
 	char msg[80];
 	dht_value_type_t type;
-	dht_value_t *vvec[MAX_VALUES_PER_KEY];
+	vstore_rec_t *vvec[MAX_VALUES_PER_KEY];
 	int vcnt = 0;
 	float load;
 	bool cached;
@@ -1628,7 +1632,7 @@ k_handle_find_value(knode_t *kn, gnutella_node_t *n,
 	 * Perform the value lookup.
 	 */
 
-	vcnt = keys_get(id, type, secondary, count,
+	vcnt = keys_get_serialized(id, type, secondary, count,
 		vvec, N_ITEMS(vvec), &load, &cached);
 
 	/*
@@ -1696,12 +1700,6 @@ cleanup:
 		WFREE_ARRAY(secondary, count);
 	}
 
-	if (vcnt) {
-		int i;
-		for (i = 0; i < vcnt; i++)
-			dht_value_free(vvec[i], TRUE);
-	}
-
 	bstr_free(&bs);
 }
 
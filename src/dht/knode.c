@@ -48,6 +48,7 @@
 #include "lib/atoms.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
+#include "lib/unsigned.h"
 #include "lib/vendors.h"
 #include "lib/walloc.h"
 
@@ -218,6 +219,55 @@ knode_can_recontact(const knode_t *kn)
 	return elapsed > grace;
 }
 
+/**
+ * Update the RTT estimators of the node with a new round-trip time sample.
+ *
+ * This is the classic TCP estimator (RFC 6298): the smoothed RTT uses a
+ * gain of 1/8 and the mean deviation a gain of 1/4, the first sample
+ * initializing the smoothed RTT and setting the deviation to half of it.
+ *
+ * @param kn		the node from which we got a reply
+ * @param sample	the measured round-trip time, in milliseconds
+ */
+void
+knode_rtt_update(knode_t *kn, uint32 sample)
+{
+	knode_check(kn);
+
+	sample = MAX(sample, 1);		/* 0 means "no RTT known yet" */
+
+	if G_UNLIKELY(0 == kn->rtt) {
+		kn->rtt = sample;
+		kn->rttvar = sample / 2;
+	} else {
+		uint32 delta = kn->rtt > sample ? kn->rtt - sample : sample - kn->rtt;
+
+		kn->rttvar = (3 * kn->rttvar + delta) / 4;
+		kn->rtt = (7 * kn->rtt + sample) / 8;
+		kn->rtt = MAX(kn->rtt, 1);
+	}
+}
+
+/**
+ * Estimate the 95th percentile of the node's round-trip time.
+ *
+ * Assuming a roughly normal distribution, the mean deviation is about 0.8
+ * times the standard deviation, so SRTT + 2 * RTTVAR approximates the
+ * mean plus 1.6 standard deviations, i.e. the 95th percentile.
+ *
+ * @return the p95 RTT estimate in milliseconds, 0 if no RTT is known yet.
+ */
+uint32
+knode_rtt_p95(const knode_t *kn)
+{
+	knode_check(kn);
+
+	if (0 == kn->rtt)
+		return 0;
+
+	return uint32_saturate_add(kn->rtt, 2 * kn->rttvar);
+}
+
 /**
  * Give a string representation of the node status.
  */
@@ -55,6 +55,8 @@ bool knode_can_recontact(const knode_t *kn);
 bool knode_is_usable(const knode_t *kn);
 bool knode_addr_is_usable(const knode_t *kn);
 double knode_still_alive_probability(const knode_t *kn);
+void knode_rtt_update(knode_t *kn, uint32 sample);
+uint32 knode_rtt_p95(const knode_t *kn);
 
 #endif /* _dht_knode_h_ */
 
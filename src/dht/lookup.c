@@ -40,6 +40,7 @@
 #include "acct.h"
 #include "keys.h"
 #include "kmsg.h"
+#include "knode.h"
 #include "kuid.h"
 #include "publish.h"
 #include "revent.h"
@@ -84,6 +85,22 @@
 #define NL_FIND_DELAY		5000	/* 5 seconds, in ms */
 #define NL_VAL_DELAY		1000	/* 1 second, in ms */
 
+/**
+ * Adaptive parallelism.
+ *
+ * The parallelism window is sized from the recent RPC loss rate so that
+ * we can expect about KDA_ALPHA replies per window, up to NL_ALPHA_MAX.
+ * Once an RPC exceeds the estimated 95th percentile of the node's RTT,
+ * it is deemed straggling and no longer accounted for in the window,
+ * allowing a speculative RPC to another node without waiting for the
+ * full RPC timeout.
+ */
+#define NL_ALPHA_MAX		(2 * KDA_ALPHA)	/* Max adaptive parallelism */
+#define NL_LOSS_SMOOTH		16		/* Smoothing period for loss rate EMA */
+#define NL_SPEC_MIN_DELAY	250		/* ms, min delay before speculating */
+#define NL_SPEC_MAX_DELAY	2500	/* ms, max delay before speculating */
+#define NL_SPEC_DEF_DELAY	1500	/* ms, when no RTT is known at all */
+
 /**
  * Maximum number of nodes from a class C network that we can return in
  * the lookup path.  This is a way to fight against ID attacks (known as
@@ -117,6 +134,18 @@ static unsigned kball_dist_proba[KUID_RAW_BITSIZE];
 
 static double log2_frequency[KDA_K][KDA_K];
 
+/**
+ * Recent RPC behaviour observed by adaptive lookups, all nodes mixed.
+ *
+ * The RTT estimators are used for nodes we never got any reply from yet,
+ * the loss rate sizes the parallelism window.
+ */
+static struct {
+	double loss;				/**< EMA of the RPC timeout rate */
+	uint32 srtt;				/**< Smoothed RTT, in ms (0 if unknown) */
+	uint32 rttvar;				/**< RTT variation, in ms */
+} lookup_adaptive;
+
 /**
  * Table keeping track of all the node lookup objects that we have created
  * and which are still running.
@@ -140,7 +169,8 @@ typedef enum {
 enum parallelism {
 	LOOKUP_STRICT = 1,			/**< Strict parallelism */
 	LOOKUP_BOUNDED,				/**< Bounded parallelism */
-	LOOKUP_LOOSE				/**< Loose parallelism */
+	LOOKUP_LOOSE,				/**< Loose parallelism */
+	LOOKUP_ADAPTIVE				/**< Adaptive bounded parallelism */
 };
 
 struct nlookup;
@@ -227,6 +257,7 @@ struct nlookup {
 	int rpc_timeouts;			/**< Amount of RPC timeouts */
 	int rpc_bad;				/**< Amount of bad RPC replies */
 	int rpc_replies;			/**< Amount of valid RPC replies */
+	int rpc_straggling;			/**< Pending RPCs deemed straggling */
 	int bw_outgoing;			/**< Amount of outgoing bandwidth used */
 	int bw_incoming;			/**< Amount of incoming bandwidth used */
 	int udp_drops;				/**< Amount of UDP packet drops */
@@ -255,8 +286,32 @@ struct nlookup {
 	map_t *pending;				/**< Nodes still pending a reply */
 	map_t *alternate;			/**< Alternate address for nodes */
 	map_t *fixed;				/**< Nodes whose contact address was fixed */
+	map_t *rpcs;				/**< Monitored RPCs (adaptive mode) */
 };
 
+typedef enum {
+	LOOKUP_RPC_MAGIC = 0x1d7a52e3U
+} lookup_rpc_magic_t;
+
+/**
+ * An RPC issued by an adaptive lookup, monitored for straggling.
+ */
+struct lookup_rpc {
+	lookup_rpc_magic_t magic;
+	nlookup_t *nl;				/**< Lookup that issued the RPC */
+	const knode_t *kn;			/**< Queried node (held in nl->pending) */
+	cevent_t *straggle_ev;		/**< Fires when RPC becomes straggling */
+	tm_t start;					/**< Time at which RPC was issued */
+	bool straggling;			/**< Whether RPC exceeded its p95 RTT */
+};
+
+static inline void
+lookup_rpc_check(const struct lookup_rpc *lr)
+{
+	g_assert(lr != NULL);
+	g_assert(LOOKUP_RPC_MAGIC == lr->magic);
+}
+
 /**
  * Operating flags for lookups.
  */
@@ -379,6 +434,7 @@ lookup_parallelism_mode_to_string(enum parallelism mode)
 	case LOOKUP_STRICT:		what = "strict"; break;
 	case LOOKUP_BOUNDED:	what = "bounded"; break;
 	case LOOKUP_LOOSE:		what = "loose"; break;
+	case LOOKUP_ADAPTIVE:	what = "adaptive"; break;
 	}
 
 	return what;
@@ -408,6 +464,31 @@ free_token(void *unused_key, void *value, void *unused_u)
 	lookup_token_free(ltok, TRUE);
 }
 
+/**
+ * Free a monitored RPC descriptor.
+ */
+static void
+lookup_rpc_free(struct lookup_rpc *lr)
+{
+	lookup_rpc_check(lr);
+
+	cq_cancel(&lr->straggle_ev);
+	lr->magic = 0;
+	WFREE(lr);
+}
+
+/**
+ * Map iterator callback to free monitored RPC descriptors.
+ */
+static void
+free_lookup_rpc(void *unused_key, void *value, void *unused_u)
+{
+	(void) unused_key;
+	(void) unused_u;
+
+	lookup_rpc_free(value);
+}
+
 /**
  * Destroy a KUID lookup.
  */
@@ -419,6 +500,16 @@ lookup_free(nlookup_t *nl)
 	if (lookup_is_fetching(nl))
 		lookup_value_free(nl, TRUE);
 
+	/*
+	 * Monitored RPCs are keyed by the KUID of nodes held in nl->pending,
+	 * so they must be disposed of before these nodes can be freed.
+	 */
+
+	if (nl->rpcs != NULL) {
+		map_foreach(nl->rpcs, free_lookup_rpc, NULL);
+		map_destroy(nl->rpcs);
+	}
+
 	map_foreach(nl->tokens, free_token, NULL);
 	patricia_foreach(nl->shortlist, knode_patricia_free, NULL);
 	map_foreach(nl->queried, knode_map_free, NULL);
@@ -427,6 +518,7 @@ lookup_free(nlookup_t *nl)
 	map_foreach(nl->pending, knode_map_free, NULL);
 	map_foreach(nl->fixed, knode_map_free, NULL);
 	patricia_foreach(nl->path, knode_patricia_free, NULL);
+
 	patricia_foreach(nl->ball, knode_patricia_free, NULL);
 
 	cq_cancel(&nl->expire_ev);
@@ -540,6 +632,52 @@ lookup_result_nth_node(const lookup_rs_t *rs, size_t n)
 	return rs->path[n].kn;
 }
 
+/**
+ * Check whether the k-closest nodes found for `kuid' are also the roots
+ * of `target', so that the result set can be reused without conducting
+ * a new lookup for `target'.
+ *
+ * This is the case when `target' shares a longer common prefix with `kuid'
+ * than any of the k-closest nodes: the subspace spanned by that prefix is
+ * then known to be empty and the closest nodes of both keys are the same,
+ * give or take the relative order of the nodes at the fringe.
+ *
+ * Security tokens being bound to the requesting host and not to the key,
+ * the tokens collected in the path remain valid for STORE operations on
+ * the other key.
+ *
+ * @param rs		the lookup result set obtained for `kuid'
+ * @param kuid		the key that was looked up
+ * @param target	the key for which we would like to reuse the result set
+ *
+ * @return TRUE if the result set can be used for `target' as well.
+ */
+bool
+lookup_result_covers(const lookup_rs_t *rs,
+	const kuid_t *kuid, const kuid_t *target)
+{
+	size_t i, common;
+
+	lookup_result_check(rs);
+
+	/*
+	 * If we do not have KDA_K nodes in the path, we did not fully converge
+	 * and cannot infer anything about the emptiness of the subspace.
+	 */
+
+	if (rs->path_len < KDA_K)
+		return FALSE;
+
+	common = kuid_common_prefix(kuid, target);
+
+	for (i = 0; i < KDA_K; i++) {
+		if (kuid_common_prefix(kuid, rs->path[i].kn->id) >= common)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
 /**
  * Add one reference to a lookup result set.
  * @return the argument
@@ -1823,6 +1961,9 @@ lookup_completed(nlookup_t *nl)
 	case LOOKUP_TOKEN:
 		break;
 	case LOOKUP_STORE:
+		gnet_stats_inc_general(GNR_DHT_STORE_ROOTS_LOOKUPS);
+		gnet_stats_count_general(GNR_DHT_STORE_ROOTS_LOOKUP_MSGS, nl->msg_sent);
+		/* FALL THROUGH */
 	case LOOKUP_NODE:
 	case LOOKUP_VALUE:
 		roots_record(nl->path, nl->kuid);
@@ -2668,11 +2809,208 @@ lookup_iterate_if_possible(nlookup_t *nl)
 		/* FALL THROUGH */
 	case LOOKUP_BOUNDED:
 	case LOOKUP_LOOSE:
+	case LOOKUP_ADAPTIVE:
 		lookup_iterate(nl);
 		break;
 	}
 }
 
+/**
+ * @return the size of the parallelism window for adaptive lookups.
+ */
+static int
+lookup_adaptive_alpha(void)
+{
+	double loss = MIN(lookup_adaptive.loss, 0.5);
+	int alpha = (int) (KDA_ALPHA / (1.0 - loss) + 0.5);
+
+	return CLAMP(alpha, KDA_ALPHA, NL_ALPHA_MAX);
+}
+
+/**
+ * Record the outcome of a monitored RPC in the adaptive statistics.
+ *
+ * @param lr		the monitored RPC
+ * @param type		whether we got a reply or a timeout
+ */
+static void
+lookup_adaptive_record(const struct lookup_rpc *lr, enum dht_rpc_ret type)
+{
+	lookup_rpc_check(lr);
+
+	if (DHT_RPC_TIMEOUT == type) {
+		lookup_adaptive.loss += (1.0 - lookup_adaptive.loss) / NL_LOSS_SMOOTH;
+	} else {
+		uint32 sample;
+		tm_t now;
+
+		lookup_adaptive.loss -= lookup_adaptive.loss / NL_LOSS_SMOOTH;
+
+		/*
+		 * Same RTT estimators as the ones computed on each node.
+		 */
+
+		tm_now_exact(&now);
+		sample = MAX(tm_elapsed_ms(&now, &lr->start), 1);
+
+		if G_UNLIKELY(0 == lookup_adaptive.srtt) {
+			lookup_adaptive.srtt = sample;
+			lookup_adaptive.rttvar = sample / 2;
+		} else {
+			uint32 srtt = lookup_adaptive.srtt;
+			uint32 delta = srtt > sample ? srtt - sample : sample - srtt;
+
+			lookup_adaptive.rttvar = (3 * lookup_adaptive.rttvar + delta) / 4;
+			lookup_adaptive.srtt = MAX((7 * srtt + sample) / 8, 1);
+		}
+	}
+}
+
+/**
+ * @return the delay after which an RPC to the node is considered straggling,
+ * in milliseconds.
+ */
+static int
+lookup_straggle_delay(const knode_t *kn)
+{
+	uint32 delay;
+
+	STATIC_ASSERT(NL_SPEC_MAX_DELAY < DHT_RPC_MINDELAY);
+
+	delay = knode_rtt_p95(kn);
+
+	if (0 == delay) {
+		if (0 == lookup_adaptive.srtt)
+			delay = NL_SPEC_DEF_DELAY;
+		else
+			delay = lookup_adaptive.srtt + 2 * lookup_adaptive.rttvar;
+	}
+
+	return CLAMP(delay, NL_SPEC_MIN_DELAY, NL_SPEC_MAX_DELAY);
+}
+
+/**
+ * @return whether the shortlist still holds a node we could query.
+ */
+static bool
+lookup_has_candidate(const nlookup_t *nl)
+{
+	patricia_iter_t *iter;
+	bool found = FALSE;
+
+	iter = patricia_tree_iterator(nl->shortlist, TRUE);
+
+	while (patricia_iter_has_next(iter)) {
+		const knode_t *kn = patricia_iter_next_value(iter);
+
+		if (knode_can_recontact(kn) && !map_contains(nl->queried, kn->id)) {
+			found = TRUE;
+			break;
+		}
+	}
+
+	patricia_iterator_release(&iter);
+	return found;
+}
+
+/**
+ * Callout queue callback invoked when a monitored RPC exceeds the
+ * estimated 95th percentile of the node's RTT.
+ */
+static void
+lookup_rpc_straggling(cqueue_t *cq, void *obj)
+{
+	struct lookup_rpc *lr = obj;
+	nlookup_t *nl = lr->nl;
+
+	lookup_rpc_check(lr);
+	lookup_check(nl);
+
+	cq_zero(cq, &lr->straggle_ev);
+	lr->straggling = TRUE;
+	nl->rpc_straggling++;
+
+	gnet_stats_inc_general(GNR_DHT_LOOKUP_STRAGGLING_RPCS);
+
+	if (GNET_PROPERTY(dht_lookup_debug) > 2) {
+		g_debug("DHT LOOKUP[%s] RPC to %s straggling (RTT=%u ms, var=%u ms)",
+			nid_to_string(&nl->lid), knode_to_string(lr->kn),
+			lr->kn->rtt, lr->kn->rttvar);
+	}
+
+	/*
+	 * The straggling RPC no longer counts in the parallelism window, so
+	 * we may now be able to send another RPC, provided we are still in
+	 * the lookup phase and there is someone left to query.
+	 */
+
+	if (
+		lookup_is_fetching(nl) ||
+		(nl->flags & (NL_F_DELAYED | NL_F_COMPLETED)) ||
+		!lookup_has_candidate(nl)
+	)
+		return;
+
+	lookup_iterate(nl);
+}
+
+/**
+ * Start monitoring an RPC sent to the node by an adaptive lookup.
+ */
+static void
+lookup_rpc_monitor(nlookup_t *nl, const knode_t *kn)
+{
+	struct lookup_rpc *lr;
+
+	lookup_check(nl);
+	knode_check(kn);
+	g_assert(LOOKUP_ADAPTIVE == nl->mode);
+
+	if G_UNLIKELY(NULL == nl->rpcs)
+		nl->rpcs = map_create_patricia(KUID_RAW_BITSIZE);
+
+	g_assert(!map_contains(nl->rpcs, kn->id));
+
+	WALLOC0(lr);
+	lr->magic = LOOKUP_RPC_MAGIC;
+	lr->nl = nl;
+	lr->kn = kn;
+	tm_now_exact(&lr->start);
+	lr->straggle_ev = cq_main_insert(lookup_straggle_delay(kn),
+		lookup_rpc_straggling, lr);
+
+	map_insert(nl->rpcs, kn->id, lr);
+}
+
+/**
+ * Stop monitoring the RPC sent to the node, if any.
+ *
+ * @return the monitored RPC descriptor, which the caller must free through
+ * lookup_rpc_free(), NULL if the RPC to that node was not monitored.
+ */
+static struct lookup_rpc *
+lookup_rpc_unmonitor(nlookup_t *nl, const knode_t *kn)
+{
+	struct lookup_rpc *lr;
+
+	if (NULL == nl->rpcs)
+		return NULL;
+
+	lr = map_lookup(nl->rpcs, kn->id);
+	if (NULL == lr)
+		return NULL;
+
+	lookup_rpc_check(lr);
+	map_remove(nl->rpcs, kn->id);
+
+	if (lr->straggling) {
+		g_assert(nl->rpc_straggling > 0);
+		nl->rpc_straggling--;
+	}
+
+	return lr;
+}
+
 /**
  * After an RPC failure to node ``kn'', retry with the alternate contact ``an''.
  *
@@ -3485,6 +3823,8 @@ static void
 lk_msg_dropped(void *obj, knode_t *kn, pmsg_t *unused_mb)
 {
 	nlookup_t *nl = obj;
+	struct lookup_rpc *lr;
+
 	lookup_check(nl);
 
 	(void) unused_mb;
@@ -3502,6 +3842,10 @@ lk_msg_dropped(void *obj, knode_t *kn, pmsg_t *unused_mb)
 	nl->msg_dropped++;
 	nl->udp_drops++;
 
+	lr = lookup_rpc_unmonitor(nl, kn);
+	if (lr != NULL)
+		lookup_rpc_free(lr);
+
 	if (map_remove(nl->queried, kn->id))
 		knode_refcnt_dec(kn);
 	if (map_remove(nl->pending, kn->id))
@@ -3564,6 +3908,7 @@ lk_handling_rpc(void *obj, enum dht_rpc_ret type,
 	const knode_t *kn, uint32 hop)
 {
 	nlookup_t *nl = obj;
+	struct lookup_rpc *lr;
 	bool removed;
 
 	lookup_check(nl);
@@ -3579,6 +3924,12 @@ lk_handling_rpc(void *obj, enum dht_rpc_ret type,
 	}
 	nl->rpc_pending--;
 
+	lr = lookup_rpc_unmonitor(nl, kn);
+	if (lr != NULL) {
+		lookup_adaptive_record(lr, type);
+		lookup_rpc_free(lr);
+	}
+
 	removed = map_remove(nl->pending, kn->id);
 	g_assert(removed);
 	knode_refcnt_dec(kn);		/* Was referenced in nl->pending */
@@ -3831,16 +4182,16 @@ lk_iterate(void *obj, enum dht_rpc_ret type, uint32 hop)
 		return;
 
 	/*
-	 * If we're in a bounded parallelism mode, we may always iterate after
-	 * receiving a reply or a timeout since we enforce a maximum number of
-	 * outstanding requests.
+	 * If we're in a bounded or adaptive parallelism mode, we may always
+	 * iterate after receiving a reply or a timeout since we enforce a
+	 * maximum number of outstanding requests.
 	 *
 	 * Otherwise, after a timeout or when we got a reply from a previous hop,
 	 * we never iterate unless there are no more pending RPCs.
 	 */
 
 	if (
-		nl->mode != LOOKUP_BOUNDED &&
+		nl->mode != LOOKUP_BOUNDED && nl->mode != LOOKUP_ADAPTIVE &&
 		(DHT_RPC_TIMEOUT == type || hop != nl->hops)
 	) {
 		if (0 == nl->rpc_pending) {
@@ -3896,6 +4247,14 @@ lookup_send(nlookup_t *nl, knode_t *kn)
 	map_insert(nl->queried, kn->id, knode_refcnt_inc(kn));
 	map_insert(nl->pending, kn->id, knode_refcnt_inc(kn));
 
+	/*
+	 * Monitoring must start before sending since the message can be
+	 * synchronously dropped, which will stop the monitoring.
+	 */
+
+	if (LOOKUP_ADAPTIVE == nl->mode)
+		lookup_rpc_monitor(nl, kn);
+
 	switch (nl->type) {
 	case LOOKUP_NODE:
 	case LOOKUP_STORE:
@@ -4005,6 +4364,7 @@ lookup_iterate(nlookup_t *nl)
 	pslist_t *sl;
 	int i = 0;
 	int alpha = KDA_ALPHA;
+	int speculative = 0;
 	char reason[80];
 	int reason_len;
 
@@ -4030,11 +4390,21 @@ lookup_iterate(nlookup_t *nl)
 
 	/*
 	 * Enforce bounded parallelism here.
+	 *
+	 * In adaptive mode, the window is dynamically sized and straggling RPCs
+	 * do not count as outstanding: any RPC we can send because of them is
+	 * a speculative one.
 	 */
 
-	if (LOOKUP_BOUNDED == nl->mode) {
+	if (LOOKUP_ADAPTIVE == nl->mode) {
+		alpha = lookup_adaptive_alpha() - nl->rpc_pending;
+		speculative = MIN(nl->rpc_straggling, alpha + nl->rpc_straggling);
+		alpha += nl->rpc_straggling;
+	} else if (LOOKUP_BOUNDED == nl->mode) {
 		alpha -= nl->rpc_pending;
+	}
 
+	if (LOOKUP_ADAPTIVE == nl->mode || LOOKUP_BOUNDED == nl->mode) {
 		if (alpha <= 0) {
 			if (GNET_PROPERTY(dht_lookup_debug) > 2)
 				g_debug("DHT LOOKUP[%s] not iterating yet (%d RPC%s pending)",
@@ -4104,6 +4474,15 @@ lookup_iterate(nlookup_t *nl)
 	nl->flags &= ~NL_F_SENDING;
 	patricia_iterator_release(&iter);
 
+	/*
+	 * The last RPCs we could send are the speculative ones, allowed only
+	 * because some of the outstanding RPCs are straggling.
+	 */
+
+	speculative = i - (alpha - speculative);
+	if (speculative > 0)
+		gnet_stats_count_general(GNR_DHT_LOOKUP_SPECULATIVE_RPCS, speculative);
+
 	/*
 	 * Remove the nodes to whom we sent a message, or which we want to ignore.
 	 */
@@ -4514,7 +4893,7 @@ lookup_find_value(
 	nl->amount = KDA_K;
 	nl->u.fv.ok = ok;
 	nl->u.fv.vtype = type;
-	nl->mode = LOOKUP_LOOSE;	/* Converge quickly */
+	nl->mode = LOOKUP_ADAPTIVE;	/* Converge quickly, bypass stragglers */
 
 	if (!lookup_load_shortlist(nl)) {
 		lookup_free(nl);
@@ -298,8 +298,8 @@ rpc_cb_free(struct rpc_cb *rcb, bool in_shutdown)
 
 /**
  * Compute a suitable timeout for the RPC call, in milliseconds, based
- * on the average RTT we have measured in the past for that node and the
- * amount of RPC timeouts that we have seen so far.
+ * on the smoothed RTT and RTT variation we have measured in the past for
+ * that node and the amount of RPC timeouts that we have seen so far.
  */
 static int
 rpc_delay(const knode_t *kn)
@@ -322,10 +322,17 @@ rpc_delay(const knode_t *kn)
 	if (kn->rpc_timeouts)
 		timeout = 1 << (MIN(kn->rpc_timeouts, 10) + 8);
 
-	if (kn->rtt)
-		timeout = uint32_saturate_add(timeout, 3 * kn->rtt);
-	else
+	/*
+	 * The retransmission timeout computed by TCP is SRTT + 4 * RTTVAR.
+	 * We add it to the minimum delay computed above.
+	 */
+
+	if (kn->rtt) {
+		timeout = uint32_saturate_add(timeout,
+			uint32_saturate_add(kn->rtt, 4 * kn->rttvar));
+	} else {
 		timeout = DHT_RPC_FIRSTDELAY;
+	}
 
 	STATIC_ASSERT(DHT_RPC_FIRSTDELAY <= DHT_RPC_MAXDELAY);
 
@@ -671,13 +678,14 @@ dht_rpc_answer(const guid_t *muid,
 
 		/*
 		 * If the node from which we got a reply is in the routing table,
-		 * update the RTT EMA, since it took longer than expected to get a
-		 * reply -- we want to do better next time at projecting a suitable RTT.
+		 * update the RTT estimators, since it took longer than expected to
+		 * get a reply -- we want to do better next time at projecting a
+		 * suitable RTT.
 		 */
 
 		if (KNODE_UNKNOWN != kn->status) {
 			tm_now_exact(&now);
-			kn->rtt += (tm_elapsed_ms(&now, &rcb->start) >> 1) - (kn->rtt >> 1);
+			knode_rtt_update(kn, tm_elapsed_ms(&now, &rcb->start));
 		}
 
 		cq_expire(rcb->timeout);		/* Will free up `rcb' */
@@ -758,9 +766,7 @@ dht_rpc_answer(const guid_t *muid,
 	}
 
 	/*
-	 * Exponential moving average for RTT is computed on the last n=3 terms.
-	 * The smoothing factor, sm=2/(n+1), is therefore 0.5, which is easy
-	 * to compute.
+	 * Update the smoothed RTT and its variation, as TCP does.
 	 *
 	 * Note that we use the starting point of the RPC, not the time at which
 	 * we actually sent the message from the queue because we also want to
@@ -770,7 +776,7 @@ dht_rpc_answer(const guid_t *muid,
 	tm_now_exact(&now);
 
 	rn->rpc_timeouts = 0;
-	rn->rtt += (tm_elapsed_ms(&now, &rcb->start) >> 1) - (rn->rtt >> 1);
+	knode_rtt_update(rn, tm_elapsed_ms(&now, &rcb->start));
 
 	/*
 	 * If the node from which we got a reply is in the routing table and
@@ -779,7 +785,7 @@ dht_rpc_answer(const guid_t *muid,
 
 	if (KNODE_UNKNOWN != kn->status && kn != rn) {
 		kn->rpc_timeouts = 0;
-		kn->rtt += (tm_elapsed_ms(&now, &rcb->start) >> 1) - (kn->rtt >> 1);
+		knode_rtt_update(kn, tm_elapsed_ms(&now, &rcb->start));
 	}
 
 	/*
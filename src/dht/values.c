@@ -70,6 +70,7 @@
 #include "kuid.h"
 #include "routing.h"
 #include "stable.h"
+#include "vstore.h"
 
 #include "if/gnet_property.h"
 #include "if/gnet_property_priv.h"
@@ -986,6 +987,7 @@ delete_valuedata(uint64 dbkey, bool has_expired)
 
 	keys_remove_value(&vd->id, &vd->cid, dbkey);
 
+	vstore_remove(dbkey);
 	dbmw_delete(db_rawdata, &dbkey);
 	dbmw_delete(db_valuedata, &dbkey);
 }
@@ -1018,14 +1020,29 @@ values_reclaim_expired(void)
 	hset_foreach_remove(expired, reclaim_dbkey, NULL);
 }
 
+static void values_expire(uint64 dbkey, const struct valuedata *vd);
+
 /**
  *  Callout queue periodic event for value expiration.
  */
 static bool
 values_periodic_expire(void *unused_obj)
 {
+	time_t now = tm_time();
+	uint64 dbkey;
+
 	(void) unused_obj;
 
+	/*
+	 * The value store keeps its values in an expiry-ordered heap, so we
+	 * can spot all these that expired since last time without waiting
+	 * for them to be looked up.  Values not loaded in the store are
+	 * handled when their key expires.
+	 */
+
+	while (0 != (dbkey = vstore_expire_next(now)))
+		values_expire(dbkey, NULL);
+
 	values_reclaim_expired();
 	return TRUE;		/* Keep calling */
 }
@@ -1036,16 +1053,26 @@ values_periodic_expire(void *unused_obj)
 static void
 log_expired_value_stats(uint64 dbkey, const struct valuedata *vd)
 {
+	const vstore_rec_t *vr;
+	uint32 n_requests;
+
 	if (NULL == vd)
 		return;
 
+	/*
+	 * Requests served directly from the value store are accounted there.
+	 */
+
+	vr = vstore_get(dbkey);
+	n_requests = vd->n_requests + (NULL == vr ? 0 : vstore_rec_requests(vr));
+
 	g_debug("DHT STORE expiring \"%s\" %s "
 		"life=%s, republish#=%u, replication#=%u, request#=%u, dbkey=%s",
 		dht_value_type_to_string(vd->type),
 		kuid_to_hex_string(&vd->id),
 		compact_time(delta_time(tm_time(), vd->created)),
 		(unsigned) vd->n_republish, (unsigned) vd->n_replication,
-		(unsigned) vd->n_requests, uint64_to_string(dbkey));
+		(unsigned) n_requests, uint64_to_string(dbkey));
 
 	if (GNET_PROPERTY(dht_storage_debug) > 1) {
 		uint32 avg_publish = 0;
@@ -1069,6 +1096,9 @@ log_expired_value_stats(uint64 dbkey, const struct valuedata *vd)
  *
  * The recorded keys are deleted asynchronously in the background regularily,
  * to avoid perturbation in the caller's data structures.
+ *
+ * @param dbkey		the DB key of the value
+ * @param vd		the value data, NULL to fetch them if needed for logging
  */
 static void
 values_expire(uint64 dbkey, const struct valuedata *vd)
@@ -1079,7 +1109,7 @@ values_expire(uint64 dbkey, const struct valuedata *vd)
 		return;
 
 	if (GNET_PROPERTY(dht_storage_debug))
-		log_expired_value_stats(dbkey, vd);
+		log_expired_value_stats(dbkey, NULL == vd ? get_valuedata(dbkey) : vd);
 
 	if (GNET_PROPERTY(dht_storage_debug) > 2)
 		g_debug("DHT value DB-key %s expired", uint64_to_string(dbkey));
@@ -1123,6 +1153,28 @@ bool
 values_has_expired(uint64 dbkey, time_t now, time_t *expire)
 {
 	struct valuedata *vd;
+	const vstore_rec_t *vr;
+
+	/*
+	 * Avoid fetching and deserializing the value data when the value is
+	 * held in the value store.
+	 */
+
+	vr = vstore_get(dbkey);
+
+	if (vr != NULL) {
+		time_t vexpire = vstore_rec_expire(vr);
+
+		if (expire != NULL)
+			*expire = vexpire;
+
+		if (delta_time(now, vexpire) >= 0)  {
+			values_expire(dbkey, NULL);
+			return TRUE;
+		}
+
+		return FALSE;
+	}
 
 	vd = get_valuedata(dbkey);
 
@@ -1697,13 +1749,19 @@ values_publish(const knode_t *kn, const dht_value_t *v)
 	 */
 
 	if (check_data) {
+		const vstore_rec_t *vr;
 		size_t length;
-		void *data;
+		const void *data;
 
 		if (values_has_expired(dbkey, tm_time(), NULL))
 			goto expired;
 
-		data = dbmw_read(db_rawdata, &dbkey, &length);
+		vr = vstore_get(dbkey);
+
+		if (vr != NULL)
+			data = vstore_rec_data(vr, &length);
+		else
+			data = dbmw_read(db_rawdata, &dbkey, &length);
 
 		if G_UNLIKELY(NULL == data) {
 			s_warning_once_per(LOG_PERIOD_MINUTE,
@@ -1739,6 +1797,7 @@ values_publish(const knode_t *kn, const dht_value_t *v)
 		g_assert(v->length == vd->length);	/* Ensured by preceding code */
 
 		dbmw_write(db_rawdata, &dbkey, deconstify_pointer(v->data), v->length);
+		vstore_put(dbkey, v, vd->expire);
 	}
 
 	dbmw_write(db_valuedata, &dbkey, vd, sizeof *vd);
@@ -1867,6 +1926,71 @@ done:
 	return status;
 }
 
+/**
+ * Build DHT value from its value data and the raw data held in the database.
+ *
+ * @param dbkey		the 64-bit DB key
+ * @param vd		the value data
+ *
+ * @return the DHT value, or NULL on database error.
+ */
+static dht_value_t *
+values_make(uint64 dbkey, const struct valuedata *vd)
+{
+	void *vdata = NULL;
+	knode_t *creator;
+	dht_value_t *v;
+
+	if (vd->length) {
+		size_t length;
+		void *data;
+
+		data = dbmw_read(db_rawdata, &dbkey, &length);
+
+		if G_UNLIKELY(NULL == data) {
+			s_warning_once_per(LOG_PERIOD_MINUTE,
+				"DBMW \"%s\" I/O error, %s() aborted",
+				dbmw_name(db_rawdata), G_STRFUNC);
+			return NULL;		/* I/O error or corrupted DB */
+		}
+
+		g_assert(data);
+		g_assert(length == vd->length);		/* Or our bookkeeping is faulty */
+
+		vdata = wcopy(data, length);
+	}
+
+	creator = knode_new(&vd->cid, 0, vd->addr, vd->port, vd->vcode,
+		vd->major, vd->minor);
+
+	v = dht_value_make(creator, &vd->id, vd->type,
+		vd->value_major, vd->value_minor, vdata, vd->length);
+
+	knode_free(creator);
+	return v;
+}
+
+/**
+ * Record value in the value store, building it from the databases.
+ *
+ * @return TRUE if value was recorded.
+ */
+static bool
+values_vstore_load(uint64 dbkey, const struct valuedata *vd)
+{
+	dht_value_t *v;
+	bool ok;
+
+	v = values_make(dbkey, vd);
+	if (NULL == v)
+		return FALSE;
+
+	ok = vstore_put(dbkey, v, vd->expire);
+	dht_value_free(v, TRUE);
+
+	return ok;
+}
+
 /**
  * Get DHT value from 64-bit DB key if of proper type.
  *
@@ -1879,9 +2003,6 @@ dht_value_t *
 values_get(uint64 dbkey, dht_value_type_t type)
 {
 	struct valuedata *vd;
-	void *vdata = NULL;
-	knode_t *creator;
-	dht_value_t *v;
 
 	g_assert(dbkey != 0);		/* 0 is a special marker, not a valid key */
 
@@ -1913,33 +2034,57 @@ values_get(uint64 dbkey, dht_value_type_t type)
 	vd->n_requests++;
 	dbmw_write(db_valuedata, &dbkey, vd, sizeof *vd);
 
-	if (vd->length) {
-		size_t length;
-		void *data;
+	return values_make(dbkey, vd);
+}
 
-		data = dbmw_read(db_rawdata, &dbkey, &length);
+/**
+ * Get serialized DHT value from 64-bit DB key if of proper type.
+ *
+ * This is the fast path used to serve FIND_VALUE requests: the value is
+ * taken from the value store, in its serialized form, and no database
+ * access is required unless the value is missing from the store.
+ *
+ * @param dbkey		the 64-bit DB key
+ * @param type		either DHT_VT_ANY or the type we want
+ *
+ * @return the value record, or NULL if type is not matching.
+ */
+vstore_rec_t *
+values_get_serialized(uint64 dbkey, dht_value_type_t type)
+{
+	vstore_rec_t *vr;
 
-		if G_UNLIKELY(NULL == data) {
-			s_warning_once_per(LOG_PERIOD_MINUTE,
-				"DBMW \"%s\" I/O error, %s() aborted",
-				dbmw_name(db_rawdata), G_STRFUNC);
-			return NULL;		/* I/O error or corrupted DB */
-		}
+	g_assert(dbkey != 0);		/* 0 is a special marker, not a valid key */
 
-		g_assert(data);
-		g_assert(length == vd->length);		/* Or our bookkeeping is faulty */
+	vr = vstore_get(dbkey);
 
-		vdata = wcopy(data, length);
+	if G_UNLIKELY(NULL == vr) {
+		struct valuedata *vd = get_valuedata(dbkey);
+
+		if (NULL == vd)
+			return NULL;		/* DB failure */
+
+		if (!values_vstore_load(dbkey, vd))
+			return NULL;
+
+		vr = vstore_get(dbkey);
+		g_assert(vr != NULL);
 	}
 
-	creator = knode_new(&vd->cid, 0, vd->addr, vd->port, vd->vcode,
-		vd->major, vd->minor);
+	if (type != DHT_VT_ANY && type != vstore_rec_type(vr))
+		return NULL;
 
-	v = dht_value_make(creator, &vd->id, vd->type,
-		vd->value_major, vd->value_minor, vdata, vd->length);
+	/*
+	 * Lazy expiration, as in values_get().
+	 */
 
-	knode_free(creator);
-	return v;
+	if (tm_time() >= vstore_rec_expire(vr)) {
+		values_expire(dbkey, NULL);
+		return NULL;
+	}
+
+	vstore_rec_served(vr);
+	return vr;
 }
 
 /**
@@ -2029,6 +2174,15 @@ values_reload(void *key, void *value, size_t u_len, void *data)
 	acct_net_update(values_per_class_c, vd->addr, NET_CLASS_C_MASK, +1);
 	acct_net_update(values_per_ip, vd->addr, NET_IPv4_MASK, +1);
 
+	/*
+	 * When DHT storage is kept on disk, the value store is filled lazily
+	 * as values are requested, to avoid mapping all the values we hold.
+	 * Values not in the store will expire through the key expiration.
+	 */
+
+	if (GNET_PROPERTY(dht_storage_in_memory))
+		values_vstore_load(*dbk, vd);
+
 	return FALSE;		/* Keep value entry */
 
 delete_value:
@@ -2116,6 +2270,7 @@ values_init(void)
 	values_per_ip = acct_net_create();
 	values_per_class_c = acct_net_create();
 	expired = hset_create_any(uint64_hash, NULL, uint64_eq);
+	vstore_init();
 
 	values_expire_ev = cq_periodic_main_add(EXPIRE_PERIOD * 1000,
 		values_periodic_expire, NULL);
@@ -2210,6 +2365,7 @@ values_close(void)
 	acct_net_free_null(&values_per_ip);
 	acct_net_free_null(&values_per_class_c);
 	cq_periodic_remove(&values_expire_ev);
+	vstore_close();
 	values_managed = 0;
 
 	gnet_stats_set_general(GNR_DHT_VALUES_HELD, 0);
@@ -37,6 +37,8 @@
 #include "if/dht/value.h"
 #include "if/dht/lookup.h"
 
+#include "vstore.h"
+
 #include "lib/bstr.h"
 #include "lib/pmsg.h"
 
@@ -54,6 +56,7 @@ size_t values_count(void);
 
 uint16 values_store(const knode_t *kn, const dht_value_t *v, bool token);
 dht_value_t *values_get(uint64 dbkey, dht_value_type_t type);
+vstore_rec_t *values_get_serialized(uint64 dbkey, dht_value_type_t type);
 void values_reclaim_expired(void);
 bool values_has_expired(uint64 dbkey, time_t now, time_t *expire);
 void values_sync(void);
@@ -0,0 +1,827 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup dht
+ * @file
+ *
+ * In-core store of serialized DHT values.
+ *
+ * The value meta data and the raw payloads are persisted in the DBMW
+ * databases managed by values.c, but serving a FIND_VALUE from there
+ * requires fetching and deserializing two records per value, then building
+ * a DHT value which is finally serialized again into the reply.
+ *
+ * This store keeps, for each value we hold, a small record indexed by the
+ * 64-bit DB key of the value, which refers to the value already serialized
+ * in its wire format.  Serving a value is then just a matter of copying the
+ * serialized form into the reply.
+ *
+ * The serialized forms are kept in an arena, allocated by multiples of
+ * VSTORE_GRAIN bytes so that each value only uses the space it needs.
+ * Freed blocks are kept in per-size free lists, larger blocks being split
+ * when no block of the proper size is available.  Blocks are referred to
+ * by their offset within the arena, since the arena moves when it grows.
+ *
+ * Unless DHT storage is configured to be kept in memory, the arena is a
+ * shared memory mapping of a file in the DHT database directory, so that
+ * the kernel can page serialized values out instead of keeping them all
+ * resident.  That file is a mere cache, recreated from the databases at
+ * each startup.
+ *
+ * Records are also linked into an expiry-ordered binary heap, so that
+ * expired values can be identified without probing all the values.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "vstore.h"
+#include "kmsg.h"
+#include "values.h"
+
+#include "if/gnet_property_priv.h"
+#include "if/core/settings.h"		/* For settings_dht_db_dir() */
+
+#include "lib/fd.h"
+#include "lib/file.h"
+#include "lib/halloc.h"
+#include "lib/hikset.h"
+#include "lib/path.h"
+#include "lib/pmsg.h"
+#include "lib/stringify.h"
+#include "lib/unsigned.h"
+#include "lib/vmm.h"
+#include "lib/walloc.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+#define VSTORE_HEAP_MIN		1024		/**< Initial expiry heap size */
+#define VSTORE_GRAIN		16			/**< Arena allocation granularity */
+#define VSTORE_ARENA_MIN	(256 * 1024)	/**< Initial arena size */
+#define VSTORE_FILE			"dht_vstore"	/**< Arena backing file */
+
+/**
+ * Maximum size of a serialized value we can store.
+ *
+ * The DHT value header is normally of fixed size since the creator's address
+ * must be an IPv4 one, but we leave room for an IPv6 address anyway.
+ */
+#define VSTORE_WIRE_MAX		(DHT_VALUE_MAX_SERIAL_SIZE + 12)
+
+/**
+ * Amount of free lists: blocks of n grains are in list n.
+ */
+#define VSTORE_CLASSES	((VSTORE_WIRE_MAX + VSTORE_GRAIN - 1) / VSTORE_GRAIN + 1)
+
+/**
+ * Offset of the creator's KUID within the serialized value, which starts
+ * with the serialized contact: vendor code (4 bytes), major and minor
+ * version (1 byte each), then the KUID.
+ */
+#define VSTORE_CREATOR_OFFSET	6
+
+typedef enum { VSTORE_REC_MAGIC = 0x1b5e2f47U } vstore_rec_magic_t;
+
+/**
+ * A value record.
+ *
+ * The serialized value lives in the arena, at offset `off'.  The data
+ * payload of the value sits at the tail of the serialized form.
+ */
+struct vstore_rec {
+	vstore_rec_magic_t magic;
+	uint32 heap;				/**< Index in expiry heap, plus one */
+	uint64 dbkey;				/**< The 64-bit DB key of the value */
+	time_t expire;				/**< Expiration time */
+	size_t off;					/**< Offset of serialized value in arena */
+	dht_value_type_t type;		/**< Type of value */
+	uint32 n_requests;			/**< Amount of times value was served */
+	uint16 size;				/**< Length of serialized value */
+	uint16 length;				/**< Length of value data */
+};
+
+static inline void
+vstore_rec_check(const struct vstore_rec * const vr)
+{
+	g_assert(vr != NULL);
+	g_assert(VSTORE_REC_MAGIC == vr->magic);
+}
+
+/**
+ * The value store.
+ */
+static struct {
+	hikset_t *records;			/**< Records, indexed by DB key */
+	char *base;					/**< Arena base */
+	size_t size;				/**< Arena size */
+	size_t top;					/**< Arena space never allocated starts here */
+	size_t used;				/**< Arena space used by values */
+	size_t free[VSTORE_CLASSES];	/**< Free lists (offset + 1, 0 if empty) */
+	char *path;					/**< Arena backing file, NULL if anonymous */
+	int fd;						/**< Arena backing file descriptor */
+	struct vstore_rec **heap;	/**< Expiry heap, earliest expiration first */
+	size_t heap_count;			/**< Amount of records in the heap */
+	size_t heap_size;			/**< Allocated heap slots */
+} vstore;
+
+/***
+ *** Arena.
+ ***/
+
+/**
+ * @return amount of grains needed to hold `len' bytes.
+ */
+static inline size_t
+vstore_grains(size_t len)
+{
+	return (len + VSTORE_GRAIN - 1) / VSTORE_GRAIN;
+}
+
+/**
+ * @return pointer to arena block at given offset.
+ */
+static inline void *
+vstore_block(size_t off)
+{
+	g_assert(off < vstore.top);
+
+	return &vstore.base[off];
+}
+
+/**
+ * Stop using the backing file, keeping the arena in anonymous memory.
+ *
+ * @param size		the size of the anonymous arena to allocate
+ */
+static void
+vstore_arena_unmap(size_t size)
+{
+	char *p;
+
+	g_assert(vstore.path != NULL);
+	g_assert(size >= vstore.top);
+
+	p = vmm_alloc(size);
+
+	if (vstore.base != NULL) {
+		memcpy(p, vstore.base, vstore.top);
+		vmm_munmap(vstore.base, vstore.size);
+	}
+
+	fd_forget_and_close(&vstore.fd);
+	unlink(vstore.path);
+	HFREE_NULL(vstore.path);
+
+	vstore.base = p;
+	vstore.size = size;
+}
+
+/**
+ * Grow the arena, so that at least `need' bytes are available after `top'.
+ */
+static void
+vstore_arena_grow(size_t need)
+{
+	size_t size = MAX(VSTORE_ARENA_MIN, vstore.size);
+
+	while (size - vstore.top < need)
+		size *= 2;
+
+	if (vstore.path != NULL) {
+		void *p = MAP_FAILED;
+
+		/*
+		 * The file mapping is re-established with its new size.  Records
+		 * only refer to offsets in the arena, so it does not matter if the
+		 * arena is moved.
+		 */
+
+		if (vstore.base != NULL)
+			vmm_munmap(vstore.base, vstore.size);
+		vstore.base = NULL;
+
+		if (0 == ftruncate(vstore.fd, size)) {
+			p = vmm_mmap(NULL, size,
+					PROT_READ | PROT_WRITE, MAP_SHARED, vstore.fd, 0);
+		}
+
+		if (MAP_FAILED == p) {
+			g_warning("%s(): cannot map %s of %s, keeping values in core: %m",
+				G_STRFUNC, vstore.path, short_size(size, FALSE));
+
+			/*
+			 * Our previous mapping is gone, but its data are still in the
+			 * file, so we can reload them.
+			 */
+
+			if (0 != vstore.top) {
+				void *old = vmm_mmap(NULL, vstore.size,
+						PROT_READ, MAP_SHARED, vstore.fd, 0);
+
+				if (MAP_FAILED == old)
+					s_error("%s(): lost DHT values in %s", G_STRFUNC, vstore.path);
+
+				vstore.base = old;
+			}
+
+			vstore_arena_unmap(size);
+			return;
+		}
+
+		vstore.base = p;
+	} else {
+		char *p = vmm_alloc(size);
+
+		if (vstore.base != NULL) {
+			memcpy(p, vstore.base, vstore.top);
+			vmm_free(vstore.base, vstore.size);
+		}
+
+		vstore.base = p;
+	}
+
+	vstore.size = size;
+
+	if (GNET_PROPERTY(dht_storage_debug) > 1) {
+		g_debug("DHT VSTORE arena now %s (%s used)%s",
+			short_size(vstore.size, FALSE), short_size2(vstore.used, FALSE),
+			NULL == vstore.path ? "" : ", file-backed");
+	}
+}
+
+/**
+ * Put block of `n' grains at `off' in its free list.
+ */
+static void
+vstore_arena_release(size_t off, size_t n)
+{
+	size_t next = vstore.free[n];
+
+	g_assert(n > 0 && n < VSTORE_CLASSES);
+
+	memcpy(vstore_block(off), &next, sizeof next);
+	vstore.free[n] = off + 1;
+}
+
+/**
+ * Allocate space for `len' bytes in the arena.
+ *
+ * @return offset of the allocated block.
+ */
+static size_t
+vstore_arena_alloc(size_t len)
+{
+	size_t n = vstore_grains(len), off, c;
+
+	g_assert(n > 0 && n < VSTORE_CLASSES);
+
+	vstore.used += n * VSTORE_GRAIN;
+
+	/*
+	 * Try, in order: a free block of the proper size, the space never used
+	 * at the end of the arena, then splitting a larger free block.
+	 */
+
+	if (vstore.free[n] != 0) {
+		c = n;
+		goto freelist;
+	}
+
+	if (vstore.size - vstore.top >= n * VSTORE_GRAIN)
+		goto top;
+
+	for (c = n + 1; c < VSTORE_CLASSES; c++) {
+		if (vstore.free[c] != 0)
+			goto freelist;
+	}
+
+	vstore_arena_grow(n * VSTORE_GRAIN);
+
+	/* FALL THROUGH */
+
+top:
+	off = vstore.top;
+	vstore.top += n * VSTORE_GRAIN;
+	return off;
+
+freelist:
+	off = vstore.free[c] - 1;
+	memcpy(&vstore.free[c], vstore_block(off), sizeof vstore.free[c]);
+
+	if (c > n)
+		vstore_arena_release(off + n * VSTORE_GRAIN, c - n);
+
+	return off;
+}
+
+/**
+ * Free arena block holding `len' bytes at `off'.
+ */
+static void
+vstore_arena_free(size_t off, size_t len)
+{
+	size_t n = vstore_grains(len);
+
+	g_assert(vstore.used >= n * VSTORE_GRAIN);
+
+	vstore.used -= n * VSTORE_GRAIN;
+	vstore_arena_release(off, n);
+}
+
+/**
+ * Allocate a new record.
+ */
+static struct vstore_rec *
+vstore_rec_alloc(uint64 dbkey)
+{
+	struct vstore_rec *vr;
+
+	WALLOC0(vr);
+	vr->magic = VSTORE_REC_MAGIC;
+	vr->dbkey = dbkey;
+
+	return vr;
+}
+
+/**
+ * Free record and the space it uses in the arena.
+ */
+static void
+vstore_rec_free(struct vstore_rec *vr)
+{
+	vstore_rec_check(vr);
+	g_assert(0 == vr->heap);
+
+	if (vr->size != 0)
+		vstore_arena_free(vr->off, vr->size);
+
+	vr->magic = 0;
+	WFREE(vr);
+}
+
+/***
+ *** Expiry heap.
+ ***
+ *** The heap is stored in an array, the record at index i having its
+ *** children at indices 2i+1 and 2i+2.  Each record remembers its position
+ *** in the heap (plus one, so that 0 means "not in the heap") to allow
+ *** removal and repositioning of arbitrary records.
+ ***/
+
+/**
+ * Put record at given heap position.
+ */
+static inline void
+vstore_heap_set(size_t i, struct vstore_rec *vr)
+{
+	vstore.heap[i] = vr;
+	vr->heap = i + 1;
+}
+
+/**
+ * Move record at position `i' up the heap until heap property is restored.
+ */
+static void
+vstore_heap_up(size_t i)
+{
+	struct vstore_rec *vr = vstore.heap[i];
+
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		struct vstore_rec *pr = vstore.heap[parent];
+
+		if (delta_time(pr->expire, vr->expire) <= 0)
+			break;
+
+		vstore_heap_set(i, pr);
+		i = parent;
+	}
+
+	vstore_heap_set(i, vr);
+}
+
+/**
+ * Move record at position `i' down the heap until heap property is restored.
+ */
+static void
+vstore_heap_down(size_t i)
+{
+	struct vstore_rec *vr = vstore.heap[i];
+	size_t n = vstore.heap_count;
+
+	for (;;) {
+		size_t child = 2 * i + 1;
+		struct vstore_rec *cr;
+
+		if (child >= n)
+			break;
+
+		cr = vstore.heap[child];
+
+		if (child + 1 < n) {
+			struct vstore_rec *rr = vstore.heap[child + 1];
+			if (delta_time(rr->expire, cr->expire) < 0) {
+				child++;
+				cr = rr;
+			}
+		}
+
+		if (delta_time(vr->expire, cr->expire) <= 0)
+			break;
+
+		vstore_heap_set(i, cr);
+		i = child;
+	}
+
+	vstore_heap_set(i, vr);
+}
+
+/**
+ * Insert record in the expiry heap.
+ */
+static void
+vstore_heap_insert(struct vstore_rec *vr)
+{
+	g_assert(0 == vr->heap);
+
+	if (vstore.heap_count == vstore.heap_size) {
+		vstore.heap_size = MAX(VSTORE_HEAP_MIN, 2 * vstore.heap_size);
+		HREALLOC_ARRAY(vstore.heap, vstore.heap_size);
+	}
+
+	vstore.heap[vstore.heap_count] = vr;
+	vstore_heap_up(vstore.heap_count++);
+}
+
+/**
+ * Remove record from the expiry heap.
+ */
+static void
+vstore_heap_remove(struct vstore_rec *vr)
+{
+	size_t i;
+	struct vstore_rec *last;
+
+	g_assert(vr->heap != 0);
+	g_assert(vstore.heap_count > 0);
+
+	i = vr->heap - 1;
+	g_assert(vstore.heap[i] == vr);
+
+	vr->heap = 0;
+	last = vstore.heap[--vstore.heap_count];
+
+	if (last == vr)
+		return;
+
+	vstore_heap_set(i, last);
+	vstore_heap_up(i);
+	vstore_heap_down(last->heap - 1);
+}
+
+/**
+ * Reposition record in the expiry heap after its expiration time changed,
+ * inserting it if it was no longer there.
+ */
+static void
+vstore_heap_update(struct vstore_rec *vr)
+{
+	if (0 == vr->heap) {
+		vstore_heap_insert(vr);
+	} else {
+		size_t i = vr->heap - 1;
+
+		vstore_heap_up(i);
+		vstore_heap_down(vr->heap - 1);
+	}
+}
+
+/***
+ *** Public interface.
+ ***/
+
+/**
+ * Store (or supersede) value in the store.
+ *
+ * @param dbkey		the 64-bit DB key of the value
+ * @param v			the DHT value
+ * @param expire	expiration time of the value
+ *
+ * @return TRUE if value was stored, FALSE if it could not be serialized.
+ */
+bool
+vstore_put(uint64 dbkey, const dht_value_t *v, time_t expire)
+{
+	struct vstore_rec *vr;
+	char buf[VSTORE_WIRE_MAX];
+	pdata_t *db;
+	pmsg_t *mb;
+	size_t size;
+
+	g_assert(dbkey != 0);
+
+	if (dht_value_length(v) > DHT_VALUE_MAX_LEN) {
+		vstore_remove(dbkey);
+		return FALSE;
+	}
+
+	/*
+	 * Serialize the value first, to know how much room it needs.
+	 */
+
+	db = pdata_allocb_ext(buf, sizeof buf, pdata_free_nop, NULL);
+	mb = pmsg_alloc(PMSG_P_DATA, db, 0, 0);
+	dht_value_serialize(mb, v);
+	size = pmsg_size(mb);
+
+	g_assert(size >= dht_value_length(v));
+
+	vr = hikset_lookup(vstore.records, &dbkey);
+
+	if (NULL == vr) {
+		vr = vstore_rec_alloc(dbkey);
+		hikset_insert(vstore.records, vr);
+	} else if (vstore_grains(vr->size) != vstore_grains(size)) {
+		vstore_arena_free(vr->off, vr->size);
+		vr->size = 0;
+	}
+
+	if (0 == vr->size)
+		vr->off = vstore_arena_alloc(size);
+
+	memcpy(vstore_block(vr->off), buf, size);
+	pmsg_free(mb);
+
+	vr->size = size;
+	vr->length = dht_value_length(v);
+	vr->type = dht_value_type(v);
+	vr->expire = expire;
+
+	vstore_heap_update(vr);
+
+	return TRUE;
+}
+
+/**
+ * Remove value from the store.
+ */
+void
+vstore_remove(uint64 dbkey)
+{
+	struct vstore_rec *vr;
+
+	vr = hikset_lookup(vstore.records, &dbkey);
+	if (NULL == vr)
+		return;
+
+	vstore_rec_check(vr);
+
+	hikset_remove(vstore.records, &vr->dbkey);
+	if (vr->heap != 0)
+		vstore_heap_remove(vr);
+	vstore_rec_free(vr);
+}
+
+/**
+ * Fetch value record.
+ *
+ * @attention
+ * The returned record is only valid until the next store modification.
+ *
+ * @return the record associated with the DB key, NULL if not found.
+ */
+vstore_rec_t *
+vstore_get(uint64 dbkey)
+{
+	return hikset_lookup(vstore.records, &dbkey);
+}
+
+/**
+ * Remove the first expired value from the expiry heap.
+ *
+ * The value itself remains in the store until it is explicitly removed,
+ * but it will not be reported again unless it is superseded.
+ *
+ * @param now		current time
+ *
+ * @return the DB key of the expired value, 0 if no value has expired.
+ */
+uint64
+vstore_expire_next(time_t now)
+{
+	struct vstore_rec *vr;
+
+	if (0 == vstore.heap_count)
+		return 0;
+
+	vr = vstore.heap[0];
+	vstore_rec_check(vr);
+
+	if (delta_time(now, vr->expire) < 0)
+		return 0;
+
+	vstore_heap_remove(vr);
+	return vr->dbkey;
+}
+
+/**
+ * @return amount of values held in the store.
+ */
+size_t
+vstore_count(void)
+{
+	return NULL == vstore.records ? 0 : hikset_count(vstore.records);
+}
+
+/**
+ * @return expiration time of value.
+ */
+time_t
+vstore_rec_expire(const vstore_rec_t *vr)
+{
+	vstore_rec_check(vr);
+	return vr->expire;
+}
+
+/**
+ * @return type of value.
+ */
+dht_value_type_t
+vstore_rec_type(const vstore_rec_t *vr)
+{
+	vstore_rec_check(vr);
+	return vr->type;
+}
+
+/**
+ * @return KUID of the value's creator (secondary key).
+ */
+const kuid_t *
+vstore_rec_creator(const vstore_rec_t *vr)
+{
+	vstore_rec_check(vr);
+	return (const kuid_t *) ptr_add_offset(vstore_block(vr->off),
+		VSTORE_CREATOR_OFFSET);
+}
+
+/**
+ * @return pointer to value data, its length being written in `len'.
+ */
+const void *
+vstore_rec_data(const vstore_rec_t *vr, size_t *len)
+{
+	vstore_rec_check(vr);
+	g_assert(len != NULL);
+
+	*len = vr->length;
+	return ptr_add_offset(vstore_block(vr->off), vr->size - vr->length);
+}
+
+/**
+ * @return size of serialized value.
+ */
+size_t
+vstore_rec_size(const vstore_rec_t *vr)
+{
+	vstore_rec_check(vr);
+	return vr->size;
+}
+
+/**
+ * Record that value is being served.
+ */
+void
+vstore_rec_served(vstore_rec_t *vr)
+{
+	vstore_rec_check(vr);
+	vr->n_requests++;
+}
+
+/**
+ * @return amount of times value was served from the store.
+ */
+uint32
+vstore_rec_requests(const vstore_rec_t *vr)
+{
+	vstore_rec_check(vr);
+	return vr->n_requests;
+}
+
+/**
+ * Serialize value into message, which must have enough room.
+ */
+void
+vstore_rec_serialize(pmsg_t *mb, const vstore_rec_t *vr)
+{
+	vstore_rec_check(vr);
+	g_assert(UNSIGNED(pmsg_available(mb)) >= vr->size);
+
+	pmsg_write(mb, vstore_block(vr->off), vr->size);
+}
+
+/**
+ * vsort() callback to compare two records on a serialized size basis.
+ */
+int
+vstore_rec_cmp(const void *a, const void *b)
+{
+	const vstore_rec_t * const *pa = a;
+	const vstore_rec_t * const *pb = b;
+
+	return (*pa)->size == (*pb)->size ? 0 :
+		(*pa)->size < (*pb)->size ? -1 : +1;
+}
+
+/**
+ * Initialize value store.
+ */
+void G_COLD
+vstore_init(void)
+{
+	g_assert(NULL == vstore.records);
+
+	vstore.records = hikset_create(
+		offsetof(struct vstore_rec, dbkey), HASH_KEY_FIXED, sizeof(uint64));
+	vstore.fd = -1;
+
+	/*
+	 * The backing file only caches what the databases hold, hence we
+	 * start with an empty one.
+	 */
+
+#ifdef HAS_MMAP
+	if (!GNET_PROPERTY(dht_storage_in_memory)) {
+		vstore.path = make_pathname(settings_dht_db_dir(), VSTORE_FILE);
+		vstore.fd = file_create(vstore.path,
+			O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR);
+
+		if (-1 == vstore.fd)
+			HFREE_NULL(vstore.path);	/* Will use anonymous memory then */
+	}
+#endif	/* HAS_MMAP */
+}
+
+/**
+ * Free record, for hikset_foreach().
+ */
+static void
+vstore_rec_discard(void *data, void *unused_udata)
+{
+	struct vstore_rec *vr = data;
+
+	(void) unused_udata;
+
+	vstore_rec_check(vr);
+
+	vr->magic = 0;
+	WFREE(vr);
+}
+
+/**
+ * Close value store.
+ */
+void G_COLD
+vstore_close(void)
+{
+	if (vstore.records != NULL)
+		hikset_foreach(vstore.records, vstore_rec_discard, NULL);
+	hikset_free_null(&vstore.records);
+
+	if (vstore.path != NULL) {
+		if (vstore.base != NULL)
+			vmm_munmap(vstore.base, vstore.size);
+		fd_forget_and_close(&vstore.fd);
+		unlink(vstore.path);
+		HFREE_NULL(vstore.path);
+	} else {
+		VMM_FREE_NULL(vstore.base, vstore.size);
+	}
+
+	HFREE_NULL(vstore.heap);
+	ZERO(&vstore);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
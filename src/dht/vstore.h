@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup dht
+ * @file
+ *
+ * In-core store of serialized DHT values.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _dht_vstore_h_
+#define _dht_vstore_h_
+
+#include "if/dht/kuid.h"
+#include "if/dht/value.h"
+
+#include "lib/pmsg.h"
+
+struct vstore_rec;
+typedef struct vstore_rec vstore_rec_t;
+
+/*
+ * Public interface.
+ */
+
+void vstore_init(void);
+void vstore_close(void);
+
+bool vstore_put(uint64 dbkey, const dht_value_t *v, time_t expire);
+void vstore_remove(uint64 dbkey);
+vstore_rec_t *vstore_get(uint64 dbkey);
+uint64 vstore_expire_next(time_t now);
+size_t vstore_count(void);
+
+time_t vstore_rec_expire(const vstore_rec_t *vr);
+dht_value_type_t vstore_rec_type(const vstore_rec_t *vr);
+const kuid_t *vstore_rec_creator(const vstore_rec_t *vr);
+const void *vstore_rec_data(const vstore_rec_t *vr, size_t *len);
+size_t vstore_rec_size(const vstore_rec_t *vr);
+void vstore_rec_served(vstore_rec_t *vr);
+uint32 vstore_rec_requests(const vstore_rec_t *vr);
+void vstore_rec_serialize(pmsg_t *mb, const vstore_rec_t *vr);
+int vstore_rec_cmp(const void *a, const void *b);
+
+#endif /* _dht_vstore_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
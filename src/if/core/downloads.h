@@ -27,6 +27,7 @@
 
 #include "lib/event.h"			/* For frequency_t */
 #include "lib/hashlist.h"
+#include "lib/erbtree.h"
 #include "lib/htable.h"
 #include "lib/http_range.h"
 #include "lib/iso3166.h"		/* For iso3166_code_is_valid() */
@@ -97,6 +98,8 @@ struct dl_server {
 	pproxy_set_t *proxies;		/**< Known push proxies */
 	htable_t *sha1_counts;
 	time_t retry_after;		/**< Time at which we may retry from this host */
+	rbnode_t by_time;		/**< Embedded node in the scheduling tree */
+	bool scheduled;			/**< Whether linked in the scheduling tree */
 	time_t dns_lookup;		/**< Last DNS lookup for hostname */
 	time_t last_connect;	/**< When we last connected to that server */
 	struct vernum parq_version; /**< Supported queueing version */
@@ -26,6 +26,7 @@
 
 #include "common.h"
 
+#include "lib/erbtree.h"
 #include "lib/eslist.h"
 #include "lib/http_range.h"
 #include "lib/path.h"
@@ -41,6 +42,7 @@ struct download;
  */
 
 enum {
+	FI_F_TT_PENDING		= 1 << 15,	/**< Tigertree still to be read from trailer */
 	FI_F_NOSHARE		= 1 << 14,	/**< Explicitly refuse any sharing of file */
 	FI_F_DHT_LOOKING	= 1 << 13,	/**< Running DHT lookup for more sources */
 	FI_F_DHT_LOOKUP		= 1 << 12,	/**< Pending DHT lookup for more sources */
@@ -133,6 +135,7 @@ enum fi_magic {
 };
 
 struct guid;
+struct fi_hash;
 
 /**
  * File downloading information.
@@ -172,6 +175,7 @@ typedef struct dl_file_info {
 	filesize_t buffered;	/**< Amount of buffered data (unflushed) */
 	filesize_t uploaded;	/**< Amount of bytes uploaded */
 	eslist_t chunklist;		/**< List of ranges within file */
+	erbtree_t chunkidx;		/**< Chunks from chunklist, indexed by offset */
 	eslist_t available;		/**< List of ranges available, with source count */
 	http_rangeset_t *seen_on_network;  /**< Ranges available on network */
 	uint32 generation;		/**< Generation number, incremented on disk update */
@@ -195,6 +199,7 @@ typedef struct dl_file_info {
 	 */
 
 	filesize_t vrfy_hashed;	/**< Amount of bytes hashed so far during verify */
+	struct fi_hash *hasher;	/**< Incremental hasher, while downloading */
 	filesize_t copied;		/**< Amount of bytes copied so far */
 	unsigned vrfy_elapsed;	/**< Time spent to compute the hash */
 	unsigned copy_elapsed;	/**< Time spent to copy the file */
@@ -209,6 +214,7 @@ typedef struct dl_file_info {
 	unsigned dirty_status:1;  	/**< Notify status change on next interval */
 	unsigned hashed:1;			/**< In hash tables? */
 	unsigned tth_check:1;		/**< TTH checking performed? */
+	unsigned chunkidx_ok:1;		/**< Is chunkidx in sync with chunklist? */
 } fileinfo_t;
 
 static inline void
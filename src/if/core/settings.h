@@ -36,6 +36,7 @@ host_addr_t listen_addr(void);
 host_addr_t listen_addr6(void);
 host_addr_t listen_addr_by_net(enum net_type net);
 const char *settings_config_dir(void);
+bool settings_config_dir_is_default(void);
 const char *settings_home_dir(void);
 const char *settings_crash_dir(void);
 const char *settings_local_socket_path(void);
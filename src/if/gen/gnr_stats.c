@@ -1,5 +1,5 @@
 /*
- * Generated on Sun Nov  6 23:31:52 2016 by enum-msg.pl -- DO NOT EDIT
+ * Generated on Mon Oct 19 03:40:55 2026 by enum-msg.pl -- DO NOT EDIT
  *
  * Command: ../../../scripts/enum-msg.pl stats.lst
  */
@@ -37,6 +37,11 @@ static const char *stats_symbols[] = {
 	"local_g2_hits",
 	"local_g2_partial_hits",
 	"local_aliased_hits",
+	"local_query_prefiltered",
+	"local_query_cache_hits",
+	"local_query_cache_misses",
+	"local_query_cache_evictions",
+	"local_query_cache_held",
 	"oob_proxied_query_hits",
 	"oob_queries",
 	"oob_queries_stripped",
@@ -73,6 +78,8 @@ static const char *stats_symbols[] = {
 	"guess_ultra_acknowledged",
 	"guess_g2_queried",
 	"guess_g2_acknowledged",
+	"guess_query_keys_prefetched",
+	"guess_scored_hosts_held",
 	"local_push_throttled",
 	"remote_push_throttled",
 	"broadcasted_pushes",
@@ -93,6 +100,7 @@ static const char *stats_symbols[] = {
 	"dyn_queries_linger_extra",
 	"dyn_queries_linger_results",
 	"dyn_queries_linger_completed",
+	"dyn_queries_low_yield",
 	"gtkg_total_queries",
 	"gtkg_requeries",
 	"queries_with_ggep_h",
@@ -190,6 +198,12 @@ static const char *stats_symbols[] = {
 	"successful_plain_resource_switching",
 	"successful_resource_switching_after_error",
 	"queued_after_switching",
+	"dl_scheduler_passes",
+	"dl_scheduler_slot_wakeups",
+	"dl_scheduler_servers_visited",
+	"dl_scheduler_starts",
+	"dl_scheduler_latency_total",
+	"dl_scheduler_latency_max",
 	"sunk_data",
 	"ignored_data",
 	"ignoring_after_mismatch",
@@ -209,6 +223,10 @@ static const char *stats_symbols[] = {
 	"parq_queue_follow_ups",
 	"sha1_verifications",
 	"tth_verifications",
+	"verify_hashed_bytes",
+	"sha1_incremental_verifications",
+	"sha1_incremental_tail_bytes",
+	"tth_incremental_bad_slices",
 	"qhit_seeding_of_orphan",
 	"upload_seeding_of_orphan",
 	"rudp_tx_bytes",
@@ -250,6 +268,8 @@ static const char *stats_symbols[] = {
 	"dht_lookup_rejected_node_on_proximity",
 	"dht_lookup_rejected_node_on_divergence",
 	"dht_lookup_fixed_node_contact",
+	"dht_lookup_straggling_rpcs",
+	"dht_lookup_speculative_rpcs",
 	"dht_keys_held",
 	"dht_cached_keys_held",
 	"dht_values_held",
@@ -312,6 +332,11 @@ static const char *stats_symbols[] = {
 	"dht_publishing_bg_attempts",
 	"dht_publishing_bg_improvements",
 	"dht_publishing_bg_successful",
+	"dht_store_roots_lookups",
+	"dht_store_roots_lookup_msgs",
+	"dht_store_roots_reused",
+	"dht_publisher_keys_published",
+	"dht_publisher_keys_per_minute",
 	"dht_sha1_data_type_collisions",
 	"dht_passively_protected_lookup_path",
 	"dht_actively_protected_lookup_path",
@@ -367,6 +392,11 @@ static const char *stats_text[] = {
 	N_("G2 hits on local DB"),
 	N_("G2 hits on local partial files"),
 	N_("Hits on aliased queries"),
+	N_("Local searches rejected by the Bloom prefilter"),
+	N_("Local searches answered from the result cache"),
+	N_("Local searches missing from the result cache"),
+	N_("Local search result cache evictions"),
+	N_("Local search results cached"),
 	N_("Query hits received for OOB-proxied queries"),
 	N_("Queries requesting OOB hit delivery"),
 	N_("Stripped OOB flag on queries"),
@@ -403,6 +433,8 @@ static const char *stats_text[] = {
 	N_("GUESS ultra nodes sending back an acknowledgment"),
 	N_("GUESS G2 nodes queried"),
 	N_("GUESS G2 nodes sending back an acknowledgment"),
+	N_("GUESS query keys requested ahead of querying"),
+	N_("GUESS hosts with recorded hit yield"),
 	N_("Throttled local push messages"),
 	N_("Throttled received push messages"),
 	N_("Broadcasted push messages"),
@@ -423,6 +455,7 @@ static const char *stats_text[] = {
 	N_("Fully completed dynamic queries getting late results"),
 	N_("Dynamic queries with partial late results"),
 	N_("Dynamic queries completed by late results"),
+	N_("Dynamic queries stopped on low expected yield"),
 	N_("Queries seen from GTKG"),
 	N_("Queries seen from GTKG that were re-queries"),
 	N_("Queries advertising support of GGEP \"H\""),
@@ -520,6 +553,12 @@ static const char *stats_text[] = {
 	N_("Successful download resource switching between plain files"),
 	N_("Successful download resource switching after error"),
 	N_("Actively queued after resource switching attempt"),
+	N_("Download scheduler passes"),
+	N_("Download scheduler wakeups on released slot or new work"),
+	N_("Eligible servers visited by download scheduler"),
+	N_("Downloads started by the scheduler"),
+	N_("Cumulated download scheduling latency (ms since eligible)"),
+	N_("Maximum download scheduling latency (ms)"),
 	N_("Sunk HTTP reply data on error codes"),
 	N_("Ignored downloaded data"),
 	N_("Ignoring requested after data mismatch"),
@@ -539,6 +578,10 @@ static const char *stats_text[] = {
 	N_("PARQ QUEUE follow-up requests received"),
 	N_("Launched SHA-1 file verifications"),
 	N_("Launched TTH file verifications"),
+	N_("Bytes hashed by file verifications"),
+	N_("SHA-1 verifications completed from incremental hashing"),
+	N_("Bytes re-read from disk to complete incremental SHA-1 hashing"),
+	N_("Corrupted TTH slices detected whilst downloading"),
 	N_("Re-seeding of orphan downloads through query hits"),
 	N_("Re-seeding of orphan downloads through upload requests"),
 	N_("RUDP sent bytes"),
@@ -580,6 +623,8 @@ static const char *stats_text[] = {
 	N_("DHT nodes rejected during lookup based on suspicious proximity"),
 	N_("DHT nodes rejected during lookup based on frequency divergence"),
 	N_("DHT node contact IP addresses fixed during lookup"),
+	N_("DHT lookup RPCs exceeding their 95th RTT percentile"),
+	N_("DHT lookup RPCs sent speculatively to bypass stragglers"),
 	N_("DHT keys held"),
 	N_("DHT cached keys held"),
 	N_("DHT values held"),
@@ -642,6 +687,11 @@ static const char *stats_text[] = {
 	N_("DHT background publishing completion attempts"),
 	N_("DHT background publishing completion showing improvements"),
 	N_("DHT background publishing completion successful (all roots)"),
+	N_("DHT STORE roots lookups completed"),
+	N_("DHT messages sent by STORE roots lookups"),
+	N_("DHT STORE roots reused for nearby keys"),
+	N_("DHT keys published by the publisher"),
+	N_("DHT publisher throughput (keys/min)"),
 	N_("DHT SHA1 data type collisions"),
 	N_("DHT lookup path passively protected against attack"),
 	N_("DHT lookup path actively protected against attack"),
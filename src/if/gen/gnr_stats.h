@@ -1,5 +1,5 @@
 /*
- * Generated on Sun Nov  6 23:31:52 2016 by enum-msg.pl -- DO NOT EDIT
+ * Generated on Mon Oct 19 03:40:55 2026 by enum-msg.pl -- DO NOT EDIT
  *
  * Command: ../../../scripts/enum-msg.pl stats.lst
  */
@@ -8,7 +8,7 @@
 #define _if_gen_gnr_stats_h_
 
 /*
- * Enum count: 309
+ * Enum count: 334
  */
 typedef enum {
 	GNR_ROUTING_ERRORS = 0,
@@ -33,6 +33,11 @@ typedef enum {
 	GNR_LOCAL_G2_HITS,
 	GNR_LOCAL_G2_PARTIAL_HITS,
 	GNR_LOCAL_ALIASED_HITS,
+	GNR_LOCAL_QUERY_PREFILTERED,
+	GNR_LOCAL_QUERY_CACHE_HITS,
+	GNR_LOCAL_QUERY_CACHE_MISSES,
+	GNR_LOCAL_QUERY_CACHE_EVICTIONS,
+	GNR_LOCAL_QUERY_CACHE_HELD,
 	GNR_OOB_PROXIED_QUERY_HITS,
 	GNR_OOB_QUERIES,
 	GNR_OOB_QUERIES_STRIPPED,
@@ -69,6 +74,8 @@ typedef enum {
 	GNR_GUESS_ULTRA_ACKNOWLEDGED,
 	GNR_GUESS_G2_QUERIED,
 	GNR_GUESS_G2_ACKNOWLEDGED,
+	GNR_GUESS_QUERY_KEYS_PREFETCHED,
+	GNR_GUESS_SCORED_HOSTS_HELD,
 	GNR_LOCAL_PUSH_THROTTLED,
 	GNR_REMOTE_PUSH_THROTTLED,
 	GNR_BROADCASTED_PUSHES,
@@ -89,6 +96,7 @@ typedef enum {
 	GNR_DYN_QUERIES_LINGER_EXTRA,
 	GNR_DYN_QUERIES_LINGER_RESULTS,
 	GNR_DYN_QUERIES_LINGER_COMPLETED,
+	GNR_DYN_QUERIES_LOW_YIELD,
 	GNR_GTKG_TOTAL_QUERIES,
 	GNR_GTKG_REQUERIES,
 	GNR_QUERIES_WITH_GGEP_H,
@@ -186,6 +194,12 @@ typedef enum {
 	GNR_SUCCESSFUL_PLAIN_RESOURCE_SWITCHING,
 	GNR_SUCCESSFUL_RESOURCE_SWITCHING_AFTER_ERROR,
 	GNR_QUEUED_AFTER_SWITCHING,
+	GNR_DL_SCHEDULER_PASSES,
+	GNR_DL_SCHEDULER_SLOT_WAKEUPS,
+	GNR_DL_SCHEDULER_SERVERS_VISITED,
+	GNR_DL_SCHEDULER_STARTS,
+	GNR_DL_SCHEDULER_LATENCY_TOTAL,
+	GNR_DL_SCHEDULER_LATENCY_MAX,
 	GNR_SUNK_DATA,
 	GNR_IGNORED_DATA,
 	GNR_IGNORING_AFTER_MISMATCH,
@@ -205,6 +219,10 @@ typedef enum {
 	GNR_PARQ_QUEUE_FOLLOW_UPS,
 	GNR_SHA1_VERIFICATIONS,
 	GNR_TTH_VERIFICATIONS,
+	GNR_VERIFY_HASHED_BYTES,
+	GNR_SHA1_INCREMENTAL_VERIFICATIONS,
+	GNR_SHA1_INCREMENTAL_TAIL_BYTES,
+	GNR_TTH_INCREMENTAL_BAD_SLICES,
 	GNR_QHIT_SEEDING_OF_ORPHAN,
 	GNR_UPLOAD_SEEDING_OF_ORPHAN,
 	GNR_RUDP_TX_BYTES,
@@ -246,6 +264,8 @@ typedef enum {
 	GNR_DHT_LOOKUP_REJECTED_NODE_ON_PROXIMITY,
 	GNR_DHT_LOOKUP_REJECTED_NODE_ON_DIVERGENCE,
 	GNR_DHT_LOOKUP_FIXED_NODE_CONTACT,
+	GNR_DHT_LOOKUP_STRAGGLING_RPCS,
+	GNR_DHT_LOOKUP_SPECULATIVE_RPCS,
 	GNR_DHT_KEYS_HELD,
 	GNR_DHT_CACHED_KEYS_HELD,
 	GNR_DHT_VALUES_HELD,
@@ -308,6 +328,11 @@ typedef enum {
 	GNR_DHT_PUBLISHING_BG_ATTEMPTS,
 	GNR_DHT_PUBLISHING_BG_IMPROVEMENTS,
 	GNR_DHT_PUBLISHING_BG_SUCCESSFUL,
+	GNR_DHT_STORE_ROOTS_LOOKUPS,
+	GNR_DHT_STORE_ROOTS_LOOKUP_MSGS,
+	GNR_DHT_STORE_ROOTS_REUSED,
+	GNR_DHT_PUBLISHER_KEYS_PUBLISHED,
+	GNR_DHT_PUBLISHER_KEYS_PER_MINUTE,
 	GNR_DHT_SHA1_DATA_TYPE_COLLISIONS,
 	GNR_DHT_PASSIVELY_PROTECTED_LOOKUP_PATH,
 	GNR_DHT_ACTIVELY_PROTECTED_LOOKUP_PATH,
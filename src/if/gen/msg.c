@@ -1,5 +1,5 @@
 /*
- * Generated on Sat Apr  5 12:09:15 2014 by enum-msg.pl -- DO NOT EDIT
+ * Generated on Mon Oct 19 03:40:36 2026 by enum-msg.pl -- DO NOT EDIT
  *
  * Command: ../../../scripts/enum-msg.pl msg.lst
  */
@@ -11,6 +11,66 @@
 #include "lib/str.h"
 #include "lib/override.h"	/* Must be the last header included */
 
+/*
+ * Symbolic descriptions for msg_type_t.
+ */
+static const char *msg_type_symbols[] = {
+	"unknown",
+	"init",
+	"init_response",
+	"bye",
+	"qrp",
+	"hsep",
+	"rudp",
+	"vendor",
+	"standard",
+	"push_request",
+	"search",
+	"search_results",
+	"dht",
+	"dht_ping",
+	"dht_pong",
+	"dht_store",
+	"dht_store_ack",
+	"dht_find_node",
+	"dht_found_node",
+	"dht_find_value",
+	"dht_value",
+	"g2_crawlr",
+	"g2_haw",
+	"g2_khl",
+	"g2_khlr",
+	"g2_khla",
+	"g2_lni",
+	"g2_pi",
+	"g2_po",
+	"g2_push",
+	"g2_qka",
+	"g2_qkr",
+	"g2_q2",
+	"g2_qa",
+	"g2_qh2",
+	"g2_qht",
+	"g2_uproc",
+	"g2_uprod",
+	"total",
+};
+
+/**
+ * @return the symbolic description of the enum value.
+ */
+const char *
+gnet_msg_type_name(msg_type_t x)
+{
+	if G_UNLIKELY(UNSIGNED(x) >= G_N_ELEMENTS(msg_type_symbols)) {
+		str_t *s = str_private(G_STRFUNC, 80);
+		str_printf(s, "Invalid msg_type_t code: %d", (int) x);
+		return str_2c(s);
+	}
+
+	return msg_type_symbols[x];
+}
+
 /*
  * English descriptions for msg_type_t.
  */
@@ -62,7 +122,7 @@ static const char *msg_type_description[] = {
 const char *
 gnet_msg_type_description(msg_type_t x)
 {
-	if G_UNLIKELY(UNSIGNED(x) >= N_ITEMS(msg_type_description)) {
+	if G_UNLIKELY(UNSIGNED(x) >= G_N_ELEMENTS(msg_type_description)) {
 		str_t *s = str_private(G_STRFUNC, 80);
 		str_printf(s, "Invalid msg_type_t code: %d", (int) x);
 		return str_2c(s);
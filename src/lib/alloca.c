@@ -48,23 +48,38 @@
 #include "alloca.h"
 #include "spinlock.h"
 
+/**
+ * Compare the address of a local variable with that of our caller.
+ *
+ * This must not be inlined, and the caller must not be able to turn the
+ * call into a tail call, which is guaranteed since it passes us the address
+ * of one of its local variables: the caller's frame is still active.
+ *
+ * @return +1 if stack is growing in the virtual address space, -1 otherwise.
+ */
+static int NO_INLINE
+alloca_stack_direction_cmp(const void *caller_sp)
+{
+	int sp;
+
+	return ptr_cmp(&sp, caller_sp);
+}
+
 /**
  * Determine whether stack is growing upwards or backwards.
  *
+ * We used to recurse once and compare the addresses of the local variable
+ * in each invocation, but the compiler can turn that recursion into a loop,
+ * reusing the same frame and yielding a wrong direction.
+ *
  * @return +1 if stack is growing in the virtual address space, -1 otherwise.
  */
 static int
 alloca_stack_direction_compute(void)
 {
-	static void *old_sp;
 	int sp;
 
-	if (NULL == old_sp) {
-		old_sp = &sp;
-		return alloca_stack_direction_compute();
-	} else {
-		return ptr_cmp(&sp, old_sp);
-	}
+	return alloca_stack_direction_cmp(&sp);
 }
 
 /**
@@ -0,0 +1,506 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Bump-pointer memory arenas.
+ *
+ * An arena hands out memory by simply moving a pointer forward within
+ * large chunks obtained from the VMM layer.  Individual objects are never
+ * freed: the whole arena is reset at once, which rewinds the pointer to
+ * the start of the first chunk.  Chunks are kept around and reused by
+ * subsequent allocations, hence resetting is O(1).
+ *
+ * This is well suited for objects that all share the same short lifetime,
+ * like the many small temporary structures created whilst parsing and
+ * processing a single incoming message.
+ *
+ * Each thread has its own arena, used through "transactions": a transaction
+ * is opened by arena_begin() and closed by arena_end(), at which time all
+ * the memory allocated via arena_tx_alloc() within the transaction is
+ * reclaimed.  Transactions can be nested, only the outermost one resetting
+ * the arena.  Outside of any transaction, arena_tx_alloc() returns NULL
+ * and callers are expected to fall back to regular allocators.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "arena.h"
+
+#include "dump_options.h"
+#include "log.h"
+#include "misc.h"			/* For round_size() */
+#include "omalloc.h"
+#include "once.h"
+#include "stringify.h"
+#include "thread.h"
+#include "tm.h"
+#include "unsigned.h"
+#include "vmm.h"
+#include "walloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#define ARENA_CHUNK_SIZE	(64 * 1024)		/**< Default chunk size */
+
+/**
+ * Largest request served by arena_tx_alloc().
+ *
+ * Since thread arenas are never shrunk, we do not want a few large
+ * allocations to pin down a lot of memory for the lifetime of the thread.
+ */
+#define ARENA_TX_MAXSIZE	(ARENA_CHUNK_SIZE / 8)
+
+/**
+ * A chunk of memory, with the header at the start of the VMM region.
+ */
+struct arena_chunk {
+	struct arena_chunk *next;	/**< Next chunk in arena */
+	size_t size;				/**< Total chunk size, including header */
+};
+
+#define ARENA_CHUNK_HEAD \
+	round_size(MEM_ALIGNBYTES, sizeof(struct arena_chunk))
+
+/**
+ * Arena statistics.
+ */
+struct arena_stats {
+	uint64 allocations;			/**< Amount of objects allocated */
+	uint64 allocated;			/**< Total amount of bytes allocated */
+	uint64 declined;			/**< Transactional allocations declined */
+	uint64 resets;				/**< Amount of arena resets */
+	uint64 chunks;				/**< Amount of chunks allocated */
+	uint64 transactions;		/**< Amount of completed transactions */
+	uint64 tx_allocations;		/**< Objects allocated in transactions */
+	uint64 tx_time;				/**< Cumulated transaction time (ns) */
+	uint64 tx_time_max;			/**< Longest transaction (ns) */
+	size_t high_water;			/**< Max amount of bytes used at reset */
+};
+
+enum arena_magic { ARENA_MAGIC = 0x2f6e13a1 };
+
+/**
+ * An arena.
+ */
+struct arena {
+	enum arena_magic magic;
+	struct arena_chunk *head;	/**< First chunk */
+	struct arena_chunk *cur;	/**< Current chunk */
+	char *avail;				/**< First free byte in current chunk */
+	char *end;					/**< First byte beyond current chunk */
+	size_t used;				/**< Bytes allocated since last reset */
+	uint depth;					/**< Transaction nesting depth */
+	tm_nano_t start;			/**< Start of outermost transaction */
+	struct arena_stats stats;	/**< Usage statistics */
+};
+
+static inline void
+arena_check(const struct arena * const a)
+{
+	g_assert(a != NULL);
+	g_assert(ARENA_MAGIC == a->magic);
+}
+
+/**
+ * Thread arenas, indexed by thread small ID, for statistics.
+ */
+static arena_t *arena_threads[THREAD_MAX];
+
+/**
+ * Position arena allocation pointers at the start of the chunk.
+ */
+static inline void
+arena_use_chunk(arena_t *a, struct arena_chunk *ac)
+{
+	a->cur = ac;
+	a->avail = ptr_add_offset(ac, ARENA_CHUNK_HEAD);
+	a->end = ptr_add_offset(ac, ac->size);
+}
+
+/**
+ * Allocate a new chunk able to hold at least ``size'' bytes.
+ */
+static struct arena_chunk *
+arena_chunk_alloc(arena_t *a, size_t size)
+{
+	struct arena_chunk *ac;
+	size_t len;
+
+	len = size_saturate_add(size, ARENA_CHUNK_HEAD);
+	len = MAX(len, ARENA_CHUNK_SIZE);
+	len = round_pagesize(len);
+
+	ac = vmm_core_alloc(len);
+	ac->next = NULL;
+	ac->size = len;
+
+	a->stats.chunks++;
+
+	return ac;
+}
+
+/**
+ * Create a new arena.
+ *
+ * @return new arena, which must be freed with arena_free_null().
+ */
+arena_t *
+arena_make(void)
+{
+	arena_t *a;
+
+	WALLOC0(a);
+	a->magic = ARENA_MAGIC;
+	a->head = arena_chunk_alloc(a, 0);
+	arena_use_chunk(a, a->head);
+
+	return a;
+}
+
+/**
+ * Free arena and nullify its pointer.
+ */
+void
+arena_free_null(arena_t **a_ptr)
+{
+	arena_t *a = *a_ptr;
+
+	if (a != NULL) {
+		struct arena_chunk *ac, *next;
+
+		arena_check(a);
+		g_assert(0 == a->depth);
+
+		for (ac = a->head; ac != NULL; ac = next) {
+			next = ac->next;
+			vmm_core_free(ac, ac->size);
+		}
+
+		a->magic = 0;
+		WFREE(a);
+		*a_ptr = NULL;
+	}
+}
+
+/**
+ * Move to the next chunk able to satisfy an allocation of ``size'' bytes,
+ * creating a new one if needed.
+ */
+static void
+arena_next_chunk(arena_t *a, size_t size)
+{
+	struct arena_chunk *ac = a->cur;
+
+	/*
+	 * Chunks after the current one are kept from previous cycles: reuse
+	 * them if they are large enough, otherwise insert a new chunk.
+	 */
+
+	while (ac->next != NULL) {
+		ac = ac->next;
+		if (ac->size - ARENA_CHUNK_HEAD >= size) {
+			arena_use_chunk(a, ac);
+			return;
+		}
+	}
+
+	ac = arena_chunk_alloc(a, size);
+	ac->next = a->cur->next;
+	a->cur->next = ac;
+	arena_use_chunk(a, ac);
+}
+
+/**
+ * Allocate memory from arena.
+ *
+ * The memory is suitably aligned for any object and remains valid until
+ * the next arena_reset().
+ *
+ * @param a		the arena
+ * @param size	amount of bytes to allocate
+ *
+ * @return pointer to allocated memory.
+ */
+void *
+arena_alloc(arena_t *a, size_t size)
+{
+	void *p;
+
+	arena_check(a);
+
+	size = round_size(MEM_ALIGNBYTES, MAX(size, 1));
+
+	if G_UNLIKELY(UNSIGNED(ptr_diff(a->end, a->avail)) < size)
+		arena_next_chunk(a, size);
+
+	p = a->avail;
+	a->avail += size;
+	a->used += size;
+	a->stats.allocations++;
+	a->stats.allocated += size;
+
+	return p;
+}
+
+/**
+ * Reset arena, reclaiming all the memory that was allocated so far.
+ *
+ * This is O(1): all chunks are kept for subsequent allocations.
+ */
+void
+arena_reset(arena_t *a)
+{
+	arena_check(a);
+
+	if (a->used > a->stats.high_water)
+		a->stats.high_water = a->used;
+
+	a->used = 0;
+	a->stats.resets++;
+	arena_use_chunk(a, a->head);
+}
+
+/**
+ * @return amount of bytes allocated in the arena since last reset.
+ */
+size_t
+arena_used(const arena_t *a)
+{
+	arena_check(a);
+
+	return a->used;
+}
+
+static once_flag_t arena_key_inited;
+static thread_key_t arena_key = THREAD_KEY_INIT;
+
+/**
+ * Create the thread-local arena key, once.
+ */
+static void
+arena_key_init(void)
+{
+	if (-1 == thread_local_key_create(&arena_key, THREAD_LOCAL_KEEP))
+		s_error("cannot initialize thread arena key: %m");
+}
+
+/**
+ * Get the thread-local arena, creating it if needed.
+ */
+static arena_t *
+arena_thread(void)
+{
+	arena_t *a;
+
+	ONCE_FLAG_RUN(arena_key_inited, arena_key_init);
+
+	a = thread_local_get(arena_key);
+
+	if G_UNLIKELY(NULL == a) {
+		unsigned stid = thread_small_id();
+
+		/*
+		 * The thread arena is never freed, and will be reused by the
+		 * next thread getting the same small ID.
+		 */
+
+		g_assert(stid < N_ITEMS(arena_threads));
+
+		a = arena_threads[stid];
+		if (NULL == a) {
+			OMALLOC0(a);
+			a->magic = ARENA_MAGIC;
+			a->head = arena_chunk_alloc(a, 0);
+			arena_use_chunk(a, a->head);
+			arena_threads[stid] = a;
+		}
+		thread_local_set(arena_key, a);
+	}
+
+	return a;
+}
+
+/**
+ * Open an arena transaction in the current thread.
+ *
+ * All the memory obtained via arena_tx_alloc() until the matching
+ * arena_end() is released at once when the outermost transaction ends.
+ */
+void
+arena_begin(void)
+{
+	arena_t *a = arena_thread();
+
+	if (0 == a->depth++)
+		tm_precise_time(&a->start);
+}
+
+/**
+ * Close the arena transaction opened by arena_begin().
+ */
+void
+arena_end(void)
+{
+	arena_t *a = arena_thread();
+	tm_nano_t end, elapsed;
+	uint64 ns;
+
+	g_assert_log(a->depth != 0, "%s(): no opened transaction", G_STRFUNC);
+
+	if (0 != --a->depth)
+		return;
+
+	tm_precise_time(&end);
+	tm_precise_elapsed(&elapsed, &end, &a->start);
+	ns = tmn2ns(&elapsed);
+
+	a->stats.transactions++;
+	a->stats.tx_time += ns;
+	if (ns > a->stats.tx_time_max)
+		a->stats.tx_time_max = ns;
+
+	arena_reset(a);
+}
+
+/**
+ * @return whether an arena transaction is opened in the current thread.
+ */
+bool
+arena_active(void)
+{
+	arena_t *a;
+
+	ONCE_FLAG_RUN(arena_key_inited, arena_key_init);
+
+	a = thread_local_get(arena_key);
+
+	return a != NULL && a->depth != 0;
+}
+
+/**
+ * Allocate memory from the thread arena, within a transaction.
+ *
+ * The memory will be reclaimed when the outermost transaction ends and
+ * therefore must not be freed by the caller, nor referenced afterwards.
+ *
+ * @param size		amount of bytes to allocate
+ *
+ * @return pointer to allocated memory, NULL if no transaction is opened
+ * or when the request is too large, in which case the caller must allocate
+ * memory by other means.
+ */
+void *
+arena_tx_alloc(size_t size)
+{
+	arena_t *a;
+
+	ONCE_FLAG_RUN(arena_key_inited, arena_key_init);
+
+	a = thread_local_get(arena_key);
+
+	if G_UNLIKELY(NULL == a)
+		return NULL;
+
+	if G_UNLIKELY(0 == a->depth || size > ARENA_TX_MAXSIZE) {
+		a->stats.declined++;
+		return NULL;
+	}
+
+	a->stats.tx_allocations++;
+
+	return arena_alloc(a, size);
+}
+
+/**
+ * Dump thread arena statistics to specified log agent.
+ */
+void G_COLD
+arena_dump_stats_log(logagent_t *la, unsigned options)
+{
+	struct arena_stats stats;
+	uint64 tx_time_avg, alloc_avg;
+	size_t i, arenas = 0;
+	bool groupped = booleanize(options & DUMP_OPT_PRETTY);
+
+	ZERO(&stats);
+
+	/*
+	 * Counters are updated without locks by each thread, so this is only
+	 * a snapshot, which is good enough for statistics.
+	 */
+
+	for (i = 0; i < N_ITEMS(arena_threads); i++) {
+		const arena_t *a = arena_threads[i];
+
+		if (NULL == a)
+			continue;
+
+		arenas++;
+		stats.allocations    += a->stats.allocations;
+		stats.allocated      += a->stats.allocated;
+		stats.declined       += a->stats.declined;
+		stats.resets         += a->stats.resets;
+		stats.chunks         += a->stats.chunks;
+		stats.transactions   += a->stats.transactions;
+		stats.tx_allocations += a->stats.tx_allocations;
+		stats.tx_time        += a->stats.tx_time;
+		stats.tx_time_max = MAX(stats.tx_time_max, a->stats.tx_time_max);
+		stats.high_water = MAX(stats.high_water, a->stats.high_water);
+	}
+
+	tx_time_avg = stats.tx_time /
+		(0 == stats.transactions ? 1 : stats.transactions);
+	alloc_avg = stats.tx_allocations /
+		(0 == stats.transactions ? 1 : stats.transactions);
+
+#define DUMP(x)	log_info(la, "ARENA %s = %s", #x,		\
+	uint64_to_string_grp(stats.x, groupped))
+
+#define DUMV(x)	log_info(la, "ARENA %s = %s", #x,		\
+	uint64_to_string_grp(x, groupped))
+
+	DUMV(arenas);
+	DUMP(chunks);
+	DUMP(allocations);
+	DUMP(allocated);
+	DUMP(declined);
+	DUMP(resets);
+	DUMP(high_water);
+	DUMP(transactions);
+	DUMP(tx_allocations);
+	DUMV(alloc_avg);
+	DUMP(tx_time);
+	DUMV(tx_time_avg);
+	DUMP(tx_time_max);
+
+#undef DUMP
+#undef DUMV
+}
+
+/* vi: set ts=4 sw=4 cindent: */
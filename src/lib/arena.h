@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Bump-pointer memory arenas.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _arena_h_
+#define _arena_h_
+
+struct logagent;
+
+struct arena;
+typedef struct arena arena_t;
+
+/*
+ * Public interface.
+ */
+
+arena_t *arena_make(void);
+void arena_free_null(arena_t **a_ptr);
+void *arena_alloc(arena_t *a, size_t size) G_MALLOC;
+void arena_reset(arena_t *a);
+size_t arena_used(const arena_t *a) G_PURE;
+
+void arena_begin(void);
+void arena_end(void);
+bool arena_active(void);
+void *arena_tx_alloc(size_t size) G_MALLOC;
+
+void arena_dump_stats_log(struct logagent *la, unsigned options);
+
+#endif /* _arena_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
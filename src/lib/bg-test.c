@@ -0,0 +1,347 @@
+/*
+ * bg-test -- background task worker pool unit tests.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "atomic.h"
+#include "bg.h"
+#include "crash.h"
+#include "getcpucount.h"
+#include "log.h"
+#include "misc.h"
+#include "parse.h"
+#include "progname.h"
+#include "pslist.h"
+#include "stringify.h"
+#include "teq.h"
+#include "thread.h"
+#include "tm.h"
+#include "walloc.h"
+
+#define TEST_TIMEOUT	60		/* Seconds, before declaring failure */
+#define TEST_LONG		200		/* Steps of a long task */
+#define TEST_SHORT		2		/* Steps of a short task */
+
+static unsigned verbose;
+
+enum test_task_magic { TEST_TASK_MAGIC = 0x4a7d1c3e };
+
+/*
+ * Context of the tasks we dispatch to the pool.
+ */
+struct test_task {
+	enum test_task_magic magic;
+	uint id;					/* Task number */
+	uint steps;					/* Amount of steps to run */
+	uint done;					/* Steps run so far */
+	uint stid;					/* Thread which ran the last step */
+	uint moves;					/* Times task changed of thread */
+	uint64 sum;					/* Computed, to keep the CPU busy */
+};
+
+static inline void
+test_task_check(const struct test_task * const tt)
+{
+	g_assert(tt != NULL);
+	g_assert(TEST_TASK_MAGIC == tt->magic);
+}
+
+static int test_completed;		/* Tasks completed, in the main thread */
+static int test_freed;			/* Contexts freed, in the main thread */
+static uint test_moved;			/* Tasks which ran on several threads */
+static uint test_main;			/* Main thread ID */
+static uint test_count;			/* Amount of tasks dispatched */
+static uint test_workers;		/* Amount of pool workers */
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-hv] [-n count] [-w workers]\n"
+		"  -h : prints this help message\n"
+		"  -n : amount of tasks to dispatch (default is 100)\n"
+		"  -v : verbose, increase to also trace background tasks\n"
+		"  -w : amount of pool workers (default is one per CPU)\n"
+		"Values given as decimal, hexadecimal (0x), octal (0) or binary (0b)\n"
+		, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static unsigned
+get_number(const char *arg, int opt)
+{
+	int error;
+	uint32 val;
+
+	val = parse_v32(arg, NULL, &error);
+	if (0 == val && error != 0) {
+		fprintf(stderr, "%s: invalid -%c argument \"%s\": %s\n",
+			getprogname(), opt, arg, english_strerror(error));
+		exit(EXIT_FAILURE);
+	}
+
+	return val;
+}
+
+/*
+ * Processing step, run from the pool workers.
+ */
+static bgret_t
+test_step(bgtask_t *h, void *ctx, int ticks)
+{
+	struct test_task *tt = ctx;
+	uint stid = thread_small_id();
+	uint i;
+
+	(void) h;
+	(void) ticks;
+
+	test_task_check(tt);
+	g_assert_log(stid != test_main,
+		"%s(): task #%u running in main thread", G_STRFUNC, tt->id);
+
+	if (tt->done != 0 && stid != tt->stid)
+		tt->moves++;
+
+	tt->stid = stid;
+
+	/*
+	 * The first task holds its worker until all the others have completed,
+	 * so that the tasks queued behind it can only be run if stolen.  The
+	 * head of the run queue is never stolen, hence one task is left over.
+	 */
+
+	if (0 == tt->id && 0 == tt->done && test_workers > 1) {
+		time_t start = tm_time_exact();
+
+		while (atomic_int_get(&test_completed) < (int) test_count - 2) {
+			if (delta_time(tm_time_exact(), start) > TEST_TIMEOUT)
+				break;
+			thread_sleep_ms(10);
+		}
+	}
+
+	for (i = 0; i < 50000; i++)
+		tt->sum += (tt->sum >> 7) ^ (i * 2654435761U);
+
+	return ++tt->done < tt->steps ? BGR_MORE : BGR_DONE;
+}
+
+/*
+ * Completion callback, must be marshalled back to the main thread.
+ */
+static void
+test_done(bgtask_t *h, void *ctx, bgstatus_t status, void *arg)
+{
+	struct test_task *tt = ctx;
+
+	(void) h;
+	(void) arg;
+
+	test_task_check(tt);
+	g_assert_log(thread_small_id() == test_main,
+		"%s(): task #%u completed in %s", G_STRFUNC, tt->id, thread_name());
+	g_assert_log(BGS_OK == status,
+		"%s(): task #%u ended with %s",
+		G_STRFUNC, tt->id, bgstatus_to_string(status));
+	g_assert(tt->done == tt->steps);
+
+	if (tt->moves != 0)
+		test_moved++;
+
+	if (verbose > 1) {
+		s_info("task #%u done: %u step%s, moved %u time%s",
+			tt->id, tt->steps, plural(tt->steps), tt->moves, plural(tt->moves));
+	}
+
+	atomic_int_inc(&test_completed);
+}
+
+/*
+ * Context freeing routine, must also be invoked from the main thread.
+ */
+static void
+test_free(void *ctx)
+{
+	struct test_task *tt = ctx;
+
+	test_task_check(tt);
+	g_assert(thread_small_id() == test_main);
+
+	tt->magic = 0;
+	WFREE(tt);
+	atomic_int_inc(&test_freed);
+}
+
+/*
+ * Dispatch tasks to the pool and wait for their completion.
+ *
+ * Tasks are created in alternating rounds of long and short ones, so that
+ * workers given short tasks become idle early and need to steal long tasks
+ * from the others.
+ */
+static void
+test_pool(uint count, uint workers)
+{
+	bgstep_cb_t steps[] = { test_step };
+	bgsched_t *bs;
+	bgpool_t *bp;
+	pslist_t *sl, *iter;
+	size_t stolen = 0, marshalled = 0;
+	time_t start;
+	uint i;
+
+	test_count = count;
+	test_workers = workers;
+
+	bs = bg_sched_create("test", 0);
+	bp = bg_pool_create("worker", workers, 0);
+	bg_sched_set_pool(bs, bp);
+
+	for (i = 0; i < count; i++) {
+		struct test_task *tt;
+
+		WALLOC0(tt);
+		tt->magic = TEST_TASK_MAGIC;
+		tt->id = i;
+		tt->steps = 0 == (i / MAX(workers, 2)) % 2 ? TEST_LONG : TEST_SHORT;
+
+		bg_task_create_threadsafe(bs, "test", steps, N_ITEMS(steps),
+			tt, test_free, test_done, NULL);
+	}
+
+	/*
+	 * Completions are delivered to our thread event queue, which is
+	 * processed whilst we sleep.
+	 */
+
+	start = tm_time_exact();
+
+	while (atomic_int_get(&test_freed) != (int) count) {
+		if (delta_time(tm_time_exact(), start) > TEST_TIMEOUT) {
+			s_error("%s(): only %d/%u task%s completed after %d secs",
+				G_STRFUNC, atomic_int_get(&test_completed), count,
+				plural(count), TEST_TIMEOUT);
+		}
+		thread_sleep_ms(10);
+	}
+
+	g_assert(atomic_int_get(&test_completed) == (int) count);
+
+	sl = bg_sched_info_list();
+
+	PSLIST_FOREACH(sl, iter) {
+		const bgsched_info_t *bsi = iter->data;
+
+		bgsched_info_check(bsi);
+
+		if (NULL == bsi->pool)
+			continue;
+
+		if (verbose) {
+			s_info("%s: %zu completed, %zu step%s, %zu stolen, %zu marshalled",
+				bsi->name, bsi->completed, bsi->steps, plural(bsi->steps),
+				bsi->stolen, bsi->marshalled);
+		}
+
+		stolen += bsi->stolen;
+		marshalled += bsi->marshalled;
+	}
+
+	bg_sched_info_list_free_null(&sl);
+
+	g_assert_log(marshalled == count,
+		"%s(): %zu completion%s marshalled for %u task%s",
+		G_STRFUNC, marshalled, plural(marshalled), count, plural(count));
+
+	if (workers > 1 && count >= 4 * workers) {
+		g_assert_log(stolen != 0,
+			"%s(): no task stolen with %u workers", G_STRFUNC, workers);
+	}
+
+	s_info("%u task%s completed by %u worker%s: %zu stolen, %u moved",
+		count, plural(count), workers, plural(workers), stolen, test_moved);
+
+	bg_sched_set_pool(bs, NULL);
+	bg_pool_destroy_null(&bp);
+	bg_sched_destroy_null(&bs);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	int c;
+	uint count = 100, workers = 0;
+	const char options[] = "hn:vw:";
+
+	progstart(argc, argv);
+	thread_set_main(TRUE);		/* We're the main thread, we can block */
+	crash_init(argv[0], getprogname(), 0, NULL);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'n':			/* amount of tasks */
+			count = get_number(optarg, c);
+			break;
+		case 'v':			/* verbose */
+			verbose++;
+			break;
+		case 'w':			/* amount of workers */
+			workers = get_number(optarg, c);
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0)
+		usage();
+
+	if (0 == workers)
+		workers = MAX(1, getcpucount());
+
+	if (verbose > 2)
+		bg_set_debug(verbose - 2);
+
+	test_main = thread_small_id();
+	teq_create();				/* To receive task completions */
+
+	test_pool(count, workers);
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2002-2003, 2013 Raphael Manfredi
+ * Copyright (c) 2002-2003, 2013, 2026 Raphael Manfredi
  *
  *----------------------------------------------------------------------
  * This file is part of gtk-gnutella.
@@ -97,19 +97,31 @@
  * makes it more complex and tedious to write, but it gives nice multiplexing
  * in an execution thread for "heavy" computations.
  *
+ * To exploit multiple cores, a scheduler can be attached to a worker pool,
+ * a set of threads each running its own scheduler.  Tasks created through
+ * bg_task_create_threadsafe() on that scheduler are then dispatched to the
+ * least loaded worker, and idle workers steal runnable tasks from busy ones.
+ * Such tasks must therefore not assume which thread runs their steps.  Their
+ * "done" and context freeing callbacks are however marshalled back to the
+ * thread that created the task, via its thread event queue.
+ *
  * @author Raphael Manfredi
- * @date 2002-2003, 2013
+ * @date 2002-2003, 2013, 2026
  */
 
 #include "common.h"
 
 #include "bg.h"
 
+#include "atomic.h"
 #include "atoms.h"
+#include "barrier.h"
+#include "constants.h"
 #include "cq.h"
 #include "elist.h"
 #include "entropy.h"
 #include "eslist.h"
+#include "getcpucount.h"
 #include "log.h"			/* For s_debug() and friends */
 #include "misc.h"
 #include "mutex.h"
@@ -119,6 +131,8 @@
 #include "stacktrace.h"
 #include "str.h"
 #include "stringify.h"		/* For short_time_ascii() and plural() */
+#include "teq.h"
+#include "thread.h"
 #include "tm.h"
 #include "walloc.h"
 
@@ -133,6 +147,10 @@
 #define BG_JUMP_END		1
 #define BG_JUMP_CANCEL	2
 
+#define BG_POOL_MAX		32				/**< Max amount of pool workers */
+#define BG_POOL_LIFE	500000UL		/**< Default worker life, in usecs */
+#define BG_POOL_DRAIN	50				/**< Max 100 ms waits for completions */
+
 enum bgsched_magic {
 	BGSCHED_MAGIC = 0x57a5ea07,
 };
@@ -164,6 +182,12 @@ struct bgsched {
 	int period;					/**< Scheduling period for callout, in ms */
 	unsigned stid;				/**< Thread running scheduler, -1 if unknown */
 	cperiodic_t *pev;			/**< Ticker periodic event */
+	bgpool_t *pool;				/**< Pool for thread-safe tasks (referenced) */
+	struct bgworker *worker;	/**< Pool worker running scheduler, if any */
+	size_t steps;				/**< Processing steps run */
+	size_t stolen;				/**< Tasks stolen from other pool workers */
+	size_t marshalled;			/**< Completions sent to creating thread */
+	int pending;				/**< Marshalled completions not run yet */
 	mutex_t lock;				/**< Thread-safe lock */
 	link_t lnk;					/**< Links all active schedulers */
 };
@@ -178,6 +202,45 @@ bg_sched_check(const bgsched_t * const bs)
 #define BG_SCHED_LOCK(s)	mutex_lock_const(&(s)->lock)
 #define BG_SCHED_UNLOCK(s)	mutex_unlock_const(&(s)->lock)
 
+enum bgpool_magic {
+	BGPOOL_MAGIC = 0x1f0c2b9d
+};
+
+/**
+ * A pool worker: a thread dedicated to running one scheduler.
+ */
+struct bgworker {
+	bgpool_t *pool;				/**< Pool to which worker belongs */
+	bgsched_t *sched;			/**< Scheduler run, NULL once worker exits */
+	barrier_t *b;				/**< Setup barrier, until thread is started */
+};
+
+/**
+ * A pool of workers, to which thread-safe tasks can be dispatched.
+ *
+ * The pool is reference-counted: each running worker holds a reference,
+ * as well as each scheduler targeting the pool and the pool creator.
+ */
+struct bgpool {
+	enum bgpool_magic magic;	/**< Magic number */
+	const char *name;			/**< Pool name (atom) */
+	struct bgworker *worker;	/**< Array of workers */
+	uint count;					/**< Amount of workers in array */
+	int refcnt;					/**< Reference count */
+	bool exiting;				/**< Set when pool is being destroyed */
+	mutex_t lock;				/**< Thread-safe lock */
+};
+
+static inline void
+bg_pool_check(const bgpool_t * const bp)
+{
+	g_assert(bp != NULL);
+	g_assert(BGPOOL_MAGIC == bp->magic);
+}
+
+#define BG_POOL_LOCK(p)		mutex_lock(&(p)->lock)
+#define BG_POOL_UNLOCK(p)	mutex_unlock(&(p)->lock)
+
 #define BGTASK_MAGIC_MASK	0xffffff00	/* Leading 24 bits set */
 #define BGTASK_MAGIC_BASE	0x3acc9300	/* Leading 24 bits significant */
 
@@ -230,6 +293,7 @@ struct bgtask {
 	int elapsed;			/**< Elapsed during last run, in usec */
 	double tick_cost;		/**< Time in ms. spent by each tick */
 	bgsig_cb_t sigh[BG_SIG_COUNT];	/**< Signal handlers */
+	unsigned owner;			/**< Thread which created a pooled task */
 	spinlock_t lock;		/**< Thread-safe lock */
 	slink_t bgt_link;		/**< Links task in appropriate list */
 };
@@ -271,6 +335,7 @@ bg_task_is_daemon(const bgtask_t * const bt)
  * Operating flags.
  */
 enum {
+	TASK_F_POOLED		= 1 << 8,	/**< Task runs in a worker pool */
 	TASK_F_CANCELLING	= 1 << 7,	/**< Task handling cancel request */
 	TASK_F_DAEMON		= 1 << 6,	/**< Task is a daemon */
 	TASK_F_RUNNABLE		= 1 << 5,	/**< Task is runnable */
@@ -331,6 +396,36 @@ bg_sched_list_remove(bgsched_t *bs)
 	BG_SCHED_LIST_UNLOCK;
 }
 
+/**
+ * Thread event queue callback used to awake an idle pool worker.
+ *
+ * There is nothing to do here: the worker re-evaluates whether it has work
+ * to perform once it has processed the event.
+ */
+static void
+bg_worker_kick(void *data)
+{
+	struct bgworker *bw = data;
+
+	bg_pool_check(bw->pool);
+}
+
+/**
+ * Make sure the pool worker running the scheduler, if any, will notice
+ * that it has new work to perform.
+ */
+static void
+bg_sched_kick(const bgsched_t *bs)
+{
+	struct bgworker *bw = bs->worker;
+
+	if (NULL == bw || bw->pool->exiting || thread_small_id() == bs->stid)
+		return;
+
+	if (teq_is_supported(bs->stid))
+		(void) teq_post_unique(bs->stid, bg_worker_kick, bw);
+}
+
 /**
  * @return the current step index for the task.
  */
@@ -1295,38 +1390,11 @@ bg_task_dead(bgtask_t *bt)
 }
 
 /**
- * Task has finished and is ready to be reclaimed, as long as its reference
- * count has dropped to 1 or 0.
+ * Invoke user callbacks on task completion and mark the task dead.
  */
 static void
-bg_task_finished(bgtask_t *bt)
+bg_task_complete(bgtask_t *bt)
 {
-	g_assert(bt->refcnt >= 0);
-	g_assert(bt->flags & TASK_F_EXITED);
-
-	if (bg_debug > 2) {
-		s_debug("%s(): BGTASK %s\"%s\" finished, refcnt=%d",
-			G_STRFUNC, bg_task_daemon_str(bt), bt->name, bt->refcnt);
-	}
-
-	/*
-	 * If the task is still referenced, put it back to the sleeping queue.
-	 * It should never be scheduled again (it would need to be awoken first,
-	 * but since it is finished, that would be a user-code error).
-	 *
-	 * It will be reclaimed via bg_task_unref() calls.
-	 */
-
-	BG_TASK_LOCK(bt);
-
-	if (bt->refcnt > 1) {
-		bg_sched_sleep(bt);
-		BG_TASK_UNLOCK(bt);
-		return;
-	}
-
-	BG_TASK_UNLOCK(bt);
-
 	/*
 	 * Let the user know this task has now ended.
 	 * Upon return from this callback, further user-reference of the
@@ -1367,6 +1435,130 @@ bg_task_finished(bgtask_t *bt)
 	bg_task_dead(bt);
 }
 
+/**
+ * Thread event queue callback to complete a pooled task in the thread
+ * which created it.
+ */
+static void
+bg_task_completed(void *data)
+{
+	bgtask_t *bt = data;
+	bgsched_t *bs;
+
+	bg_task_check(bt);
+
+	/*
+	 * The task is no longer in any scheduling queue and cannot be stolen
+	 * anymore, so its scheduler is stable.  Once bg_task_complete() has
+	 * returned, the task can be reclaimed concurrently by its scheduler:
+	 * we must not reference it afterwards.
+	 */
+
+	bs = bt->sched;
+	bg_sched_check(bs);
+
+	bg_task_complete(bt);
+
+	BG_SCHED_LOCK(bs);
+	g_assert(bs->pending > 0);
+	bs->pending--;
+	BG_SCHED_UNLOCK(bs);
+}
+
+/**
+ * Send completion of a pooled task back to the thread which created it.
+ *
+ * When the creating thread has an I/O event queue, the completion will be
+ * dispatched from its event loop, otherwise it will be processed as soon
+ * as the thread gets the event.
+ *
+ * @return TRUE if completion was marshalled, FALSE if the creating thread
+ * has no event queue and the completion must be handled by the caller.
+ */
+static bool
+bg_task_marshal(bgtask_t *bt)
+{
+	bgsched_t *bs = bt->sched;
+	bool io;
+
+	bg_sched_check(bs);
+
+	io = teq_is_io_supported(bt->owner);
+
+	if (!io && !teq_is_supported(bt->owner)) {
+		if (bg_debug > 0) {
+			s_debug("BGTASK %s has no event queue, completing \"%s\" %p here",
+				thread_id_name(bt->owner), bt->name, bt);
+		}
+		return FALSE;
+	}
+
+	BG_SCHED_LOCK(bs);
+	bs->pending++;
+	bs->marshalled++;
+	BG_SCHED_UNLOCK(bs);
+
+	if (bg_debug > 2) {
+		s_debug("BGTASK sending completion of \"%s\" %p to %s",
+			bt->name, bt, thread_id_name(bt->owner));
+	}
+
+	if (io)
+		teq_safe_post(bt->owner, bg_task_completed, bt);
+	else
+		teq_post(bt->owner, bg_task_completed, bt);
+
+	return TRUE;
+}
+
+/**
+ * Task has finished and is ready to be reclaimed, as long as its reference
+ * count has dropped to 1 or 0.
+ */
+static void
+bg_task_finished(bgtask_t *bt)
+{
+	g_assert(bt->refcnt >= 0);
+	g_assert(bt->flags & TASK_F_EXITED);
+
+	if (bg_debug > 2) {
+		s_debug("%s(): BGTASK %s\"%s\" finished, refcnt=%d",
+			G_STRFUNC, bg_task_daemon_str(bt), bt->name, bt->refcnt);
+	}
+
+	/*
+	 * If the task is still referenced, put it back to the sleeping queue.
+	 * It should never be scheduled again (it would need to be awoken first,
+	 * but since it is finished, that would be a user-code error).
+	 *
+	 * It will be reclaimed via bg_task_unref() calls.
+	 */
+
+	BG_TASK_LOCK(bt);
+
+	if (bt->refcnt > 1) {
+		bg_sched_sleep(bt);
+		BG_TASK_UNLOCK(bt);
+		return;
+	}
+
+	BG_TASK_UNLOCK(bt);
+
+	/*
+	 * Pooled tasks run their steps in a worker thread, but user callbacks
+	 * are invoked from the thread which created the task.
+	 */
+
+	if (
+		(bt->flags & TASK_F_POOLED) &&
+		bt->owner != thread_small_id() &&
+		bg_task_marshal(bt)
+	)
+		return;
+
+	bg_task_complete(bt);
+}
+
 /**
  * Add a reference to the task.
  *
@@ -1765,6 +1957,7 @@ bg_task_cancel(bgtask_t *bt)
 		if (bg_debug > 1)
 			s_debug("BGTASK recorded foreign cancel for \"%s\" %p, "
 				"currently in %s()", bt->name, bt, bg_task_step_name(bt));
+		bg_sched_kick(bs);
 		return;
 	}
 
@@ -1899,9 +2092,6 @@ bg_task_wakeup(bgtask_t *bt)
 	bg_task_check(bt);
 	g_assert(bt->refcnt >= 1);
 
-	bs = bt->sched;
-	bg_sched_check(bs);
-
 	bg_task_trace(bt, G_STRFUNC, TRUE);
 
 	/*
@@ -1909,9 +2099,16 @@ bg_task_wakeup(bgtask_t *bt)
 	 * the scheduler at the same time someone would want to call this routine,
 	 * we need to hold the lock for the scheduler throughout the execution,
 	 * the leading precondition (about the task being sleeping) included.
+	 *
+	 * The scheduler is read with the task locked, since a pooled task can
+	 * be moved to another scheduler by a worker stealing it.
 	 */
 
 	BG_TASK_LOCK(bt);		/* Strict lock order: task first, then scheduler */
+
+	bs = bt->sched;
+	bg_sched_check(bs);
+
 	BG_SCHED_LOCK(bs);
 
 	bg_task_is_sleeping(bt, G_STRFUNC);
@@ -1950,6 +2147,9 @@ bg_task_wakeup(bgtask_t *bt)
 
 	BG_SCHED_UNLOCK(bs);
 	BG_TASK_UNLOCK(bt);
+
+	if (!only_requested)
+		bg_sched_kick(bs);
 }
 
 /**
@@ -2428,6 +2628,8 @@ bg_sched_timer(void *arg)
 			schedules, plural(schedules));
 	}
 
+	bs->steps += schedules;
+
 	/*
 	 * Update total scheduler work time, in msecs.
 	 */
@@ -2551,15 +2753,13 @@ bg_sched_create(const char *name, ulong max_life)
 }
 
 /**
- * Destroy a background task scheduler, terminating all its tasks.
+ * Terminate all the tasks held in a background task scheduler.
  */
 static void
-bg_sched_destroy(bgsched_t *bs)
+bg_sched_terminate(bgsched_t *bs)
 {
 	uint count;
 
-	bg_sched_list_remove(bs);
-
 	BG_SCHED_LOCK(bs);
 
 	count = bg_task_terminate_all(&bs->runq);
@@ -2572,9 +2772,45 @@ bg_sched_destroy(bgsched_t *bs)
 		s_warning("terminated %d daemon task%s", count, plural(count));
 	}
 
+	BG_SCHED_UNLOCK(bs);
+}
+
+/**
+ * Remove a reference on a worker pool, freeing it with the last one.
+ */
+static void
+bg_pool_unref(bgpool_t *bp)
+{
+	bg_pool_check(bp);
+
+	if (!atomic_int_dec_is_zero(&bp->refcnt))
+		return;
+
+	g_assert(bp->exiting);
+
+	WFREE_ARRAY(bp->worker, bp->count);
+	atom_str_free_null(&bp->name);
+	mutex_destroy(&bp->lock);
+	bp->magic = 0;
+	WFREE(bp);
+}
+
+/**
+ * Destroy a background task scheduler, terminating all its tasks.
+ */
+static void
+bg_sched_destroy(bgsched_t *bs)
+{
+	bg_sched_list_remove(bs);
+	bg_sched_terminate(bs);
+
+	BG_SCHED_LOCK(bs);
+
 	bg_reclaim_dead(bs);				/* Free dead tasks */
 	bs->runcount = 0;
 	cq_periodic_remove(&bs->pev);
+	if (bs->pool != NULL)
+		bg_pool_unref(bs->pool);
 	atom_str_free_null(&bs->name);
 
 	mutex_destroy(&bs->lock);
@@ -2597,6 +2833,490 @@ bg_sched_destroy_null(bgsched_t **bs_ptr)
 	}
 }
 
+/**
+ * @return amount of marshalled completions not yet processed.
+ */
+static int
+bg_sched_pending(const bgsched_t *bs)
+{
+	int r;
+
+	BG_SCHED_LOCK(bs);
+	r = bs->pending;
+	BG_SCHED_UNLOCK(bs);
+
+	return r;
+}
+
+/**
+ * Steal a runnable task from the busiest worker of the pool.
+ *
+ * Only pooled tasks that are not about to be put to sleep, cancelled or
+ * signalled can be moved to another scheduler.  We never take the head
+ * of the victim's run queue, since it can have been picked already by its
+ * scheduler, which therefore keeps at least one task to run.
+ *
+ * @param bw		the idle worker looking for work
+ *
+ * @return TRUE if a task was stolen.
+ */
+static bool
+bg_pool_steal(struct bgworker *bw)
+{
+	bgpool_t *bp = bw->pool;
+	bgsched_t *bs = bw->sched, *victim = NULL;
+	bgtask_t *bt, *locked = NULL, *stolen = NULL;
+	size_t max = 1;
+	uint i;
+
+	bg_pool_check(bp);
+
+	if (bp->exiting)
+		return FALSE;
+
+	BG_POOL_LOCK(bp);
+
+	for (i = 0; i < bp->count; i++) {
+		bgsched_t *ws = bp->worker[i].sched;
+		size_t n;
+
+		if (NULL == ws || ws == bs)
+			continue;
+
+		BG_SCHED_LOCK(ws);
+		n = eslist_count(&ws->runq);
+		BG_SCHED_UNLOCK(ws);
+
+		if (n > max) {
+			max = n;
+			victim = ws;
+		}
+	}
+
+	if (NULL == victim)
+		goto done;
+
+	BG_SCHED_LOCK(victim);
+
+	ESLIST_FOREACH_DATA(&victim->runq, bt) {
+		bg_task_check(bt);
+
+		if (eslist_head(&victim->runq) == bt)
+			continue;
+
+		if (
+			TASK_F_POOLED != (bt->flags & (
+				TASK_F_POOLED | TASK_F_DAEMON | TASK_F_RUNNING |
+				TASK_F_SIGNAL | TASK_F_CANCELLING | TASK_F_EXITED))
+		)
+			continue;
+
+		/* Unlocked peek, to skip tasks we could not steal anyway */
+
+		if (0 != (bt->uflags & ~TASK_UF_NOTICK) || bt->signals != NULL)
+			continue;
+
+		/*
+		 * The normal lock order is to lock the task, then the scheduler.
+		 * Since the scheduler is already locked, we can only try to lock
+		 * the task and move on to the next one if we cannot.  We swap the
+		 * lock order, since the scheduler must be released first.
+		 *
+		 * Once the task is locked, we cannot release it before the scheduler
+		 * so we give up if it has changed state in the meantime.
+		 */
+
+		if (!spinlock_swap_try(&bt->lock, &victim->lock))
+			continue;
+
+		locked = bt;
+
+		if (0 != (bt->uflags & ~TASK_UF_NOTICK) || bt->signals != NULL)
+			break;
+
+		eslist_remove(&victim->runq, bt);
+		bt->flags &= ~TASK_F_RUNNABLE;
+		victim->runcount--;
+		stolen = bt;
+		break;
+	}
+
+	BG_SCHED_UNLOCK(victim);
+
+	if (locked != stolen)
+		BG_TASK_UNLOCK(locked);
+
+	/*
+	 * The stolen task is still locked, hence it cannot be acted upon
+	 * until it is attached to its new scheduler.
+	 */
+
+	if (stolen != NULL) {
+		BG_SCHED_LOCK(bs);
+		stolen->sched = bs;
+		bs->runcount++;
+		bs->stolen++;
+		bg_sched_add(stolen);
+		BG_SCHED_UNLOCK(bs);
+		BG_TASK_UNLOCK(stolen);
+
+		if (bg_debug > 1) {
+			s_debug("BGTASK \"%s\" stole \"%s\" %p from \"%s\"",
+				bs->name, stolen->name, stolen, victim->name);
+		}
+	}
+
+done:
+	BG_POOL_UNLOCK(bp);
+
+	return stolen != NULL;
+}
+
+/**
+ * Kick idle workers of the pool, so that they can steal some of the tasks
+ * from a worker with several runnable tasks.
+ */
+static void
+bg_pool_share(struct bgworker *bw)
+{
+	bgpool_t *bp = bw->pool;
+	uint i;
+
+	bg_pool_check(bp);
+
+	BG_POOL_LOCK(bp);
+
+	for (i = 0; i < bp->count; i++) {
+		bgsched_t *ws = bp->worker[i].sched;
+
+		if (ws != NULL && ws != bw->sched && 0 == bg_sched_runcount(ws))
+			bg_sched_kick(ws);
+	}
+
+	BG_POOL_UNLOCK(bp);
+}
+
+/**
+ * Is there work for the pool worker, or is the pool being destroyed?
+ */
+static bool
+bg_worker_has_work(void *arg)
+{
+	struct bgworker *bw = arg;
+
+	return bw->pool->exiting ||
+		0 != bg_sched_runcount(bw->sched) || bg_pool_steal(bw);
+}
+
+/**
+ * Pool worker main loop.
+ */
+static void *
+bg_worker_main(void *arg)
+{
+	struct bgworker *bw = arg;
+	bgpool_t *bp = bw->pool;
+	bgsched_t *bs = bw->sched;
+	barrier_t *b = bw->b;
+	int i;
+
+	thread_set_name(bs->name);
+	teq_create();				/* Queue to receive kicks and completions */
+
+	bs->stid = thread_small_id();
+	bs->worker = bw;
+	bw->b = NULL;
+
+	barrier_wait(b);			/* Thread has initialized */
+	barrier_free_null(&b);
+
+	if (bg_debug > 0)
+		s_debug("BGTASK pool worker \"%s\" started", bs->name);
+
+	while (!bp->exiting) {
+		int n;
+
+		teq_wait(bg_worker_has_work, bw);
+
+		while (!bp->exiting && 0 != (n = bg_sched_run(bs))) {
+			if (n > 1)
+				bg_pool_share(bw);
+			thread_check_suspended();
+		}
+	}
+
+	/*
+	 * Hide the scheduler from the other workers before destroying it.
+	 *
+	 * Completions of the terminated tasks are marshalled to the threads
+	 * which created them, and they reference the scheduler: we can only
+	 * destroy it once they have all been processed.
+	 */
+
+	BG_POOL_LOCK(bp);
+	bw->sched = NULL;
+	BG_POOL_UNLOCK(bp);
+
+	bg_sched_terminate(bs);
+
+	for (i = 0; i < BG_POOL_DRAIN && 0 != bg_sched_pending(bs); i++)
+		thread_sleep_ms(100);
+
+	if (0 == bg_sched_pending(bs)) {
+		bg_sched_destroy_null(&bs);
+	} else {
+		s_warning("%s(): leaking scheduler \"%s\" with %d pending completion%s",
+			G_STRFUNC, bs->name, bs->pending, plural(bs->pending));
+	}
+
+	if (bg_debug > 0)
+		s_debug("BGTASK pool worker %s exiting", thread_name());
+
+	bg_pool_unref(bp);
+	return NULL;
+}
+
+/**
+ * Create a pool of worker threads to which thread-safe tasks can be
+ * dispatched, once a scheduler has been attached to it.
+ *
+ * This routine does not return until all the workers have been started.
+ *
+ * @param name		pool name, workers are named after it
+ * @param workers	amount of worker threads, 0 meaning one per CPU
+ * @param max_life	maximum life time of a worker scheduling tick, 0 = default
+ *
+ * @return the new pool, to be freed via bg_pool_destroy_null().
+ */
+bgpool_t *
+bg_pool_create(const char *name, uint workers, ulong max_life)
+{
+	bgpool_t *bp;
+	barrier_t *b;
+	uint i;
+
+	g_assert(name != NULL);
+
+	if (0 == workers)
+		workers = MAX(1, getcpucount());
+	if (0 == max_life)
+		max_life = BG_POOL_LIFE;
+
+	workers = MIN(workers, BG_POOL_MAX);
+
+	WALLOC0(bp);
+	bp->magic = BGPOOL_MAGIC;
+	bp->name = atom_str_get(name);
+	bp->count = workers;
+	bp->refcnt = 1 + workers;		/* Creator + each worker */
+	mutex_init(&bp->lock);
+	WALLOC0_ARRAY(bp->worker, workers);
+
+	b = barrier_new(workers + 1);
+
+	for (i = 0; i < workers; i++) {
+		struct bgworker *bw = &bp->worker[i];
+		const char *wname = constant_str(str_smsg("%s #%u", name, i + 1));
+
+		bw->pool = bp;
+		bw->sched = bg_sched_alloc(wname, max_life, FALSE);
+		bw->b = barrier_refcnt_inc(b);
+
+		/*
+		 * Workers are detached since we do not expect any result from them.
+		 * They are not cancelable: they exit when the pool is destroyed.
+		 */
+
+		thread_create(bg_worker_main, bw,
+			THREAD_F_DETACH | THREAD_F_NO_CANCEL |
+				THREAD_F_NO_POOL | THREAD_F_PANIC,
+			THREAD_STACK_DFLT);
+	}
+
+	barrier_wait(b);		/* Wait for all the workers to initialize */
+	barrier_free_null(&b);
+
+	if (bg_debug > 0) {
+		s_debug("BGTASK created pool \"%s\" with %u worker%s",
+			name, workers, plural(workers));
+	}
+
+	return bp;
+}
+
+/**
+ * Destroy a worker pool and nullify its pointer.
+ *
+ * Workers terminate the tasks they still hold and exit asynchronously.
+ * Schedulers still targeting the pool will keep running thread-safe tasks
+ * themselves.
+ */
+void
+bg_pool_destroy_null(bgpool_t **bp_ptr)
+{
+	bgpool_t *bp = *bp_ptr;
+
+	if (bp != NULL) {
+		uint i;
+
+		bg_pool_check(bp);
+		g_assert(!bp->exiting);
+
+		BG_POOL_LOCK(bp);
+
+		bp->exiting = TRUE;
+		atomic_mb();
+
+		for (i = 0; i < bp->count; i++) {
+			struct bgworker *bw = &bp->worker[i];
+
+			if (bw->sched != NULL && teq_is_supported(bw->sched->stid))
+				teq_post(bw->sched->stid, bg_worker_kick, bw);
+		}
+
+		BG_POOL_UNLOCK(bp);
+
+		bg_pool_unref(bp);
+		*bp_ptr = NULL;
+	}
+}
+
+/**
+ * Attach a scheduler to a worker pool.
+ *
+ * Tasks subsequently created via bg_task_create_threadsafe() on that
+ * scheduler will run in the pool.
+ *
+ * @param bs		the scheduler (NULL = default)
+ * @param bp		the pool to target, NULL to detach the scheduler
+ */
+void
+bg_sched_set_pool(bgsched_t *bs, bgpool_t *bp)
+{
+	bgpool_t *old;
+
+	if (NULL == bs)
+		bs = bg_sched;
+
+	bg_sched_check(bs);
+	g_assert(NULL == bs->worker);	/* Pool workers cannot delegate */
+
+	if (bp != NULL) {
+		bg_pool_check(bp);
+		atomic_int_inc(&bp->refcnt);
+	}
+
+	BG_SCHED_LOCK(bs);
+	old = bs->pool;
+	bs->pool = bp;
+	BG_SCHED_UNLOCK(bs);
+
+	if (old != NULL)
+		bg_pool_unref(old);
+}
+
+/**
+ * Create a new thread-safe background task.
+ *
+ * This is the same as bg_task_create() but when the scheduler is attached
+ * to a worker pool, the task is dispatched to the least loaded worker of
+ * the pool, and can later be stolen by other idle workers.  The processing
+ * steps must therefore be thread-safe.
+ *
+ * The "done" callback and the context freeing routine are invoked from the
+ * calling thread, as long as it has a thread event queue.
+ *
+ * @param bs			The scheduler to put task in (NULL = default)
+ * @param name			Task name (for tracing)
+ * @param steps			Work to perform (copied)
+ * @param stepcnt		Number of steps
+ * @param ucontext		User context
+ * @param ucontext_free	Free routine for context
+ * @param done_cb		Notification callback when done
+ * @param done_arg		Callback argument
+ *
+ * @returns an opaque handle.
+ */
+bgtask_t *
+bg_task_create_threadsafe(
+	bgsched_t *bs, const char *name,
+	const bgstep_cb_t *steps, int stepcnt,
+	void *ucontext, bgclean_cb_t ucontext_free,
+	bgdone_cb_t done_cb, void *done_arg)
+{
+	bgpool_t *bp;
+	bgsched_t *ws = NULL;
+	bgtask_t *bt = NULL;
+	int min = INT_MAX;
+	uint i;
+
+	if (NULL == bs)
+		bs = bg_sched;
+
+	bg_sched_check(bs);
+
+	BG_SCHED_LOCK(bs);
+	bp = bs->pool;
+	if (bp != NULL)
+		atomic_int_inc(&bp->refcnt);
+	BG_SCHED_UNLOCK(bs);
+
+	if (NULL == bp) {
+		return bg_task_create(bs, name, steps, stepcnt,
+			ucontext, ucontext_free, done_cb, done_arg);
+	}
+
+	BG_POOL_LOCK(bp);
+
+	for (i = 0; i < bp->count && !bp->exiting; i++) {
+		bgsched_t *s = bp->worker[i].sched;
+		int n;
+
+		if (NULL == s)
+			continue;
+
+		n = bg_sched_runcount(s);
+		if (n < min) {
+			min = n;
+			ws = s;
+		}
+	}
+
+	/*
+	 * The task is created stopped so that we can flag it before any worker
+	 * can run it.  We keep the pool locked to prevent the selected worker
+	 * from exiting until the task is in its run queue.
+	 */
+
+	if (ws != NULL) {
+		bt = bg_task_create_internal(ws, name, steps, stepcnt,
+			ucontext, ucontext_free, done_cb, done_arg, FALSE);
+
+		if (bt != NULL) {
+			BG_TASK_LOCK(bt);
+			bt->flags |= TASK_F_POOLED;
+			bt->owner = thread_small_id();
+			BG_TASK_UNLOCK(bt);
+
+			bg_task_run(bt);
+			bg_sched_kick(ws);
+		}
+	}
+
+	BG_POOL_UNLOCK(bp);
+	bg_pool_unref(bp);
+
+	if (ws != NULL)
+		return bt;
+
+	/*
+	 * The pool is being destroyed, run the task in the scheduler.
+	 */
+
+	return bg_task_create(bs, name, steps, stepcnt,
+		ucontext, ucontext_free, done_cb, done_arg);
+}
+
 struct bg_info_list_vars {
 	pslist_t *sl;
 	bgsched_t *bs;
@@ -2642,6 +3362,7 @@ bg_info_get(void *data, void *udata)
 	flags = bt->flags;								/* Read all bits once */
 	bi->running = booleanize(flags & TASK_F_RUNNING);
 	bi->daemon = booleanize(flags & TASK_F_DAEMON);
+	bi->pooled = booleanize(flags & TASK_F_POOLED);
 	bi->cancelling = booleanize(flags & TASK_F_CANCELLING);
 	bi->cancelled = booleanize(bt->uflags & TASK_UF_CANCELLED);
 
@@ -2749,6 +3470,11 @@ bg_sched_info_list(void)
 		bsi->runcount = bs->runcount;
 		bsi->max_life = bs->max_life;
 		bsi->period = bs->period;
+		bsi->steps = bs->steps;
+		bsi->stolen = bs->stolen;
+		bsi->marshalled = bs->marshalled;
+		if (bs->worker != NULL)
+			bsi->pool = atom_str_get(bs->worker->pool->name);
 		BG_SCHED_UNLOCK(bs);
 
 		sl = pslist_prepend(sl, bsi);
@@ -2768,6 +3494,7 @@ bg_sched_info_free(void *data, void *udata)
 	(void) udata;
 
 	atom_str_free_null(&bsi->name);
+	atom_str_free_null(&bsi->pool);
 	WFREE(bsi);
 }
 
@@ -28,7 +28,7 @@
  * Background task management.
  *
  * @author Raphael Manfredi
- * @date 2002-2003, 2013
+ * @date 2002-2003, 2013, 2026
  */
 
 #ifndef _bg_h_
@@ -70,6 +70,7 @@ typedef enum {
 
 typedef struct bgtask bgtask_t;
 typedef struct bgsched bgsched_t;
+typedef struct bgpool bgpool_t;
 
 enum bg_info_magic {
 	BGTASK_INFO_MAGIC  = 0x4f01b8ee,
@@ -93,6 +94,7 @@ typedef struct {
 	size_t wq_done;			/**< Processed items, for daemon tasks */
 	uint running:1;			/**< Is task running? */
 	uint daemon:1;			/**< Is task a daemon? */
+	uint pooled:1;			/**< Is task running in a worker pool? */
 	uint cancelled:1;		/**< Is task cancelled? */
 	uint cancelling:1;		/**< Is task cancel being processed? */
 	uint locked:1;			/**< Whether we could lock task to read all info */
@@ -119,6 +121,10 @@ typedef struct {
 	int runcount;			/**< Amount of runnable tasks */
 	uint max_life;			/**< Maximum schedule life, in usecs */
 	int period;				/**< Scheduling period for callout, in ms */
+	const char *pool;		/**< Pool name (atom), NULL if not a pool worker */
+	size_t steps;			/**< Amount of processing steps run */
+	size_t stolen;			/**< Tasks stolen from other pool workers */
+	size_t marshalled;		/**< Completions sent back to creating thread */
 } bgsched_info_t;
 
 static inline void
@@ -161,6 +167,10 @@ bgsched_t *bg_sched_create(const char *name, ulong max_life);
 void bg_sched_destroy_null(bgsched_t **bs_ptr);
 int bg_sched_run(bgsched_t *bs);
 int bg_sched_runcount(const bgsched_t *bs);
+void bg_sched_set_pool(bgsched_t *bs, bgpool_t *bp);
+
+bgpool_t *bg_pool_create(const char *name, uint workers, ulong max_life);
+void bg_pool_destroy_null(bgpool_t **bp_ptr);
 
 const char *bgstatus_to_string(bgstatus_t status);
 
@@ -182,6 +192,15 @@ bgtask_t *bg_task_create_stopped(
 	bgdone_cb_t done_cb,
 	void *done_arg);
 
+bgtask_t *bg_task_create_threadsafe(
+	bgsched_t *bs,
+	const char *name,
+	const bgstep_cb_t *steps, int stepcnt,
+	void *ucontext,
+	bgclean_cb_t ucontext_free,
+	bgdone_cb_t done_cb,
+	void *done_arg);
+
 bgtask_t *bg_daemon_create(
 	bgsched_t *bs,
 	const char *name,
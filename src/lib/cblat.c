@@ -0,0 +1,647 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Callback latency tracking.
+ *
+ * When enabled, the I/O event dispatcher and the callout queue time each
+ * callback they invoke using the monotonic clock, and report the duration
+ * here.  We keep a duration histogram per callback site, the site being
+ * identified by the address of the callback routine, so that we can later
+ * figure out which callbacks are stalling the event loops.
+ *
+ * Dispatchers bracket the callback with cblat_begin() and cblat_end(), which
+ * keep the callbacks being run by each thread on a small stack.  Trampolines
+ * dispatching the real event on behalf of a callback use cblat_begin_via()
+ * instead, so that the time is accounted to the event they invoke and not
+ * to the trampoline itself, which would otherwise lump together all the
+ * events it dispatches.
+ *
+ * Callbacks running for longer than the configured threshold are flagged
+ * with a warning naming the callback routine.  To avoid flooding the logs
+ * with a callback that is consistently slow, we only warn when the amount
+ * of slow calls for the site is a power of 2.
+ *
+ * A stack trace taken once the callback has returned would only show the
+ * dispatcher.  Therefore, a watchdog running in the event queue thread
+ * periodically looks at the callbacks being run by each thread, and when
+ * one has been running for longer than the threshold, it interrupts the
+ * stalled thread to have it unwind its own stack whilst still within the
+ * callback.  The trace is then logged by the watchdog.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "cblat.h"
+
+#include "atomic.h"
+#include "atoms.h"
+#include "evq.h"
+#include "hashing.h"
+#include "htable.h"
+#include "log.h"
+#include "mutex.h"
+#include "pow2.h"
+#include "stacktrace.h"
+#include "str.h"
+#include "stringify.h"
+#include "thread.h"
+#include "vsort.h"
+#include "walloc.h"
+#include "xmalloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#define CBLAT_BUCKETS	40	/**< Log2 buckets, in nanoseconds */
+#define CBLAT_DEPTH		4	/**< Nested callbacks tracked per thread */
+#define CBLAT_STACK		64	/**< Max frames in stalled callback trace */
+#define CBLAT_WATCHDOG	50	/**< Watchdog period, in ms */
+
+/**
+ * Statistics for a callback site.
+ */
+struct cblat_site {
+	const void *fn;					/**< Callback routine */
+	uint64 count;					/**< Amount of calls */
+	uint64 total_ns;				/**< Total time spent in callback */
+	uint64 max_ns;					/**< Longest call */
+	uint64 slow;					/**< Calls above threshold */
+	uint64 bucket[CBLAT_BUCKETS];	/**< Slot i counts [2^i, 2^(i+1)) */
+};
+
+/**
+ * A callback being run.
+ */
+struct cblat_frame {
+	const void *fn;					/**< Callback routine */
+	tm_nano_t start;				/**< When callback was invoked */
+	enum cblat_kind kind;			/**< Kind of callback */
+	bool relayed;					/**< Time accounted by a nested frame */
+};
+
+/**
+ * Callbacks being run by a thread.
+ *
+ * This is only updated by the thread itself, hence requires no locking.
+ * The watchdog reads it concurrently, and uses the amount of outermost
+ * callbacks run so far to make sure it is looking at the same callback.
+ */
+struct cblat_thread {
+	uint depth;						/**< Amount of nested callbacks */
+	uint incarnation;				/**< Thread ID incarnation */
+	uint64 calls;					/**< Outermost callbacks started */
+	uint64 traced;					/**< Last call traced by watchdog */
+	struct cblat_frame frame[CBLAT_DEPTH];
+};
+
+/**
+ * Stack trace of a stalled callback, filled by the stalled thread.
+ */
+struct cblat_stall {
+	void *stack[CBLAT_STACK];		/**< The frames */
+	size_t count;					/**< Amount of frames captured */
+	const void *fn;					/**< Stalled callback */
+	enum cblat_kind kind;			/**< Kind of stalled callback */
+	uint64 calls;					/**< Outermost call being traced */
+	uint64 ns;						/**< Time spent so far in callback */
+	uint stid;						/**< Stalled thread */
+};
+
+bool cblat_on;								/**< Whether tracking is enabled */
+
+static uint cblat_threshold_ms = CBLAT_THRESHOLD_DEFAULT;
+static htable_t *cblat_sites[CBLAT_KINDS];	/**< fn -> struct cblat_site */
+static struct cblat_thread cblat_thread[THREAD_MAX];
+static cperiodic_t *cblat_watchdog_ev;
+static mutex_t cblat_mtx = MUTEX_INIT;
+
+#define CBLAT_LOCK		mutex_lock(&cblat_mtx)
+#define CBLAT_UNLOCK	mutex_unlock(&cblat_mtx)
+
+/**
+ * @return name of callback kind.
+ */
+const char *
+cblat_kind_name(enum cblat_kind kind)
+{
+	switch (kind) {
+	case CBLAT_IO:		return "I/O";
+	case CBLAT_CQ:		return "callout";
+	case CBLAT_KINDS:	break;
+	}
+
+	return "unknown";
+}
+
+/**
+ * Thread interrupt routine, invoked by the stalled thread to trace itself.
+ */
+static void *
+cblat_stall_trace(void *arg)
+{
+	struct cblat_stall *cst = arg;
+	const struct cblat_thread *ct = &cblat_thread[cst->stid];
+
+	/*
+	 * Only trace when we are still within the stalled callback.
+	 */
+
+	if (0 != ct->depth && cst->calls == ct->calls)
+		cst->count = stacktrace_unwind(cst->stack, N_ITEMS(cst->stack), 2);
+
+	return NULL;
+}
+
+/**
+ * Thread interrupt completion, invoked in the watchdog thread to log the
+ * stack trace of the stalled thread.
+ */
+static void
+cblat_stall_report(void *unused_result, void *data)
+{
+	struct cblat_stall *cst = data;
+
+	(void) unused_result;
+
+	if (0 != cst->count) {
+		s_warning("%s(): %s callback %s() stalling %s for %s ms so far:",
+			G_STRFUNC, cblat_kind_name(cst->kind),
+			stacktrace_function_name(cst->fn), thread_id_name(cst->stid),
+			uint64_to_string(cst->ns / 1000000));
+		stacktrace_stack_print_decorated(STDERR_FILENO, cst->stid,
+			cst->stack, cst->count, STACKTRACE_F_ORIGIN | STACKTRACE_F_SOURCE);
+	}
+
+	WFREE(cst);
+}
+
+/**
+ * Check whether the callback run by a thread is stalled, and interrupt the
+ * thread to get a stack trace if so.
+ *
+ * @param id		the thread ID
+ * @param now		current monotonic time
+ * @param limit		threshold above which callbacks are stalled, in ns
+ */
+static void
+cblat_watchdog_check(uint id, const tm_nano_t *now, uint64 limit)
+{
+	struct cblat_thread *ct = &cblat_thread[id];
+	const struct cblat_frame *cf = NULL;
+	struct cblat_stall *cst;
+	struct cblat_site *cs;
+	enum cblat_kind kind;
+	const void *fn;
+	tm_nano_t elapsed;
+	uint64 calls, slow;
+	uint d, i;
+
+	d = ATOMIC_GET(&ct->depth);
+	calls = ct->calls;
+
+	if (0 == d || calls == ct->traced)
+		return;		/* Not running a callback, or already traced */
+
+	if (thread_id_incarnation(id) != ct->incarnation)
+		return;		/* Thread exited whilst running a callback */
+
+	/*
+	 * The stalled callback is the first one not relayed to a nested frame,
+	 * i.e. not a trampoline.
+	 */
+
+	for (i = 0; i < MIN(d, CBLAT_DEPTH); i++) {
+		cf = &ct->frame[i];
+		if (!cf->relayed)
+			break;
+	}
+
+	fn = cf->fn;
+	kind = cf->kind;
+	tm_precise_elapsed(&elapsed, now, &cf->start);
+
+	atomic_mb();
+
+	if (calls != ct->calls)
+		return;		/* Callback returned whilst we were looking */
+
+	if (tmn2ns(&elapsed) < limit)
+		return;
+
+	ct->traced = calls;
+
+	/*
+	 * Only trace the occurrences that will be flagged with a warning when
+	 * the callback returns.
+	 */
+
+	CBLAT_LOCK;
+	cs = NULL == cblat_sites[kind] ? NULL : htable_lookup(cblat_sites[kind], fn);
+	slow = (NULL == cs ? 0 : cs->slow) + 1;
+	CBLAT_UNLOCK;
+
+	if (!IS_POWER_OF_2(slow))
+		return;
+
+	WALLOC0(cst);
+	cst->fn = fn;
+	cst->kind = kind;
+	cst->calls = calls;
+	cst->ns = tmn2ns(&elapsed);
+	cst->stid = id;
+
+	if (0 != thread_interrupt(id, cblat_stall_trace, cst,
+			cblat_stall_report, cst))
+		WFREE(cst);
+}
+
+/**
+ * Watchdog, run periodically from the event queue thread, looking for
+ * threads stalled in a callback.
+ */
+static bool
+cblat_watchdog(void *unused_data)
+{
+	tm_nano_t now;
+	uint i, me = thread_small_id();
+	uint64 limit;
+
+	(void) unused_data;
+
+	CBLAT_LOCK;
+
+	if (!cblat_on) {
+		cblat_watchdog_ev = NULL;
+		CBLAT_UNLOCK;
+		return FALSE;		/* Tracking disabled, stop watchdog */
+	}
+
+	CBLAT_UNLOCK;
+
+	limit = cblat_threshold_ms * 1000000ULL;
+
+	if (0 == limit)
+		return TRUE;
+
+	tm_precise_monotonic(&now);
+
+	for (i = 0; i < N_ITEMS(cblat_thread); i++) {
+		if (i != me)
+			cblat_watchdog_check(i, &now, limit);
+	}
+
+	return TRUE;
+}
+
+/**
+ * Enable or disable callback latency tracking.
+ *
+ * Disabling keeps the statistics collected so far.
+ */
+void
+cblat_enable(bool on)
+{
+	CBLAT_LOCK;
+
+	if (on && NULL == cblat_sites[0]) {
+		uint i;
+
+		for (i = 0; i < N_ITEMS(cblat_sites); i++)
+			cblat_sites[i] = htable_create(HASH_KEY_SELF, 0);
+	}
+
+	cblat_on = on;
+
+	if (on && NULL == cblat_watchdog_ev) {
+		cblat_watchdog_ev =
+			evq_raw_periodic_add(CBLAT_WATCHDOG, cblat_watchdog, NULL);
+	}
+
+	CBLAT_UNLOCK;
+}
+
+/**
+ * Set threshold above which callbacks are flagged as slow, 0 to disable.
+ */
+void
+cblat_set_threshold(uint ms)
+{
+	cblat_threshold_ms = ms;
+}
+
+/**
+ * @return threshold above which callbacks are flagged as slow, in ms.
+ */
+uint
+cblat_threshold(void)
+{
+	return cblat_threshold_ms;
+}
+
+/**
+ * Record duration of a callback.
+ *
+ * @param kind		the kind of callback
+ * @param fn		the callback routine that was invoked
+ * @param ns		duration of the callback, in nanoseconds
+ */
+static void
+cblat_record(enum cblat_kind kind, const void *fn, uint64 ns)
+{
+	struct cblat_site *cs;
+	uint64 slow = 0;
+	uint i;
+
+	g_assert(UNSIGNED(kind) < CBLAT_KINDS);
+
+	CBLAT_LOCK;
+
+	if G_UNLIKELY(NULL == cblat_sites[kind])
+		goto done;		/* Tracking was never enabled */
+
+	cs = htable_lookup(cblat_sites[kind], fn);
+
+	if G_UNLIKELY(NULL == cs) {
+		WALLOC0(cs);
+		cs->fn = fn;
+		htable_insert(cblat_sites[kind], fn, cs);
+	}
+
+	cs->count++;
+	cs->total_ns += ns;
+	cs->max_ns = MAX(cs->max_ns, ns);
+
+	i = 0 == ns ? 0 : highest_bit_set64(ns);
+	cs->bucket[MIN(i, CBLAT_BUCKETS - 1)]++;
+
+	if (cblat_threshold_ms != 0 && ns >= cblat_threshold_ms * 1000000ULL)
+		slow = ++cs->slow;
+
+done:
+	CBLAT_UNLOCK;
+
+	/*
+	 * Log outside of the critical section.
+	 */
+
+	if G_UNLIKELY(slow != 0 && IS_POWER_OF_2(slow)) {
+		s_warning("%s(): slow %s callback %s() took %s ms (%s time%s)",
+			G_STRFUNC, cblat_kind_name(kind), stacktrace_function_name(fn),
+			uint64_to_string(ns / 1000000), uint64_to_string2(slow),
+			plural(slow));
+	}
+}
+
+/**
+ * Start timing a callback, invoked by the current thread.
+ *
+ * This must be paired with a cblat_end() call, once the callback returns.
+ *
+ * @param kind		the kind of callback
+ * @param fn		the callback routine about to be invoked
+ */
+void
+cblat_begin(enum cblat_kind kind, const void *fn)
+{
+	struct cblat_thread *ct = &cblat_thread[thread_small_id()];
+	uint d = ct->depth;
+
+	g_assert(UNSIGNED(kind) < CBLAT_KINDS);
+
+	if G_LIKELY(d < CBLAT_DEPTH) {
+		struct cblat_frame *cf = &ct->frame[d];
+
+		cf->fn = fn;
+		cf->kind = kind;
+		cf->relayed = FALSE;
+		tm_precise_monotonic(&cf->start);
+	}
+
+	if (0 == d) {
+		ct->incarnation = thread_id_incarnation(thread_small_id());
+		ct->calls++;
+	}
+
+	atomic_mb();		/* Frame must be filled before watchdog can see it */
+	ct->depth = d + 1;
+}
+
+/**
+ * Start timing a callback invoked by a trampoline, on behalf of the callback
+ * dispatched to that trampoline.
+ *
+ * If the enclosing callback being timed is the trampoline, its time will not
+ * be recorded: it is accounted to the callback we are about to invoke.
+ *
+ * This must be paired with a cblat_end() call, once the callback returns.
+ *
+ * @param kind		the kind of callback
+ * @param fn		the callback routine about to be invoked
+ * @param via		the trampoline invoking the callback
+ */
+void
+cblat_begin_via(enum cblat_kind kind, const void *fn, const void *via)
+{
+	struct cblat_thread *ct = &cblat_thread[thread_small_id()];
+	uint d = ct->depth;
+
+	if (d != 0 && d <= CBLAT_DEPTH) {
+		struct cblat_frame *cf = &ct->frame[d - 1];
+
+		if (via == cf->fn)
+			cf->relayed = TRUE;
+	}
+
+	cblat_begin(kind, fn);
+}
+
+/**
+ * Stop timing the last callback started by the current thread, recording
+ * its duration.
+ */
+void
+cblat_end(void)
+{
+	struct cblat_thread *ct = &cblat_thread[thread_small_id()];
+	uint d = ct->depth;
+
+	g_assert_log(d != 0, "%s(): no callback being timed", G_STRFUNC);
+
+	ct->depth = --d;
+
+	if G_LIKELY(d < CBLAT_DEPTH) {
+		const struct cblat_frame *cf = &ct->frame[d];
+
+		if G_LIKELY(!cf->relayed) {
+			tm_nano_t end, elapsed;
+
+			tm_precise_monotonic(&end);
+			tm_precise_elapsed(&elapsed, &end, &cf->start);
+			cblat_record(cf->kind, cf->fn, tmn2ns(&elapsed));
+		}
+	}
+}
+
+static bool
+cblat_site_free(const void *key, void *value, void *unused)
+{
+	struct cblat_site *cs = value;
+
+	(void) key;
+	(void) unused;
+
+	WFREE(cs);
+	return TRUE;
+}
+
+/**
+ * Discard all the statistics collected so far.
+ */
+void
+cblat_reset(void)
+{
+	uint i;
+
+	CBLAT_LOCK;
+
+	for (i = 0; i < N_ITEMS(cblat_sites); i++) {
+		if (cblat_sites[i] != NULL)
+			htable_foreach_remove(cblat_sites[i], cblat_site_free, NULL);
+	}
+
+	CBLAT_UNLOCK;
+}
+
+/**
+ * Estimate given percentile from the histogram of a site.
+ *
+ * @return upper bound of the bucket where the percentile lies, in ns.
+ */
+static uint64
+cblat_percentile(const struct cblat_site *cs, double p)
+{
+	uint64 target, seen = 0;
+	uint i;
+
+	if (0 == cs->count)
+		return 0;
+
+	target = (uint64) (p * cs->count);
+	if (target >= cs->count)
+		target = cs->count - 1;
+
+	for (i = 0; i < N_ITEMS(cs->bucket); i++) {
+		seen += cs->bucket[i];
+		if (seen > target)
+			return MIN((uint64) 1 << (i + 1), cs->max_ns);
+	}
+
+	return cs->max_ns;
+}
+
+static void
+cblat_site_collect(const void *key, void *value, void *data)
+{
+	struct cblat_site ***pp = data;
+
+	(void) key;
+
+	/* Copy, since the original can be updated concurrently once unlocked */
+
+	*(*pp)++ = WCOPY((struct cblat_site *) value);
+}
+
+static int
+cblat_site_cmp(const void *a, const void *b)
+{
+	const struct cblat_site * const *pa = a, * const *pb = b;
+
+	return CMP((*pb)->total_ns, (*pa)->total_ns);	/* Decreasing order */
+}
+
+/**
+ * Generate a report of the callbacks where most time was spent.
+ *
+ * @param kind		the kind of callbacks to report
+ * @param max		maximum amount of callbacks to report, 0 for all
+ *
+ * @return a new string, which must be freed via str_destroy_null().
+ */
+str_t *
+cblat_top(enum cblat_kind kind, size_t max)
+{
+	str_t *s = str_new(0);
+	struct cblat_site **vec, **p;
+	size_t i, n;
+
+	g_assert(UNSIGNED(kind) < CBLAT_KINDS);
+
+	CBLAT_LOCK;
+
+	n = NULL == cblat_sites[kind] ? 0 : htable_count(cblat_sites[kind]);
+	XMALLOC_ARRAY(vec, MAX(n, 1));
+	p = vec;
+	if (n != 0)
+		htable_foreach(cblat_sites[kind], cblat_site_collect, &p);
+
+	CBLAT_UNLOCK;
+
+	vsort(vec, n, sizeof vec[0], cblat_site_cmp);
+
+	if (0 == max)
+		max = n;
+
+	str_printf(s, "%10s %10s %9s %9s %9s %9s %6s %s\n",
+		"Calls", "Total (ms)", "Mean (us)", "p50 (us)", "p99 (us)", "Max (us)",
+		"Slow", "Callback");
+
+	for (i = 0; i < n; i++) {
+		struct cblat_site *cs = vec[i];
+
+		if (i < max) {
+			str_catf(s, "%10s %10.3f %9.1f %9.1f %9.1f %9.1f %6s %s()\n",
+				uint64_to_string(cs->count),
+				cs->total_ns / 1e6,
+				0 == cs->count ? 0.0 : cs->total_ns / 1e3 / cs->count,
+				cblat_percentile(cs, 0.50) / 1e3,
+				cblat_percentile(cs, 0.99) / 1e3,
+				cs->max_ns / 1e3,
+				uint64_to_string2(cs->slow),
+				stacktrace_function_name(cs->fn));
+		}
+
+		WFREE(cs);
+	}
+
+	XFREE_NULL(vec);
+
+	return s;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Callback latency tracking.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _cblat_h_
+#define _cblat_h_
+
+#include "tm.h"
+
+#define CBLAT_THRESHOLD_DEFAULT	100		/**< Slow callback threshold, in ms */
+
+/**
+ * Kinds of instrumented callbacks.
+ */
+enum cblat_kind {
+	CBLAT_IO = 0,			/**< I/O callbacks dispatched by inputevt */
+	CBLAT_CQ,				/**< Callout queue events */
+
+	CBLAT_KINDS
+};
+
+extern bool cblat_on;
+
+/**
+ * @return whether callback latency tracking is enabled.
+ */
+static inline bool
+cblat_enabled(void)
+{
+	return cblat_on;
+}
+
+struct str;
+
+/*
+ * Public interface.
+ */
+
+void cblat_enable(bool on);
+void cblat_set_threshold(uint ms);
+uint cblat_threshold(void);
+void cblat_begin(enum cblat_kind kind, const void *fn);
+void cblat_begin_via(enum cblat_kind kind, const void *fn, const void *via);
+void cblat_end(void);
+void cblat_reset(void);
+const char *cblat_kind_name(enum cblat_kind kind);
+struct str *cblat_top(enum cblat_kind kind, size_t max);
+
+#endif /* _cblat_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
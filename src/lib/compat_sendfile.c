@@ -33,6 +33,23 @@
 
 #include "common.h"
 
+#ifdef HAS_SYSCALL
+#include <sys/syscall.h>
+#endif
+
+/*
+ * The copy_file_range() system call and the FICLONE ioctl() are both Linux
+ * specific: the presence of the system call number tells us we're on Linux.
+ */
+
+#if defined(HAS_SYSCALL) && defined(SYS_copy_file_range)
+#define HAS_COPY_FILE_RANGE
+#include <sys/ioctl.h>
+#ifndef FICLONE
+#define FICLONE		_IOW(0x94, 9, int)		/* From <linux/fs.h> */
+#endif
+#endif	/* HAS_SYSCALL && SYS_copy_file_range */
+
 #include "compat_sendfile.h"
 
 #include "compat_pio.h"
@@ -230,4 +247,82 @@ compat_sendfile(int out_fd, int in_fd, off_t *offset, size_t count)
 #endif	/* HAS_SENDFILE */
 }
 
+/**
+ * Copy data between two regular files without going through user space.
+ *
+ * Unlike sendfile(), the filesystem is involved: it may share the data
+ * blocks between the two files (reflink), or perform the copy on the server
+ * side for network filesystems, in which case no data needs to transit
+ * through this host.
+ *
+ * @param in_fd		the file descriptor opened for reading
+ * @param in_off	input = offset where to read, output = next unread offset
+ * @param out_fd	the file descriptor opened for writing
+ * @param out_off	input = offset where to write, output = next offset
+ * @param count		amount of bytes to transfer
+ *
+ * @return the amount of bytes copied, 0 at the end of the input file,
+ * -1 on errors with errno set.  When the operation is not supported by
+ * the system, errno is set to ENOSYS.
+ */
+ssize_t
+compat_copy_file_range(int in_fd, off_t *in_off,
+	int out_fd, off_t *out_off, size_t count)
+{
+	g_assert(is_valid_fd(out_fd));
+	g_assert(is_valid_fd(in_fd));
+	g_assert(in_off != NULL);
+	g_assert(out_off != NULL);
+	g_assert(size_is_non_negative(count));
+
+#ifdef HAS_COPY_FILE_RANGE
+	{
+		int64 ioff = *in_off, ooff = *out_off;		/* loff_t */
+		ssize_t r;
+
+		r = syscall(SYS_copy_file_range,
+				in_fd, &ioff, out_fd, &ooff, count, 0U);
+
+		if (r > 0) {
+			*in_off = ioff;
+			*out_off = ooff;
+		}
+
+		return r;
+	}
+#else	/* !HAS_COPY_FILE_RANGE */
+	(void) count;
+	errno = ENOSYS;
+	return -1;
+#endif	/* HAS_COPY_FILE_RANGE */
+}
+
+/**
+ * Make the file opened for writing share all the data blocks of the input
+ * file, provided the filesystem supports it (reflink).
+ *
+ * This is an atomic operation: the two files end-up having the same content
+ * and no data are copied.  It is only possible when the two files lie on
+ * the same underlying filesystem.
+ *
+ * @param out_fd	the file descriptor opened for writing
+ * @param in_fd		the file descriptor opened for reading
+ *
+ * @return 0 if OK, -1 on failure with errno set.  When the operation is
+ * not supported by the system, errno is set to ENOSYS.
+ */
+int
+compat_clone_file(int out_fd, int in_fd)
+{
+	g_assert(is_valid_fd(out_fd));
+	g_assert(is_valid_fd(in_fd));
+
+#ifdef HAS_COPY_FILE_RANGE
+	return ioctl(out_fd, FICLONE, in_fd);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
 /* vi: set ts=4 sw=4 cindent: */
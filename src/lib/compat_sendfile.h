@@ -32,5 +32,8 @@
  */
 
 ssize_t compat_sendfile(int out_fd, int in_fd, off_t *offset, size_t count);
+ssize_t compat_copy_file_range(int in_fd, off_t *in_off,
+	int out_fd, off_t *out_off, size_t count);
+int compat_clone_file(int out_fd, int in_fd);
 
 /* vi: set ts=4 sw=4 cindent: */
@@ -38,6 +38,7 @@
 
 #include "atoms.h"
 #include "buf.h"
+#include "cblat.h"
 #include "elist.h"
 #include "entropy.h"
 #include "hashing.h"		/* For integer_hash_fast() */
@@ -1044,7 +1045,13 @@ cq_expire_internal(cqueue_t *cq, cevent_t *ev)
 	g_assert(fn != NULL);
 
 	CQ_UNLOCK(cq);
-	(*fn)(cq, arg);		/* Callback invoked with queue unlocked */
+	if G_UNLIKELY(cblat_enabled()) {
+		cblat_begin(CBLAT_CQ, func_to_pointer(fn));
+		(*fn)(cq, arg);
+		cblat_end();
+	} else {
+		(*fn)(cq, arg);		/* Callback invoked with queue unlocked */
+	}
 	CQ_LOCK(cq);
 
 	/*
@@ -1655,9 +1662,19 @@ cq_periodic_trampoline(cqueue_t *cq, void *data)
 	 *
 	 * To handle synchronous calls to cq_periodic_remove(), freeing of the
 	 * periodic event is deferred until we come back from the user call.
+	 *
+	 * When tracking callback latency, account the time to the periodic
+	 * event and not to this trampoline.
 	 */
 
-	reschedule = (*cp->event)(cp->arg);
+	if G_UNLIKELY(cblat_enabled()) {
+		cblat_begin_via(CBLAT_CQ, func_to_pointer(cp->event),
+			func_to_pointer(cq_periodic_trampoline));
+		reschedule = (*cp->event)(cp->arg);
+		cblat_end();
+	} else {
+		reschedule = (*cp->event)(cp->arg);
+	}
 
 	if (cp->to_free || !reschedule) {
 		cq_periodic_free(cp, TRUE);
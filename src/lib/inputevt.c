@@ -109,6 +109,7 @@ typedef struct {
 #include "inputevt.h"
 
 #include "bit_array.h"
+#include "cblat.h"
 #include "compat_poll.h"
 #include "fd.h"
 #include "glib-missing.h"	/* For g_main_context_get_poll_func() with GTK1 */
@@ -1004,6 +1005,10 @@ inputevt_handle(const struct poll_ctx *ctx, int fd, inputevt_cond_t condition)
 
 				s_info("%s(): ...back from %s()",
 					G_STRFUNC, stacktrace_function_name(handler));
+			} else if G_UNLIKELY(cblat_enabled()) {
+				cblat_begin(CBLAT_IO, func_to_pointer(relay->handler));
+				relay->handler(relay->data, fd, condition);
+				cblat_end();
 			} else {
 				relay->handler(relay->data, fd, condition);
 			}
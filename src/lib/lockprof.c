@@ -0,0 +1,520 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Lock contention profiler.
+ *
+ * When enabled, the spinlock, mutex and read-write lock layers report each
+ * accounted lock acquisition and release here, along with the source
+ * location where the lock is taken.  For each lock site, we collect:
+ *
+ * - the amount of acquisitions;
+ * - the amount of contended acquisitions, and the time spent waiting;
+ * - the time during which the lock was held.
+ *
+ * Since this code runs on the locking path, it cannot itself take any lock
+ * nor allocate memory.  Each thread therefore records its statistics in its
+ * own buffer, a fixed-size open-addressing table of lock sites, which needs
+ * no synchronization.  All the thread buffers are allocated at once when
+ * profiling is first enabled, and are never freed.
+ *
+ * Reports are built by merging the buffers of all the threads, reading
+ * them without locking: the values reported are therefore approximate,
+ * which is fine for profiling purposes.  Resetting statistics is done
+ * by bumping a generation number, each thread clearing its own buffer
+ * the next time it records something.
+ *
+ * Hidden spinlocks and mutexes are not profiled, as they are not accounted
+ * by the thread layer either: they are mostly used to build higher-level
+ * locks or within the memory allocators.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "lockprof.h"
+
+#include "atomic.h"
+#include "hashing.h"
+#include "htable.h"
+#include "misc.h"				/* For short_filename() */
+#include "mutex.h"
+#include "str.h"
+#include "stringify.h"
+#include "thread.h"
+#include "tm.h"
+#include "vmm.h"
+#include "vsort.h"
+#include "walloc.h"
+#include "xmalloc.h"
+
+#include "override.h"			/* Must be the last header included */
+
+#define LOCKPROF_SITES		256		/**< Lock sites per thread (power of 2) */
+#define LOCKPROF_SITES_MASK	(LOCKPROF_SITES - 1)
+#define LOCKPROF_HELD		32		/**< Held locks tracked per thread */
+
+/**
+ * Statistics for a lock site.
+ */
+struct lockprof_site {
+	const char *file;			/**< Where lock is taken, NULL if free slot */
+	uint line;					/**< Line where lock is taken */
+	uint8 kind;					/**< Lock kind (enum lockprof_kind) */
+	uint64 acquired;			/**< Amount of acquisitions */
+	uint64 contended;			/**< Amount of contended acquisitions */
+	uint64 wait_ns;				/**< Total time spent waiting */
+	uint64 wait_max_ns;			/**< Longest wait */
+	uint64 hold_ns;				/**< Total time lock was held */
+	uint64 hold_max_ns;			/**< Longest hold */
+};
+
+/**
+ * A lock currently held by a thread.
+ */
+struct lockprof_held {
+	const volatile void *lock;	/**< The lock object */
+	struct lockprof_site *site;	/**< Where lock was taken */
+	uint64 start;				/**< Acquisition time, in ns */
+	uint depth;					/**< Recursion depth */
+};
+
+/**
+ * Per-thread profiling buffer.
+ */
+struct lockprof_thread {
+	uint gen;					/**< Generation of recorded statistics */
+	size_t depth;				/**< Amount of entries in held[] */
+	const volatile void *waiting;	/**< Lock being waited for */
+	uint64 wait_start;			/**< When we started waiting, in ns */
+	uint64 overflow;			/**< Acquisitions not recorded, table full */
+	struct lockprof_held held[LOCKPROF_HELD];
+	struct lockprof_site site[LOCKPROF_SITES];
+};
+
+bool lockprof_on;				/**< Whether profiling is enabled */
+
+static struct lockprof_thread *lockprof_threads;	/**< THREAD_MAX items */
+static uint lockprof_gen;		/**< Current statistics generation */
+static mutex_t lockprof_mtx = MUTEX_INIT;
+
+/**
+ * @return name of lock kind.
+ */
+const char *
+lockprof_kind_name(enum lockprof_kind kind)
+{
+	switch (kind) {
+	case LOCKPROF_SPINLOCK:	return "spinlock";
+	case LOCKPROF_MUTEX:	return "mutex";
+	case LOCKPROF_RLOCK:	return "rlock";
+	case LOCKPROF_WLOCK:	return "wlock";
+	case LOCKPROF_KINDS:	break;
+	}
+
+	return "unknown";
+}
+
+/**
+ * @return current monotonic time, in ns.
+ */
+static inline uint64
+lockprof_now(void)
+{
+	tm_nano_t tn;
+
+	tm_precise_monotonic(&tn);
+	return tmn2ns(&tn);
+}
+
+/**
+ * @return profiling buffer of the current thread, NULL if none.
+ */
+static struct lockprof_thread *
+lockprof_thread(void)
+{
+	struct lockprof_thread *lt;
+	uint stid;
+
+	if G_UNLIKELY(NULL == lockprof_threads)
+		return NULL;
+
+	stid = thread_safe_small_id();
+
+	if G_UNLIKELY(stid >= THREAD_MAX)
+		return NULL;
+
+	lt = &lockprof_threads[stid];
+
+	/*
+	 * If statistics were reset since we last recorded something, clear them.
+	 */
+
+	if G_UNLIKELY(lt->gen != lockprof_gen) {
+		ZERO(&lt->site);
+		lt->depth = 0;
+		lt->waiting = NULL;
+		lt->overflow = 0;
+		lt->gen = lockprof_gen;
+	}
+
+	return lt;
+}
+
+/**
+ * Find or create lock site in thread buffer.
+ *
+ * @return the lock site, NULL if the buffer is full.
+ */
+static struct lockprof_site *
+lockprof_site(struct lockprof_thread *lt,
+	enum lockprof_kind kind, const char *file, unsigned line)
+{
+	uint h, i;
+
+	h = pointer_hash_fast(file) + line;
+
+	for (i = 0; i < LOCKPROF_SITES; i++) {
+		struct lockprof_site *ls = &lt->site[(h + i) & LOCKPROF_SITES_MASK];
+
+		if G_LIKELY(ls->file == file && ls->line == line && ls->kind == kind)
+			return ls;
+
+		if (NULL == ls->file) {
+			ls->line = line;
+			ls->kind = kind;
+			atomic_mb();		/* Key complete before slot is visible */
+			ls->file = file;
+			return ls;
+		}
+	}
+
+	lt->overflow++;
+	return NULL;
+}
+
+/**
+ * Record that the current thread is about to wait for a lock.
+ *
+ * This is called on the contention path, before spinning or sleeping.
+ *
+ * @param lock		the lock object being waited for
+ */
+void
+lockprof_waiting(const volatile void *lock)
+{
+	struct lockprof_thread *lt = lockprof_thread();
+
+	if G_UNLIKELY(NULL == lt)
+		return;
+
+	lt->waiting = lock;
+	lt->wait_start = lockprof_now();
+}
+
+/**
+ * Record lock acquisition by the current thread.
+ *
+ * @param lock		the lock object
+ * @param kind		the kind of lock
+ * @param file		file where lock was taken
+ * @param line		line where lock was taken
+ */
+void
+lockprof_acquired(const volatile void *lock, enum lockprof_kind kind,
+	const char *file, unsigned line)
+{
+	struct lockprof_thread *lt = lockprof_thread();
+	struct lockprof_site *ls;
+	uint64 now;
+	size_t i;
+
+	if G_UNLIKELY(NULL == lt)
+		return;
+
+	ls = lockprof_site(lt, kind, file, line);
+	if G_UNLIKELY(NULL == ls)
+		goto done;
+
+	ls->acquired++;
+
+	/*
+	 * A recursive acquisition cannot have been contended, and the hold time
+	 * is measured from the outermost acquisition.
+	 */
+
+	for (i = lt->depth; i != 0; i--) {
+		struct lockprof_held *lh = &lt->held[i - 1];
+
+		if (lh->lock == lock) {
+			lh->depth++;
+			goto done;
+		}
+	}
+
+	now = lockprof_now();
+
+	if (lt->waiting == lock) {
+		uint64 waited = now - lt->wait_start;
+
+		ls->contended++;
+		ls->wait_ns += waited;
+		ls->wait_max_ns = MAX(ls->wait_max_ns, waited);
+	}
+
+	if G_LIKELY(lt->depth < N_ITEMS(lt->held)) {
+		struct lockprof_held *lh = &lt->held[lt->depth++];
+
+		lh->lock = lock;
+		lh->site = ls;
+		lh->start = now;
+		lh->depth = 1;
+	}
+
+done:
+	lt->waiting = NULL;
+}
+
+/**
+ * Record lock release by the current thread.
+ *
+ * @param lock		the lock object
+ */
+void
+lockprof_released(const volatile void *lock)
+{
+	struct lockprof_thread *lt = lockprof_thread();
+	size_t i;
+
+	if G_UNLIKELY(NULL == lt)
+		return;
+
+	for (i = lt->depth; i != 0; i--) {
+		struct lockprof_held *lh = &lt->held[i - 1];
+		struct lockprof_site *ls;
+		uint64 held;
+
+		if (lh->lock != lock)
+			continue;
+
+		if (0 != --lh->depth)
+			return;
+
+		ls = lh->site;
+		held = lockprof_now() - lh->start;
+		ls->hold_ns += held;
+		ls->hold_max_ns = MAX(ls->hold_max_ns, held);
+
+		/* Locks are not necessarily released in reverse order */
+
+		memmove(lh, lh + 1, (lt->depth - i) * sizeof *lh);
+		lt->depth--;
+		return;
+	}
+
+	/* Lock was taken before profiling started, or was not tracked */
+}
+
+/**
+ * Enable or disable lock profiling.
+ *
+ * Disabling keeps the statistics collected so far.
+ */
+void
+lockprof_enable(bool on)
+{
+	mutex_lock(&lockprof_mtx);
+
+	/*
+	 * The thread buffers are allocated whilst profiling is still off, since
+	 * the memory allocator needs to take locks.
+	 */
+
+	if (on && NULL == lockprof_threads) {
+		lockprof_threads =
+			vmm_alloc0(THREAD_MAX * sizeof lockprof_threads[0]);
+		atomic_mb();
+	}
+
+	lockprof_on = on;
+
+	mutex_unlock(&lockprof_mtx);
+}
+
+/**
+ * Discard all the statistics collected so far.
+ */
+void
+lockprof_reset(void)
+{
+	atomic_uint_inc(&lockprof_gen);
+}
+
+static unsigned
+lockprof_total_hash(const void *key)
+{
+	const struct lockprof_site *ls = key;
+
+	return string_mix_hash(ls->file) + integer_hash(ls->line) + ls->kind;
+}
+
+static bool
+lockprof_total_eq(const void *a, const void *b)
+{
+	const struct lockprof_site *la = a, *lb = b;
+
+	return la->line == lb->line && la->kind == lb->kind &&
+		0 == strcmp(la->file, lb->file);
+}
+
+static void
+lockprof_total_collect(const void *key, void *value, void *data)
+{
+	struct lockprof_site ***pp = data;
+
+	(void) key;
+
+	*(*pp)++ = value;
+}
+
+static int
+lockprof_total_cmp(const void *a, const void *b)
+{
+	const struct lockprof_site * const *pa = a, * const *pb = b;
+	const struct lockprof_site *la = *pa, *lb = *pb;
+
+	/* Decreasing wait time, then decreasing contention */
+
+	return la->wait_ns == lb->wait_ns ?
+		CMP(lb->contended, la->contended) : CMP(lb->wait_ns, la->wait_ns);
+}
+
+/**
+ * Generate a report of the most contended lock sites.
+ *
+ * @param max		maximum amount of lock sites to report, 0 for all
+ *
+ * @return a new string, which must be freed via str_destroy_null().
+ */
+str_t *
+lockprof_top(size_t max)
+{
+	str_t *s = str_new(0);
+	htable_t *ht;
+	struct lockprof_site **vec, **p;
+	uint64 overflow = 0;
+	size_t i, n;
+	uint gen;
+
+	ht = htable_create_any(lockprof_total_hash, NULL, lockprof_total_eq);
+	gen = atomic_uint_get(&lockprof_gen);
+
+	for (i = 0; lockprof_threads != NULL && i < THREAD_MAX; i++) {
+		const struct lockprof_thread *lt = &lockprof_threads[i];
+		size_t j;
+
+		if (lt->gen != gen)
+			continue;		/* Statistics predate last reset */
+
+		overflow += lt->overflow;
+
+		for (j = 0; j < N_ITEMS(lt->site); j++) {
+			const struct lockprof_site *ls = &lt->site[j];
+			struct lockprof_site key, *total;
+
+			if (NULL == ls->file)
+				continue;
+
+			/*
+			 * Sites are merged by name: the same source file can be known
+			 * through different pointers, e.g. for inlined routines.
+			 */
+
+			key = *ls;		/* Snapshot, thread could update it */
+			total = htable_lookup(ht, &key);
+
+			if (NULL == total) {
+				WALLOC0(total);
+				total->file = key.file;
+				total->line = key.line;
+				total->kind = key.kind;
+				htable_insert(ht, total, total);
+			}
+
+			total->acquired += key.acquired;
+			total->contended += key.contended;
+			total->wait_ns += key.wait_ns;
+			total->wait_max_ns = MAX(total->wait_max_ns, key.wait_max_ns);
+			total->hold_ns += key.hold_ns;
+			total->hold_max_ns = MAX(total->hold_max_ns, key.hold_max_ns);
+		}
+	}
+
+	n = htable_count(ht);
+	XMALLOC_ARRAY(vec, MAX(n, 1));
+	p = vec;
+	htable_foreach(ht, lockprof_total_collect, &p);
+	vsort(vec, n, sizeof vec[0], lockprof_total_cmp);
+
+	if (0 == max)
+		max = n;
+
+	str_printf(s, "%-8s %10s %9s %6s %10s %10s %10s %10s %s\n",
+		"Kind", "Acquired", "Contended", "%", "Wait (ms)", "Wmax (us)",
+		"Hold (ms)", "Hmax (us)", "Site");
+
+	for (i = 0; i < n; i++) {
+		struct lockprof_site *ls = vec[i];
+
+		if (i < max) {
+			str_catf(s,
+				"%-8s %10s %9s %6.2f %10.3f %10.1f %10.3f %10.1f %s:%u\n",
+				lockprof_kind_name(ls->kind),
+				uint64_to_string(ls->acquired),
+				uint64_to_string2(ls->contended),
+				0 == ls->acquired ? 0.0 : 100.0 * ls->contended / ls->acquired,
+				ls->wait_ns / 1e6, ls->wait_max_ns / 1e3,
+				ls->hold_ns / 1e6, ls->hold_max_ns / 1e3,
+				short_filename(ls->file), ls->line);
+		}
+
+		WFREE(ls);
+	}
+
+	if (overflow != 0) {
+		str_catf(s, "(%s acquisition%s not recorded, thread buffers full)\n",
+			uint64_to_string(overflow), plural(overflow));
+	}
+
+	XFREE_NULL(vec);
+	htable_free_null(&ht);
+
+	return s;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
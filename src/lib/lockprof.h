@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Lock contention profiler.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _lockprof_h_
+#define _lockprof_h_
+
+/**
+ * Kinds of profiled locks.
+ */
+enum lockprof_kind {
+	LOCKPROF_SPINLOCK = 0,
+	LOCKPROF_MUTEX,
+	LOCKPROF_RLOCK,
+	LOCKPROF_WLOCK,
+
+	LOCKPROF_KINDS
+};
+
+extern bool lockprof_on;
+
+/**
+ * @return whether lock profiling is enabled.
+ */
+static inline bool
+lockprof_enabled(void)
+{
+	return lockprof_on;
+}
+
+struct str;
+
+/*
+ * Public interface.
+ */
+
+void lockprof_waiting(const volatile void *lock);
+void lockprof_acquired(const volatile void *lock, enum lockprof_kind kind,
+	const char *file, unsigned line);
+void lockprof_released(const volatile void *lock);
+
+void lockprof_enable(bool on);
+void lockprof_reset(void);
+const char *lockprof_kind_name(enum lockprof_kind kind);
+struct str *lockprof_top(size_t max);
+
+#endif /* _lockprof_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -65,6 +65,7 @@
 #include "atoms.h"
 #include "ckalloc.h"
 #include "crash.h"
+#include "dump_options.h"
 #include "fd.h"				/* For is_valid_fd() */
 #include "glog.h"
 #include "halloc.h"
@@ -2298,6 +2299,48 @@ log_debug(logagent_t *la, const char *format, ...)
 	va_end(args);
 }
 
+/**
+ * Context for log_stats_item().
+ */
+struct log_stats {
+	logagent_t *la;			/**< Where logging goes */
+	const char *prefix;		/**< Prefix of each logged line */
+	bool groupped;			/**< Whether to group digits */
+};
+
+/**
+ * Statistics enumeration callback, logging one counter.
+ */
+static void
+log_stats_item(const char *name, uint64 value, void *data)
+{
+	struct log_stats *ls = data;
+
+	log_info(ls->la, "%s %s = %s",
+		ls->prefix, name, uint64_to_string_grp(value, ls->groupped));
+}
+
+/**
+ * Log statistics counters, one per line as "prefix name = value".
+ *
+ * @param la		the log agent
+ * @param options	dumping options (DUMP_OPT_* flags)
+ * @param prefix	the prefix to use on each line
+ * @param foreach	the routine enumerating the statistics counters
+ */
+void
+log_stats(logagent_t *la, unsigned options,
+	const char *prefix, stats_foreach_fn_t foreach)
+{
+	struct log_stats ls;
+
+	ls.la = la;
+	ls.prefix = prefix;
+	ls.groupped = booleanize(options & DUMP_OPT_PRETTY);
+
+	(*foreach)(log_stats_item, &ls);
+}
+
 /**
  * Regular log handler used for glib's logging routines (the g_xxx() ones).
  */
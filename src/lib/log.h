@@ -183,6 +183,9 @@ void log_message(logagent_t *la, const char *format, ...) G_PRINTF(2, 3);
 void log_info(logagent_t *la, const char *format, ...) G_PRINTF(2, 3);
 void log_debug(logagent_t *la, const char *format, ...) G_PRINTF(2, 3);
 
+void log_stats(logagent_t *la, unsigned options,
+	const char *prefix, stats_foreach_fn_t foreach);
+
 #endif /* _log_h_ */
 
 /* vi: set ts=4 sw=4 cindent: */
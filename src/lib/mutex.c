@@ -39,6 +39,7 @@
 
 #include "atomic.h"
 #include "crash.h"
+#include "lockprof.h"
 #include "log.h"
 #include "spinlock.h"
 #include "thread.h"
@@ -53,6 +54,9 @@ mutex_get_account(const mutex_t *m, const char *file, unsigned line,
 	const void *element)
 {
 	thread_lock_got(m, THREAD_LOCK_MUTEX, file, line, element);
+
+	if G_UNLIKELY(lockprof_enabled())
+		lockprof_acquired(m, LOCKPROF_MUTEX, file, line);
 }
 
 static inline void
@@ -60,12 +64,18 @@ mutex_get_account_swap(const mutex_t *m, const char *file, unsigned line,
 	const void *plock, const void *element)
 {
 	thread_lock_got_swap(m, THREAD_LOCK_MUTEX, file, line, plock, element);
+
+	if G_UNLIKELY(lockprof_enabled())
+		lockprof_acquired(m, LOCKPROF_MUTEX, file, line);
 }
 
 static inline void
 mutex_release_account(const mutex_t *m, const void *element)
 {
 	thread_lock_released(m, THREAD_LOCK_MUTEX, element);
+
+	if G_UNLIKELY(lockprof_enabled())
+		lockprof_released(m);
 }
 
 static inline void
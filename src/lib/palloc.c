@@ -879,33 +879,39 @@ palloc_stats_digest(sha1_t *digest)
 }
 
 /**
- * Dump consolidated palloc statistics to specified log agent.
+ * Enumerate consolidated palloc statistics.
+ *
+ * @param cb		callback invoked with the name and value of each counter
+ * @param udata		additional callback argument
  */
-void G_COLD
-palloc_dump_stats_log(logagent_t *la, unsigned options)
+void
+palloc_stats_foreach(stats_fn_t cb, void *udata)
 {
 	pool_info_t stats;
-	bool groupped = booleanize(options & DUMP_OPT_PRETTY);
 
 	palloc_all_stats(&stats);
 
-#define DUMPS(x)	log_info(la, "PALLOC %s = %s", #x,			\
-	size_t_to_string_grp(stats.x, groupped))
+#define DUMP(x)	(*cb)(#x, stats.x, udata)
 
-#define DUMPV(x)		log_info(la, "PALLOC %s = %s", #x,		\
-	uint64_to_string_grp(stats.x, groupped))
+	DUMP(allocated);
+	DUMP(available);
+	DUMP(allocations);
+	DUMP(freeings);
+	DUMP(alloc_pool);
+	DUMP(alloc_core);
+	DUMP(free_fragments);
+	DUMP(free_collected);
 
-	DUMPS(allocated);
-	DUMPS(available);
-	DUMPV(allocations);
-	DUMPV(freeings);
-	DUMPV(alloc_pool);
-	DUMPV(alloc_core);
-	DUMPV(free_fragments);
-	DUMPV(free_collected);
+#undef DUMP
+}
 
-#undef DUMPS
-#undef DUMPV
+/**
+ * Dump consolidated palloc statistics to specified log agent.
+ */
+void G_COLD
+palloc_dump_stats_log(logagent_t *la, unsigned options)
+{
+	log_stats(la, options, "PALLOC", palloc_stats_foreach);
 }
 
 /*
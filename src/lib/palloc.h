@@ -93,6 +93,7 @@ void set_palloc_debug(uint32 level);
 struct pslist *pool_info_list(void);
 void pool_info_list_free_null(struct pslist **sl_ptr);
 void palloc_dump_stats_log(logagent_t *la, unsigned options);
+void palloc_stats_foreach(stats_fn_t cb, void *udata);
 void palloc_dump_pool_log(logagent_t *la);
 void palloc_dump_stats(void);
 
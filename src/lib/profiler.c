@@ -0,0 +1,738 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Statistical CPU profiler.
+ *
+ * The profiler arms the ITIMER_PROF interval timer, which delivers SIGPROF
+ * each time the process has consumed the configured slice of CPU time.
+ * The signal handler unwinds the stack of the interrupted thread into a
+ * slot of a ring buffer, reserved through a lock-free compare-and-swap on
+ * the head index.  When the ring is full, the sample is simply dropped.
+ *
+ * A periodic callout drains the ring buffer from the main thread and
+ * aggregates identical stacks, per thread name, in a hash table.  Symbol
+ * resolution is deferred until the results are requested, which keeps the
+ * signal path down to a stack unwinding.
+ *
+ * Results can be obtained as "folded" stacks, one line per distinct stack
+ * with frames separated by semi-colons and followed by the sample count,
+ * which is the input format of flame graph generators.  They can also be
+ * summarized per subsystem, which is derived from the prefix of the routine
+ * names (e.g. "zalloc" for zalloc_xxx() routines) where the samples hit.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "profiler.h"
+
+#include "atomic.h"
+#include "atoms.h"
+#include "cq.h"
+#include "hashing.h"
+#include "htable.h"
+#include "mutex.h"
+#include "signal.h"
+#include "stacktrace.h"
+#include "str.h"
+#include "stringify.h"
+#include "thread.h"
+#include "vmm.h"
+#include "vsort.h"
+#include "walloc.h"
+#include "xmalloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#define PROFILER_DEPTH		32		/**< Max amount of frames per sample */
+#define PROFILER_RING		2048	/**< Amount of slots in ring buffer */
+#define PROFILER_DRAIN_MS	250		/**< Ring buffer draining period */
+#define PROFILER_EXITED		"exited"	/**< Thread name when thread is gone */
+
+/**
+ * A sample, as recorded in the ring buffer by the signal handler.
+ */
+struct profiler_sample {
+	uint seq;					/**< Set to reserved index + 1 when filled */
+	uint incarnation;			/**< Thread ID incarnation number */
+	uint16 stid;				/**< Thread small ID */
+	uint16 depth;				/**< Amount of valid entries in pc[] */
+	void *pc[PROFILER_DEPTH];	/**< Stack, innermost frame first */
+};
+
+/**
+ * Aggregation key: a stack within a given thread.
+ */
+struct profiler_key {
+	const char *thread;			/**< Thread name (atom) */
+	void **pc;					/**< Stack, innermost frame first */
+	size_t depth;				/**< Amount of entries in pc[] */
+};
+
+/**
+ * An aggregated stack.
+ */
+struct profiler_entry {
+	struct profiler_key key;	/**< Stack identification */
+	uint64 count;				/**< Amount of samples */
+};
+
+static struct profiler_sample *profiler_ring;
+static uint profiler_head;		/**< Next slot to reserve in ring */
+static uint profiler_tail;		/**< Next slot to read from ring */
+static uint profiler_dropped;	/**< Samples dropped, ring being full */
+
+static htable_t *profiler_stacks;			/**< Aggregated stacks */
+static const char *profiler_threads[THREAD_MAX];	/**< Thread name atoms */
+static cperiodic_t *profiler_drain_ev;
+static uint profiler_hz;
+static uint64 profiler_samples;
+static uint64 profiler_truncated;
+static uint64 profiler_stale;		/**< Samples from gone threads */
+static uint profiler_dropped_base;	/**< Value of dropped at last reset */
+
+static mutex_t profiler_mtx = MUTEX_INIT;
+
+#define PROFILER_LOCK		mutex_lock(&profiler_mtx)
+#define PROFILER_UNLOCK		mutex_unlock(&profiler_mtx)
+
+static unsigned
+profiler_key_hash(const void *key)
+{
+	const struct profiler_key *k = key;
+
+	return pointer_hash(k->thread) ^
+		binary_hash(k->pc, k->depth * sizeof k->pc[0]);
+}
+
+static bool
+profiler_key_eq(const void *a, const void *b)
+{
+	const struct profiler_key *ka = a, *kb = b;
+
+	return ka->thread == kb->thread && ka->depth == kb->depth &&
+		0 == memcmp(ka->pc, kb->pc, ka->depth * sizeof ka->pc[0]);
+}
+
+/**
+ * SIGPROF handler.
+ *
+ * Unwinds the stack of the interrupted thread into the next slot of
+ * the ring buffer, unless it is full.
+ */
+static void
+profiler_sigprof(int signo)
+{
+	struct profiler_sample *s;
+	uint head, stid;
+
+	(void) signo;
+
+	if G_UNLIKELY(NULL == profiler_ring)
+		return;
+
+	do {
+		head = ATOMIC_GET(&profiler_head);
+		if (head - ATOMIC_GET(&profiler_tail) >= PROFILER_RING) {
+			ATOMIC_INC(&profiler_dropped);
+			return;
+		}
+	} while (!atomic_uint_xchg_if_eq(&profiler_head, head, head + 1));
+
+	s = &profiler_ring[head % PROFILER_RING];
+	stid = thread_safe_small_id();
+	s->stid = stid >= THREAD_MAX ? THREAD_MAX : stid;
+	s->incarnation = thread_id_incarnation(stid);
+	s->depth = stacktrace_unwind(s->pc, N_ITEMS(s->pc), 0);
+
+	atomic_mb();		/* Sample must be complete before it is published */
+	s->seq = head + 1;
+}
+
+/**
+ * Get the name of the thread that recorded the sample.
+ *
+ * The thread small ID recorded in the sample could have been reused, or its
+ * thread could have exited, by the time we drain the ring buffer.  We use
+ * the thread ID incarnation number to detect that, in which case we cannot
+ * know the name of the thread that was sampled.
+ *
+ * @return the name of the thread, NULL if the thread is gone.
+ */
+static const char *
+profiler_thread_name(const struct profiler_sample *s)
+{
+	const char *name;
+	uint stid = s->stid;
+
+	if G_UNLIKELY(stid >= N_ITEMS(profiler_threads))
+		return "unknown";
+
+	if G_UNLIKELY(thread_id_incarnation(stid) != s->incarnation)
+		return NULL;
+
+	/*
+	 * Thread small IDs are reused, hence we check that the cached name
+	 * is still accurate.
+	 */
+
+	name = thread_id_name(stid);
+
+	if G_UNLIKELY(
+		NULL == profiler_threads[stid] ||
+		0 != strcmp(name, profiler_threads[stid])
+	) {
+		atom_str_free_null(&profiler_threads[stid]);
+		profiler_threads[stid] = atom_str_get(name);
+	}
+
+	/*
+	 * The thread could have exited whilst we were fetching its name.
+	 */
+
+	if G_UNLIKELY(thread_id_incarnation(stid) != s->incarnation)
+		return NULL;
+
+	return profiler_threads[stid];
+}
+
+/**
+ * Aggregate sample into the table of stacks.
+ *
+ * @attention
+ * Must be called with the profiler lock held.
+ */
+static void
+profiler_record(const struct profiler_sample *s)
+{
+	struct profiler_key key;
+	struct profiler_entry *e;
+
+	key.thread = profiler_thread_name(s);
+
+	/*
+	 * When the thread is gone, only its name is lost: the stack is still
+	 * valid and must be accounted for, lest short-lived threads vanish
+	 * from the profile.
+	 */
+
+	if G_UNLIKELY(NULL == key.thread) {
+		key.thread = PROFILER_EXITED;
+		profiler_stale++;
+	}
+
+	key.pc = deconstify_pointer(s->pc);
+	key.depth = s->depth;
+
+	e = htable_lookup(profiler_stacks, &key);
+
+	if (NULL == e) {
+		WALLOC0(e);
+		e->key.thread = atom_str_get(key.thread);
+		e->key.depth = key.depth;
+		e->key.pc = 0 == key.depth ?
+			NULL : wcopy(key.pc, key.depth * sizeof key.pc[0]);
+		htable_insert(profiler_stacks, &e->key, e);
+	}
+
+	e->count++;
+	profiler_samples++;
+
+	if (PROFILER_DEPTH == s->depth)
+		profiler_truncated++;
+}
+
+/**
+ * Drain the ring buffer, aggregating all the completed samples.
+ */
+static void
+profiler_drain(void)
+{
+	uint tail;
+
+	PROFILER_LOCK;
+
+	if G_UNLIKELY(NULL == profiler_ring)
+		goto done;
+
+	for (tail = profiler_tail; tail != ATOMIC_GET(&profiler_head); tail++) {
+		const struct profiler_sample *s = &profiler_ring[tail % PROFILER_RING];
+
+		/*
+		 * If the slot was reserved but not filled yet, the signal handler
+		 * is still running in another thread: stop there and resume at
+		 * the next period.
+		 */
+
+		if (ATOMIC_GET(&s->seq) != tail + 1)
+			break;
+
+		profiler_record(s);
+		atomic_mb();		/* Slot processed before it can be reused */
+		profiler_tail = tail + 1;
+	}
+
+done:
+	PROFILER_UNLOCK;
+}
+
+/**
+ * Periodic callout to drain the ring buffer.
+ *
+ * @return TRUE to keep calling.
+ */
+static bool
+profiler_drain_periodic(void *unused)
+{
+	(void) unused;
+
+	profiler_drain();
+	return TRUE;
+}
+
+/**
+ * Start the profiler.
+ *
+ * @param hz	amount of samples per second of CPU time
+ *
+ * @return TRUE if OK, FALSE on error with errno set.
+ */
+bool
+profiler_start(uint hz)
+{
+#if defined(SIGPROF) && defined(ITIMER_PROF)
+	struct itimerval it;
+	void *pc[2];
+
+	if (0 == hz || hz > PROFILER_HZ_MAX) {
+		errno = EINVAL;
+		return FALSE;
+	}
+
+	PROFILER_LOCK;
+
+	if (profiler_hz != 0) {
+		PROFILER_UNLOCK;
+		errno = EBUSY;
+		return FALSE;
+	}
+
+	/*
+	 * The ring buffer is never freed once allocated, until profiler_close(),
+	 * so that a late signal, delivered after profiler_stop(), is harmless.
+	 */
+
+	if (NULL == profiler_ring)
+		profiler_ring = vmm_alloc0(PROFILER_RING * sizeof profiler_ring[0]);
+
+	if (NULL == profiler_stacks) {
+		profiler_stacks =
+			htable_create_any(profiler_key_hash, NULL, profiler_key_eq);
+	}
+
+	/*
+	 * Unwind once outside of the signal handler to let the stack unwinding
+	 * logic perform its one-time initialization, which can allocate memory.
+	 */
+
+	(void) stacktrace_unwind(pc, N_ITEMS(pc), 0);
+
+	if (SIG_ERR == signal_set(SIGPROF, profiler_sigprof))
+		goto failed;
+
+	it.it_interval.tv_sec = 1 / hz;
+	it.it_interval.tv_usec = (1000000 / hz) % 1000000;
+	it.it_value = it.it_interval;
+
+	if (-1 == setitimer(ITIMER_PROF, &it, NULL)) {
+		int saved_errno = errno;
+		signal_set(SIGPROF, SIG_IGN);
+		errno = saved_errno;
+		goto failed;
+	}
+
+	profiler_hz = hz;
+	profiler_drain_ev =
+		cq_periodic_main_add(PROFILER_DRAIN_MS, profiler_drain_periodic, NULL);
+
+	PROFILER_UNLOCK;
+	return TRUE;
+
+failed:
+	PROFILER_UNLOCK;
+	return FALSE;
+#else	/* !SIGPROF || !ITIMER_PROF */
+	(void) hz;
+	errno = ENOTSUP;
+	return FALSE;
+#endif	/* SIGPROF && ITIMER_PROF */
+}
+
+/**
+ * Stop the profiler, keeping the aggregated samples.
+ */
+void
+profiler_stop(void)
+{
+	PROFILER_LOCK;
+
+	if (0 == profiler_hz) {
+		PROFILER_UNLOCK;
+		return;
+	}
+
+#if defined(SIGPROF) && defined(ITIMER_PROF)
+	{
+		struct itimerval it;
+
+		ZERO(&it);
+		setitimer(ITIMER_PROF, &it, NULL);
+
+		/*
+		 * Ignore rather than restore the default action, which would
+		 * terminate the process should a signal be still pending.
+		 */
+
+		signal_set(SIGPROF, SIG_IGN);
+	}
+#endif	/* SIGPROF && ITIMER_PROF */
+
+	profiler_hz = 0;
+	cq_periodic_remove(&profiler_drain_ev);
+
+	PROFILER_UNLOCK;
+
+	profiler_drain();
+}
+
+/**
+ * @return whether the profiler is running.
+ */
+bool
+profiler_is_running(void)
+{
+	return 0 != ATOMIC_GET(&profiler_hz);
+}
+
+static bool
+profiler_entry_free(const void *key, void *value, void *unused)
+{
+	struct profiler_entry *e = value;
+
+	(void) key;
+	(void) unused;
+
+	atom_str_free_null(&e->key.thread);
+	if (e->key.pc != NULL)
+		wfree(e->key.pc, e->key.depth * sizeof e->key.pc[0]);
+	WFREE(e);
+
+	return TRUE;
+}
+
+/**
+ * Discard all the samples aggregated so far.
+ */
+void
+profiler_reset(void)
+{
+	profiler_drain();
+
+	PROFILER_LOCK;
+
+	if (profiler_stacks != NULL)
+		htable_foreach_remove(profiler_stacks, profiler_entry_free, NULL);
+
+	profiler_samples = 0;
+	profiler_truncated = 0;
+	profiler_stale = 0;
+	profiler_dropped_base = ATOMIC_GET(&profiler_dropped);
+
+	PROFILER_UNLOCK;
+}
+
+/**
+ * Fill supplied structure with profiler statistics.
+ */
+void
+profiler_stats(struct profiler_stats *ps)
+{
+	g_assert(ps != NULL);
+
+	profiler_drain();
+
+	PROFILER_LOCK;
+
+	ps->samples = profiler_samples;
+	ps->dropped = ATOMIC_GET(&profiler_dropped) - profiler_dropped_base;
+	ps->truncated = profiler_truncated;
+	ps->stale = profiler_stale;
+	ps->stacks = NULL == profiler_stacks ? 0 : htable_count(profiler_stacks);
+	ps->hz = profiler_hz;
+
+	PROFILER_UNLOCK;
+}
+
+/**
+ * Compute index of the first frame of the stack belonging to the code that
+ * was interrupted by SIGPROF, skipping the signal handling frames.
+ */
+static size_t
+profiler_entry_start(const struct profiler_entry *e)
+{
+	size_t i;
+
+	for (i = 0; i < e->key.depth; i++) {
+		const char *name = stacktrace_routine_name(e->key.pc[i], FALSE);
+
+		if (0 == strcmp(name, "signal_trampoline")) {
+			i++;
+
+			/*
+			 * Skip the signal return trampoline, which does not belong to
+			 * our text but to the C library.
+			 */
+
+			if (i < e->key.depth && !stacktrace_pc_within_our_text(e->key.pc[i]))
+				i++;
+
+			return i;
+		}
+	}
+
+	return 0;		/* Signal trampoline not found, keep everything */
+}
+
+/**
+ * Append sanitized name to string, as a frame of a folded stack.
+ */
+static void
+profiler_folded_cat(str_t *s, const char *name)
+{
+	const char *p;
+
+	for (p = name; *p != '\0'; p++) {
+		char c = *p;
+		str_putc(s, (';' == c || '\n' == c) ? '_' : c);
+	}
+}
+
+static void
+profiler_folded_entry(const void *key, void *value, void *data)
+{
+	const struct profiler_entry *e = value;
+	str_t *s = data;
+	size_t start, i;
+
+	(void) key;
+
+	start = profiler_entry_start(e);
+
+	profiler_folded_cat(s, e->key.thread);
+
+	for (i = e->key.depth; i > start; i--) {
+		str_putc(s, ';');
+		profiler_folded_cat(s,
+			stacktrace_routine_name(e->key.pc[i - 1], FALSE));
+	}
+
+	str_catf(s, " %s\n", uint64_to_string(e->count));
+}
+
+/**
+ * Generate the aggregated stacks in folded format, one line per stack,
+ * starting with the thread name and going from the outermost frame to
+ * the innermost one, followed by the amount of samples.
+ *
+ * @return a new string, which must be freed via str_destroy_null().
+ */
+str_t *
+profiler_folded(void)
+{
+	str_t *s = str_new(0);
+
+	profiler_drain();
+
+	PROFILER_LOCK;
+	if (profiler_stacks != NULL)
+		htable_foreach(profiler_stacks, profiler_folded_entry, s);
+	PROFILER_UNLOCK;
+
+	return s;
+}
+
+/**
+ * A subsystem, with the amount of samples attributed to it.
+ */
+struct profiler_subsystem {
+	const char *name;			/**< Subsystem name (atom) */
+	uint64 count;				/**< Amount of samples */
+};
+
+static void
+profiler_subsystem_entry(const void *key, void *value, void *data)
+{
+	const struct profiler_entry *e = value;
+	htable_t *ht = data;
+	struct profiler_subsystem *ps;
+	const char *name, *p;
+	char buf[64];
+	size_t i;
+
+	(void) key;
+
+	/*
+	 * Attribute the sample to the innermost frame that belongs to our
+	 * code, since the C library routines are called on its behalf.
+	 */
+
+	name = "unknown";
+
+	for (i = profiler_entry_start(e); i < e->key.depth; i++) {
+		if (stacktrace_pc_within_our_text(e->key.pc[i])) {
+			name = stacktrace_routine_name(e->key.pc[i], FALSE);
+			break;
+		}
+	}
+
+	p = strchr(name, '_');
+	clamp_strncpy(buf, sizeof buf, name,
+		NULL == p ? strlen(name) : ptr_diff(p, name));
+
+	ps = htable_lookup(ht, buf);
+
+	if (NULL == ps) {
+		WALLOC0(ps);
+		ps->name = atom_str_get(buf);
+		htable_insert(ht, ps->name, ps);
+	}
+
+	ps->count += e->count;
+}
+
+static int
+profiler_subsystem_cmp(const void *a, const void *b)
+{
+	const struct profiler_subsystem * const *pa = a, * const *pb = b;
+
+	return CMP((*pb)->count, (*pa)->count);	/* Decreasing order */
+}
+
+static void
+profiler_subsystem_collect(const void *key, void *value, void *data)
+{
+	struct profiler_subsystem ***pp = data;
+
+	(void) key;
+
+	*(*pp)++ = value;
+}
+
+/**
+ * Generate a summary of samples per subsystem, sorted by decreasing
+ * amount of samples.
+ *
+ * @param max		maximum amount of subsystems to report, 0 for all
+ *
+ * @return a new string, which must be freed via str_destroy_null().
+ */
+str_t *
+profiler_subsystems(size_t max)
+{
+	str_t *s = str_new(0);
+	htable_t *ht;
+	struct profiler_subsystem **vec, **p;
+	size_t i, n;
+	uint64 total;
+
+	profiler_drain();
+
+	ht = htable_create(HASH_KEY_STRING, 0);
+
+	PROFILER_LOCK;
+	if (profiler_stacks != NULL)
+		htable_foreach(profiler_stacks, profiler_subsystem_entry, ht);
+	total = profiler_samples;
+	PROFILER_UNLOCK;
+
+	n = htable_count(ht);
+	XMALLOC_ARRAY(vec, MAX(n, 1));
+	p = vec;
+	htable_foreach(ht, profiler_subsystem_collect, &p);
+	vsort(vec, n, sizeof vec[0], profiler_subsystem_cmp);
+
+	if (0 == max)
+		max = n;
+
+	for (i = 0; i < n; i++) {
+		struct profiler_subsystem *ps = vec[i];
+
+		if (i < max) {
+			str_catf(s, "%6.2f%% %10s %s\n",
+				0 == total ? 0.0 : 100.0 * ps->count / total,
+				uint64_to_string(ps->count), ps->name);
+		}
+
+		atom_str_free_null(&ps->name);
+		WFREE(ps);
+	}
+
+	XFREE_NULL(vec);
+	htable_free_null(&ht);
+
+	return s;
+}
+
+/**
+ * Stop profiling and release all the resources.
+ */
+void
+profiler_close(void)
+{
+	uint i;
+
+	profiler_stop();
+	profiler_reset();
+
+	PROFILER_LOCK;
+
+	htable_free_null(&profiler_stacks);
+
+	/*
+	 * The ring buffer is left allocated, on purpose, since the signal handler
+	 * could still be running in another thread.
+	 */
+
+	for (i = 0; i < N_ITEMS(profiler_threads); i++)
+		atom_str_free_null(&profiler_threads[i]);
+
+	PROFILER_UNLOCK;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Statistical CPU profiler.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _profiler_h_
+#define _profiler_h_
+
+#define PROFILER_HZ_DEFAULT		97		/**< Default sampling frequency */
+#define PROFILER_HZ_MAX			1000	/**< Maximum sampling frequency */
+
+/**
+ * Profiler statistics.
+ */
+struct profiler_stats {
+	uint64 samples;			/**< Samples aggregated */
+	uint64 dropped;			/**< Samples dropped, ring buffer being full */
+	uint64 truncated;		/**< Samples whose stack was truncated */
+	uint64 stale;			/**< Samples whose thread was gone */
+	size_t stacks;			/**< Distinct stacks recorded */
+	uint hz;				/**< Sampling frequency, 0 if not running */
+};
+
+struct str;
+
+/*
+ * Public interface.
+ */
+
+bool profiler_start(uint hz);
+void profiler_stop(void);
+bool profiler_is_running(void);
+void profiler_reset(void);
+void profiler_stats(struct profiler_stats *ps);
+
+struct str *profiler_folded(void);
+struct str *profiler_subsystems(size_t max);
+
+void profiler_close(void);
+
+#endif /* _profiler_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
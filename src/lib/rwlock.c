@@ -63,6 +63,7 @@
 #include "crash.h"
 #include "gentime.h"
 #include "getcpucount.h"
+#include "lockprof.h"
 #include "log.h"
 #include "spinlock.h"
 #include "stringify.h"
@@ -239,24 +240,36 @@ static inline void
 rwlock_read_account(const rwlock_t *rw, const char *file, unsigned line)
 {
 	thread_lock_got(rw, THREAD_LOCK_RLOCK, file, line, NULL);
+
+	if G_UNLIKELY(lockprof_enabled())
+		lockprof_acquired(rw, LOCKPROF_RLOCK, file, line);
 }
 
 static inline void
 rwlock_read_unaccount(const rwlock_t *rw)
 {
 	thread_lock_released(rw, THREAD_LOCK_RLOCK, NULL);
+
+	if G_UNLIKELY(lockprof_enabled())
+		lockprof_released(rw);
 }
 
 static inline void
 rwlock_write_account(const rwlock_t *rw, const char *file, unsigned line)
 {
 	thread_lock_got(rw, THREAD_LOCK_WLOCK, file, line, NULL);
+
+	if G_UNLIKELY(lockprof_enabled())
+		lockprof_acquired(rw, LOCKPROF_WLOCK, file, line);
 }
 
 static inline void
 rwlock_write_unaccount(const rwlock_t *rw)
 {
 	thread_lock_released(rw, THREAD_LOCK_WLOCK, NULL);
+
+	if G_UNLIKELY(lockprof_enabled())
+		lockprof_released(rw);
 }
 
 static inline void
@@ -786,6 +799,9 @@ static inline void
 rwlock_wait_grant(const rwlock_t *rw, struct rwlock_waiting *wc,
 	const char *file, unsigned line)
 {
+	if G_UNLIKELY(lockprof_enabled())
+		lockprof_waiting(rw);
+
 	rwlock_wait(rw, wc->reading, rwlock_lock_granted, wc, file, line);
 }
 
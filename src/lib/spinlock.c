@@ -42,6 +42,7 @@
 #include "crash.h"
 #include "gentime.h"
 #include "getcpucount.h"
+#include "lockprof.h"
 #include "log.h"
 #include "thread.h"
 
@@ -80,6 +81,9 @@ static inline void
 spinlock_account(const spinlock_t *s, const char *file, unsigned line)
 {
 	thread_lock_got(s, THREAD_LOCK_SPINLOCK, file, line, NULL);
+
+	if G_UNLIKELY(lockprof_enabled())
+		lockprof_acquired(s, LOCKPROF_SPINLOCK, file, line);
 }
 
 static inline void
@@ -87,12 +91,18 @@ spinlock_account_swap(const spinlock_t *s, const char *file, unsigned line,
 	const void *plock)
 {
 	thread_lock_got_swap(s, THREAD_LOCK_SPINLOCK, file, line, plock, NULL);
+
+	if G_UNLIKELY(lockprof_enabled())
+		lockprof_acquired(s, LOCKPROF_SPINLOCK, file, line);
 }
 
 static inline void
 spinunlock_account(const spinlock_t *s)
 {
 	thread_lock_released(s, THREAD_LOCK_SPINLOCK, NULL);
+
+	if G_UNLIKELY(lockprof_enabled())
+		lockprof_released(s);
 }
 
 static inline void ALWAYS_INLINE
@@ -287,6 +297,9 @@ spinlock_loop(volatile spinlock_t *s,
 	thread_lock_contention(SPINLOCK_SRC_MUTEX == src ?
 		THREAD_LOCK_MUTEX : THREAD_LOCK_SPINLOCK);
 
+	if G_UNLIKELY(lockprof_enabled())
+		lockprof_waiting(src_object);
+
 	if G_UNLIKELY(spinlock_contention_trace) {
 		s_rawinfo("LOCK contention for %s %p at %s:%u",
 			spinlock_source_string(src), src_object, file, line);
@@ -155,7 +155,7 @@ bool spinlock_grab_try_from(spinlock_t *s, bool hidden,
 	const char *file, unsigned line);
 void spinlock_grab_swap_from(spinlock_t *s, const void *plock,
 	const char *file, unsigned line);
-bool spinlock_grab_swap_try(spinlock_t *s, const void *plock,
+bool spinlock_grab_swap_try_from(spinlock_t *s, const void *plock,
 	const char *file, unsigned line);
 void spinlock_raw_from(spinlock_t *s, const char *file, unsigned line);
 
@@ -73,6 +73,7 @@
 #include "teq.h"
 
 #include "atomic.h"
+#include "cblat.h"
 #include "cq.h"
 #include "eslist.h"
 #include "evq.h"
@@ -396,6 +397,25 @@ teq_is_supported(unsigned id)
 	return supported;
 }
 
+/**
+ * Does the specified thread ID have a valid I/O event queue?
+ *
+ * Only threads with an I/O event queue can be targeted by teq_safe_post().
+ */
+bool
+teq_is_io_supported(unsigned id)
+{
+	bool supported;
+
+	g_assert(id < THREAD_MAX);
+
+	EVENT_QUEUE_LOCK;
+	supported = teq_is_io(event_queue[id]);
+	EVENT_QUEUE_UNLOCK;
+
+	return supported;
+}
+
 /**
  * Get the event queue for a specific thread ID.
  *
@@ -470,7 +490,14 @@ teq_cq_trampoline(cqueue_t *unused_cq, void *udata)
 
 	(void) unused_cq;
 
-	(*ci->event)(ci->data);
+	if G_UNLIKELY(cblat_enabled()) {
+		cblat_begin_via(CBLAT_CQ, func_to_pointer(ci->event),
+			func_to_pointer(teq_cq_trampoline));
+		(*ci->event)(ci->data);
+		cblat_end();
+	} else {
+		(*ci->event)(ci->data);
+	}
 	WFREE(ci);
 }
 
@@ -486,7 +513,14 @@ teq_async_rpc(cqueue_t *unused_cq, void *udata)
 
 	g_assert(THREAD_EVENT_ARPC_MAGIC == evr->magic);
 
-	evr->result = (*evr->routine)(evr->data);
+	if G_UNLIKELY(cblat_enabled()) {
+		cblat_begin_via(CBLAT_CQ, func_to_pointer(evr->routine),
+			func_to_pointer(teq_async_rpc));
+		evr->result = (*evr->routine)(evr->data);
+		cblat_end();
+	} else {
+		evr->result = (*evr->routine)(evr->data);
+	}
 	atomic_bool_set(&evr->done, TRUE);
 	thread_unblock(evr->id);
 }
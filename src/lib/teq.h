@@ -53,6 +53,7 @@ typedef void *(*teq_rpc_fn_t)(void *arg);
  */
 
 bool teq_is_supported(unsigned id);
+bool teq_is_io_supported(unsigned id);
 size_t teq_count(unsigned id);
 void teq_create(void);
 void teq_io_create(void);
@@ -403,6 +403,7 @@ struct thread_element {
 	tsigset_t sig_pending;			/**< Signals pending delivery */
 	unsigned signalled;				/**< Unblocking signal events sent */
 	unsigned sig_generation;		/**< Signal reception generation number */
+	unsigned incarnation;			/**< Bumped at each thread exit or reuse */
 	int in_signal_handler;			/**< Counts signal handler nesting */
 	bool sig_disabled;				/**< Cheap way of disabling all signals */
 	int sleep_interruptible;		/**< Shall a signal interrupt blocking? */
@@ -1954,6 +1955,7 @@ thread_element_mark_reusable_locked(struct thread_element *te)
 
 	te->reusable = TRUE;	/* Allow reuse */
 	te->valid = FALSE;		/* Holds stale values now */
+	te->incarnation++;		/* Thread ID no longer refers to same thread */
 }
 
 /**
@@ -2311,6 +2313,7 @@ thread_element_reset(struct thread_element *te)
 
 	te->locks.count = 0;
 	te->waits.count = 0;
+	te->incarnation++;
 	thread_element_clear_name(te);
 
 #ifdef MINGW32
@@ -4477,6 +4480,32 @@ thread_safe_id_name(unsigned id)
 	return thread_id_name_to_buf(id, b, sizeof emergency, FALSE);
 }
 
+/**
+ * Get the incarnation number of the specified thread ID.
+ *
+ * Thread small IDs are reused, so this number changes each time the thread
+ * holding the ID exits or the ID is reused by a new thread.  Comparing the
+ * incarnation numbers read at different times tells whether the thread ID
+ * still refers to the same thread.
+ *
+ * This routine does not take any lock and can be called from signal
+ * handlers.
+ *
+ * @return the incarnation number of the thread ID, 0 if invalid.
+ */
+unsigned
+thread_id_incarnation(unsigned id)
+{
+	const struct thread_element *te;
+
+	if G_UNLIKELY(id >= THREAD_MAX)
+		return 0;
+
+	te = threads[id];
+
+	return NULL == te ? 0 : ATOMIC_GET(&te->incarnation);
+}
+
 /**
  * @return the name of the thread id, as pointer to static data.
  */
@@ -11978,28 +12007,22 @@ thread_dump_stats(void)
 }
 
 /**
- * Dump thread statistics to specified logging agent.
+ * Enumerate thread statistics.
+ *
+ * @param cb		callback invoked with the name and value of each counter
+ * @param udata		additional callback argument
  */
-void G_COLD
-thread_dump_stats_log(logagent_t *la, unsigned options)
+void
+thread_stats_foreach(stats_fn_t cb, void *udata)
 {
 	struct thread_stats t;
-	bool groupped = booleanize(options & DUMP_OPT_PRETTY);
 
 	atomic_mb();
 	t = thread_stats;			/* Struct copy */
 
-#define DUMP(x)		log_info(la, "THREAD %s = %s", #x,		\
-	uint_to_string_grp(t.x, groupped))
-
-#define DUMP64(x) G_STMT_START {							\
-	uint64 v = AU64_VALUE(&t.x);							\
-	log_info(la, "THREAD %s = %s", #x,						\
-		uint64_to_string_grp(v, groupped));					\
-} G_STMT_END
-
-#define DUMPV(x)	log_info(la, "THREAD %s = %s", #x,		\
-	size_t_to_string_grp(x, groupped))
+#define DUMP(x)		(*cb)(#x, t.x, udata)
+#define DUMP64(x)	(*cb)(#x, AU64_VALUE(&t.x), udata)
+#define DUMPV(x)	(*cb)(#x, x, udata)
 
 	DUMP(created);
 	DUMP(discovered);
@@ -12080,6 +12103,15 @@ thread_dump_stats_log(logagent_t *la, unsigned options)
 #undef DUMPV
 }
 
+/**
+ * Dump thread statistics to specified logging agent.
+ */
+void G_COLD
+thread_dump_stats_log(logagent_t *la, unsigned options)
+{
+	log_stats(la, options, "THREAD", thread_stats_foreach);
+}
+
 /**
  * Dump thread elements to stderr.
  */
@@ -239,6 +239,7 @@ const char *thread_name(void);
 const char *thread_safe_name(void);
 const char *thread_safe_id_name(unsigned id);
 const char *thread_id_name(unsigned id);
+unsigned thread_id_incarnation(unsigned id);
 unsigned thread_by_name(const char *name);
 
 unsigned thread_count();
@@ -429,6 +430,7 @@ thread_cancel_disable(void)
 
 struct logagent;
 void thread_dump_stats_log(struct logagent *la, unsigned options);
+void thread_stats_foreach(stats_fn_t cb, void *udata);
 void thread_dump_stats(void);
 void thread_dump_thread_elements_log(struct logagent *la, unsigned options);
 void thread_dump_thread_elements(void);
@@ -172,6 +172,32 @@ tm_precise_time(tm_nano_t *tn)
 #endif	/* HAS_CLOCK_GETTIME */
 }
 
+/**
+ * Get current monotonic time at the nanosecond precision if possible,
+ * filling the supplied tm_nano_t structure.
+ *
+ * The origin of the monotonic clock is unspecified, but it is not affected
+ * by wall-clock adjustments, which makes it suitable to measure durations.
+ * When no monotonic clock is available, this is tm_precise_time().
+ *
+ * @note
+ * The returned value is not cached.
+ */
+void
+tm_precise_monotonic(tm_nano_t *tn)
+{
+#if defined(HAS_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+	struct timespec tp;
+
+	if (-1 == clock_gettime(CLOCK_MONOTONIC, &tp))
+		tm_precise_time(tn);
+	else
+		timespec_to_tm_nano(tn, &tp);
+#else
+	tm_precise_time(tn);
+#endif	/* HAS_CLOCK_GETTIME && CLOCK_MONOTONIC */
+}
+
 /**
  * Fallback routine for tm_precise_granularity() when clock_getres() is
  * not working or not available.
@@ -189,6 +189,7 @@ void tm_now_exact_raw(tm_t *tm);
 time_t tm_time_exact(void);
 void tm_current_time(tm_t *tm);
 void tm_precise_time(tm_nano_t *tn);
+void tm_precise_monotonic(tm_nano_t *tn);
 bool tm_precise_granularity(tm_nano_t *tn);
 double tm_cputime(double *user, double *sys);
 
@@ -131,6 +131,17 @@
  * threshold, the size M is increased: new magazines are sized with that new
  * value and older magazines are freed whenever convenient.
  *
+ * The depot miss rate (the proportion of magazine exchanges that the depot
+ * cannot satisfy from its lists, forcing an allocation from the memory layer)
+ * is also monitored: a high miss rate increases M as well.  Conversely, when
+ * the depot remains quiet for several periods, M is slowly decreased back
+ * towards its default value, to limit the memory held in the magazines.
+ *
+ * To avoid having all the threads contend on a single lock, the depot layer
+ * is split into per-CPU depots, each with their own lock and magazine lists.
+ * Each thread is bound to one of these depots, based on its thread small ID.
+ * The object trash remains shared at the allocator level.
+ *
  * The size of the depot is monitored regularily, via a periodic callout event
  * to compute the minimum amount of items in the full magazine list, and the
  * minimum amount of items in the empty magazine list. Items in excess can
@@ -148,6 +159,7 @@
 #include "dump_options.h"
 #include "eslist.h"
 #include "evq.h"
+#include "getcpucount.h"
 #include "glib-missing.h"	/* For pslist_free_null() */
 #include "log.h"
 #include "omalloc.h"
@@ -185,6 +197,12 @@
 
 #define TMALLOC_MAG_TRASH_MAX	4		/* Max trash */
 
+#define TMALLOC_CPU_MAX			16		/* Max amount of per-CPU depots */
+#define TMALLOC_MISS_MIN		64		/* Min depot requests to assess misses */
+#define TMALLOC_MISS_HIGH		0.5		/* Miss rate above which M grows */
+#define TMALLOC_MISS_LOW		0.05	/* Miss rate below which M may shrink */
+#define TMALLOC_SHRINK_PERIODS	6		/* Quiet periods before shrinking M */
+
 static thread_key_t tmalloc_magazines_key;
 static thread_key_t tmalloc_periodic_key;
 static once_flag_t tmalloc_keys_inited;
@@ -208,6 +226,9 @@ struct tmalloc_stats {
 	AU64(tmas_contentions);			/* Total amount of lock contentions */
 	AU64(tmas_preemptions);			/* Counts "concurrent" signal processing */
 	AU64(tmas_capacity_increased);	/* Increased magazine capacity */
+	AU64(tmas_capacity_decreased);	/* Decreased magazine capacity */
+	AU64(tmas_depot_requests);		/* Magazine exchanges with the depot */
+	AU64(tmas_depot_misses);		/* Exchanges not satisfied by the depot */
 	AU64(tmas_object_trash_reused);	/* Amount of trahsed object reused */
 	AU64(tmas_empty_trash_reused);	/* Empty trahsed magazines reused */
 	AU64(tmas_mag_allocated);		/* Total amount of magazines allocated */
@@ -235,6 +256,23 @@ struct tma_list {
 	size_t tml_max;				/* Maximum list count */
 };
 
+/**
+ * A per-CPU magazine depot.
+ *
+ * Threads are spread over these depots so that the exchange of magazines
+ * does not funnel all the threads through a single lock.  The depot layer
+ * of an allocator is made of as many per-CPU depots as there are CPUs,
+ * up to TMALLOC_CPU_MAX.
+ */
+struct tma_cpu {
+	struct tma_list tmc_full;	/* List of full magazines */
+	struct tma_list tmc_empty;	/* List of empty magazines */
+	size_t tmc_contentions;		/* Contentions registered */
+	size_t tmc_requests;		/* Magazine exchange requests */
+	size_t tmc_misses;			/* Requests not satisfied from the lists */
+	spinlock_t tmc_lock;		/* Thread-safe lock */
+};
+
 enum tmalloc_magic { TMALLOC_MAGIC = 0x4aeecb45 };
 
 /**
@@ -253,10 +291,10 @@ struct tmalloc_depot {
 	int tma_mag_capacity;		/* The ideal magazine capacity "M" */
 	int tma_threads;			/* Amount of threads using this allocator */
 	int tma_magazines;			/* Magazines currently used by threads */
-	size_t tma_contentions;		/* Contentions registered */
+	int tma_cpus;				/* Amount of per-CPU depots */
+	int tma_quiet;				/* Consecutive quiet periods */
 	size_t tmp_minmax_count;	/* Periods used to monitor min/max values */
-	struct tma_list tma_full;	/* List of full magazines */
-	struct tma_list tma_empty;	/* List of empty magazines */
+	struct tma_cpu *tma_cpu;	/* The per-CPU depots */
 	void **tma_obj_trash;		/* Trashed objects, when thread exits */
 	size_t tma_obj_trash_count;	/* Amount of trashed objects */
 	time_t tma_last_contention;	/* When we last reset the contention counter */
@@ -292,6 +330,19 @@ tmalloc_check(const tmalloc_t * const tma)
 #define TMALLOC_LOCK_HIDDEN(d)		spinlock_hidden(&(d)->tma_lock)
 #define TMALLOC_UNLOCK_HIDDEN(d)	spinunlock_hidden(&(d)->tma_lock)
 
+/*
+ * Locks for the per-CPU depots.
+ *
+ * When both the per-CPU depot and the allocator need to be locked, the
+ * per-CPU depot must be locked first.
+ */
+
+#define TMALLOC_CPU_LOCK(c)			spinlock(&(c)->tmc_lock)
+#define TMALLOC_CPU_UNLOCK(c)		spinunlock(&(c)->tmc_lock)
+
+#define TMALLOC_CPU_LOCK_HIDDEN(c)		spinlock_hidden(&(c)->tmc_lock)
+#define TMALLOC_CPU_UNLOCK_HIDDEN(c)	spinunlock_hidden(&(c)->tmc_lock)
+
 #define TMALLOC_STATS_INCX(t,v)		AU64_INC(&(t)->tma_stats.tmas_##v)
 #define TMALLOC_STATS_ADDX(t,v,n)	AU64_ADD(&(t)->tma_stats.tmas_##v, n)
 
@@ -330,9 +381,10 @@ enum tmalloc_thread_magic { TMALLOC_THREAD_MAGIC = 0x2fe3612d };
  */
 struct tmalloc_thread {
 	enum tmalloc_thread_magic tmt_magic;
-	uint tmt_stid;						/* STID of thread, for cleanup only */
+	uint tmt_stid;						/* STID of thread */
 	time_t tmt_last_op;					/* Last allocation / deallocation */
 	tmalloc_t *tmt_depot;				/* Our TM allocator */
+	struct tma_cpu *tmt_cpu;			/* Our per-CPU depot */
 	tmalloc_magazine_t *tmt_mag[2];		/* "loaded" and "previous" magazines */
 	slink_t tmt_link;					/* Links all thread layers in thread */
 };
@@ -527,9 +579,12 @@ tmalloc_magazine_free(tmalloc_t *d, tmalloc_magazine_t *m)
 
 /**
  * Allocate a new (empty) magazine.
+ *
+ * @param d		the magazine depot
+ * @param c		the per-CPU depot where trashed magazines can be reused
  */
 static tmalloc_magazine_t *
-tmalloc_magazine_alloc(tmalloc_t *d)
+tmalloc_magazine_alloc(tmalloc_t *d, struct tma_cpu *c)
 {
 	tmalloc_magazine_t *m;
 	int cap;
@@ -540,16 +595,26 @@ tmalloc_magazine_alloc(tmalloc_t *d)
 	 * If there are trashed empty magazines, reuse one.
 	 */
 
-	if G_UNLIKELY(0 != eslist_count(&d->tma_empty.tml_trash)) {
-		TMALLOC_LOCK_HIDDEN(d);
-		m = eslist_shift(&d->tma_empty.tml_trash);
-		TMALLOC_UNLOCK_HIDDEN(d);
+	if G_UNLIKELY(0 != eslist_count(&c->tmc_empty.tml_trash)) {
+		TMALLOC_CPU_LOCK_HIDDEN(c);
+		m = eslist_shift(&c->tmc_empty.tml_trash);
+		TMALLOC_CPU_UNLOCK_HIDDEN(c);
 
 		if G_LIKELY(m != NULL) {
 			tmalloc_magazine_check_magic(m);
 			g_assert(0 == m->tmag_count);
-			TMALLOC_STATS_INCX(d, empty_trash_reused);
-			return m;
+
+			/*
+			 * Trashed magazines can have an obsolete capacity.
+			 */
+
+			if G_LIKELY(m->tmag_capacity == d->tma_mag_capacity) {
+				TMALLOC_STATS_INCX(d, empty_trash_reused);
+				return m;
+			}
+
+			TMALLOC_STATS_INCX(d, mag_bad_capacity);
+			tmalloc_magazine_free(d, m);
 		}
 
 		/* FALL THROUGH */
@@ -573,47 +638,50 @@ tmalloc_magazine_alloc(tmalloc_t *d)
 }
 
 /**
- * Lock depot (hidden lock), accounting contention.
+ * Lock per-CPU depot (hidden lock), accounting contention.
  *
  * @note
  * This is a macro to get accurate locking point in the file.
  */
-#define tmalloc_depot_lock_hidden(d) G_STMT_START {			\
-	if G_UNLIKELY(!spinlock_hidden_try(&(d)->tma_lock)) {	\
+#define tmalloc_depot_lock_hidden(d,c) G_STMT_START {		\
+	if G_UNLIKELY(!spinlock_hidden_try(&(c)->tmc_lock)) {	\
 		TMALLOC_STATS_INCX(d, contentions);					\
-		spinlock_hidden(&(d)->tma_lock);					\
-		(d)->tma_contentions++;								\
+		spinlock_hidden(&(c)->tmc_lock);					\
+		(c)->tmc_contentions++;								\
 	}														\
 } G_STMT_END
 
 /**
- * Unlock depot.
+ * Unlock per-CPU depot.
  */
 static inline void
-tmalloc_depot_unlock_hidden(tmalloc_t *d)
+tmalloc_depot_unlock_hidden(struct tma_cpu *c)
 {
-	spinunlock_hidden(&d->tma_lock);
+	spinunlock_hidden(&c->tmc_lock);
 }
 
 /**
  * Give empty magazine back to the depot and get a new full magazine.
  *
  * @param d		the depot to which we're returning the magazine
+ * @param c		the per-CPU depot of the thread
  * @param m		the empty magazine (may be NULL)
  *
  * @return new full magazine, or NULL if none were found.
  */
 static tmalloc_magazine_t *
-tmalloc_depot_return_empty(tmalloc_t *d, tmalloc_magazine_t *m)
+tmalloc_depot_return_empty(tmalloc_t *d, struct tma_cpu *c,
+	tmalloc_magazine_t *m)
 {
 	tmalloc_magazine_t *fm;
 	bool free_magazine = FALSE;
 
 	tmalloc_check(d);
 
-	tmalloc_depot_lock_hidden(d);
+	tmalloc_depot_lock_hidden(d, c);
 
-	fm = eslist_shift(&d->tma_full.tml_list);	/* Full magazine (or NULL) */
+	c->tmc_requests++;
+	fm = eslist_shift(&c->tmc_full.tml_list);	/* Full magazine (or NULL) */
 
 	if G_LIKELY(m != NULL) {
 		tmalloc_magazine_check_magic(m);
@@ -626,9 +694,9 @@ tmalloc_depot_return_empty(tmalloc_t *d, tmalloc_magazine_t *m)
 		if G_UNLIKELY(m->tmag_capacity != d->tma_mag_capacity)
 			free_magazine = TRUE;
 		else
-			eslist_prepend(&d->tma_empty.tml_list, m);
+			eslist_prepend(&c->tmc_empty.tml_list, m);
 
-		d->tma_magazines--;		/* Thread returned a magazine */
+		atomic_int_dec(&d->tma_magazines);	/* Thread returned a magazine */
 	}
 
 	/*
@@ -641,33 +709,48 @@ tmalloc_depot_return_empty(tmalloc_t *d, tmalloc_magazine_t *m)
 		NULL == fm &&
 		d->tma_obj_trash_count >= UNSIGNED(d->tma_mag_capacity)
 	) {
-		fm = eslist_shift(&d->tma_empty.tml_list);
+		fm = eslist_shift(&c->tmc_empty.tml_list);
 
 		if G_LIKELY(fm != NULL) {
 			int n = fm->tmag_capacity;
 
-			TMALLOC_STATS_ADDX(d, object_trash_reused, n);
+			TMALLOC_LOCK_HIDDEN(d);
+
+			if G_LIKELY(d->tma_obj_trash_count >= UNSIGNED(n)) {
+				TMALLOC_STATS_ADDX(d, object_trash_reused, n);
 
-			while (n-- > 0) {
-				void **p = d->tma_obj_trash;
-				d->tma_obj_trash = *p;	/* Next in the chain */
-				d->tma_obj_trash_count--;
-				fm->tmag_objects[fm->tmag_count++] = p;
+				while (n-- > 0) {
+					void **p = d->tma_obj_trash;
+					d->tma_obj_trash = *p;	/* Next in the chain */
+					d->tma_obj_trash_count--;
+					fm->tmag_objects[fm->tmag_count++] = p;
+				}
 			}
 
 			g_assert(size_is_non_negative(d->tma_obj_trash_count));
-			g_assert(fm->tmag_count == fm->tmag_capacity);	/* Full magazine */
 
-			TMALLOC_STATS_INCX(d, mag_full_rebuilt);
+			TMALLOC_UNLOCK_HIDDEN(d);
+
+			if G_LIKELY(fm->tmag_count == fm->tmag_capacity) {
+				TMALLOC_STATS_INCX(d, mag_full_rebuilt);
+			} else {
+				/* Trash was concurrently used, put magazine back */
+				g_assert(0 == fm->tmag_count);
+				eslist_prepend(&c->tmc_empty.tml_list, fm);
+				fm = NULL;
+			}
 		}
 	}
 
-	if G_LIKELY(fm != NULL) {
+	if G_LIKELY(fm != NULL)
 		TMALLOC_STATS_INCX(d, mag_full_loaded);
-		d->tma_magazines++;			/* Returning magazine to thread */
-	}
+	else
+		c->tmc_misses++;
 
-	tmalloc_depot_unlock_hidden(d);
+	tmalloc_depot_unlock_hidden(c);
+
+	if G_LIKELY(fm != NULL)
+		atomic_int_inc(&d->tma_magazines);	/* Returning magazine to thread */
 
 	if G_UNLIKELY(free_magazine) {
 		TMALLOC_STATS_INCX(d, mag_bad_capacity);
@@ -684,21 +767,27 @@ tmalloc_depot_return_empty(tmalloc_t *d, tmalloc_magazine_t *m)
  * allocate a new (empty) magazine if there are none in the depot.
  *
  * @param d		the depot to which we're returning the magazine
+ * @param c		the per-CPU depot of the thread
  * @param m		the full magazine (may be NULL)
  *
  * @return new empty magazine, allocated if needed.
  */
 static tmalloc_magazine_t *
-tmalloc_depot_return_full(tmalloc_t *d, tmalloc_magazine_t *m)
+tmalloc_depot_return_full(tmalloc_t *d, struct tma_cpu *c,
+	tmalloc_magazine_t *m)
 {
 	tmalloc_magazine_t *em;
 	bool free_magazine = FALSE;
 
 	tmalloc_check(d);
 
-	tmalloc_depot_lock_hidden(d);
+	tmalloc_depot_lock_hidden(d, c);
 
-	em = eslist_shift(&d->tma_empty.tml_list);	/* Empty magazine (or NULL) */
+	c->tmc_requests++;
+	em = eslist_shift(&c->tmc_empty.tml_list);	/* Empty magazine (or NULL) */
+
+	if G_UNLIKELY(NULL == em)
+		c->tmc_misses++;
 
 	if G_LIKELY(m != NULL) {
 		tmalloc_magazine_check_magic(m);
@@ -711,12 +800,13 @@ tmalloc_depot_return_full(tmalloc_t *d, tmalloc_magazine_t *m)
 		if G_UNLIKELY(m->tmag_capacity != d->tma_mag_capacity)
 			free_magazine = TRUE;
 		else
-			eslist_prepend(&d->tma_full.tml_list, m);
-	} else {
-		d->tma_magazines++;		/* We always return a new magazine */
+			eslist_prepend(&c->tmc_full.tml_list, m);
 	}
 
-	tmalloc_depot_unlock_hidden(d);
+	tmalloc_depot_unlock_hidden(c);
+
+	if G_UNLIKELY(NULL == m)
+		atomic_int_inc(&d->tma_magazines);	/* We always return a magazine */
 
 	/*
 	 * Dispose of empty magazine, if needed.
@@ -736,7 +826,7 @@ tmalloc_depot_return_full(tmalloc_t *d, tmalloc_magazine_t *m)
 	 */
 
 	if G_UNLIKELY(NULL == em)
-		em = tmalloc_magazine_alloc(d);
+		em = tmalloc_magazine_alloc(d, c);
 
 	TMALLOC_STATS_INCX(d, mag_empty_loaded);
 
@@ -747,7 +837,7 @@ tmalloc_depot_return_full(tmalloc_t *d, tmalloc_magazine_t *m)
  * Return a magazine to the depot, when a thread is exiting.
  */
 static void
-tmalloc_depot_return(tmalloc_t *d, tmalloc_magazine_t *m)
+tmalloc_depot_return(tmalloc_t *d, struct tma_cpu *c, tmalloc_magazine_t *m)
 {
 	bool free_magazine = TRUE;
 
@@ -761,24 +851,24 @@ tmalloc_depot_return(tmalloc_t *d, tmalloc_magazine_t *m)
 	 * since this is an exceptional event (the thread is exiting).
 	 */
 
-	TMALLOC_LOCK(d);
-
 	g_assert(d->tma_magazines > 0);
-	d->tma_magazines--;
+	atomic_int_dec(&d->tma_magazines);
+
+	TMALLOC_CPU_LOCK(c);
 
 	if (0 == m->tmag_count) {
 		if G_LIKELY(m->tmag_capacity == d->tma_mag_capacity) {
-			eslist_prepend(&d->tma_empty.tml_list, m);
+			eslist_prepend(&c->tmc_empty.tml_list, m);
 			free_magazine = FALSE;
 		}
 	} else if (m->tmag_count == m->tmag_capacity) {
 		if G_LIKELY(m->tmag_capacity == d->tma_mag_capacity) {
-			eslist_prepend(&d->tma_full.tml_list, m);
+			eslist_prepend(&c->tmc_full.tml_list, m);
 			free_magazine = FALSE;
 		}
 	}
 
-	TMALLOC_UNLOCK(d);
+	TMALLOC_CPU_UNLOCK(c);
 
 	if (free_magazine) {
 		if G_UNLIKELY(m->tmag_capacity != d->tma_mag_capacity)
@@ -791,7 +881,8 @@ tmalloc_depot_return(tmalloc_t *d, tmalloc_magazine_t *m)
  * Unload magazine to the depot.
  */
 static void
-tmalloc_depot_unload(tmalloc_t *d, tmalloc_magazine_t *m, size_t i)
+tmalloc_depot_unload(tmalloc_t *d, struct tma_cpu *c,
+	tmalloc_magazine_t *m, size_t i)
 {
 	bool free_magazine = FALSE;
 
@@ -805,11 +896,9 @@ tmalloc_depot_unload(tmalloc_t *d, tmalloc_magazine_t *m, size_t i)
 			thread_name(), m->tmag_count, m->tmag_capacity);
 	}
 
-	TMALLOC_LOCK_HIDDEN(d);
-
 	g_assert(d->tma_magazines > 0);
 
-	d->tma_magazines--;
+	atomic_int_dec(&d->tma_magazines);
 
 	/*
 	 * The magazine may not be empty or full, and any objects held are put
@@ -817,23 +906,30 @@ tmalloc_depot_unload(tmalloc_t *d, tmalloc_magazine_t *m, size_t i)
 	 * the end.
 	 */
 
-	while (m->tmag_count != 0) {
-		void **p = m->tmag_objects[--m->tmag_count];
-		*p = d->tma_obj_trash;
-		d->tma_obj_trash = p;
-		d->tma_obj_trash_count++;
+	if (m->tmag_count != 0) {
+		TMALLOC_LOCK_HIDDEN(d);
+
+		while (m->tmag_count != 0) {
+			void **p = m->tmag_objects[--m->tmag_count];
+			*p = d->tma_obj_trash;
+			d->tma_obj_trash = p;
+			d->tma_obj_trash_count++;
+		}
+
+		TMALLOC_UNLOCK_HIDDEN(d);
 	}
 
 	/*
 	 * If the magazine no longer has the ideal capacity, free it.
 	 */
 
-	if G_UNLIKELY(m->tmag_capacity != d->tma_mag_capacity)
+	if G_UNLIKELY(m->tmag_capacity != d->tma_mag_capacity) {
 		free_magazine = TRUE;
-	else
-		eslist_prepend(&d->tma_empty.tml_list, m);
-
-	TMALLOC_UNLOCK_HIDDEN(d);
+	} else {
+		TMALLOC_CPU_LOCK_HIDDEN(c);
+		eslist_prepend(&c->tmc_empty.tml_list, m);
+		TMALLOC_CPU_UNLOCK_HIDDEN(c);
+	}
 
 	TMALLOC_STATS_INCX(d, mag_unloaded);
 
@@ -967,7 +1063,7 @@ tmalloc_thread_layer_free(void *data)
 		tmalloc_magazine_t *m = tmt->tmt_mag[i];
 		if (m != NULL) {
 			tmt->tmt_mag[i] = NULL;
-			tmalloc_depot_return(d, m);
+			tmalloc_depot_return(d, tmt->tmt_cpu, m);
 		}
 	}
 
@@ -1080,7 +1176,7 @@ tmalloc_thread_alloc(struct tmalloc_thread *t)
 			 */
 
 			t->tmt_mag[TMALLOC_MAG_LOADED] = NULL;
-			m = tmalloc_depot_return_empty(t->tmt_depot, m);
+			m = tmalloc_depot_return_empty(t->tmt_depot, t->tmt_cpu, m);
 			om = t->tmt_mag[TMALLOC_MAG_LOADED];
 			t->tmt_mag[TMALLOC_MAG_LOADED] = m;
 
@@ -1096,7 +1192,8 @@ tmalloc_thread_alloc(struct tmalloc_thread *t)
 				if (NULL == m && !tmalloc_magazine_is_empty(om))
 					m = t->tmt_mag[TMALLOC_MAG_LOADED] = om;
 				else
-					tmalloc_depot_unload(t->tmt_depot, om, TMALLOC_MAG_EXTRA);
+					tmalloc_depot_unload(t->tmt_depot, t->tmt_cpu, om,
+						TMALLOC_MAG_EXTRA);
 			}
 
 			/*
@@ -1160,7 +1257,7 @@ tmalloc_thread_free(struct tmalloc_thread *t, void *p)
 			 */
 
 			t->tmt_mag[TMALLOC_MAG_LOADED] = NULL;
-			m = tmalloc_depot_return_full(t->tmt_depot, m);
+			m = tmalloc_depot_return_full(t->tmt_depot, t->tmt_cpu, m);
 			om = t->tmt_mag[TMALLOC_MAG_LOADED];
 			t->tmt_mag[TMALLOC_MAG_LOADED] = m;
 
@@ -1172,7 +1269,8 @@ tmalloc_thread_free(struct tmalloc_thread *t, void *p)
 			if G_UNLIKELY(om != NULL) {
 				tmalloc_magazine_check_magic(om);
 				TMALLOC_STATS_INCX(t->tmt_depot, preemptions);
-				tmalloc_depot_unload(t->tmt_depot, om, TMALLOC_MAG_EXTRA);
+				tmalloc_depot_unload(t->tmt_depot, t->tmt_cpu, om,
+					TMALLOC_MAG_EXTRA);
 			}
 
 			/*
@@ -1217,7 +1315,7 @@ tmalloc_thread_clear(struct tmalloc_thread *tmt)
 		tmalloc_magazine_t *m = tmt->tmt_mag[i];
 		if (m != NULL) {
 			tmt->tmt_mag[i] = NULL;
-			tmalloc_depot_unload(d, m, i);
+			tmalloc_depot_unload(d, tmt->tmt_cpu, m, i);
 		}
 	}
 }
@@ -1285,10 +1383,62 @@ tmalloc_list_purge(struct tma_list *tl)
 static bool
 tmalloc_has_garbage(const tmalloc_t *d)
 {
-	return
-		0 != d->tma_obj_trash_count ||
-		0 != eslist_count(&d->tma_full.tml_trash) ||
-		0 != eslist_count(&d->tma_empty.tml_trash);
+	int i;
+
+	if (0 != d->tma_obj_trash_count)
+		return TRUE;
+
+	for (i = 0; i < d->tma_cpus; i++) {
+		const struct tma_cpu *c = &d->tma_cpu[i];
+
+		if (
+			0 != eslist_count(&c->tmc_full.tml_trash) ||
+			0 != eslist_count(&c->tmc_empty.tml_trash)
+		)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Magazine counts across all the per-CPU depots.
+ */
+struct tma_counts {
+	size_t full;			/* Full magazines */
+	size_t empty;			/* Empty magazines */
+	size_t full_trash;		/* Trashed full magazines */
+	size_t empty_trash;		/* Trashed empty magazines */
+};
+
+/**
+ * Count magazines held in the per-CPU depots.
+ *
+ * @param d		the magazine depot
+ * @param tc	filled with the magazine counts
+ * @param lock	whether to lock each per-CPU depot to get accurate counts
+ */
+static void
+tmalloc_depot_counts(const tmalloc_t *d, struct tma_counts *tc, bool lock)
+{
+	int i;
+
+	ZERO(tc);
+
+	for (i = 0; i < d->tma_cpus; i++) {
+		struct tma_cpu *c = &d->tma_cpu[i];
+
+		if (lock)
+			TMALLOC_CPU_LOCK(c);
+
+		tc->full        += eslist_count(&c->tmc_full.tml_list);
+		tc->empty       += eslist_count(&c->tmc_empty.tml_list);
+		tc->full_trash  += eslist_count(&c->tmc_full.tml_trash);
+		tc->empty_trash += eslist_count(&c->tmc_empty.tml_trash);
+
+		if (lock)
+			TMALLOC_CPU_UNLOCK(c);
+	}
 }
 
 /**
@@ -1301,7 +1451,6 @@ tmalloc_has_garbage(const tmalloc_t *d)
 static void
 tmalloc_list_extract_trash(struct tma_list *tl, eslist_t *dl, size_t n)
 {
-	g_assert(0 == eslist_count(dl));
 	g_assert(size_is_non_negative(n));
 
 	while (n-- != 0) {
@@ -1338,28 +1487,38 @@ tmalloc_gc(void *data)
 	size_t objcount = 0;
 	eslist_t full, empty;
 	bool again;
+	int i;
 
 	tmalloc_check(d);
 
 	if (tmalloc_debugging(4)) {
+		struct tma_counts tc;
+
+		tmalloc_depot_counts(d, &tc, FALSE);
 		s_debug("%s(\"%s\"): trash={full=%zu, empty=%zu, objects=%zu}",
 			G_STRFUNC, d->tma_name,
-			eslist_count(&d->tma_full.tml_trash),
-			eslist_count(&d->tma_empty.tml_trash),
-			d->tma_obj_trash_count);
+			tc.full_trash, tc.empty_trash, d->tma_obj_trash_count);
 	}
 
 	eslist_init(&full,	offsetof(tmalloc_magazine_t, slk));
 	eslist_init(&empty,	offsetof(tmalloc_magazine_t, slk));
 
-	TMALLOC_LOCK(d);
-
 	/*
-	 * Extract trashed magazines.
+	 * Extract trashed magazines, spreading the amount we collect in
+	 * each run over all the per-CPU depots.
 	 */
 
-	tmalloc_list_extract_trash(&d->tma_full,  &full,  TMALLOC_GC_MAG_COUNT);
-	tmalloc_list_extract_trash(&d->tma_empty, &empty, TMALLOC_GC_MAG_COUNT);
+	for (i = 0; i < d->tma_cpus; i++) {
+		struct tma_cpu *c = &d->tma_cpu[i];
+		size_t n = TMALLOC_GC_MAG_COUNT / d->tma_cpus;
+
+		TMALLOC_CPU_LOCK(c);
+		tmalloc_list_extract_trash(&c->tmc_full,  &full,  n);
+		tmalloc_list_extract_trash(&c->tmc_empty, &empty, n);
+		TMALLOC_CPU_UNLOCK(c);
+	}
+
+	TMALLOC_LOCK(d);
 
 	/*
 	 * Extract trashed objects.
@@ -1491,6 +1650,128 @@ done:
 	}
 }
 
+/**
+ * Sum the contentions registered on the per-CPU depots.
+ *
+ * This is a dirty read, without locking.
+ */
+static size_t
+tmalloc_contentions(const tmalloc_t *d)
+{
+	size_t contentions = 0;
+	int i;
+
+	for (i = 0; i < d->tma_cpus; i++)
+		contentions += d->tma_cpu[i].tmc_contentions;
+
+	return contentions;
+}
+
+/**
+ * Change the magazine capacity.
+ *
+ * All the magazines held in the per-CPU depots are trashed since they
+ * are no longer of the right size.  Magazines held by threads will be
+ * freed when returned to the depot.
+ */
+static void
+tmalloc_set_capacity(tmalloc_t *d, int capacity)
+{
+	int i;
+
+	d->tma_mag_capacity = capacity;
+	atomic_mb();
+
+	for (i = 0; i < d->tma_cpus; i++) {
+		struct tma_cpu *c = &d->tma_cpu[i];
+
+		TMALLOC_CPU_LOCK_HIDDEN(c);
+		tmalloc_trash_list(&c->tmc_full);
+		tmalloc_trash_list(&c->tmc_empty);
+		TMALLOC_CPU_UNLOCK_HIDDEN(c);
+	}
+}
+
+/**
+ * Adjust magazine capacity based on observed depot activity.
+ *
+ * The capacity M is increased when there are too many lock contentions on
+ * the depots, or when the depots fail to satisfy too many of the magazine
+ * exchanges requested by threads (miss rate).  When the depots are quiet
+ * for several periods, M is reduced back towards its default value to
+ * limit the amount of memory held by magazines.
+ *
+ * @param d				the magazine depot
+ * @param elapsed		seconds elapsed since last adjustment
+ * @param contentions	contentions during that period
+ * @param requests		magazine exchanges during that period
+ * @param misses		exchanges not satisfied during that period
+ */
+static void
+tmalloc_adjust_capacity(tmalloc_t *d, time_delta_t elapsed,
+	size_t contentions, size_t requests, size_t misses)
+{
+	double rate, miss_rate = 0.0;
+	int capacity = d->tma_mag_capacity;
+
+	rate = contentions / (double) elapsed;
+
+	if (requests >= TMALLOC_MISS_MIN)
+		miss_rate = misses / (double) requests;
+
+	if (tmalloc_debugging(2)) {
+		s_debug("%s(\"%s\"): contentions=%zu in %u secs (%.2f/sec), "
+			"misses=%zu/%zu (%.2f%%)",
+			G_STRFUNC, d->tma_name, contentions, (uint) elapsed, rate,
+			misses, requests, miss_rate * 100.0);
+	}
+
+	/*
+	 * If we have more lock contentions on the depot than our target, or
+	 * too many misses, increase the magazine capacity so that threads
+	 * go to the depot less often.
+	 */
+
+	if (
+		(rate > TMALLOC_CONTENTIONS || miss_rate > TMALLOC_MISS_HIGH) &&
+		capacity < tmalloc_magazine_max_capacity(d->tma_size)
+	) {
+		d->tma_quiet = 0;
+		tmalloc_set_capacity(d, capacity + 1);
+		TMALLOC_STATS_INCX(d, capacity_increased);
+
+		if (tmalloc_debugging(1)) {
+			s_debug("%s(\"%s\"): M increased to %d",
+				G_STRFUNC, d->tma_name, d->tma_mag_capacity);
+		}
+		return;
+	}
+
+	/*
+	 * When there were no contentions and few misses for a while, shrink
+	 * the capacity, never going below the default one.
+	 */
+
+	if (
+		0 == contentions && miss_rate < TMALLOC_MISS_LOW &&
+		capacity > tmalloc_magazine_default_capacity(d->tma_size)
+	) {
+		if (++d->tma_quiet < TMALLOC_SHRINK_PERIODS)
+			return;
+
+		d->tma_quiet = 0;
+		tmalloc_set_capacity(d, capacity - 1);
+		TMALLOC_STATS_INCX(d, capacity_decreased);
+
+		if (tmalloc_debugging(1)) {
+			s_debug("%s(\"%s\"): M decreased to %d",
+				G_STRFUNC, d->tma_name, d->tma_mag_capacity);
+		}
+	} else {
+		d->tma_quiet = 0;
+	}
+}
+
 /**
  * Periodic beat invoked on the thread magazine layer.
  */
@@ -1500,19 +1781,20 @@ tmalloc_beat(void *data)
 	tmalloc_t *d = data;
 	time_t now = tm_time();
 	time_delta_t elapsed;
+	int i;
 
 	tmalloc_check(d);
 
 	if (tmalloc_debugging(3)) {
+		struct tma_counts tc;
+
 		/* Don't lock, we can have dirty reads but we don't care */
-		s_debug("%s(\"%s\"): M=%d, C=%zu, T=%d, full=%zu, empty=%zu, "
+		tmalloc_depot_counts(d, &tc, FALSE);
+		s_debug("%s(\"%s\"): M=%d, C=%zu, T=%d, CPU=%d, full=%zu, empty=%zu, "
 			"trash={full=%zu, empty=%zu, objects=%zu}",
-			G_STRFUNC, d->tma_name, d->tma_mag_capacity, d->tma_contentions,
-			d->tma_threads,
-			eslist_count(&d->tma_full.tml_list),
-			eslist_count(&d->tma_empty.tml_list),
-			eslist_count(&d->tma_full.tml_trash),
-			eslist_count(&d->tma_empty.tml_trash),
+			G_STRFUNC, d->tma_name, d->tma_mag_capacity,
+			tmalloc_contentions(d), d->tma_threads, d->tma_cpus,
+			tc.full, tc.empty, tc.full_trash, tc.empty_trash,
 			d->tma_obj_trash_count);
 	}
 
@@ -1525,47 +1807,27 @@ tmalloc_beat(void *data)
 	if (
 		elapsed >= TMALLOC_BEAT_THRESHOLD ||
 		(elapsed > 0 &&
-			d->tma_contentions / elapsed > (int) (5 * TMALLOC_CONTENTIONS))
+			tmalloc_contentions(d) / elapsed > (int) (5 * TMALLOC_CONTENTIONS))
 	) {
-		size_t contentions;
-		double rate;
-
-		TMALLOC_LOCK_HIDDEN(d);
-		contentions = d->tma_contentions;
-		d->tma_contentions = 0;
-		d->tma_last_contention = now;
-		TMALLOC_UNLOCK_HIDDEN(d);
+		size_t contentions = 0, requests = 0, misses = 0;
 
-		rate = contentions / (double) elapsed;
+		for (i = 0; i < d->tma_cpus; i++) {
+			struct tma_cpu *c = &d->tma_cpu[i];
 
-		if (tmalloc_debugging(2)) {
-			s_debug("%s(\"%s\"): contentions=%zu in %u secs (%.2f/sec)",
-				G_STRFUNC, d->tma_name, contentions, (uint) elapsed, rate);
+			TMALLOC_CPU_LOCK_HIDDEN(c);
+			contentions += c->tmc_contentions;
+			requests += c->tmc_requests;
+			misses += c->tmc_misses;
+			c->tmc_contentions = c->tmc_requests = c->tmc_misses = 0;
+			TMALLOC_CPU_UNLOCK_HIDDEN(c);
 		}
 
-		/*
-		 * If we have more lock contentions on the depot than our target,
-		 * adjust the magazine capacity, then trash all the existing
-		 * magazines in the depot (since they are of the wrong size now).
-		 */
-
-		if (
-			rate > TMALLOC_CONTENTIONS &&
-			d->tma_mag_capacity < tmalloc_magazine_max_capacity(d->tma_size)
-		) {
-			TMALLOC_LOCK_HIDDEN(d);
-			d->tma_mag_capacity++;
-			tmalloc_trash_list(&d->tma_full);
-			tmalloc_trash_list(&d->tma_empty);
-			TMALLOC_UNLOCK_HIDDEN(d);
+		d->tma_last_contention = now;
 
-			TMALLOC_STATS_INCX(d, capacity_increased);
+		TMALLOC_STATS_ADDX(d, depot_requests, requests);
+		TMALLOC_STATS_ADDX(d, depot_misses, misses);
 
-			if (tmalloc_debugging(1)) {
-				s_debug("%s(\"%s\"): M increased to %d",
-					G_STRFUNC, d->tma_name, d->tma_mag_capacity);
-			}
-		}
+		tmalloc_adjust_capacity(d, elapsed, contentions, requests, misses);
 	}
 
 	/*
@@ -1574,30 +1836,44 @@ tmalloc_beat(void *data)
 
 	{
 		size_t full_purged = 0, empty_purged = 0;
+		bool purge;
 
-		TMALLOC_LOCK_HIDDEN(d);
+		purge = ++d->tmp_minmax_count >= TMALLOC_MINMAX_PERIODS;
 
-		full_purged = tmalloc_list_update_minmax(&d->tma_full);
-		empty_purged = tmalloc_list_update_minmax(&d->tma_empty);
-		d->tmp_minmax_count++;
+		for (i = 0; i < d->tma_cpus; i++) {
+			struct tma_cpu *c = &d->tma_cpu[i];
 
-		if G_UNLIKELY(d->tmp_minmax_count >= TMALLOC_MINMAX_PERIODS) {
-			full_purged = tmalloc_list_purge(&d->tma_full);
-			empty_purged = tmalloc_list_purge(&d->tma_empty);
-		}
+			TMALLOC_CPU_LOCK_HIDDEN(c);
 
-		TMALLOC_UNLOCK_HIDDEN(d);
+			tmalloc_list_update_minmax(&c->tmc_full);
+			tmalloc_list_update_minmax(&c->tmc_empty);
+
+			if G_UNLIKELY(purge) {
+				full_purged += tmalloc_list_purge(&c->tmc_full);
+				empty_purged += tmalloc_list_purge(&c->tmc_empty);
+			}
 
-		if (tmalloc_debugging(0) && full_purged != 0) {
-			s_debug("%s(\"%s\"): purged %zu full magazine%s, %zu remaining",
-				G_STRFUNC, d->tma_name, full_purged, plural(full_purged),
-				eslist_count(&d->tma_full.tml_list));
+			TMALLOC_CPU_UNLOCK_HIDDEN(c);
 		}
 
-		if (tmalloc_debugging(0) && empty_purged != 0) {
-			s_debug("%s(\"%s\"): purged %zu empty magazine%s, %zu remaining",
-				G_STRFUNC, d->tma_name, empty_purged, plural(empty_purged),
-				eslist_count(&d->tma_empty.tml_list));
+		if (tmalloc_debugging(0) && (full_purged != 0 || empty_purged != 0)) {
+			struct tma_counts tc;
+
+			tmalloc_depot_counts(d, &tc, FALSE);
+
+			if (full_purged != 0) {
+				s_debug("%s(\"%s\"): purged %zu full magazine%s, "
+					"%zu remaining",
+					G_STRFUNC, d->tma_name, full_purged, plural(full_purged),
+					tc.full);
+			}
+
+			if (empty_purged != 0) {
+				s_debug("%s(\"%s\"): purged %zu empty magazine%s, "
+					"%zu remaining",
+					G_STRFUNC, d->tma_name, empty_purged, plural(empty_purged),
+					tc.empty);
+			}
 		}
 	}
 
@@ -1639,6 +1915,26 @@ tmalloc_list_init(struct tma_list *tl)
 	eslist_init(&tl->tml_trash,	offsetof(tmalloc_magazine_t, slk));
 }
 
+/**
+ * @return the amount of per-CPU depots to create for each allocator.
+ */
+static int
+tmalloc_cpu_count(void)
+{
+	static int cpus;
+
+	/*
+	 * No need for locking: concurrent threads will compute the same value.
+	 */
+
+	if G_UNLIKELY(0 == cpus) {
+		long n = getcpucount();
+		cpus = MIN(n, TMALLOC_CPU_MAX);
+	}
+
+	return cpus;
+}
+
 /**
  * Allocate a new thread magazine depot.
  *
@@ -1655,6 +1951,7 @@ tmalloc_create(const char *name, size_t size,
 	alloc_fn_t allocate, free_size_fn_t deallocate)
 {
 	tmalloc_t *tma;
+	int i;
 
 	g_assert(size_is_positive(size));
 	g_assert(size >= sizeof(void *));		/* Need to chain objects */
@@ -1696,8 +1993,16 @@ tmalloc_create(const char *name, size_t size,
 	tma->tma_free = deallocate;
 	tma->tma_ev = evq_raw_periodic_add(TMALLOC_PERIODIC, tmalloc_beat, tma);
 	tma->tma_last_contention = tm_time();
-	tmalloc_list_init(&tma->tma_full);
-	tmalloc_list_init(&tma->tma_empty);
+	tma->tma_cpus = tmalloc_cpu_count();
+	OMALLOC0_ARRAY(tma->tma_cpu, tma->tma_cpus);
+
+	for (i = 0; i < tma->tma_cpus; i++) {
+		struct tma_cpu *c = &tma->tma_cpu[i];
+
+		tmalloc_list_init(&c->tmc_full);
+		tmalloc_list_init(&c->tmc_empty);
+		spinlock_init(&c->tmc_lock);
+	}
 
 	tmalloc_vars_add(tma);
 
@@ -1707,8 +2012,9 @@ tmalloc_create(const char *name, size_t size,
 	 */
 
 	if (tmalloc_debugging(0)) {
-		s_rawdebug("%s(\"%s\"): handling %zu-byte objects, M=%d",
-			G_STRFUNC, tma->tma_name, tma->tma_size, tma->tma_mag_capacity);
+		s_rawdebug("%s(\"%s\"): handling %zu-byte objects, M=%d, CPU=%d",
+			G_STRFUNC, tma->tma_name, tma->tma_size, tma->tma_mag_capacity,
+			tma->tma_cpus);
 	}
 
 	return tma;
@@ -1805,22 +2111,30 @@ tmalloc_size(const tmalloc_t *tma)
 void
 tmalloc_reset(tmalloc_t *tma)
 {
-	struct tma_list full, empty;
 	void **obj_trash;
 	size_t n;
 	struct tmalloc_thread *tmt;
+	int i;
 
 	tmalloc_check(tma);
 
+	if (tmalloc_debugging(0)) {
+		struct tma_counts tc;
+
+		tmalloc_depot_counts(tma, &tc, TRUE);
+		s_debug("%s(\"%s\"): %d thread%s, "
+			"full=%zu+%zu, empty=%zu+%zu, objects=%zu",
+			G_STRFUNC, tma->tma_name,
+			tma->tma_threads, plural(tma->tma_threads),
+			tc.full, tc.full_trash, tc.empty, tc.empty_trash,
+			tma->tma_obj_trash_count);
+	}
+
 	/*
 	 * Atomically reset the layer.
 	 */
 
 	TMALLOC_LOCK(tma);
-	full = tma->tma_full;					/* struct copy */
-	empty = tma->tma_empty;					/* struct copy */
-	tmalloc_list_clear(&tma->tma_full);
-	tmalloc_list_clear(&tma->tma_empty);
 	if (evq_is_inited())						/* Not at shutdown time */
 		cq_periodic_remove(&tma->tma_gc_ev);	/* Trash is being collected */
 	else
@@ -1828,21 +2142,23 @@ tmalloc_reset(tmalloc_t *tma)
 	TMALLOC_UNLOCK(tma);
 
 	/*
-	 * Now dispose of the trash...
+	 * Now dispose of the trash, for each per-CPU depot...
 	 */
 
-	if (tmalloc_debugging(0)) {
-		s_debug("%s(\"%s\"): %d thread%s, "
-			"full=%zu+%zu, empty=%zu+%zu, objects=%zu",
-			G_STRFUNC, tma->tma_name,
-			tma->tma_threads, plural(tma->tma_threads),
-			eslist_count(&full.tml_list), eslist_count(&full.tml_trash),
-			eslist_count(&empty.tml_list), eslist_count(&empty.tml_trash),
-			tma->tma_obj_trash_count);
-	}
+	for (i = 0; i < tma->tma_cpus; i++) {
+		struct tma_cpu *c = &tma->tma_cpu[i];
+		struct tma_list full, empty;
 
-	tmalloc_list_free(&full, tma);
-	tmalloc_list_free(&empty, tma);
+		TMALLOC_CPU_LOCK(c);
+		full = c->tmc_full;					/* struct copy */
+		empty = c->tmc_empty;				/* struct copy */
+		tmalloc_list_clear(&c->tmc_full);
+		tmalloc_list_clear(&c->tmc_empty);
+		TMALLOC_CPU_UNLOCK(c);
+
+		tmalloc_list_free(&full, tma);
+		tmalloc_list_free(&empty, tma);
+	}
 
 	/*
 	 * We cannot safely access the two magazines from other threads, but we
@@ -1977,8 +2293,8 @@ tmalloc_thread_create(tmalloc_t *tma)
 	 * thread magazine layer.
 	 *
 	 * @note
-	 * The tmt_stid field is not required for normal operations but is just
-	 * used during tmalloc_reset() to log the thread name when resetting
+	 * The tmt_stid field is used to select the per-CPU depot of the thread,
+	 * and during tmalloc_reset() to log the thread name when resetting
 	 * its private magazines.
 	 */
 
@@ -1987,6 +2303,7 @@ tmalloc_thread_create(tmalloc_t *tma)
 	tmt->tmt_magic = TMALLOC_THREAD_MAGIC;
 	tmt->tmt_stid = thread_small_id();
 	tmt->tmt_depot = tma;
+	tmt->tmt_cpu = &tma->tma_cpu[tmt->tmt_stid % tma->tma_cpus];
 	atomic_int_inc(&tma->tma_threads);
 
 	TMALLOC_STATS_INCX(tma, threads);
@@ -2234,12 +2551,15 @@ tmalloc_info_list(void)
 
 	ESLIST_FOREACH_DATA(&tmalloc_vars, d) {
 		tmalloc_info_t *tmi;
+		struct tma_counts tc;
 
 		tmalloc_check(d);
 
 		WALLOC0(tmi);
 		tmi->magic = TMALLOC_INFO_MAGIC;
 
+		tmalloc_depot_counts(d, &tc, TRUE);
+
 		TMALLOC_LOCK(d);
 
 		tmi->name = d->tma_name;
@@ -2247,10 +2567,11 @@ tmalloc_info_list(void)
 		tmi->attached = d->tma_threads;
 		tmi->magazines = d->tma_magazines;
 		tmi->mag_capacity = d->tma_mag_capacity;
-		tmi->mag_full = eslist_count(&d->tma_full.tml_list);
-		tmi->mag_empty = eslist_count(&d->tma_empty.tml_list);
-		tmi->mag_full_trash = eslist_count(&d->tma_full.tml_trash);
-		tmi->mag_empty_trash = eslist_count(&d->tma_empty.tml_trash);
+		tmi->cpus = d->tma_cpus;
+		tmi->mag_full = tc.full;
+		tmi->mag_empty = tc.empty;
+		tmi->mag_full_trash = tc.full_trash;
+		tmi->mag_empty_trash = tc.empty_trash;
 		tmi->mag_object_trash = d->tma_obj_trash_count;
 
 #define STATS_COPY(name)	tmi->name = AU64_VALUE(&d->tma_stats.tmas_ ## name)
@@ -2266,6 +2587,10 @@ tmalloc_info_list(void)
 		STATS_COPY(contentions);
 		STATS_COPY(object_trash_reused);
 		STATS_COPY(empty_trash_reused);
+		STATS_COPY(capacity_increased);
+		STATS_COPY(capacity_decreased);
+		STATS_COPY(depot_requests);
+		STATS_COPY(depot_misses);
 		STATS_COPY(mag_allocated);
 		STATS_COPY(mag_freed);
 		STATS_COPY(mag_trashed);
@@ -2335,15 +2660,20 @@ tmalloc_all_stats(tmalloc_info_t *stats)
 	depot_count = eslist_count(&tmalloc_vars);
 
 	ESLIST_FOREACH_DATA(&tmalloc_vars, d) {
+		struct tma_counts tc;
+
 		tmalloc_check(d);
 
+		tmalloc_depot_counts(d, &tc, TRUE);
+
 		TMALLOC_LOCK(d);
 
 		stats->magazines += d->tma_magazines;
-		stats->mag_full += eslist_count(&d->tma_full.tml_list);
-		stats->mag_empty += eslist_count(&d->tma_empty.tml_list);
-		stats->mag_full_trash += eslist_count(&d->tma_full.tml_trash);
-		stats->mag_empty_trash += eslist_count(&d->tma_empty.tml_trash);
+		stats->cpus += d->tma_cpus;
+		stats->mag_full += tc.full;
+		stats->mag_empty += tc.empty;
+		stats->mag_full_trash += tc.full_trash;
+		stats->mag_empty_trash += tc.empty_trash;
 		stats->mag_object_trash += d->tma_obj_trash_count;
 
 #define STATS_COPY(name) stats->name += AU64_VALUE(&d->tma_stats.tmas_ ## name)
@@ -2360,6 +2690,9 @@ tmalloc_all_stats(tmalloc_info_t *stats)
 		STATS_COPY(object_trash_reused);
 		STATS_COPY(empty_trash_reused);
 		STATS_COPY(capacity_increased);
+		STATS_COPY(capacity_decreased);
+		STATS_COPY(depot_requests);
+		STATS_COPY(depot_misses);
 		STATS_COPY(mag_allocated);
 		STATS_COPY(mag_freed);
 		STATS_COPY(mag_trashed);
@@ -2399,20 +2732,19 @@ tmalloc_stats_digest(sha1_t *digest)
 }
 
 /**
- * Dump tmalloc statistics to specified log agent.
+ * Enumerate tmalloc statistics.
+ *
+ * @param cb		callback invoked with the name and value of each counter
+ * @param udata		additional callback argument
  */
-void G_COLD
-tmalloc_dump_stats_log(logagent_t *la, unsigned options)
+void
+tmalloc_stats_foreach(stats_fn_t cb, void *udata)
 {
 	tmalloc_info_t stats;
 	size_t depot_count;
-	bool groupped = booleanize(options & DUMP_OPT_PRETTY);
 
-#define DUMPV(x)	log_info(la, "TMALLOC %s = %s", #x,			\
-	size_t_to_string_grp(x, groupped))
-
-#define DUMP(x)		log_info(la, "TMALLOC %s = %s", #x,			\
-	uint64_to_string_grp(stats.x, groupped))
+#define DUMPV(x)	(*cb)(#x, x, udata)
+#define DUMP(x)		(*cb)(#x, stats.x, udata)
 
 	depot_count = tmalloc_all_stats(&stats);
 
@@ -2430,6 +2762,10 @@ tmalloc_dump_stats_log(logagent_t *la, unsigned options)
 	DUMP(object_trash_reused);
 	DUMP(empty_trash_reused);
 	DUMP(capacity_increased);
+	DUMP(capacity_decreased);
+	DUMP(depot_requests);
+	DUMP(depot_misses);
+	DUMP(cpus);
 	DUMP(mag_full);
 	DUMP(mag_empty);
 	DUMP(mag_full_trash);
@@ -2453,6 +2789,15 @@ tmalloc_dump_stats_log(logagent_t *la, unsigned options)
 #undef DUMPV
 }
 
+/**
+ * Dump tmalloc statistics to specified log agent.
+ */
+void G_COLD
+tmalloc_dump_stats_log(logagent_t *la, unsigned options)
+{
+	log_stats(la, options, "TMALLOC", tmalloc_stats_foreach);
+}
+
 /*
  * Dump thread magazine allocator information to specified log-agent.
  */
@@ -2470,8 +2815,8 @@ tmalloc_info_dump(void *data, void *udata)
 #define DUMPL(x) \
 	log_info(la, "TMALLOC %19s = %s", #x, uint64_to_gstring(tmi->x))
 
-	log_info(la, "TMALLOC --- \"%s\" %zu-byte blocks M=%zu ---",
-		tmi->name, tmi->size, tmi->mag_capacity);
+	log_info(la, "TMALLOC --- \"%s\" %zu-byte blocks M=%zu, CPU=%zu ---",
+		tmi->name, tmi->size, tmi->mag_capacity, tmi->cpus);
 
 	DUMPS(attached);
 	DUMPS(magazines);
@@ -2488,6 +2833,9 @@ tmalloc_info_dump(void *data, void *udata)
 	DUMPL(object_trash_reused);
 	DUMPL(empty_trash_reused);
 	DUMPL(capacity_increased);
+	DUMPL(capacity_decreased);
+	DUMPL(depot_requests);
+	DUMPL(depot_misses);
 	DUMPL(mag_full);
 	DUMPL(mag_empty);
 	DUMPL(mag_full_trash);
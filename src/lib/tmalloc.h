@@ -48,6 +48,7 @@ typedef struct {
 	size_t attached;				/**< Threads currently using allocator */
 	size_t magazines;				/**< Magazines handed out to threads */
 	size_t mag_capacity;			/**< Current magazine capacity */
+	size_t cpus;					/**< Amount of per-CPU depots */
 	size_t mag_full;				/**< Amount of full magazines in depot */
 	size_t mag_empty;				/**< Amount of empty magazines in depot */
 	size_t mag_full_trash;			/**< Full magazines, trashed */
@@ -66,6 +67,9 @@ typedef struct {
 	uint64 object_trash_reused;		/**< Amount of trashed objects reused */
 	uint64 empty_trash_reused;		/**< Empty trashed magazines reused */
 	uint64 capacity_increased;		/**< Magazine capacity increases */
+	uint64 capacity_decreased;		/**< Magazine capacity decreases */
+	uint64 depot_requests;			/**< Magazine exchanges with depots */
+	uint64 depot_misses;			/**< Exchanges not satisfied by depots */
 	uint64 mag_allocated;			/**< Total amount of magazines allocated */
 	uint64 mag_freed;				/**< Total amount of magazines freed */
 	uint64 mag_trashed;				/**< Total amount of magazines trashed */
@@ -116,6 +120,7 @@ void tmalloc_stats_digest(struct sha1 *digest);
 struct pslist *tmalloc_info_list(void);
 void tmalloc_info_list_free_null(struct pslist **sl_ptr);
 void tmalloc_dump_stats_log(struct logagent *la, unsigned options);
+void tmalloc_stats_foreach(stats_fn_t cb, void *udata);
 void tmalloc_dump_magazines_log(struct logagent *la);
 void tmalloc_dump_stats(void);
 
@@ -0,0 +1,332 @@
+/*
+ * utf8-test -- differential tests for query canonization.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/atoms.h"
+#include "lib/halloc.h"
+#include "lib/hstrfn.h"
+#include "lib/mempcpy.h"
+#include "lib/misc.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/str.h"
+#include "lib/tm.h"
+#include "lib/utf8.h"
+
+#define TEST_LOOPS	100000		/* Default amount of random strings */
+#define TEST_MAXLEN	80			/* Default maximum string length, in chars */
+
+static bool verbose_mode;
+static unsigned initial_seed;
+
+/*
+ * Strings that must be handled identically by both canonization paths.
+ */
+static const char *fixed_strings[] = {
+	"",
+	" ",
+	".",
+	"a",
+	"A",
+	"a.",
+	"a. b",
+	"a.\001",
+	".a",
+	"a  b",
+	"a\tb",
+	"a\nb",
+	"\n",
+	" \n ",
+	"a_b-c+d",
+	"ABCDEFGHabcdefgh01234567",
+	"ABCDEFG.abcdefgh01234567",
+	"Some Artist - Some Song (Live) [2026].mp3",
+	"ubuntu-26.04-desktop-amd64.iso",
+	"CamelCaseWordsThatAreLong",
+	"$100 & 50% off!",
+	"Caf\xc3\xa9",
+	"e\xcc\x81",
+	"\xef\xac\x81le",
+	"a\xc2\xa0" "b",
+	"\xd0\x9c\xd0\xbe\xd1\x81\xd0\xba\xd0\xb2\xd0\xb0 2026",
+	"\xe6\x9d\xb1\xe4\xba\xac" "abc",
+};
+
+/*
+ * Non-ASCII fragments mixed with ASCII in random strings to exercise the
+ * fallback to the Unicode tables, and composition across ASCII characters.
+ */
+static const char *non_ascii[] = {
+	"\xc3\xa9",					/* U+00E9, e with acute */
+	"\xcc\x81",					/* U+0301, combining acute */
+	"\xcc\xb8",					/* U+0338, combining long solidus overlay */
+	"\xc2\xa0",					/* U+00A0, no-break space */
+	"\xc3\x9f",					/* U+00DF, sharp s */
+	"\xef\xac\x81",				/* U+FB01, fi ligature */
+	"\xd0\x96",					/* U+0416, cyrillic capital zhe */
+	"\xe2\x80\x94",				/* U+2014, em dash */
+	"\xe3\x81\x8b\xe3\x82\x99",	/* U+304B U+3099, hiragana ka + voicing */
+	"\xea\xb0\x80",				/* U+AC00, hangul syllable ga */
+	"\xf0\x9f\x8e\xb5",			/* U+1F3B5, musical note */
+};
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-htv] [-l maxlen] [-n loops] [-R seed]\n"
+		"  -h : prints this help message\n"
+		"  -l : maximum length of random strings (default %d)\n"
+		"  -n : amount of random strings to test (default %d)\n"
+		"  -t : time both canonization paths on ASCII strings\n"
+		"  -v : verbose mode\n"
+		"  -R : seed for repeatable random string sequence\n"
+		, getprogname(), TEST_MAXLEN, TEST_LOOPS);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * Print string with non-printable characters escaped.
+ */
+static void
+print_escaped(const char *what, const char *s)
+{
+	printf("%s: \"", what);
+	for (/* empty */; *s != '\0'; s++) {
+		uchar c = *s;
+
+		if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\')
+			putchar(c);
+		else
+			printf("\\x%02x", c);
+	}
+	printf("\"\n");
+}
+
+/**
+ * Canonize string through both paths and compare the results.
+ */
+static void
+check(const char *s)
+{
+	char *fast, *slow;
+
+	fast = utf8_canonize(s);
+	slow = utf8_canonize_unicode(s);
+
+	if (0 != strcmp(fast, slow)) {
+		printf("%s: canonization mismatch\n", getprogname());
+		print_escaped("input", s);
+		print_escaped("utf8_canonize()", fast);
+		print_escaped("utf8_canonize_unicode()", slow);
+		printf("use '-R %u' to reproduce problem.\n", initial_seed);
+		abort();
+	}
+
+	if (verbose_mode) {
+		print_escaped("input", s);
+		print_escaped("canonic", fast);
+	}
+
+	hfree(fast);
+	hfree(slow);
+}
+
+/**
+ * Generate random string of at most ``maxlen'' characters.
+ *
+ * @param buf		where string is generated
+ * @param size		size of buffer
+ * @param maxlen	maximum amount of characters to generate
+ * @param ascii		whether to only generate ASCII characters
+ */
+static void
+random_string(char *buf, size_t size, size_t maxlen, bool ascii)
+{
+	static const char alnum[] =
+		"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+	size_t len = rand31_value(maxlen);
+	char *p = buf, *end = &buf[size - 1];
+
+	while (len-- != 0) {
+		const char *frag;
+		char c[2];
+		int r = rand31_value(99);
+
+		if (r < 60) {
+			c[0] = alnum[rand31_value(N_ITEMS(alnum) - 2)];	/* Word runs */
+		} else if (r < 75) {
+			c[0] = ' ';
+		} else if (ascii || r < 95) {
+			c[0] = 1 + rand31_value(0x7e);					/* Any ASCII */
+		} else {
+			c[0] = '\0';
+		}
+
+		if ('\0' == c[0]) {
+			frag = non_ascii[rand31_value(N_ITEMS(non_ascii) - 1)];
+		} else {
+			c[1] = '\0';
+			frag = c;
+		}
+
+		if (ptr_diff(end, p) < strlen(frag))
+			break;
+
+		p = mempcpy(p, frag, strlen(frag));
+	}
+
+	*p = '\0';
+}
+
+/**
+ * Time ``loops'' canonizations of each of the ``n'' strings in ``vec''.
+ *
+ * @return CPU time spent, in seconds.
+ */
+static double
+timeit(char *(*canonize)(const char *), char **vec, size_t n, long loops)
+{
+	double start, end;
+	long i;
+
+	tm_cputime(&start, NULL);
+
+	for (i = 0; i < loops; i++) {
+		size_t j;
+
+		for (j = 0; j < n; j++)
+			hfree((*canonize)(vec[j]));
+	}
+
+	tm_cputime(&end, NULL);
+
+	return end - start;
+}
+
+/**
+ * Compare speed of both canonization paths on random ASCII strings.
+ */
+static void
+benchmark(size_t maxlen)
+{
+	char *vec[1000];
+	double fast, slow;
+	size_t i;
+	long loops = 100;
+
+	for (i = 0; i < N_ITEMS(vec); i++) {
+		char buf[1024];
+
+		random_string(buf, sizeof buf, maxlen, TRUE);
+		vec[i] = h_strdup(buf);
+	}
+
+	fast = timeit(utf8_canonize, vec, N_ITEMS(vec), loops);
+	slow = timeit(utf8_canonize_unicode, vec, N_ITEMS(vec), loops);
+
+	printf("canonized %zu ASCII strings %ld times:\n", N_ITEMS(vec), loops);
+	printf("  utf8_canonize():         %.3f secs\n", fast);
+	printf("  utf8_canonize_unicode(): %.3f secs\n", slow);
+
+	for (i = 0; i < N_ITEMS(vec); i++)
+		HFREE_NULL(vec[i]);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	const char options[] = "hl:n:tvR:";
+	long loops = TEST_LOOPS, i;
+	size_t maxlen = TEST_MAXLEN;
+	unsigned rseed = 0;
+	bool tflag = FALSE;
+	int c;
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'l':			/* maximum string length */
+			maxlen = atol(optarg);
+			break;
+		case 'n':			/* amount of loops */
+			loops = atol(optarg);
+			break;
+		case 't':			/* timing report */
+			tflag = TRUE;
+			break;
+		case 'v':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0 || 0 == maxlen)
+		usage();
+
+	atoms_init();
+	locale_init();
+
+	rand31_set_seed(rseed);
+	initial_seed = rand31_current_seed();
+
+	for (i = 0; i < (long) N_ITEMS(fixed_strings); i++)
+		check(fixed_strings[i]);
+
+	for (i = 0; i < loops; i++) {
+		char buf[1024];
+
+		random_string(buf, sizeof buf, maxlen, 0 != (i & 1));
+		check(buf);
+	}
+
+	printf("%s: %zu fixed and %ld random strings canonized identically\n",
+		getprogname(), N_ITEMS(fixed_strings), loops);
+
+	if (tflag)
+		benchmark(maxlen);
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
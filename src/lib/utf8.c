@@ -5667,11 +5667,203 @@ utf32_canonize(const uint32 *src0)
 	return dst;
 }
 
+/*
+ * Fast canonization of pure ASCII strings.
+ *
+ * For ASCII, the NFC/NFKD/NFD steps of utf32_canonize() are no-ops, case
+ * folding is a 1:1 mapping and all the characters belong to the same Unicode
+ * block.  Only the filtering of utf32_filter_char() matters, and it depends
+ * solely on the general category of each character.  We therefore map each
+ * ASCII character to its canonic form once, at initialization time, and
+ * then run the same space-merging logic as utf32_filter(), without leaving
+ * the UTF-8 representation.
+ *
+ * Runs of letters and digits, which make up most of the queries, are
+ * processed 8 bytes at a time using plain word arithmetic.
+ */
+
+#define CANON_ASCII_WORD	8					/**< Bytes per word */
+#define CANON_ASCII_ONES	UINT64_CONST(0x0101010101010101)
+#define CANON_ASCII_HIGH	UINT64_CONST(0x8080808080808080)
+
+static uint8 canon_ascii_lut[0x80];	/**< Canonic form, ' ' or 0 (skipped) */
+static bool canon_ascii_ok;			/**< Whether the LUT can be used */
+
 /**
- * Apply the NFKD/NFC algo to have nomalized keywords (string is halloc()-ed)
+ * Compute per-byte mask of the characters in ``w'' within [lo, hi].
+ *
+ * All the bytes of ``w'' must be ASCII.
+ *
+ * @return word with the highest bit of each byte set when in range.
+ */
+static inline uint64
+canon_ascii_range(uint64 w, uint8 lo, uint8 hi)
+{
+	uint64 ge = w + (0x80 - lo) * CANON_ASCII_ONES;	/* High bit: w >= lo */
+	uint64 gt = w + (0x7f - hi) * CANON_ASCII_ONES;	/* High bit: w > hi */
+
+	return ge & ~gt & CANON_ASCII_HIGH;
+}
+
+/**
+ * @return whether the ``len'' bytes starting at ``s'' are all ASCII.
+ */
+static bool
+canon_ascii_span(const char *s, size_t len)
+{
+	uint64 acc = 0;
+
+	while (len >= CANON_ASCII_WORD) {
+		uint64 w;
+
+		memcpy(&w, s, sizeof w);
+		acc |= w;
+		s += CANON_ASCII_WORD;
+		len -= CANON_ASCII_WORD;
+	}
+
+	while (len-- != 0)
+		acc |= (uchar) *s++;
+
+	return 0 == (acc & CANON_ASCII_HIGH);
+}
+
+/**
+ * Canonize pure ASCII string.
+ *
+ * @return the halloc()-ed canonized string, NULL if ``src'' is not ASCII.
+ */
+static char *
+utf8_canonize_ascii(const char *src)
+{
+	size_t len = strlen(src);
+	const uchar *s = (const uchar *) src, *end = s + len;
+	bool space = TRUE;		/* Prevent adding leading space */
+	char *dst, *p;
+
+	if (!canon_ascii_span(src, len))
+		return NULL;
+
+	dst = p = halloc(len + 1);
+
+	while (s != end) {
+		size_t n = 1;
+
+		if (ptr_diff(end, s) >= CANON_ASCII_WORD) {
+			uint64 w, upper;
+
+			memcpy(&w, s, sizeof w);
+			upper = canon_ascii_range(w, 'A', 'Z');
+
+			if (
+				CANON_ASCII_HIGH == (upper |
+					canon_ascii_range(w, 'a', 'z') |
+					canon_ascii_range(w, '0', '9'))
+			) {
+				w |= upper >> 2;		/* 0x80 >> 2 is 0x20: fold to lowercase */
+				memcpy(p, &w, sizeof w);
+				p += CANON_ASCII_WORD;
+				s += CANON_ASCII_WORD;
+				space = FALSE;
+				continue;
+			}
+			n = CANON_ASCII_WORD;		/* Go through the whole word slowly */
+		}
+
+		while (n-- != 0) {
+			uint8 c = canon_ascii_lut[*s++];
+
+			if (' ' == c) {
+				if (!space && s != end)
+					*p++ = ' ';
+				space = TRUE;
+			} else if ('\n' == c) {
+				*p++ = c;
+			} else if (c != 0) {
+				*p++ = c;
+				space = FALSE;
+			}
+		}
+	}
+
+	*p = '\0';
+	return dst;
+}
+
+/**
+ * Initialize the LUT used by utf8_canonize_ascii(), checking that the
+ * assumptions it relies on hold for the Unicode tables we were compiled with.
+ */
+static void G_COLD
+utf8_canonize_ascii_init(void)
+{
+	uint id = utf32_block_id(0x01);
+	size_t i;
+	uint32 uc;
+
+	for (uc = 0x01; uc < 0x80; uc++) {
+		uint32 folded[4], c;
+		bool space = TRUE;
+
+		if (utf32_block_id(uc) != id)
+			return;
+		if (utf32_decompose_lookup(uc, TRUE) != NULL)
+			return;
+		if (1 != utf32_case_fold_char(uc, folded, N_ITEMS(folded)))
+			return;
+		if (folded[0] >= 0x80 || utf32_decompose_lookup(folded[0], TRUE))
+			return;
+
+		c = utf32_filter_char(folded[0], &space, FALSE);
+
+		if (!space) {
+			if (0x0020 == c || '\n' == c || c != folded[0])
+				return;
+			canon_ascii_lut[uc] = c;			/* Kept */
+		} else if ('\n' == c) {
+			canon_ascii_lut[uc] = c;			/* Kept, no space change */
+		} else if (0 == c) {
+			space = FALSE;
+			c = utf32_filter_char(folded[0], &space, FALSE);
+			if (0x0020 == c && space)
+				canon_ascii_lut[uc] = 0x0020;	/* Turned into a space */
+			else if (0 == c && !space)
+				canon_ascii_lut[uc] = 0;		/* Skipped */
+			else
+				return;
+		} else {
+			return;
+		}
+	}
+
+	/* No composition can occur between ASCII characters */
+	for (i = 0; i < N_ITEMS(utf32_nfkd_lut); i++) {
+		const uint32 *d = utf32_nfkd_lut[i].d;
+
+		if (utf32_nfkd_lut[i].c & UTF32_F_NFKD)
+			continue;		/* Compatibility decompositions never compose */
+
+		if (d[0] < 0x80 && d[1] != 0 && d[1] < 0x80)
+			return;
+	}
+
+	/* Letters and digits must be kept as-is, modulo case, for word runs */
+	for (uc = 0x01; uc < 0x80; uc++) {
+		if (is_ascii_alnum(uc) && canon_ascii_lut[uc] != ascii_tolower(uc))
+			return;
+	}
+
+	canon_ascii_ok = TRUE;
+}
+
+/**
+ * Apply the NFKD/NFC algo to have nomalized keywords (string is halloc()-ed),
+ * always going through the full Unicode tables.
+ *
+ * This is only exported to allow utf8_canonize() to be checked against it.
  */
 char *
-utf8_canonize(const char *src)
+utf8_canonize_unicode(const char *src)
 {
 	uint32 *dst32;
 
@@ -5704,6 +5896,25 @@ utf8_canonize(const char *src)
 	return cast_to_char_ptr(dst32);
 }
 
+/**
+ * Apply the NFKD/NFC algo to have nomalized keywords (string is halloc()-ed)
+ *
+ * Pure ASCII strings, which are the most common by far, are handled without
+ * going through the Unicode tables.
+ */
+char *
+utf8_canonize(const char *src)
+{
+	if (canon_ascii_ok) {
+		char *dst = utf8_canonize_ascii(src);
+
+		if (dst != NULL)
+			return dst;
+	}
+
+	return utf8_canonize_unicode(src);
+}
+
 /**
  * Helper function to sort the lists of ``utf32_compose_roots''.
  */
@@ -5837,6 +6048,7 @@ unicode_compose_init(void)
 		}
 	}
 
+	utf8_canonize_ascii_init();
 	unicode_compose_init_passed = TRUE;
 }
 
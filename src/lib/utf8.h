@@ -86,6 +86,7 @@ char *utf8_strlower_copy(const char *src);
 size_t utf8_strupper(char *dst, const char *src, size_t size);
 char *utf8_strupper_copy(const char *src);
 char *utf8_canonize(const char *src);
+char *utf8_canonize_unicode(const char *src);
 char *utf8_normalize(const char *src, uni_norm_t norm);
 bool utf8_is_decomposed(const char *src, bool nfkd);
 uint NON_NULL_PARAM((2)) utf8_encode_char(uint32 uc, char *buf, size_t size);
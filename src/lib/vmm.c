@@ -5192,29 +5192,25 @@ vmm_dump_pcache_log(logagent_t *la)
 }
 
 /**
- * Dump VMM statistics to specified logging agent.
+ * Enumerate VMM statistics.
+ *
+ * @param cb		callback invoked with the name and value of each counter
+ * @param udata		additional callback argument
  */
-void G_COLD
-vmm_dump_stats_log(logagent_t *la, unsigned options)
+void
+vmm_stats_foreach(stats_fn_t cb, void *udata)
 {
 	struct pmap *pm = vmm_pmap();
 	size_t cached_pages = 0, mapped_pages = 0, native_pages = 0;
 	size_t i;
 	struct vmm_stats stats;
-	bool groupped = booleanize(options & DUMP_OPT_PRETTY);
 
 	VMM_STATS_LOCK;
 	stats = vmm_stats;		/* struct copy under lock protection */
 	VMM_STATS_UNLOCK;
 
-#define DUMP(x)	log_info(la, "VMM %s = %s", #x,		\
-	uint64_to_string_grp(stats.x, groupped))
-
-#define DUMP64(x) G_STMT_START {							\
-	uint64 v = AU64_VALUE(&vmm_stats.x);					\
-	log_info(la, "VMM %s = %s", #x,							\
-		uint64_to_string_grp(v, groupped));					\
-} G_STMT_END
+#define DUMP(x)		(*cb)(#x, stats.x, udata)
+#define DUMP64(x)	(*cb)(#x, AU64_VALUE(&vmm_stats.x), udata)
 
 	DUMP(allocations);
 	DUMP(allocations_zeroed);
@@ -5266,11 +5262,13 @@ vmm_dump_stats_log(logagent_t *la, unsigned options)
 
 	for (i = 0; i < VMM_CACHE_LINES; i++) {
 		struct page_cache *pc = &page_cache[i];
+		char name[32];
 
-		log_info(la, "VMM cache_entries_%zu = %zu", i, pc->current);
+		str_bprintf(name, sizeof name, "cache_entries_%zu", i);
+		(*cb)(name, pc->current, udata);
 	}
 
-	log_info(la, "VMM cache_entries_next_expire = %zu", page_cache_line);
+	(*cb)("cache_entries_next_expire", page_cache_line, udata);
 
 	DUMP(pmap_foreign_discards);
 	DUMP(pmap_foreign_discarded_pages);
@@ -5300,8 +5298,7 @@ vmm_dump_stats_log(logagent_t *la, unsigned options)
 	DUMP(hole_unchanged);
 
 #undef DUMP
-#define DUMP(x) log_info(la, "VMM pmap_%s = %s", #x,	\
-	size_t_to_string_grp(x, groupped))
+#define DUMP(x)		(*cb)("pmap_" #x, x, udata)
 
 	{
 		size_t count, size, pages;
@@ -5318,8 +5315,7 @@ vmm_dump_stats_log(logagent_t *la, unsigned options)
 	}
 
 #undef DUMP
-#define DUMP(x)	log_info(la, "VMM %s = %s", #x,		\
-	size_t_to_string_grp(stats.x, groupped))
+#define DUMP(x)		(*cb)(#x, stats.x, udata)
 
 	DUMP(user_memory);
 	DUMP(user_pages);
@@ -5359,8 +5355,7 @@ vmm_dump_stats_log(logagent_t *la, unsigned options)
 
 	rwlock_runlock(&pm->lock);
 
-#define DUMP(v,x)	log_info(la, "VMM %s = %s", (v),	\
-	size_t_to_string_grp(x, groupped))
+#define DUMP(v,x)	(*cb)((v), (x), udata)
 
 	DUMP("cached_pages", cached_pages);
 	DUMP("mapped_pages", mapped_pages);
@@ -5381,6 +5376,15 @@ vmm_dump_stats_log(logagent_t *la, unsigned options)
 #undef DUMP
 }
 
+/**
+ * Dump VMM statistics to specified logging agent.
+ */
+void G_COLD
+vmm_dump_stats_log(logagent_t *la, unsigned options)
+{
+	log_stats(la, options, "VMM", vmm_stats_foreach);
+}
+
 /**
  * Dump VMM statistics at exit time, along with the current pmap.
  */
@@ -151,6 +151,7 @@ void vmm_dump_pmap(void);
 void vmm_dump_pmap_log(struct logagent *la);
 void vmm_dump_stats(void);
 void vmm_dump_stats_log(struct logagent *la, unsigned options);
+void vmm_stats_foreach(stats_fn_t cb, void *udata);
 void vmm_dump_usage_log(struct logagent *la, unsigned options);
 void vmm_dump_hole_log(struct logagent *la);
 void vmm_dump_pcache_log(struct logagent *la);
@@ -6702,6 +6702,21 @@ xmalloc_stats_digest(sha1_t *digest)
 	SHA1_COMPUTE(xstats, digest);
 }
 
+/**
+ * @return total amount of allocations made so far.
+ */
+uint64
+xmalloc_allocations(void)
+{
+	uint64 n;
+
+	XSTATS_LOCK;
+	n = xstats.allocations;
+	XSTATS_UNLOCK;
+
+	return n;
+}
+
 /**
  * Dump xmalloc usage statistics to specified logging agent.
  */
@@ -6716,39 +6731,23 @@ xmalloc_dump_usage_log(struct logagent *la, unsigned options)
 }
 
 /**
- * Dump xmalloc statistics to specified log agent.
+ * Enumerate xmalloc statistics.
+ *
+ * @param cb		callback invoked with the name and value of each counter
+ * @param udata		additional callback argument
  */
-void G_COLD
-xmalloc_dump_stats_log(logagent_t *la, unsigned options)
+void
+xmalloc_stats_foreach(stats_fn_t cb, void *udata)
 {
 	struct xstats stats;
 
 	XSTATS_LOCK;
 	stats = xstats;		/* struct copy under lock protection */
 	XSTATS_UNLOCK;
-	bool groupped = booleanize(options & DUMP_OPT_PRETTY);
-
-#define DUMP(x)	log_info(la, "XM %s = %s", #x,		\
-	uint64_to_string_grp(stats.x, groupped))
-
-#define DUMP64(x) G_STMT_START {							\
-	uint64 v = AU64_VALUE(&xstats.x);						\
-	log_info(la, "XM %s = %s", #x,							\
-		uint64_to_string_grp(v, groupped));					\
-} G_STMT_END
-
-#define DUMPV(x)	log_info(la, "XM %s = %s", #x,			\
-	size_t_to_string_grp(x, groupped))
-
-	/*
-	 * On Windows, we're performing dynamic patching of loaded libraries
-	 * to redirect them to our malloc(), hence we need to include the
-	 * status of our patching activity as part of the malloc() stats.
-	 */
 
-#ifdef MINGW32
-	win32dlp_dump_stats_log(la, options);
-#endif
+#define DUMP(x)		(*cb)(#x, stats.x, udata)
+#define DUMP64(x)	(*cb)(#x, AU64_VALUE(&xstats.x), udata)
+#define DUMPV(x)	(*cb)(#x, x, udata)
 
 	DUMP(allocations);
 	DUMP64(allocations_zeroed);
@@ -6868,6 +6867,25 @@ xmalloc_dump_stats_log(logagent_t *la, unsigned options)
 #undef DUMPV
 }
 
+/**
+ * Dump xmalloc statistics to specified log agent.
+ */
+void G_COLD
+xmalloc_dump_stats_log(logagent_t *la, unsigned options)
+{
+	/*
+	 * On Windows, we're performing dynamic patching of loaded libraries
+	 * to redirect them to our malloc(), hence we need to include the
+	 * status of our patching activity as part of the malloc() stats.
+	 */
+
+#ifdef MINGW32
+	win32dlp_dump_stats_log(la, options);
+#endif
+
+	log_stats(la, options, "XM", xmalloc_stats_foreach);
+}
+
 /**
  * Dump freelist status to specified log agent.
  */
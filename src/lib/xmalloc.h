@@ -94,11 +94,13 @@ void xmalloc_show_settings_log(struct logagent *la);
 void xmalloc_stop_freeing(void);
 void xmalloc_dump_stats(void);
 void xmalloc_dump_stats_log(struct logagent *la, unsigned options);
+void xmalloc_stats_foreach(stats_fn_t cb, void *udata);
 void xmalloc_dump_usage_log(struct logagent *la, unsigned options);
 void xmalloc_dump_freelist_log(struct logagent *la);
 size_t xmalloc_freelist_check(struct logagent *la, unsigned flags);
 
 void xmalloc_stats_digest(struct sha1 *digest);
+uint64 xmalloc_allocations(void);
 
 void xgc(void);
 void xmalloc_long_term(void);
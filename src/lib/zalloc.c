@@ -3485,6 +3485,21 @@ zalloc_stats_digest(sha1_t *digest)
 	SHA1_COMPUTE(zstats, digest);
 }
 
+/**
+ * @return total amount of zone allocations made so far.
+ */
+uint64
+zalloc_allocations(void)
+{
+	uint64 n;
+
+	ZSTATS_LOCK;
+	n = zstats.allocations;
+	ZSTATS_UNLOCK;
+
+	return n;
+}
+
 /**
  * Dump zone status to specified log agent.
  */
@@ -3587,30 +3602,24 @@ zalloc_dump_usage_log(logagent_t *la, unsigned options)
 }
 
 /**
- * Dump zalloc() statistics to specified log agent.
+ * Enumerate zalloc() statistics.
+ *
+ * @param cb		callback invoked with the name and value of each counter
+ * @param udata		additional callback argument
  */
-void G_COLD
-zalloc_dump_stats_log(logagent_t *la, unsigned options)
+void
+zalloc_stats_foreach(stats_fn_t cb, void *udata)
 {
 	struct zstats stats;
-	bool groupped = booleanize(options & DUMP_OPT_PRETTY);
 
-	/* Will be always less than a thousand, ignore pretty-priting */
-	log_info(la, "ZALLOC zone_count = %s",
-		size_t_to_string(NULL == zt ? 0 : hash_table_size(zt)));
+	(*cb)("zone_count", NULL == zt ? 0 : hash_table_size(zt), udata);
 
 	ZSTATS_LOCK;
 	stats = zstats;			/* struct copy under lock protection */
 	ZSTATS_UNLOCK;
 
-#define DUMP(x)	log_info(la, "ZALLOC %s = %s", #x,		\
-	uint64_to_string_grp(stats.x, groupped))
-
-#define DUMP64(x) G_STMT_START {							\
-	uint64 v = AU64_VALUE(&zstats.x);						\
-	log_info(la, "ZALLOC %s = %s", #x,						\
-		uint64_to_string_grp(v, groupped));					\
-} G_STMT_END
+#define DUMP(x)		(*cb)(#x, stats.x, udata)
+#define DUMP64(x)	(*cb)(#x, AU64_VALUE(&zstats.x), udata)
 
 	DUMP(allocations);
 	DUMP(freeings);
@@ -3636,13 +3645,7 @@ zalloc_dump_stats_log(logagent_t *la, unsigned options)
 	DUMP(zgc_excess_zones_freed);
 	DUMP(zgc_shrinked);
 
-	/* Will be always less than a thousand, ignore pretty-priting */
-	log_info(la, "ZALLOC zgc_zone_count = %u", atomic_uint_get(&zgc_zone_cnt));
-
-#undef DUMP
-#define DUMP(x)	log_info(la, "ZALLOC %s = %s", #x,		\
-	(options & DUMP_OPT_PRETTY) ?						\
-		size_t_to_gstring(stats.x) : size_t_to_string(stats.x))
+	(*cb)("zgc_zone_count", atomic_uint_get(&zgc_zone_cnt), udata);
 
 	DUMP(user_memory);
 	DUMP(user_blocks);
@@ -3653,6 +3656,15 @@ zalloc_dump_stats_log(logagent_t *la, unsigned options)
 #undef DUMP64
 }
 
+/**
+ * Dump zalloc() statistics to specified log agent.
+ */
+void G_COLD
+zalloc_dump_stats_log(logagent_t *la, unsigned options)
+{
+	log_stats(la, options, "ZALLOC", zalloc_stats_foreach);
+}
+
 /**
  * Dump zalloc() statistics.
  */
@@ -88,6 +88,7 @@ void zgc(bool overloaded);
 void zalloc_long_term(void);
 
 void zalloc_stats_digest(struct sha1 *digest);
+uint64 zalloc_allocations(void);
 
 void zinit(void);
 void zclose(void);
@@ -99,6 +100,7 @@ void zalloc_memusage_close(void);
 void zalloc_dump_stats(void);
 void zalloc_dump_usage_log(struct logagent *la, unsigned options);
 void zalloc_dump_stats_log(struct logagent *la, unsigned options);
+void zalloc_stats_foreach(stats_fn_t cb, void *udata);
 void zalloc_dump_zones_log(struct logagent *la);
 
 enum zalloc_stack_ctrl {
@@ -43,6 +43,7 @@
 #include "core/ban.h"
 #include "core/bogons.h"
 #include "core/bsched.h"
+#include "core/capture.h"
 #include "core/clock.h"
 #include "core/ctl.h"
 #include "core/dh.h"
@@ -148,6 +149,7 @@
 #include "lib/pattern.h"
 #include "lib/pow2.h"
 #include "lib/product.h"
+#include "lib/profiler.h"
 #include "lib/progname.h"
 #include "lib/random.h"
 #include "lib/setproctitle.h"
@@ -707,6 +709,7 @@ gtk_gnutella_exit(int exit_code)
 
 	DO(socket_shutdowning);			/* We're about to shutdown for good */
 	DO(shell_close);
+	DO(profiler_close);
 	DO(file_info_store_if_dirty);	/* For safety, will run again below */
 	DO(file_info_close_pre);
 	DO_BOOL(node_bye_all, byeall);
@@ -963,6 +966,7 @@ gtk_gnutella_exit(int exit_code)
 	DO(adns_close);
 	DO(dbus_util_close);  /* After adns_close() to avoid strange crashes */
 	DO(ipp_cache_close);
+	DO(capture_close);
 	DO(dump_close);
 	DO(tls_global_close);
 	DO(misc_close);
@@ -0,0 +1,256 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup shell
+ * @file
+ *
+ * The "capture" command.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "cmd.h"
+
+#include "core/capture.h"
+
+#include "if/gnet_property_priv.h"
+#include "if/core/settings.h"
+
+#include "lib/ascii.h"
+#include "lib/str.h"
+#include "lib/stringify.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+static enum shell_reply
+shell_exec_capture_start(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	shell_check(sh);
+
+	if (argc < 2)
+		return REPLY_ERROR;
+
+	if (!capture_start(argv[1])) {
+		shell_set_formatted(sh, "Cannot capture into \"%s\": %m", argv[1]);
+		return REPLY_ERROR;
+	}
+
+	shell_set_formatted(sh, "Capturing traffic into \"%s\"", argv[1]);
+	return REPLY_READY;
+}
+
+static enum shell_reply
+shell_exec_capture_stop(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	shell_check(sh);
+	(void) argc;
+	(void) argv;
+
+	if (!capture_is_active()) {
+		shell_set_msg(sh, "No capture in progress");
+		return REPLY_ERROR;
+	}
+
+	shell_write_linef(sh, REPLY_READY, "Captured %s message%s into \"%s\"",
+		uint64_to_string(capture_count()), plural(capture_count()),
+		capture_path());
+	capture_stop();
+
+	return REPLY_READY;
+}
+
+static enum shell_reply
+shell_exec_capture_status(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	shell_check(sh);
+	(void) argc;
+	(void) argv;
+
+	if (capture_is_active()) {
+		shell_write_linef(sh, REPLY_READY,
+			"Capturing into \"%s\", %s message%s so far",
+			capture_path(), uint64_to_string(capture_count()),
+			plural(capture_count()));
+	} else {
+		shell_write_line(sh, REPLY_READY, "No capture in progress");
+	}
+
+	return REPLY_READY;
+}
+
+static enum shell_reply
+shell_exec_capture_replay(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	struct capture_replay r;
+	uint64 count = 0, total_ns = 0;
+	uint i;
+
+	shell_check(sh);
+
+	if (argc < 2)
+		return REPLY_ERROR;
+
+	if (GNET_PROPERTY(online_mode)) {
+		shell_set_msg(sh, "Must be offline to replay traffic");
+		return REPLY_ERROR;
+	}
+
+	if (capture_is_active()) {
+		shell_set_msg(sh, "Cannot replay traffic whilst capturing");
+		return REPLY_ERROR;
+	}
+
+	if (settings_config_dir_is_default()) {
+		shell_set_msg(sh, "Replayed traffic alters the persisted state: "
+			"restart with $GTK_GNUTELLA_DIR set to a throwaway directory");
+		return REPLY_ERROR;
+	}
+
+	if (!capture_replay(argv[1], &r)) {
+		shell_set_formatted(sh, "Cannot replay \"%s\": %m", argv[1]);
+		return REPLY_ERROR;
+	}
+
+	shell_write_linef(sh, REPLY_READY,
+		"Replayed %s message%s (%s record%s, %s skipped) from %u node%s",
+		uint64_to_string(r.replayed), plural(r.replayed),
+		uint64_to_string2(r.records), plural(r.records),
+		uint64_to_string3(r.skipped), r.nodes, plural(r.nodes));
+
+	shell_write_linef(sh, REPLY_READY,
+		"%-8s %10s %10s %10s %10s %10s %10s",
+		"Stage", "Count", "Mean (ns)", "p50", "p90", "p99", "Max");
+
+	for (i = 0; i < N_ITEMS(r.stage); i++) {
+		const struct capture_hist *h = &r.stage[i];
+
+		if (0 == h->count)
+			continue;
+
+		count += h->count;
+		total_ns += h->total_ns;
+
+		shell_write_linef(sh, REPLY_READY,
+			"%-8s %10s %10s %10s %10s %10s %10s",
+			capture_stage_name(i),
+			int64_to_string(h->count),
+			int64_to_string2(h->total_ns / h->count),
+			int64_to_string3(capture_hist_percentile(h, 0.50)),
+			int64_to_string4(capture_hist_percentile(h, 0.90)),
+			int64_to_string5(capture_hist_percentile(h, 0.99)),
+			int64_to_string6(h->max_ns));
+	}
+
+	shell_write_linef(sh, REPLY_READY,
+		"%.0f msg/s wall-clock, %.0f msg/s in stack",
+		0.0 == r.elapsed ? 0.0 : r.replayed / r.elapsed,
+		0 == total_ns ? 0.0 : count * 1e9 / total_ns);
+
+	shell_write_linef(sh, REPLY_READY,
+		"Allocations: zalloc=%s, tmalloc=%s, xmalloc=%s (%.2f per message)",
+		uint64_to_string(r.zallocs), uint64_to_string2(r.tallocs),
+		uint64_to_string3(r.xallocs),
+		0 == r.replayed ? 0.0 :
+			(double) (r.zallocs + r.tallocs + r.xallocs) / r.replayed);
+
+	return REPLY_READY;
+}
+
+/**
+ * Handle the "CAPTURE" command.
+ */
+enum shell_reply
+shell_exec_capture(struct gnutella_shell *sh, int argc, const char *argv[])
+{
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	if (argc < 2)
+		return REPLY_ERROR;
+
+#define CMD(name) G_STMT_START { \
+	if (0 == ascii_strcasecmp(argv[1], #name)) \
+		return shell_exec_capture_ ## name(sh, argc - 1, argv + 1); \
+} G_STMT_END
+
+	CMD(replay);
+	CMD(start);
+	CMD(status);
+	CMD(stop);
+
+#undef CMD
+
+	shell_set_formatted(sh, _("Unknown operation \"%s\""), argv[1]);
+	return REPLY_ERROR;
+}
+
+const char *
+shell_summary_capture(void)
+{
+	return "Capture and replay Gnutella traffic";
+}
+
+const char *
+shell_help_capture(int argc, const char *argv[])
+{
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	if (argc > 1) {
+		if (0 == ascii_strcasecmp(argv[1], "replay")) {
+			return "capture replay FILE\n"
+				"push received traffic from FILE through the stack, offline\n"
+				"and report processing times per message kind\n"
+				"requires $GTK_GNUTELLA_DIR to point to a throwaway directory\n"
+				"since replayed messages update the persisted state\n";
+		} else if (0 == ascii_strcasecmp(argv[1], "start")) {
+			return "capture start FILE\n"
+				"capture RX and TX Gnutella traffic into FILE\n";
+		} else if (0 == ascii_strcasecmp(argv[1], "status")) {
+			return "capture status\n"
+				"show whether traffic is being captured\n";
+		} else if (0 == ascii_strcasecmp(argv[1], "stop")) {
+			return "capture stop\n"
+				"stop capturing traffic\n";
+		}
+	} else {
+		return
+			"capture replay FILE\n"
+			"capture start FILE\n"
+			"capture status\n"
+			"capture stop\n"
+			"Use \"help capture <cmd>\" for additional information\n";
+	}
+	return NULL;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
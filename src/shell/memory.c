@@ -38,6 +38,7 @@
 
 #include "cmd.h"
 
+#include "lib/arena.h"
 #include "lib/ascii.h"
 #include "lib/dump_options.h"
 #include "lib/fd.h"
@@ -433,6 +434,16 @@ memory_stats_unsupported(struct gnutella_shell *sh,
 	return REPLY_ERROR;
 }
 
+static enum shell_reply
+shell_exec_memory_stats_arena(struct gnutella_shell *sh,
+	unsigned opt, unsigned which)
+{
+	if (which & STATS_USAGE)
+		return memory_stats_unsupported(sh, "arena", STATS_USAGE_STR);
+
+	return memory_run_opt_shower(sh, arena_dump_stats_log, "ARENA ", opt);
+}
+
 static enum shell_reply
 shell_exec_memory_stats_halloc(struct gnutella_shell *sh,
 	unsigned opt, unsigned which)
@@ -538,6 +549,7 @@ shell_exec_memory_stats(struct gnutella_shell *sh,
 		return shell_exec_memory_stats_## name(sh, opt, which); \
 } G_STMT_END
 
+	CMD(arena);
 	CMD(halloc);
 	CMD(palloc);
 	CMD(tmalloc);
@@ -766,7 +778,7 @@ shell_help_memory(int argc, const char *argv[])
 				"memory show zones     # display zone usage\n";
 		} else if (0 == ascii_strcasecmp(argv[1], "stats")) {
 			return "memory stats [-pu] "
-				"halloc|omalloc|palloc|tmalloc|vmm|xmalloc|zalloc\n"
+				"arena|halloc|omalloc|palloc|tmalloc|vmm|xmalloc|zalloc\n"
 				"show statistics about specified memory sub-system\n"
 				"-p : pretty-print numbers with thousands separators\n"
 				"-u : show allocation usage statistics, if available\n";
@@ -781,7 +793,8 @@ shell_help_memory(int argc, const char *argv[])
 #endif
 		"memory check xmalloc\n"
 		"memory show hole|magazines|options|pmap|pools|xmalloc|zones\n"
-		"memory stats [-pu] omalloc|palloc|tmalloc|vmm|xmalloc|zalloc\n"
+		"memory stats [-pu] "
+			"arena|halloc|omalloc|palloc|tmalloc|vmm|xmalloc|zalloc\n"
 		"memory usage zone <size> on|off|show\n"
 		;
 	}
@@ -0,0 +1,460 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup shell
+ * @file
+ *
+ * The "metrics" command.
+ *
+ * Exports statistics in the OpenMetrics text format, for monitoring tools
+ * to scrape without having to parse the output of the other commands.
+ *
+ * The amount of work done is bounded: all the exported families have a
+ * fixed size and are read from running totals or statistics snapshots,
+ * without iterating over the connected nodes.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "cmd.h"
+
+#include "core/gnet_stats.h"
+#include "core/mq.h"
+
+#include "dht/routing.h"
+
+#include "if/core/net_stats.h"
+
+#include "lib/palloc.h"
+#include "lib/str.h"
+#include "lib/stringify.h"
+#include "lib/thread.h"
+#include "lib/tmalloc.h"
+#include "lib/vmm.h"
+#include "lib/xmalloc.h"
+#include "lib/zalloc.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+#define METRICS_PREFIX	"gtkg_"
+
+/**
+ * Emit the metadata of a metric family.
+ */
+static void
+metrics_family(struct gnutella_shell *sh,
+	const char *name, const char *type, const char *help)
+{
+	char buf[256];
+
+	str_bprintf(buf, sizeof buf,
+		"# TYPE " METRICS_PREFIX "%s %s\n"
+		"# HELP " METRICS_PREFIX "%s %s.\n",
+		name, type, name, help);
+	shell_write(sh, buf);
+}
+
+/**
+ * Emit an integer sample.
+ *
+ * @param sh		the shell
+ * @param name		the sample name, without prefix
+ * @param labels	the formatted labels, without braces, NULL if none
+ * @param value		the sample value
+ */
+static void
+metrics_uint64(struct gnutella_shell *sh,
+	const char *name, const char *labels, uint64 value)
+{
+	char buf[256];
+
+	str_bprintf(buf, sizeof buf, METRICS_PREFIX "%s%s%s%s %s\n",
+		name, NULL == labels ? "" : "{", EMPTY_STRING(labels),
+		NULL == labels ? "" : "}", uint64_to_string(value));
+	shell_write(sh, buf);
+}
+
+/**
+ * Emit a floating point sample.
+ *
+ * @param sh		the shell
+ * @param name		the sample name, without prefix
+ * @param labels	the formatted labels, without braces, NULL if none
+ * @param value		the sample value
+ */
+static void
+metrics_double(struct gnutella_shell *sh,
+	const char *name, const char *labels, double value)
+{
+	char buf[256];
+
+	str_bprintf(buf, sizeof buf, METRICS_PREFIX "%s%s%s%s %.9g\n",
+		name, NULL == labels ? "" : "{", EMPTY_STRING(labels),
+		NULL == labels ? "" : "}", value);
+	shell_write(sh, buf);
+}
+
+/**
+ * Export the general statistics counters.
+ */
+static void
+metrics_general(struct gnutella_shell *sh, const gnet_stats_t *stats)
+{
+	char labels[128];
+	uint i;
+
+	metrics_family(sh, "general", "unknown", "General statistics counters");
+
+	for (i = 0; i < GNR_TYPE_COUNT; i++) {
+		str_bprintf(labels, sizeof labels, "name=\"%s\"",
+			gnet_stats_general_to_string(i));
+		metrics_uint64(sh, "general", labels, stats->general[i]);
+	}
+}
+
+/**
+ * Export per-message-type traffic counters for one transport.
+ */
+static void
+metrics_traffic_samples(struct gnutella_shell *sh,
+	const char *name, const char *transport,
+	const uint64 *v1, const uint64 *v2)
+{
+	char labels[128];
+	uint t;
+
+	for (t = 0; t < MSG_TOTAL; t++) {
+		str_bprintf(labels, sizeof labels, "transport=\"%s\",type=\"%s\"",
+			transport, gnet_msg_type_name(t));
+		metrics_uint64(sh, name, labels,
+			v1[t] + (NULL == v2 ? 0 : v2[t]));
+	}
+}
+
+/**
+ * Export the Gnutella traffic counters, per transport and message type.
+ */
+static void
+metrics_traffic(struct gnutella_shell *sh,
+	const gnet_stats_t *tcp, const gnet_stats_t *udp)
+{
+	char labels[128];
+	uint i;
+
+#define TRAFFIC(name, field, help) G_STMT_START {					\
+	metrics_family(sh, name, "counter", help);						\
+	metrics_traffic_samples(sh, name "_total", "tcp", tcp->field, NULL);	\
+	metrics_traffic_samples(sh, name "_total", "udp", udp->field, NULL);	\
+} G_STMT_END
+
+#define TRAFFIC2(name, f1, f2, help) G_STMT_START {					\
+	metrics_family(sh, name, "counter", help);						\
+	metrics_traffic_samples(sh, name "_total", "tcp", tcp->f1, tcp->f2);	\
+	metrics_traffic_samples(sh, name "_total", "udp", udp->f1, udp->f2);	\
+} G_STMT_END
+
+	TRAFFIC("messages_received", pkg.received, "Messages received");
+	TRAFFIC("bytes_received", byte.received, "Bytes received");
+	TRAFFIC2("messages_sent", pkg.generated, pkg.relayed, "Messages sent");
+	TRAFFIC2("bytes_sent", byte.generated, byte.relayed, "Bytes sent");
+	TRAFFIC("messages_expired", pkg.expired, "Messages expired");
+	TRAFFIC("messages_dropped", pkg.dropped, "Messages dropped");
+	TRAFFIC("bytes_dropped", byte.dropped, "Bytes dropped");
+
+#undef TRAFFIC
+#undef TRAFFIC2
+
+	metrics_family(sh, "messages_dropped_by_reason", "counter",
+		"Messages dropped, per reason");
+
+	for (i = 0; i < MSG_DROP_REASON_COUNT; i++) {
+		str_bprintf(labels, sizeof labels, "transport=\"tcp\",reason=\"%s\"",
+			gnet_stats_drop_reason_name(i));
+		metrics_uint64(sh, "messages_dropped_by_reason_total", labels,
+			tcp->drop_reason[i][MSG_TOTAL]);
+		str_bprintf(labels, sizeof labels, "transport=\"udp\",reason=\"%s\"",
+			gnet_stats_drop_reason_name(i));
+		metrics_uint64(sh, "messages_dropped_by_reason_total", labels,
+			udp->drop_reason[i][MSG_TOTAL]);
+	}
+}
+
+/**
+ * Export the message processing latency summaries.
+ */
+static void
+metrics_latency(struct gnutella_shell *sh)
+{
+	static const double quantile[] = { 0.5, 0.9, 0.99, 0.999 };
+	struct gnet_stats_latency *h;
+	char labels[128];
+	uint t;
+
+	XMALLOC(h);
+
+	metrics_family(sh, "message_latency_seconds", "summary",
+		"Time spent processing received Gnutella messages");
+
+	for (t = 0; t < MSG_TOTAL; t++) {
+		const char *type = gnet_msg_type_name(t);
+		uint i;
+
+		gnet_stats_latency_get(t, h);
+
+		if (0 == h->count)
+			continue;
+
+		for (i = 0; i < N_ITEMS(quantile); i++) {
+			str_bprintf(labels, sizeof labels, "type=\"%s\",quantile=\"%g\"",
+				type, quantile[i]);
+			metrics_double(sh, "message_latency_seconds", labels,
+				gnet_stats_latency_percentile(h, quantile[i]) / 1e9);
+		}
+
+		str_bprintf(labels, sizeof labels, "type=\"%s\"", type);
+		metrics_uint64(sh, "message_latency_seconds_count", labels, h->count);
+		metrics_double(sh, "message_latency_seconds_sum", labels,
+			h->total_ns / 1e9);
+	}
+
+	XFREE_NULL(h);
+}
+
+/**
+ * Export the bandwidth scheduler rates.
+ */
+static void
+metrics_bandwidth(struct gnutella_shell *sh)
+{
+	static const struct {
+		gnet_bw_source source;
+		const char *name;
+	} bws[] = {
+		{ BW_GNET_IN,		"gnet_in" },
+		{ BW_GNET_OUT,		"gnet_out" },
+		{ BW_HTTP_IN,		"http_in" },
+		{ BW_HTTP_OUT,		"http_out" },
+		{ BW_LEAF_IN,		"leaf_in" },
+		{ BW_LEAF_OUT,		"leaf_out" },
+		{ BW_GNET_UDP_IN,	"gnet_udp_in" },
+		{ BW_GNET_UDP_OUT,	"gnet_udp_out" },
+		{ BW_DHT_IN,		"dht_in" },
+		{ BW_DHT_OUT,		"dht_out" },
+	};
+	gnet_bw_stats_t stats[N_ITEMS(bws)];
+	char labels[64];
+	uint i;
+
+	for (i = 0; i < N_ITEMS(bws); i++)
+		gnet_get_bw_stats(bws[i].source, &stats[i]);
+
+#define BW(metric, field, help) G_STMT_START {						\
+	metrics_family(sh, metric, "gauge", help);						\
+	for (i = 0; i < N_ITEMS(bws); i++) {							\
+		str_bprintf(labels, sizeof labels, "scheduler=\"%s\"", bws[i].name); \
+		metrics_uint64(sh, metric, labels, stats[i].field);			\
+	}																\
+} G_STMT_END
+
+	BW("bandwidth_bytes_per_second", current,
+		"Current bandwidth usage, in bytes per second");
+	BW("bandwidth_average_bytes_per_second", average,
+		"Average bandwidth usage, in bytes per second");
+	BW("bandwidth_limit_bytes_per_second", limit,
+		"Configured bandwidth limit, in bytes per second");
+	BW("bandwidth_limited", enabled,
+		"Whether bandwidth limit is enforced");
+
+#undef BW
+}
+
+/**
+ * Export the message queue depths, from the running totals kept by the
+ * message queues.
+ */
+static void
+metrics_mq(struct gnutella_shell *sh)
+{
+	mq_stats_t tcp, udp;
+
+	mq_stats_get(&tcp, &udp);
+
+	metrics_family(sh, "mq_queued_bytes", "gauge",
+		"Bytes held in the message queues");
+	metrics_uint64(sh, "mq_queued_bytes", "transport=\"tcp\"", tcp.bytes);
+	metrics_uint64(sh, "mq_queued_bytes", "transport=\"udp\"", udp.bytes);
+
+	metrics_family(sh, "mq_queued_messages", "gauge",
+		"Messages held in the message queues");
+	metrics_uint64(sh, "mq_queued_messages", "transport=\"tcp\"",
+		tcp.messages);
+	metrics_uint64(sh, "mq_queued_messages", "transport=\"udp\"",
+		udp.messages);
+
+	metrics_family(sh, "mq_flow_controlled_nodes", "gauge",
+		"Nodes whose message queue is in flow-control");
+	metrics_uint64(sh, "mq_flow_controlled_nodes", NULL, tcp.flowc);
+
+	metrics_family(sh, "mq_swift_controlled_nodes", "gauge",
+		"Nodes whose message queue is in swift mode");
+	metrics_uint64(sh, "mq_swift_controlled_nodes", NULL, tcp.swift);
+}
+
+/**
+ * Context for metrics_stats_sample().
+ */
+struct metrics_stats_ctx {
+	struct gnutella_shell *sh;
+	const char *name;
+};
+
+/**
+ * Statistics enumeration callback, emitting one sample per counter.
+ */
+static void
+metrics_stats_sample(const char *key, uint64 value, void *udata)
+{
+	const struct metrics_stats_ctx *ctx = udata;
+	char labels[128];
+
+	str_bprintf(labels, sizeof labels, "name=\"%s\"", key);
+	metrics_uint64(ctx->sh, ctx->name, labels, value);
+}
+
+/**
+ * Export statistics from an enumerating routine, one sample per counter,
+ * keyed by the counter name.
+ *
+ * @param sh		the shell
+ * @param foreach	the stats enumerating routine
+ * @param name		the metric family name, without prefix
+ * @param help		the metric family description
+ */
+static void
+metrics_stats(struct gnutella_shell *sh,
+	stats_foreach_fn_t foreach, const char *name, const char *help)
+{
+	struct metrics_stats_ctx ctx;
+
+	ctx.sh = sh;
+	ctx.name = name;
+
+	metrics_family(sh, name, "unknown", help);
+	(*foreach)(metrics_stats_sample, &ctx);
+}
+
+/**
+ * Export the memory allocator and thread statistics.
+ */
+static void
+metrics_runtime(struct gnutella_shell *sh)
+{
+	metrics_stats(sh, palloc_stats_foreach,
+		"palloc", "Memory pool allocator statistics");
+	metrics_stats(sh, zalloc_stats_foreach,
+		"zalloc", "Zone allocator statistics");
+	metrics_stats(sh, tmalloc_stats_foreach,
+		"tmalloc", "Thread magazine allocator statistics");
+	metrics_stats(sh, xmalloc_stats_foreach,
+		"xmalloc", "Heap allocator statistics");
+	metrics_stats(sh, vmm_stats_foreach,
+		"vmm", "Virtual memory manager statistics");
+	metrics_stats(sh, thread_stats_foreach,
+		"thread", "Thread statistics");
+
+	metrics_family(sh, "threads", "gauge", "Running threads");
+	metrics_uint64(sh, "threads", NULL, thread_count());
+}
+
+/**
+ * Handle the "METRICS" command.
+ */
+enum shell_reply
+shell_exec_metrics(struct gnutella_shell *sh, int argc, const char *argv[])
+{
+	gnet_stats_t *stats, *tcp, *udp;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	/*
+	 * This command runs in the main thread, which is required to access
+	 * the TCP and UDP traffic statistics and the queue totals.  The stats
+	 * are large, so we allocate them on the heap nonetheless.
+	 */
+
+	g_assert(thread_is_main());
+
+	XMALLOC(stats);
+	XMALLOC(tcp);
+	XMALLOC(udp);
+
+	gnet_stats_get(stats);
+	gnet_stats_tcp_get(tcp);
+	gnet_stats_udp_get(udp);
+
+	shell_write(sh, "100~\n");
+
+	metrics_general(sh, stats);
+	metrics_traffic(sh, tcp, udp);
+	metrics_latency(sh);
+	metrics_bandwidth(sh);
+	metrics_mq(sh);
+
+	metrics_family(sh, "dht_size", "gauge", "Estimated DHT size");
+	metrics_uint64(sh, "dht_size", NULL, dht_size());
+
+	metrics_runtime(sh);
+
+	shell_write(sh, "# EOF\n");
+	shell_write(sh, ".\n");
+
+	XFREE_NULL(stats);
+	XFREE_NULL(tcp);
+	XFREE_NULL(udp);
+
+	return REPLY_READY;
+}
+
+const char *
+shell_summary_metrics(void)
+{
+	return "Export statistics in OpenMetrics format";
+}
+
+const char *
+shell_help_metrics(int argc, const char *argv[])
+{
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	return "metrics\n"
+		"export statistics in the OpenMetrics text format\n";
+}
+
+/* vi: set ts=4 sw=4 cindent: */
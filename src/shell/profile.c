@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup shell
+ * @file
+ *
+ * The "profile" command.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "cmd.h"
+
+#include "lib/ascii.h"
+#include "lib/options.h"
+#include "lib/parse.h"
+#include "lib/profiler.h"
+#include "lib/str.h"
+#include "lib/stringify.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+/**
+ * Write multi-line string to the shell, as raw output.
+ */
+static void
+shell_profile_write(struct gnutella_shell *sh, str_t *s)
+{
+	shell_write(sh, "100~\n");
+	shell_write(sh, str_2c(s));
+	shell_write(sh, ".\n");
+	str_destroy_null(&s);
+}
+
+static enum shell_reply
+shell_exec_profile_start(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	const char *opt_f;
+	const option_t options[] = {
+		{ "f:", &opt_f },
+	};
+	uint hz = PROFILER_HZ_DEFAULT;
+	int parsed;
+
+	shell_check(sh);
+
+	parsed = shell_options_parse(sh, argv, options, N_ITEMS(options));
+	if (parsed < 0)
+		return REPLY_ERROR;
+
+	argc -= parsed;	/* counts only command arguments now */
+
+	if (argc != 0)
+		return REPLY_ERROR;
+
+	if (opt_f != NULL) {
+		int error;
+
+		hz = parse_uint32(opt_f, NULL, 10, &error);
+		if (error || 0 == hz || hz > PROFILER_HZ_MAX) {
+			shell_set_formatted(sh,
+				"Invalid sampling frequency \"%s\", must be 1-%u Hz",
+				opt_f, PROFILER_HZ_MAX);
+			return REPLY_ERROR;
+		}
+	}
+
+	if (!profiler_start(hz)) {
+		shell_set_formatted(sh, "Cannot start profiler: %m");
+		return REPLY_ERROR;
+	}
+
+	shell_set_formatted(sh, "Profiling at %u Hz", hz);
+	return REPLY_READY;
+}
+
+static enum shell_reply
+shell_exec_profile_stop(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	shell_check(sh);
+	(void) argc;
+	(void) argv;
+
+	if (!profiler_is_running()) {
+		shell_set_msg(sh, "Profiler is not running");
+		return REPLY_ERROR;
+	}
+
+	profiler_stop();
+	shell_set_msg(sh, "Profiler stopped");
+	return REPLY_READY;
+}
+
+static enum shell_reply
+shell_exec_profile_status(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	struct profiler_stats ps;
+
+	shell_check(sh);
+	(void) argc;
+	(void) argv;
+
+	profiler_stats(&ps);
+
+	if (0 != ps.hz)
+		shell_write_linef(sh, REPLY_READY, "Profiling at %u Hz", ps.hz);
+	else
+		shell_write_line(sh, REPLY_READY, "Profiler is not running");
+
+	shell_write_linef(sh, REPLY_READY,
+		"%s sample%s in %zu distinct stack%s, %s dropped, %s truncated",
+		uint64_to_string(ps.samples), plural(ps.samples),
+		ps.stacks, plural(ps.stacks),
+		uint64_to_string2(ps.dropped), uint64_to_string3(ps.truncated));
+
+	if (0 != ps.stale) {
+		shell_write_linef(sh, REPLY_READY,
+			"%s sample%s attributed to \"exited\", their thread being gone",
+			uint64_to_string(ps.stale), plural(ps.stale));
+	}
+
+	return REPLY_READY;
+}
+
+static enum shell_reply
+shell_exec_profile_folded(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	shell_check(sh);
+	(void) argc;
+	(void) argv;
+
+	shell_profile_write(sh, profiler_folded());
+	return REPLY_READY;
+}
+
+static enum shell_reply
+shell_exec_profile_top(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	uint32 max = 20;
+
+	shell_check(sh);
+
+	if (argc > 1) {
+		int error;
+
+		max = parse_uint32(argv[1], NULL, 10, &error);
+		if (error) {
+			shell_set_formatted(sh, "Invalid count \"%s\"", argv[1]);
+			return REPLY_ERROR;
+		}
+	}
+
+	shell_profile_write(sh, profiler_subsystems(max));
+	return REPLY_READY;
+}
+
+static enum shell_reply
+shell_exec_profile_reset(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	shell_check(sh);
+	(void) argc;
+	(void) argv;
+
+	profiler_reset();
+	shell_set_msg(sh, "Profiler samples discarded");
+	return REPLY_READY;
+}
+
+/**
+ * Handle the "PROFILE" command.
+ */
+enum shell_reply
+shell_exec_profile(struct gnutella_shell *sh, int argc, const char *argv[])
+{
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	if (argc < 2)
+		return REPLY_ERROR;
+
+#define CMD(name) G_STMT_START { \
+	if (0 == ascii_strcasecmp(argv[1], #name)) \
+		return shell_exec_profile_ ## name(sh, argc - 1, argv + 1); \
+} G_STMT_END
+
+	CMD(folded);
+	CMD(reset);
+	CMD(start);
+	CMD(status);
+	CMD(stop);
+	CMD(top);
+
+#undef CMD
+
+	shell_set_formatted(sh, _("Unknown operation \"%s\""), argv[1]);
+	return REPLY_ERROR;
+}
+
+const char *
+shell_summary_profile(void)
+{
+	return "Statistical CPU profiler";
+}
+
+const char *
+shell_help_profile(int argc, const char *argv[])
+{
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	if (argc > 1) {
+		if (0 == ascii_strcasecmp(argv[1], "folded")) {
+			return "profile folded\n"
+				"dump sampled stacks in folded format, one per line:\n"
+				"thread;outermost;...;innermost count\n"
+				"suitable as input to flame graph generators\n";
+		} else if (0 == ascii_strcasecmp(argv[1], "reset")) {
+			return "profile reset\n"
+				"discard all the samples collected so far\n";
+		} else if (0 == ascii_strcasecmp(argv[1], "start")) {
+			return "profile start [-f HZ]\n"
+				"start sampling the CPU usage of all threads\n"
+				"-f : samples per second of CPU time, up to 1000 (default 97)\n";
+		} else if (0 == ascii_strcasecmp(argv[1], "status")) {
+			return "profile status\n"
+				"show profiler status and amount of samples\n";
+		} else if (0 == ascii_strcasecmp(argv[1], "stop")) {
+			return "profile stop\n"
+				"stop sampling, keeping the collected samples\n";
+		} else if (0 == ascii_strcasecmp(argv[1], "top")) {
+			return "profile top [COUNT]\n"
+				"show the COUNT subsystems where most samples were taken\n"
+				"a subsystem is the prefix of the routine names, 0 = all\n";
+		}
+	} else {
+		return
+			"profile folded\n"
+			"profile reset\n"
+			"profile start [-f HZ]\n"
+			"profile status\n"
+			"profile stop\n"
+			"profile top [COUNT]\n"
+			"Use \"help profile <cmd>\" for additional information\n";
+	}
+	return NULL;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
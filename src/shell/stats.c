@@ -191,6 +191,58 @@ shell_exec_stats_drop(struct gnutella_shell *sh,
 	return REPLY_READY;
 }
 
+static enum shell_reply
+shell_exec_stats_latency(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	const char *all;
+	const option_t options[] = {
+		{ "a", &all },			/* show all message types */
+	};
+	int parsed;
+	int i;
+	struct gnet_stats_latency *h;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	parsed = shell_options_parse(sh, argv, options, N_ITEMS(options));
+	if (parsed < 0)
+		return REPLY_ERROR;
+
+	/*
+	 * Histograms are too large for the thread stack.
+	 */
+
+	XMALLOC(h);
+
+	shell_write_linef(sh, REPLY_READY,
+		"%-28s %10s %9s %9s %9s %9s %9s %9s",
+		"Message", "Count", "Mean (us)", "p50", "p90", "p99", "p99.9", "Max");
+
+	for (i = 0; i < MSG_TOTAL; i++) {
+		gnet_stats_latency_get(i, h);
+
+		if (0 == h->count && NULL == all)
+			continue;
+
+		shell_write_linef(sh, REPLY_READY,
+			"%-28s %10s %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f",
+			gnet_msg_type_description(i),
+			uint64_to_string(h->count),
+			0 == h->count ? 0.0 : h->total_ns / 1e3 / h->count,
+			gnet_stats_latency_percentile(h, 0.50) / 1e3,
+			gnet_stats_latency_percentile(h, 0.90) / 1e3,
+			gnet_stats_latency_percentile(h, 0.99) / 1e3,
+			gnet_stats_latency_percentile(h, 0.999) / 1e3,
+			h->max_ns / 1e3);
+	}
+
+	XFREE_NULL(h);
+	return REPLY_READY;
+}
+
 /**
  * Handle the stats command.
  */
@@ -213,6 +265,7 @@ shell_exec_stats(struct gnutella_shell *sh, int argc, const char *argv[])
 
 	CMD(general);
 	CMD(drop);
+	CMD(latency);
 
 #undef CMD
 
@@ -245,10 +298,16 @@ shell_help_stats(int argc, const char *argv[])
 				"-t : only show TCP messages.\n"
 				"-u : only show UDP messages.\n";
 		}
+		else if (0 == ascii_strcasecmp(argv[1], "latency")) {
+			return "stats latency [-a]\n"
+				"prints the message processing latency distribution.\n"
+				"-a : also show message types not seen yet.\n";
+		}
 	} else {
 		return
 			"stats [general] [-p]\n"
 			"stats drop [-ptu]\n"
+			"stats latency [-a]\n"
 			;
 	}
 	return NULL;
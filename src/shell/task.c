@@ -37,6 +37,8 @@
 
 #include "lib/ascii.h"
 #include "lib/bg.h"
+#include "lib/cblat.h"
+#include "lib/parse.h"
 #include "lib/pslist.h"
 #include "lib/str.h"
 #include "lib/stringify.h"			/* For compact_time_ms() */
@@ -127,7 +129,7 @@ shell_exec_task_list(struct gnutella_shell *sh,
 				str_putc(s, 'c');
 			else
 				str_putc(s, '-');
-			str_putc(s, bi->daemon ? 'd' : '-');
+			str_putc(s, bi->daemon ? 'd' : bi->pooled ? 'p' : '-');
 			str_putc(s, bi->running ? 'R' : 'S');
 			str_putc(s, ' ');
 			str_catf(s, "%-1zu ", bi->signals);
@@ -159,6 +161,110 @@ shell_exec_task_list(struct gnutella_shell *sh,
 	return REPLY_READY;
 }
 
+static enum shell_reply
+shell_exec_task_latency(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	const char *opt_n;
+	const option_t options[] = {
+		{ "n:", &opt_n },		/* amount of events to list */
+	};
+	int parsed;
+	uint32 max = 20;
+	str_t *s;
+
+	shell_check(sh);
+
+	parsed = shell_options_parse(sh, argv, options, N_ITEMS(options));
+	if (parsed < 0)
+		return REPLY_ERROR;
+
+	argc -= parsed;		/* counts only command arguments now */
+
+	if (0 != argc)
+		return REPLY_ERROR;
+
+	if (opt_n != NULL) {
+		int error;
+
+		max = parse_uint32(opt_n, NULL, 10, &error);
+		if (error) {
+			shell_set_formatted(sh, "Invalid count \"%s\"", opt_n);
+			return REPLY_ERROR;
+		}
+	}
+
+	if (!cblat_enabled()) {
+		shell_write_line(sh, REPLY_READY,
+			"Callback latency tracking is off, see \"thread latency on\"");
+	}
+
+	s = cblat_top(CBLAT_CQ, max);
+	shell_write(sh, "100~\n");
+	shell_write(sh, str_2c(s));
+	shell_write(sh, ".\n");
+	str_destroy_null(&s);
+
+	return REPLY_READY;
+}
+
+static enum shell_reply
+shell_exec_task_pool(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	pslist_t *info, *sl;
+	size_t workers = 0;
+	str_t *s;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	if (argc != 1)
+		return REPLY_ERROR;
+
+	shell_write(sh, "100~\n");
+	shell_write(sh,
+		"T  Tasks Run-Q Ended      Steps Stolen Marshal  Run-time Name (Pool)\n");
+
+	info = bg_sched_info_list();
+	s = str_new(80);
+
+	PSLIST_FOREACH(info, sl) {
+		bgsched_info_t *bsi = sl->data;
+
+		bgsched_info_check(bsi);
+
+		if (NULL == bsi->pool)
+			continue;
+
+		workers++;
+
+		if (THREAD_INVALID_ID == bsi->stid)
+			str_printf(s, "%-2s ", "-");
+		else
+			str_printf(s, "%-2d ", bsi->stid);
+		str_catf(s, "%-5d ", bsi->runcount);
+		str_catf(s, "%-5d ", bsi->runq_count);
+		str_catf(s, "%-5zu ", bsi->completed);
+		str_catf(s, "%10zu ", bsi->steps);
+		str_catf(s, "%6zu ", bsi->stolen);
+		str_catf(s, "%7zu ", bsi->marshalled);
+		str_catf(s, "%9s ", compact_time_ms(bsi->wtime));
+		str_catf(s, "\"%s\" (%s)\n", bsi->name, bsi->pool);
+		shell_write(sh, str_2c(s));
+	}
+
+	if (0 == workers)
+		shell_write(sh, "No worker pool defined\n");
+
+	str_destroy_null(&s);
+	bg_sched_info_list_free_null(&info);
+	shell_write(sh, ".\n");
+
+	return REPLY_READY;
+}
+
 /**
  * Handles the task command.
  */
@@ -177,7 +283,9 @@ shell_exec_task(struct gnutella_shell *sh, int argc, const char *argv[])
 		return shell_exec_task_ ## name(sh, argc - 1, argv + 1); \
 } G_STMT_END
 
+	CMD(latency);
 	CMD(list);
+	CMD(pool);
 
 #undef CMD
 
@@ -198,13 +306,23 @@ shell_help_task(int argc, const char *argv[])
 	g_assert(argc > 0);
 
 	if (argc > 1) {
-		if (0 == ascii_strcasecmp(argv[1], "list")) {
+		if (0 == ascii_strcasecmp(argv[1], "latency")) {
+			return "task latency [-n COUNT]\n"
+				"show callout events where the event loops spent most time\n"
+				"-n : amount of events to show, 0 = all (default 20)\n";
+		} else if (0 == ascii_strcasecmp(argv[1], "list")) {
 			return "task list [-s]\n"
 				"list all running background tasks\n"
 				"-s: show schedulers instead of tasks\n";
+		} else if (0 == ascii_strcasecmp(argv[1], "pool")) {
+			return "task pool\n"
+				"show activity of the worker pool threads\n";
 		}
 	} else {
-		return "task list [-s]\n";
+		return
+			"task latency [-n COUNT]\n"
+			"task list [-s]\n"
+			"task pool\n";
 	}
 	return NULL;
 }
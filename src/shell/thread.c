@@ -36,9 +36,12 @@
 #include "cmd.h"
 
 #include "lib/ascii.h"
+#include "lib/cblat.h"
 #include "lib/dump_options.h"
+#include "lib/lockprof.h"
 #include "lib/log.h"
 #include "lib/options.h"
+#include "lib/parse.h"
 #include "lib/pow2.h"			/* For popcount() */
 #include "lib/stacktrace.h"		/* For stacktrace_function_name() */
 #include "lib/str.h"
@@ -223,6 +226,143 @@ shell_exec_thread_elements(struct gnutella_shell *sh,
 	return REPLY_READY;
 }
 
+static enum shell_reply
+shell_exec_thread_latency(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	const char *opt_n, *opt_t;
+	const option_t options[] = {
+		{ "n:", &opt_n },		/* amount of callbacks to list */
+		{ "t:", &opt_t },		/* slow callback threshold */
+	};
+	int parsed, error;
+	uint32 max = 20;
+	str_t *s;
+
+	shell_check(sh);
+
+	parsed = shell_options_parse(sh, argv, options, N_ITEMS(options));
+	if (parsed < 0)
+		return REPLY_ERROR;
+
+	argv += parsed;		/* args[0] is first command argument */
+	argc -= parsed;		/* counts only command arguments now */
+
+	if (argc > 1)
+		return REPLY_ERROR;
+
+	if (opt_n != NULL) {
+		max = parse_uint32(opt_n, NULL, 10, &error);
+		if (error) {
+			shell_set_formatted(sh, "Invalid count \"%s\"", opt_n);
+			return REPLY_ERROR;
+		}
+	}
+
+	if (opt_t != NULL) {
+		uint32 ms = parse_uint32(opt_t, NULL, 10, &error);
+		if (error) {
+			shell_set_formatted(sh, "Invalid threshold \"%s\"", opt_t);
+			return REPLY_ERROR;
+		}
+		cblat_set_threshold(ms);
+	}
+
+	if (1 == argc) {
+		if (0 == ascii_strcasecmp(argv[0], "on")) {
+			cblat_enable(TRUE);
+			shell_set_formatted(sh,
+				"Callback latency tracking enabled, threshold %u ms",
+				cblat_threshold());
+		} else if (0 == ascii_strcasecmp(argv[0], "off")) {
+			cblat_enable(FALSE);
+			shell_set_msg(sh, "Callback latency tracking disabled");
+		} else if (0 == ascii_strcasecmp(argv[0], "reset")) {
+			cblat_reset();
+			shell_set_msg(sh, "Callback latency statistics cleared");
+		} else {
+			shell_set_formatted(sh, _("Unknown operation \"%s\""), argv[0]);
+			return REPLY_ERROR;
+		}
+		return REPLY_READY;
+	}
+
+	shell_write_linef(sh, REPLY_READY,
+		"Callback latency tracking is %s, slow threshold %u ms",
+		cblat_enabled() ? "on" : "off", cblat_threshold());
+
+	s = cblat_top(CBLAT_IO, max);
+	shell_write(sh, "100~\n");
+	shell_write(sh, str_2c(s));
+	shell_write(sh, ".\n");
+	str_destroy_null(&s);
+
+	return REPLY_READY;
+}
+
+static enum shell_reply
+shell_exec_thread_locks(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	const char *opt_n;
+	const option_t options[] = {
+		{ "n:", &opt_n },		/* amount of lock sites to list */
+	};
+	int parsed;
+	uint32 max = 20;
+	str_t *s;
+
+	shell_check(sh);
+
+	parsed = shell_options_parse(sh, argv, options, N_ITEMS(options));
+	if (parsed < 0)
+		return REPLY_ERROR;
+
+	argv += parsed;		/* args[0] is first command argument */
+	argc -= parsed;		/* counts only command arguments now */
+
+	if (argc > 1)
+		return REPLY_ERROR;
+
+	if (opt_n != NULL) {
+		int error;
+
+		max = parse_uint32(opt_n, NULL, 10, &error);
+		if (error) {
+			shell_set_formatted(sh, "Invalid count \"%s\"", opt_n);
+			return REPLY_ERROR;
+		}
+	}
+
+	if (1 == argc) {
+		if (0 == ascii_strcasecmp(argv[0], "on")) {
+			lockprof_enable(TRUE);
+			shell_set_msg(sh, "Lock profiling enabled");
+		} else if (0 == ascii_strcasecmp(argv[0], "off")) {
+			lockprof_enable(FALSE);
+			shell_set_msg(sh, "Lock profiling disabled");
+		} else if (0 == ascii_strcasecmp(argv[0], "reset")) {
+			lockprof_reset();
+			shell_set_msg(sh, "Lock profiling statistics cleared");
+		} else {
+			shell_set_formatted(sh, _("Unknown operation \"%s\""), argv[0]);
+			return REPLY_ERROR;
+		}
+		return REPLY_READY;
+	}
+
+	shell_write_linef(sh, REPLY_READY, "Lock profiling is %s",
+		lockprof_enabled() ? "on" : "off");
+
+	s = lockprof_top(max);
+	shell_write(sh, "100~\n");
+	shell_write(sh, str_2c(s));
+	shell_write(sh, ".\n");
+	str_destroy_null(&s);
+
+	return REPLY_READY;
+}
+
 /**
  * Handles the thread command.
  */
@@ -244,6 +384,8 @@ shell_exec_thread(struct gnutella_shell *sh, int argc, const char *argv[])
 	CMD(list);
 	CMD(stats);
 	CMD(elements);
+	CMD(latency);
+	CMD(locks);
 
 #undef CMD
 
@@ -273,6 +415,22 @@ shell_help_thread(int argc, const char *argv[])
 				"list all initialized thread elements\n"
 				"-a : include all elements, even the reusable ones\n";
 		}
+		else if (0 == ascii_strcasecmp(argv[1], "latency")) {
+			return "thread latency [-n COUNT] [-t MS] [on|off|reset]\n"
+				"show I/O callbacks where the event loops spent most time\n"
+				"on, off: enable or disable callback latency tracking\n"
+				"reset: discard statistics collected so far\n"
+				"-n : amount of callbacks to show, 0 = all (default 20)\n"
+				"-t : flag callbacks lasting longer than MS, with a stack trace\n"
+				"     taken whilst they are still running, 0 = never\n";
+		}
+		else if (0 == ascii_strcasecmp(argv[1], "locks")) {
+			return "thread locks [-n COUNT] [on|off|reset]\n"
+				"show lock sites with the most contention\n"
+				"on, off: enable or disable lock profiling\n"
+				"reset: discard statistics collected so far\n"
+				"-n : amount of lock sites to show, 0 = all (default 20)\n";
+		}
 		else if (0 == ascii_strcasecmp(argv[1], "stats")) {
 			return "thread stats [-p]\n"
 				"show thread global statistics\n"
@@ -282,6 +440,8 @@ shell_help_thread(int argc, const char *argv[])
 		return
 			"thread list\n"
 			"thread elements [-a]\n"
+			"thread latency [-n COUNT] [-t MS] [on|off|reset]\n"
+			"thread locks [-n COUNT] [on|off|reset]\n"
 			"thread stats [-p]\n"
 			;
 	}
@@ -178,6 +178,11 @@ typedef void *(*get_fn_t)(const void *obj);
 
 typedef void *(*process_fn_t)(void *);
 
+/* Statistics enumeration: counter callback and enumerating routine */
+
+typedef void (*stats_fn_t)(const char *name, uint64 value, void *udata);
+typedef void (*stats_foreach_fn_t)(stats_fn_t cb, void *udata);
+
 /* Generic stringifiers */
 
 typedef const char *(*stringify_fn_t)(const void *data);
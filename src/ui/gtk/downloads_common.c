@@ -570,6 +570,11 @@ downloads_gui_status_string(const struct download *d)
 				rw += str_bprintf(&tmpstr[rw], sizeof(tmpstr)-rw,
 					_("; Moving (%.02f%%)"),
 					((gdouble) fi->copied / fi->size) * 100.0);
+				if (fi->copy_elapsed) {
+					rw += str_bprintf(&tmpstr[rw], sizeof(tmpstr)-rw,
+						" %s", short_rate(fi->copied / fi->copy_elapsed,
+							show_metric_units()));
+				}
 				break;
 			case GTA_DL_DONE:
 				if (fi->copy_elapsed) {